@@ -13,7 +13,8 @@ SOURCE_FILES=($PACKAGE/Callables.java \
               $PACKAGE/Iterator.java \
               $PACKAGE/Map.java \
               $PACKAGE/Options.java \
-              $PACKAGE/Utils.java)
+              $PACKAGE/Utils.java \
+              $PACKAGE/WorkloadDriver.java)
 
 MAJOR_VERSION=$(grep MAJOR src/cpp/multimap/Version.hpp | grep -Po '[0-9]+(?=;)')
 MINOR_VERSION=$(grep MINOR src/cpp/multimap/Version.hpp | grep -Po '[0-9]+(?=;)')
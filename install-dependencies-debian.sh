@@ -6,5 +6,5 @@
 set -e  # Exit on error
 # set -x  # Display commands
 
-apt-get install libboost-filesystem-dev libboost-system-dev libboost-thread-dev
+apt-get install libboost-filesystem-dev libboost-system-dev libboost-thread-dev zlib1g-dev
 
@@ -0,0 +1,12 @@
+MULTIMAP_TESTS = multimap-tests.pro
+!include($$MULTIMAP_TESTS) {
+    error("Could not find $$MULTIMAP_TESTS file")
+}
+
+TARGET = multimap-bench
+CONFIG -= debug
+CONFIG += release
+
+SOURCES -= src/cpp/multimap/thirdparty/googlemock/src/gmock_main.cc
+SOURCES += src/cpp/multimap/benchmark_main.cpp
+# Runs the disabled benchmark tests only, see internal/Benchmark.hpp.
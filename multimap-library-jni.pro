@@ -18,6 +18,7 @@ INCLUDEPATH += \
     $$JAVA_HOME/include/darwin
 
 HEADERS += \
+    src/cpp/multimap/jni/generated/io_multimap_EntryScanner_Native.h \
     src/cpp/multimap/jni/generated/io_multimap_Iterator_Native.h \
     src/cpp/multimap/jni/generated/io_multimap_Map_Limits_Native.h \
     src/cpp/multimap/jni/generated/io_multimap_Map_Native.h \
@@ -25,6 +26,7 @@ HEADERS += \
 
 SOURCES += \
     src/cpp/multimap/jni/common.cpp \
+    src/cpp/multimap/jni/io_multimap_EntryScanner_Native.cpp \
     src/cpp/multimap/jni/io_multimap_Iterator_Native.cpp \
     src/cpp/multimap/jni/io_multimap_Map_Limits_Native.cpp \
     src/cpp/multimap/jni/io_multimap_Map_Native.cpp
@@ -0,0 +1,8 @@
+MULTIMAP_LIBRARY = multimap-library.pro
+!include($$MULTIMAP_LIBRARY) {
+    error("Could not find $$MULTIMAP_LIBRARY file")
+}
+
+DEFINES += MULTIMAP_LOCK_PROFILING
+TARGET = multimap-prof
+# Records lock contention, see src/cpp/multimap/internal/LockProfiler.hpp.
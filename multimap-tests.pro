@@ -20,6 +20,7 @@ INCLUDEPATH += \
     src/cpp/multimap/thirdparty/googletest/include
 
 HEADERS += \
+    src/cpp/multimap/internal/Benchmark.hpp \
     src/cpp/multimap/internal/Generator.hpp \
     src/cpp/multimap/thirdparty/googlemock/include/gmock/internal/custom/gmock-generated-actions.h \
     src/cpp/multimap/thirdparty/googlemock/include/gmock/internal/custom/gmock-matchers.h \
@@ -67,12 +68,37 @@ HEADERS += \
 SOURCES += \
     src/cpp/multimap/internal/ArenaTest.cpp \
     src/cpp/multimap/internal/Base64Test.cpp \
+    src/cpp/multimap/internal/BlockCacheTest.cpp \
     src/cpp/multimap/internal/BlockTest.cpp \
+    src/cpp/multimap/internal/BloomFilterTest.cpp \
+    src/cpp/multimap/internal/Crc32cTest.cpp \
+    src/cpp/multimap/internal/DumpTest.cpp \
+    src/cpp/multimap/internal/GateTest.cpp \
+    src/cpp/multimap/internal/HotKeysTest.cpp \
+    src/cpp/multimap/internal/IoLimiterTest.cpp \
+    src/cpp/multimap/internal/KeyDirectoryTest.cpp \
+    src/cpp/multimap/internal/KeyIndexTest.cpp \
+    src/cpp/multimap/internal/ListMapTest.cpp \
     src/cpp/multimap/internal/ListTest.cpp \
+    src/cpp/multimap/internal/LockProfilerTest.cpp \
+    src/cpp/multimap/internal/MetricsTest.cpp \
+    src/cpp/multimap/internal/MpscQueueTest.cpp \
+    src/cpp/multimap/internal/NumaTest.cpp \
+    src/cpp/multimap/internal/PartitionBuilderTest.cpp \
     src/cpp/multimap/internal/PartitionTest.cpp \
+    src/cpp/multimap/internal/ProtocolTest.cpp \
+    src/cpp/multimap/internal/SharedMutexTest.cpp \
+    src/cpp/multimap/internal/SkipIndexTest.cpp \
+    src/cpp/multimap/internal/SorterTest.cpp \
+    src/cpp/multimap/internal/SpscQueueTest.cpp \
+    src/cpp/multimap/internal/StatsPublisherTest.cpp \
     src/cpp/multimap/internal/StoreTest.cpp \
+    src/cpp/multimap/internal/ThreadPoolTest.cpp \
+    src/cpp/multimap/internal/TuningTest.cpp \
     src/cpp/multimap/internal/UintVectorTest.cpp \
     src/cpp/multimap/internal/VarintTest.cpp \
+    src/cpp/multimap/internal/WalTest.cpp \
+    src/cpp/multimap/internal/WorkStealingPoolTest.cpp \
     src/cpp/multimap/thirdparty/googlemock/src/gmock_main.cc \
     src/cpp/multimap/thirdparty/googlemock/src/gmock-cardinalities.cc \
     src/cpp/multimap/thirdparty/googlemock/src/gmock-internal-utils.cc \
@@ -88,7 +114,16 @@ SOURCES += \
     src/cpp/multimap/thirdparty/googletest/src/gtest.cc \
     src/cpp/multimap/BytesTest.cpp \
     src/cpp/multimap/callablesTest.cpp \
-    src/cpp/multimap/MapTest.cpp
+    src/cpp/multimap/DedupMapTest.cpp \
+    src/cpp/multimap/DeltaMapTest.cpp \
+    src/cpp/multimap/EntryCursorTest.cpp \
+    src/cpp/multimap/EntryScannerTest.cpp \
+    src/cpp/multimap/FixedMapTest.cpp \
+    src/cpp/multimap/FrozenMapTest.cpp \
+    src/cpp/multimap/IngesterTest.cpp \
+    src/cpp/multimap/MapBuilderTest.cpp \
+    src/cpp/multimap/MapTest.cpp \
+    src/cpp/multimap/ServerTest.cpp
 
 # Only enable for memory leak checking with Google Address Sanitizer.
 # Caution: You may experience increased memory usage.
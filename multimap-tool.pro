@@ -8,7 +8,7 @@ QMAKE_CXXFLAGS += -std=c++11  # for Qt4 compatibility
 
 SOURCES += src/cpp/multimap/command_line_tool.cpp
 
-unix: LIBS += -lboost_system -lmultimap
+unix: LIBS += -lboost_filesystem -lboost_system -lmultimap -lpthread
 
 unix {
     target.path = /usr/local/bin
@@ -0,0 +1,21 @@
+TEMPLATE = app
+TARGET = multimap-workload
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+QMAKE_CXXFLAGS += -std=c++11  # for Qt4 compatibility
+
+SOURCES += src/cpp/multimap/workload_driver.cpp
+
+unix: LIBS += -lboost_filesystem -lboost_system -lmultimap -lpthread
+
+unix {
+    target.path = /usr/local/bin
+    INSTALLS += target
+}
+
+macx {
+    INCLUDEPATH += /usr/local/include
+    LIBS += -L/usr/local/lib
+}
@@ -1,7 +1,7 @@
 CONFIG -= qt
 CONFIG += c++11
 DEFINES -= QT_WEBKIT
-VERSION = 0.5.0
+VERSION = 0.6.0
 
 QMAKE_CXXFLAGS += -std=c++11  # for Qt4 compatibility
 QMAKE_LFLAGS += -rdynamic     # for GNU backtrace
@@ -14,40 +14,118 @@ HEADERS += \
     src/cpp/multimap/internal/Arena.hpp \
     src/cpp/multimap/internal/Base64.hpp \
     src/cpp/multimap/internal/Block.hpp \
+    src/cpp/multimap/internal/BlockCache.hpp \
+    src/cpp/multimap/internal/BloomFilter.hpp \
+    src/cpp/multimap/internal/Checkpointer.hpp \
+    src/cpp/multimap/internal/Compactor.hpp \
+    src/cpp/multimap/internal/Crc32c.hpp \
+    src/cpp/multimap/internal/Dump.hpp \
+    src/cpp/multimap/internal/Flusher.hpp \
+    src/cpp/multimap/internal/Gate.hpp \
+    src/cpp/multimap/internal/HotKeys.hpp \
+    src/cpp/multimap/internal/IoLimiter.hpp \
+    src/cpp/multimap/internal/KeyDirectory.hpp \
+    src/cpp/multimap/internal/KeyIndex.hpp \
     src/cpp/multimap/internal/List.hpp \
+    src/cpp/multimap/internal/ListMap.hpp \
+    src/cpp/multimap/internal/LockProfiler.hpp \
     src/cpp/multimap/internal/Locks.hpp \
+    src/cpp/multimap/internal/MemoryUsage.hpp \
+    src/cpp/multimap/internal/Metrics.hpp \
+    src/cpp/multimap/internal/MpscQueue.hpp \
+    src/cpp/multimap/internal/Numa.hpp \
     src/cpp/multimap/internal/Partition.hpp \
+    src/cpp/multimap/internal/PartitionBuilder.hpp \
+    src/cpp/multimap/internal/Protocol.hpp \
     src/cpp/multimap/internal/SharedMutex.hpp \
+    src/cpp/multimap/internal/SkipIndex.hpp \
+    src/cpp/multimap/internal/Sorter.hpp \
+    src/cpp/multimap/internal/Spiller.hpp \
+    src/cpp/multimap/internal/SpscQueue.hpp \
     src/cpp/multimap/internal/Stats.hpp \
+    src/cpp/multimap/internal/StatsPublisher.hpp \
     src/cpp/multimap/internal/Store.hpp \
+    src/cpp/multimap/internal/ThreadPool.hpp \
+    src/cpp/multimap/internal/Tuning.hpp \
     src/cpp/multimap/internal/UintVector.hpp \
     src/cpp/multimap/internal/Varint.hpp \
+    src/cpp/multimap/internal/Wal.hpp \
+    src/cpp/multimap/internal/WorkStealingPool.hpp \
+    src/cpp/multimap/internal/Workload.hpp \
     src/cpp/multimap/thirdparty/mt/mt.hpp \
     src/cpp/multimap/thirdparty/xxhash/xxhash.h \
     src/cpp/multimap/Bytes.hpp \
     src/cpp/multimap/callables.hpp \
+    src/cpp/multimap/Client.hpp \
+    src/cpp/multimap/DedupMap.hpp \
+    src/cpp/multimap/DeltaMap.hpp \
+    src/cpp/multimap/EntryCursor.hpp \
+    src/cpp/multimap/EntryScanner.hpp \
+    src/cpp/multimap/FixedMap.hpp \
+    src/cpp/multimap/FrozenMap.hpp \
+    src/cpp/multimap/Ingester.hpp \
     src/cpp/multimap/Iterator.hpp \
     src/cpp/multimap/Map.hpp \
-    src/cpp/multimap/Version.hpp
+    src/cpp/multimap/MapBuilder.hpp \
+    src/cpp/multimap/Server.hpp \
+    src/cpp/multimap/Version.hpp \
+    src/cpp/multimap/WriteBatch.hpp
 
 SOURCES += \
     src/cpp/multimap/internal/Arena.cpp \
     src/cpp/multimap/internal/Base64.cpp \
+    src/cpp/multimap/internal/BlockCache.cpp \
+    src/cpp/multimap/internal/BloomFilter.cpp \
+    src/cpp/multimap/internal/Checkpointer.cpp \
+    src/cpp/multimap/internal/Compactor.cpp \
+    src/cpp/multimap/internal/Crc32c.cpp \
+    src/cpp/multimap/internal/Dump.cpp \
+    src/cpp/multimap/internal/Flusher.cpp \
+    src/cpp/multimap/internal/Gate.cpp \
+    src/cpp/multimap/internal/HotKeys.cpp \
+    src/cpp/multimap/internal/IoLimiter.cpp \
+    src/cpp/multimap/internal/KeyDirectory.cpp \
+    src/cpp/multimap/internal/KeyIndex.cpp \
     src/cpp/multimap/internal/List.cpp \
+    src/cpp/multimap/internal/ListMap.cpp \
+    src/cpp/multimap/internal/LockProfiler.cpp \
+    src/cpp/multimap/internal/MemoryUsage.cpp \
+    src/cpp/multimap/internal/Metrics.cpp \
+    src/cpp/multimap/internal/Numa.cpp \
     src/cpp/multimap/internal/Partition.cpp \
+    src/cpp/multimap/internal/PartitionBuilder.cpp \
+    src/cpp/multimap/internal/Protocol.cpp \
     src/cpp/multimap/internal/SharedMutex.cpp \
+    src/cpp/multimap/internal/SkipIndex.cpp \
+    src/cpp/multimap/internal/Sorter.cpp \
+    src/cpp/multimap/internal/Spiller.cpp \
     src/cpp/multimap/internal/Stats.cpp \
+    src/cpp/multimap/internal/StatsPublisher.cpp \
     src/cpp/multimap/internal/Store.cpp \
+    src/cpp/multimap/internal/ThreadPool.cpp \
+    src/cpp/multimap/internal/Tuning.cpp \
     src/cpp/multimap/internal/UintVector.cpp \
     src/cpp/multimap/internal/Varint.cpp \
+    src/cpp/multimap/internal/Wal.cpp \
+    src/cpp/multimap/internal/WorkStealingPool.cpp \
     src/cpp/multimap/thirdparty/mt/mt.cpp \
     src/cpp/multimap/thirdparty/xxhash/xxhash.c \
+    src/cpp/multimap/Client.cpp \
+    src/cpp/multimap/DedupMap.cpp \
+    src/cpp/multimap/DeltaMap.cpp \
+    src/cpp/multimap/EntryCursor.cpp \
+    src/cpp/multimap/EntryScanner.cpp \
+    src/cpp/multimap/FrozenMap.cpp \
+    src/cpp/multimap/Ingester.cpp \
     src/cpp/multimap/Map.cpp \
+    src/cpp/multimap/MapBuilder.cpp \
+    src/cpp/multimap/Server.cpp \
     src/cpp/multimap/Version.cpp \
+    src/cpp/multimap/WriteBatch.cpp \
 
-unix:!macx: LIBS += -lboost_filesystem -lboost_system -lboost_thread -lpthread
+unix:!macx: LIBS += -lboost_filesystem -lboost_system -lboost_thread -lpthread -lz
 
 macx {
     INCLUDEPATH += /usr/local/include
-    LIBS += -L/usr/local/lib -lboost_filesystem -lboost_system -lboost_thread-mt
+    LIBS += -L/usr/local/lib -lboost_filesystem -lboost_system -lboost_thread-mt -lz
 }
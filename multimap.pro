@@ -1,12 +1,17 @@
 TEMPLATE = subdirs
 
 SUBDIRS = \
+  multimap-bench.pro \
+  multimap-formats.pro \
   multimap-library.pro \
   multimap-library-dbg.pro \
   multimap-library-jni.pro \
   multimap-library-jni-dbg.pro \
+  multimap-library-prof.pro \
+  multimap-server.pro \
   multimap-tests.pro \
-  multimap-tool.pro
+  multimap-tool.pro \
+  multimap-workload.pro
 
 # In order to generate Makefiles, object files, and build targets in the
 # project's root directory you need to disable Shadow build in QtCreator.
@@ -0,0 +1,191 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/Client.hpp"
+
+#include <cerrno>
+#include <cstring>  // For std::memset
+#include <memory>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "multimap/internal/Varint.hpp"
+
+namespace multimap {
+
+namespace {
+
+typedef internal::Protocol Protocol;
+
+const size_t RECEIVE_BUFFER_SIZE = mt::KiB(64);
+
+std::vector<std::string> toStrings(const std::vector<Bytes>& keys) {
+  std::vector<std::string> strings;
+  strings.reserve(keys.size());
+  for (const auto& key : keys) {
+    strings.push_back(key.toString());
+  }
+  return strings;
+}
+
+}  // namespace
+
+Client::Client(const std::string& host, uint16_t port) {
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addresses = nullptr;
+  const auto result = ::getaddrinfo(host.c_str(), std::to_string(port).c_str(),
+                                    &hints, &addresses);
+  mt::Check::isZero(result, "Client: Cannot resolve '%s' because of '%s'",
+                    host.c_str(), ::gai_strerror(result));
+  std::unique_ptr<addrinfo, decltype(&::freeaddrinfo)> guard(addresses,
+                                                              ::freeaddrinfo);
+  int error = 0;
+  for (auto address = addresses; address; address = address->ai_next) {
+    mt::AutoCloseFd socket(::socket(address->ai_family, address->ai_socktype,
+                                    address->ai_protocol));
+    if (socket.get() == -1) {
+      error = errno;
+      continue;
+    }
+    if (::connect(socket.get(), address->ai_addr, address->ai_addrlen) == 0) {
+      socket_ = std::move(socket);
+      break;
+    }
+    error = errno;
+  }
+  mt::Check::isTrue(socket_.get() != mt::AutoCloseFd::NO_FD,
+                    "Client: Cannot connect to '%s:%u' because of '%s'",
+                    host.c_str(), port, std::strerror(error));
+  const int one = 1;
+  ::setsockopt(socket_.get(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+}
+
+void Client::put(const Bytes& key, const Bytes& value) {
+  call(Message(Protocol::Opcode::PUT, {key.toString(), value.toString()}));
+}
+
+void Client::put(const Bytes& key, const std::vector<std::string>& values) {
+  std::vector<std::string> fields;
+  fields.reserve(values.size() + 1);
+  fields.push_back(key.toString());
+  fields.insert(fields.end(), values.begin(), values.end());
+  call(Message(Protocol::Opcode::PUT, std::move(fields)));
+}
+
+std::vector<std::string> Client::get(const Bytes& key) {
+  return call(Message(Protocol::Opcode::GET, {key.toString()})).fields;
+}
+
+bool Client::contains(const Bytes& key) {
+  const auto response =
+      call(Message(Protocol::Opcode::CONTAINS, {key.toString()}));
+  mt::Check::isEqual(response.fields.size(), size_t(1),
+                     "Client: Invalid response to CONTAINS");
+  return response.fields.front() == std::string(1, true);
+}
+
+uint32_t Client::remove(const Bytes& key) {
+  const auto response =
+      call(Message(Protocol::Opcode::REMOVE, {key.toString()}));
+  uint32_t num_values_removed = 0;
+  mt::Check::isTrue(response.fields.size() == 1 &&
+                        internal::Varint::readUint(
+                            response.fields.front().data(),
+                            response.fields.front().size(),
+                            &num_values_removed) != 0,
+                    "Client: Invalid response to REMOVE");
+  return num_values_removed;
+}
+
+std::vector<std::vector<std::string> > Client::getMany(
+    const std::vector<Bytes>& keys) {
+  const auto response =
+      call(Message(Protocol::Opcode::GET_MANY, toStrings(keys)));
+  mt::Check::isEqual(response.fields.size(), keys.size(),
+                     "Client: Invalid response to GET_MANY");
+  std::vector<std::vector<std::string> > lists;
+  lists.reserve(keys.size());
+  for (const auto& field : response.fields) {
+    lists.push_back(Protocol::parseFields(field.data(), field.size()));
+  }
+  return lists;
+}
+
+std::vector<bool> Client::containsMany(const std::vector<Bytes>& keys) {
+  const auto response =
+      call(Message(Protocol::Opcode::CONTAINS_MANY, toStrings(keys)));
+  mt::Check::isTrue(response.fields.size() == 1 &&
+                        response.fields.front().size() == keys.size(),
+                    "Client: Invalid response to CONTAINS_MANY");
+  std::vector<bool> flags;
+  flags.reserve(keys.size());
+  for (const auto flag : response.fields.front()) {
+    flags.push_back(flag != 0);
+  }
+  return flags;
+}
+
+void Client::send(const Message& request) {
+  Protocol::append(request, &output_);
+  ++num_pending_;
+}
+
+void Client::flush() {
+  if (!output_.empty()) {
+    Protocol::sendAll(socket_.get(), output_);
+    output_.clear();
+  }
+}
+
+Client::Message Client::receive() {
+  MT_REQUIRE_NOT_ZERO(num_pending_);
+  flush();
+  Message response;
+  std::vector<char> buffer(RECEIVE_BUFFER_SIZE);
+  while (true) {
+    const auto size =
+        Protocol::parse(input_.data(), input_.size(), &response);
+    if (size != 0) {
+      input_.erase(0, size);
+      break;
+    }
+    const auto nbytes = ::recv(socket_.get(), buffer.data(), buffer.size(), 0);
+    if (nbytes == -1 && errno == EINTR) continue;
+    mt::Check::notEqual(nbytes, -1, "recv() failed because of '%s'",
+                        mt::errnostr());
+    mt::Check::notZero(nbytes, "Client: Connection closed by server");
+    input_.append(buffer.data(), nbytes);
+  }
+  --num_pending_;
+  if (response.code != static_cast<uint8_t>(Protocol::Status::OK)) {
+    mt::fail("%s", response.fields.empty() ? "Unknown error"
+                                           : response.fields.front().c_str());
+  }
+  return response;
+}
+
+Client::Message Client::call(const Message& request) {
+  MT_REQUIRE_ZERO(num_pending_);
+  send(request);
+  return receive();
+}
+
+}  // namespace multimap
@@ -0,0 +1,86 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_CLIENT_HPP_INCLUDED
+#define MULTIMAP_CLIENT_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include "multimap/internal/Protocol.hpp"
+#include "multimap/thirdparty/mt/mt.hpp"
+#include "multimap/Bytes.hpp"
+
+namespace multimap {
+
+class Client : public mt::Resource {
+  // A connection to a `Server`.  The member functions that mirror those of
+  // `Map` send one request and wait for its response.  In order to avoid a
+  // round trip per request, send a batch of requests via `send()` and then
+  // read their responses via `receive()`, or use the batch operations.
+  // Since the server does not read further requests while it cannot send
+  // responses, the responses to a batch should be received before the next
+  // batch is sent.
+  // A client must not be used by multiple threads at the same time.
+  // Errors reported by the server are thrown as `std::runtime_error`.
+
+ public:
+  typedef internal::Protocol::Message Message;
+
+  Client(const std::string& host, uint16_t port);
+
+  void put(const Bytes& key, const Bytes& value);
+
+  void put(const Bytes& key, const std::vector<std::string>& values);
+
+  std::vector<std::string> get(const Bytes& key);
+  // Returns copies of all values of `key`, which is empty if `key` is not
+  // found.
+
+  bool contains(const Bytes& key);
+
+  uint32_t remove(const Bytes& key);
+
+  std::vector<std::vector<std::string> > getMany(
+      const std::vector<Bytes>& keys);
+  // Same as `get()` for each key, but with a single request.
+
+  std::vector<bool> containsMany(const std::vector<Bytes>& keys);
+  // Same as `contains()` for each key, but with a single request.
+
+  void send(const Message& request);
+  // Buffers `request`, which is sent with the next call of `flush()` or
+  // `receive()`.
+
+  void flush();
+  // Sends all buffered requests.
+
+  Message receive();
+  // Returns the response to the oldest request whose response has not been
+  // received yet.  Throws if the response has `Protocol::Status::ERROR`.
+
+ private:
+  Message call(const Message& request);
+
+  mt::AutoCloseFd socket_;
+  std::string input_;
+  std::string output_;
+  size_t num_pending_ = 0;
+};
+
+}  // namespace multimap
+
+#endif  // MULTIMAP_CLIENT_HPP_INCLUDED
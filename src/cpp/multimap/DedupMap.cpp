@@ -0,0 +1,251 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/DedupMap.hpp"
+
+#include <cstring>
+#include <unordered_map>
+#include <boost/filesystem/operations.hpp>
+#include "multimap/internal/Locks.hpp"
+#include "multimap/thirdparty/xxhash/xxhash.h"
+
+namespace multimap {
+
+namespace {
+
+typedef internal::ReaderLockGuard<boost::shared_mutex> ReaderLock;
+typedef internal::WriterLockGuard<boost::shared_mutex> WriterLock;
+
+// Each value in a list is prefixed by a tag that tells inline values and
+// references apart.  A reference is followed by the hash of the value.
+
+const char INLINE = 0;
+const char REFERENCE = 1;
+
+// A stored value is a list of two values: its reference count, which has
+// 8 bytes, and the value itself, which has more.
+
+std::string hashValue(const Bytes& value) {
+  const uint64_t hashes[] = {XXH64(value.data(), value.size(), 0),
+                             XXH64(value.data(), value.size(), 1)};
+  return std::string(reinterpret_cast<const char*>(hashes), sizeof hashes);
+}
+
+std::string tag(char tag, const Bytes& value) {
+  std::string tagged(1, tag);
+  tagged.append(value.begin(), value.end());
+  return tagged;
+}
+
+std::string getHash(const Bytes& tagged) {
+  return std::string(tagged.data() + 1, tagged.size() - 1);
+}
+
+std::string encodeCount(uint64_t count) {
+  return std::string(reinterpret_cast<const char*>(&count), sizeof count);
+}
+
+uint64_t decodeCount(const Bytes& value) {
+  uint64_t count;
+  std::memcpy(&count, value.data(), sizeof count);
+  return count;
+}
+
+}  // namespace
+
+DedupMap::DedupMap(const boost::filesystem::path& directory)
+    : DedupMap(directory, Options()) {}
+
+DedupMap::DedupMap(const boost::filesystem::path& directory,
+                   const Options& options)
+    : min_value_size_(options.min_value_size) {
+  mt::Check::isTrue(options.min_value_size > sizeof(uint64_t),
+                    "DedupMap: min_value_size must be greater than %zu",
+                    sizeof(uint64_t));
+  const auto lists_directory = directory / getNameOfListsDirectory();
+  const auto values_directory = directory / getNameOfValuesDirectory();
+  if (!boost::filesystem::is_directory(lists_directory)) {
+    mt::Check::isTrue(options.create_if_missing,
+                      "No dedup map found in '%s'",
+                      boost::filesystem::absolute(directory).c_str());
+    boost::filesystem::create_directory(lists_directory);
+    boost::filesystem::create_directory(values_directory);
+  }
+  auto map_options = options.map_options;
+  map_options.create_if_missing = options.create_if_missing;
+  lists_.reset(new Map(lists_directory, map_options));
+  values_.reset(new Map(values_directory, map_options));
+}
+
+void DedupMap::put(const Bytes& key, const Bytes& value) {
+  ReaderLock lock(mutex_);
+  if (value.size() < min_value_size_) {
+    lists_->put(key, tag(INLINE, value));
+    return;
+  }
+  const auto hash = hashValue(value);
+  {
+    std::lock_guard<std::mutex> stripe_lock(getStripe(hash));
+    uint64_t count = 0;
+    std::string stored;
+    if (!findStored(hash, &count, &stored)) {
+      values_->put(hash, encodeCount(1));
+      values_->put(hash, value);
+    } else if (Bytes(stored) == value) {
+      values_->replaceOne(hash, encodeCount(count), encodeCount(count + 1));
+    } else {
+      // Another value has the same hash.
+      lists_->put(key, tag(INLINE, value));
+      return;
+    }
+  }
+  // The reference is counted before it is written, so that a crash in
+  // between leaves a value that is collected as garbage, but no dangling
+  // reference.
+  lists_->put(key, tag(REFERENCE, hash));
+}
+
+std::vector<std::string> DedupMap::get(const Bytes& key) const {
+  std::vector<std::string> values;
+  ReaderLock lock(mutex_);
+  lists_->forEachValue(key, [this, &values](const Bytes& tagged) {
+    values.push_back(resolve(tagged));
+  });
+  return values;
+}
+
+uint64_t DedupMap::collectGarbage() {
+  WriterLock lock(mutex_);
+  std::unordered_map<std::string, uint64_t> counts;
+  lists_->forEachEntry([&counts](const Bytes&, Iterator* iter) {
+    while (iter->hasNext()) {
+      const auto tagged = iter->next();
+      if (tagged.data()[0] == REFERENCE) {
+        ++counts[getHash(tagged)];
+      }
+    }
+  });
+  std::vector<std::string> hashes;
+  values_->forEachKey(
+      [&hashes](const Bytes& hash) { hashes.push_back(hash.toString()); });
+  uint64_t num_removed = 0;
+  for (const auto& hash : hashes) {
+    const auto iter = counts.find(hash);
+    uint64_t count = 0;
+    findStored(hash, &count, nullptr);
+    if (iter == counts.end()) {
+      values_->remove(hash);
+      ++num_removed;
+    } else if (count != iter->second) {
+      values_->replaceOne(hash, encodeCount(count),
+                          encodeCount(iter->second));
+    }
+  }
+  return num_removed;
+}
+
+DedupMap::Stats DedupMap::getStats() const {
+  Stats stats;
+  ReaderLock lock(mutex_);
+  values_->forEachEntry([&stats](const Bytes&, Iterator* iter) {
+    uint64_t count = 0;
+    uint64_t size = 0;
+    while (iter->hasNext()) {
+      const auto value = iter->next();
+      if (value.size() == sizeof count) {
+        count = decodeCount(value);
+      } else {
+        size = value.size();
+      }
+    }
+    ++stats.num_stored_values;
+    stats.num_stored_bytes += size;
+    stats.num_references += count;
+    stats.num_referenced_bytes += count * size;
+  });
+  return stats;
+}
+
+std::string DedupMap::getNameOfListsDirectory() { return "lists"; }
+
+std::string DedupMap::getNameOfValuesDirectory() { return "values"; }
+
+uint32_t DedupMap::removeValues(
+    const Bytes& key, const std::function<bool(const Bytes&)>& predicate) {
+  std::vector<std::string> hashes;
+  ReaderLock lock(mutex_);
+  const auto num_removed =
+      lists_->removeAll(key, [&](const Bytes& tagged) {
+        const bool is_reference = tagged.data()[0] == REFERENCE;
+        if (predicate) {
+          const auto value =
+              is_reference ? resolve(tagged)
+                           : std::string(tagged.data() + 1, tagged.size() - 1);
+          if (!predicate(value)) return false;
+        }
+        if (is_reference) hashes.push_back(getHash(tagged));
+        return true;
+      });
+  for (const auto& hash : hashes) {
+    release(hash);
+  }
+  return num_removed;
+}
+
+std::string DedupMap::resolve(const Bytes& tagged) const {
+  if (tagged.data()[0] == INLINE) {
+    return std::string(tagged.data() + 1, tagged.size() - 1);
+  }
+  std::string value;
+  uint64_t count = 0;
+  mt::Check::isTrue(findStored(getHash(tagged), &count, &value),
+                    "DedupMap: referenced value not found");
+  return value;
+}
+
+bool DedupMap::findStored(const std::string& hash, uint64_t* count,
+                          std::string* value) const {
+  bool found = false;
+  values_->forEachValue(hash, [&](const Bytes& stored) {
+    found = true;
+    if (stored.size() == sizeof *count) {
+      *count = decodeCount(stored);
+    } else if (value) {
+      *value = stored.toString();
+    }
+  });
+  return found;
+}
+
+void DedupMap::release(const std::string& hash) {
+  std::lock_guard<std::mutex> stripe_lock(getStripe(hash));
+  uint64_t count = 0;
+  if (!findStored(hash, &count, nullptr)) return;
+  if (count <= 1) {
+    values_->remove(hash);
+  } else {
+    values_->replaceOne(hash, encodeCount(count), encodeCount(count - 1));
+  }
+}
+
+std::mutex& DedupMap::getStripe(const std::string& hash) const {
+  uint64_t index;
+  std::memcpy(&index, hash.data(), sizeof index);
+  return stripes_[index % NUM_STRIPES];
+}
+
+}  // namespace multimap
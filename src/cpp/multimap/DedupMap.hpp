@@ -0,0 +1,134 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_DEDUP_MAP_HPP_INCLUDED
+#define MULTIMAP_DEDUP_MAP_HPP_INCLUDED
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <boost/thread/shared_mutex.hpp>
+#include "multimap/Map.hpp"
+
+namespace multimap {
+
+class DedupMap : public mt::Resource {
+  // A map that stores each value of at least `Options::min_value_size` bytes
+  // only once, no matter how many lists contain it, for data where the same
+  // payload is fanned out to many keys.  Such values are kept in a second
+  // map, keyed by a 128-bit hash of their content, together with the number
+  // of references to them, while lists hold the hash instead.  Each value
+  // in a list is prefixed by a tag that tells inline values and references
+  // apart.  A value whose hash is taken by a different content, which is
+  // very unlikely, is stored inline.
+  //
+  // References are counted when values are put and removed.  Values that
+  // the underlying map drops on its own, e.g. when keys expire, leave their
+  // references counted until `collectGarbage()` recounts them.  The lists
+  // and the stored values are kept in two subdirectories.  Objects of this
+  // class are thread-safe.
+
+ public:
+  struct Options {
+    Map::Options map_options;
+    // Options of both maps.  `create_if_missing` is taken from below.
+
+    uint32_t min_value_size = 64;
+    // Values of fewer bytes are stored inline, since a reference takes 17.
+    // Must be greater than 8.
+
+    bool create_if_missing = false;
+  };
+
+  struct Stats {
+    uint64_t num_stored_values = 0;
+    uint64_t num_stored_bytes = 0;
+    // Number and total size of the values stored once.
+
+    uint64_t num_references = 0;
+    uint64_t num_referenced_bytes = 0;
+    // Number of values in lists that refer to a stored value, and the number
+    // of bytes they would take if they were stored inline.
+  };
+
+  explicit DedupMap(const boost::filesystem::path& directory);
+
+  DedupMap(const boost::filesystem::path& directory, const Options& options);
+
+  void put(const Bytes& key, const Bytes& value);
+  // Compares `value` with the stored value of the same hash, if any, before
+  // adding a reference, which reads the stored value.
+
+  std::vector<std::string> get(const Bytes& key) const;
+  // Returns copies of the values of `key` in the order they were put.
+
+  bool contains(const Bytes& key) const { return lists_->contains(key); }
+
+  uint32_t remove(const Bytes& key) { return removeValues(key, nullptr); }
+  // Removes all values of `key` and returns their number.
+
+  template <typename Predicate>
+  uint32_t removeAll(const Bytes& key, Predicate predicate) {
+    return removeValues(key, predicate);
+  }
+  // Removes all values of `key` for which `predicate` yields true and
+  // returns their number.
+
+  uint64_t collectGarbage();
+  // Recounts the references to each stored value by visiting all lists,
+  // removes values that are no longer referenced, and returns their number.
+  // Blocks all other operations meanwhile.
+
+  Stats getStats() const;
+  // Visits all stored values, but no lists.
+
+  static std::string getNameOfListsDirectory();
+
+  static std::string getNameOfValuesDirectory();
+
+ private:
+  static const size_t NUM_STRIPES = 64;
+
+  uint32_t removeValues(const Bytes& key,
+                        const std::function<bool(const Bytes&)>& predicate);
+
+  std::string resolve(const Bytes& tagged) const;
+  // Returns the value that a value of a list stands for.
+
+  bool findStored(const std::string& hash, uint64_t* count,
+                  std::string* value) const;
+
+  void release(const std::string& hash);
+  // Drops a reference and removes the stored value with the last one.
+
+  std::mutex& getStripe(const std::string& hash) const;
+  // Serializes updates of the reference count of the value with `hash`.
+
+  std::unique_ptr<Map> lists_;
+  std::unique_ptr<Map> values_;
+  const uint32_t min_value_size_;
+  mutable boost::shared_mutex mutex_;
+  // Updates and lookups take a reader lock, `collectGarbage()` a writer lock.
+  mutable std::mutex stripes_[NUM_STRIPES];
+};
+
+}  // namespace multimap
+
+#endif  // MULTIMAP_DEDUP_MAP_HPP_INCLUDED
@@ -0,0 +1,188 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <string>
+#include <type_traits>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/DedupMap.hpp"
+
+namespace multimap {
+
+using testing::ElementsAre;
+using testing::Eq;
+using testing::IsEmpty;
+
+TEST(DedupMapTest, IsNotDefaultConstructible) {
+  ASSERT_FALSE(std::is_default_constructible<DedupMap>::value);
+}
+
+TEST(DedupMapTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<DedupMap>::value);
+  ASSERT_FALSE(std::is_copy_assignable<DedupMap>::value);
+}
+
+struct DedupMapTestFixture : public testing::Test {
+  void SetUp() override {
+    boost::filesystem::remove_all(directory);
+    boost::filesystem::create_directory(directory);
+    options.create_if_missing = true;
+    options.min_value_size = 16;
+    options.map_options.num_partitions = 3;
+  }
+
+  void TearDown() override { boost::filesystem::remove_all(directory); }
+
+  static std::string makeLargeValue(int i) {
+    return std::string(100, 'a' + i % 26) + std::to_string(i);
+  }
+
+  const boost::filesystem::path directory = "/tmp/multimap.DedupMapTest";
+  DedupMap::Options options;
+};
+
+TEST_F(DedupMapTestFixture, ConstructorThrowsIfNoDedupMapExists) {
+  ASSERT_THROW(DedupMap map(directory), std::runtime_error);
+}
+
+TEST_F(DedupMapTestFixture, ConstructorThrowsIfMinValueSizeIsTooSmall) {
+  options.min_value_size = 8;
+  ASSERT_THROW(DedupMap map(directory, options), std::runtime_error);
+}
+
+TEST_F(DedupMapTestFixture, GetReturnsInlineAndStoredValuesInOrder) {
+  DedupMap map(directory, options);
+  map.put("k", "small");
+  map.put("k", makeLargeValue(1));
+  map.put("k", "tiny");
+  map.put("k", makeLargeValue(1));
+  ASSERT_THAT(map.get("k"), ElementsAre("small", makeLargeValue(1), "tiny",
+                                        makeLargeValue(1)));
+  ASSERT_TRUE(map.contains("k"));
+  ASSERT_FALSE(map.contains("x"));
+  ASSERT_THAT(map.get("x"), IsEmpty());
+}
+
+TEST_F(DedupMapTestFixture, EqualValuesAreStoredOnce) {
+  DedupMap map(directory, options);
+  for (int k = 0; k != 100; ++k) {
+    map.put(std::to_string(k), makeLargeValue(k % 5));
+    map.put(std::to_string(k), "small");
+  }
+  const auto stats = map.getStats();
+  ASSERT_THAT(stats.num_stored_values, Eq(5));
+  ASSERT_THAT(stats.num_references, Eq(100));
+  ASSERT_THAT(stats.num_stored_bytes, Eq(5 * makeLargeValue(0).size()));
+  ASSERT_THAT(stats.num_referenced_bytes,
+              Eq(100 * makeLargeValue(0).size()));
+  for (int k = 0; k != 100; ++k) {
+    ASSERT_THAT(map.get(std::to_string(k)),
+                ElementsAre(makeLargeValue(k % 5), "small"));
+  }
+}
+
+TEST_F(DedupMapTestFixture, RemovingLastReferenceRemovesStoredValue) {
+  DedupMap map(directory, options);
+  map.put("k1", makeLargeValue(1));
+  map.put("k1", makeLargeValue(2));
+  map.put("k2", makeLargeValue(1));
+  ASSERT_THAT(map.getStats().num_stored_values, Eq(2));
+
+  ASSERT_THAT(map.remove("k1"), Eq(2));
+  ASSERT_THAT(map.get("k1"), IsEmpty());
+  ASSERT_THAT(map.get("k2"), ElementsAre(makeLargeValue(1)));
+  auto stats = map.getStats();
+  ASSERT_THAT(stats.num_stored_values, Eq(1));
+  ASSERT_THAT(stats.num_references, Eq(1));
+
+  ASSERT_THAT(map.remove("k2"), Eq(1));
+  stats = map.getStats();
+  ASSERT_THAT(stats.num_stored_values, Eq(0));
+  ASSERT_THAT(stats.num_references, Eq(0));
+}
+
+TEST_F(DedupMapTestFixture, RemoveAllPassesOriginalValuesToPredicate) {
+  DedupMap map(directory, options);
+  map.put("k", makeLargeValue(1));
+  map.put("k", "small");
+  map.put("k", makeLargeValue(2));
+  map.put("k", makeLargeValue(1));
+  const auto is_large_value_1 = [](const Bytes& value) {
+    return value == makeLargeValue(1);
+  };
+  ASSERT_THAT(map.removeAll("k", is_large_value_1), Eq(2));
+  ASSERT_THAT(map.get("k"), ElementsAre("small", makeLargeValue(2)));
+  const auto stats = map.getStats();
+  ASSERT_THAT(stats.num_stored_values, Eq(1));
+  ASSERT_THAT(stats.num_references, Eq(1));
+}
+
+TEST_F(DedupMapTestFixture, ValuesSurviveReopening) {
+  {
+    DedupMap map(directory, options);
+    for (int k = 0; k != 10; ++k) {
+      map.put(std::to_string(k), makeLargeValue(0));
+    }
+  }
+  DedupMap map(directory, options);
+  for (int k = 0; k != 10; ++k) {
+    ASSERT_THAT(map.get(std::to_string(k)), ElementsAre(makeLargeValue(0)));
+  }
+  map.put("k", makeLargeValue(0));
+  ASSERT_THAT(map.getStats().num_references, Eq(11));
+}
+
+TEST_F(DedupMapTestFixture, CollectGarbageKeepsReferencedValues) {
+  DedupMap map(directory, options);
+  for (int k = 0; k != 100; ++k) {
+    map.put(std::to_string(k), makeLargeValue(k % 7));
+  }
+  map.remove("0");
+  ASSERT_THAT(map.collectGarbage(), Eq(0));
+  const auto stats = map.getStats();
+  ASSERT_THAT(stats.num_stored_values, Eq(7));
+  ASSERT_THAT(stats.num_references, Eq(99));
+  for (int k = 1; k != 100; ++k) {
+    ASSERT_THAT(map.get(std::to_string(k)),
+                ElementsAre(makeLargeValue(k % 7)));
+  }
+}
+
+TEST_F(DedupMapTestFixture, CollectGarbageRemovesUnreferencedValues) {
+  {
+    DedupMap map(directory, options);
+    map.put("k1", makeLargeValue(1));
+    map.put("k2", makeLargeValue(2));
+    map.put("k3", makeLargeValue(2));
+  }
+  {
+    Map lists(directory / DedupMap::getNameOfListsDirectory());
+    lists.remove("k1");
+    lists.remove("k2");
+  }
+  // Values dropped by the underlying map, e.g. when keys expire, are not
+  // released.
+  DedupMap map(directory, options);
+  ASSERT_THAT(map.getStats().num_references, Eq(3));
+  ASSERT_THAT(map.collectGarbage(), Eq(1));
+  const auto stats = map.getStats();
+  ASSERT_THAT(stats.num_stored_values, Eq(1));
+  ASSERT_THAT(stats.num_references, Eq(1));
+  ASSERT_THAT(map.get("k3"), ElementsAre(makeLargeValue(2)));
+}
+
+}  // namespace multimap
@@ -0,0 +1,301 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/DeltaMap.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <boost/filesystem/operations.hpp>
+#include "multimap/internal/Locks.hpp"
+
+namespace multimap {
+
+namespace {
+
+typedef internal::ReaderLockGuard<boost::shared_mutex> ReaderLock;
+typedef internal::WriterLockGuard<boost::shared_mutex> WriterLock;
+
+// Each value in a delta is prefixed by a tag that tells values and
+// tombstones apart.  A tombstone hides all values put before it.
+
+const char VALUE = 0;
+const char TOMBSTONE = 1;
+
+const char* BASE_PREFIX = "base.";
+const char* DELTA_PREFIX = "delta.";
+
+std::string makeName(const char* prefix, uint64_t id) {
+  return prefix + std::to_string(id);
+}
+
+uint64_t getId(const std::string& name) {
+  return std::stoull(name.substr(name.find('.') + 1));
+}
+
+bool startsWith(const std::string& str, const char* prefix) {
+  return str.compare(0, std::strlen(prefix), prefix) == 0;
+}
+
+void applyDelta(const Map& delta, const Bytes& key,
+                std::vector<std::string>* values) {
+  delta.forEachValue(key, [values](const Bytes& value) {
+    if (value.data()[0] == TOMBSTONE) {
+      values->clear();
+    } else {
+      values->emplace_back(value.data() + 1, value.size() - 1);
+    }
+  });
+}
+
+class VectorIter : public Iterator {
+ public:
+  explicit VectorIter(const std::vector<std::string>& values)
+      : values_(values) {}
+
+  uint32_t available() const override { return values_.size() - index_; }
+
+  bool hasNext() const override { return index_ != values_.size(); }
+
+  Bytes next() override { return values_[index_++]; }
+
+  Bytes peekNext() override { return values_[index_]; }
+
+  uint32_t skip(uint32_t num_values) override {
+    num_values = std::min(num_values, available());
+    index_ += num_values;
+    return num_values;
+  }
+
+ private:
+  const std::vector<std::string>& values_;
+  size_t index_ = 0;
+};
+
+}  // namespace
+
+DeltaMap::DeltaMap(const boost::filesystem::path& directory)
+    : DeltaMap(directory, Options()) {}
+
+DeltaMap::DeltaMap(const boost::filesystem::path& directory,
+                   const Options& options)
+    : lock_(directory, Map::getNameOfLockFile()),
+      directory_(directory),
+      delta_options_(options.delta_options) {
+  delta_options_.create_if_missing = true;
+  delta_options_.error_if_exists = false;
+  const auto manifest = directory / getNameOfManifestFile();
+  if (boost::filesystem::exists(manifest)) {
+    for (const auto& name : mt::Files::readAllLines(manifest)) {
+      if (startsWith(name, BASE_PREFIX)) {
+        base_.reset(new FrozenMap(directory / name));
+        base_name_ = name;
+      } else if (startsWith(name, DELTA_PREFIX)) {
+        deltas_.emplace_back(new Map(directory / name, delta_options_));
+        delta_names_.push_back(name);
+      } else {
+        continue;
+      }
+      next_id_ = std::max(next_id_, getId(name) + 1);
+    }
+  } else {
+    mt::Check::isTrue(options.create_if_missing,
+                      "No delta map found in '%s'",
+                      boost::filesystem::absolute(directory).c_str());
+  }
+  if (deltas_.empty()) {
+    addDelta();
+  }
+  if (options.merge_interval != 0) {
+    merger_ = std::thread(&DeltaMap::runMerger, this,
+                          std::chrono::seconds(options.merge_interval));
+  }
+}
+
+DeltaMap::~DeltaMap() {
+  if (merger_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(merger_mutex_);
+      stop_merger_ = true;
+    }
+    merger_cond_.notify_one();
+    merger_.join();
+  }
+}
+
+void DeltaMap::put(const Bytes& key, const Bytes& value) {
+  std::string tagged(1, VALUE);
+  tagged.append(value.begin(), value.end());
+  ReaderLock lock(mutex_);
+  deltas_.back()->put(key, tagged);
+}
+
+void DeltaMap::remove(const Bytes& key) {
+  ReaderLock lock(mutex_);
+  deltas_.back()->remove(key);
+  deltas_.back()->put(key, Bytes(&TOMBSTONE, 1));
+}
+
+std::vector<std::string> DeltaMap::get(const Bytes& key) const {
+  std::vector<std::string> values;
+  ReaderLock lock(mutex_);
+  if (base_) {
+    base_->forEachValue(key, [&values](const Bytes& value) {
+      values.push_back(value.toString());
+    });
+  }
+  for (const auto& delta : deltas_) {
+    applyDelta(*delta, key, &values);
+  }
+  return values;
+}
+
+void DeltaMap::merge() {
+  std::lock_guard<std::mutex> merge_lock(merge_mutex_);
+  FrozenMap* base;
+  std::vector<Map*> deltas;
+  uint64_t id;
+  {
+    WriterLock lock(mutex_);
+    base = base_.get();
+    for (const auto& delta : deltas_) {
+      deltas.push_back(delta.get());
+    }
+    id = next_id_;
+    addDelta();
+  }
+  // The old deltas do not receive updates anymore, and neither they nor the
+  // old base are removed by anyone else while `merge_mutex_` is held.
+
+  const auto new_base_name = makeName(BASE_PREFIX, id);
+  const auto new_base_directory = directory_ / new_base_name;
+  boost::filesystem::remove_all(new_base_directory);
+  // Might be left over from a merge that has been interrupted.
+  {
+    FrozenMap::Builder builder(new_base_directory);
+    std::vector<std::string> values;
+    if (base) {
+      base->forEachEntry([&](const Bytes& key, Iterator* iter) {
+        values.clear();
+        while (iter->hasNext()) {
+          values.push_back(iter->next().toString());
+        }
+        for (const auto delta : deltas) {
+          applyDelta(*delta, key, &values);
+        }
+        VectorIter values_iter(values);
+        builder.put(key, &values_iter);
+      });
+    }
+    std::vector<std::string> delta_keys;
+    for (const auto delta : deltas) {
+      delta->forEachKey([&](const Bytes& key) {
+        if (!base || !base->contains(key)) {
+          delta_keys.push_back(key.toString());
+        }
+      });
+    }
+    std::sort(delta_keys.begin(), delta_keys.end());
+    delta_keys.erase(std::unique(delta_keys.begin(), delta_keys.end()),
+                     delta_keys.end());
+    for (const auto& key : delta_keys) {
+      values.clear();
+      for (const auto delta : deltas) {
+        applyDelta(*delta, key, &values);
+      }
+      VectorIter values_iter(values);
+      builder.put(key, &values_iter);
+    }
+    builder.finish();
+  }
+
+  std::unique_ptr<FrozenMap> new_base(new FrozenMap(new_base_directory));
+  std::vector<std::string> obsolete_names;
+  Deltas obsolete_deltas;
+  {
+    WriterLock lock(mutex_);
+    if (base_) {
+      obsolete_names.push_back(base_name_);
+    }
+    base_.swap(new_base);
+    base_name_ = new_base_name;
+    const auto num_merged = deltas.size();
+    std::move(deltas_.begin(), deltas_.begin() + num_merged,
+              std::back_inserter(obsolete_deltas));
+    deltas_.erase(deltas_.begin(), deltas_.begin() + num_merged);
+    obsolete_names.insert(obsolete_names.end(), delta_names_.begin(),
+                          delta_names_.begin() + num_merged);
+    delta_names_.erase(delta_names_.begin(),
+                       delta_names_.begin() + num_merged);
+    writeManifest();
+  }
+  new_base.reset();
+  obsolete_deltas.clear();
+  for (const auto& name : obsolete_names) {
+    boost::filesystem::remove_all(directory_ / name);
+  }
+}
+
+void DeltaMap::runMerger(std::chrono::seconds interval) {
+  std::unique_lock<std::mutex> lock(merger_mutex_);
+  while (!merger_cond_.wait_for(lock, interval,
+                                [this] { return stop_merger_; })) {
+    lock.unlock();
+    try {
+      merge();
+    } catch (std::exception& error) {
+      mt::log() << "DeltaMap could not merge: " << error.what() << '\n';
+    }
+    lock.lock();
+  }
+}
+
+size_t DeltaMap::getNumDeltas() const {
+  ReaderLock lock(mutex_);
+  return deltas_.size();
+}
+
+std::string DeltaMap::getNameOfManifestFile() {
+  return "multimap.delta.manifest";
+}
+
+void DeltaMap::addDelta() {
+  const auto name = makeName(DELTA_PREFIX, next_id_++);
+  const auto delta_directory = directory_ / name;
+  boost::filesystem::remove_all(delta_directory);
+  boost::filesystem::create_directory(delta_directory);
+  deltas_.emplace_back(new Map(delta_directory, delta_options_));
+  delta_names_.push_back(name);
+  writeManifest();
+}
+
+void DeltaMap::writeManifest() const {
+  std::vector<std::string> names;
+  if (base_) {
+    names.push_back(base_name_);
+  }
+  names.insert(names.end(), delta_names_.begin(), delta_names_.end());
+  const auto manifest = directory_ / getNameOfManifestFile();
+  const auto temporary = directory_ / (getNameOfManifestFile() + ".tmp");
+  mt::Files::writeLinewise(names, temporary);
+  boost::filesystem::rename(temporary, manifest);
+  // Replaces the manifest atomically, so that a crash leaves either the old
+  // or the new set of layers.
+}
+
+}  // namespace multimap
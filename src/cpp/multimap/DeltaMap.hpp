@@ -0,0 +1,118 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_DELTA_MAP_HPP_INCLUDED
+#define MULTIMAP_DELTA_MAP_HPP_INCLUDED
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/thread/shared_mutex.hpp>
+#include "multimap/FrozenMap.hpp"
+#include "multimap/Map.hpp"
+
+namespace multimap {
+
+class DeltaMap : public mt::Resource {
+  // A writable map on top of an immutable base in the format of class
+  // `FrozenMap`, for maps that are served frozen but updated incrementally.
+  // Updates go to a small writable map, the delta, and lookups append the
+  // values of the delta to those of the base.  Removing a key writes a
+  // tombstone into the delta, which hides all values put before it,
+  // including those of the base.  `merge()` folds the delta into a new base,
+  // like compaction in a log-structured merge tree, while new updates go to
+  // a fresh delta.
+  //
+  // The base and the deltas are stored in subdirectories, which are listed by
+  // a manifest file.  Objects of this class are thread-safe.
+
+ public:
+  struct Options {
+    Map::Options delta_options;
+    // Options of the delta maps, which are created as needed.  Options that
+    // open maps read-only or that only apply to `optimize()` must not be set.
+
+    uint32_t merge_interval = 0;
+    // If not zero, a background thread calls `merge()` every this many
+    // seconds.
+
+    bool create_if_missing = false;
+  };
+
+  explicit DeltaMap(const boost::filesystem::path& directory);
+
+  DeltaMap(const boost::filesystem::path& directory, const Options& options);
+
+  ~DeltaMap();
+  // Waits for a running merge to finish.
+
+  void put(const Bytes& key, const Bytes& value);
+
+  void remove(const Bytes& key);
+  // Hides all values of `key`, including those in the base.
+
+  std::vector<std::string> get(const Bytes& key) const;
+  // Returns copies of the values of `key`: those of the base, followed by
+  // those put since in the order they were put.
+
+  bool contains(const Bytes& key) const { return !get(key).empty(); }
+
+  void merge();
+  // Writes a new base with the values of the current base and deltas, and
+  // removes them afterwards.  Updates and lookups are only blocked while the
+  // layers are switched.  Concurrent calls are serialized.
+
+  size_t getNumDeltas() const;
+  // Returns 1 unless a merge is running.
+
+  static std::string getNameOfManifestFile();
+
+ private:
+  typedef std::vector<std::unique_ptr<Map> > Deltas;
+
+  void addDelta();
+  void writeManifest() const;
+  // Require a writer lock on `mutex_`.
+
+  void runMerger(std::chrono::seconds interval);
+
+  mt::DirectoryLockGuard lock_;
+  boost::filesystem::path directory_;
+  Map::Options delta_options_;
+  mutable boost::shared_mutex mutex_;
+  // Protects the members below.  Updates and lookups take a reader lock.
+  std::unique_ptr<FrozenMap> base_;
+  std::string base_name_;
+  Deltas deltas_;
+  // Oldest first.  Only the last one receives updates.
+  std::vector<std::string> delta_names_;
+  uint64_t next_id_ = 0;
+
+  std::mutex merge_mutex_;
+  std::mutex merger_mutex_;
+  std::condition_variable merger_cond_;
+  bool stop_merger_ = false;
+  std::thread merger_;
+};
+
+}  // namespace multimap
+
+#endif  // MULTIMAP_DELTA_MAP_HPP_INCLUDED
@@ -0,0 +1,135 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <thread>
+#include <type_traits>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/DeltaMap.hpp"
+
+namespace multimap {
+
+using testing::ElementsAre;
+using testing::Eq;
+using testing::IsEmpty;
+
+TEST(DeltaMapTest, IsNotDefaultConstructible) {
+  ASSERT_FALSE(std::is_default_constructible<DeltaMap>::value);
+}
+
+TEST(DeltaMapTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<DeltaMap>::value);
+  ASSERT_FALSE(std::is_copy_assignable<DeltaMap>::value);
+}
+
+struct DeltaMapTestFixture : public testing::Test {
+  void SetUp() override {
+    boost::filesystem::remove_all(directory);
+    boost::filesystem::create_directory(directory);
+    options.create_if_missing = true;
+    options.delta_options.num_partitions = 3;
+  }
+
+  void TearDown() override { boost::filesystem::remove_all(directory); }
+
+  const boost::filesystem::path directory = "/tmp/multimap.DeltaMapTest";
+  DeltaMap::Options options;
+};
+
+TEST_F(DeltaMapTestFixture, ConstructorThrowsIfNoDeltaMapExists) {
+  ASSERT_THROW(DeltaMap map(directory), std::runtime_error);
+}
+
+TEST_F(DeltaMapTestFixture, GetAppendsDeltaValuesToBaseValues) {
+  DeltaMap map(directory, options);
+  map.put("k1", "a");
+  map.put("k2", "x");
+  map.merge();
+  map.put("k1", "b");
+  map.put("k3", "y");
+  ASSERT_THAT(map.get("k1"), ElementsAre("a", "b"));
+  ASSERT_THAT(map.get("k2"), ElementsAre("x"));
+  ASSERT_THAT(map.get("k3"), ElementsAre("y"));
+  ASSERT_THAT(map.get("k4"), IsEmpty());
+  ASSERT_FALSE(map.contains("k4"));
+}
+
+TEST_F(DeltaMapTestFixture, RemoveHidesBaseValuesUntilNextPut) {
+  DeltaMap map(directory, options);
+  map.put("k1", "a");
+  map.put("k2", "b");
+  map.merge();
+  map.remove("k1");
+  ASSERT_FALSE(map.contains("k1"));
+  map.put("k1", "c");
+  ASSERT_THAT(map.get("k1"), ElementsAre("c"));
+  map.remove("k2");
+  map.merge();
+  ASSERT_THAT(map.get("k1"), ElementsAre("c"));
+  ASSERT_FALSE(map.contains("k2"));
+}
+
+TEST_F(DeltaMapTestFixture, MergeFoldsDeltasIntoNewBase) {
+  DeltaMap map(directory, options);
+  for (int round = 0; round != 3; ++round) {
+    for (int k = 0; k != 100; ++k) {
+      map.put(std::to_string(k), std::to_string(round));
+    }
+    map.merge();
+    ASSERT_THAT(map.getNumDeltas(), Eq(1));
+  }
+  for (int k = 0; k != 100; ++k) {
+    ASSERT_THAT(map.get(std::to_string(k)), ElementsAre("0", "1", "2"));
+  }
+  // Only the manifest, the lock file, one base, and one delta are left.
+  ASSERT_THAT(std::distance(boost::filesystem::directory_iterator(directory),
+                            boost::filesystem::directory_iterator()),
+              Eq(4));
+}
+
+TEST_F(DeltaMapTestFixture, ReopenRestoresBaseAndDelta) {
+  {
+    DeltaMap map(directory, options);
+    map.put("k1", "a");
+    map.merge();
+    map.put("k1", "b");
+    map.remove("k2");
+  }
+  DeltaMap map(directory, options);
+  ASSERT_THAT(map.get("k1"), ElementsAre("a", "b"));
+  ASSERT_FALSE(map.contains("k2"));
+}
+
+TEST_F(DeltaMapTestFixture, UpdatesDuringMergeAreKept) {
+  DeltaMap map(directory, options);
+  for (int k = 0; k != 1000; ++k) {
+    map.put(std::to_string(k), "a");
+  }
+  std::thread writer([&map] {
+    for (int k = 0; k != 1000; ++k) {
+      map.put(std::to_string(k), "b");
+    }
+  });
+  map.merge();
+  writer.join();
+  map.merge();
+  for (int k = 0; k != 1000; ++k) {
+    ASSERT_THAT(map.get(std::to_string(k)), ElementsAre("a", "b"));
+  }
+}
+
+}  // namespace multimap
@@ -0,0 +1,55 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/EntryCursor.hpp"
+
+#include <cstring>
+
+namespace multimap {
+
+EntryCursor::EntryCursor(const Map& map, uint32_t num_threads,
+                         size_t batch_size)
+    : scanner_(map, num_threads, batch_size) {}
+
+bool EntryCursor::next() {
+  values_.clear();
+  if (pos_ == end_) {
+    const auto batch = scanner_.next();
+    if (!batch) return false;
+    pos_ = batch->data();
+    end_ = pos_ + batch->size();
+  }
+  key_ = readField(&pos_);
+  values_.push_back(readField(&pos_));
+  while (pos_ != end_) {
+    auto pos = pos_;
+    if (readField(&pos) != key_) break;
+    values_.push_back(readField(&pos));
+    pos_ = pos;
+  }
+  return true;
+}
+
+Bytes EntryCursor::readField(const char** pos) {
+  uint32_t size;
+  std::memcpy(&size, *pos, sizeof size);
+  const Bytes field(*pos + sizeof size, size);
+  *pos += sizeof size + size;
+  return field;
+}
+
+}  // namespace multimap
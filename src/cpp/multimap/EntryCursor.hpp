@@ -0,0 +1,76 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_ENTRY_CURSOR_HPP_INCLUDED
+#define MULTIMAP_ENTRY_CURSOR_HPP_INCLUDED
+
+#include <vector>
+#include "multimap/EntryScanner.hpp"
+
+namespace multimap {
+
+class EntryCursor : public mt::Resource {
+  // Pull-style iteration over the entries of a map, which yields a key
+  // together with a batch of its values at a time.  Unlike the callbacks of
+  // `Map::forEachEntry()`, the consumer decides when to advance, so that it
+  // can be suspended in between, e.g. by a coroutine that awaits a network
+  // or another store.  The entries are read by class EntryScanner, whose
+  // threads fill the next batches while the consumer works on the current
+  // one.
+  //
+  // The values of a key are yielded in one or more items, which need not
+  // be adjacent, since lists may be split across batches and batches of
+  // different partitions are interleaved.  The same restrictions as for
+  // class EntryScanner apply.
+  //
+  // Example:
+  //
+  //   EntryCursor cursor(map);
+  //   while (cursor.next()) {
+  //     send(cursor.key(), cursor.values());
+  //   }
+
+ public:
+  explicit EntryCursor(const Map& map, uint32_t num_threads = 0,
+                       size_t batch_size = EntryScanner::DEFAULT_BATCH_SIZE);
+  // See `EntryScanner::EntryScanner()`.
+
+  bool next();
+  // Advances to the next item and returns true, or false after the last
+  // one.  Rethrows exceptions of the scan, see `EntryScanner::next()`.
+
+  const Bytes& key() const { return key_; }
+
+  const std::vector<Bytes>& values() const { return values_; }
+  // The key and the values of the current item, which are valid until the
+  // next call of `next()`.  Requires: the last call of `next()` returned
+  // true.
+
+ private:
+  static Bytes readField(const char** pos);
+
+  EntryScanner scanner_;
+  const char* pos_ = nullptr;
+  const char* end_ = nullptr;
+  // The records of the current batch that have not been yielded yet.
+  Bytes key_;
+  std::vector<Bytes> values_;
+};
+
+}  // namespace multimap
+
+#endif  // MULTIMAP_ENTRY_CURSOR_HPP_INCLUDED
@@ -0,0 +1,103 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <map>
+#include <string>
+#include <type_traits>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/EntryCursor.hpp"
+
+namespace multimap {
+
+using testing::Eq;
+using testing::Gt;
+
+TEST(EntryCursorTest, IsNotDefaultConstructible) {
+  ASSERT_FALSE(std::is_default_constructible<EntryCursor>::value);
+}
+
+TEST(EntryCursorTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<EntryCursor>::value);
+  ASSERT_FALSE(std::is_copy_assignable<EntryCursor>::value);
+}
+
+struct EntryCursorTestFixture : public testing::Test {
+  void SetUp() override {
+    boost::filesystem::remove_all(directory);
+    boost::filesystem::create_directory(directory);
+    Map::Options options;
+    options.create_if_missing = true;
+    options.num_partitions = 7;
+    map.reset(new Map(directory, options));
+  }
+
+  void TearDown() override {
+    map.reset();
+    boost::filesystem::remove_all(directory);
+  }
+
+  const boost::filesystem::path directory =
+      "/tmp/multimap.EntryCursorTestFixture";
+  std::unique_ptr<Map> map;
+};
+
+TEST_F(EntryCursorTestFixture, YieldsAllValuesOfEachKeyInOrder) {
+  const auto num_keys = 1000;
+  for (auto k = 0; k != num_keys; ++k) {
+    for (auto v = 0; v != k % 50; ++v) {
+      map->put(std::to_string(k), std::to_string(v));
+    }
+  }
+  std::map<std::string, std::vector<std::string> > entries;
+  size_t num_items = 0;
+  EntryCursor cursor(*map, 3, mt::KiB(1));
+  while (cursor.next()) {
+    ASSERT_THAT(cursor.values().size(), Gt(0));
+    auto& values = entries[cursor.key().toString()];
+    for (const auto& value : cursor.values()) {
+      values.push_back(value.toString());
+    }
+    ++num_items;
+  }
+  ASSERT_FALSE(cursor.next());
+  ASSERT_THAT(entries.size(), Eq(num_keys - num_keys / 50));
+  // Lists that do not fit into one batch are yielded in several items.
+  ASSERT_THAT(num_items, Gt(entries.size()));
+  for (const auto& entry : entries) {
+    const auto k = std::stoi(entry.first);
+    ASSERT_THAT(entry.second.size(), Eq(k % 50));
+    for (size_t v = 0; v != entry.second.size(); ++v) {
+      ASSERT_THAT(entry.second[v], Eq(std::to_string(v)));
+    }
+  }
+}
+
+TEST_F(EntryCursorTestFixture, YieldsNothingForEmptyMap) {
+  EntryCursor cursor(*map);
+  ASSERT_FALSE(cursor.next());
+}
+
+TEST_F(EntryCursorTestFixture, CanBeDestroyedBeforeTheLastItem) {
+  for (auto k = 0; k != 1000; ++k) {
+    map->put(std::to_string(k), std::string(100, 'v'));
+  }
+  EntryCursor cursor(*map, 2, 256);
+  ASSERT_TRUE(cursor.next());
+}
+
+}  // namespace multimap
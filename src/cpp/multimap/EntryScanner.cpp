@@ -0,0 +1,138 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/EntryScanner.hpp"
+
+#include <cstring>
+#include "multimap/internal/WorkStealingPool.hpp"
+
+namespace multimap {
+
+namespace {
+
+char* writeUint32(uint32_t value, char* target) {
+  std::memcpy(target, &value, sizeof value);
+  return target + sizeof value;
+}
+
+}  // namespace
+
+const size_t EntryScanner::DEFAULT_BATCH_SIZE;
+const size_t EntryScanner::QUEUE_CAPACITY;
+
+EntryScanner::EntryScanner(const Map& map, uint32_t num_threads,
+                           size_t batch_size)
+    : map_(map), batch_size_(batch_size) {
+  const auto num_producers = map.getNumScanThreads(num_threads);
+  producers_.reserve(num_producers);
+  for (uint32_t i = 0; i != num_producers; ++i) {
+    producers_.emplace_back(new Producer());
+  }
+  thread_ = std::thread(&EntryScanner::scan, this, num_threads);
+}
+
+EntryScanner::~EntryScanner() {
+  cancelled_ = true;
+  thread_.join();
+}
+
+const EntryScanner::Batch* EntryScanner::next() {
+  if (consumed_) {
+    consumed_->clear();
+    consumed_producer_->empty.tryPush(std::move(consumed_));
+    consumed_.reset();
+    // The batch is dropped if the producer has enough spare ones.
+  }
+  while (true) {
+    const bool finished = finished_.load(std::memory_order_acquire);
+    for (size_t i = 0; i != producers_.size(); ++i) {
+      const auto producer = producers_[next_producer_].get();
+      next_producer_ = (next_producer_ + 1) % producers_.size();
+      if (producer->full.tryPop(&consumed_)) {
+        consumed_producer_ = producer;
+        return consumed_.get();
+      }
+    }
+    if (finished) {
+      if (error_) std::rethrow_exception(error_);
+      return nullptr;
+    }
+    std::this_thread::yield();
+  }
+}
+
+void EntryScanner::scan(uint32_t num_threads) {
+  try {
+    map_.forEachEntryInParallel(
+        [this](const Bytes& key, Iterator* iter) {
+          const auto producer = getProducer();
+          while (iter->hasNext()) {
+            append(producer, key, iter->next());
+          }
+        },
+        num_threads);
+    for (const auto& producer : producers_) {
+      if (producer->current && !producer->current->empty()) {
+        flush(producer.get());
+      }
+    }
+    // The scanning threads have been joined, so their last batches are
+    // passed on by this thread instead.
+  } catch (Cancelled&) {
+    // The consumer is gone.
+  } catch (...) {
+    error_ = std::current_exception();
+  }
+  finished_.store(true, std::memory_order_release);
+}
+
+EntryScanner::Producer* EntryScanner::getProducer() {
+  if (cancelled_) throw Cancelled();
+  const auto index = internal::WorkStealingPool::getCurrentWorkerIndex();
+  MT_ASSERT_LT(index, producers_.size());
+  return producers_[index].get();
+}
+
+void EntryScanner::append(Producer* producer, const Bytes& key,
+                          const Bytes& value) {
+  const auto size = 2 * sizeof(uint32_t) + key.size() + value.size();
+  if (producer->current && !producer->current->empty() &&
+      producer->current->size() + size > batch_size_) {
+    flush(producer);
+  }
+  if (!producer->current && !producer->empty.tryPop(&producer->current)) {
+    producer->current.reset(new Batch());
+    producer->current->reserve(batch_size_);
+  }
+  auto& batch = *producer->current;
+  const auto offset = batch.size();
+  batch.resize(offset + size);
+  auto target = writeUint32(key.size(), batch.data() + offset);
+  std::memcpy(target, key.data(), key.size());
+  target = writeUint32(value.size(), target + key.size());
+  std::memcpy(target, value.data(), value.size());
+}
+
+void EntryScanner::flush(Producer* producer) {
+  while (!producer->full.tryPush(std::move(producer->current))) {
+    if (cancelled_) throw Cancelled();
+    std::this_thread::yield();
+  }
+  producer->current.reset();
+}
+
+}  // namespace multimap
@@ -0,0 +1,107 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_ENTRY_SCANNER_HPP_INCLUDED
+#define MULTIMAP_ENTRY_SCANNER_HPP_INCLUDED
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "multimap/internal/SpscQueue.hpp"
+#include "multimap/Map.hpp"
+
+namespace multimap {
+
+class EntryScanner : public mt::Resource {
+  // Scans all entries of a map on background threads and hands them in
+  // batches to a single consumer thread, which is not blocked by the scan
+  // itself.  Partitions are scanned as by `Map::forEachEntryInParallel()`.
+  // Each scanning thread fills batches of its own and passes them through a
+  // lock-free single-producer single-consumer queue, and the consumer
+  // returns batches it is done with through a second queue for reuse.
+  //
+  // While the consumer lags behind, scanning threads wait with a partition
+  // being visited, which blocks updates of that partition.  The map must
+  // outlive the scanner.  `next()` must not be called concurrently.
+
+ public:
+  typedef std::vector<char> Batch;
+
+  static const size_t DEFAULT_BATCH_SIZE = mt::KiB(64);
+  static const size_t QUEUE_CAPACITY = 4;
+
+  explicit EntryScanner(const Map& map, uint32_t num_threads = 0,
+                        size_t batch_size = DEFAULT_BATCH_SIZE);
+  // Starts scanning with `num_threads` threads, or with one thread per
+  // hardware thread if zero.  Batches are flushed when appending the next
+  // entry would exceed `batch_size` bytes.
+
+  ~EntryScanner();
+  // Stops scanning if not finished yet and joins all threads.
+
+  const Batch* next();
+  // Returns the next batch or null after the last one.  The batch stays
+  // valid until the next call.  It consists of records, each of which is a
+  // `uint32_t` key size in native byte order, the key, a `uint32_t` value
+  // size, and the value.  A list is passed as one record per value, and
+  // lists may be split across batches.  Rethrows the first exception that
+  // occurred while scanning, after the batches produced before it.
+
+ private:
+  struct Producer {
+    Producer() : full(QUEUE_CAPACITY), empty(QUEUE_CAPACITY) {}
+
+    internal::SpscQueue<std::unique_ptr<Batch> > full;
+    internal::SpscQueue<std::unique_ptr<Batch> > empty;
+    std::unique_ptr<Batch> current;
+  };
+
+  struct Cancelled {};
+  // Thrown by scanning threads to leave the for-each loop early.
+
+  void scan(uint32_t num_threads);
+
+  Producer* getProducer();
+  // Returns the producer of the calling thread, which is selected by its
+  // index among the workers of the scanning thread pool.  A worker of the
+  // shared pool may take turns in several scans, but it keeps its index.
+
+  void append(Producer* producer, const Bytes& key, const Bytes& value);
+
+  void flush(Producer* producer);
+  // Passes the current batch to the consumer, waiting while the queue is
+  // full.  Throws `Cancelled` if the scanner is destroyed meanwhile.
+
+  const Map& map_;
+  const size_t batch_size_;
+  std::vector<std::unique_ptr<Producer> > producers_;
+  std::atomic<bool> cancelled_{false};
+  std::atomic<bool> finished_{false};
+  std::exception_ptr error_;
+  // Written by the scanning thread before `finished_` is set.
+
+  std::unique_ptr<Batch> consumed_;
+  Producer* consumed_producer_ = nullptr;
+  size_t next_producer_ = 0;
+  std::thread thread_;
+};
+
+}  // namespace multimap
+
+#endif  // MULTIMAP_ENTRY_SCANNER_HPP_INCLUDED
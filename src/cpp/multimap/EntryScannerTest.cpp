@@ -0,0 +1,122 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <type_traits>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/EntryScanner.hpp"
+
+namespace multimap {
+
+using testing::Eq;
+using testing::Gt;
+
+TEST(EntryScannerTest, IsNotDefaultConstructible) {
+  ASSERT_FALSE(std::is_default_constructible<EntryScanner>::value);
+}
+
+TEST(EntryScannerTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<EntryScanner>::value);
+  ASSERT_FALSE(std::is_copy_assignable<EntryScanner>::value);
+}
+
+struct EntryScannerTestWithParam : public testing::TestWithParam<uint32_t> {
+  void SetUp() override {
+    boost::filesystem::remove_all(directory);
+    boost::filesystem::create_directory(directory);
+    Map::Options options;
+    options.create_if_missing = true;
+    options.num_partitions = 7;
+    map.reset(new Map(directory, options));
+  }
+
+  void TearDown() override {
+    map.reset();
+    boost::filesystem::remove_all(directory);
+  }
+
+  static std::string readField(const char** pos) {
+    uint32_t size = 0;
+    std::memcpy(&size, *pos, sizeof size);
+    const std::string field(*pos + sizeof size, size);
+    *pos += sizeof size + size;
+    return field;
+  }
+
+  const boost::filesystem::path directory =
+      "/tmp/multimap.EntryScannerTestWithParam";
+  std::unique_ptr<Map> map;
+};
+
+TEST_P(EntryScannerTestWithParam, ScanYieldsAllEntriesInBatches) {
+  const auto num_keys = 1000;
+  for (auto k = 0; k != num_keys; ++k) {
+    for (auto v = 0; v != k % 20; ++v) {
+      map->put(std::to_string(k), std::to_string(v));
+    }
+  }
+  std::map<std::string, std::vector<std::string> > entries;
+  size_t num_batches = 0;
+  EntryScanner scanner(*map, GetParam(), mt::KiB(1));
+  while (const auto batch = scanner.next()) {
+    ASSERT_THAT(batch->size(), Gt(0));
+    ++num_batches;
+    const char* pos = batch->data();
+    const char* end = pos + batch->size();
+    while (pos != end) {
+      const auto key = readField(&pos);
+      entries[key].push_back(readField(&pos));
+    }
+  }
+  ASSERT_THAT(scanner.next(), Eq(nullptr));
+  ASSERT_THAT(num_batches, Gt(10));
+
+  size_t num_keys_found = 0;
+  for (auto k = 0; k != num_keys; ++k) {
+    const auto iter = entries.find(std::to_string(k));
+    if (k % 20 == 0) {
+      ASSERT_TRUE(iter == entries.end());
+      continue;
+    }
+    ASSERT_TRUE(iter != entries.end());
+    ASSERT_THAT(iter->second.size(), Eq(k % 20));
+    for (auto v = 0; v != k % 20; ++v) {
+      ASSERT_THAT(iter->second[v], Eq(std::to_string(v)));
+    }
+    ++num_keys_found;
+  }
+  ASSERT_THAT(entries.size(), Eq(num_keys_found));
+}
+
+TEST_P(EntryScannerTestWithParam, DestructorStopsUnfinishedScan) {
+  for (auto k = 0; k != 1000; ++k) {
+    map->put(std::to_string(k), std::string(100, 'v'));
+  }
+  {
+    EntryScanner scanner(*map, GetParam(), 128);
+    ASSERT_TRUE(scanner.next() != nullptr);
+  }
+  map->put("key", "value");
+}
+
+INSTANTIATE_TEST_CASE_P(Parameterized, EntryScannerTestWithParam,
+                        testing::Values(0, 1, 2, 4));
+
+}  // namespace multimap
@@ -0,0 +1,163 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_FIXED_MAP_HPP_INCLUDED
+#define MULTIMAP_FIXED_MAP_HPP_INCLUDED
+
+#include <array>
+#include <cstring>
+#include <vector>
+#include "multimap/Map.hpp"
+
+namespace multimap {
+
+template <size_t KeySize, size_t ValueSize>
+class FixedMap : public mt::Resource {
+  // A map whose keys and values all have the same size, which is known at
+  // compile time, e.g. `FixedMap<8, 16>` for 8-byte keys and 16-byte values.
+  // Keys and values are passed by value as arrays instead of class Bytes, and
+  // values are compared via `std::memcmp()` with a constant size, which the
+  // compiler turns into a few integer comparisons.  Predicates, procedures,
+  // and iterators therefore never look at value sizes.
+  //
+  // The data is stored as an ordinary map, which can be opened as class Map
+  // as well.  Values that do not have `ValueSize` bytes, which can only be
+  // written that way, are rejected when they are read.
+
+ public:
+  static_assert(KeySize != 0, "FixedMap requires KeySize > 0");
+  static_assert(ValueSize != 0, "FixedMap requires ValueSize > 0");
+
+  typedef std::array<char, KeySize> Key;
+  typedef std::array<char, ValueSize> Value;
+
+  explicit FixedMap(const boost::filesystem::path& directory)
+      : map_(directory) {}
+
+  FixedMap(const boost::filesystem::path& directory,
+           const Map::Options& options)
+      : map_(directory, options) {}
+
+  void put(const Key& key, const Value& value) {
+    map_.put(toBytes(key), toBytes(value));
+  }
+
+  std::vector<Value> get(const Key& key) const {
+    std::vector<Value> values;
+    forEachValue(key, [&values](const Value& value) {
+      values.push_back(value);
+    });
+    return values;
+  }
+  // Returns copies of all values associated with `key`.
+
+  bool contains(const Key& key) const { return map_.contains(toBytes(key)); }
+
+  bool containsValue(const Key& key, const Value& value) const {
+    return map_.containsValue(toBytes(key), toBytes(value));
+  }
+
+  uint32_t remove(const Key& key) { return map_.remove(toBytes(key)); }
+
+  bool removeOne(const Key& key, const Value& value) {
+    return map_.removeOne(toBytes(key), [&value](const Bytes& other) {
+      return isEqual(other, value);
+    });
+  }
+
+  uint32_t removeAll(const Key& key, const Value& value) {
+    return map_.removeAll(toBytes(key), [&value](const Bytes& other) {
+      return isEqual(other, value);
+    });
+  }
+
+  bool replaceOne(const Key& key, const Value& old_value,
+                  const Value& new_value) {
+    return map_.replaceOne(toBytes(key), toBytes(old_value),
+                           toBytes(new_value));
+  }
+
+  uint32_t replaceAll(const Key& key, const Value& old_value,
+                      const Value& new_value) {
+    return map_.replaceAll(toBytes(key), toBytes(old_value),
+                           toBytes(new_value));
+  }
+
+  template <typename Procedure>
+  void forEachKey(Procedure process) const {
+    map_.forEachKey([&process](const Bytes& key) { process(toKey(key)); });
+  }
+
+  template <typename Procedure>
+  void forEachValue(const Key& key, Procedure process) const {
+    map_.forEachValue(toBytes(key), [&process](const Bytes& value) {
+      process(toValue(value));
+    });
+  }
+
+  template <typename BinaryProcedure>
+  void forEachEntry(BinaryProcedure process) const {
+    map_.forEachEntry([&process](const Bytes& key, Iterator* iter) {
+      const auto fixed_key = toKey(key);
+      while (iter->hasNext()) {
+        process(fixed_key, toValue(iter->next()));
+      }
+    });
+  }
+  // Calls `process` with each key and one of its values at a time.
+
+  Map& getMap() { return map_; }
+
+  const Map& getMap() const { return map_; }
+  // Gives access to the operations of the underlying map that do not depend
+  // on the size of keys or values, such as statistics and checkpoints.
+
+ private:
+  template <size_t N>
+  static Bytes toBytes(const std::array<char, N>& array) {
+    return Bytes(array.data(), N);
+  }
+
+  static Key toKey(const Bytes& key) {
+    mt::Check::isEqual(key.size(), KeySize,
+                       "FixedMap: Key has %zu bytes, but expected %zu",
+                       key.size(), KeySize);
+    Key result;
+    std::memcpy(result.data(), key.data(), KeySize);
+    return result;
+  }
+
+  static Value toValue(const Bytes& value) {
+    mt::Check::isEqual(value.size(), ValueSize,
+                       "FixedMap: Value has %zu bytes, but expected %zu",
+                       value.size(), ValueSize);
+    Value result;
+    std::memcpy(result.data(), value.data(), ValueSize);
+    return result;
+  }
+
+  static bool isEqual(const Bytes& a, const Value& b) {
+    return a.size() == ValueSize &&
+           std::memcmp(a.data(), b.data(), ValueSize) == 0;
+  }
+
+  Map map_;
+};
+
+}  // namespace multimap
+
+#endif  // MULTIMAP_FIXED_MAP_HPP_INCLUDED
@@ -0,0 +1,122 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/FixedMap.hpp"
+
+namespace multimap {
+
+using testing::ElementsAre;
+using testing::Eq;
+
+typedef FixedMap<8, 16> Map8x16;
+
+Map8x16::Key makeKey(uint64_t i) {
+  Map8x16::Key key;
+  std::memcpy(key.data(), &i, key.size());
+  return key;
+}
+
+Map8x16::Value makeValue(uint64_t i) {
+  Map8x16::Value value;
+  std::memcpy(value.data(), &i, sizeof i);
+  std::memcpy(value.data() + sizeof i, &i, sizeof i);
+  return value;
+}
+
+TEST(FixedMapTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<Map8x16>::value);
+  ASSERT_FALSE(std::is_copy_assignable<Map8x16>::value);
+}
+
+struct FixedMapTestFixture : public testing::Test {
+  void SetUp() override {
+    boost::filesystem::remove_all(directory);
+    boost::filesystem::create_directory(directory);
+    options.create_if_missing = true;
+  }
+
+  void TearDown() override { boost::filesystem::remove_all(directory); }
+
+  const boost::filesystem::path directory =
+      "/tmp/multimap.FixedMapTestFixture";
+  Map::Options options;
+};
+
+TEST_F(FixedMapTestFixture, PutValuesAndGetThemBack) {
+  Map8x16 map(directory, options);
+  for (uint64_t i = 0; i != 1000; ++i) {
+    map.put(makeKey(i % 100), makeValue(i));
+  }
+  for (uint64_t i = 0; i != 100; ++i) {
+    ASSERT_TRUE(map.contains(makeKey(i)));
+    ASSERT_THAT(map.get(makeKey(i)).size(), Eq(10));
+    ASSERT_TRUE(map.containsValue(makeKey(i), makeValue(i + 900)));
+    ASSERT_FALSE(map.containsValue(makeKey(i), makeValue(i + 1)));
+  }
+  ASSERT_FALSE(map.contains(makeKey(100)));
+  ASSERT_TRUE(map.get(makeKey(100)).empty());
+
+  size_t num_entries = 0;
+  map.forEachEntry([&](const Map8x16::Key& key, const Map8x16::Value& value) {
+    uint64_t k, v;
+    std::memcpy(&k, key.data(), sizeof k);
+    std::memcpy(&v, value.data(), sizeof v);
+    ASSERT_THAT(v % 100, Eq(k));
+    ++num_entries;
+  });
+  ASSERT_THAT(num_entries, Eq(1000));
+}
+
+TEST_F(FixedMapTestFixture, RemoveAndReplaceValues) {
+  Map8x16 map(directory, options);
+  const auto key = makeKey(1);
+  for (uint64_t i = 0; i != 4; ++i) {
+    map.put(key, makeValue(i % 2));
+  }
+  ASSERT_TRUE(map.removeOne(key, makeValue(0)));
+  ASSERT_THAT(map.get(key), ElementsAre(makeValue(1), makeValue(0),
+                                        makeValue(1)));
+  ASSERT_THAT(map.removeAll(key, makeValue(1)), Eq(2));
+  ASSERT_THAT(map.get(key), ElementsAre(makeValue(0)));
+  ASSERT_TRUE(map.replaceOne(key, makeValue(0), makeValue(2)));
+  ASSERT_THAT(map.get(key), ElementsAre(makeValue(2)));
+  ASSERT_THAT(map.remove(key), Eq(1));
+  ASSERT_FALSE(map.contains(key));
+}
+
+TEST_F(FixedMapTestFixture, ValuesOfOtherSizeAreRejectedWhenRead) {
+  {
+    Map8x16 map(directory, options);
+    map.put(makeKey(1), makeValue(1));
+    map.getMap().put(Bytes(makeKey(1).data(), 8), "short");
+  }
+  Map8x16 map(directory, Map::Options());
+  ASSERT_THROW(map.get(makeKey(1)), std::runtime_error);
+  size_t num_keys = 0;
+  map.forEachKey([&](const Map8x16::Key& key) {
+    ASSERT_THAT(key, Eq(makeKey(1)));
+    ++num_keys;
+  });
+  ASSERT_THAT(num_keys, Eq(1));
+}
+
+}  // namespace multimap
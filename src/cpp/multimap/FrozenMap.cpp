@@ -0,0 +1,168 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/FrozenMap.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <string>
+#include <boost/filesystem/operations.hpp>
+#include "multimap/internal/Varint.hpp"
+
+namespace multimap {
+
+namespace {
+
+// A record in the data file consists of the key and its values:
+//
+//   [key size : u32][key][num values : u32][zero : u32][body size : u32]
+//   [value size : varint][value]...
+//
+// The values are laid out like a serialized list so that
+// `internal::KeyIndex` can walk the records, see
+// `internal::KeyIndex::getSizeOfList()`.
+
+const size_t HEADER_SIZE = sizeof(uint32_t) * 3;
+
+void appendUint32(uint32_t value, std::string* record) {
+  record->append(reinterpret_cast<const char*>(&value), sizeof value);
+}
+
+uint32_t readUint32(const char* pos) {
+  uint32_t value;
+  std::memcpy(&value, pos, sizeof value);
+  return value;
+}
+
+const boost::filesystem::path& createIfMissing(
+    const boost::filesystem::path& directory) {
+  boost::filesystem::create_directories(directory);
+  return directory;
+}
+
+}  // namespace
+
+FrozenMap::Iter::Iter(const char* record)
+    : pos_(record + HEADER_SIZE),
+      end_(pos_ + readUint32(record + sizeof(uint32_t) * 2)),
+      available_(readUint32(record)) {}
+
+Bytes FrozenMap::Iter::peekNext() {
+  MT_REQUIRE_TRUE(hasNext());
+  uint32_t size;
+  const auto nbytes = internal::Varint::readUint(pos_, end_ - pos_, &size);
+  return Bytes(pos_ + nbytes, size);
+}
+
+uint32_t FrozenMap::Iter::skip(uint32_t num_values) {
+  num_values = std::min(num_values, available_);
+  for (uint32_t i = 0; i != num_values; ++i) {
+    next();
+  }
+  return num_values;
+}
+
+FrozenMap::Builder::Builder(const boost::filesystem::path& directory)
+    : lock_(createIfMissing(directory), Map::getNameOfLockFile()),
+      directory_(directory) {
+  mt::Check::isFalse(
+      boost::filesystem::exists(directory / Map::getNameOfIdFile()) ||
+          boost::filesystem::exists(directory / getNameOfDataFile()),
+      "Map in '%s' already exists",
+      boost::filesystem::absolute(directory).c_str());
+  stream_ = mt::fopen(directory / getNameOfDataFile(), "w");
+}
+
+FrozenMap::Builder::~Builder() {
+  if (!finished()) {
+    try {
+      finish();
+    } catch (const std::exception& error) {
+      mt::log() << "FrozenMap::Builder::finish() failed: " << error.what()
+                << std::endl;
+    }
+  }
+}
+
+void FrozenMap::Builder::put(const Bytes& key, Iterator* values) {
+  MT_REQUIRE_FALSE(finished());
+  if (!values->hasNext()) return;
+
+  std::string record;
+  appendUint32(key.size(), &record);
+  record.append(key.begin(), key.end());
+  const auto header_offset = record.size();
+  record.append(HEADER_SIZE, '\0');
+  uint32_t num_values = 0;
+  char buffer[sizeof(uint32_t)];
+  while (values->hasNext()) {
+    const auto value = values->next();
+    mt::Check::isLessEqual(value.size(), internal::Varint::Limits::MAX_N4,
+                           "Value of %zu bytes is too large", value.size());
+    record.append(buffer, internal::Varint::writeUint(value.size(), buffer,
+                                                      sizeof buffer));
+    record.append(value.begin(), value.end());
+    ++num_values;
+  }
+  const auto body_size = record.size() - header_offset - HEADER_SIZE;
+  mt::Check::isLessEqual(body_size, std::numeric_limits<uint32_t>::max(),
+                         "Values of a key exceed 4 GiB");
+  const uint32_t header[] = {num_values, 0, static_cast<uint32_t>(body_size)};
+  std::memcpy(&record[header_offset], header, sizeof header);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  mt::fwrite(stream_.get(), record.data(), record.size());
+  index_.add(key, offset_);
+  offset_ += record.size();
+}
+
+void FrozenMap::Builder::finish() {
+  MT_REQUIRE_FALSE(finished());
+  mt::Check::isZero(std::fflush(stream_.get()), "fflush() failed");
+  stream_.reset();
+  index_.writeToFile(directory_ / getNameOfIndexFile(), offset_);
+}
+
+FrozenMap::FrozenMap(const boost::filesystem::path& directory)
+    : lock_(directory, Map::getNameOfLockFile(),
+            mt::DirectoryLockGuard::Mode::SHARED),
+      index_(internal::KeyIndex::open(directory / getNameOfIndexFile(),
+                                      directory / getNameOfDataFile())) {
+  mt::Check::notNull(index_.get(), "No frozen map found in '%s'",
+                     boost::filesystem::absolute(directory).c_str());
+}
+
+std::unique_ptr<Iterator> FrozenMap::get(const Bytes& key) const {
+  const auto record = index_->find(key);
+  if (record.list == nullptr) return nullptr;
+  return std::unique_ptr<Iterator>(new Iter(record.list));
+}
+
+uint32_t FrozenMap::count(const Bytes& key) const {
+  const auto record = index_->find(key);
+  return record.list ? readUint32(record.list) : 0;
+}
+
+std::string FrozenMap::getNameOfDataFile() { return "multimap.frozen"; }
+
+std::string FrozenMap::getNameOfIndexFile() {
+  return getNameOfDataFile() + ".index";
+}
+
+}  // namespace multimap
@@ -0,0 +1,155 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_FROZEN_MAP_HPP_INCLUDED
+#define MULTIMAP_FROZEN_MAP_HPP_INCLUDED
+
+#include <memory>
+#include <mutex>
+#include <boost/filesystem/path.hpp>
+#include "multimap/internal/KeyIndex.hpp"
+#include "multimap/Iterator.hpp"
+#include "multimap/Map.hpp"
+
+namespace multimap {
+
+class FrozenMap : public mt::Resource {
+  // A read-only map in the frozen format, which `Map::optimize()` writes if
+  // `Map::Options::frozen` is set.  All values of a key are stored back to
+  // back in a single data file, right after the key, and an immutable hash
+  // table maps each key to its record, see `internal::KeyIndex`.  Both files
+  // are memory-mapped, so that opening a map takes constant time, and since
+  // nothing is ever modified, lookups and iterators take no locks at all.
+  // Objects of this class are thread-safe.
+
+ public:
+  class Iter : public Iterator {
+    // Iterates the values of a key in place.  Values are varint-prefixed, so
+    // `skip()` has to visit each value it skips.
+
+   public:
+    Iter() = default;
+
+    explicit Iter(const char* record);
+    // `record` points to the values header of a key's record.
+
+    uint32_t available() const override { return available_; }
+
+    bool hasNext() const override { return available_ != 0; }
+
+    Bytes next() override {
+      const auto value = peekNext();
+      pos_ = value.end();
+      --available_;
+      return value;
+    }
+
+    Bytes peekNext() override;
+
+    uint32_t skip(uint32_t num_values) override;
+
+   private:
+    const char* pos_ = nullptr;
+    const char* end_ = nullptr;
+    uint32_t available_ = 0;
+  };
+
+  class Builder : public mt::Resource {
+    // Writes a frozen map from the entries of another map.  `put()` may be
+    // called concurrently, but all values of a key must be passed by a
+    // single call.
+
+   public:
+    explicit Builder(const boost::filesystem::path& directory);
+    // Creates `directory` if it is missing.
+    // Throws if there is already a map in `directory`.
+
+    ~Builder();
+    // Calls `finish()` if not already done.  Errors are logged, but not thrown.
+
+    void put(const Bytes& key, Iterator* values);
+    // Keys without values are skipped.
+
+    void finish();
+    // Must not be called concurrently with `put()`.
+    // Writes the index file.  Afterwards the directory contains a complete
+    // map that can be opened via `FrozenMap`.
+
+    bool finished() const { return stream_.get() == nullptr; }
+
+   private:
+    mt::DirectoryLockGuard lock_;
+    std::mutex mutex_;
+    mt::AutoCloseFile stream_;
+    internal::KeyIndex::Builder index_;
+    uint64_t offset_ = 0;
+    boost::filesystem::path directory_;
+  };
+
+  explicit FrozenMap(const boost::filesystem::path& directory);
+  // Throws if `directory` does not contain a frozen map.
+
+  std::unique_ptr<Iterator> get(const Bytes& key) const;
+  // Returns `nullptr` if `key` is not found.
+
+  bool contains(const Bytes& key) const {
+    return index_->find(key).list != nullptr;
+  }
+
+  uint32_t count(const Bytes& key) const;
+  // Returns the number of values associated with `key` without reading them.
+
+  template <typename Procedure>
+  void forEachKey(Procedure process) const {
+    index_->forEachRecord([&process](const internal::KeyIndex::Record& record) {
+      process(record.key);
+    });
+  }
+
+  template <typename Procedure>
+  void forEachValue(const Bytes& key, Procedure process) const {
+    const auto record = index_->find(key);
+    if (record.list == nullptr) return;
+    Iter iter(record.list);
+    while (iter.hasNext()) {
+      process(iter.next());
+    }
+  }
+
+  template <typename BinaryProcedure>
+  void forEachEntry(BinaryProcedure process) const {
+    index_->forEachRecord([&process](const internal::KeyIndex::Record& record) {
+      Iter iter(record.list);
+      process(record.key, &iter);
+    });
+  }
+  // Visits the keys in the order they have been written.
+
+  uint64_t getNumKeys() const { return index_->size(); }
+
+  static std::string getNameOfDataFile();
+  static std::string getNameOfIndexFile();
+  // Returns names of files relative to the map's directory.
+
+ private:
+  mt::DirectoryLockGuard lock_;
+  std::unique_ptr<internal::KeyIndex> index_;
+};
+
+}  // namespace multimap
+
+#endif  // MULTIMAP_FROZEN_MAP_HPP_INCLUDED
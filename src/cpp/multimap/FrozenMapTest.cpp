@@ -0,0 +1,158 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <string>
+#include <type_traits>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/FrozenMap.hpp"
+
+namespace multimap {
+
+using testing::ElementsAre;
+using testing::Eq;
+
+TEST(FrozenMapTest, IsNotDefaultConstructible) {
+  ASSERT_FALSE(std::is_default_constructible<FrozenMap>::value);
+}
+
+TEST(FrozenMapTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<FrozenMap>::value);
+  ASSERT_FALSE(std::is_copy_assignable<FrozenMap>::value);
+}
+
+struct FrozenMapTestFixture : public testing::Test {
+  void SetUp() override {
+    boost::filesystem::remove_all(directory);
+    boost::filesystem::remove_all(output);
+    boost::filesystem::create_directory(directory);
+  }
+
+  void TearDown() override {
+    boost::filesystem::remove_all(directory);
+    boost::filesystem::remove_all(output);
+  }
+
+  const boost::filesystem::path directory = "/tmp/multimap.FrozenMapTest";
+  const boost::filesystem::path output = "/tmp/multimap.FrozenMapTest.out";
+};
+
+std::string makeKey(uint32_t i) { return "k" + std::to_string(i); }
+
+std::string makeValue(uint32_t i) { return "v" + std::to_string(i); }
+
+TEST_F(FrozenMapTestFixture, OptimizeWritesFrozenMapWithAllValues) {
+  const uint32_t num_keys = 1000;
+  {
+    Map::Options options;
+    options.create_if_missing = true;
+    options.num_partitions = 7;
+    Map map(directory, options);
+    for (uint32_t k = 0; k != num_keys; ++k) {
+      for (uint32_t v = 0; v != k % 10; ++v) {
+        map.put(makeKey(k), makeValue(v));
+      }
+    }
+  }
+  Map::Options options;
+  options.frozen = true;
+  options.quiet = true;
+  options.num_threads = 4;
+  Map::optimize(directory, output, options);
+
+  FrozenMap map(output);
+  ASSERT_THAT(map.getNumKeys(), Eq(num_keys - num_keys / 10));
+  for (uint32_t k = 0; k != num_keys; ++k) {
+    const auto key = makeKey(k);
+    ASSERT_THAT(map.count(key), Eq(k % 10));
+    ASSERT_THAT(map.contains(key), Eq(k % 10 != 0));
+    auto iter = map.get(key);
+    if (k % 10 == 0) {
+      ASSERT_TRUE(iter == nullptr);
+      continue;
+    }
+    ASSERT_THAT(iter->available(), Eq(k % 10));
+    for (uint32_t v = 0; v != k % 10; ++v) {
+      ASSERT_TRUE(iter->hasNext());
+      ASSERT_THAT(iter->peekNext().toString(), Eq(makeValue(v)));
+      ASSERT_THAT(iter->next().toString(), Eq(makeValue(v)));
+    }
+    ASSERT_FALSE(iter->hasNext());
+  }
+  ASSERT_FALSE(map.contains("absent"));
+  ASSERT_THAT(map.count("absent"), Eq(0));
+
+  uint32_t num_entries = 0;
+  map.forEachEntry([&](const Bytes& key, Iterator* iter) {
+    ASSERT_TRUE(map.contains(key));
+    num_entries += iter->available();
+  });
+  ASSERT_THAT(num_entries, Eq(4500));
+}
+
+TEST_F(FrozenMapTestFixture, OptimizeSortsValuesIfCompareIsGiven) {
+  {
+    Map::Options options;
+    options.create_if_missing = true;
+    Map map(directory, options);
+    map.put("key", "c");
+    map.put("key", "a");
+    map.put("key", "b");
+  }
+  Map::Options options;
+  options.frozen = true;
+  options.quiet = true;
+  options.compare = [](const Bytes& a, const Bytes& b) { return a < b; };
+  Map::optimize(directory, output, options);
+
+  FrozenMap map(output);
+  std::vector<std::string> values;
+  map.forEachValue("key", [&values](const Bytes& value) {
+    values.push_back(value.toString());
+  });
+  ASSERT_THAT(values, ElementsAre("a", "b", "c"));
+}
+
+TEST_F(FrozenMapTestFixture, IterSkipsValues) {
+  {
+    FrozenMap::Builder builder(output);
+    Map::Options options;
+    options.create_if_missing = true;
+    Map map(directory, options);
+    for (uint32_t v = 0; v != 100; ++v) {
+      map.put("key", makeValue(v));
+    }
+    builder.put("key", map.get("key").get());
+  }
+  FrozenMap map(output);
+  auto iter = map.get("key");
+  ASSERT_THAT(iter->skip(10), Eq(10));
+  ASSERT_THAT(iter->next().toString(), Eq(makeValue(10)));
+  ASSERT_THAT(iter->skip(1000), Eq(89));
+  ASSERT_FALSE(iter->hasNext());
+}
+
+TEST_F(FrozenMapTestFixture, BuilderThrowsIfMapExists) {
+  { FrozenMap::Builder builder(output); }
+  ASSERT_THROW(FrozenMap::Builder builder(output), std::runtime_error);
+}
+
+TEST_F(FrozenMapTestFixture, ConstructorThrowsIfNoFrozenMapExists) {
+  ASSERT_THROW(FrozenMap map(directory), std::runtime_error);
+}
+
+}  // namespace multimap
@@ -0,0 +1,140 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/Ingester.hpp"
+
+#include "multimap/WriteBatch.hpp"
+#include "multimap/internal/Numa.hpp"
+
+namespace multimap {
+
+const size_t Ingester::DEFAULT_QUEUE_CAPACITY;
+const size_t Ingester::MAX_BATCH_SIZE;
+
+Ingester::Ingester(Map& map, size_t queue_capacity) : map_(map) {
+  mt::Check::isFalse(map.isReadOnly(), "Ingester: map is read-only");
+  const auto num_partitions = map.getNumPartitions();
+  owners_.reserve(num_partitions);
+  for (size_t i = 0; i != num_partitions; ++i) {
+    owners_.emplace_back(new Owner(queue_capacity));
+  }
+  for (size_t i = 0; i != num_partitions; ++i) {
+    owners_[i]->thread = std::thread(&Ingester::run, this, owners_[i].get(),
+                                     map.getNumaNode(i));
+  }
+}
+
+Ingester::~Ingester() {
+  waitForOwners();
+  stopped_ = true;
+  for (const auto& owner : owners_) {
+    {
+      std::lock_guard<std::mutex> lock(owner->mutex);
+      owner->cond.notify_one();
+    }
+    owner->thread.join();
+  }
+}
+
+void Ingester::put(const Bytes& key, const Bytes& value) {
+  rethrowError();
+  auto& owner = *owners_[map_.getPartitionIndexOf(key) % owners_.size()];
+  const auto fill = [&key, &value](Put* put) {
+    put->data.assign(key.data(), key.size());
+    put->data.append(value.data(), value.size());
+    put->key_size = key.size();
+  };
+  while (!owner.queue.tryPush(fill)) {
+    rethrowError();
+    std::this_thread::yield();
+  }
+  // Pairs with the fence in `run()`, so that either the owner sees the put
+  // or this thread sees that the owner is sleeping.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (owner.sleeping.load()) {
+    std::lock_guard<std::mutex> lock(owner.mutex);
+    owner.cond.notify_one();
+  }
+}
+
+void Ingester::flush() {
+  waitForOwners();
+  rethrowError();
+}
+
+void Ingester::run(Owner* owner, int numa_node) {
+  if (numa_node != -1) {
+    internal::Numa::bindCurrentThreadToNode(numa_node);
+  }
+  WriteBatch batch;
+  const auto take = [&batch](Put* put) {
+    batch.put(Bytes(put->data.data(), put->key_size),
+              Bytes(put->data.data() + put->key_size,
+                    put->data.size() - put->key_size));
+  };
+  while (true) {
+    uint64_t num_taken = 0;
+    while (num_taken != MAX_BATCH_SIZE && owner->queue.tryPop(take)) {
+      ++num_taken;
+    }
+    if (num_taken != 0) {
+      if (!failed_) {
+        try {
+          map_.write(batch);
+        } catch (...) {
+          std::lock_guard<std::mutex> lock(error_mutex_);
+          if (!failed_) {
+            error_ = std::current_exception();
+            failed_ = true;
+          }
+        }
+      }
+      batch.clear();
+      owner->num_applied.fetch_add(num_taken);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(owner->mutex);
+    owner->sleeping = true;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    owner->cond.wait(lock, [owner, this] {
+      return !owner->queue.empty() || stopped_;
+    });
+    owner->sleeping = false;
+    if (stopped_ && owner->queue.empty()) break;
+  }
+}
+
+void Ingester::waitForOwners() {
+  std::vector<uint64_t> num_pushes;
+  num_pushes.reserve(owners_.size());
+  for (const auto& owner : owners_) {
+    num_pushes.push_back(owner->queue.getNumPushes());
+  }
+  // Puts are taken in the order they were counted, so that all puts made
+  // before have been applied once as many puts have been taken.
+  for (size_t i = 0; i != owners_.size(); ++i) {
+    while (owners_[i]->num_applied.load() < num_pushes[i]) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void Ingester::rethrowError() const {
+  if (failed_) std::rethrow_exception(error_);
+}
+
+}  // namespace multimap
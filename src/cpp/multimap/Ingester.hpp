@@ -0,0 +1,113 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INGESTER_HPP_INCLUDED
+#define MULTIMAP_INGESTER_HPP_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "multimap/internal/MpscQueue.hpp"
+#include "multimap/Map.hpp"
+
+namespace multimap {
+
+class Ingester : public mt::Resource {
+  // Applies the puts of many threads to a map via one owner thread per
+  // partition, so that each partition is written by a single thread.
+  // `put()` copies a put into the queue of the key's partition, which is a
+  // lock-free multi-producer single-consumer ring, and the owner applies
+  // the puts it takes from there in batches via `Map::write()`.  Writers
+  // therefore neither wait for nor touch the shard locks, list locks, and
+  // store buffers of partitions, as long as no other thread writes to the
+  // map directly.
+  //
+  // Puts of the same thread to the same key are applied in the order they
+  // were made, like via `Map::put()`, but possibly after `put()` returned,
+  // see `flush()`.  Owners are assigned to partitions when the ingester is
+  // created.  If the map is repartitioned later, puts are still applied
+  // correctly, just no longer by a single thread per partition.  The map
+  // must outlive the ingester.
+
+ public:
+  static const size_t DEFAULT_QUEUE_CAPACITY = 4096;
+  static const size_t MAX_BATCH_SIZE = 1024;
+  // Maximum number of puts an owner applies via a single `Map::write()`.
+
+  explicit Ingester(Map& map, size_t queue_capacity = DEFAULT_QUEUE_CAPACITY);
+  // Starts one owner thread per partition of `map`, which is bound to the
+  // partition's NUMA node, see `Map::getNumaNode()`.  Each queue holds up
+  // to `queue_capacity` puts, which must be a power of two.
+
+  ~Ingester();
+  // Applies all puts made so far and joins the owner threads.  Errors that
+  // occur meanwhile are lost, so call `flush()` before to see them.
+
+  void put(const Bytes& key, const Bytes& value);
+  // Hands the put over to the owner of the key's partition, waiting while
+  // its queue is full.  Thread-safe.  Rethrows the first exception that an
+  // owner got from `Map::write()`, after which all puts are dropped.
+
+  void flush();
+  // Waits until all puts that have been made before the call are applied
+  // to the map.  Thread-safe.  Rethrows as `put()`.
+
+ private:
+  struct Put {
+    std::string data;
+    uint32_t key_size = 0;
+    // `data` holds the key followed by the value.
+  };
+
+  struct Owner {
+    explicit Owner(size_t queue_capacity) : queue(queue_capacity) {}
+
+    internal::MpscQueue<Put> queue;
+    std::atomic<uint64_t> num_applied{0};
+    // Number of puts taken from `queue` that have been applied or dropped.
+
+    std::atomic<bool> sleeping{false};
+    std::mutex mutex;
+    std::condition_variable cond;
+    // Producers only lock `mutex` to wake up an owner that is sleeping.
+
+    std::thread thread;
+  };
+
+  void run(Owner* owner, int numa_node);
+
+  void waitForOwners();
+
+  void rethrowError() const;
+
+  Map& map_;
+  std::vector<std::unique_ptr<Owner> > owners_;
+  std::atomic<bool> stopped_{false};
+  std::atomic<bool> failed_{false};
+  std::exception_ptr error_;
+  // Written by the first owner that fails before `failed_` is set.
+  std::mutex error_mutex_;
+};
+
+}  // namespace multimap
+
+#endif  // MULTIMAP_INGESTER_HPP_INCLUDED
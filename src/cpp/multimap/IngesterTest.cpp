@@ -0,0 +1,113 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/Ingester.hpp"
+
+namespace multimap {
+
+using testing::Eq;
+
+TEST(IngesterTest, IsNotDefaultConstructible) {
+  ASSERT_FALSE(std::is_default_constructible<Ingester>::value);
+}
+
+TEST(IngesterTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<Ingester>::value);
+  ASSERT_FALSE(std::is_copy_assignable<Ingester>::value);
+}
+
+struct IngesterTestFixture : public testing::Test {
+  void SetUp() override {
+    boost::filesystem::remove_all(directory);
+    boost::filesystem::create_directory(directory);
+    Map::Options options;
+    options.create_if_missing = true;
+    options.num_partitions = 7;
+    map.reset(new Map(directory, options));
+  }
+
+  void TearDown() override {
+    map.reset();
+    boost::filesystem::remove_all(directory);
+  }
+
+  const boost::filesystem::path directory =
+      "/tmp/multimap.IngesterTestFixture";
+  std::unique_ptr<Map> map;
+};
+
+TEST_F(IngesterTestFixture, ConcurrentPutsAreAppliedInOrderAfterFlush) {
+  const uint32_t num_threads = 4;
+  const uint32_t num_keys = 100;
+  const uint32_t num_puts = 20000;
+  Ingester ingester(*map, 64);
+  std::vector<std::thread> writers;
+  for (uint32_t t = 0; t != num_threads; ++t) {
+    writers.emplace_back([&ingester, t] {
+      for (uint32_t i = 0; i != num_puts; ++i) {
+        const auto key = std::to_string(i % num_keys);
+        ingester.put(key, std::to_string(t) + ':' + std::to_string(i));
+      }
+    });
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  ingester.flush();
+  for (uint32_t k = 0; k != num_keys; ++k) {
+    ASSERT_THAT(map->count(std::to_string(k)),
+                Eq(num_threads * num_puts / num_keys));
+    std::vector<uint32_t> next(num_threads, k);
+    const auto iter = map->get(std::to_string(k));
+    while (iter->hasNext()) {
+      const auto value = iter->next().toString();
+      const auto colon = value.find(':');
+      const uint32_t t = std::stoul(value.substr(0, colon));
+      ASSERT_THAT(std::stoul(value.substr(colon + 1)), Eq(next[t]));
+      next[t] += num_keys;
+    }
+  }
+}
+
+TEST_F(IngesterTestFixture, DestructorAppliesRemainingPuts) {
+  {
+    Ingester ingester(*map);
+    for (uint32_t i = 0; i != 1000; ++i) {
+      ingester.put(std::to_string(i % 10), std::to_string(i));
+    }
+  }
+  for (uint32_t k = 0; k != 10; ++k) {
+    ASSERT_THAT(map->count(std::to_string(k)), Eq(100));
+  }
+}
+
+TEST_F(IngesterTestFixture, ReadOnlyMapIsRejected) {
+  map.reset();
+  Map::Options options;
+  options.readonly = true;
+  Map readonly_map(directory, options);
+  ASSERT_THROW(Ingester ingester(readonly_map), std::runtime_error);
+}
+
+}  // namespace multimap
@@ -34,6 +34,11 @@ class Iterator : public mt::Resource {
   virtual Bytes next() = 0;
 
   virtual Bytes peekNext() = 0;
+
+  virtual uint32_t skip(uint32_t num_values) = 0;
+  // Moves forward by `num_values` values, or to the end if less values are
+  // available, and returns the number of values skipped.  Long lists are
+  // indexed, so that paging through them does not decode every value.
 };
 
 }  // namespace multimap
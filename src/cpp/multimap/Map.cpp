@@ -17,10 +17,23 @@
 
 #include "multimap/Map.hpp"
 
+#include <fcntl.h>
 #include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <mutex>
 #include <boost/filesystem/operations.hpp>
 #include "multimap/internal/Base64.hpp"
+#include "multimap/internal/Dump.hpp"
+#include "multimap/internal/Numa.hpp"
+#include "multimap/internal/Sorter.hpp"
+#include "multimap/internal/ThreadPool.hpp"
+#include "multimap/FrozenMap.hpp"
+#include "multimap/MapBuilder.hpp"
 
 namespace multimap {
 
@@ -30,28 +43,189 @@ void checkOptions(const Map::Options& options) {
   mt::Check::notZero(options.block_size, "Map's block size must be positive");
   mt::Check::isTrue(mt::isPowerOfTwo(options.block_size),
                     "Map's block size must be a power of two");
+  mt::Check::notZero(options.max_read_ahead,
+                     "Map's max read-ahead must be positive");
+  mt::Check::notZero(options.max_extent_size,
+                     "Map's max extent size must be positive");
+  mt::Check::isTrue(
+      options.compaction_threshold >= 0 && options.compaction_threshold <= 1,
+      "Map's compaction threshold must be in [0, 1]");
+  mt::Check::notZero(options.compaction_rate,
+                     "Map's compaction rate must be positive");
+  mt::Check::isTrue(options.bloom_filter_false_positive_rate >= 0 &&
+                        options.bloom_filter_false_positive_rate < 1,
+                    "Map's Bloom filter false-positive rate must be in [0, 1)");
+  mt::Check::isTrue(options.hot_keys == 0 || options.hot_keys_sample_rate != 0,
+                    "Map's hot keys sample rate must not be zero");
+  mt::Check::isTrue(options.value_filter_false_positive_rate >= 0 &&
+                        options.value_filter_false_positive_rate < 1,
+                    "Map's value filter false-positive rate must be in [0, 1)");
 }
 
-std::string getPrefix() { return "multimap.map"; }
+const uint64_t BASE64_CHUNK_SIZE = mt::MiB(4);
+// Approximate size of the pieces of input files that are imported in
+// parallel by `Map::importFromBase64()`.
 
-std::string getNameOfIdFile() { return getPrefix() + ".id"; }
+class MappedInputFile : public mt::Resource {
+ public:
+  explicit MappedInputFile(const boost::filesystem::path& file)
+      : size_(boost::filesystem::file_size(file)) {
+    if (size_ != 0) {
+      const auto fd = mt::open(file, O_RDONLY);
+      void* data =
+          mt::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd.get(), 0);
+      ::madvise(data, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char*>(data);
+    }
+  }
 
-std::string getNameOfLockFile() { return getPrefix() + ".lock"; }
+  ~MappedInputFile() {
+    if (data_) mt::munmap(const_cast<char*>(data_), size_);
+  }
 
-std::string getPartitionPrefix(size_t index) {
-  return getPrefix() + '.' + std::to_string(index);
+  const char* begin() const { return data_; }
+  const char* end() const { return data_ + size_; }
+
+ private:
+  const char* data_ = nullptr;
+  uint64_t size_ = 0;
+};
+
+struct Base64Chunk {
+  const char* begin;
+  const char* end;
+};
+
+bool isLineBreak(char c) { return c == '\n' || c == '\r'; }
+
+bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\f' || c == '\v' || isLineBreak(c);
+}
+
+void splitIntoChunks(const MappedInputFile& file,
+                     std::vector<Base64Chunk>* chunks) {
+  auto begin = file.begin();
+  while (begin != file.end()) {
+    auto end =
+        begin + std::min<uint64_t>(BASE64_CHUNK_SIZE, file.end() - begin);
+    while (end != file.end() && !isLineBreak(end[-1])) ++end;
+    chunks->push_back(Base64Chunk{begin, end});
+    begin = end;
+  }
+}
+// Chunks end after a line break, so that each line is in a single chunk.
+
+void parseChunk(const Base64Chunk& chunk, WriteBatch* batch) {
+  std::string key;
+  std::string value;
+  bool has_key = false;
+  auto pos = chunk.begin;
+  while (pos != chunk.end) {
+    if (isLineBreak(*pos)) {
+      has_key = false;
+      ++pos;
+    } else if (isSpace(*pos)) {
+      ++pos;
+    } else {
+      auto token_end = pos;
+      while (token_end != chunk.end && !isSpace(*token_end)) ++token_end;
+      if (has_key) {
+        internal::Base64::decode(pos, token_end - pos, &value);
+        batch->put(key, value);
+      } else {
+        internal::Base64::decode(pos, token_end - pos, &key);
+        has_key = true;
+      }
+      pos = token_end;
+    }
+  }
 }
+// Each line consists of a key followed by its values.  Blank lines are
+// ignored.
+
+class ChunkSequencer : public mt::Resource {
+  // Lets the chunks of an import update each partition in the order of their
+  // indices, so that the values of a key keep the order of the input, while
+  // different chunks update different partitions at the same time.
+
+ public:
+  explicit ChunkSequencer(size_t num_partitions)
+      : next_chunks_(num_partitions, 0) {}
+
+  template <typename Procedure>
+  void run(size_t chunk, size_t partition, Procedure process) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [&] {
+      return failed_ || next_chunks_[partition] == chunk;
+    });
+    if (failed_) return;
+    lock.unlock();
+    process();
+    lock.lock();
+    ++next_chunks_[partition];
+    cond_.notify_all();
+  }
+  // Calls `process` after all chunks with a smaller index have been run for
+  // `partition`, unless a chunk has failed.
+
+  void fail() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    failed_ = true;
+    cond_.notify_all();
+  }
+
+  bool hasFailed() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return failed_;
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<size_t> next_chunks_;
+  bool failed_ = false;
+};
+
+template <typename Procedure>
+// Required interface:
+// void process(const boost::filesystem::path& file);
+void forEachInputFile(const boost::filesystem::path& input,
+                      Procedure process) {
+  const auto is_hidden = [](const boost::filesystem::path& path) {
+    return path.filename().string().front() == '.';
+  };
+
+  if (boost::filesystem::is_regular_file(input)) {
+    process(input);
+  } else if (boost::filesystem::is_directory(input)) {
+    boost::filesystem::directory_iterator end;
+    for (boost::filesystem::directory_iterator it(input); it != end; ++it) {
+      const auto path = it->path();
+      if (boost::filesystem::is_regular_file(path) && !is_hidden(path)) {
+        process(path);
+      }
+    }
+  } else {
+    mt::fail("No such file or directory '%s'", input.c_str());
+  }
+}
+// `input` is either a file or a directory whose regular files that are not
+// hidden are processed.
+
+std::string getPrefix() { return "multimap.map"; }
 
 std::string getNameOfKeysFile(size_t index) {
-  return internal::Partition::getNameOfKeysFile(getPartitionPrefix(index));
+  return internal::Partition::getNameOfKeysFile(Map::getPartitionPrefix(index));
 }
 
 std::string getNameOfStatsFile(size_t index) {
-  return internal::Partition::getNameOfStatsFile(getPartitionPrefix(index));
+  return internal::Partition::getNameOfStatsFile(
+      Map::getPartitionPrefix(index));
 }
 
 std::string getNameOfValuesFile(size_t index) {
-  return internal::Partition::getNameOfValuesFile(getPartitionPrefix(index));
+  return internal::Partition::getNameOfValuesFile(
+      Map::getPartitionPrefix(index));
 }
 
 template <typename Procedure>
@@ -60,21 +234,178 @@ template <typename Procedure>
 //              const internal::Partition::Options& partition_options,
 //              size_t partition_index, size_t num_partitions);
 void forEachPartition(const boost::filesystem::path& directory,
-                      Procedure process) {
-  mt::DirectoryLockGuard lock(directory, getNameOfLockFile());
+                      Procedure process, size_t num_threads = 1,
+                      bool numa_aware = false,
+                      bool shared_thread_pool = false) {
+  // If `num_threads` is not 1, partitions are processed concurrently by a
+  // thread pool of that size, so `process` must be thread-safe.  If also
+  // `numa_aware`, each partition is processed on a thread bound to the NUMA
+  // node it would be assigned to by `Map::getNumaNode()`.  If
+  // `shared_thread_pool`, the process-wide pool is used instead, see
+  // `Map::Options::shared_thread_pool`.
+  mt::DirectoryLockGuard lock(directory, Map::getNameOfLockFile(),
+                             mt::DirectoryLockGuard::Mode::SHARED);
   const auto id = Map::Id::readFromDirectory(directory);
   Version::checkCompatibility(id.major_version, id.minor_version);
 
   internal::Partition::Options partition_options;
   partition_options.block_size = id.block_size;
   partition_options.readonly = true;
+  partition_options.compress = id.compressed;
+  partition_options.front_coding = id.front_coded;
+  const auto directories = Map::getDirectories(directory, id);
+  const auto get_partition_prefix = [&directories](size_t index) {
+    return directories[index % directories.size()] /
+           Map::getPartitionPrefix(index);
+  };
+
+  if (num_threads == 1) {
+    for (size_t i = 0; i != id.num_partitions; ++i) {
+      const auto partition_prefix = get_partition_prefix(i);
+      process(partition_prefix, partition_options, i, id.num_partitions);
+    }
+    return;
+  }
+
+  if (shared_thread_pool) {
+    internal::WorkStealingPool::getShared(num_threads)
+        ->forEachIndex(id.num_partitions, [&](size_t i) {
+          process(get_partition_prefix(i), partition_options, i,
+                  id.num_partitions);
+        });
+    return;
+  }
 
+  const auto numa_nodes =
+      numa_aware ? internal::Numa::getNodes() : std::vector<int>();
+  internal::ThreadPool thread_pool(num_threads);
+  std::vector<std::future<void> > futures;
   for (size_t i = 0; i != id.num_partitions; ++i) {
-    const auto partition_prefix = directory / getPartitionPrefix(i);
-    process(partition_prefix, partition_options, i, id.num_partitions);
+    const auto partition_prefix = get_partition_prefix(i);
+    futures.push_back(thread_pool.submit([&, partition_prefix, i] {
+      if (!numa_nodes.empty()) {
+        internal::Numa::bindCurrentThreadToNode(
+            numa_nodes[i % numa_nodes.size()]);
+      }
+      process(partition_prefix, partition_options, i, id.num_partitions);
+    }));
+  }
+  for (auto& future : futures) {
+    future.get();
   }
 }
 
+internal::Sorter::Options getSorterOptions(
+    const boost::filesystem::path& output, bool is_directory) {
+  internal::Sorter::Options options;
+  options.directory = is_directory ? output : output.parent_path();
+  return options;
+}
+// Values that are sorted on their way to `output` spill into the same file
+// system, which is expected to have room for them.
+
+void optimizeToFrozen(const boost::filesystem::path& directory,
+                      const boost::filesystem::path& output,
+                      const Map::Options& options) {
+  FrozenMap::Builder frozen_map(output);
+  forEachPartition(
+      directory,
+      [&](const boost::filesystem::path& partition_prefix,
+          const internal::Partition::Options& partition_options,
+          size_t partition_index, size_t num_partitions) {
+        if (!options.quiet) {
+          mt::log(std::cout) << "Freezing partition " << (partition_index + 1)
+                             << " of " << num_partitions << std::endl;
+        }
+        if (options.compare) {
+          internal::Sorter sorter(options.compare,
+                                  getSorterOptions(output, true));
+          internal::Partition::forEachEntry(
+              partition_prefix, partition_options,
+              [&](const Bytes& key, Iterator* iter) {
+                while (iter->hasNext()) {
+                  sorter.add(iter->next());
+                }
+                frozen_map.put(key, sorter.sort().get());
+              },
+              internal::Partition::ScanOrder::BLOCKS);
+        } else {
+          internal::Partition::forEachEntry(
+              partition_prefix, partition_options,
+              [&](const Bytes& key, Iterator* iter) {
+                frozen_map.put(key, iter);
+              },
+              internal::Partition::ScanOrder::BLOCKS);
+        }
+      },
+      options.num_threads, options.numa_aware, options.shared_thread_pool);
+  frozen_map.finish();
+}
+// Each key's values are written as one record, so source partitions can be
+// read concurrently like for a regular optimization.
+
+std::string getNameOfExportFile(size_t index, const std::string& extension) {
+  return Map::getPartitionPrefix(index) + extension;
+}
+
+template <typename Procedure>
+// Required interface:
+// void process(const boost::filesystem::path& partition_prefix,
+//              const internal::Partition::Options& partition_options,
+//              size_t partition_index);
+void forEachPartitionToExport(const boost::filesystem::path& directory,
+                              bool in_parallel, const Map::Options& options,
+                              Procedure process) {
+  // Partitions are exported by `options.num_threads` threads if each one is
+  // written into its own file, and one after another otherwise.
+  std::mutex log_mutex;
+  forEachPartition(
+      directory,
+      [&](const boost::filesystem::path& partition_prefix,
+          const internal::Partition::Options& partition_options,
+          size_t partition_index, size_t num_partitions) {
+        if (!options.quiet) {
+          std::lock_guard<std::mutex> lock(log_mutex);
+          mt::log(std::cout) << "Exporting partition " << (partition_index + 1)
+                             << " of " << num_partitions << std::endl;
+        }
+        process(partition_prefix, partition_options, partition_index);
+      },
+      in_parallel ? options.num_threads : 1, in_parallel && options.numa_aware,
+      options.shared_thread_pool);
+}
+
+std::vector<uint64_t> readFeedOffsetsFile(
+    const boost::filesystem::path& filename) {
+  mt::Check::isTrue(boost::filesystem::is_regular_file(filename),
+                    "Map: '%s' does not exist, hence the map is not a "
+                    "snapshot of a map with a change feed",
+                    filename.c_str());
+  const auto size = boost::filesystem::file_size(filename);
+  mt::Check::isZero(size % sizeof(uint64_t),
+                    "Map: '%s' is not a valid feed offsets file",
+                    filename.c_str());
+  std::vector<uint64_t> offsets(size / sizeof(uint64_t));
+  const auto stream = mt::fopen(filename, "r");
+  mt::fread(stream.get(), offsets.data(), size);
+  return offsets;
+}
+
+void writeFeedOffsetsFile(const std::vector<uint64_t>& offsets,
+                          const boost::filesystem::path& filename) {
+  const auto new_filename = filename.string() + ".new";
+  {
+    const auto stream = mt::fopen(new_filename, "w");
+    mt::fwrite(stream.get(), offsets.data(),
+               offsets.size() * sizeof(uint64_t));
+  }
+  boost::filesystem::rename(new_filename, filename);
+  // Replaces the previous file atomically.
+}
+// The file holds the offset into the change feed of each partition of the
+// map that has been snapshotted, up to which the lists have been copied or
+// followed since.
+
 }  // namespace
 
 Map::Id Map::Id::readFromDirectory(const boost::filesystem::path& directory) {
@@ -83,8 +414,12 @@ Map::Id Map::Id::readFromDirectory(const boost::filesystem::path& directory) {
 
 Map::Id Map::Id::readFromFile(const boost::filesystem::path& filename) {
   Id id;
+  const auto size = boost::filesystem::file_size(filename);
+  mt::Check::isTrue(size >= offsetof(Id, compressed) && size <= sizeof id &&
+                        size % sizeof(uint64_t) == 0,
+                    "Map: '%s' is not a valid id file", filename.c_str());
   const auto stream = mt::fopen(filename, "r");
-  mt::fread(stream.get(), &id, sizeof id);
+  mt::fread(stream.get(), &id, size);
   return id;
 }
 
@@ -105,12 +440,54 @@ Map::Map(const boost::filesystem::path& directory)
     : Map(directory, Options()) {}
 
 Map::Map(const boost::filesystem::path& directory, const Options& options)
-    : lock_(directory, getNameOfLockFile()) {
+    : lock_(directory, getNameOfLockFile(),
+            options.readonly ? mt::DirectoryLockGuard::Mode::SHARED
+                             : mt::DirectoryLockGuard::Mode::EXCLUSIVE) {
   checkOptions(options);
-  internal::Partition::Options part_options;
-  part_options.readonly = options.readonly;
-  part_options.block_size = options.block_size;
-  part_options.buffer_size = options.buffer_size;
+  partition_options_.readonly = options.readonly;
+  partition_options_.block_size = options.block_size;
+  partition_options_.buffer_size = options.buffer_size;
+  partition_options_.background_flush = options.background_flush;
+  partition_options_.num_write_lanes = options.num_write_lanes;
+  partition_options_.track_tail_blocks =
+      options.tail_memory_budget != 0 && !options.readonly;
+  partition_options_.max_values_per_key = options.max_values_per_key;
+  partition_options_.write_ahead_log = options.write_ahead_log;
+  partition_options_.sync_write_ahead_log = options.sync_write_ahead_log;
+  partition_options_.change_feed = options.change_feed;
+  partition_options_.hot_keys = options.hot_keys;
+  partition_options_.hot_keys_sample_rate = options.hot_keys_sample_rate;
+  partition_options_.durability = options.durability;
+  partition_options_.populate = options.populate;
+  partition_options_.huge_pages = options.huge_pages;
+  partition_options_.lock_in_memory = options.lock_in_memory;
+  partition_options_.direct_io = options.direct_io;
+  partition_options_.max_read_ahead = options.max_read_ahead;
+  partition_options_.max_extent_size = options.max_extent_size;
+  partition_options_.checksums = options.checksums;
+  partition_options_.bloom_filter_false_positive_rate =
+      options.bloom_filter_false_positive_rate;
+  num_threads_ = options.num_threads;
+  num_async_threads_ = options.num_async_threads;
+  if (options.shared_thread_pool) {
+    shared_thread_pool_ =
+        internal::WorkStealingPool::getShared(options.num_threads);
+  }
+  compare_ = options.compare;
+  on_partition_open_ = options.on_partition_open;
+  on_partition_close_ = options.on_partition_close;
+  if (options.metrics) {
+    metrics_ = std::make_shared<internal::Metrics>();
+    partition_options_.metrics = metrics_;
+  }
+  if (options.background_io_rate != 0) {
+    partition_options_.io_limiter =
+        std::make_shared<internal::IoLimiter>(options.background_io_rate);
+  }
+  if (options.online_repartitioning) {
+    routing_mutexes_.reset(new boost::shared_mutex[NUM_ROUTING_MUTEXES]);
+  }
+  uint64_t num_incomplete_partition = 0;
   const auto id_filename = directory / getNameOfIdFile();
   if (boost::filesystem::is_regular_file(id_filename)) {
     mt::Check::isFalse(options.error_if_exists, "Map in '%s' already exists",
@@ -118,51 +495,619 @@ Map::Map(const boost::filesystem::path& directory, const Options& options)
     const auto id = Id::readFromFile(id_filename);
     Version::checkCompatibility(id.major_version, id.minor_version);
     partitions_.resize(id.num_partitions);
+    block_size_ = id.block_size;
+    if (id.compressed) {
+      mt::Check::isTrue(options.readonly,
+                        "Map in '%s' is compressed and must be read-only",
+                        boost::filesystem::absolute(directory).c_str());
+      partition_options_.compress = true;
+    }
+    partition_options_.front_coding = id.front_coded;
+    partition_options_.sorted = id.sorted;
+    mt::Check::isTrue(id.key_hash <= static_cast<uint64_t>(KeyHash::CRC32C),
+                      "Map in '%s' uses an unknown key hash function",
+                      boost::filesystem::absolute(directory).c_str());
+    partition_options_.key_hash = static_cast<KeyHash>(id.key_hash);
+    fnv1a_partitioning_ = !id.xxhash_partitioning;
+    directories_ = getDirectories(directory, id);
+    num_incomplete_partition =
+        readRoutesFile(directory / getNameOfRoutesFile());
+    mt::Check::isTrue(
+        num_incomplete_partition == 0 || !options.readonly,
+        "Map in '%s' has been repartitioned incompletely and must be opened "
+        "writable first",
+        boost::filesystem::absolute(directory).c_str());
+    MT_ASSERT_GE(partitions_.size(), id.num_partitions);
+    if (options.readonly && options.block_cache_size != 0) {
+      partition_options_.block_cache = std::make_shared<internal::BlockCache>(
+          options.block_cache_size, block_size_);
+    }
+    if (options.lazy) {
+      once_flags_.reset(new std::once_flag[partitions_.size()]);
+    }
 
   } else {
     mt::Check::isTrue(options.create_if_missing, "Map in '%s' does not exist",
                       boost::filesystem::absolute(directory).c_str());
+    mt::Check::isFalse(options.compress,
+                       "Compressed maps can only be created via MapBuilder");
+    partition_options_.front_coding = options.front_coding;
+    partition_options_.key_hash = options.key_hash;
     partitions_.resize(mt::nextPrime(options.num_partitions));
+    directories_.push_back(directory);
+    for (const auto& extra_directory : options.directories) {
+      directories_.push_back(boost::filesystem::absolute(extra_directory));
+    }
+    if (directories_.size() > 1) {
+      mt::Files::writeLinewise(
+          std::vector<boost::filesystem::path>(directories_.begin() + 1,
+                                               directories_.end()),
+          directory / getNameOfDirectoriesFile(),
+          [](const boost::filesystem::path& path, std::ostream& os) {
+            os << path.string();
+          });
+    }
   }
-  for (size_t i = 0; i != partitions_.size(); ++i) {
-    const auto prefix = directory / getPartitionPrefix(i);
-    partitions_[i].reset(new internal::Partition(prefix, part_options));
+  partition_options_.warm_up_size = options.warm_up_size / partitions_.size();
+  for (size_t i = 1; i < directories_.size(); ++i) {
+    directory_locks_.emplace_back(
+        new mt::DirectoryLockGuard(directories_[i], getNameOfLockFile(),
+                                   lock_.mode()));
+  }
+  if (options.numa_aware) {
+    numa_nodes_ = internal::Numa::getNodes();
+  }
+  if (!once_flags_ && numa_nodes_.size() > 1) {
+    // One thread per node opens the partitions assigned to it, so that their
+    // memory is allocated on that node.
+    std::vector<std::future<void> > futures;
+    for (size_t n = 0; n != numa_nodes_.size(); ++n) {
+      futures.push_back(std::async(std::launch::async, [this, n] {
+        internal::Numa::bindCurrentThreadToNode(numa_nodes_[n]);
+        for (size_t i = n; i < partitions_.size(); i += numa_nodes_.size()) {
+          openPartition(i);
+        }
+      }));
+    }
+    for (auto& future : futures) {
+      future.get();
+    }
+    block_size_ = partitions_.front()->getBlockSize();
+  } else if (!once_flags_ && shared_thread_pool_) {
+    shared_thread_pool_->forEachIndex(
+        partitions_.size(), [this](size_t i) { openPartition(i); });
+    block_size_ = partitions_.front()->getBlockSize();
+  } else if (!once_flags_ && getNumWorkerThreads() > 1) {
+    // Each partition reads its keys file when opened, which takes as long as
+    // the slowest partition when they are opened concurrently.
+    internal::ThreadPool thread_pool(getNumWorkerThreads());
+    std::vector<std::future<void> > futures;
+    for (size_t i = 0; i != partitions_.size(); ++i) {
+      futures.push_back(thread_pool.submit([this, i] { openPartition(i); }));
+    }
+    for (auto& future : futures) {
+      future.get();
+    }
+    block_size_ = partitions_.front()->getBlockSize();
+  } else if (!once_flags_) {
+    for (size_t i = 0; i != partitions_.size(); ++i) {
+      openPartition(i);
+    }
+    block_size_ = partitions_.front()->getBlockSize();
+  }
+  if (num_incomplete_partition != 0) {
+    getPartition(num_incomplete_partition - 1);
+    writeRoutesFile(0);
+    // The partition has been cleaned up when opened.
+  }
+  if ((options.write_ahead_log || options.checkpoint_interval != 0 ||
+       options.memory_limit != 0) &&
+      !options.readonly && !boost::filesystem::is_regular_file(id_filename)) {
+    writeIdFile(false);
+    // Otherwise, a new map could not be recovered after a crash.
+  }
+  if (partition_options_.sorted && !options.readonly) {
+    writeIdFile(false);
+    // Appends may break the order, which is only confirmed again when the
+    // map is closed, so that a crash cannot leave an unsorted list behind
+    // that is searched via binary search.
+  }
+  if (partition_options_.track_tail_blocks) {
+    const auto max_num_tail_blocks =
+        options.tail_memory_budget / block_size_ / partitions_.size();
+    flusher_.reset(new internal::Flusher(max_num_tail_blocks));
+    if (!once_flags_) {
+      for (const auto& partition : partitions_) {
+        flusher_->add(partition.get());
+      }
+    }
+  }
+  if (options.checkpoint_interval != 0 && !options.readonly) {
+    checkpointer_.reset(new internal::Checkpointer(
+        std::chrono::seconds(options.checkpoint_interval)));
+    if (!once_flags_) {
+      for (const auto& partition : partitions_) {
+        checkpointer_->add(partition.get());
+      }
+    }
+  }
+  if (options.compaction_threshold != 0 && !options.readonly) {
+    compactor_.reset(new internal::Compactor(options.compaction_threshold,
+                                             options.compaction_rate));
+    if (!once_flags_) {
+      for (const auto& partition : partitions_) {
+        compactor_->add(partition.get());
+      }
+    }
+  }
+  if (options.memory_limit != 0 && !options.readonly) {
+    spiller_.reset(
+        new internal::Spiller(options.memory_limit / partitions_.size()));
+    if (!once_flags_) {
+      for (const auto& partition : partitions_) {
+        spiller_->add(partition.get());
+      }
+    }
+  }
+  if (options.live_stats_interval != 0 && !options.readonly) {
+    stats_publisher_.reset(new internal::StatsPublisher(
+        directory / getNameOfLiveStatsFile(),
+        std::chrono::milliseconds(options.live_stats_interval)));
+    for (size_t i = 0; i != partitions_.size(); ++i) {
+      if (!once_flags_) {
+        stats_publisher_->add(i, partitions_[i].get());
+      } else {
+        const auto stats_file =
+            directories_[i % directories_.size()] / getNameOfStatsFile(i);
+        stats_publisher_->set(i, Stats::readFromFile(stats_file));
+        // Partitions that are not opened yet are published as stored.
+      }
+    }
+  }
+  if (options.warm_up_size != 0 && !once_flags_) {
+    warm_up_thread_ = std::thread(&Map::warmUp, this);
+    // Started last, so that it is never left running if the constructor
+    // throws.
   }
 }
 
 Map::~Map() {
+  async_thread_pool_.reset();
+  // Completes pending lookups.
+  if (warm_up_thread_.joinable()) {
+    stop_warm_up_ = true;
+    warm_up_thread_.join();
+  }
+  stats_publisher_.reset();
+  spiller_.reset();
+  compactor_.reset();
+  checkpointer_.reset();
+  flusher_.reset();
   if (!partitions_.empty()) {
-    Id id;
-    id.num_partitions = partitions_.size();
-    id.block_size = partitions_.front()->getBlockSize();
-    id.writeToFile(lock_.directory() / getNameOfIdFile());
+    bool sorted = partition_options_.sorted;
+    for (const auto& partition : partitions_) {
+      // Partitions of a lazily opened map that were never opened are
+      // unchanged.
+      if (sorted && partition) sorted = partition->hasSortedValues();
+    }
+    writeIdFile(sorted);
+  }
+  closePartitions();
+  if (metrics_ && !isReadOnly()) {
+    // Closing the partitions flushes their stores, and thereby counts the
+    // bytes they write last.
+    metrics_->getSnapshot().writeToFile(directories_.front() /
+                                        getNameOfMetricsFile());
+  }
+}
+
+void Map::write(const WriteBatch& batch) {
+  const internal::Metrics::Timer timer(metrics_.get(), Operation::WRITE);
+  std::vector<Bytes> keys;
+  std::vector<Bytes> values;
+  std::vector<uint64_t> hashes;
+  const auto lock = lockRouting();
+  const auto groups = groupByPartition(batch, &keys, &values, &hashes);
+  for (size_t i = 0; i != groups.size(); ++i) {
+    if (!groups[i].empty()) {
+      getPartition(i)->putMany(keys, hashes, values, groups[i]);
+    }
   }
 }
 
+std::vector<std::unique_ptr<Iterator> > Map::getMany(
+    const std::vector<Bytes>& keys) const {
+  const internal::Metrics::Timer timer(metrics_.get(), Operation::GET_MANY);
+  std::vector<std::unique_ptr<Iterator> > iterators(keys.size());
+  const auto lock = lockRouting();
+  std::vector<uint64_t> hashes;
+  const auto groups = groupByPartition(keys, &hashes);
+  for (size_t i = 0; i != groups.size(); ++i) {
+    if (!groups[i].empty()) {
+      getPartition(i)->getMany(keys, hashes, groups[i], &iterators);
+    }
+  }
+  return iterators;
+}
+
+std::future<std::vector<std::string> > Map::getAsync(const Bytes& key) const {
+  typedef std::vector<std::string> Values;
+  const auto promise = std::make_shared<std::promise<Values> >();
+  auto future = promise->get_future();
+  const auto key_copy = key.toString();
+  getAsyncThreadPool()->submit([this, key_copy, promise] {
+    try {
+      Values values;
+      get(key_copy, [&values](Iterator* iter) {
+        values.reserve(iter->available());
+        while (iter->hasNext()) {
+          values.push_back(iter->next().toString());
+        }
+      });
+      promise->set_value(std::move(values));
+    } catch (...) {
+      promise->set_exception(std::current_exception());
+    }
+  });
+  return future;
+}
+
+std::vector<bool> Map::containsMany(const std::vector<Bytes>& keys) const {
+  std::vector<bool> results(keys.size());
+  const auto lock = lockRouting();
+  std::vector<uint64_t> hashes;
+  const auto groups = groupByPartition(keys, &hashes);
+  for (size_t i = 0; i != groups.size(); ++i) {
+    if (!groups[i].empty()) {
+      getPartition(i)->containsMany(keys, hashes, groups[i], &results);
+    }
+  }
+  return results;
+}
+
+std::vector<uint32_t> Map::countMany(const std::vector<Bytes>& keys) const {
+  std::vector<uint32_t> results(keys.size());
+  const auto lock = lockRouting();
+  std::vector<uint64_t> hashes;
+  const auto groups = groupByPartition(keys, &hashes);
+  for (size_t i = 0; i != groups.size(); ++i) {
+    if (!groups[i].empty()) {
+      getPartition(i)->countMany(keys, hashes, groups[i], &results);
+    }
+  }
+  return results;
+}
+
+std::vector<uint32_t> Map::replaceMany(const std::vector<Bytes>& keys,
+                                       const std::vector<Bytes>& old_values,
+                                       const std::vector<Bytes>& new_values) {
+  mt::Check::isEqual(keys.size(), old_values.size(),
+                     "Map::replaceMany() got %zu keys, but %zu old values",
+                     keys.size(), old_values.size());
+  mt::Check::isEqual(keys.size(), new_values.size(),
+                     "Map::replaceMany() got %zu keys, but %zu new values",
+                     keys.size(), new_values.size());
+  const internal::Metrics::Timer timer(metrics_.get(), Operation::REPLACE);
+  std::vector<uint32_t> results(keys.size());
+  const auto lock = lockRouting();
+  std::vector<uint64_t> hashes;
+  const auto groups = groupByPartition(keys, &hashes);
+  for (size_t i = 0; i != groups.size(); ++i) {
+    if (!groups[i].empty()) {
+      getPartition(i)->replaceMany(keys, hashes, old_values, new_values,
+                                   groups[i], &results);
+    }
+  }
+  return results;
+}
+
+uint32_t Map::getNumScanThreads(uint32_t num_threads) const {
+  if (shared_thread_pool_) return shared_thread_pool_->size();
+  return num_threads ? num_threads
+                     : internal::ThreadPool::getDefaultNumThreads();
+}
+
 std::vector<Map::Stats> Map::getStats() const {
   std::vector<Stats> stats;
-  for (const auto& partition : partitions_) {
-    stats.push_back(partition->getStats());
+  const auto lock = lockRouting();
+  for (size_t i = 0; i != partitions_.size(); ++i) {
+    stats.push_back(getPartition(i)->getStats());
   }
   return stats;
 }
 
 Map::Stats Map::getTotalStats() const { return Stats::total(getStats()); }
 
-bool Map::isReadOnly() const { return partitions_.front()->isReadOnly(); }
+std::vector<Map::Stats> Map::getCurrentStats() const {
+  std::vector<Stats> stats;
+  const auto lock = lockRouting();
+  for (size_t i = 0; i != partitions_.size(); ++i) {
+    stats.push_back(getPartition(i)->getCurrentStats());
+  }
+  return stats;
+}
+
+Map::Stats Map::getCurrentTotalStats() const {
+  return Stats::total(getCurrentStats());
+}
+
+std::vector<Map::SampledStats> Map::getSampledStats(
+    size_t num_samples) const {
+  std::vector<SampledStats> stats;
+  const auto lock = lockRouting();
+  for (size_t i = 0; i != partitions_.size(); ++i) {
+    stats.push_back(getPartition(i)->getSampledStats(num_samples));
+  }
+  return stats;
+}
+
+Map::SampledStats Map::getSampledTotalStats(size_t num_samples) const {
+  return SampledStats::total(getSampledStats(num_samples));
+}
+
+std::vector<Map::MemoryUsage> Map::getMemoryUsage() const {
+  std::vector<MemoryUsage> usages;
+  const auto lock = lockRouting();
+  for (size_t i = 0; i != partitions_.size(); ++i) {
+    usages.push_back(getPartition(i)->getMemoryBreakdown());
+  }
+  return usages;
+}
+
+Map::MemoryUsage Map::getTotalMemoryUsage() const {
+  auto total = MemoryUsage::total(getMemoryUsage());
+  total.mutex_pool = internal::SharedMutex::getCurrentPoolSize() *
+                     internal::SharedMutex::getSizeOfPooledMutex();
+  return total;
+}
+
+std::vector<std::pair<std::string, uint64_t> > Map::getHotKeys(
+    size_t k) const {
+  std::vector<std::pair<std::string, uint64_t> > hot_keys;
+  const auto lock = lockRouting();
+  for (size_t i = 0; i != partitions_.size(); ++i) {
+    const auto top = getPartition(i)->getHotKeys(k);
+    hot_keys.insert(hot_keys.end(), top.begin(), top.end());
+  }
+  std::sort(hot_keys.begin(), hot_keys.end(),
+            [](const std::pair<std::string, uint64_t>& a,
+               const std::pair<std::string, uint64_t>& b) {
+              return a.second > b.second;
+            });
+  if (hot_keys.size() > k) hot_keys.resize(k);
+  return hot_keys;
+}
+
+Map::Metrics Map::getMetrics() const {
+  return metrics_ ? metrics_->getSnapshot() : Metrics();
+}
+
+bool Map::isReadOnly() const { return partition_options_.readonly; }
+
+int Map::getNumaNode(size_t partition_index) const {
+  MT_REQUIRE_LT(partition_index, partitions_.size());
+  return numa_nodes_.empty()
+             ? -1
+             : numa_nodes_[partition_index % numa_nodes_.size()];
+}
+
+size_t Map::getNumPartitions() const {
+  const auto lock = lockRouting();
+  return partitions_.size();
+}
+
+size_t Map::getPartitionIndexOf(const Bytes& key) const {
+  const auto hashed_key = hashKey(key);
+  const auto lock = lockRouting(hashed_key.hash());
+  return getPartitionIndex(hashed_key);
+}
+
+uint64_t Map::removeExpired() {
+  mt::Check::isFalse(isReadOnly(), "Attempt to remove from read-only map");
+  uint64_t num_keys_removed = 0;
+  const auto lock = lockRouting();
+  for (size_t i = 0; i != partitions_.size(); ++i) {
+    num_keys_removed += getPartition(i)->removeExpiredLists();
+  }
+  return num_keys_removed;
+}
+
+void Map::checkpoint() {
+  mt::Check::isFalse(isReadOnly(), "Attempt to checkpoint read-only map");
+  const auto lock = lockRouting();
+  writeIdFile(false);
+  for (size_t i = 0; i != partitions_.size(); ++i) {
+    getPartition(i)->checkpoint();
+  }
+}
+
+void Map::snapshot(const boost::filesystem::path& directory) {
+  mt::Check::isFalse(isReadOnly(), "Attempt to snapshot read-only map");
+  mt::Check::isTrue(boost::filesystem::is_directory(directory),
+                    "Map: '%s' is not a directory", directory.c_str());
+  mt::Check::isTrue(boost::filesystem::is_empty(directory),
+                    "Map: '%s' is not empty", directory.c_str());
+  mt::Check::isFalse(boost::filesystem::equivalent(directory,
+                                                   lock_.directory()),
+                     "Map: cannot snapshot a map into its own directory");
+  const internal::IoLimiter::Scope scope(internal::IoLimiter::Priority::LOW);
+  const auto lock = lockRouting();
+  std::vector<uint64_t> feed_offsets(partitions_.size());
+  for (size_t i = 0; i != partitions_.size(); ++i) {
+    feed_offsets[i] =
+        getPartition(i)->snapshot(directory / getPartitionPrefix(i));
+  }
+  if (partition_options_.change_feed) {
+    writeFeedOffsetsFile(feed_offsets, directory / getNameOfFeedOffsetsFile());
+  }
+  const auto routes_file = lock_.directory() / getNameOfRoutesFile();
+  if (boost::filesystem::is_regular_file(routes_file)) {
+    boost::filesystem::copy_file(routes_file,
+                                 directory / getNameOfRoutesFile());
+  }
+  auto id = getId(false);
+  id.num_directories = 1;
+  id.writeToFile(directory / getNameOfIdFile());
+  // Written last, so that an incomplete snapshot cannot be opened.
+}
+
+uint64_t Map::followChangeFeed(const boost::filesystem::path& directory) {
+  mt::Check::isFalse(isReadOnly(), "Attempt to update read-only map");
+  const auto lock = lockRouting();
+  const auto offsets_file = lock_.directory() / getNameOfFeedOffsetsFile();
+  auto offsets = readFeedOffsetsFile(offsets_file);
+  mt::Check::isTrue(offsets.size() == partitions_.size(),
+                    "Map: '%s' has not been snapshotted from '%s'",
+                    lock_.directory().c_str(), directory.c_str());
+  // The id file of a new map is not written before it is closed.
+  std::vector<boost::filesystem::path> directories = {directory};
+  const auto directories_file = directory / getNameOfDirectoriesFile();
+  if (boost::filesystem::is_regular_file(directories_file)) {
+    const auto lines = mt::Files::readAllLines(directories_file);
+    directories.insert(directories.end(), lines.begin(), lines.end());
+  }
+  uint64_t num_records = 0;
+  for (size_t i = 0; i != partitions_.size(); ++i) {
+    const auto feed_file = internal::Partition::getNameOfFeedFile(
+        (directories[i % directories.size()] / getPartitionPrefix(i))
+            .string());
+    mt::Check::isTrue(boost::filesystem::is_regular_file(feed_file),
+                      "Map: '%s' does not exist", feed_file.c_str());
+    offsets[i] =
+        getPartition(i)->followChangeFeed(feed_file, offsets[i], &num_records);
+  }
+  writeFeedOffsetsFile(offsets, offsets_file);
+  return num_records;
+}
+
+std::string Map::getNameOfIdFile() { return getPrefix() + ".id"; }
+
+std::string Map::getNameOfLockFile() { return getPrefix() + ".lock"; }
+
+std::string Map::getNameOfRoutesFile() { return getPrefix() + ".routes"; }
+
+std::string Map::getNameOfDirectoriesFile() { return getPrefix() + ".dirs"; }
+
+std::string Map::getNameOfMetricsFile() { return getPrefix() + ".metrics"; }
+
+std::string Map::getNameOfFeedOffsetsFile() {
+  return getPrefix() + ".feedoffsets";
+}
+
+std::string Map::getNameOfLiveStatsFile() {
+  return getPrefix() + ".livestats";
+}
+
+std::vector<boost::filesystem::path> Map::getDirectories(
+    const boost::filesystem::path& directory, const Id& id) {
+  std::vector<boost::filesystem::path> directories = {directory};
+  if (id.num_directories > 1) {
+    const auto filename = directory / getNameOfDirectoriesFile();
+    const auto lines = mt::Files::readAllLines(filename);
+    mt::Check::isTrue(lines.size() + 1 == id.num_directories,
+                      "Map: '%s' is not a valid directories file",
+                      filename.c_str());
+    directories.insert(directories.end(), lines.begin(), lines.end());
+  }
+  return directories;
+}
+
+std::string Map::getPartitionPrefix(size_t index) {
+  return getPrefix() + '.' + std::to_string(index);
+}
+
+size_t Map::getPartitionIndex(const Bytes& key, size_t num_partitions) {
+  return getPartitionIndex(HashedKey::hash(key), num_partitions);
+}
+
+size_t Map::getPartitionIndex(uint64_t key_hash, size_t num_partitions) {
+  MT_ASSERT_LE(num_partitions, std::numeric_limits<uint32_t>::max());
+  return ((key_hash >> 32) * num_partitions) >> 32;
+}
 
 std::vector<Map::Stats> Map::stats(const boost::filesystem::path& directory) {
-  mt::DirectoryLockGuard lock(directory, getNameOfLockFile());
+  mt::DirectoryLockGuard lock(directory, getNameOfLockFile(),
+                             mt::DirectoryLockGuard::Mode::SHARED);
   const auto id = Id::readFromDirectory(directory);
   Version::checkCompatibility(id.major_version, id.minor_version);
   std::vector<Stats> stats;
+  const auto directories = getDirectories(directory, id);
   for (size_t i = 0; i != id.num_partitions; ++i) {
-    const auto stats_file = directory / getNameOfStatsFile(i);
+    const auto stats_file =
+        directories[i % directories.size()] / getNameOfStatsFile(i);
     stats.push_back(Stats::readFromFile(stats_file));
   }
   return stats;
 }
 
+std::vector<Map::Stats> Map::liveStats(
+    const boost::filesystem::path& directory,
+    std::chrono::system_clock::time_point* published) {
+  const auto file = directory / getNameOfLiveStatsFile();
+  mt::Check::isTrue(boost::filesystem::is_regular_file(file),
+                    "Map in '%s' is not open with live stats",
+                    directory.c_str());
+  return internal::StatsPublisher::read(file, published);
+}
+
+Map::Metrics Map::metrics(const boost::filesystem::path& directory) {
+  mt::DirectoryLockGuard lock(directory, getNameOfLockFile(),
+                             mt::DirectoryLockGuard::Mode::SHARED);
+  const auto metrics_file = directory / getNameOfMetricsFile();
+  return boost::filesystem::is_regular_file(metrics_file)
+             ? Metrics::readFromFile(metrics_file)
+             : Metrics();
+}
+
+Map::Tuning Map::recommendOptions(const boost::filesystem::path& directory) {
+  return recommendOptions(directory, Options());
+}
+
+Map::Tuning Map::recommendOptions(const boost::filesystem::path& directory,
+                                  const Options& options) {
+  const auto num_threads = options.num_threads
+                               ? options.num_threads
+                               : internal::ThreadPool::getDefaultNumThreads();
+  return Tuning::recommend(stats(directory), metrics(directory), num_threads);
+}
+
+std::vector<std::vector<uint32_t> > Map::verify(
+    const boost::filesystem::path& directory) {
+  std::vector<std::vector<uint32_t> > corrupt_blocks;
+  forEachPartition(
+      directory,
+      [&](const boost::filesystem::path& partition_prefix,
+          const internal::Partition::Options& partition_options,
+          size_t, size_t) {
+        corrupt_blocks.push_back(internal::Partition::getCorruptBlocks(
+            partition_prefix, partition_options));
+      });
+  return corrupt_blocks;
+}
+
+std::vector<std::vector<uint32_t> > Map::verifyLists(
+    const boost::filesystem::path& directory, const Options& options) {
+  std::vector<std::vector<uint32_t> > invalid_blocks;
+  std::mutex mutex;
+  forEachPartition(
+      directory,
+      [&](const boost::filesystem::path& partition_prefix,
+          const internal::Partition::Options& partition_options,
+          size_t partition_index, size_t num_partitions) {
+        auto block_ids = internal::Partition::getInvalidBlocks(
+            partition_prefix, partition_options);
+        std::lock_guard<std::mutex> lock(mutex);
+        invalid_blocks.resize(num_partitions);
+        invalid_blocks[partition_index] = std::move(block_ids);
+      },
+      options.num_threads, options.numa_aware, options.shared_thread_pool);
+  return invalid_blocks;
+}
+
+Map::LockProfile Map::getLockProfile() {
+  return internal::LockProfiler::getSnapshot();
+}
+
 void Map::importFromBase64(const boost::filesystem::path& directory,
                            const boost::filesystem::path& input) {
   Map::importFromBase64(directory, input, Options());
@@ -173,120 +1118,244 @@ void Map::importFromBase64(const boost::filesystem::path& directory,
                            const Options& options) {
   Map map(directory, options);
 
-  const auto import_file = [&](const boost::filesystem::path& file) {
-    std::ifstream input(file.string());
-    mt::check(input.is_open(), "Could not open '%s'", file.c_str());
-
+  std::vector<std::unique_ptr<MappedInputFile> > files;
+  std::vector<Base64Chunk> chunks;
+  forEachInputFile(input, [&](const boost::filesystem::path& file) {
     if (!options.quiet) {
       mt::log(std::cout) << "Importing " << file << std::endl;
     }
+    files.emplace_back(new MappedInputFile(file));
+    splitIntoChunks(*files.back(), &chunks);
+  });
 
-    std::string base64_key;
-    std::string base64_value;
-    std::string binary_key;
-    std::string binary_value;
-    if (input >> base64_key) {
-      internal::Base64::decode(base64_key, &binary_key);
-      while (input) {
-        switch (input.peek()) {
-          case '\n':
-          case '\r':
-            input >> base64_key;
-            internal::Base64::decode(base64_key, &binary_key);
-            break;
-          case '\f':
-          case '\t':
-          case '\v':
-          case ' ':
-            input.ignore();
-            break;
-          default:
-            input >> base64_value;
-            internal::Base64::decode(base64_value, &binary_value);
-            map.put(binary_key, binary_value);
+  // Each chunk is parsed, decoded, and grouped by partition by any thread,
+  // which then applies the groups in the order of the chunks.
+  ChunkSequencer sequencer(map.partitions_.size());
+  const auto thread_pool =
+      map.shared_thread_pool_
+          ? map.shared_thread_pool_
+          : std::make_shared<internal::WorkStealingPool>(options.num_threads);
+  std::vector<std::future<void> > futures;
+  futures.reserve(chunks.size());
+  for (size_t i = 0; i != chunks.size(); ++i) {
+    futures.push_back(thread_pool->submit([&map, &chunks, &sequencer, i] {
+      if (sequencer.hasFailed()) return;
+      try {
+        WriteBatch batch;
+        parseChunk(chunks[i], &batch);
+        std::vector<Bytes> keys;
+        std::vector<Bytes> values;
+        std::vector<uint64_t> hashes;
+        const auto groups =
+            map.groupByPartition(batch, &keys, &values, &hashes);
+        for (size_t p = 0; p != groups.size(); ++p) {
+          sequencer.run(i, p, [&] {
+            if (!groups[p].empty()) {
+              map.getPartition(p)->putMany(keys, hashes, values, groups[p]);
+            }
+          });
         }
+      } catch (...) {
+        sequencer.fail();
+        throw;
       }
-    }
-  };
+    }));
+  }
+  thread_pool->waitAll(&futures);
+}
 
-  const auto is_hidden = [](const boost::filesystem::path& path) {
-    return path.filename().string().front() == '.';
-  };
+void Map::importFromBinary(const boost::filesystem::path& directory,
+                           const boost::filesystem::path& input) {
+  Map::importFromBinary(directory, input, Options());
+}
 
-  if (boost::filesystem::is_regular_file(input)) {
-    import_file(input);
-  } else if (boost::filesystem::is_directory(input)) {
-    boost::filesystem::directory_iterator end;
-    for (boost::filesystem::directory_iterator it(input); it != end; ++it) {
-      const auto path = it->path();
-      if (boost::filesystem::is_regular_file(path) && !is_hidden(path)) {
-        import_file(it->path());
+void Map::importFromBinary(const boost::filesystem::path& directory,
+                           const boost::filesystem::path& input,
+                           const Options& options) {
+  Map map(directory, options);
+
+  // Chunks are read by this thread and decoded by any thread as in
+  // `importFromBase64()`.  Since dumps are not mapped into memory, the number
+  // of chunks read ahead is bounded.
+  ChunkSequencer sequencer(map.partitions_.size());
+  const auto thread_pool =
+      map.shared_thread_pool_
+          ? map.shared_thread_pool_
+          : std::make_shared<internal::WorkStealingPool>(options.num_threads);
+  const auto max_pending_chunks = 2 * thread_pool->size();
+  std::deque<std::future<void> > futures;
+  size_t num_chunks = 0;
+  try {
+    forEachInputFile(input, [&](const boost::filesystem::path& file) {
+      if (!options.quiet) {
+        mt::log(std::cout) << "Importing " << file << std::endl;
       }
+      internal::Dump::Reader reader(file);
+      while (true) {
+        std::shared_ptr<internal::Dump::Chunk> chunk(
+            new internal::Dump::Chunk());
+        if (!reader.readChunk(chunk.get())) break;
+        if (futures.size() == max_pending_chunks) {
+          thread_pool->wait(&futures.front());
+          futures.pop_front();
+        }
+        const auto i = num_chunks++;
+        futures.push_back(thread_pool->submit([&map, &sequencer, chunk, i] {
+          if (sequencer.hasFailed()) return;
+          try {
+            std::string payload;
+            internal::Dump::decode(*chunk, &payload);
+            WriteBatch batch;
+            internal::Dump::forEachValue(
+                payload, [&batch](const Bytes& key, const Bytes& value) {
+                  batch.put(key, value);
+                });
+            std::vector<Bytes> keys;
+            std::vector<Bytes> values;
+            std::vector<uint64_t> hashes;
+            const auto groups =
+                map.groupByPartition(batch, &keys, &values, &hashes);
+            for (size_t p = 0; p != groups.size(); ++p) {
+              sequencer.run(i, p, [&] {
+                if (!groups[p].empty()) {
+                  map.getPartition(p)->putMany(keys, hashes, values, groups[p]);
+                }
+              });
+            }
+          } catch (...) {
+            sequencer.fail();
+            throw;
+          }
+        }));
+      }
+    });
+  } catch (...) {
+    // Pending tasks refer to local variables.
+    try {
+      thread_pool->waitAll(&futures);
+    } catch (...) {
     }
-  } else {
-    mt::fail("No such file or directory '%s'", input.c_str());
+    throw;
   }
+  thread_pool->waitAll(&futures);
 }
 
-void Map::exportToBase64(const boost::filesystem::path& directory,
+void Map::exportToBinary(const boost::filesystem::path& directory,
                          const boost::filesystem::path& output) {
-  Map::exportToBase64(directory, output, Options());
+  Map::exportToBinary(directory, output, Options());
 }
 
-void Map::exportToBase64(const boost::filesystem::path& directory,
+void Map::exportToBinary(const boost::filesystem::path& directory,
                          const boost::filesystem::path& output,
                          const Options& options) {
-  std::ofstream output_stream(output.string());
-  mt::check(output_stream.is_open(), "Could not create '%s'", output.c_str());
+  internal::Dump::Options dump_options;
+  dump_options.compress = options.compress;
+  const auto per_partition = boost::filesystem::is_directory(output);
+  std::unique_ptr<internal::Dump::Writer> output_writer;
+  if (!per_partition) {
+    output_writer.reset(new internal::Dump::Writer(output, dump_options));
+  }
 
   const auto process =
       [&](const boost::filesystem::path& partition_prefix,
           const internal::Partition::Options& partition_options,
-          size_t partition_index, size_t num_partitions) {
+          size_t partition_index) {
 
-        if (!options.quiet) {
-          mt::log(std::cout) << "Exporting partition " << (partition_index + 1)
-                             << " of " << num_partitions << std::endl;
+        std::unique_ptr<internal::Dump::Writer> partition_writer;
+        auto writer = output_writer.get();
+        if (per_partition) {
+          partition_writer.reset(new internal::Dump::Writer(
+              output / getNameOfExportFile(partition_index, ".dump"),
+              dump_options));
+          writer = partition_writer.get();
         }
 
-        std::string base64_key;
-        std::string base64_value;
         if (options.compare) {
-          std::vector<std::string> sorted_values;
+          internal::Sorter sorter(options.compare,
+                                  getSorterOptions(output, per_partition));
           internal::Partition::forEachEntry(
               partition_prefix, partition_options,
               [&](const Bytes& key, Iterator* iter) {
-                sorted_values.clear();
-                sorted_values.reserve(iter->available());
                 while (iter->hasNext()) {
-                  sorted_values.push_back(iter->next().toString());
+                  sorter.add(iter->next());
                 }
-                std::sort(sorted_values.begin(), sorted_values.end(),
-                          options.compare);
-
-                internal::Base64::encode(key, &base64_key);
-                output_stream << base64_key;
-                for (const auto& value : sorted_values) {
-                  internal::Base64::encode(value, &base64_value);
-                  output_stream << ' ' << base64_value;
-                }
-                output_stream << '\n';
+                writer->put(key, sorter.sort().get());
               });
         } else {
           internal::Partition::forEachEntry(
               partition_prefix, partition_options,
               [&](const Bytes& key, Iterator* iter) {
-                internal::Base64::encode(key, &base64_key);
-                output_stream << base64_key;
+                writer->put(key, iter);
+              });
+        }
+        if (partition_writer) partition_writer->close();
+      };
+  forEachPartitionToExport(directory, per_partition, options, process);
+  if (output_writer) output_writer->close();
+}
+
+void Map::exportToBase64(const boost::filesystem::path& directory,
+                         const boost::filesystem::path& output) {
+  Map::exportToBase64(directory, output, Options());
+}
+
+void Map::exportToBase64(const boost::filesystem::path& directory,
+                         const boost::filesystem::path& output,
+                         const Options& options) {
+  const auto per_partition = boost::filesystem::is_directory(output);
+  std::ofstream output_stream;
+  if (!per_partition) {
+    output_stream.open(output.string());
+    mt::check(output_stream.is_open(), "Could not create '%s'",
+              output.c_str());
+  }
+
+  const auto process =
+      [&](const boost::filesystem::path& partition_prefix,
+          const internal::Partition::Options& partition_options,
+          size_t partition_index) {
+
+        std::ofstream partition_stream;
+        auto stream = &output_stream;
+        if (per_partition) {
+          const auto file =
+              output / getNameOfExportFile(partition_index, ".base64");
+          partition_stream.open(file.string());
+          mt::check(partition_stream.is_open(), "Could not create '%s'",
+                    file.c_str());
+          stream = &partition_stream;
+        }
+
+        std::string base64_key;
+        std::string base64_value;
+        const auto write_line = [&](const Bytes& key, Iterator* iter) {
+          internal::Base64::encode(key, &base64_key);
+          *stream << base64_key;
+          while (iter->hasNext()) {
+            internal::Base64::encode(iter->next(), &base64_value);
+            *stream << ' ' << base64_value;
+          }
+          *stream << '\n';
+        };
+        if (options.compare) {
+          internal::Sorter sorter(options.compare,
+                                  getSorterOptions(output, per_partition));
+          internal::Partition::forEachEntry(
+              partition_prefix, partition_options,
+              [&](const Bytes& key, Iterator* iter) {
                 while (iter->hasNext()) {
-                  internal::Base64::encode(iter->next(), &base64_value);
-                  output_stream << ' ' << base64_value;
+                  sorter.add(iter->next());
                 }
-                output_stream << '\n';
+                write_line(key, sorter.sort().get());
               });
+        } else {
+          internal::Partition::forEachEntry(partition_prefix,
+                                            partition_options, write_line);
         }
+        mt::check(stream->flush().good(), "Could not write partition %zu",
+                  partition_index);
       };
-  forEachPartition(directory, process);
+  forEachPartitionToExport(directory, per_partition, options, process);
 }
 
 void Map::optimize(const boost::filesystem::path& directory,
@@ -300,6 +1369,10 @@ void Map::optimize(const boost::filesystem::path& directory,
 void Map::optimize(const boost::filesystem::path& directory,
                    const boost::filesystem::path& output,
                    const Options& options) {
+  if (options.frozen) {
+    optimizeToFrozen(directory, output, options);
+    return;
+  }
   const auto id = Id::readFromDirectory(directory);
   Options new_options = options;
   new_options.error_if_exists = true;
@@ -310,42 +1383,452 @@ void Map::optimize(const boost::filesystem::path& directory,
   if (options.num_partitions == 0) {
     new_options.num_partitions = id.num_partitions;
   }
-  Map new_map(output, new_options);
+  if (options.tune) {
+    const auto tuning = recommendOptions(directory, options);
+    if (options.block_size == 0) {
+      new_options.block_size = tuning.block_size;
+    }
+    if (options.num_partitions == 0) {
+      new_options.num_partitions = tuning.num_partitions;
+    }
+  }
+  MapBuilder new_map(output, new_options);
+
+  std::mutex log_mutex;
+  const auto log_progress = [&](const char* action, size_t partition_index,
+                                size_t num_partitions) {
+    if (!options.quiet) {
+      std::lock_guard<std::mutex> lock(log_mutex);
+      mt::log(std::cout) << action << " partition " << (partition_index + 1)
+                         << " of " << num_partitions << std::endl;
+    }
+  };
 
+  // If each source partition becomes one partition of the new map, the
+  // blocks of its lists can be copied as they are.
+  const auto copy_partitions =
+      !options.compare && id.xxhash_partitioning &&
+      id.key_hash == static_cast<uint64_t>(KeyHash::XXH64) &&
+      id.num_partitions == mt::nextPrime(new_options.num_partitions) &&
+      id.block_size == new_options.block_size &&
+      static_cast<bool>(id.front_coded) == new_options.front_coding &&
+      !boost::filesystem::exists(directory / getNameOfRoutesFile());
+  if (copy_partitions) {
+    forEachPartition(
+        directory,
+        [&](const boost::filesystem::path& partition_prefix,
+            const internal::Partition::Options& partition_options,
+            size_t partition_index, size_t num_partitions) {
+          log_progress("Copying", partition_index, num_partitions);
+          new_map.putPartition(partition_index, partition_prefix,
+                               partition_options);
+          log_progress("Finished", partition_index, num_partitions);
+        },
+        options.num_threads, options.numa_aware, options.shared_thread_pool);
+    new_map.finish();
+    return;
+  }
+
+  // Source partitions are read concurrently.  Since each key is contained in
+  // exactly one of them and all its values are passed to the builder in a
+  // single call, the values of a key remain consecutive as required.
   forEachPartition(
-      directory, [&](const boost::filesystem::path& partition_prefix,
-                     const internal::Partition::Options& partition_options,
-                     size_t partition_index, size_t num_partitions) {
-        if (!options.quiet) {
-          mt::log(std::cout) << "Optimizing partition " << (partition_index + 1)
-                             << " of " << num_partitions << std::endl;
-        }
+      directory,
+      [&](const boost::filesystem::path& partition_prefix,
+          const internal::Partition::Options& partition_options,
+          size_t partition_index, size_t num_partitions) {
+        log_progress("Optimizing", partition_index, num_partitions);
         if (options.compare) {
-          std::vector<std::string> sorted_values;
+          internal::Sorter sorter(options.compare,
+                                  getSorterOptions(output, true));
           internal::Partition::forEachEntry(
               partition_prefix, partition_options,
               [&](const Bytes& key, Iterator* iter) {
-                sorted_values.clear();
-                sorted_values.reserve(iter->available());
                 while (iter->hasNext()) {
-                  sorted_values.push_back(iter->next().toString());
-                }
-                std::sort(sorted_values.begin(), sorted_values.end(),
-                          options.compare);
-                for (const auto& value : sorted_values) {
-                  new_map.put(key, value);
+                  sorter.add(iter->next());
                 }
-              });
+                new_map.put(key, sorter.sort().get());
+              },
+              internal::Partition::ScanOrder::BLOCKS);
         } else {
           internal::Partition::forEachEntry(
               partition_prefix, partition_options,
               [&](const Bytes& key, Iterator* iter) {
-                while (iter->hasNext()) {
-                  new_map.put(key, iter->next());
-                }
-              });
+                new_map.put(key, iter);
+              },
+              internal::Partition::ScanOrder::BLOCKS);
         }
-      });
+        log_progress("Finished", partition_index, num_partitions);
+      },
+      options.num_threads, options.numa_aware, options.shared_thread_pool);
+  new_map.finish();
+  if (options.compare) {
+    const auto id_filename = output / getNameOfIdFile();
+    auto new_id = Id::readFromFile(id_filename);
+    new_id.sorted = true;
+    new_id.writeToFile(id_filename);
+    // Enables binary search via `containsValue()` and `getRange()`.
+  }
+}
+
+void Map::openPartition(size_t index) const {
+  const auto prefix =
+      directories_[index % directories_.size()] / getPartitionPrefix(index);
+  auto options = partition_options_;
+  options.block_cache_id = index;
+  if (on_partition_open_) {
+    const auto on_open = on_partition_open_;
+    options.on_open = [on_open, index](const PartitionTimings& timings) {
+      on_open(index, timings);
+    };
+  }
+  if (on_partition_close_) {
+    const auto on_close = on_partition_close_;
+    options.on_close = [on_close, index](const PartitionTimings& timings) {
+      on_close(index, timings);
+    };
+    // Copied, because `partitions_` is destroyed after the member.
+  }
+  partitions_[index].reset(new internal::Partition(prefix, options));
+  if (!range_begins_.empty() && !options.readonly) {
+    removeMisroutedLists(index);
+  }
+  if (flusher_) {
+    flusher_->add(partitions_[index].get());
+  }
+  if (checkpointer_) {
+    checkpointer_->add(partitions_[index].get());
+  }
+  if (compactor_) {
+    compactor_->add(partitions_[index].get());
+  }
+  if (spiller_) {
+    spiller_->add(partitions_[index].get());
+  }
+  if (stats_publisher_) {
+    stats_publisher_->add(index, partitions_[index].get());
+  }
+}
+
+void Map::closePartitions() {
+  if (shared_thread_pool_ && !isReadOnly()) {
+    shared_thread_pool_->forEachIndex(
+        partitions_.size(), [this](size_t i) { partitions_[i].reset(); });
+    return;
+  }
+  if (getNumWorkerThreads() < 2 || isReadOnly()) {
+    partitions_.clear();
+    return;
+  }
+  internal::ThreadPool thread_pool(getNumWorkerThreads());
+  for (size_t i = 0; i != partitions_.size(); ++i) {
+    thread_pool.submit([this, i] {
+      if (!numa_nodes_.empty()) {
+        internal::Numa::bindCurrentThreadToNode(getNumaNode(i));
+      }
+      partitions_[i].reset();
+    });
+  }
+  // The destructor of the pool waits for all partitions to be closed.
+}
+
+std::vector<uint64_t> Map::getKeysInRange(uint64_t lower,
+                                          uint64_t upper) const {
+  std::vector<uint64_t> keys;
+  const auto lock = lockRouting();
+  for (size_t i = 0; i != partitions_.size(); ++i) {
+    const auto num_keys = keys.size();
+    getPartition(i)->getKeysInRange(lower, upper, &keys);
+    std::inplace_merge(keys.begin(), keys.begin() + num_keys, keys.end());
+  }
+  return keys;
+}
+
+std::vector<std::string> Map::getKeysInRangeUnlocked(
+    const Bytes& lower, const Bytes& upper) const {
+  std::vector<std::vector<std::string> > runs(partitions_.size());
+  for (size_t i = 0; i != partitions_.size(); ++i) {
+    getPartition(i)->getKeysInRange(lower, upper, &runs[i]);
+  }
+  // Merges the sorted runs of all partitions via a min-heap of the run
+  // indices, ordered by the current key of each run.
+  std::vector<size_t> positions(runs.size());
+  const auto greater = [&](size_t a, size_t b) {
+    return runs[b][positions[b]] < runs[a][positions[a]];
+  };
+  std::vector<size_t> heap;
+  size_t num_keys = 0;
+  for (size_t i = 0; i != runs.size(); ++i) {
+    if (!runs[i].empty()) heap.push_back(i);
+    num_keys += runs[i].size();
+  }
+  std::make_heap(heap.begin(), heap.end(), greater);
+  std::vector<std::string> keys;
+  keys.reserve(num_keys);
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), greater);
+    const auto run = heap.back();
+    keys.push_back(std::move(runs[run][positions[run]++]));
+    if (positions[run] == runs[run].size()) {
+      heap.pop_back();
+    } else {
+      std::push_heap(heap.begin(), heap.end(), greater);
+    }
+  }
+  return keys;
+}
+
+uint32_t Map::getDeadline(std::chrono::seconds ttl) {
+  const uint64_t max_deadline = std::numeric_limits<uint32_t>::max();
+  const uint64_t now = internal::Partition::getCurrentTime();
+  const uint64_t seconds = mt::max<int64_t>(0, ttl.count());
+  return mt::min(now + mt::min(seconds, max_deadline), max_deadline);
+}
+
+std::string Map::getPrefixUpperBound(const Bytes& prefix) {
+  auto upper = prefix.toString();
+  while (!upper.empty() && static_cast<unsigned char>(upper.back()) == 0xFF) {
+    upper.pop_back();
+  }
+  if (!upper.empty()) ++upper.back();
+  return upper;
+}
+
+void Map::warmUp() const {
+  const internal::IoLimiter::Scope scope(internal::IoLimiter::Priority::LOW);
+  for (size_t i = 0; !stop_warm_up_; ++i) {
+    const auto lock = lockRouting();
+    if (i >= partitions_.size()) break;
+    try {
+      partitions_[i]->warmUp();
+    } catch (std::exception& error) {
+      mt::log() << "Map could not warm up partition " << i << ": "
+                << error.what() << '\n';
+    }
+  }
+}
+
+size_t Map::getNumWorkerThreads() const {
+  const size_t num_threads = num_threads_
+                                 ? num_threads_
+                                 : internal::ThreadPool::getDefaultNumThreads();
+  return std::min(num_threads, partitions_.size());
+}
+
+void Map::removeMisroutedLists(size_t index) const {
+  partitions_[index]->removeAll([this, index](const Bytes& key) {
+    return getPartitionIndex(hashKey(key)) != index;
+  });
+}
+
+size_t Map::split(size_t index) {
+  const auto locks = lockRoutingForRepartitioning(index);
+  const auto range = ranges_[index];
+  mt::Check::isTrue(range.end - range.begin >= 2,
+                    "Map::split(): Partition %zu cannot be split any further",
+                    index);
+
+  size_t target = 0;
+  while (target != ranges_.size() &&
+         ranges_[target].begin != ranges_[target].end) {
+    ++target;
+  }
+  if (target == ranges_.size()) {
+    MT_ASSERT_LT(target, std::numeric_limits<uint32_t>::max());
+    auto ranges = ranges_;
+    ranges.push_back(Range{0, 0});
+    setRanges(ranges);
+    partitions_.emplace_back();
+    writeRoutesFile(target + 1);
+    writeIdFile(false);
+    openPartition(target);
+    // Removes lists left behind by a previous attempt that did not complete.
+  }
+
+  auto ranges = ranges_;
+  const auto middle = range.begin + (range.end - range.begin) / 2;
+  ranges[index].end = middle;
+  ranges[target] = Range{middle, range.end};
+  repartition(index, target, ranges);
+  return target;
+}
+
+void Map::merge(size_t index) {
+  const auto locks = lockRoutingForRepartitioning(index);
+  const auto range = ranges_[index];
+  size_t source = 0;
+  while (source != ranges_.size() &&
+         (ranges_[source].begin != range.end ||
+          ranges_[source].begin == ranges_[source].end)) {
+    ++source;
+  }
+  mt::Check::isTrue(source != ranges_.size() && range.begin != range.end,
+                    "Map::merge(): Partition %zu has no successor", index);
+
+  auto ranges = ranges_;
+  ranges[index].end = ranges[source].end;
+  ranges[source] = Range{0, 0};
+  repartition(source, index, ranges);
+}
+
+std::vector<internal::WriterLock<boost::shared_mutex> >
+Map::lockRoutingForRepartitioning(size_t index) {
+  mt::Check::isFalse(isReadOnly(), "Attempt to repartition read-only map");
+  mt::Check::isFalse(fnv1a_partitioning_,
+                     "Maps created before version 0.6 cannot be "
+                     "repartitioned, see Map::optimize()");
+  mt::Check::isFalse(static_cast<bool>(once_flags_),
+                     "Lazily opened maps cannot be repartitioned");
+  mt::Check::isTrue(index < partitions_.size(),
+                    "Map has no partition with index %zu", index);
+  std::vector<internal::WriterLock<boost::shared_mutex> > locks;
+  if (routing_mutexes_) {
+    for (size_t i = 0; i != NUM_ROUTING_MUTEXES; ++i) {
+      locks.emplace_back(routing_mutexes_[i]);
+    }
+  }
+  if (ranges_.empty()) {
+    const uint64_t n = partitions_.size();
+    std::vector<Range> ranges(n);
+    for (uint64_t i = 0; i != n; ++i) {
+      ranges[i].begin = ((i << 32) + n - 1) / n;
+      ranges[i].end = (((i + 1) << 32) + n - 1) / n;
+    }
+    // The same ranges as selected by `getPartitionIndex(key_hash, n)`.
+    setRanges(ranges);
+  }
+  return locks;
+}
+
+void Map::repartition(size_t source, size_t target,
+                      const std::vector<Range>& ranges) {
+  writeRoutesFile(target + 1);
+  const auto begin = ranges[target].begin;
+  const auto end = ranges[target].end;
+  const auto target_partition = getPartition(target);
+  getPartition(source)->forEachEntry([&](const Bytes& key, Iterator* iter) {
+    const HashedKey hashed_key(key);
+    const auto upper_half = hashed_key.hash() >> 32;
+    if (upper_half >= begin && upper_half < end) {
+      while (iter->hasNext()) {
+        target_partition->put(hashed_key, iter->next());
+      }
+    }
+  });
+  target_partition->checkpoint();
+
+  setRanges(ranges);
+  writeRoutesFile(source + 1);
+  writeIdFile(false);
+  removeMisroutedLists(source);
+  getPartition(source)->checkpoint();
+  writeRoutesFile(0);
+}
+
+void Map::setRanges(const std::vector<Range>& ranges) {
+  ranges_ = ranges;
+  std::vector<uint32_t> partitions;
+  for (size_t i = 0; i != ranges_.size(); ++i) {
+    if (ranges_[i].begin != ranges_[i].end) partitions.push_back(i);
+  }
+  std::sort(partitions.begin(), partitions.end(), [this](uint32_t a,
+                                                         uint32_t b) {
+    return ranges_[a].begin < ranges_[b].begin;
+  });
+  range_begins_.clear();
+  for (const auto partition : partitions) {
+    range_begins_.push_back(ranges_[partition].begin);
+  }
+  range_partitions_.swap(partitions);
+}
+
+uint64_t Map::readRoutesFile(const boost::filesystem::path& filename) {
+  if (!boost::filesystem::is_regular_file(filename)) return 0;
+  uint64_t num_incomplete_partition = 0;
+  const auto size = boost::filesystem::file_size(filename);
+  mt::Check::isTrue(size >= sizeof num_incomplete_partition &&
+                        (size - sizeof num_incomplete_partition) %
+                                sizeof(Range) ==
+                            0,
+                    "Map: '%s' is not a valid routes file", filename.c_str());
+  std::vector<Range> ranges((size - sizeof num_incomplete_partition) /
+                            sizeof(Range));
+  const auto stream = mt::fopen(filename, "r");
+  mt::fread(stream.get(), &num_incomplete_partition,
+            sizeof num_incomplete_partition);
+  mt::fread(stream.get(), ranges.data(), ranges.size() * sizeof(Range));
+  partitions_.resize(ranges.size());
+  setRanges(ranges);
+  return num_incomplete_partition;
+}
+
+void Map::writeRoutesFile(uint64_t num_incomplete_partition) const {
+  const auto filename = lock_.directory() / getNameOfRoutesFile();
+  const auto new_filename = filename.string() + ".new";
+  {
+    const auto stream = mt::fopen(new_filename, "w");
+    mt::fwrite(stream.get(), &num_incomplete_partition,
+               sizeof num_incomplete_partition);
+    mt::fwrite(stream.get(), ranges_.data(), ranges_.size() * sizeof(Range));
+  }
+  boost::filesystem::rename(new_filename, filename);
+  // Replaces the previous file atomically.
+}
+
+internal::ThreadPool* Map::getAsyncThreadPool() const {
+  std::call_once(async_once_flag_, [this] {
+    async_thread_pool_.reset(new internal::ThreadPool(num_async_threads_));
+  });
+  return async_thread_pool_.get();
+}
+
+Map::Id Map::getId(bool sorted) const {
+  Id id;
+  id.num_partitions = partitions_.size();
+  id.block_size = block_size_;
+  id.compressed = partition_options_.compress;
+  id.front_coded = partition_options_.front_coding;
+  id.sorted = sorted;
+  id.xxhash_partitioning = !fnv1a_partitioning_;
+  id.num_directories = directories_.size();
+  id.key_hash = static_cast<uint64_t>(partition_options_.key_hash);
+  return id;
+}
+
+void Map::writeIdFile(bool sorted) const {
+  getId(sorted).writeToFile(lock_.directory() / getNameOfIdFile());
+}
+
+std::vector<std::vector<size_t> > Map::groupByPartition(
+    const std::vector<Bytes>& keys, std::vector<uint64_t>* hashes) const {
+  std::vector<std::vector<size_t> > groups(partitions_.size());
+  hashes->resize(keys.size());
+  for (size_t i = 0; i != keys.size(); ++i) {
+    const auto key = hashKey(keys[i]);
+    (*hashes)[i] = key.hash();
+    groups[getPartitionIndex(key)].push_back(i);
+  }
+  return groups;
+}
+
+std::vector<std::vector<size_t> > Map::groupByPartition(
+    const WriteBatch& batch, std::vector<Bytes>* keys,
+    std::vector<Bytes>* values, std::vector<uint64_t>* hashes) const {
+  std::vector<std::vector<size_t> > groups(partitions_.size());
+  keys->reserve(batch.size());
+  values->reserve(batch.size());
+  hashes->reserve(batch.size());
+  const auto rehash = partition_options_.key_hash != KeyHash::XXH64;
+  for (const auto& entry : batch.entries_) {
+    // The batch has hashed its keys with XXH64.
+    const auto key = rehash ? hashKey(batch.getKey(entry))
+                            : HashedKey(batch.getKey(entry), entry.hash);
+    groups[getPartitionIndex(key)].push_back(keys->size());
+    keys->push_back(key);
+    values->push_back(batch.getValue(entry));
+    hashes->push_back(key.hash());
+  }
+  return groups;
 }
 
 }  // namespace multimap
@@ -22,10 +22,30 @@
 #ifndef MULTIMAP_MAP_HPP_INCLUDED
 #define MULTIMAP_MAP_HPP_INCLUDED
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
+#include "multimap/internal/Checkpointer.hpp"
+#include "multimap/internal/Compactor.hpp"
+#include "multimap/internal/Flusher.hpp"
+#include "multimap/internal/LockProfiler.hpp"
+#include "multimap/internal/Metrics.hpp"
+#include "multimap/internal/Numa.hpp"
 #include "multimap/internal/Partition.hpp"
+#include "multimap/internal/Spiller.hpp"
+#include "multimap/internal/StatsPublisher.hpp"
+#include "multimap/internal/ThreadPool.hpp"
+#include "multimap/internal/Tuning.hpp"
+#include "multimap/internal/WorkStealingPool.hpp"
 #include "multimap/Version.hpp"
+#include "multimap/WriteBatch.hpp"
 
 namespace multimap {
 
@@ -40,13 +60,28 @@ class Map : public mt::Resource {
     uint64_t num_partitions = 0;
     uint64_t major_version = Version::MAJOR;
     uint64_t minor_version = Version::MINOR;
+    uint64_t compressed = false;
+    uint64_t front_coded = false;
+    uint64_t sorted = false;
+    uint64_t xxhash_partitioning = false;
+    // If true, keys are assigned to partitions via their XXH64 hash value,
+    // see `getPartitionIndex()`, otherwise via their FNV-1a hash value as
+    // in maps created before version 0.6.
+    uint64_t num_directories = 1;
+    // Number of directories across which the partitions are spread, see
+    // `Options::directories` and `getDirectories()`.
+    uint64_t key_hash = 0;
+    // The value of `KeyHash` that keys are hashed with, see
+    // `Options::key_hash`.
+    // Ids written by earlier versions do not contain all of these fields,
+    // in which case the missing ones keep their default value.
 
     static Id readFromDirectory(const boost::filesystem::path& directory);
     static Id readFromFile(const boost::filesystem::path& file);
     void writeToFile(const boost::filesystem::path& file) const;
   };
 
-  static_assert(mt::hasExpectedSize<Id>(32, 32),
+  static_assert(mt::hasExpectedSize<Id>(80, 80),
                 "struct Map::Id does not have expected size");
 
   struct Limits {
@@ -54,23 +89,339 @@ class Map : public mt::Resource {
     static uint32_t maxValueSize();
   };
 
+  typedef internal::Partition::Timings PartitionTimings;
+
+  typedef internal::Partition::KeyHash KeyHash;
+
+  typedef internal::Store::Durability Durability;
+
   struct Options {
     uint32_t block_size = 512;
     uint32_t num_partitions = 23;
     uint32_t buffer_size = mt::MiB(1);
 
+    bool background_flush = false;
+    // If true, each partition writes its full block buffer to disk in a
+    // background thread, while puts go on filling a second buffer of
+    // `buffer_size` bytes.  This keeps writes to the disk out of the latency
+    // of `put()` at the cost of one additional buffer and thread per
+    // partition.  Has no effect in read-only mode.
+
+    uint32_t num_write_lanes = 0;
+    // If not zero, each partition lets up to this many threads append
+    // blocks of values at the same time, each into a range of its data file
+    // that is reserved `buffer_size` bytes at a time.  Useful if many threads
+    // put values into the same partitions.  Has no effect in read-only mode,
+    // with `checksums`, or with a `durability` other than `NONE`.
+
     bool create_if_missing = false;
     bool error_if_exists = false;
     bool readonly = false;
+    // If true, the map is opened with a shared lock on its directories, so
+    // that any number of processes can open it read-only at the same time,
+    // while writable opens are refused meanwhile.  Partitions that have a key
+    // index map it instead of loading their keys, so that all processes share
+    // one copy of it in the page cache, see `internal::KeyIndex`.
+
     bool quiet = false;
 
+    bool compress = false;
+    // If true, blocks are compressed when written to disk.  Compressed maps
+    // are read-only, hence this option is only supported by `MapBuilder` and
+    // `optimize()`.  Existing compressed maps must be opened read-only.
+    // For `exportToBinary()` it compresses the output instead.
+
+    bool front_coding = false;
+    // If true, each value is stored as the size of the prefix it shares with
+    // the previous value in the same block followed by the remaining suffix.
+    // This saves space and read bandwidth for lists of values with long
+    // common prefixes, such as URLs.  Has no effect for existing maps, which
+    // keep the encoding they have been created with.
+
+    bool lazy = false;
+    // If true, the partitions of an existing map are not opened in the
+    // constructor, but on first access.  This is useful for short-lived
+    // processes that only touch a few keys.  Has no effect for new maps.
+
+    std::vector<boost::filesystem::path> directories;
+    // Additional directories, e.g. on other devices, across which the
+    // partitions of a new map are spread round-robin, so that their I/O is
+    // striped.  The map's own directory holds partition 0 and the files of
+    // the map as a whole, including the list of these directories.  Each
+    // directory must not be used by another map.  Has no effect for
+    // existing maps.
+
+    bool online_repartitioning = false;
+    // If true, `split()` and `merge()` may be called while other threads use
+    // the map.  Each operation then holds one of a few shared locks, which
+    // are acquired exclusively to repartition, so callbacks passed to the
+    // map must not call the map again.
+
+    bool numa_aware = false;
+    // If true, partition `i` is assigned to NUMA node `getNumaNode(i)`.
+    // Partitions are opened by threads bound to their node, so that the
+    // memory they allocate when opened is local to the node, and parallel
+    // scans as well as `optimize()` process each partition on its node.
+    // Partitions of a lazily opened map are opened by the calling thread.
+    // Has no effect on machines with a single node.
+
+    double bloom_filter_false_positive_rate = 0;
+    // If not zero, each partition stores a Bloom filter of its keys with
+    // this false-positive rate whenever its keys file is rewritten, i.e. by
+    // `MapBuilder`, `optimize()`, and when a writable map is closed after
+    // many updates.  Read-only maps consult the filter before the key index,
+    // so that most lookups of absent keys touch neither locks nor the disk.
+    // Must be in [0, 1).  A rate of 1% costs about 10 bits per key.
+
+    double value_filter_false_positive_rate = 0;
+    // If not zero, `MapBuilder` and `optimize()` also store a Bloom filter of
+    // all pairs of keys and values with this false-positive rate, so that
+    // `mayContainValue()` and `containsValue()` rule out most absent values
+    // without reading the values file.  The filter covers the lists as they
+    // were built, and is dropped when a writable map rewrites its keys file.
+    // Must be in [0, 1).  A rate of 1% costs about 10 bits per value.
+
+    uint64_t tail_memory_budget = 0;
+    // If not zero, a background thread flushes the partially filled tail
+    // blocks of lists that have not been appended to recently, so that the
+    // memory they hold stays roughly within this number of bytes, regardless
+    // of the number of keys.  Since flushed tail blocks are padded, a small
+    // budget trades disk space for memory.  Has no effect in read-only mode.
+
+    uint64_t memory_limit = 0;
+    // If not zero, a background thread keeps the memory held by the keys and
+    // lists of each partition roughly within this number of bytes divided by
+    // the number of partitions.  A partition that exceeds its share is
+    // checkpointed and then writes lists that are not being updated to spill
+    // files next to it and evicts them from memory, so that ingestion can go
+    // on with bounded memory.  Evicted lists are read back on access.  Spill
+    // files are merged when there are more than a few and into the keys file
+    // when the map is closed.  Has no effect in read-only mode.
+
+    bool write_ahead_log = false;
+    // If true, each partition records updates in a write-ahead log before
+    // they return, so that they are not lost if the process crashes.  The
+    // log is replayed when the map is opened the next time, which must be
+    // done in writable mode.  It is removed when the map is closed.
+
+    bool sync_write_ahead_log = false;
+    // If true, updates also wait until their log records have been forced to
+    // stable storage, which protects against a crash of the operating system
+    // at the cost of one sync per group of concurrent updates.
+
+    bool change_feed = false;
+    // If true, each partition appends its updates to a change feed, a file
+    // in the format of the write-ahead log that is kept across checkpoints
+    // and restarts, so that replicas can follow the map, see
+    // `followChangeFeed()`.  Each update writes its records before it
+    // returns, but does not sync them.  The feed grows until it is removed
+    // while the map is closed, which requires new replicas.  Has no effect
+    // in read-only mode.
+
+    Durability durability = Durability::NONE;
+    // Chooses when the values, keys, and stats files of each partition are
+    // forced to stable storage:
+    //   NONE       never, which is fastest and suits maps that are rebuilt
+    //              from scratch after a crash.
+    //   ON_CLOSE   when the map is closed.
+    //   PERIODIC   also by each checkpoint, see `checkpoint_interval`, and
+    //              full block buffers are handed over to writeback via
+    //              `sync_file_range()` as soon as they are written.
+    //   PER_BATCH  also whenever a full block buffer has been written, via
+    //              `fdatasync()`.
+    // Has no effect in read-only mode.  A synced write-ahead log implies
+    // that checkpoints are synced as well.
+
+    uint32_t checkpoint_interval = 0;
+    // If not zero, a background thread checkpoints each partition every this
+    // many seconds, see `checkpoint()`.  Has no effect in read-only mode.
+
+    uint32_t live_stats_interval = 0;
+    // If not zero, a background thread publishes the current stats of each
+    // partition, see `getCurrentStats()`, every this many milliseconds to a
+    // memory-mapped file in the map's directory, so that other processes can
+    // read them at any time via `liveStats()` while the map is open.  Has no
+    // effect in read-only mode.
+
+    double compaction_threshold = 0;
+    // If not zero, a background thread rewrites lists in which at least this
+    // fraction of values has been removed, so that the space they occupy can
+    // be reused by other lists.  Must be in (0, 1].  Freed blocks are reused
+    // after the next checkpoint, or when the map is opened the next time.
+    // Has no effect in read-only mode or for compressed maps.  The thread
+    // also removes the values of expired keys, see `expire()`, unless the
+    // map is read-only.
+
+    uint64_t compaction_rate = mt::MiB(8);
+    // Maximum number of bytes per second that the compaction thread rewrites,
+    // so that compaction does not compete with foreground updates for I/O.
+
+    uint64_t background_io_rate = 0;
+    // If not zero, maximum number of bytes per second that background work
+    // reads and writes via the values files of all partitions together,
+    // which protects the latency of foreground requests, see
+    // `internal::IoLimiter`.  Flushing cold lists takes precedence over
+    // compaction, checkpoints, warm-up, and `snapshot()`, which is
+    // limited as well.  Foreground requests are never limited.
+
+    uint32_t max_values_per_key = 0;
+    // If not zero, each key keeps only about its most recent values, like a
+    // ring buffer: once a put lets the list of a key exceed this number of
+    // values, its oldest values are dropped in whole blocks, which are reused
+    // after the next checkpoint, without reading or removing them one by
+    // one.  A list may therefore keep up to about two blocks of values more,
+    // and blocks are only dropped while no iterator reads the list.  Dropped
+    // values count as removed in `Stats`.  The cap is not stored with the map
+    // and applies to puts while the map is opened with it.
+
+    bool populate = false;
+    // If true, the data files of a read-only map are read into memory when
+    // the map is opened, so that the first lookups do not fault in pages.
+
+    bool huge_pages = false;
+    // If true, transparent huge pages are requested for the mapped data files
+    // of a read-only map, which reduces TLB misses of random lookups in maps
+    // that are held in memory.  This is only a hint to the operating system.
+
+    bool lock_in_memory = false;
+    // If true, the mapped data files of a read-only map are locked into
+    // memory via `mlock()`, so that they cannot be paged out.  Opening the map
+    // fails if this exceeds the process's limit for locked memory.
+
+    bool direct_io = false;
+    // If true, the data files of a read-only map that is not compressed are
+    // not mapped, but read via `O_DIRECT`, which bypasses the page cache.
+    // This gives predictable memory usage and latency for maps that are much
+    // larger than memory, especially in combination with `block_cache_size`.
+
+    uint64_t block_cache_size = 0;
+    // If not zero, a read-only map that is compressed or uses `direct_io`
+    // caches blocks it has read in a cache of this number of bytes, which is
+    // shared by all partitions, so that hot lists are not decompressed or
+    // read from disk repeatedly.  Hits and misses are reported in `Stats`.
+
+    uint32_t max_read_ahead = 1024;
+    // Maximum number of blocks that an iterator reads at once.  An iterator
+    // starts with a few blocks and doubles the number with each read until
+    // this limit is reached, so that short lookups read and allocate little,
+    // while long scans are served with large batches.
+
+    uint32_t max_extent_size = 64;
+    // Maximum number of consecutive blocks that a list reserves at once when
+    // it flushes a block.  A list that spans several blocks reserves twice
+    // as many as its last run of consecutive blocks, so that long lists are
+    // laid out in runs of up to this length, whose ids take constant memory
+    // and which are read sequentially.  Blocks reserved but not used when
+    // the map is closed are reused later.  If one, lists do not reserve
+    // blocks.
+
+    bool checksums = false;
+    // If true, a writable map maintains a CRC-32C checksum of each block of
+    // values, which is saved when the map is closed, and a read-only map
+    // verifies each block the first time it is read, so that corrupt data
+    // files raise an exception instead of yielding wrong values.  Blocks are
+    // not verified if the map has been written without this option since.
+    // Has no effect for compressed maps.  See also `verify()`.
+
+    bool frozen = false;
+    // If true, `optimize()` writes the map in the read-only frozen format,
+    // which is opened via class `FrozenMap` instead of `Map`.  The values of
+    // each key are stored contiguously, so that lookups cost one probe of a
+    // memory-mapped hash table and iterating the values reads them in place.
+    // Block size, number of partitions, and encoding options do not apply.
+
+    bool tune = false;
+    // If true, `optimize()` uses the block size and number of partitions
+    // that `recommendOptions()` recommends for the source map instead of
+    // keeping those of the source map, see `keepBlockSize()` and
+    // `keepNumPartitions()`.  Values that are not kept are used as given.
+
+    KeyHash key_hash = KeyHash::XXH64;
+    // The function that a new map hashes its keys with, to select their
+    // partition and to look them up within it.  `KeyHash::CRC32C` combines
+    // three streams of the SSE 4.2 `crc32` instruction, which is faster than
+    // XXH64 for keys of up to a few hundred bytes, and falls back to tables
+    // on other CPUs.  Existing maps keep the function they have been created
+    // with, and `MapBuilder` as well as `optimize()` always use XXH64.
+
+    uint32_t num_threads = 0;
+    // Number of worker threads used by bulk operations such as `MapBuilder`
+    // and `optimize()`, and to open the partitions of a map as well as to
+    // close those of a writable map concurrently.  If zero, the number of
+    // hardware threads is used.
+
+    bool shared_thread_pool = false;
+    // If true, the concurrent work of the map or operation, i.e. opening and
+    // closing partitions, parallel scans, `MapBuilder`, `optimize()`, and the
+    // imports and exports, runs as tasks on a process-wide work-stealing
+    // pool, which is shared by all maps and operations with this option,
+    // instead of on threads of their own.  The pool is started with
+    // `num_threads` threads by the first of them and keeps its size until
+    // the last one is gone.  Threads of the pool are not bound to NUMA nodes.
+
+    uint32_t num_async_threads = 0;
+    // Number of threads that perform lookups requested via `getAsync()`.  The
+    // threads are started on the first such request.  If zero, the number of
+    // hardware threads is used.
+
+    uint32_t hot_keys = 0;
+    // If not zero, each partition tracks this number of its most frequently
+    // accessed keys, see `getHotKeys()`, e.g. to warm up caches after a
+    // restart or to choose partitions to `split()`.  Accesses are counted by
+    // all operations on given keys, but not by scans.
+
+    uint32_t hot_keys_sample_rate = 16;
+    // Only about one in this many accesses is counted, which keeps the cost
+    // of tracking low.  Must not be zero.
+
+    uint64_t warm_up_size = 0;
+    // If not zero, each partition saves the ids of its hot blocks, up to this
+    // number of bytes divided by the number of partitions, when the map is
+    // closed, even in read-only mode.  Hot blocks are those of the lists of
+    // hot keys, see `hot_keys`, and those in the block cache, see
+    // `block_cache_size`.  When the map is opened with this option the next
+    // time, a background thread reads these blocks ahead, so that the
+    // working set is in memory soon after a restart instead of being faulted
+    // in by lookups.  Mapped blocks are paged in, and blocks of maps that are
+    // compressed or use `direct_io` are loaded into the block cache.
+    // Partitions of a lazily opened map are not warmed up.
+
+    bool metrics = false;
+    // If true, the map records the latency of its operations and the number
+    // of bytes read and written, see `getMetrics()`.  Recording takes two
+    // clock reads per operation.  A writable map saves the metrics when it
+    // is closed, see `metrics()`.
+
     std::function<bool(const Bytes&, const Bytes&)> compare;
+    // Strict weak ordering of values.  If given, `optimize()` and
+    // `exportToBase64()` sort the values of each list, and a map whose lists
+    // have been sorted by `optimize()` uses it to find values via binary
+    // search, see `containsValue()` and `getRange()`.  Such a map must be
+    // opened with the same function it has been optimized with.
+
+    std::function<void(uint32_t, const PartitionTimings&)> on_partition_open;
+    // If set, called with the index of each partition once it has been
+    // opened and the time spent in each phase of opening it, so that it also
+    // serves as a progress callback for maps that take long to open.
+    // Partitions are opened concurrently unless `num_threads` is 1.
+
+    std::function<void(uint32_t, const PartitionTimings&)> on_partition_close;
+    // Same for closing the partitions of a writable map, which flushes all
+    // lists and may rewrite the keys files.  Must not throw.  Partitions are
+    // closed concurrently unless `num_threads` is 1.
 
     void keepNumPartitions() { num_partitions = 0; }
     void keepBlockSize() { block_size = 0; }
   };
 
   typedef internal::Stats Stats;
+  typedef internal::SampledStats SampledStats;
+  typedef internal::Tuning Tuning;
+  typedef internal::MemoryUsage MemoryUsage;
+
+  typedef internal::Metrics::Snapshot Metrics;
+
+  typedef internal::LockProfiler::Snapshot LockProfile;
 
   // ---------------------------------------------------------------------------
   // Member functions
@@ -83,29 +434,170 @@ class Map : public mt::Resource {
   ~Map();
 
   void put(const Bytes& key, const Bytes& value) {
-    getPartition(key)->put(key, value);
+    const internal::Metrics::Timer timer(metrics_.get(), Operation::PUT);
+    const auto hashed_key = hashKey(key);
+    getPartition(hashed_key)->put(hashed_key, value);
   }
 
   template <typename InputIter>
   void put(const Bytes& key, InputIter first, InputIter last) {
-    getPartition(key)->put(key, first, last);
+    const internal::Metrics::Timer timer(metrics_.get(), Operation::PUT);
+    const auto hashed_key = hashKey(key);
+    getPartition(hashed_key)->put(hashed_key, first, last);
   }
 
+  void write(const WriteBatch& batch);
+  // Same as calling `put()` for each put of `batch` in the order they were
+  // added, but puts that belong to the same partition are applied together,
+  // so that each shard lock and each list lock is acquired only once, and
+  // a write-ahead log records all values of a list at once.  If an error
+  // occurs, puts of other partitions or lists may already have been applied.
+
   std::unique_ptr<Iterator> get(const Bytes& key) const {
-    return getPartition(key)->get(key);
+    const internal::Metrics::Timer timer(metrics_.get(), Operation::GET);
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)->get(hashed_key);
+  }
+
+  std::unique_ptr<Iterator> getReverse(const Bytes& key) const {
+    const internal::Metrics::Timer timer(metrics_.get(), Operation::GET);
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)->getReverse(hashed_key);
+  }
+  // Same as `get()`, but the iterator yields the values from the newest to
+  // the oldest.  Reading the latest values of a long list does not decode
+  // the others, except for the first time, when an index of the list is
+  // built, see `internal::List::ReverseIterator`.
+
+  template <typename Procedure>
+  bool get(const Bytes& key, Procedure process) const {
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)->get(hashed_key, process);
   }
+  // Same as `get()`, but calls `process` with an iterator that lives on the
+  // stack, which saves the heap allocations of the former on hot lookup
+  // paths.  The iterator must not be used after `process` has returned.
+  // Returns `false` without calling `process` if `key` is not found.
 
   bool contains(const Bytes& key) const {
-    return getPartition(key)->contains(key);
+    const internal::Metrics::Timer timer(metrics_.get(), Operation::CONTAINS);
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)->contains(hashed_key);
+  }
+
+  uint32_t count(const Bytes& key) const {
+    const internal::Metrics::Timer timer(metrics_.get(), Operation::CONTAINS);
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)->count(hashed_key);
+  }
+  // Returns the number of values associated with `key`, which is read from
+  // the statistics of the list without creating an iterator.
+
+  uint64_t byteSize(const Bytes& key) const {
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)->byteSize(hashed_key);
+  }
+  // Returns the number of bytes the values of `key` occupy on disk and in
+  // memory, counted in whole blocks plus the used part of the tail block.
+  // Removed values count until the map is optimized.  No block is read.
+
+  bool mayContainValue(const Bytes& key, const Bytes& value) const {
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)->mayContainValue(hashed_key, value);
+  }
+  // Returns `false` if the list associated with `key` definitely does not
+  // contain `value`, which is answered from memory if the map has a value
+  // filter, see `Options::value_filter_false_positive_rate`.  Otherwise, or
+  // if the list has been appended to since it was built, `true` is returned
+  // for any existing key.
+
+  bool containsValue(const Bytes& key, const Bytes& value) const {
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)
+        ->containsValue(hashed_key, value, compare_);
+  }
+  // Returns `true` if the list associated with `key` contains `value`.  If
+  // the map has been sorted by `optimize()` and is opened with the same
+  // `Options::compare`, lists that have not been appended to since are
+  // searched in logarithmic time.  Otherwise, all values are compared.
+
+  template <typename Procedure>
+  void getRange(const Bytes& key, const Bytes& lower, const Bytes& upper,
+                Procedure process) const {
+    mt::Check::isTrue(static_cast<bool>(compare_),
+                      "Map::getRange() requires Options::compare");
+    const auto hashed_key = hashKey(key);
+    getPartition(hashed_key)
+        ->forEachValueInRange(hashed_key, lower, upper, compare_, process);
+  }
+  // Calls `process` for each value of `key` that is not less than `lower`
+  // and less than `upper` according to `Options::compare`.  Lists sorted by
+  // `optimize()` are entered via binary search and left at the first value
+  // that is not less than `upper`, other lists are scanned entirely.
+
+  std::vector<std::unique_ptr<Iterator> > getMany(
+      const std::vector<Bytes>& keys) const;
+  // Same as calling `get()` for each key, but keys that belong to the same
+  // partition are looked up with a single acquisition of the partition lock.
+  // The iterators are returned in the order of `keys`.
+
+  std::vector<bool> containsMany(const std::vector<Bytes>& keys) const;
+  // Same as `getMany()`, but for `contains()`.
+
+  std::vector<uint32_t> countMany(const std::vector<Bytes>& keys) const;
+  // Same as `getMany()`, but for `count()`.
+
+  std::future<std::vector<std::string> > getAsync(const Bytes& key) const;
+  // Looks up `key` on an internal thread and returns a future that becomes
+  // ready with copies of all values, so that a caller such as an event loop
+  // does not block on page faults or disk I/O and can have many lookups
+  // outstanding.  Exceptions are propagated via the future.
+
+  template <typename Callback>
+  std::future<void> getAsync(const Bytes& key, Callback callback) const {
+    const auto key_copy = key.toString();
+    return getAsyncThreadPool()->submit([this, key_copy, callback]() mutable {
+      const auto found = get(key_copy, [&callback](Iterator* iter) {
+        callback(iter);
+      });
+      if (!found) callback(nullptr);
+    });
+  }
+  // Same as before, but calls `callback` with the result of `get()` for `key`
+  // on the internal thread instead of copying the values.  The iterator is
+  // null if the key does not exist.  Otherwise, it is closed when `callback`
+  // returns and must not be used by another thread.  The returned future
+  // becomes ready afterwards or propagates an exception.
+
+  uint32_t remove(const Bytes& key) {
+    const internal::Metrics::Timer timer(metrics_.get(), Operation::REMOVE);
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)->remove(hashed_key);
+  }
+
+  bool expire(const Bytes& key, std::chrono::seconds ttl) {
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)->expire(hashed_key, getDeadline(ttl));
   }
+  // Lets the values of `key` expire `ttl` from now, after which the key is
+  // treated as if it did not exist and its values are removed lazily, see
+  // `removeExpired()`.  Calling the function again replaces the deadline.
+  // Returns `false` if `key` has no values.  The deadline is dropped when
+  // all values of the key are removed, but not when values are put.
 
-  uint32_t remove(const Bytes& key) { return getPartition(key)->remove(key); }
+  bool persist(const Bytes& key) {
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)->expire(hashed_key, 0);
+  }
+  // Removes the deadline of `key`, if any.  Returns `false` if `key` has no
+  // values.
 
   template <typename Predicate>
   uint32_t removeOne(Predicate predicate) {
     uint32_t num_values_removed = 0;
-    for (const auto& partition : partitions_) {
-      num_values_removed = partition->removeOne(predicate);
+    const auto lock = lockRouting();
+    for (size_t i = 0; i != partitions_.size(); ++i) {
+      num_values_removed = getPartition(i)->removeOne(predicate);
       if (num_values_removed != 0) break;
     }
     return num_values_removed;
@@ -115,81 +607,368 @@ class Map : public mt::Resource {
   std::pair<uint32_t, uint64_t> removeAll(Predicate predicate) {
     uint32_t num_keys_removed = 0;
     uint64_t num_values_removed = 0;
-    for (const auto& partition : partitions_) {
-      const auto result = partition->removeAll(predicate);
+    const auto lock = lockRouting();
+    for (size_t i = 0; i != partitions_.size(); ++i) {
+      const auto result = getPartition(i)->removeAll(predicate);
       num_keys_removed += result.first;
       num_values_removed += result.second;
     }
     return {num_keys_removed, num_values_removed};
   }
 
+  template <typename Predicate>
+  std::pair<uint32_t, uint64_t> removeAllInChunks(
+      Predicate predicate, size_t chunk_size = DEFAULT_REMOVE_CHUNK_SIZE,
+      uint32_t num_threads = 1) {
+    std::atomic<uint32_t> num_keys_removed(0);
+    std::atomic<uint64_t> num_values_removed(0);
+    const auto remove = [&](internal::Partition* partition) {
+      const auto result = partition->removeAllInChunks(predicate, chunk_size);
+      num_keys_removed += result.first;
+      num_values_removed += result.second;
+    };
+    if (num_threads == 1) {
+      const auto lock = lockRouting();
+      for (size_t i = 0; i != partitions_.size(); ++i) {
+        remove(getPartition(i));
+      }
+    } else {
+      forEachPartitionInParallel(
+          [&remove](internal::Partition& partition) { remove(&partition); },
+          num_threads);
+    }
+    return {num_keys_removed, num_values_removed};
+  }
+  // Same as `removeAll()`, but no lock is held for longer than it takes to
+  // evaluate `predicate` for `chunk_size` keys of a partition, so that
+  // lookups and updates proceed while many keys are removed.  Keys inserted
+  // concurrently may or may not be visited.  If `num_threads` is not 1,
+  // partitions are processed concurrently by `num_threads` threads, or by
+  // one thread per hardware thread if zero, in which case `predicate` must
+  // be thread-safe.  Only keys that had values are counted as removed.
+
+  static const size_t DEFAULT_REMOVE_CHUNK_SIZE = 1024;
+
   template <typename Predicate>
   bool removeOne(const Bytes& key, Predicate predicate) {
-    return getPartition(key)->removeOne(key, predicate);
+    const internal::Metrics::Timer timer(metrics_.get(), Operation::REMOVE);
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)->removeOne(hashed_key, predicate);
   }
 
   template <typename Predicate>
   uint32_t removeAll(const Bytes& key, Predicate predicate) {
-    return getPartition(key)->removeAll(key, predicate);
+    const internal::Metrics::Timer timer(metrics_.get(), Operation::REMOVE);
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)->removeAll(hashed_key, predicate);
   }
 
   bool replaceOne(const Bytes& key, const Bytes& old_value,
                   const Bytes& new_value) {
-    return getPartition(key)->replaceOne(key, old_value, new_value);
+    const internal::Metrics::Timer timer(metrics_.get(), Operation::REPLACE);
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)
+        ->replaceOne(hashed_key, old_value, new_value);
   }
 
   template <typename Function>
   bool replaceOne(const Bytes& key, Function map) {
-    return getPartition(key)->replaceOne(key, map);
+    const internal::Metrics::Timer timer(metrics_.get(), Operation::REPLACE);
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)->replaceOne(hashed_key, map);
   }
 
   uint32_t replaceAll(const Bytes& key, const Bytes& old_value,
                       const Bytes& new_value) {
-    return getPartition(key)->replaceAll(key, old_value, new_value);
+    const internal::Metrics::Timer timer(metrics_.get(), Operation::REPLACE);
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)
+        ->replaceAll(hashed_key, old_value, new_value);
   }
+  // Matches of the same size as `new_value` are overwritten in place and keep
+  // their position.  Otherwise matches are removed and `new_value` is
+  // appended once per match, as with the versions that take a function.
 
   template <typename Function>
   uint32_t replaceAll(const Bytes& key, Function map) {
-    return getPartition(key)->replaceAll(key, map);
+    const internal::Metrics::Timer timer(metrics_.get(), Operation::REPLACE);
+    const auto hashed_key = hashKey(key);
+    return getPartition(hashed_key)->replaceAll(hashed_key, map);
   }
 
+  std::vector<uint32_t> replaceMany(const std::vector<Bytes>& keys,
+                                    const std::vector<Bytes>& old_values,
+                                    const std::vector<Bytes>& new_values);
+  // Same as calling `replaceAll()` for `keys[i]`, `old_values[i]`, and
+  // `new_values[i]` for all `i`, but the routing lock is acquired only once.
+  // Returns the number of replaced values for each key.
+
   template <typename Procedure>
   void forEachKey(Procedure process) const {
-    for (const auto& partition : partitions_) {
-      partition->forEachKey(process);
+    const auto lock = lockRouting();
+    for (size_t i = 0; i != partitions_.size(); ++i) {
+      getPartition(i)->forEachKey(process);
     }
   }
 
+  template <typename Procedure>
+  void forEachKeyInRange(const Bytes& lower, const Bytes& upper,
+                         Procedure process) const {
+    const auto lock = lockRouting();
+    for (const auto& key : getKeysInRangeUnlocked(lower, upper)) {
+      process(Bytes(key));
+    }
+  }
+  // Calls `process` for each key that is not less than `lower` and less than
+  // `upper` in ascending byte-wise order, where an empty `upper` means no
+  // upper bound.  Each partition keeps a sorted array of its keys, which is
+  // built on first use and after new keys have been inserted, and the keys
+  // found there by binary search are merged across partitions.
+
+  template <typename Procedure>
+  void forEachKeyWithPrefix(const Bytes& prefix, Procedure process) const {
+    forEachKeyInRange(prefix, getPrefixUpperBound(prefix), process);
+  }
+  // Same as `forEachKeyInRange()` for the keys that start with `prefix`.
+
+  template <typename Procedure>
+  void forEachKey(uint64_t lower, uint64_t upper, Procedure process) const {
+    char data[sizeof(uint64_t)];
+    for (const auto key : getKeysInRange(lower, upper)) {
+      internal::KeyDirectory::writeKey(key, data);
+      process(Bytes(data, sizeof data));
+    }
+  }
+  // Calls `process` in ascending order for each key that consists of eight
+  // bytes and whose value as a big-endian integer is not less than `lower`
+  // and less than `upper`.  Each partition keeps such keys in a compressed
+  // sorted directory, which is built on first use and after new keys have
+  // been inserted, so that repeated range scans do not visit all keys.  The
+  // keys are collected before `process` is called, which may therefore
+  // modify the map.
+
+  template <typename Procedure>
+  void forEachKeyInParallel(Procedure process, uint32_t num_threads = 0) const {
+    forEachPartitionInParallel(
+        [&process](const internal::Partition& partition) {
+          partition.forEachKey(process);
+        },
+        num_threads);
+  }
+  // Same as `forEachKey()`, but partitions are scanned concurrently by
+  // `num_threads` threads, or by one thread per hardware thread if zero.
+  // `process` is called concurrently and therefore must be thread-safe.
+
   template <typename Procedure>
   void forEachValue(const Bytes& key, Procedure process) const {
-    getPartition(key)->forEachValue(key, process);
+    const auto hashed_key = hashKey(key);
+    getPartition(hashed_key)->forEachValue(hashed_key, process);
   }
 
   template <typename BinaryProcedure>
   void forEachEntry(BinaryProcedure process) const {
-    for (const auto& partition : partitions_) {
-      partition->forEachEntry(process);
+    const auto lock = lockRouting();
+    for (size_t i = 0; i != partitions_.size(); ++i) {
+      getPartition(i)->forEachEntry(process);
     }
   }
 
+  template <typename BinaryProcedure>
+  void forEachEntryInParallel(BinaryProcedure process,
+                              uint32_t num_threads = 0) const {
+    forEachPartitionInParallel(
+        [&process](const internal::Partition& partition) {
+          partition.forEachEntry(process);
+        },
+        num_threads);
+  }
+  // Same as `forEachEntry()`, but partitions are scanned concurrently by
+  // `num_threads` threads, or by one thread per hardware thread if zero.
+  // `process` is called concurrently and therefore must be thread-safe.
+
+  uint32_t getNumScanThreads(uint32_t num_threads) const;
+  // Returns the number of threads that `forEachEntryInParallel()` and the
+  // like actually use when called with `num_threads`, which is the size of
+  // the shared pool if `Options::shared_thread_pool` is set.
+
   std::vector<Stats> getStats() const;
 
   Stats getTotalStats() const;
 
+  std::vector<Stats> getCurrentStats() const;
+
+  Stats getCurrentTotalStats() const;
+  // Same as `getStats()` and `getTotalStats()`, but based on counters that
+  // updates maintain, so that the call does not visit any list and can be
+  // used to monitor a map that is being updated.  Only numbers of keys and
+  // values are provided, while sizes of keys and lists are zero.
+
+  std::vector<SampledStats> getSampledStats(size_t num_samples = 1000) const;
+
+  SampledStats getSampledTotalStats(size_t num_samples = 1000) const;
+  // Same as `getCurrentStats()` and `getCurrentTotalStats()`, but sizes of
+  // keys and lists are estimated from `num_samples` random keys per
+  // partition, with 95% confidence intervals, so that their distribution
+  // can be watched on maps too large to visit every list, see
+  // `internal::Partition::getSampledStats()`.
+
+  std::vector<MemoryUsage> getMemoryUsage() const;
+
+  MemoryUsage getTotalMemoryUsage() const;
+  // Returns the number of bytes held by each component of the partitions,
+  // so that it can be seen where memory goes, e.g. to choose
+  // `Options::memory_limit`.  The total includes the process-wide pool of
+  // list mutexes.  Like `getStats()`, the call visits all lists.
+
+  std::vector<std::pair<std::string, uint64_t> > getHotKeys(size_t k) const;
+  // Returns up to `k` of the most frequently accessed keys of all partitions
+  // with the estimated number of their recent accesses, most frequent
+  // first, or nothing if the map has not been opened with
+  // `Options::hot_keys`.  Estimates are upper bounds derived from sampled
+  // accesses, and decay over time, so that they reflect recent accesses.
+
+  Metrics getMetrics() const;
+  // Returns the latency histograms and byte counters recorded since the map
+  // was opened with `Options::metrics`, or empty ones otherwise.  Latencies
+  // are measured for `put()`, `write()`, `get()` returning an iterator,
+  // `getMany()`, `contains()`, and removing and replacing values of a key.
+  // The histograms are aggregated from per-thread slots on each call, which
+  // is cheap compared to `getStats()`.
+
   bool isReadOnly() const;
 
+  int getNumaNode(size_t partition_index) const;
+  // Returns the NUMA node that the partition is assigned to, or -1 if the
+  // map has not been opened with `Options::numa_aware`.  Callers can bind
+  // threads that work on the partition to this node, see
+  // `internal::Numa::bindCurrentThreadToNode()`.
+
+  size_t getNumPartitions() const;
+  // Returns the number of partitions including unused ones of a map that
+  // has been repartitioned via `split()` or `merge()`.
+
+  size_t getPartitionIndexOf(const Bytes& key) const;
+  // Returns the index of the partition that `key` currently belongs to,
+  // which changes if the partition is split or merged.
+
+  uint64_t removeExpired();
+  // Removes the values of all keys whose deadline has passed and returns
+  // the number of such keys.  Expired keys are found without visiting the
+  // other keys.  The compaction thread, if any, calls this periodically.
+
+  void checkpoint();
+  // Writes the lists that have been modified since the last checkpoint to
+  // the delta file of their partition, so that a crash loses no update made
+  // before, and truncates write-ahead logs, if any.  Closing the map only
+  // rewrites the keys file of partitions whose delta has grown large.
+  // Partitions of a lazily opened map are opened first.
+
+  void snapshot(const boost::filesystem::path& directory);
+  // Writes a copy of the map as it is now into `directory`, which must be
+  // an existing empty directory, so that it can be opened as a map of its
+  // own, e.g. for backups, without closing this one.  Each partition
+  // flushes its tail blocks and writes a new keys file, while its updates
+  // wait, and clones its values file, see `internal::Partition::snapshot()`.
+  // On file systems with reflinks, such as Btrfs and XFS, this pauses each
+  // partition for milliseconds and shares the values with the original
+  // until they are modified.  Otherwise the values are copied.  All
+  // partitions of the copy are stored in `directory`.  Since partitions are
+  // copied one after another, the copy reflects each of them at a slightly
+  // different time.  Partitions of a lazily opened map are opened first.
+  // If the map has been opened with `Options::change_feed`, the copy also
+  // records the offset of each feed, from which on it follows the map.
+
+  uint64_t followChangeFeed(const boost::filesystem::path& directory);
+  // Applies the updates that the map in `directory`, which is open with
+  // `Options::change_feed` or has been, has appended to its change feeds
+  // since this map was snapshotted from it or followed it the last time,
+  // and returns the number of records applied.  Replicas call this
+  // periodically to stay behind the primary by no more than the interval.
+  // Updates are replayed by position, so this map must not be updated
+  // otherwise, and it must be created anew from a snapshot if either map
+  // has crashed, or if the primary has been split, merged, or optimized.
+  // If the primary caps lists, see `Options::max_values_per_key`, the same
+  // goes for reopening this map.
+  // The primary may be in use by another process meanwhile.
+
+  size_t split(size_t index);
+  // Moves the lists in the upper half of the hash range of partition `index`
+  // to another partition, which is one left empty by `merge()` or a new one,
+  // and returns its index.  Unlike `optimize()`, this only reads and writes
+  // the lists of one partition and needs no second directory.  Other
+  // operations wait meanwhile, see `Options::online_repartitioning`.
+  // Requires: the map is writable, not lazy, and selects partitions via
+  // `Id::xxhash_partitioning`.
+
+  void merge(size_t index);
+  // Moves the lists of the partition whose hash range follows the one of
+  // partition `index` into the latter, which takes over the range.  The
+  // emptied partition is reused by the next `split()`.  Same requirements
+  // as `split()`.
+
   // ---------------------------------------------------------------------------
   // Static member functions
   // ---------------------------------------------------------------------------
 
   static std::vector<Stats> stats(const boost::filesystem::path& directory);
 
+  static std::vector<Stats> liveStats(
+      const boost::filesystem::path& directory,
+      std::chrono::system_clock::time_point* published = nullptr);
+  // Returns the stats that the map in `directory`, which must be open in
+  // another process or this one with `Options::live_stats_interval`, has
+  // published last, and if `published` is not null, sets it to the time of
+  // publication.  Unlike `stats()`, this neither waits for the map to be
+  // closed nor locks its directory, and it does not affect the process that
+  // has the map open, which only writes the stats to shared memory.
+
+  static Metrics metrics(const boost::filesystem::path& directory);
+  // Returns the metrics that the map in `directory` has saved when it was
+  // closed the last time, or empty ones if it has not been opened with
+  // `Options::metrics` in writable mode before.
+
+  static Tuning recommendOptions(const boost::filesystem::path& directory);
+
+  static Tuning recommendOptions(const boost::filesystem::path& directory,
+                                 const Options& options);
+  // Recommends a block size and number of partitions for the map in
+  // `directory` from its `stats()` and `metrics()`, see
+  // `internal::Tuning::recommend()`.  The recommendation assumes that the
+  // map is processed by `Options::num_threads` threads.
+
+  static std::vector<std::vector<uint32_t> > verify(
+      const boost::filesystem::path& directory);
+  // Compares all blocks of values with their checksums and returns the ids
+  // of those that do not match for each partition.  Throws if the map has
+  // not been closed with `Options::checksums` in writable mode the last
+  // time, see there.
+
+  static std::vector<std::vector<uint32_t> > verifyLists(
+      const boost::filesystem::path& directory, const Options& options);
+  // Checks the structure of each partition, which does not require
+  // checksums, and returns the ids of the blocks that are invalid, see
+  // `internal::Partition::getInvalidBlocks()`.  Decodes all values, and
+  // also checks them against their checksums, if any.  Partitions are
+  // checked by `Options::num_threads` threads.
+
+  static LockProfile getLockProfile();
+  // Returns how often the locks of partition shards, lists, and stores of
+  // all maps in the process have been acquired and waited for, and the keys
+  // whose operations waited most often.  The profile is empty unless the
+  // library has been compiled with MULTIMAP_LOCK_PROFILING defined, see
+  // multimap-library-prof.pro.
+
   static void importFromBase64(const boost::filesystem::path& directory,
                                const boost::filesystem::path& input);
 
   static void importFromBase64(const boost::filesystem::path& directory,
                                const boost::filesystem::path& input,
                                const Options& options);
+  // Puts the keys and values of `input`, which is a file or a directory of
+  // files in the format written by `exportToBase64()`.  The files are mapped
+  // into memory and split into chunks at line breaks, which are decoded by
+  // `Options::num_threads` threads.  The values of each key are put in the
+  // order of the input.
 
   static void exportToBase64(const boost::filesystem::path& directory,
                              const boost::filesystem::path& output);
@@ -197,6 +976,31 @@ class Map : public mt::Resource {
   static void exportToBase64(const boost::filesystem::path& directory,
                              const boost::filesystem::path& output,
                              const Options& options);
+  // Writes all keys and values into `output` using Base64 encoding, one
+  // list per line.  If `output` is an existing directory, each partition is
+  // written into its own file named after the partition, and partitions are
+  // exported by `Options::num_threads` threads, so that the files can be
+  // consumed in parallel, e.g. by `importFromBase64()`.  Values are sorted
+  // if `Options::compare` is set.
+
+  static void importFromBinary(const boost::filesystem::path& directory,
+                               const boost::filesystem::path& input);
+
+  static void importFromBinary(const boost::filesystem::path& directory,
+                               const boost::filesystem::path& input,
+                               const Options& options);
+  // Same as `importFromBase64()`, but for files written by `exportToBinary()`.
+  // Their chunks are decoded and verified by `Options::num_threads` threads.
+
+  static void exportToBinary(const boost::filesystem::path& directory,
+                             const boost::filesystem::path& output);
+
+  static void exportToBinary(const boost::filesystem::path& directory,
+                             const boost::filesystem::path& output,
+                             const Options& options);
+  // Same as `exportToBase64()`, but using the length-prefixed format of
+  // `internal::Dump`, which is not subject to the overhead of Base64.  If
+  // `Options::compress` is true, the chunks of the output are compressed.
 
   static void optimize(const boost::filesystem::path& directory,
                        const boost::filesystem::path& output);
@@ -204,20 +1008,239 @@ class Map : public mt::Resource {
   static void optimize(const boost::filesystem::path& directory,
                        const boost::filesystem::path& output,
                        const Options& options);
+  // Writes a defragmented copy of the map into `output`, using the block size
+  // and number of partitions of `options` unless they are kept.  If both are
+  // kept, the value encoding is unchanged, and `Options::compare` is not
+  // set, the blocks of lists without removed values are copied as they are
+  // instead of decoding and rewriting each value.  In each partition of the
+  // copy the blocks of a list are consecutive and lists are laid out in the
+  // order of the keys file, so that reading a list or scanning a partition
+  // reads its values file sequentially.  If `Options::frozen` is set, the
+  // copy is written in the format of class `FrozenMap`.
+
+  static std::string getNameOfIdFile();
+  static std::string getNameOfLockFile();
+  static std::string getNameOfRoutesFile();
+  static std::string getNameOfDirectoriesFile();
+  static std::string getNameOfMetricsFile();
+  static std::string getNameOfFeedOffsetsFile();
+  static std::string getNameOfLiveStatsFile();
+  static std::string getPartitionPrefix(size_t index);
+  // Returns names of files and file prefixes relative to the map's directory.
+
+  static std::vector<boost::filesystem::path> getDirectories(
+      const boost::filesystem::path& directory, const Id& id);
+  // Returns `directory` followed by the additional directories of the map in
+  // `directory` with `id`.  Partition `i` is stored in element `i % size()`.
+
+  static size_t getPartitionIndex(const Bytes& key, size_t num_partitions);
+  // Returns the index of the partition that `key` belongs to in a map with
+  // `Id::xxhash_partitioning`, which is set for all newly created maps.
+
+  static size_t getPartitionIndex(uint64_t key_hash, size_t num_partitions);
+  // Same as above, but with the key's hash value already computed via
+  // `internal::Partition::Key::hash()`.  The partition is selected by the
+  // upper half of the hash value, the lower half is left to the partition.
+  // Maps that have been repartitioned via `split()` or `merge()` assign
+  // ranges of the upper half to partitions as recorded in their routes file.
 
  private:
-  internal::Partition* getPartition(const Bytes& key) {
-    const auto hash = mt::fnv1aHash(key.data(), key.size());
-    return partitions_[hash % partitions_.size()].get();
+  typedef internal::Partition::Key HashedKey;
+
+  typedef internal::ReaderLock<boost::shared_mutex> RoutingLock;
+
+  class LockedPartition {
+   public:
+    LockedPartition(internal::Partition* partition, RoutingLock lock)
+        : partition_(partition), lock_(std::move(lock)) {}
+
+    internal::Partition* operator->() const { return partition_; }
+
+   private:
+    internal::Partition* partition_;
+    RoutingLock lock_;
+  };
+  // Keeps the routing of keys to partitions unchanged while it lives, which
+  // is until the end of the full expression `getPartition(key)->...`.
+
+  struct Range {
+    uint64_t begin;
+    uint64_t end;
+  };
+  // A range of the upper half of hash values.  Empty for unused partitions.
+
+  static const size_t NUM_ROUTING_MUTEXES = 16;
+
+  RoutingLock lockRouting(uint64_t hash = 0) const {
+    return routing_mutexes_
+               ? RoutingLock(routing_mutexes_[hash % NUM_ROUTING_MUTEXES])
+               : RoutingLock();
   }
+  // Any of the mutexes excludes repartitioning, so operations on the whole
+  // map take the first one and operations on a key one chosen by its hash.
 
-  const internal::Partition* getPartition(const Bytes& key) const {
-    const auto hash = mt::fnv1aHash(key.data(), key.size());
-    return partitions_[hash % partitions_.size()].get();
+  HashedKey hashKey(const Bytes& key) const {
+    return HashedKey(key, HashedKey::hash(key, partition_options_.key_hash));
   }
 
-  std::vector<std::unique_ptr<internal::Partition> > partitions_;
+  size_t getPartitionIndex(const HashedKey& key) const {
+    if (fnv1a_partitioning_) {
+      return mt::fnv1aHash(key.data(), key.size()) % partitions_.size();
+    }
+    if (range_begins_.empty()) {
+      return getPartitionIndex(key.hash(), partitions_.size());
+    }
+    const auto iter = std::upper_bound(
+        range_begins_.begin(), range_begins_.end(), key.hash() >> 32);
+    return range_partitions_[iter - range_begins_.begin() - 1];
+  }
+
+  internal::Partition* getPartition(size_t index) const {
+    if (once_flags_) {
+      std::call_once(once_flags_[index],
+                     [this, index] { openPartition(index); });
+    }
+    return partitions_[index].get();
+  }
+  // Opens the partition first if the map was opened lazily.
+
+  LockedPartition getPartition(const HashedKey& key) const {
+    auto lock = lockRouting(key.hash());
+    return LockedPartition(getPartition(getPartitionIndex(key)),
+                           std::move(lock));
+  }
+
+  void openPartition(size_t index) const;
+
+  void closePartitions();
+  // Closes all partitions, concurrently by `getNumWorkerThreads()` threads,
+  // since each writable partition flushes its lists and rewrites its files.
+
+  std::vector<uint64_t> getKeysInRange(uint64_t lower, uint64_t upper) const;
+
+  std::vector<std::string> getKeysInRangeUnlocked(const Bytes& lower,
+                                                  const Bytes& upper) const;
+  // Requires: the caller holds the routing lock.
+
+  static uint32_t getDeadline(std::chrono::seconds ttl);
+  // Returns the deadline that is `ttl` from now, see `expire()`.
+
+  static std::string getPrefixUpperBound(const Bytes& prefix);
+  // Returns the least string that is greater than all strings starting with
+  // `prefix`, or an empty string if there is none.
+
+  size_t getNumWorkerThreads() const;
+  // Returns `Options::num_threads`, or the number of hardware threads if
+  // zero, but at most the number of partitions.
+
+  void warmUp() const;
+  // Calls `warmUp()` for one partition after another until all are done or
+  // `stop_warm_up_` is set.  Runs in `warm_up_thread_`.
+
+  void removeMisroutedLists(size_t index) const;
+  // Removes the lists of keys that belong to other partitions, which
+  // `split()` and `merge()` leave behind if they do not complete.  Called
+  // for each writable partition of a repartitioned map when it is opened.
+
+  std::vector<internal::WriterLock<boost::shared_mutex> >
+  lockRoutingForRepartitioning(size_t index);
+  // Checks the requirements of `split()` and `merge()` and assigns explicit
+  // ranges to the partitions if they do not have them yet.
+
+  void repartition(size_t source, size_t target,
+                   const std::vector<Range>& ranges);
+  // Copies the lists of `source` that belong to `target` according to the
+  // new `ranges` there, switches to `ranges`, and then removes the copied
+  // lists from `source`.  The routes file marks the partition that may hold
+  // lists of other partitions meanwhile, so that an interrupted call is
+  // rolled back or completed when the map is opened the next time.
+
+  void setRanges(const std::vector<Range>& ranges);
+
+  uint64_t readRoutesFile(const boost::filesystem::path& filename);
+  // Returns the index plus one of a partition that may hold lists of other
+  // partitions, or zero.
+
+  void writeRoutesFile(uint64_t num_incomplete_partition) const;
+
+  Id getId(bool sorted) const;
+
+  void writeIdFile(bool sorted) const;
+  // Records whether the lists are still sorted, which is only known when
+  // the map is closed.
+
+  internal::ThreadPool* getAsyncThreadPool() const;
+  // Starts the thread pool on first use.
+
+  template <typename Procedure>
+  void forEachPartitionInParallel(Procedure process,
+                                  uint32_t num_threads) const {
+    const auto lock = lockRouting();
+    const auto process_partition = [this, &process](size_t i) {
+      if (!numa_nodes_.empty() && !shared_thread_pool_) {
+        internal::Numa::bindCurrentThreadToNode(getNumaNode(i));
+      }
+      process(*getPartition(i));
+    };
+    if (shared_thread_pool_) {
+      shared_thread_pool_->forEachIndex(partitions_.size(), process_partition);
+    } else {
+      internal::WorkStealingPool(num_threads)
+          .forEachIndex(partitions_.size(), process_partition);
+    }
+  }
+  // Threads of the shared pool are not bound to NUMA nodes, since they
+  // serve other maps as well.
+
+  std::vector<std::vector<size_t> > groupByPartition(
+      const std::vector<Bytes>& keys, std::vector<uint64_t>* hashes) const;
+  // Also stores the hash value of each key in `hashes`.
+
+  std::vector<std::vector<size_t> > groupByPartition(
+      const WriteBatch& batch, std::vector<Bytes>* keys,
+      std::vector<Bytes>* values, std::vector<uint64_t>* hashes) const;
+  // Stores the keys, values, and hash values of `batch` in the order of the
+  // puts, which is what the returned indices refer to.
+
+  typedef internal::Metrics::Operation Operation;
+
+  mutable std::vector<std::unique_ptr<internal::Partition> > partitions_;
+  std::unique_ptr<std::once_flag[]> once_flags_;
+  internal::Partition::Options partition_options_;
+  std::function<bool(const Bytes&, const Bytes&)> compare_;
+  std::function<void(uint32_t, const PartitionTimings&)> on_partition_open_;
+  std::function<void(uint32_t, const PartitionTimings&)> on_partition_close_;
+  uint64_t block_size_ = 0;
+  bool fnv1a_partitioning_ = false;
+  std::vector<Range> ranges_;
+  std::vector<uint64_t> range_begins_;
+  std::vector<uint32_t> range_partitions_;
+  // Sorted by begin and without empty ranges for the lookup of partitions.
+  // Empty if the map has never been repartitioned.
+  std::unique_ptr<boost::shared_mutex[]> routing_mutexes_;
+  std::shared_ptr<internal::Metrics> metrics_;
+  // Shared with the partitions.  Null unless `Options::metrics`.
   mt::DirectoryLockGuard lock_;
+  std::vector<boost::filesystem::path> directories_;
+  std::vector<std::unique_ptr<mt::DirectoryLockGuard> > directory_locks_;
+  // Lock the directories of `directories_` except the first one.
+  std::vector<int> numa_nodes_;
+  // Empty unless `Options::numa_aware`.
+  std::shared_ptr<internal::WorkStealingPool> shared_thread_pool_;
+  // Null unless `Options::shared_thread_pool`.
+  std::unique_ptr<internal::Flusher> flusher_;
+  std::unique_ptr<internal::Checkpointer> checkpointer_;
+  std::unique_ptr<internal::Compactor> compactor_;
+  std::unique_ptr<internal::Spiller> spiller_;
+  std::unique_ptr<internal::StatsPublisher> stats_publisher_;
+  std::atomic<bool> stop_warm_up_{false};
+  std::thread warm_up_thread_;
+  // Reads the hot blocks of all partitions ahead, see `warmUp()`.
+  uint32_t num_threads_ = 0;
+  uint32_t num_async_threads_ = 0;
+  mutable std::once_flag async_once_flag_;
+  mutable std::unique_ptr<internal::ThreadPool> async_thread_pool_;
+  // Declared last, so that they are stopped before the partitions are closed.
 };
 
 }  // namespace multimap
@@ -0,0 +1,201 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/MapBuilder.hpp"
+
+#include <exception>
+#include <boost/filesystem/operations.hpp>
+
+namespace multimap {
+
+namespace {
+
+void appendBytes(const Bytes& bytes, std::vector<char>* batch) {
+  const uint32_t size = bytes.size();
+  const auto begin = reinterpret_cast<const char*>(&size);
+  batch->insert(batch->end(), begin, begin + sizeof size);
+  batch->insert(batch->end(), bytes.begin(), bytes.end());
+}
+
+Bytes readBytes(const char** pos) {
+  uint32_t size;
+  std::memcpy(&size, *pos, sizeof size);
+  const Bytes bytes(*pos + sizeof size, size);
+  *pos += sizeof size + size;
+  return bytes;
+}
+
+}  // namespace
+
+MapBuilder::MapBuilder(const boost::filesystem::path& directory,
+                       const Map::Options& options)
+    : lock_(directory, Map::getNameOfLockFile()) {
+  mt::Check::notZero(options.block_size, "Map's block size must be positive");
+  mt::Check::isTrue(mt::isPowerOfTwo(options.block_size),
+                    "Map's block size must be a power of two");
+  mt::Check::isTrue(options.bloom_filter_false_positive_rate >= 0 &&
+                        options.bloom_filter_false_positive_rate < 1,
+                    "Map's Bloom filter false-positive rate must be in [0, 1)");
+  mt::Check::isTrue(options.value_filter_false_positive_rate >= 0 &&
+                        options.value_filter_false_positive_rate < 1,
+                    "Map's value filter false-positive rate must be in [0, 1)");
+  mt::Check::isFalse(
+      boost::filesystem::exists(directory / Map::getNameOfIdFile()),
+      "Map in '%s' already exists",
+      boost::filesystem::absolute(directory).c_str());
+
+  internal::PartitionBuilder::Options builder_options;
+  builder_options.block_size = options.block_size;
+  builder_options.buffer_size = options.buffer_size;
+  builder_options.compress = options.compress;
+  builder_options.front_coding = options.front_coding;
+  builder_options.bloom_filter_false_positive_rate =
+      options.bloom_filter_false_positive_rate;
+  builder_options.value_filter_false_positive_rate =
+      options.value_filter_false_positive_rate;
+  std::vector<boost::filesystem::path> directories = {directory};
+  for (const auto& extra_directory : options.directories) {
+    directories.push_back(boost::filesystem::absolute(extra_directory));
+    directory_locks_.emplace_back(new mt::DirectoryLockGuard(
+        directories.back(), Map::getNameOfLockFile()));
+  }
+  if (directories.size() > 1) {
+    mt::Files::writeLinewise(
+        std::vector<boost::filesystem::path>(directories.begin() + 1,
+                                             directories.end()),
+        directory / Map::getNameOfDirectoriesFile(),
+        [](const boost::filesystem::path& path, std::ostream& os) {
+          os << path.string();
+        });
+  }
+  partitions_ = std::vector<Partition>(mt::nextPrime(options.num_partitions));
+  // std::vector::resize() would require Partition to be movable.
+  for (size_t i = 0; i != partitions_.size(); ++i) {
+    const auto prefix = directories[i % directories.size()] /
+                        Map::getPartitionPrefix(i);
+    partitions_[i].builder.reset(
+        new internal::PartitionBuilder(prefix, builder_options));
+  }
+  thread_pool_ =
+      options.shared_thread_pool
+          ? internal::WorkStealingPool::getShared(options.num_threads)
+          : std::make_shared<internal::WorkStealingPool>(options.num_threads);
+  batch_size_ = options.buffer_size;
+  block_size_ = options.block_size;
+  compress_ = options.compress;
+  front_coding_ = options.front_coding;
+}
+
+MapBuilder::~MapBuilder() {
+  if (!finished()) {
+    try {
+      finish();
+    } catch (std::exception& error) {
+      mt::log() << "MapBuilder could not finish the map in "
+                << lock_.directory() << ": " << error.what() << '\n';
+    }
+  }
+  for (auto& partition : partitions_) {
+    if (partition.pending.valid()) partition.pending.wait();
+  }
+  // Tasks of a shared pool would outlive the partitions otherwise.
+}
+
+void MapBuilder::putUnlocked(const Bytes& key, const Bytes& value,
+                             Partition* partition) {
+  MT_REQUIRE_LE(key.size(), Map::Limits::maxKeySize());
+  MT_REQUIRE_LE(value.size(), Map::Limits::maxValueSize());
+  appendBytes(key, &partition->batch);
+  appendBytes(value, &partition->batch);
+  if (partition->batch.size() >= batch_size_) {
+    submitBatch(partition);
+  }
+}
+
+void MapBuilder::putPartition(size_t index,
+                              const boost::filesystem::path& prefix,
+                              const internal::Partition::Options& options) {
+  MT_REQUIRE_FALSE(finished());
+  MT_REQUIRE_LT(index, partitions_.size());
+  auto& partition = partitions_[index];
+  std::lock_guard<std::mutex> lock(partition.mutex);
+  submitBatch(&partition);
+  thread_pool_->wait(&partition.pending);
+  // Values put before must be written first.
+  internal::Partition::forEachList(
+      prefix, options, [&](const Bytes& key, const internal::List& list,
+                           const internal::Store& store) {
+        MT_ASSERT_EQ(Map::getPartitionIndex(key, partitions_.size()), index);
+        partition.builder->put(key, list, store);
+      },
+      internal::Partition::ScanOrder::BLOCKS);
+  std::promise<void> done;
+  done.set_value();
+  partition.pending = done.get_future();
+  // `finish()` expects a valid future.
+}
+
+void MapBuilder::finish() {
+  MT_REQUIRE_FALSE(finished());
+  for (auto& partition : partitions_) {
+    submitBatch(&partition);
+  }
+  for (size_t i = 0; i != partitions_.size(); ++i) {
+    auto& partition = partitions_[i];
+    thread_pool_->wait(&partition.pending);
+    internal::PartitionBuilder* builder = partition.builder.get();
+    partition.pending =
+        thread_pool_->submit([builder] { builder->finish(); }, i);
+  }
+  for (auto& partition : partitions_) {
+    thread_pool_->wait(&partition.pending);
+  }
+
+  Map::Id id;
+  id.block_size = block_size_;
+  id.num_partitions = partitions_.size();
+  id.compressed = compress_;
+  id.front_coded = front_coding_;
+  id.xxhash_partitioning = true;
+  id.num_directories = directory_locks_.size() + 1;
+  id.writeToFile(lock_.directory() / Map::getNameOfIdFile());
+  partitions_.clear();
+  thread_pool_.reset();
+}
+
+void MapBuilder::submitBatch(Partition* partition) {
+  if (partition->pending.valid()) {
+    thread_pool_->wait(&partition->pending);
+    // Batches of the same partition must be written in order.
+  }
+  const auto batch = std::make_shared<std::vector<char> >();
+  batch->swap(partition->batch);
+  partition->batch.reserve(batch_size_);
+  internal::PartitionBuilder* builder = partition->builder.get();
+  const size_t index = partition - partitions_.data();
+  partition->pending = thread_pool_->submit([builder, batch] {
+    const char* pos = batch->data();
+    const char* end = pos + batch->size();
+    while (pos != end) {
+      const auto key = readBytes(&pos);
+      const auto value = readBytes(&pos);
+      builder->put(key, value);
+    }
+  }, index);
+}
+
+}  // namespace multimap
@@ -0,0 +1,128 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_MAP_BUILDER_HPP_INCLUDED
+#define MULTIMAP_MAP_BUILDER_HPP_INCLUDED
+
+#include <future>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "multimap/internal/PartitionBuilder.hpp"
+#include "multimap/internal/WorkStealingPool.hpp"
+#include "multimap/Map.hpp"
+
+namespace multimap {
+
+class MapBuilder : public mt::Resource {
+  // Creates a new map from bulk input without going through `Map::put()`.
+  // The input must be grouped by key, i.e. all values of a key have to be
+  // put consecutively, which is the case for key-sorted input as well as for
+  // the entries of another map.  Values are collected in per-partition
+  // batches of `Options::buffer_size` bytes, which are written by a pool of
+  // `Options::num_threads` threads, or by the process-wide pool if
+  // `Options::shared_thread_pool` is set, so that partitions are built in
+  // parallel.
+  //
+  // `put()` may be called concurrently, e.g. by threads reading different
+  // inputs.  In that case all values of a key must be passed by a single call
+  // of one of the range versions, because only those are atomic per key.
+
+ public:
+  MapBuilder(const boost::filesystem::path& directory,
+             const Map::Options& options);
+  // Throws if there is already a map in `directory`.
+
+  ~MapBuilder();
+  // Calls `finish()` if not already done.  Errors are logged, but not thrown.
+
+  void put(const Bytes& key, const Bytes& value) {
+    MT_REQUIRE_FALSE(finished());
+    auto& partition = getPartition(key);
+    std::lock_guard<std::mutex> lock(partition.mutex);
+    putUnlocked(key, value, &partition);
+  }
+
+  template <typename InputIter>
+  void put(const Bytes& key, InputIter first, InputIter last) {
+    MT_REQUIRE_FALSE(finished());
+    auto& partition = getPartition(key);
+    std::lock_guard<std::mutex> lock(partition.mutex);
+    while (first != last) {
+      putUnlocked(key, *first, &partition);
+      ++first;
+    }
+  }
+
+  void put(const Bytes& key, Iterator* values) {
+    MT_REQUIRE_FALSE(finished());
+    auto& partition = getPartition(key);
+    std::lock_guard<std::mutex> lock(partition.mutex);
+    while (values->hasNext()) {
+      putUnlocked(key, values->next(), &partition);
+    }
+  }
+
+  void putPartition(size_t index, const boost::filesystem::path& prefix,
+                    const internal::Partition::Options& options);
+  // Puts all lists of the partition at `prefix` into partition `index`,
+  // which must be the partition of each of its keys, as is the case for the
+  // partitions of a map with the same number of partitions.  Blocks are
+  // copied without decoding the values where possible, see
+  // `internal::PartitionBuilder::put()`.  The lists are written by the
+  // calling thread, so that partitions can be put concurrently.
+
+  void finish();
+  // Must not be called concurrently with `put()`.
+  // Writes all remaining data to disk.  Afterwards the directory contains a
+  // complete map that can be opened via `Map`.  Exceptions that might have
+  // occurred in a worker thread are rethrown here and by `put()`.
+
+  bool finished() const { return partitions_.empty(); }
+
+ private:
+  struct Partition {
+    std::mutex mutex;
+    std::unique_ptr<internal::PartitionBuilder> builder;
+    std::vector<char> batch;
+    std::future<void> pending;
+    // Becomes ready when the previous batch has been written.
+  };
+
+  Partition& getPartition(const Bytes& key) {
+    return partitions_[Map::getPartitionIndex(key, partitions_.size())];
+  }
+
+  void putUnlocked(const Bytes& key, const Bytes& value, Partition* partition);
+
+  void submitBatch(Partition* partition);
+
+  mt::DirectoryLockGuard lock_;
+  std::vector<std::unique_ptr<mt::DirectoryLockGuard> > directory_locks_;
+  // Lock the additional directories, see `Map::Options::directories`.
+  std::vector<Partition> partitions_;
+  std::shared_ptr<internal::WorkStealingPool> thread_pool_;
+  // Shared by other maps if `Map::Options::shared_thread_pool` is set.
+  uint32_t batch_size_ = 0;
+  uint32_t block_size_ = 0;
+  bool compress_ = false;
+  bool front_coding_ = false;
+};
+
+}  // namespace multimap
+
+#endif  // MULTIMAP_MAP_BUILDER_HPP_INCLUDED
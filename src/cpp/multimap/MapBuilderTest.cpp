@@ -0,0 +1,132 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <thread>
+#include <type_traits>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/MapBuilder.hpp"
+
+namespace multimap {
+
+using testing::Eq;
+
+TEST(MapBuilderTest, IsNotDefaultConstructible) {
+  ASSERT_FALSE(std::is_default_constructible<MapBuilder>::value);
+}
+
+TEST(MapBuilderTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<MapBuilder>::value);
+  ASSERT_FALSE(std::is_copy_assignable<MapBuilder>::value);
+}
+
+struct MapBuilderTestWithParam : public testing::TestWithParam<uint32_t> {
+  void SetUp() override {
+    boost::filesystem::remove_all(directory);
+    boost::filesystem::create_directory(directory);
+  }
+
+  void TearDown() override { boost::filesystem::remove_all(directory); }
+
+  const boost::filesystem::path directory =
+      "/tmp/multimap.MapBuilderTestWithParam";
+};
+
+TEST_P(MapBuilderTestWithParam, ConstructorThrowsIfMapExists) {
+  Map::Options options;
+  options.create_if_missing = true;
+  Map(directory, options);
+  options.num_threads = GetParam();
+  ASSERT_THROW(MapBuilder(directory, options), std::runtime_error);
+}
+
+TEST_P(MapBuilderTestWithParam, BuiltMapContainsAllValues) {
+  const auto num_keys = 1000;
+  Map::Options options;
+  options.num_partitions = 7;
+  options.buffer_size = mt::KiB(4);
+  options.num_threads = GetParam();
+  {
+    MapBuilder builder(directory, options);
+    for (auto k = 0; k != num_keys; ++k) {
+      for (auto v = 0; v != k % 20; ++v) {
+        builder.put(std::to_string(k), std::to_string(v));
+      }
+    }
+    builder.finish();
+  }
+  Map map(directory);
+  const auto stats = map.getTotalStats();
+  ASSERT_THAT(stats.num_partitions, Eq(7));
+  ASSERT_THAT(stats.num_keys_valid, Eq(num_keys - num_keys / 20));
+  for (auto k = 0; k != num_keys; ++k) {
+    const auto key = std::to_string(k);
+    ASSERT_THAT(map.contains(key), Eq(k % 20 != 0));
+    if (map.contains(key)) {
+      auto iter = map.get(key);
+      ASSERT_THAT(iter->available(), Eq(k % 20));
+      for (auto v = 0; iter->hasNext(); ++v) {
+        ASSERT_THAT(iter->next(), Eq(std::to_string(v)));
+      }
+    }
+  }
+}
+
+TEST_P(MapBuilderTestWithParam, ConcurrentRangePutsKeepValuesOfKeyTogether) {
+  const auto num_keys_per_thread = 500;
+  const std::vector<std::string> values = {"1", "2", "3"};
+  Map::Options options;
+  options.num_partitions = 3;
+  options.buffer_size = mt::KiB(1);
+  options.num_threads = GetParam();
+  {
+    MapBuilder builder(directory, options);
+    std::vector<std::thread> threads;
+    for (auto t = 0; t != 4; ++t) {
+      threads.emplace_back([&, t] {
+        for (auto k = 0; k != num_keys_per_thread; ++k) {
+          const auto key = std::to_string(t) + '.' + std::to_string(k);
+          builder.put(key, values.begin(), values.end());
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    builder.finish();
+  }
+  Map map(directory);
+  ASSERT_THAT(map.getTotalStats().num_keys_valid, Eq(4 * num_keys_per_thread));
+  ASSERT_THAT(map.getTotalStats().num_values_valid,
+              Eq(4 * num_keys_per_thread * values.size()));
+}
+
+TEST_P(MapBuilderTestWithParam, FinishThrowsIfValuesAreNotConsecutive) {
+  Map::Options options;
+  options.num_partitions = 1;
+  options.num_threads = GetParam();
+  MapBuilder builder(directory, options);
+  builder.put("a", "1");
+  builder.put("b", "1");
+  builder.put("a", "2");
+  ASSERT_THROW(builder.finish(), std::runtime_error);
+}
+
+INSTANTIATE_TEST_CASE_P(Parameterized, MapBuilderTestWithParam,
+                        testing::Values(1, 2, 4));
+
+}  // namespace multimap
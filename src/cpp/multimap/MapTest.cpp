@@ -15,15 +15,29 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <thread>
 #include <type_traits>
 #include <boost/filesystem/operations.hpp>
 #include "gmock/gmock.h"
+#include "multimap/internal/Base64.hpp"
 #include "multimap/callables.hpp"
 #include "multimap/Map.hpp"
 
 namespace multimap {
 
+using testing::ElementsAreArray;
 using testing::Eq;
+using testing::Ge;
+using testing::Gt;
+using testing::Le;
+using testing::Lt;
 
 const auto NULL_PROCEDURE = [](const Bytes&) {};
 const auto TRUE_PREDICATE = [](const Bytes&) { return true; };
@@ -94,6 +108,1651 @@ TEST_F(MapTestFixture, ConstructorThrowsIfBlockSizeIsNotPowerOfTwo) {
   ASSERT_THROW(Map(directory, options), std::runtime_error);
 }
 
+TEST_F(MapTestFixture, ConstructorThrowsIfCompactionThresholdIsOutOfRange) {
+  Map::Options options;
+  options.compaction_threshold = 1.5;
+  options.create_if_missing = true;
+  ASSERT_THROW(Map(directory, options), std::runtime_error);
+}
+
+TEST_F(MapTestFixture, BackgroundCompactionFreesBlocksOfRemovedValues) {
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_partitions = 1;
+  options.compaction_threshold = 0.5;
+  options.compaction_rate = mt::MiB(1);
+  Map map(directory, options);
+  for (size_t i = 0; i != 1000; ++i) {
+    map.put("key", std::to_string(i));
+  }
+  map.checkpoint();
+  map.removeAll("key", [](const Bytes& value) {
+    return std::stoul(value.toString()) % 2 == 0;
+  });
+  for (size_t i = 0; i != 50; ++i) {
+    if (map.getTotalStats().num_values_total == 500) break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  ASSERT_THAT(map.getTotalStats().num_values_total, Eq(500));
+  ASSERT_THAT(map.get("key")->available(), Eq(500));
+}
+
+TEST_F(MapTestFixture, LazyMapOpensPartitionsOnFirstAccess) {
+  openOrCreateMap(directory)->put("a", "1");
+  openOrCreateMap(directory)->put("b", "2");
+  const auto id = Map::Id::readFromDirectory(directory);
+  const auto index_of_a = Map::getPartitionIndex("a", id.num_partitions);
+  ASSERT_NE(index_of_a, Map::getPartitionIndex("b", id.num_partitions));
+  boost::filesystem::remove(
+      directory / internal::Partition::getNameOfKeysFile(
+                      Map::getPartitionPrefix(index_of_a)));
+  ASSERT_THROW(Map(directory, Map::Options()), std::runtime_error);
+
+  Map::Options options;
+  options.lazy = true;
+  Map map(directory, options);
+  ASSERT_TRUE(map.contains("b"));
+  ASSERT_THROW(map.contains("a"), std::runtime_error);
+  // The broken partition of key "a" is only opened when accessed.
+}
+
+TEST_F(MapTestFixture, NewMapSelectsPartitionsByXxhash) {
+  openOrCreateMap(directory)->put("a", "1");
+  const auto id = Map::Id::readFromDirectory(directory);
+  ASSERT_TRUE(id.xxhash_partitioning);
+  ASSERT_THAT(Map::getPartitionIndex("a", id.num_partitions),
+              Eq(Map::getPartitionIndex(internal::Partition::Key::hash("a"),
+                                        id.num_partitions)));
+}
+
+TEST_F(MapTestFixture, ReplaceManyReplacesValuesOfEachKey) {
+  auto map = openOrCreateMap(directory);
+  std::vector<std::string> keys;
+  for (int i = 0; i != 100; ++i) {
+    keys.push_back("k" + std::to_string(i));
+    for (int j = 0; j <= i % 3; ++j) {
+      map->put(keys.back(), "old");
+    }
+  }
+  std::vector<Bytes> key_bytes(keys.begin(), keys.end());
+  key_bytes.push_back("unknown");
+  const std::vector<Bytes> old_values(key_bytes.size(), "old");
+  const std::vector<Bytes> new_values(key_bytes.size(), "new");
+  const auto results = map->replaceMany(key_bytes, old_values, new_values);
+  ASSERT_THAT(results.size(), Eq(key_bytes.size()));
+  for (int i = 0; i != 100; ++i) {
+    ASSERT_THAT(results[i], Eq(i % 3 + 1));
+    ASSERT_FALSE(map->containsValue(keys[i], "old"));
+    ASSERT_TRUE(map->containsValue(keys[i], "new"));
+  }
+  ASSERT_THAT(results.back(), Eq(0));
+  ASSERT_THROW(map->replaceMany(key_bytes, old_values, {}),
+               std::runtime_error);
+}
+
+TEST_F(MapTestFixture, RemoveAllInChunksRemovesSameKeysAsRemoveAll) {
+  auto map = openOrCreateMap(directory);
+  for (int i = 0; i != 1000; ++i) {
+    map->put(std::to_string(i), "a");
+    map->put(std::to_string(i), "b");
+  }
+  const auto is_odd_or_zero = [](const Bytes& key) {
+    return key == "0" || IS_ODD(key);
+  };
+  auto result = map->removeAllInChunks(IS_ODD, 10);
+  ASSERT_THAT(result.first, Eq(500));
+  ASSERT_THAT(result.second, Eq(1000));
+  result = map->removeAllInChunks(is_odd_or_zero, 3, 0);
+  ASSERT_THAT(result.first, Eq(1));
+  ASSERT_THAT(result.second, Eq(2));
+  for (int i = 0; i != 1000; ++i) {
+    ASSERT_THAT(map->contains(std::to_string(i)), Eq(i != 0 && i % 2 == 0));
+  }
+}
+
+TEST_F(MapTestFixture, ExpiredKeysAreRemovedWithoutScanningOthers) {
+  auto map = openOrCreateMap(directory);
+  for (int i = 0; i != 100; ++i) {
+    map->put(std::to_string(i), "a");
+  }
+  ASSERT_FALSE(map->expire("100", std::chrono::seconds(0)));
+  for (int i = 0; i != 100; i += 2) {
+    ASSERT_TRUE(map->expire(std::to_string(i), std::chrono::seconds(0)));
+  }
+  ASSERT_TRUE(map->expire("1", std::chrono::hours(1)));
+  ASSERT_TRUE(map->expire("3", std::chrono::hours(1)));
+  ASSERT_TRUE(map->persist("3"));
+  for (int i = 0; i != 100; ++i) {
+    ASSERT_THAT(map->contains(std::to_string(i)), Eq(i % 2 != 0));
+  }
+  ASSERT_THAT(map->removeExpired(), Eq(50));
+  ASSERT_THAT(map->removeExpired(), Eq(0));
+  ASSERT_THAT(map->getTotalStats().num_values_valid, Eq(50));
+}
+
+TEST_F(MapTestFixture, GetReverseYieldsNewestValuesFirst) {
+  auto map = openOrCreateMap(directory);
+  ASSERT_FALSE(map->getReverse("k"));
+  for (int i = 0; i != 1000; ++i) {
+    map->put("k", std::to_string(i));
+  }
+  map->removeOne("k", [](const Bytes& value) { return value == "998"; });
+  const auto iter = map->getReverse("k");
+  ASSERT_THAT(iter->available(), Eq(999));
+  ASSERT_THAT(iter->next(), Eq("999"));
+  ASSERT_THAT(iter->next(), Eq("997"));
+  ASSERT_THAT(iter->skip(996), Eq(996));
+  ASSERT_THAT(iter->next(), Eq("0"));
+  ASSERT_FALSE(iter->hasNext());
+}
+
+TEST_F(MapTestFixture, MaxValuesPerKeyKeepsMostRecentValues) {
+  Map::Options options;
+  options.create_if_missing = true;
+  options.max_values_per_key = 100;
+  Map map(directory, options);
+  for (int i = 0; i != 10000; ++i) {
+    map.put(std::to_string(i % 10), std::to_string(i));
+  }
+  for (int k = 0; k != 10; ++k) {
+    const auto iter = map.get(std::to_string(k));
+    ASSERT_THAT(iter->available(), Ge(100));
+    ASSERT_THAT(iter->available(), Lt(500));
+    for (int i = 10000 - 10 * iter->available() + k; i < 10000; i += 10) {
+      ASSERT_THAT(iter->next(), Eq(std::to_string(i)));
+    }
+  }
+  const auto stats = map.getTotalStats();
+  ASSERT_THAT(stats.num_values_total, Eq(10000));
+  ASSERT_THAT(stats.num_values_valid, Lt(5000));
+}
+
+TEST_F(MapTestFixture, ForEachKeyWithPrefixVisitsKeysInOrder) {
+  const auto get_keys = [](const Map& map, const std::string& prefix) {
+    std::vector<std::string> keys;
+    map.forEachKeyWithPrefix(prefix, [&keys](const Bytes& key) {
+      keys.push_back(key.toString());
+    });
+    return keys;
+  };
+  std::vector<std::string> all_keys;
+  for (int i = 0; i != 1000; ++i) {
+    all_keys.push_back("item:" + std::to_string(i));
+    all_keys.push_back("user:" + std::to_string(i));
+  }
+  all_keys.push_back("user");
+  all_keys.push_back("\xFF");
+  all_keys.push_back("\xFF\xFF\x01");
+  std::sort(all_keys.begin(), all_keys.end());
+  const auto filter = [&all_keys](const std::string& prefix) {
+    std::vector<std::string> keys;
+    for (const auto& key : all_keys) {
+      if (key.compare(0, prefix.size(), prefix) == 0) keys.push_back(key);
+    }
+    return keys;
+  };
+  const auto check = [&](const Map& map) {
+    ASSERT_THAT(get_keys(map, ""), ElementsAreArray(all_keys));
+    ASSERT_THAT(get_keys(map, "user:1"), ElementsAreArray(filter("user:1")));
+    ASSERT_THAT(get_keys(map, "\xFF"), ElementsAreArray(filter("\xFF")));
+    ASSERT_THAT(get_keys(map, "\xFF\xFF").size(), Eq(1));
+    ASSERT_TRUE(get_keys(map, "users").empty());
+  };
+  {
+    Map::Options options;
+    options.create_if_missing = true;
+    Map map(directory, options);
+    for (const auto& key : all_keys) {
+      map.put(key, "value");
+    }
+    map.put("removed", "value");
+    map.remove("removed");
+    check(map);
+
+    map.put("user:1x", "value");
+    all_keys.insert(std::upper_bound(all_keys.begin(), all_keys.end(),
+                                     "user:1x"),
+                    "user:1x");
+    check(map);
+
+    std::vector<std::string> keys;
+    map.forEachKeyInRange("item:998", "user:0", [&keys](const Bytes& key) {
+      keys.push_back(key.toString());
+    });
+    ASSERT_THAT(keys, ElementsAreArray({"item:998", "item:999", "user"}));
+  }
+  // Read-only partitions take the keys from their index.
+  Map::Options options;
+  options.readonly = true;
+  check(Map(directory, options));
+}
+
+TEST_F(MapTestFixture, ForEachKeyInRangeVisitsIntegerKeysInOrder) {
+  const auto make_key = [](uint64_t i) {
+    char data[sizeof i];
+    internal::KeyDirectory::writeKey(i, data);
+    return std::string(data, sizeof data);
+  };
+  const auto get_keys = [](const Map& map, uint64_t lower, uint64_t upper) {
+    std::vector<uint64_t> keys;
+    map.forEachKey(lower, upper, [&keys](const Bytes& key) {
+      keys.push_back(internal::KeyDirectory::readKey(key.data()));
+    });
+    return keys;
+  };
+  std::vector<uint64_t> expected;
+  {
+    Map::Options options;
+    options.create_if_missing = true;
+    Map map(directory, options);
+    for (uint64_t i = 0; i != 1000; ++i) {
+      map.put(make_key(i * 3), "value");
+      map.put("not an integer " + std::to_string(i), "value");
+    }
+    map.remove(make_key(300));
+    for (uint64_t i = 34; i != 200; ++i) {
+      if (i != 100) expected.push_back(i * 3);
+    }
+    ASSERT_THAT(get_keys(map, 100, 600), ElementsAreArray(expected));
+
+    // Newly inserted keys and keys that get values again are visited.
+    map.put(make_key(301), "value");
+    map.put(make_key(300), "value");
+    expected.push_back(300);
+    expected.push_back(301);
+    std::sort(expected.begin(), expected.end());
+    ASSERT_THAT(get_keys(map, 100, 600), ElementsAreArray(expected));
+    ASSERT_TRUE(get_keys(map, 3000, -1).empty());
+  }
+  // Read-only partitions take the keys from their index.
+  Map::Options options;
+  options.readonly = true;
+  const Map map(directory, options);
+  ASSERT_THAT(get_keys(map, 100, 600), ElementsAreArray(expected));
+  ASSERT_THAT(get_keys(map, 0, -1).size(), Eq(1001));
+}
+
+TEST_F(MapTestFixture, MapKeepsKeyHashItHasBeenCreatedWith) {
+  const auto make_key = [](int i) {
+    return std::string(40 + i % 7 * 20, 'k') + std::to_string(i);
+  };
+  const auto checkAllKeys = [&](const Map& map) {
+    for (int i = 0; i != 51; ++i) {
+      ASSERT_THAT(map.get(make_key(i))->available(), Eq(i == 50 ? 1 : 4));
+    }
+    ASSERT_FALSE(map.contains(make_key(51)));
+  };
+  Map::Options options;
+  options.create_if_missing = true;
+  options.key_hash = Map::KeyHash::CRC32C;
+  options.bloom_filter_false_positive_rate = 0.01;
+  {
+    Map map(directory, options);
+    for (int i = 0; i != 200; ++i) {
+      map.put(make_key(i % 50), std::to_string(i));
+    }
+    WriteBatch batch;
+    batch.put(make_key(50), "batch");
+    map.write(batch);
+    checkAllKeys(map);
+  }
+  ASSERT_THAT(Map::Id::readFromDirectory(directory).key_hash,
+              Eq(static_cast<uint64_t>(Map::KeyHash::CRC32C)));
+
+  // Keys are looked up in the in-memory index, and in the key index and the
+  // Bloom filter of read-only partitions respectively.
+  checkAllKeys(Map(directory, Map::Options()));
+  options.readonly = true;
+  checkAllKeys(Map(directory, options));
+}
+
+TEST_F(MapTestFixture, MapWithoutXxhashPartitioningKeepsFnv1aPartitions) {
+  const size_t num_partitions = 7;
+  const auto make_key = [](int i) { return "k" + std::to_string(i); };
+  {
+    std::vector<std::unique_ptr<internal::Partition> > partitions;
+    for (size_t i = 0; i != num_partitions; ++i) {
+      partitions.emplace_back(new internal::Partition(
+          directory / Map::getPartitionPrefix(i)));
+    }
+    for (int i = 0; i != 100; ++i) {
+      const auto key = make_key(i);
+      const auto hash = mt::fnv1aHash(key.data(), key.size());
+      partitions[hash % num_partitions]->put(key, std::to_string(i));
+    }
+  }
+  Map::Id id;
+  id.block_size = 512;
+  id.num_partitions = num_partitions;
+  {
+    const auto stream = mt::fopen(directory / Map::getNameOfIdFile(), "w");
+    mt::fwrite(stream.get(), &id, offsetof(Map::Id, xxhash_partitioning));
+    // As written by version 0.5.
+  }
+  for (int round = 0; round != 2; ++round) {
+    auto map = openOrCreateMap(directory);
+    for (int i = 0; i != 100; ++i) {
+      ASSERT_TRUE(map->contains(make_key(i)));
+    }
+    map->put(make_key(100 + round), "new");
+  }
+  ASSERT_FALSE(Map::Id::readFromDirectory(directory).xxhash_partitioning);
+  auto map = openOrCreateMap(directory);
+  ASSERT_TRUE(map->contains(make_key(100)));
+  ASSERT_TRUE(map->contains(make_key(101)));
+}
+
+TEST_F(MapTestFixture, SplitAndMergeKeepAllListsReachable) {
+  const auto make_key = [](int i) { return "k" + std::to_string(i); };
+  const auto expect_all_lists = [&](const Map& map) {
+    size_t num_keys = 0;
+    map.forEachKey([&num_keys](const Bytes&) { ++num_keys; });
+    EXPECT_THAT(num_keys, Eq(1000));
+    for (int i = 0; i != 1000; ++i) {
+      auto iter = map.get(make_key(i));
+      ASSERT_TRUE(iter != nullptr);
+      ASSERT_THAT(iter->available(), Eq(2));
+      ASSERT_THAT(iter->next(), Eq(std::to_string(i)));
+      ASSERT_THAT(iter->next(), Eq(std::to_string(-i)));
+    }
+  };
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_partitions = 3;
+  {
+    Map map(directory, options);
+    for (int i = 0; i != 1000; ++i) {
+      map.put(make_key(i), std::to_string(i));
+    }
+    ASSERT_THAT(map.split(1), Eq(3));
+    for (int i = 0; i != 1000; ++i) {
+      map.put(make_key(i), std::to_string(-i));
+    }
+    expect_all_lists(map);
+    ASSERT_THAT(map.getStats()[3].num_keys_valid, Gt(0));
+    ASSERT_THAT(map.getStats().size(), Eq(4));
+  }
+  {
+    Map map(directory, Map::Options());
+    expect_all_lists(map);
+    map.merge(0);
+    ASSERT_THAT(map.getStats()[1].num_keys_valid, Eq(0));
+    expect_all_lists(map);
+    ASSERT_THAT(map.split(3), Eq(1));
+    // Reuses the partition emptied by merge().
+    expect_all_lists(map);
+  }
+  ASSERT_THAT(Map::Id::readFromDirectory(directory).num_partitions, Eq(4));
+  options.readonly = true;
+  expect_all_lists(Map(directory, options));
+}
+
+TEST_F(MapTestFixture, OnlineSplitDoesNotDisturbConcurrentLookups) {
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_partitions = 1;
+  options.online_repartitioning = true;
+  Map map(directory, options);
+  for (int i = 0; i != 1000; ++i) {
+    map.put(std::to_string(i), std::to_string(i));
+  }
+  std::atomic<bool> stop(false);
+  std::atomic<int> num_misses(0);
+  std::thread reader([&] {
+    while (!stop) {
+      for (int i = 0; i != 1000; ++i) {
+        if (!map.contains(std::to_string(i))) ++num_misses;
+      }
+    }
+  });
+  for (size_t i = 0; i != 7; ++i) {
+    map.split(i);
+  }
+  stop = true;
+  reader.join();
+  ASSERT_THAT(num_misses.load(), Eq(0));
+  ASSERT_THAT(map.getStats().size(), Eq(8));
+  ASSERT_THAT(map.getTotalStats().num_keys_valid, Eq(1000));
+}
+
+TEST_F(MapTestFixture, PartitionsOfMapsCreatedBeforeVersion06CannotBeSplit) {
+  openOrCreateMap(directory);
+  {
+    Map::Id id = Map::Id::readFromDirectory(directory);
+    id.xxhash_partitioning = false;
+    id.writeToFile(directory / Map::getNameOfIdFile());
+  }
+  ASSERT_THROW(openOrCreateMap(directory)->split(0), std::runtime_error);
+}
+
+TEST_F(MapTestFixture, PartitionsAreSpreadAcrossDirectories) {
+  const auto disk1 = directory / "disk1";
+  const auto disk2 = directory / "disk2";
+  const auto disk3 = directory / "disk3";
+  const auto output = directory / "optimized";
+  for (const auto& path : {disk1, disk2, disk3, output}) {
+    boost::filesystem::create_directory(path);
+  }
+  const auto expect_all_keys = [](const Map& map) {
+    for (int i = 0; i != 100; ++i) {
+      ASSERT_TRUE(map.contains(std::to_string(i)));
+    }
+  };
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_partitions = 5;
+  options.directories = {disk1, disk2};
+  {
+    Map map(directory, options);
+    for (int i = 0; i != 100; ++i) {
+      map.put(std::to_string(i), std::to_string(i));
+    }
+    ASSERT_THROW(Map(disk1, options), std::runtime_error);
+    // The directories are locked.
+  }
+  const auto id = Map::Id::readFromDirectory(directory);
+  ASSERT_THAT(id.num_directories, Eq(3));
+  const auto directories = Map::getDirectories(directory, id);
+  ASSERT_THAT(directories.size(), Eq(3));
+  for (size_t i = 0; i != id.num_partitions; ++i) {
+    ASSERT_TRUE(boost::filesystem::is_regular_file(
+        directories[i % 3] / internal::Partition::getNameOfKeysFile(
+                                 Map::getPartitionPrefix(i))));
+  }
+  ASSERT_FALSE(boost::filesystem::exists(
+      directory / internal::Partition::getNameOfKeysFile(
+                      Map::getPartitionPrefix(1))));
+  expect_all_keys(Map(directory, Map::Options()));
+
+  Map::Options optimize_options;
+  optimize_options.directories = {disk3};
+  Map::optimize(directory, output, optimize_options);
+  ASSERT_THAT(Map::Id::readFromDirectory(output).num_directories, Eq(2));
+  expect_all_keys(Map(output, Map::Options()));
+}
+
+TEST_F(MapTestFixture, OptimizeWithTuneAppliesRecommendedOptions) {
+  const auto output = directory / "optimized";
+  boost::filesystem::create_directory(output);
+  Map::Options options;
+  options.create_if_missing = true;
+  {
+    Map map(directory, options);
+    for (int i = 0; i != 1000; ++i) {
+      map.put(std::to_string(i), std::to_string(i));
+    }
+  }
+  options.num_threads = 2;
+  const auto tuning = Map::recommendOptions(directory, options);
+  ASSERT_THAT(tuning.block_size, Eq(256));
+  ASSERT_THAT(tuning.num_partitions, Eq(1));
+  ASSERT_FALSE(tuning.reasons.empty());
+
+  options.keepBlockSize();
+  options.keepNumPartitions();
+  options.tune = true;
+  options.quiet = true;
+  Map::optimize(directory, output, options);
+  const auto id = Map::Id::readFromDirectory(output);
+  ASSERT_THAT(id.block_size, Eq(256));
+  ASSERT_THAT(id.num_partitions, Eq(1));
+  const Map map(output, Map::Options());
+  ASSERT_THAT(map.getTotalStats().num_keys_valid, Eq(1000));
+}
+
+TEST_F(MapTestFixture, NumaAwareMapAssignsPartitionsToNodesRoundRobin) {
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_partitions = 5;
+  {
+    Map map(directory, options);
+    ASSERT_THAT(map.getNumaNode(0), Eq(-1));
+  }
+  options.numa_aware = true;
+  Map map(directory, options);
+  for (int i = 0; i != 100; ++i) {
+    map.put(std::to_string(i), std::to_string(i));
+  }
+  const auto nodes = internal::Numa::getNodes();
+  for (size_t i = 0; i != 5; ++i) {
+    ASSERT_THAT(map.getNumaNode(i), Eq(nodes[i % nodes.size()]));
+  }
+  ASSERT_THROW(map.getNumaNode(5), mt::AssertionError);
+  std::atomic<int> num_keys(0);
+  map.forEachKeyInParallel([&num_keys](const Bytes&) { ++num_keys; });
+  ASSERT_THAT(num_keys.load(), Eq(100));
+}
+
+TEST_F(MapTestFixture, ReadOnlyMapCanBeOpenedManyTimesButNotWhileWritable) {
+  Map::Options options;
+  options.create_if_missing = true;
+  {
+    Map map(directory, options);
+    map.put("k", "v");
+    Map::Options readonly_options;
+    readonly_options.readonly = true;
+    ASSERT_THROW(Map(directory, readonly_options), std::runtime_error);
+  }
+  options.readonly = true;
+  std::unique_ptr<Map> map1(new Map(directory, options));
+  std::unique_ptr<Map> map2(new Map(directory, options));
+  ASSERT_TRUE(map1->contains("k"));
+  ASSERT_TRUE(map2->contains("k"));
+  ASSERT_NO_THROW(Map::stats(directory));
+  ASSERT_THROW(Map(directory, Map::Options()), std::runtime_error);
+  map1.reset();
+  ASSERT_THROW(Map(directory, Map::Options()), std::runtime_error);
+  map2.reset();
+  ASSERT_FALSE(
+      boost::filesystem::exists(directory / Map::getNameOfLockFile()));
+  ASSERT_NO_THROW(Map(directory, Map::Options()));
+}
+
+TEST_F(MapTestFixture, FrontCodingIsKeptWhenReopened) {
+  const auto make_value = [](int i) {
+    return "http://multimap.io/values/" + std::to_string(i);
+  };
+  {
+    Map::Options options;
+    options.create_if_missing = true;
+    options.front_coding = true;
+    Map map(directory, options);
+    for (int i = 0; i != 500; ++i) {
+      map.put("key", make_value(i));
+    }
+  }
+  ASSERT_TRUE(Map::Id::readFromDirectory(directory).front_coded);
+  openOrCreateMap(directory)->put("key", make_value(500));
+
+  Map map(directory, Map::Options());
+  auto iter = map.get("key");
+  ASSERT_THAT(iter->available(), Eq(501));
+  for (int i = 0; iter->hasNext(); ++i) {
+    ASSERT_THAT(iter->next(), Eq(make_value(i)));
+  }
+}
+
+TEST_F(MapTestFixture, OptimizedMapFindsValuesAndRangesInSortedLists) {
+  const auto output = directory / "optimized";
+  boost::filesystem::create_directory(output);
+  Map::Options options;
+  options.keepBlockSize();
+  options.keepNumPartitions();
+  options.quiet = true;
+  options.compare = [](const Bytes& a, const Bytes& b) {
+    return std::stoi(a.toString()) < std::stoi(b.toString());
+  };
+  {
+    auto map = openOrCreateMap(directory);
+    for (int i = 5000; i != 0; --i) {
+      map->put("key", std::to_string(i * 2));
+    }
+  }
+  Map::optimize(directory, output, options);
+  ASSERT_TRUE(Map::Id::readFromDirectory(output).sorted);
+
+  const auto assert_lookups = [](const Map& map, std::vector<int> extra) {
+    for (int i = 0; i < 10010; i += 7) {
+      const auto found =
+          (i % 2 == 0 && i != 0 && i <= 10000) ||
+          std::find(extra.begin(), extra.end(), i) != extra.end();
+      ASSERT_EQ(map.containsValue("key", std::to_string(i)), found);
+    }
+    std::vector<int> range;
+    map.getRange("key", "1000", "1100", [&range](const Bytes& value) {
+      range.push_back(std::stoi(value.toString()));
+    });
+    std::vector<int> expected;
+    for (int i = 1000; i != 1100; i += 2) {
+      expected.push_back(i);
+    }
+    for (const auto i : extra) {
+      if (i >= 1000 && i < 1100) expected.push_back(i);
+    }
+    ASSERT_THAT(range, Eq(expected));
+    ASSERT_FALSE(map.containsValue("other", "2"));
+  };
+  {
+    Map::Options open_options;
+    open_options.readonly = true;
+    open_options.compare = options.compare;
+    Map map(output, open_options);
+    assert_lookups(map, {});
+  }
+  {
+    Map::Options open_options;
+    open_options.readonly = true;
+    Map map(output, open_options);
+    ASSERT_TRUE(map.containsValue("key", "1000"));
+    ASSERT_THROW(map.getRange("key", "1", "2", NULL_PROCEDURE),
+                 std::runtime_error);
+  }
+  ASSERT_TRUE(Map::Id::readFromDirectory(output).sorted);
+
+  {
+    Map::Options open_options;
+    open_options.compare = options.compare;
+    Map map(output, open_options);
+    ASSERT_FALSE(Map::Id::readFromDirectory(output).sorted);
+    // Not sorted until closed, in case the process crashes.
+    map.put("key", "1001");
+    assert_lookups(map, {1001});
+  }
+  ASSERT_FALSE(Map::Id::readFromDirectory(output).sorted);
+  Map::Options open_options;
+  open_options.compare = options.compare;
+  assert_lookups(Map(output, open_options), {1001});
+}
+
+TEST_F(MapTestFixture, ValueFilterRulesOutAbsentValuesOfListsNotAppendedTo) {
+  {
+    auto map = openOrCreateMap(directory);
+    for (int k = 0; k != 10; ++k) {
+      for (int v = 0; v != 1000; ++v) {
+        map->put(std::to_string(k), std::to_string(v * 2));
+      }
+    }
+  }
+  const auto output = directory / "optimized";
+  boost::filesystem::create_directory(output);
+  Map::Options options;
+  options.keepBlockSize();
+  options.keepNumPartitions();
+  options.quiet = true;
+  options.value_filter_false_positive_rate = 0.01;
+  Map::optimize(directory, output, options);
+
+  const auto count_absent = [](const Map& map, const std::string& key) {
+    int num_ruled_out = 0;
+    for (int v = 0; v != 1000; ++v) {
+      const auto value = std::to_string(v * 2 + 1);
+      num_ruled_out += !map.mayContainValue(key, value);
+      EXPECT_FALSE(map.containsValue(key, value));
+      EXPECT_TRUE(map.mayContainValue(key, std::to_string(v * 2)));
+      EXPECT_TRUE(map.containsValue(key, std::to_string(v * 2)));
+    }
+    return num_ruled_out;
+  };
+  {
+    Map::Options open_options;
+    open_options.readonly = true;
+    Map map(output, open_options);
+    ASSERT_FALSE(map.mayContainValue("missing", "0"));
+    for (int k = 0; k != 10; ++k) {
+      ASSERT_GT(count_absent(map, std::to_string(k)), 950);
+    }
+  }
+  Map map(output, Map::Options());
+  map.put("0", "2001");
+  ASSERT_TRUE(map.mayContainValue("0", "2001"));
+  ASSERT_TRUE(map.containsValue("0", "2001"));
+  ASSERT_EQ(count_absent(map, "0"), 0);
+  ASSERT_GT(count_absent(map, "1"), 950);
+}
+
+TEST_F(MapTestFixture, TailMemoryBudgetDoesNotLoseValues) {
+  Map::Options options;
+  options.create_if_missing = true;
+  options.tail_memory_budget = 1;
+  // Allows no tail blocks at all, so that the flusher is always busy.
+  const int num_keys = 1000;
+  const int num_rounds = 3;
+  {
+    Map map(directory, options);
+    for (int r = 0; r != num_rounds; ++r) {
+      for (int k = 0; k != num_keys; ++k) {
+        map.put(std::to_string(k), std::to_string(r));
+      }
+      std::this_thread::sleep_for(internal::Flusher::DEFAULT_INTERVAL * 3);
+    }
+    for (int k = 0; k != num_keys; ++k) {
+      auto iter = map.get(std::to_string(k));
+      ASSERT_THAT(iter->available(), Eq(num_rounds));
+      for (int r = 0; iter->hasNext(); ++r) {
+        ASSERT_THAT(iter->next(), Eq(std::to_string(r)));
+      }
+    }
+  }
+  Map map(directory, Map::Options());
+  ASSERT_THAT(map.getTotalStats().num_values_valid, Eq(num_keys * num_rounds));
+}
+
+TEST_F(MapTestFixture, GetTotalMemoryUsageSumsPartitions) {
+  Map::Options options;
+  options.create_if_missing = true;
+  Map map(directory, options);
+  for (int k = 0; k != 1000; ++k) {
+    map.put(std::to_string(k), std::to_string(k));
+  }
+  const auto usages = map.getMemoryUsage();
+  ASSERT_THAT(usages.size(), Eq(map.getStats().size()));
+  uint64_t arena_allocated = 0;
+  for (const auto& usage : usages) {
+    arena_allocated += usage.arena_allocated;
+    ASSERT_THAT(usage.mutex_pool, Eq(0));
+  }
+  const auto total = map.getTotalMemoryUsage();
+  ASSERT_THAT(total.arena_allocated, Eq(arena_allocated));
+  ASSERT_THAT(total.tail_blocks, Gt(0));
+  ASSERT_THAT(total.heap(), Gt(total.arena_allocated));
+  ASSERT_THAT(total.toVector().size(), Eq(Map::MemoryUsage::names().size()));
+}
+
+TEST_F(MapTestFixture, MemoryLimitDoesNotLoseValues) {
+  Map::Options options;
+  options.create_if_missing = true;
+  options.memory_limit = 1;
+  // Evicts all lists that are not being updated.
+  const int num_keys = 1000;
+  const int num_rounds = 3;
+  {
+    Map map(directory, options);
+    for (int r = 0; r != num_rounds; ++r) {
+      for (int k = 0; k != num_keys; ++k) {
+        map.put(std::to_string(k), std::to_string(r));
+      }
+      std::this_thread::sleep_for(internal::Spiller::DEFAULT_INTERVAL * 3);
+    }
+    ASSERT_THAT(map.getTotalStats().num_keys_valid, Eq(num_keys));
+    for (int k = 0; k != num_keys; ++k) {
+      auto iter = map.get(std::to_string(k));
+      ASSERT_THAT(iter->available(), Eq(num_rounds));
+      for (int r = 0; iter->hasNext(); ++r) {
+        ASSERT_THAT(iter->next(), Eq(std::to_string(r)));
+      }
+    }
+  }
+  Map map(directory, Map::Options());
+  ASSERT_THAT(map.getTotalStats().num_values_valid, Eq(num_keys * num_rounds));
+}
+
+TEST_F(MapTestFixture, AllDurabilityPoliciesPreserveValues) {
+  const Map::Durability policies[] = {
+      Map::Durability::NONE, Map::Durability::ON_CLOSE,
+      Map::Durability::PERIODIC, Map::Durability::PER_BATCH};
+  for (const auto policy : policies) {
+    boost::filesystem::remove_all(directory);
+    boost::filesystem::create_directory(directory);
+    Map::Options options;
+    options.create_if_missing = true;
+    options.num_partitions = 2;
+    options.buffer_size = options.block_size * 2;
+    options.durability = policy;
+    const int num_keys = 100;
+    {
+      Map map(directory, options);
+      for (int k = 0; k != num_keys; ++k) {
+        map.put(std::to_string(k), std::string(100, 'a' + k % 26));
+      }
+      map.checkpoint();
+      for (int k = 0; k != num_keys; ++k) {
+        map.put(std::to_string(k), std::string(100, 'b'));
+      }
+    }
+    Map map(directory, Map::Options());
+    ASSERT_THAT(map.getTotalStats().num_values_valid, Eq(num_keys * 2));
+    for (int k = 0; k != num_keys; ++k) {
+      auto iter = map.get(std::to_string(k));
+      ASSERT_THAT(iter->next(), Eq(std::string(100, 'a' + k % 26)));
+      ASSERT_THAT(iter->next(), Eq(std::string(100, 'b')));
+    }
+  }
+}
+
+TEST_F(MapTestFixture, SnapshotIsConsistentWhileUpdatesContinue) {
+  const auto snapshot_directory = directory.string() + ".snapshot";
+  boost::filesystem::remove_all(snapshot_directory);
+  boost::filesystem::create_directory(snapshot_directory);
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_partitions = 4;
+  const int num_keys = 100;
+  {
+    Map map(directory, options);
+    for (int k = 0; k != num_keys; ++k) {
+      map.put(std::to_string(k), "0");
+    }
+    std::atomic<bool> stop(false);
+    std::thread writer([&] {
+      for (int i = 1; !stop; ++i) {
+        map.put(std::to_string(i % num_keys), std::to_string(i));
+      }
+    });
+    map.snapshot(snapshot_directory);
+    stop = true;
+    writer.join();
+    ASSERT_THROW(map.snapshot(snapshot_directory), std::runtime_error);
+  }
+  {
+    Map snapshot(snapshot_directory, Map::Options());
+    const auto stats = snapshot.getTotalStats();
+    ASSERT_THAT(stats.num_keys_valid, Eq(num_keys));
+    uint64_t num_values = 0;
+    for (int k = 0; k != num_keys; ++k) {
+      auto iter = snapshot.get(std::to_string(k));
+      ASSERT_THAT(iter->next(), Eq("0"));
+      ++num_values;
+      // Each list holds a prefix of the values that were put into it.
+      for (int i = k == 0 ? num_keys : k; iter->hasNext(); i += num_keys) {
+        ASSERT_THAT(iter->next(), Eq(std::to_string(i)));
+        ++num_values;
+      }
+    }
+    ASSERT_THAT(stats.num_values_valid, Eq(num_values));
+  }
+  boost::filesystem::remove_all(snapshot_directory);
+}
+
+TEST_F(MapTestFixture, ReplicaFollowsChangeFeedOfPrimary) {
+  const auto replica_directory = directory.string() + ".replica";
+  boost::filesystem::remove_all(replica_directory);
+  boost::filesystem::create_directory(replica_directory);
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_partitions = 3;
+  options.block_size = 64;
+  options.change_feed = true;
+  const auto get_entries = [](const Map& map) {
+    std::map<std::string, std::vector<std::string> > entries;
+    map.forEachEntry([&entries](const Bytes& key, Iterator* iter) {
+      auto& values = entries[key.toString()];
+      while (iter->hasNext()) {
+        values.push_back(iter->next().toString());
+      }
+    });
+    return entries;
+  };
+  const auto update = [](Map* map, int round) {
+    for (int i = 0; i != 500; ++i) {
+      map->put(std::to_string(i % 20), std::to_string(round * 1000 + i));
+    }
+    map->remove(std::to_string(round));
+    map->removeAll(std::to_string(round + 1), [](const Bytes& value) {
+      return value.toString().back() == '3';
+    });
+    map->replaceAll(std::to_string(round + 2), std::to_string(round * 1000 + 2),
+                    "same");
+    map->replaceAll(std::to_string(round + 3), std::to_string(round * 1000 + 3),
+                    "other size");
+  };
+  {
+    Map primary(directory, options);
+    update(&primary, 0);
+    primary.snapshot(replica_directory);
+    update(&primary, 1);
+    {
+      Map replica(replica_directory, Map::Options());
+      ASSERT_THAT(replica.followChangeFeed(directory), testing::Gt(0));
+      ASSERT_THAT(get_entries(replica), Eq(get_entries(primary)));
+      ASSERT_THAT(replica.followChangeFeed(directory), Eq(0));
+    }
+    update(&primary, 2);
+    primary.checkpoint();
+    update(&primary, 3);
+  }
+  {
+    options.create_if_missing = false;
+    Map primary(directory, options);
+    update(&primary, 4);
+    Map replica(replica_directory, Map::Options());
+    ASSERT_THAT(replica.followChangeFeed(directory), testing::Gt(0));
+    ASSERT_THAT(get_entries(replica), Eq(get_entries(primary)));
+    ASSERT_THROW(primary.followChangeFeed(replica_directory),
+                 std::runtime_error);
+  }
+  boost::filesystem::remove_all(replica_directory);
+}
+
+TEST_F(MapTestFixture, LiveStatsArePublishedWhileMapIsOpen) {
+  ASSERT_ANY_THROW(Map::liveStats(directory));
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_partitions = 3;
+  options.live_stats_interval = 10;
+  {
+    Map map(directory, options);
+    for (int i = 0; i != 1000; ++i) {
+      map.put(std::to_string(i % 100), std::to_string(i));
+    }
+    Map::Stats total;
+    for (int i = 0; i != 1000 && total.num_values_total != 1000; ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      total = Map::Stats::total(Map::liveStats(directory));
+    }
+    ASSERT_THAT(total.num_partitions, Eq(3));
+    ASSERT_THAT(total.num_keys_valid, Eq(100));
+    ASSERT_THAT(total.num_values_total, Eq(1000));
+  }
+  ASSERT_ANY_THROW(Map::liveStats(directory));
+}
+
+TEST_F(MapTestFixture, GetHotKeysReturnsMostFrequentlyAccessedKeys) {
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_partitions = 3;
+  options.hot_keys = 4;
+  options.hot_keys_sample_rate = 1;
+  Map map(directory, options);
+  for (int i = 0; i != 100; ++i) {
+    map.put(std::to_string(i), "value");
+    map.put("hot", "value");
+    if (i % 2 == 0) {
+      ASSERT_FALSE(map.contains("warm"));
+    }
+  }
+  const auto hot_keys = map.getHotKeys(2);
+  ASSERT_THAT(hot_keys.size(), Eq(2));
+  ASSERT_THAT(hot_keys[0].first, Eq("hot"));
+  ASSERT_THAT(hot_keys[0].second, Eq(100));
+  ASSERT_THAT(hot_keys[1].first, Eq("warm"));
+  ASSERT_THAT(hot_keys[1].second, Eq(50));
+}
+
+TEST_F(MapTestFixture, WriteAheadLogIsKeptUntilMapIsClosed) {
+  Map::Options options;
+  options.create_if_missing = true;
+  options.write_ahead_log = true;
+  const auto wal_file = internal::Partition::getNameOfWalFile(
+      (directory / Map::getPartitionPrefix(0)).string());
+  {
+    Map map(directory, options);
+    map.put("key", "value");
+    ASSERT_TRUE(boost::filesystem::is_regular_file(wal_file));
+    ASSERT_TRUE(
+        boost::filesystem::is_regular_file(directory / Map::getNameOfIdFile()));
+    // A new map can be recovered even if it is never closed.
+  }
+  ASSERT_FALSE(boost::filesystem::exists(wal_file));
+  Map map(directory, Map::Options());
+  ASSERT_THAT(map.get("key")->next(), Eq("value"));
+}
+
+TEST_F(MapTestFixture, GetMetricsCountsOperationsIfEnabled) {
+  typedef internal::Metrics::Operation Operation;
+  Map::Options options;
+  options.create_if_missing = true;
+  options.metrics = true;
+  {
+    Map map(directory, options);
+    map.put("key", "value");
+    map.put("key", "value");
+    map.get("key");
+    map.contains("key");
+    const auto metrics = map.getMetrics();
+    ASSERT_THAT(metrics.get(Operation::PUT).count, Eq(2));
+    ASSERT_THAT(metrics.get(Operation::GET).count, Eq(1));
+    ASSERT_THAT(metrics.get(Operation::CONTAINS).count, Eq(1));
+    ASSERT_THAT(metrics.get(Operation::REMOVE).count, Eq(0));
+  }
+  const auto metrics = Map::metrics(directory);
+  ASSERT_THAT(metrics.get(Operation::PUT).count, Eq(2));
+  ASSERT_THAT(metrics.bytes_written, Gt(0));
+
+  Map map(directory, Map::Options());
+  map.put("key", "value");
+  ASSERT_THAT(map.getMetrics().get(Operation::PUT).count, Eq(0));
+}
+
+TEST_F(MapTestFixture, GetLockProfileCountsLocksOnlyIfProfilingIsEnabled) {
+  typedef internal::LockProfiler::LockClass LockClass;
+  internal::LockProfiler::reset();
+  {
+    auto map = openOrCreateMap(directory);
+    map->put("key", "value");
+    map->get("key");
+  }
+  const auto profile = Map::getLockProfile();
+  if (internal::LockProfiler::isEnabled()) {
+    ASSERT_THAT(profile.get(LockClass::PARTITION).acquisitions, Gt(0));
+    ASSERT_THAT(profile.get(LockClass::LIST).acquisitions, Gt(0));
+  } else {
+    for (const auto value : profile.toVector()) {
+      ASSERT_THAT(value, Eq(0));
+    }
+    ASSERT_TRUE(profile.contended_keys.empty());
+  }
+}
+
+TEST_F(MapTestFixture, WriteBatchToReadOnlyMapThrows) {
+  openOrCreateMap(directory);
+  Map::Options options;
+  options.readonly = true;
+  Map map(directory, options);
+  WriteBatch batch;
+  batch.put("key", "value");
+  ASSERT_THROW(map.write(batch), std::runtime_error);
+  batch.clear();
+  ASSERT_TRUE(batch.empty());
+  map.write(batch);
+}
+
+TEST_F(MapTestFixture, ImportFromBase64KeepsOrderOfValuesAcrossChunks) {
+  const auto input = directory / "input.txt";
+  const auto num_keys = 100;
+  const auto num_lines = 200000;
+  // More than 5 MiB, which is more than one chunk.
+  {
+    const auto stream = mt::fopen(input, "w");
+    for (auto i = 0; i != num_lines; ++i) {
+      const auto key =
+          internal::Base64::encode("key" + std::to_string(i % num_keys));
+      const auto value = internal::Base64::encode(std::to_string(i));
+      auto line = key + " " + value + "\t" + value;
+      line += (i % 3 == 0) ? "\r\n" : "\n";
+      if (i % 7 == 0) line += "\n";
+      mt::fwrite(stream.get(), line.data(), line.size());
+    }
+  }
+  const auto map_directory = directory / "map";
+  boost::filesystem::create_directory(map_directory);
+  Map::Options options;
+  options.create_if_missing = true;
+  options.quiet = true;
+  options.num_threads = 4;
+  Map::importFromBase64(map_directory, input, options);
+
+  Map map(map_directory, Map::Options());
+  for (auto k = 0; k != num_keys; ++k) {
+    auto iter = map.get("key" + std::to_string(k));
+    ASSERT_THAT(iter->available(), Eq(2 * num_lines / num_keys));
+    for (auto i = k; iter->hasNext(); i += num_keys) {
+      ASSERT_THAT(iter->next(), Eq(std::to_string(i)));
+      ASSERT_THAT(iter->next(), Eq(std::to_string(i)));
+    }
+  }
+}
+
+TEST_F(MapTestFixture, ExportToBinaryThenImportKeepsAllValues) {
+  const auto num_keys = 1000;
+  const auto num_values = 1000;
+  {
+    auto map = openOrCreateMap(directory);
+    for (auto k = 0; k != num_keys; ++k) {
+      for (auto v = 0; v != num_values; ++v) {
+        map->put(std::to_string(k), std::to_string(v));
+      }
+    }
+  }
+  for (const auto compress : {false, true}) {
+    const auto output = directory / "dump";
+    Map::Options options;
+    options.quiet = true;
+    options.compress = compress;
+    Map::exportToBinary(directory, output, options);
+
+    const auto map_directory = directory / "map";
+    boost::filesystem::remove_all(map_directory);
+    boost::filesystem::create_directory(map_directory);
+    options = Map::Options();
+    options.create_if_missing = true;
+    options.quiet = true;
+    options.num_threads = 4;
+    Map::importFromBinary(map_directory, output, options);
+
+    Map map(map_directory, Map::Options());
+    ASSERT_THAT(map.getTotalStats().num_keys_valid, Eq(num_keys));
+    for (auto k = 0; k != num_keys; ++k) {
+      auto iter = map.get(std::to_string(k));
+      ASSERT_THAT(iter->available(), Eq(num_values));
+      for (auto v = 0; iter->hasNext(); ++v) {
+        ASSERT_THAT(iter->next(), Eq(std::to_string(v)));
+      }
+    }
+  }
+}
+
+TEST_F(MapTestFixture, ExportWithCompareSortsValues) {
+  {
+    auto map = openOrCreateMap(directory);
+    for (auto v = 100; v != 0; --v) {
+      map->put("key", std::to_string(v));
+    }
+  }
+  const auto output = directory / "dump";
+  Map::Options options;
+  options.quiet = true;
+  options.compare = [](const Bytes& a, const Bytes& b) {
+    return std::stoi(a.toString()) < std::stoi(b.toString());
+  };
+  Map::exportToBinary(directory, output, options);
+
+  const auto map_directory = directory / "map";
+  boost::filesystem::create_directory(map_directory);
+  options = Map::Options();
+  options.create_if_missing = true;
+  options.quiet = true;
+  Map::importFromBinary(map_directory, output, options);
+  Map map(map_directory, Map::Options());
+  auto iter = map.get("key");
+  ASSERT_THAT(iter->available(), Eq(100));
+  for (auto v = 1; iter->hasNext(); ++v) {
+    ASSERT_THAT(iter->next(), Eq(std::to_string(v)));
+  }
+}
+
+TEST_F(MapTestFixture, ExportIntoDirectoryWritesOneFilePerPartition) {
+  const auto num_keys = 1000;
+  const auto num_values = 10;
+  size_t num_partitions = 0;
+  {
+    auto map = openOrCreateMap(directory);
+    for (auto k = 0; k != num_keys; ++k) {
+      for (auto v = 0; v != num_values; ++v) {
+        map->put(std::to_string(k), std::to_string(v));
+      }
+    }
+    num_partitions = map->getStats().size();
+  }
+  for (const auto binary : {false, true}) {
+    const auto output = directory / "export";
+    boost::filesystem::remove_all(output);
+    boost::filesystem::create_directory(output);
+    Map::Options options;
+    options.quiet = true;
+    options.num_threads = 4;
+    if (binary) {
+      Map::exportToBinary(directory, output, options);
+    } else {
+      Map::exportToBase64(directory, output, options);
+    }
+    ASSERT_THAT(std::distance(boost::filesystem::directory_iterator(output),
+                              boost::filesystem::directory_iterator()),
+                Eq(num_partitions));
+
+    const auto map_directory = directory / "map";
+    boost::filesystem::remove_all(map_directory);
+    boost::filesystem::create_directory(map_directory);
+    options.create_if_missing = true;
+    if (binary) {
+      Map::importFromBinary(map_directory, output, options);
+    } else {
+      Map::importFromBase64(map_directory, output, options);
+    }
+
+    Map map(map_directory, Map::Options());
+    ASSERT_THAT(map.getTotalStats().num_keys_valid, Eq(num_keys));
+    for (auto k = 0; k != num_keys; ++k) {
+      auto iter = map.get(std::to_string(k));
+      ASSERT_THAT(iter->available(), Eq(num_values));
+      for (auto v = 0; iter->hasNext(); ++v) {
+        ASSERT_THAT(iter->next(), Eq(std::to_string(v)));
+      }
+    }
+  }
+}
+
+TEST_F(MapTestFixture, DISABLED_BenchmarkExportAndImportBinaryVersusBase64) {
+  const auto num_keys = 10000;
+  const auto num_values = 1000;
+  {
+    auto map = openOrCreateMap(directory);
+    for (auto k = 0; k != num_keys; ++k) {
+      for (auto v = 0; v != num_values; ++v) {
+        map->put(std::to_string(k), std::to_string(k * num_values + v));
+      }
+    }
+  }
+  const auto elapsed_ms = [](std::chrono::steady_clock::time_point start) {
+    return static_cast<long>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count());
+  };
+  for (const auto format : {"base64", "binary", "binary+zlib"}) {
+    const auto output = directory / "dump";
+    const auto map_directory = directory / "map";
+    boost::filesystem::remove_all(map_directory);
+    boost::filesystem::create_directory(map_directory);
+    Map::Options options;
+    options.quiet = true;
+    options.compress = std::strcmp(format, "binary+zlib") == 0;
+    const auto base64 = std::strcmp(format, "base64") == 0;
+
+    auto start = std::chrono::steady_clock::now();
+    if (base64) {
+      Map::exportToBase64(directory, output, options);
+    } else {
+      Map::exportToBinary(directory, output, options);
+    }
+    const auto export_ms = elapsed_ms(start);
+
+    options = Map::Options();
+    options.create_if_missing = true;
+    options.quiet = true;
+    start = std::chrono::steady_clock::now();
+    if (base64) {
+      Map::importFromBase64(map_directory, output, options);
+    } else {
+      Map::importFromBinary(map_directory, output, options);
+    }
+    const auto import_ms = elapsed_ms(start);
+    const auto size = boost::filesystem::file_size(output);
+    std::printf("%s: export %ld ms, import %ld ms, %lu bytes\n", format,
+                export_ms, import_ms, static_cast<unsigned long>(size));
+  }
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
+TEST_F(MapTestFixture, DISABLED_BenchmarkOptimizeCopyingBlocks) {
+  const auto num_keys = 10000;
+  const auto num_values = 1000;
+  {
+    auto map = openOrCreateMap(directory);
+    for (auto k = 0; k != num_keys; ++k) {
+      for (auto v = 0; v != num_values; ++v) {
+        map->put(std::to_string(k), std::to_string(v));
+      }
+    }
+  }
+  for (const auto copy_blocks : {false, true}) {
+    const auto output = directory / "optimized";
+    boost::filesystem::remove_all(output);
+    boost::filesystem::create_directory(output);
+    Map::Options options;
+    options.keepBlockSize();
+    options.keepNumPartitions();
+    options.quiet = true;
+    if (!copy_blocks) {
+      options.num_partitions = 2;
+      // Values are rewritten if the number of partitions changes.
+    }
+    const auto start = std::chrono::steady_clock::now();
+    Map::optimize(directory, output, options);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    std::printf(
+        "%s: %ld ms\n", copy_blocks ? "copy blocks" : "rewrite values",
+        static_cast<long>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(elapsed)
+                .count()));
+  }
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
+TEST_F(MapTestFixture, DISABLED_BenchmarkWriteBatchVersusPut) {
+  const auto num_keys = 10000;
+  const auto num_values = 100;
+  std::vector<std::pair<std::string, std::string> > records;
+  for (auto v = 0; v != num_values; ++v) {
+    for (auto k = 0; k != num_keys; ++k) {
+      records.emplace_back(std::to_string(k), std::to_string(v));
+    }
+  }
+  for (const auto use_batch : {false, true}) {
+    SetUp();
+    auto map = openOrCreateMap(directory);
+    const auto start = std::chrono::steady_clock::now();
+    if (use_batch) {
+      WriteBatch batch;
+      for (const auto& record : records) {
+        batch.put(record.first, record.second);
+      }
+      map->write(batch);
+    } else {
+      for (const auto& record : records) {
+        map->put(record.first, record.second);
+      }
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    std::printf(
+        "%s: %ld ms\n", use_batch ? "write(batch)" : "put()",
+        static_cast<long>(
+            std::chrono::duration_cast<std::chrono::milliseconds>(elapsed)
+                .count()));
+  }
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
+TEST_F(MapTestFixture, GetWithProcedurePassesIteratorOnlyIfKeyExists) {
+  auto map = openOrCreateMap(directory);
+  for (auto v = 0; v != 1000; ++v) {
+    map->put("key", std::to_string(v));
+  }
+  std::vector<std::string> values;
+  ASSERT_TRUE(map->get("key", [&values](Iterator* iter) {
+    ASSERT_THAT(iter->available(), Eq(1000));
+    while (iter->hasNext()) {
+      values.push_back(iter->next().toString());
+    }
+  }));
+  ASSERT_THAT(values.size(), Eq(1000));
+  for (size_t v = 0; v != values.size(); ++v) {
+    ASSERT_THAT(values[v], Eq(std::to_string(v)));
+  }
+  ASSERT_FALSE(map->get("missing", [](Iterator*) { FAIL(); }));
+  map->put("key", "value");  // The iterator has released its lock.
+}
+
+TEST_F(MapTestFixture, GetAsyncReturnsSameValuesAsGet) {
+  auto map = openOrCreateMap(directory);
+  for (auto k = 0; k != 100; ++k) {
+    for (auto v = 0; v <= k; ++v) {
+      map->put(std::to_string(k), std::to_string(v));
+    }
+  }
+  std::vector<std::future<std::vector<std::string> > > futures;
+  for (auto k = 0; k != 101; ++k) {
+    futures.push_back(map->getAsync(std::to_string(k)));
+  }
+  for (auto k = 0; k != 101; ++k) {
+    const auto values = futures[k].get();
+    ASSERT_THAT(values.size(), Eq(k == 100 ? 0 : k + 1));
+    for (size_t v = 0; v != values.size(); ++v) {
+      ASSERT_THAT(values[v], Eq(std::to_string(v)));
+    }
+  }
+}
+
+TEST_F(MapTestFixture, GetAsyncWithCallbackPassesIteratorAndPropagatesErrors) {
+  auto map = openOrCreateMap(directory);
+  for (auto v = 0; v != 1000; ++v) {
+    map->put("key", std::to_string(v));
+  }
+  std::atomic<uint64_t> num_values(0);
+  std::vector<std::future<void> > futures;
+  for (auto i = 0; i != 10; ++i) {
+    futures.push_back(map->getAsync("key", [&num_values](Iterator* iter) {
+      while (iter->hasNext()) {
+        iter->next();
+        ++num_values;
+      }
+    }));
+  }
+  for (auto& future : futures) {
+    future.get();
+  }
+  ASSERT_THAT(num_values.load(), Eq(10000));
+  auto future = map->getAsync("key", [](Iterator*) {
+    throw std::runtime_error("Error in callback");
+  });
+  ASSERT_THROW(future.get(), std::runtime_error);
+}
+
+TEST_F(MapTestFixture, BlockCacheIsSharedByPartitionsOfReadOnlyMap) {
+  const auto num_values = 1000;
+  {
+    auto map = openOrCreateMap(directory);
+    for (auto k = 0; k != 10; ++k) {
+      for (auto v = 0; v != num_values; ++v) {
+        map->put(std::to_string(k), std::to_string(v));
+      }
+    }
+  }
+  Map::Options options;
+  options.readonly = true;
+  options.direct_io = true;
+  options.block_cache_size = mt::MiB(1);
+  Map map(directory, options);
+  for (auto round = 0; round != 2; ++round) {
+    for (auto k = 0; k != 10; ++k) {
+      auto iter = map.get(std::to_string(k));
+      for (auto v = 0; v != num_values; ++v) {
+        ASSERT_TRUE(iter->hasNext());
+        ASSERT_THAT(iter->next(), Eq(std::to_string(v)));
+      }
+    }
+    const auto stats = map.getTotalStats();
+    ASSERT_THAT(stats.block_cache_misses, testing::Gt(0));
+    // Each block is read from disk once and served from the cache then.
+    ASSERT_THAT(stats.block_cache_hits,
+                Eq(round == 0 ? 0 : stats.block_cache_misses));
+  }
+}
+
+TEST_F(MapTestFixture, HotBlocksAreSavedOnCloseAndWarmedUpOnOpen) {
+  const auto num_values = 1000;
+  {
+    auto map = openOrCreateMap(directory);
+    for (auto k = 0; k != 10; ++k) {
+      for (auto v = 0; v != num_values; ++v) {
+        map->put(std::to_string(k), std::to_string(v));
+      }
+    }
+  }
+  Map::Options options;
+  options.readonly = true;
+  options.direct_io = true;
+  options.block_cache_size = mt::MiB(1);
+  options.hot_keys = 4;
+  options.hot_keys_sample_rate = 1;
+  options.warm_up_size = mt::MiB(16);
+  const auto read_hot_key = [num_values](const Map& map) {
+    auto iter = map.get("3");
+    for (auto v = 0; v != num_values; ++v) {
+      ASSERT_TRUE(iter->hasNext());
+      ASSERT_THAT(iter->next(), Eq(std::to_string(v)));
+    }
+  };
+  {
+    Map map(directory, options);
+    read_hot_key(map);
+  }
+  Map map(directory, options);
+  uint64_t num_misses = 0;
+  for (auto i = 0; i != 100; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    const auto misses = map.getCurrentTotalStats().block_cache_misses;
+    if (misses != 0 && misses == num_misses) break;
+    num_misses = misses;
+  }
+  // The blocks of the hot key have been read ahead into the cache.
+  ASSERT_THAT(num_misses, testing::Gt(0));
+  read_hot_key(map);
+  const auto stats = map.getCurrentTotalStats();
+  ASSERT_THAT(stats.block_cache_misses, Eq(num_misses));
+  ASSERT_THAT(stats.block_cache_hits, testing::Gt(0));
+}
+
+TEST_F(MapTestFixture, CheckpointWritesModifiedListsToDeltaFiles) {
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_partitions = 1;
+  const auto delta_file = internal::Partition::getNameOfDeltaFile(
+      (directory / Map::getPartitionPrefix(0)).string());
+  {
+    Map map(directory, options);
+    map.put("key", "value");
+    ASSERT_FALSE(boost::filesystem::exists(delta_file));
+    map.checkpoint();
+    ASSERT_TRUE(boost::filesystem::is_regular_file(delta_file));
+    ASSERT_TRUE(
+        boost::filesystem::is_regular_file(directory / Map::getNameOfIdFile()));
+  }
+  // The first close of a partition writes its keys file from scratch.
+  ASSERT_FALSE(boost::filesystem::exists(delta_file));
+  options.readonly = true;
+  Map map(directory, options);
+  ASSERT_THAT(map.get("key")->next(), Eq("value"));
+  ASSERT_THROW(map.checkpoint(), std::runtime_error);
+}
+
+TEST_F(MapTestFixture, PartitionCallbacksAreCalledOncePerPartition) {
+  std::vector<uint32_t> opened;
+  std::vector<uint32_t> closed;
+  std::vector<Map::PartitionTimings> timings_seen;
+  std::mutex mutex;
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_partitions = 5;
+  options.num_threads = 3;
+  options.on_partition_open = [&](uint32_t index,
+                                  const Map::PartitionTimings& timings) {
+    std::lock_guard<std::mutex> lock(mutex);
+    opened.push_back(index);
+    timings_seen.push_back(timings);
+  };
+  options.on_partition_close = [&](uint32_t index,
+                                   const Map::PartitionTimings& timings) {
+    std::lock_guard<std::mutex> lock(mutex);
+    closed.push_back(index);
+    timings_seen.push_back(timings);
+  };
+  // Partitions are opened and closed concurrently.
+  {
+    Map map(directory, options);
+    ASSERT_THAT(opened, testing::UnorderedElementsAre(0, 1, 2, 3, 4));
+    ASSERT_TRUE(closed.empty());
+  }
+  ASSERT_THAT(closed, testing::UnorderedElementsAre(0, 1, 2, 3, 4));
+  ASSERT_THAT(timings_seen.size(), Eq(10));
+  for (const auto& timings : timings_seen) {
+    ASSERT_THAT(timings.total, Gt(0));
+    ASSERT_THAT(timings.read_keys + timings.replay_delta +
+                    timings.replay_wal + timings.build_index +
+                    timings.flush_lists + timings.write_keys +
+                    timings.write_stats,
+                Le(timings.total));
+  }
+}
+
+TEST_F(MapTestFixture, OpenAndCloseWithMultipleThreadsKeepsAllData) {
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_threads = 4;
+  {
+    Map map(directory, options);
+    for (auto k = 0; k != 100; ++k) {
+      for (auto v = 0; v != 10; ++v) {
+        map.put(std::to_string(k), std::to_string(v));
+      }
+    }
+  }
+  for (const auto num_threads : {1, 4}) {
+    options.num_threads = num_threads;
+    Map map(directory, options);
+    ASSERT_THAT(map.getTotalStats().num_values_valid, Eq(1000));
+    for (auto k = 0; k != 100; ++k) {
+      auto iter = map.get(std::to_string(k));
+      for (auto v = 0; v != 10; ++v) {
+        ASSERT_TRUE(iter->hasNext());
+        ASSERT_THAT(iter->next(), Eq(std::to_string(v)));
+      }
+      ASSERT_FALSE(iter->hasNext());
+    }
+  }
+}
+
+TEST_F(MapTestFixture, ListsWrittenInExtentsKeepAllValuesAcrossReopen) {
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_partitions = 1;
+  options.max_extent_size = 8;
+  const std::string value(300, 'v');
+  const auto putInterleaved = [&](Map* map) {
+    for (auto i = 0; i != 100; ++i) {
+      for (auto k = 0; k != 3; ++k) {
+        map->put(std::to_string(k), value + std::to_string(i));
+      }
+    }
+  };
+  const auto checkValues = [&](const Map& map, int num_values) {
+    for (auto k = 0; k != 3; ++k) {
+      auto iter = map.get(std::to_string(k));
+      for (auto i = 0; i != num_values; ++i) {
+        ASSERT_TRUE(iter->hasNext());
+        ASSERT_THAT(iter->next(), Eq(value + std::to_string(i % 100)));
+      }
+      ASSERT_FALSE(iter->hasNext());
+    }
+  };
+  {
+    Map map(directory, options);
+    putInterleaved(&map);
+    checkValues(map, 100);
+  }
+  {
+    // Blocks that were reserved but not used are reused.
+    options.max_extent_size = 1;
+    Map map(directory, options);
+    checkValues(map, 100);
+    putInterleaved(&map);
+    checkValues(map, 200);
+  }
+  Map map(directory, options);
+  checkValues(map, 200);
+}
+
+TEST_F(MapTestFixture, VerifyReportsCorruptBlocksPerPartition) {
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_partitions = 1;
+  options.checksums = true;
+  {
+    Map map(directory, options);
+    for (auto i = 0; i != 1000; ++i) {
+      map.put(std::to_string(i % 10), std::to_string(i));
+    }
+  }
+  auto corrupt_blocks = Map::verify(directory);
+  ASSERT_FALSE(corrupt_blocks.empty());
+  for (const auto& ids : corrupt_blocks) {
+    ASSERT_TRUE(ids.empty());
+  }
+
+  const auto values_file = internal::Partition::getNameOfValuesFile(
+      (directory / Map::getPartitionPrefix(0)).string());
+  ASSERT_THAT(boost::filesystem::file_size(values_file), testing::Gt(0));
+  {
+    const auto fd = mt::open(values_file, O_WRONLY);
+    const char byte = '!';
+    mt::pwrite(fd.get(), &byte, sizeof byte, 0);
+  }
+  corrupt_blocks = Map::verify(directory);
+  ASSERT_THAT(corrupt_blocks[0], testing::ElementsAre(0));
+  for (size_t i = 1; i != corrupt_blocks.size(); ++i) {
+    ASSERT_TRUE(corrupt_blocks[i].empty());
+  }
+
+  options.readonly = true;
+  {
+    const Map map(directory, options);
+    const auto readAllValues = [&map] {
+      for (auto k = 0; k != 10; ++k) {
+        auto iter = map.get(std::to_string(k));
+        while (iter->hasNext()) {
+          iter->next();
+        }
+      }
+    };
+    ASSERT_THROW(readAllValues(), std::runtime_error);
+  }
+
+  // A map that is opened in writable mode without checksums drops them.
+  options.readonly = false;
+  options.checksums = false;
+  { Map map(directory, options); }
+  ASSERT_THROW(Map::verify(directory), std::runtime_error);
+}
+
+TEST_F(MapTestFixture, VerifyListsReportsMissingBlocksWithoutChecksums) {
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_partitions = 3;
+  {
+    Map map(directory, options);
+    for (auto i = 0; i != 10000; ++i) {
+      map.put(std::to_string(i % 10), std::to_string(i));
+    }
+  }
+  options.num_threads = 2;
+  auto invalid_blocks = Map::verifyLists(directory, options);
+  ASSERT_THAT(invalid_blocks.size(), Eq(3));
+  for (const auto& ids : invalid_blocks) {
+    ASSERT_TRUE(ids.empty());
+  }
+
+  const auto values_file = internal::Partition::getNameOfValuesFile(
+      (directory / Map::getPartitionPrefix(1)).string());
+  ASSERT_THAT(boost::filesystem::file_size(values_file),
+              testing::Gt(options.block_size));
+  boost::filesystem::resize_file(values_file, options.block_size);
+  invalid_blocks = Map::verifyLists(directory, options);
+  ASSERT_TRUE(invalid_blocks[0].empty());
+  ASSERT_FALSE(invalid_blocks[1].empty());
+  ASSERT_TRUE(invalid_blocks[2].empty());
+  for (const auto id : invalid_blocks[1]) {
+    ASSERT_THAT(id, testing::Ge(1));
+  }
+}
+
 struct MapTestWithParam : public testing::TestWithParam<int> {
   void SetUp() override {
     boost::filesystem::remove_all(directory);
@@ -146,6 +1805,131 @@ TEST_P(MapTestWithParam, PutDataThenReopenThenReadAll) {
   }
 }
 
+TEST_P(MapTestWithParam, WriteBatchThenReadAll) {
+  auto map = openOrCreateMap(directory);
+  WriteBatch batch;
+  for (auto v = 0; v != GetParam(); ++v) {
+    for (auto k = 0; k != GetParam(); ++k) {
+      batch.put(std::to_string(k), std::to_string(v));
+    }
+  }
+  ASSERT_THAT(batch.size(), Eq(GetParam() * GetParam()));
+  map->write(batch);
+  for (auto k = 0; k != GetParam(); ++k) {
+    auto iter = map->get(std::to_string(k));
+    ASSERT_THAT(iter->available(), Eq(GetParam()));
+    for (auto v = 0; iter->hasNext(); ++v) {
+      ASSERT_THAT(iter->next(), Eq(std::to_string(v)));
+    }
+  }
+}
+
+TEST_P(MapTestWithParam, GetManyAndContainsManyReturnResultsInInputOrder) {
+  auto map = openOrCreateMap(directory);
+  for (auto k = 0; k != GetParam(); ++k) {
+    for (auto v = 0; v <= k; ++v) {
+      map->put(std::to_string(k), std::to_string(v));
+    }
+  }
+  // Odd keys beyond GetParam() do not exist.
+  std::vector<std::string> keys;
+  for (auto k = 2 * GetParam() - 1; k >= 0; --k) {
+    keys.push_back(std::to_string(k));
+  }
+  const std::vector<Bytes> key_bytes(keys.begin(), keys.end());
+
+  const auto contained = map->containsMany(key_bytes);
+  ASSERT_THAT(contained.size(), Eq(keys.size()));
+  for (size_t i = 0; i != keys.size(); ++i) {
+    const auto k = std::stoi(keys[i]);
+    ASSERT_THAT(contained[i], Eq(k < GetParam()));
+  }
+
+  const auto iterators = map->getMany(key_bytes);
+  ASSERT_THAT(iterators.size(), Eq(keys.size()));
+  for (size_t i = 0; i != keys.size(); ++i) {
+    const auto k = std::stoi(keys[i]);
+    if (k < GetParam()) {
+      ASSERT_TRUE(iterators[i] != nullptr);
+      ASSERT_THAT(iterators[i]->available(), Eq(k + 1));
+      for (auto v = 0; iterators[i]->hasNext(); ++v) {
+        ASSERT_THAT(iterators[i]->next(), Eq(std::to_string(v)));
+      }
+    } else {
+      ASSERT_TRUE(iterators[i] == nullptr);
+    }
+  }
+}
+
+TEST_P(MapTestWithParam, CountAndCountManyMatchNumberOfValues) {
+  auto map = openOrCreateMap(directory);
+  for (auto k = 0; k != GetParam(); ++k) {
+    for (auto v = 0; v <= k; ++v) {
+      map->put(std::to_string(k), std::to_string(v));
+    }
+  }
+  map->removeOne("0", [](const Bytes&) { return true; });
+  std::vector<std::string> keys;
+  for (auto k = 2 * GetParam() - 1; k >= 0; --k) {
+    keys.push_back(std::to_string(k));
+  }
+  const auto counts = map->countMany(
+      std::vector<Bytes>(keys.begin(), keys.end()));
+  ASSERT_THAT(counts.size(), Eq(keys.size()));
+  for (size_t i = 0; i != keys.size(); ++i) {
+    const uint32_t k = std::stoi(keys[i]);
+    const uint32_t expected =
+        (k != 0 && k < static_cast<uint32_t>(GetParam())) ? k + 1 : 0;
+    ASSERT_THAT(counts[i], Eq(expected));
+    ASSERT_THAT(map->count(keys[i]), Eq(expected));
+  }
+}
+
+TEST_F(MapTestFixture, ByteSizeCountsBlocksAndTailOfList) {
+  Map::Options options;
+  options.block_size = 128;
+  options.create_if_missing = true;
+  Map map(directory, options);
+  ASSERT_THAT(map.byteSize("k"), Eq(0));
+  map.put("k", "v");
+  const auto size_of_one = map.byteSize("k");
+  ASSERT_THAT(size_of_one, Gt(0));
+  ASSERT_THAT(size_of_one, Lt(options.block_size));
+  for (auto i = 0; i != 100; ++i) {
+    map.put("k", "value" + std::to_string(i));
+  }
+  ASSERT_THAT(map.byteSize("k"), Gt(5 * options.block_size));
+  ASSERT_THAT(map.byteSize("k"), Lt(20 * options.block_size));
+  ASSERT_THAT(map.byteSize("other"), Eq(0));
+}
+
+TEST_P(MapTestWithParam, ForEachKeyAndEntryInParallelVisitAllData) {
+  auto map = openOrCreateMap(directory);
+  for (auto k = 0; k != GetParam(); ++k) {
+    for (auto v = 0; v != GetParam(); ++v) {
+      map->put(std::to_string(k), std::to_string(v));
+    }
+  }
+  for (const uint32_t num_threads : {1, 4}) {
+    std::atomic<int> num_keys(0);
+    map->forEachKeyInParallel([&](const Bytes&) { ++num_keys; }, num_threads);
+    ASSERT_THAT(num_keys.load(), Eq(GetParam()));
+
+    std::atomic<int> num_values(0);
+    std::atomic<int> num_mismatches(0);
+    map->forEachEntryInParallel(
+        [&](const Bytes&, Iterator* iter) {
+          for (auto v = 0; iter->hasNext(); ++v) {
+            if (iter->next() != std::to_string(v)) ++num_mismatches;
+            ++num_values;
+          }
+        },
+        num_threads);
+    ASSERT_THAT(num_values.load(), Eq(GetParam() * GetParam()));
+    ASSERT_THAT(num_mismatches.load(), Eq(0));
+  }
+}
+
 TEST_P(MapTestWithParam, GetTotalStatsReturnsCorrectValuesAfterPuttingValues) {
   {
     auto map = openOrCreateMap(directory);
@@ -240,6 +2024,224 @@ TEST_P(MapTestWithParam, GetTotalStatsReturnsCorrectValuesAfterRemovingValues) {
   ASSERT_THAT(stats.num_values_valid, Eq(stats_backup.num_values_valid));
 }
 
+TEST_P(MapTestWithParam, GetCurrentTotalStatsReturnsSameCounts) {
+  auto map = openOrCreateMap(directory);
+  for (auto k = 0; k != GetParam(); ++k) {
+    for (auto v = 0; v != GetParam(); ++v) {
+      map->put(std::to_string(k), std::to_string(v));
+    }
+  }
+  map->remove(std::to_string(0));
+  map->removeAll(std::to_string(1), IS_ODD);
+  map->replaceAll(std::to_string(2), std::to_string(0), "x");
+
+  const auto stats = map->getTotalStats();
+  const auto current_stats = map->getCurrentTotalStats();
+  ASSERT_THAT(current_stats.num_keys_total, Eq(stats.num_keys_total));
+  ASSERT_THAT(current_stats.num_keys_valid, Eq(stats.num_keys_valid));
+  ASSERT_THAT(current_stats.num_values_total, Eq(stats.num_values_total));
+  ASSERT_THAT(current_stats.num_values_valid, Eq(stats.num_values_valid));
+  ASSERT_THAT(current_stats.num_partitions, Eq(stats.num_partitions));
+}
+
+TEST_P(MapTestWithParam, GetSampledTotalStatsReturnsSameCounts) {
+  auto map = openOrCreateMap(directory);
+  for (auto k = 0; k != GetParam(); ++k) {
+    for (auto v = 0; v != GetParam(); ++v) {
+      map->put(std::to_string(k), std::to_string(v));
+    }
+  }
+  const auto stats = map->getTotalStats();
+  const auto sampled = map->getSampledTotalStats(100);
+  ASSERT_THAT(sampled.stats.num_keys_valid, Eq(stats.num_keys_valid));
+  ASSERT_THAT(sampled.stats.num_values_valid, Eq(stats.num_values_valid));
+  ASSERT_THAT(sampled.stats.num_partitions, Eq(stats.num_partitions));
+  ASSERT_THAT(sampled.stats.list_size_avg, Eq(stats.list_size_avg));
+  ASSERT_THAT(sampled.list_size_avg_error, Eq(0));
+  // All lists have the same size.
+  if (GetParam() != 0) {
+    ASSERT_THAT(sampled.num_samples, Gt(0));
+  }
+}
+
+TEST_P(MapTestWithParam, OptimizeThenReadAll) {
+  {
+    auto map = openOrCreateMap(directory);
+    for (auto k = 0; k != GetParam(); ++k) {
+      for (auto v = 0; v != GetParam(); ++v) {
+        map->put(std::to_string(k), std::to_string(v));
+      }
+    }
+  }
+  const auto output = directory / "optimized";
+  boost::filesystem::create_directory(output);
+  Map::Options options;
+  options.keepBlockSize();
+  options.num_partitions = 5;
+  options.quiet = true;
+  Map::optimize(directory, output, options);
+
+  Map map(output);
+  ASSERT_THAT(map.getStats().size(), Eq(5));
+  ASSERT_THAT(map.getTotalStats().num_keys_valid, Eq(GetParam()));
+  for (auto k = 0; k != GetParam(); ++k) {
+    auto iter = map.get(std::to_string(k));
+    ASSERT_THAT(iter->available(), Eq(GetParam()));
+    for (auto v = 0; iter->hasNext(); ++v) {
+      ASSERT_THAT(iter->next(), Eq(std::to_string(v)));
+    }
+  }
+}
+
+TEST_P(MapTestWithParam, MapsWithSharedThreadPoolCanBeScannedConcurrently) {
+  Map::Options options;
+  options.create_if_missing = true;
+  options.num_partitions = 7;
+  options.num_threads = 3;
+  options.shared_thread_pool = true;
+  const auto other_directory = directory / "other";
+  boost::filesystem::create_directory(other_directory);
+  {
+    Map map(directory, options);
+    Map other(other_directory, options);
+    for (auto k = 0; k != GetParam(); ++k) {
+      map.put(std::to_string(k), std::to_string(k));
+      other.put(std::to_string(k), std::to_string(k));
+    }
+    std::atomic<int> num_values(0);
+    const auto count = [&num_values](const Bytes&, Iterator* iter) {
+      num_values += iter->available();
+    };
+    std::thread thread([&] { other.forEachEntryInParallel(count); });
+    map.forEachEntryInParallel(count);
+    thread.join();
+    ASSERT_THAT(num_values.load(), Eq(2 * GetParam()));
+  }
+  const auto output = directory / "optimized";
+  boost::filesystem::create_directory(output);
+  options.keepBlockSize();
+  options.quiet = true;
+  Map::optimize(directory, output, options);
+  Map::Options read_options;
+  read_options.readonly = true;
+  read_options.shared_thread_pool = true;
+  Map map(output, read_options);
+  ASSERT_THAT(map.getTotalStats().num_keys_valid, Eq(GetParam()));
+}
+
+TEST_P(MapTestWithParam, OptimizeKeepingLayoutDropsRemovedValues) {
+  {
+    auto map = openOrCreateMap(directory);
+    for (auto k = 0; k != GetParam(); ++k) {
+      for (auto v = 0; v != GetParam(); ++v) {
+        map->put(std::to_string(k), std::to_string(v));
+      }
+    }
+    for (auto k = 0; k < GetParam(); k += 2) {
+      map->removeAll(std::to_string(k), [](const Bytes& value) {
+        return std::stoi(value.toString()) % 3 == 0;
+      });
+    }
+    if (GetParam() != 0) map->remove(std::to_string(GetParam() - 1));
+  }
+  const auto num_keys = std::max(GetParam() - 1, 0);
+  const auto output = directory / "optimized";
+  boost::filesystem::create_directory(output);
+  Map::Options options;
+  options.keepBlockSize();
+  options.keepNumPartitions();
+  options.num_threads = 4;
+  options.quiet = true;
+  Map::optimize(directory, output, options);
+
+  Map map(output);
+  const auto total_stats = map.getTotalStats();
+  ASSERT_THAT(total_stats.num_values_total,
+              Eq(total_stats.num_values_valid));
+  ASSERT_THAT(total_stats.num_keys_valid, Eq(num_keys));
+  for (auto k = 0; k != num_keys; ++k) {
+    auto iter = map.get(std::to_string(k));
+    for (auto v = 0; v != GetParam(); ++v) {
+      if (k % 2 == 0 && v % 3 == 0) continue;
+      ASSERT_TRUE(iter->hasNext());
+      ASSERT_THAT(iter->next(), Eq(std::to_string(v)));
+    }
+    ASSERT_FALSE(iter->hasNext());
+  }
+}
+
+TEST_P(MapTestWithParam, OptimizeWithMultipleThreadsAndSortingThenReadAll) {
+  {
+    auto map = openOrCreateMap(directory);
+    for (auto k = 0; k != GetParam(); ++k) {
+      for (auto v = 0; v != GetParam(); ++v) {
+        map->put(std::to_string(k), std::to_string(v));
+      }
+    }
+  }
+  const auto output = directory / "optimized";
+  boost::filesystem::create_directory(output);
+  Map::Options options;
+  options.keepBlockSize();
+  options.keepNumPartitions();
+  options.num_threads = 4;
+  options.quiet = true;
+  options.compare = [](const Bytes& a, const Bytes& b) {
+    return std::stoi(a.toString()) > std::stoi(b.toString());
+  };
+  Map::optimize(directory, output, options);
+
+  Map map(output);
+  ASSERT_THAT(map.getTotalStats().num_keys_valid, Eq(GetParam()));
+  for (auto k = 0; k != GetParam(); ++k) {
+    auto iter = map.get(std::to_string(k));
+    ASSERT_THAT(iter->available(), Eq(GetParam()));
+    for (auto v = GetParam() - 1; iter->hasNext(); --v) {
+      ASSERT_THAT(iter->next(), Eq(std::to_string(v)));
+    }
+  }
+}
+
+TEST_P(MapTestWithParam, OptimizeWithCompressionThenReadAll) {
+  {
+    auto map = openOrCreateMap(directory);
+    for (auto k = 0; k != GetParam(); ++k) {
+      for (auto v = 0; v != GetParam(); ++v) {
+        map->put(std::to_string(k), std::to_string(v));
+      }
+    }
+  }
+  const auto compressed = directory / "compressed";
+  boost::filesystem::create_directory(compressed);
+  Map::Options options;
+  options.keepBlockSize();
+  options.keepNumPartitions();
+  options.compress = true;
+  options.quiet = true;
+  Map::optimize(directory, compressed, options);
+  ASSERT_THROW(Map(compressed, Map::Options()), std::runtime_error);
+
+  // Optimizing a compressed map decompresses it, unless requested otherwise.
+  const auto output = directory / "decompressed";
+  boost::filesystem::create_directory(output);
+  options.compress = false;
+  Map::optimize(compressed, output, options);
+
+  for (const auto& path : {compressed, output}) {
+    Map::Options read_options;
+    read_options.readonly = true;
+    Map map(path, read_options);
+    ASSERT_THAT(map.getTotalStats().num_keys_valid, Eq(GetParam()));
+    for (auto k = 0; k != GetParam(); ++k) {
+      auto iter = map.get(std::to_string(k));
+      ASSERT_THAT(iter->available(), Eq(GetParam()));
+      for (auto v = 0; iter->hasNext(); ++v) {
+        ASSERT_THAT(iter->next(), Eq(std::to_string(v)));
+      }
+    }
+  }
+}
+
 INSTANTIATE_TEST_CASE_P(Parameterized, MapTestWithParam,
                         testing::Values(0, 1, 2, 10, 100, 1000));
 
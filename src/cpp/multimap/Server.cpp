@@ -0,0 +1,262 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/Server.hpp"
+
+#include <cerrno>
+#include <cstring>  // For std::memset
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "multimap/internal/Varint.hpp"
+
+namespace multimap {
+
+namespace {
+
+typedef internal::Protocol Protocol;
+
+const size_t RECEIVE_BUFFER_SIZE = mt::KiB(64);
+
+void checkKey(const Protocol::Message& request) {
+  mt::Check::isFalse(request.fields.empty(), "Server: Request without key");
+}
+
+std::vector<std::string> readAll(Iterator* iter) {
+  std::vector<std::string> values;
+  if (iter) {
+    values.reserve(iter->available());
+    while (iter->hasNext()) {
+      values.push_back(iter->next().toString());
+    }
+  }
+  return values;
+}
+
+}  // namespace
+
+Server::Server(Map* map, const std::string& host, uint16_t port)
+    : map_(map), stopped_(false) {
+  MT_REQUIRE_NOT_NULL(map);
+  addrinfo hints;
+  std::memset(&hints, 0, sizeof hints);
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  addrinfo* addresses = nullptr;
+  const auto result =
+      ::getaddrinfo(host.empty() ? nullptr : host.c_str(),
+                    std::to_string(port).c_str(), &hints, &addresses);
+  mt::Check::isZero(result, "Server: Cannot resolve '%s' because of '%s'",
+                    host.c_str(), ::gai_strerror(result));
+  std::unique_ptr<addrinfo, decltype(&::freeaddrinfo)> guard(addresses,
+                                                              ::freeaddrinfo);
+  int error = 0;
+  for (auto address = addresses; address; address = address->ai_next) {
+    mt::AutoCloseFd socket(::socket(address->ai_family, address->ai_socktype,
+                                    address->ai_protocol));
+    if (socket.get() == -1) {
+      error = errno;
+      continue;
+    }
+    const int one = 1;
+    ::setsockopt(socket.get(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    if (::bind(socket.get(), address->ai_addr, address->ai_addrlen) == 0 &&
+        ::listen(socket.get(), SOMAXCONN) == 0) {
+      socket_ = std::move(socket);
+      break;
+    }
+    error = errno;
+  }
+  mt::Check::isTrue(socket_.get() != mt::AutoCloseFd::NO_FD,
+                    "Server: Cannot listen on '%s:%u' because of '%s'",
+                    host.c_str(), port, std::strerror(error));
+
+  sockaddr_storage address;
+  socklen_t address_size = sizeof address;
+  const auto status = ::getsockname(
+      socket_.get(), reinterpret_cast<sockaddr*>(&address), &address_size);
+  mt::Check::isZero(status, "getsockname() failed because of '%s'",
+                    mt::errnostr());
+  port_ = ntohs(address.ss_family == AF_INET6
+                    ? reinterpret_cast<sockaddr_in6*>(&address)->sin6_port
+                    : reinterpret_cast<sockaddr_in*>(&address)->sin_port);
+}
+
+Server::~Server() {
+  stop();
+  closeConnections(false);
+}
+
+void Server::run() {
+  while (!stopped_) {
+    const auto socket = ::accept(socket_.get(), nullptr, nullptr);
+    if (socket == -1) {
+      if (stopped_) break;
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      const auto error = errno;
+      closeConnections(false);
+      mt::fail("accept() failed because of '%s'", std::strerror(error));
+    }
+    const int one = 1;
+    ::setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    std::unique_ptr<Connection> connection(new Connection());
+    connection->socket.reset(socket);
+    closeConnections(true);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (stopped_) break;
+    // Otherwise, `stop()` has already shut down all connections.
+    const auto connection_ptr = connection.get();
+    connection->thread =
+        std::thread([this, connection_ptr] { serve(connection_ptr); });
+    connections_.push_back(std::move(connection));
+  }
+  closeConnections(false);
+}
+
+void Server::stop() {
+  stopped_ = true;
+  ::shutdown(socket_.get(), SHUT_RDWR);
+  // Wakes up `accept()`.
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& connection : connections_) {
+    ::shutdown(connection->socket.get(), SHUT_RDWR);
+  }
+}
+
+Protocol::Message Server::execute(Map* map,
+                                  const Protocol::Message& request) {
+  typedef Protocol::Message Message;
+  typedef Protocol::Status Status;
+  try {
+    const auto& fields = request.fields;
+    switch (static_cast<Protocol::Opcode>(request.code)) {
+      case Protocol::Opcode::PUT:
+        mt::Check::isTrue(fields.size() >= 2,
+                          "Server: PUT requires a key and values");
+        map->put(fields.front(), fields.begin() + 1, fields.end());
+        return Message(Status::OK, {});
+
+      case Protocol::Opcode::GET: {
+        checkKey(request);
+        std::vector<std::string> values;
+        map->get(fields.front(),
+                 [&values](Iterator* iter) { values = readAll(iter); });
+        return Message(Status::OK, std::move(values));
+      }
+
+      case Protocol::Opcode::CONTAINS:
+        checkKey(request);
+        return Message(Status::OK,
+                       {std::string(1, map->contains(fields.front()))});
+
+      case Protocol::Opcode::REMOVE: {
+        checkKey(request);
+        char buffer[4];
+        const auto nbytes = internal::Varint::writeUint(
+            map->remove(fields.front()), buffer, sizeof buffer);
+        return Message(Status::OK, {std::string(buffer, nbytes)});
+      }
+
+      case Protocol::Opcode::GET_MANY: {
+        const std::vector<Bytes> keys(fields.begin(), fields.end());
+        const auto iterators = map->getMany(keys);
+        std::vector<std::string> lists(iterators.size());
+        for (size_t i = 0; i != iterators.size(); ++i) {
+          Protocol::appendFields(readAll(iterators[i].get()), &lists[i]);
+        }
+        return Message(Status::OK, std::move(lists));
+      }
+
+      case Protocol::Opcode::CONTAINS_MANY: {
+        const std::vector<Bytes> keys(fields.begin(), fields.end());
+        const auto flags = map->containsMany(keys);
+        return Message(Status::OK, {std::string(flags.begin(), flags.end())});
+      }
+    }
+    mt::fail("Server: Unknown opcode %u", request.code);
+
+  } catch (const std::exception& error) {
+    return Message(Status::ERROR, {error.what()});
+  }
+  return Message();
+}
+
+void Server::serve(Connection* connection) {
+  const auto socket = connection->socket.get();
+  std::vector<char> buffer(RECEIVE_BUFFER_SIZE);
+  std::string input;
+  std::string output;
+  Protocol::Message request;
+  try {
+    while (true) {
+      const auto nbytes = ::recv(socket, buffer.data(), buffer.size(), 0);
+      if (nbytes == -1 && errno == EINTR) continue;
+      if (nbytes <= 0) break;
+      input.append(buffer.data(), nbytes);
+      size_t offset = 0;
+      while (const auto size = Protocol::parse(input.data() + offset,
+                                               input.size() - offset,
+                                               &request)) {
+        offset += size;
+        Protocol::append(execute(map_, request), &output);
+      }
+      input.erase(0, offset);
+      if (!output.empty()) {
+        Protocol::sendAll(socket, output);
+        output.clear();
+      }
+    }
+  } catch (const std::exception& error) {
+    // The request stream is malformed or the client has gone away.
+    try {
+      output.clear();
+      Protocol::append(Protocol::Message(Protocol::Status::ERROR,
+                                         {error.what()}),
+                       &output);
+      Protocol::sendAll(socket, output);
+    } catch (...) {
+    }
+  }
+  ::shutdown(socket, SHUT_RDWR);
+  connection->closed = true;
+}
+
+void Server::closeConnections(bool only_closed) {
+  std::list<std::unique_ptr<Connection> > finished;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto iter = connections_.begin();
+    while (iter != connections_.end()) {
+      const auto next = std::next(iter);
+      if (!only_closed) {
+        ::shutdown((*iter)->socket.get(), SHUT_RDWR);
+      }
+      if (!only_closed || (*iter)->closed) {
+        finished.splice(finished.end(), connections_, iter);
+      }
+      iter = next;
+    }
+  }
+  for (const auto& connection : finished) {
+    connection->thread.join();
+  }
+}
+
+}  // namespace multimap
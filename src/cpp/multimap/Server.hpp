@@ -0,0 +1,86 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_SERVER_HPP_INCLUDED
+#define MULTIMAP_SERVER_HPP_INCLUDED
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "multimap/internal/Protocol.hpp"
+#include "multimap/Map.hpp"
+
+namespace multimap {
+
+class Server : public mt::Resource {
+  // Serves a map to clients over TCP, so that many processes can share one
+  // opened map, see `internal::Protocol` and `Client`.  Each connection is
+  // served by its own thread, which executes the requests of its client in
+  // order.  Requests that have arrived together are answered together, so
+  // that pipelining clients need only a few system calls per batch.
+
+ public:
+  Server(Map* map, const std::string& host, uint16_t port);
+  // Listens on `host`, which may be a name or a numeric address, and `port`.
+  // If `host` is empty, the server listens on all interfaces.  If `port` is
+  // zero, an unused port is chosen, see `getPort()`.  `map` is not owned and
+  // must outlive the server.
+
+  ~Server();
+  // Calls `stop()` and waits for connections to be closed.
+
+  uint16_t getPort() const { return port_; }
+
+  void run();
+  // Accepts and serves connections until `stop()` is called.  Returns after
+  // all connections have been closed.
+
+  void stop();
+  // Makes `run()` return.  May be called from any thread, also before `run()`.
+
+  static internal::Protocol::Message execute(
+      Map* map, const internal::Protocol::Message& request);
+  // Returns the response to `request`.  Errors are returned as responses.
+
+ private:
+  struct Connection {
+    mt::AutoCloseFd socket;
+    std::thread thread;
+    std::atomic<bool> closed;
+    Connection() : closed(false) {}
+  };
+
+  void serve(Connection* connection);
+
+  void closeConnections(bool only_closed);
+  // Joins and removes closed connections, or all after shutting them down.
+
+  Map* map_;
+  mt::AutoCloseFd socket_;
+  uint16_t port_ = 0;
+  std::atomic<bool> stopped_;
+  std::mutex mutex_;
+  std::list<std::unique_ptr<Connection> > connections_;
+  // Guarded by `mutex_`.
+};
+
+}  // namespace multimap
+
+#endif  // MULTIMAP_SERVER_HPP_INCLUDED
@@ -0,0 +1,147 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/Client.hpp"
+#include "multimap/Server.hpp"
+
+namespace multimap {
+
+using testing::ElementsAre;
+using testing::Eq;
+using testing::IsEmpty;
+using testing::Ne;
+
+struct ServerTestFixture : public testing::Test {
+  void SetUp() override {
+    boost::filesystem::remove_all(directory);
+    boost::filesystem::create_directory(directory);
+    Map::Options options;
+    options.create_if_missing = true;
+    map.reset(new Map(directory, options));
+    server.reset(new Server(map.get(), "127.0.0.1", 0));
+    thread = std::thread([this] { server->run(); });
+  }
+
+  void TearDown() override {
+    server->stop();
+    thread.join();
+    server.reset();
+    map.reset();
+    boost::filesystem::remove_all(directory);
+  }
+
+  const boost::filesystem::path directory = "/tmp/multimap.ServerTestFixture";
+  std::unique_ptr<Map> map;
+  std::unique_ptr<Server> server;
+  std::thread thread;
+};
+
+TEST_F(ServerTestFixture, ListensOnChosenPort) {
+  ASSERT_THAT(server->getPort(), Ne(0));
+}
+
+TEST_F(ServerTestFixture, ClientPutsGetsAndRemovesValues) {
+  Client client("127.0.0.1", server->getPort());
+  client.put("k1", "v1");
+  client.put("k1", std::vector<std::string>{"v2", "v3"});
+  client.put("k2", "v4");
+  ASSERT_THAT(client.get("k1"), ElementsAre("v1", "v2", "v3"));
+  ASSERT_THAT(client.get("k3"), IsEmpty());
+  ASSERT_TRUE(client.contains("k2"));
+  ASSERT_FALSE(client.contains("k3"));
+  ASSERT_THAT(client.remove("k1"), Eq(3));
+  ASSERT_THAT(client.remove("k1"), Eq(0));
+  ASSERT_FALSE(map->contains("k1"));
+  ASSERT_TRUE(map->contains("k2"));
+}
+
+TEST_F(ServerTestFixture, BatchOperationsReturnResultsInInputOrder) {
+  map->put("a", "1");
+  map->put("c", "2");
+  map->put("c", "3");
+  Client client("127.0.0.1", server->getPort());
+  const std::vector<Bytes> keys = {"c", "b", "a"};
+  ASSERT_THAT(client.getMany(keys),
+              ElementsAre(ElementsAre("2", "3"), IsEmpty(), ElementsAre("1")));
+  ASSERT_THAT(client.containsMany(keys), ElementsAre(true, false, true));
+}
+
+TEST_F(ServerTestFixture, PipelinedRequestsAreAnsweredInOrder) {
+  Client client("127.0.0.1", server->getPort());
+  const int num_keys = 1000;
+  for (int i = 0; i != num_keys; ++i) {
+    const auto key = std::to_string(i);
+    client.send(Client::Message(internal::Protocol::Opcode::PUT, {key, key}));
+  }
+  for (int i = 0; i != num_keys; ++i) {
+    client.send(Client::Message(internal::Protocol::Opcode::GET,
+                                {std::to_string(i)}));
+  }
+  for (int i = 0; i != num_keys; ++i) {
+    ASSERT_THAT(client.receive().fields, IsEmpty());
+  }
+  for (int i = 0; i != num_keys; ++i) {
+    ASSERT_THAT(client.receive().fields, ElementsAre(std::to_string(i)));
+  }
+}
+
+TEST_F(ServerTestFixture, FailedRequestsAreReportedAndConnectionStaysUsable) {
+  Client client("127.0.0.1", server->getPort());
+  client.send(Client::Message());
+  ASSERT_THROW(client.receive(), std::runtime_error);
+  ASSERT_THROW(client.put("", "v"), std::runtime_error);
+  client.put("k", "v");
+  ASSERT_THAT(client.get("k"), ElementsAre("v"));
+}
+
+TEST_F(ServerTestFixture, ClientsShareTheMapConcurrently) {
+  const int num_clients = 8;
+  const int num_values = 100;
+  std::vector<std::thread> threads;
+  for (int i = 0; i != num_clients; ++i) {
+    threads.emplace_back([this, i] {
+      Client client("127.0.0.1", server->getPort());
+      for (int j = 0; j != num_values; ++j) {
+        client.put(std::to_string(i), std::to_string(j));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  Client client("127.0.0.1", server->getPort());
+  for (int i = 0; i != num_clients; ++i) {
+    ASSERT_THAT(client.get(std::to_string(i)).size(), Eq(num_values));
+  }
+}
+
+TEST_F(ServerTestFixture, StopClosesOpenConnections) {
+  Client client("127.0.0.1", server->getPort());
+  client.put("k", "v");
+  server->stop();
+  thread.join();
+  ASSERT_THROW(client.get("k"), std::runtime_error);
+  thread = std::thread([] {});
+}
+
+}  // namespace multimap
@@ -0,0 +1,42 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/WriteBatch.hpp"
+
+#include "multimap/internal/Partition.hpp"
+
+namespace multimap {
+
+void WriteBatch::put(const Bytes& key, const Bytes& value) {
+  MT_REQUIRE_LE(key.size(), internal::Partition::Limits::maxKeySize());
+  MT_REQUIRE_LE(value.size(), internal::Partition::Limits::maxValueSize());
+  Entry entry;
+  entry.hash = internal::Partition::Key::hash(key);
+  entry.offset = data_.size();
+  entry.key_size = key.size();
+  entry.value_size = value.size();
+  data_.append(key.data(), key.size());
+  data_.append(value.data(), value.size());
+  entries_.push_back(entry);
+}
+
+void WriteBatch::clear() {
+  entries_.clear();
+  data_.clear();
+}
+
+}  // namespace multimap
@@ -0,0 +1,77 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// -----------------------------------------------------------------------------
+// Documentation:  http://multimap.io/cppreference/#writebatchhpp
+// -----------------------------------------------------------------------------
+
+#ifndef MULTIMAP_WRITE_BATCH_HPP_INCLUDED
+#define MULTIMAP_WRITE_BATCH_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include "multimap/Bytes.hpp"
+
+namespace multimap {
+
+class Map;
+
+class WriteBatch {
+  // Collects puts that are applied at once via `Map::write()`.  Keys and
+  // values are copied into a single buffer, so that the arguments of `put()`
+  // need not outlive the call.  Objects of this class are not thread-safe.
+
+ public:
+  WriteBatch() = default;
+
+  void put(const Bytes& key, const Bytes& value);
+
+  size_t size() const { return entries_.size(); }
+  // Returns the number of puts.
+
+  bool empty() const { return entries_.empty(); }
+
+  void clear();
+  // Removes all puts, but keeps the allocated memory for reuse.
+
+ private:
+  friend class Map;
+
+  struct Entry {
+    uint64_t hash;
+    size_t offset;
+    uint32_t key_size;
+    uint32_t value_size;
+  };
+  // The key starts at `offset` in `data_` and is followed by the value.
+
+  Bytes getKey(const Entry& entry) const {
+    return Bytes(data_.data() + entry.offset, entry.key_size);
+  }
+
+  Bytes getValue(const Entry& entry) const {
+    return Bytes(data_.data() + entry.offset + entry.key_size,
+                 entry.value_size);
+  }
+
+  std::vector<Entry> entries_;
+  std::string data_;
+};
+
+}  // namespace multimap
+
+#endif  // MULTIMAP_WRITE_BATCH_HPP_INCLUDED
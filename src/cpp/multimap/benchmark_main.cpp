@@ -0,0 +1,27 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "gmock/gmock.h"
+
+int main(int argc, char** argv) {
+  testing::GTEST_FLAG(also_run_disabled_tests) = true;
+  testing::GTEST_FLAG(filter) = "*Benchmark*";
+  // Command line flags are parsed afterwards and take precedence, so that
+  // e.g. --gtest_filter=Store*Benchmark* selects a subset.
+  testing::InitGoogleMock(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -22,7 +22,7 @@
 #ifndef MULTIMAP_CALLABLES_HPP_INCLUDED
 #define MULTIMAP_CALLABLES_HPP_INCLUDED
 
-#include <algorithm>
+#include <cstring>
 #include "multimap/Bytes.hpp"
 
 namespace multimap {
@@ -46,10 +46,22 @@ struct Contains {
   const Bytes& bytes() const { return bytes_; }
 
   bool operator()(const Bytes& bytes) const {
-    return (bytes_.size() > 0)
-               ? std::search(bytes.begin(), bytes.end(), bytes_.begin(),
-                             bytes_.end()) != bytes.end()
-               : true;
+    if (bytes_.size() == 0) return true;
+    if (bytes.size() < bytes_.size()) return false;
+    // Candidates are found via `std::memchr()`, which the C library scans
+    // with vector instructions, and are then verified via `std::memcmp()`.
+    const char* pos = bytes.data();
+    const char* last = bytes.data() + (bytes.size() - bytes_.size());
+    while (pos <= last) {
+      pos = static_cast<const char*>(
+          std::memchr(pos, bytes_.data()[0], last - pos + 1));
+      if (!pos) return false;
+      if (std::memcmp(pos + 1, bytes_.data() + 1, bytes_.size() - 1) == 0) {
+        return true;
+      }
+      ++pos;
+    }
+    return false;
   }
 
  private:
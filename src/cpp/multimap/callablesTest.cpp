@@ -15,8 +15,12 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <string>
 #include <type_traits>
+#include <vector>
 #include "gmock/gmock.h"
+#include "multimap/internal/Benchmark.hpp"
 #include "multimap/callables.hpp"
 
 namespace multimap {
@@ -37,8 +41,14 @@ TEST(CallablesTest, TestContains) {
   ASSERT_TRUE(Contains("abc")("abcd"));
   ASSERT_TRUE(Contains("abc")("zabc"));
 
+  ASSERT_TRUE(Contains("aab")("aaab"));
+  ASSERT_TRUE(Contains("b")("aaab"));
+  ASSERT_TRUE(Contains(Bytes("a\0b", 3))(Bytes("\0a\0a\0b", 6)));
+
   ASSERT_FALSE(Contains("abc")(""));
   ASSERT_FALSE(Contains("abc")("ab"));
+  ASSERT_FALSE(Contains("abc")("abab"));
+  ASSERT_FALSE(Contains("abc")("xbcabd"));
 }
 
 TEST(CallablesTest, TestStartsWith) {
@@ -55,4 +65,35 @@ TEST(CallablesTest, TestEndsWith) {
   ASSERT_FALSE(EndsWith("bc")("abcd"));
 }
 
+TEST(CallablesTest, DISABLED_BenchmarkContainsVersusStdSearch) {
+  std::vector<std::string> keys;
+  for (int i = 0; i != 100000; ++i) {
+    keys.push_back("user:" + std::to_string(i) + ":session:" +
+                   std::to_string(i * 7919));
+  }
+  const std::string pattern = ":session:12345";
+  const Contains contains(pattern);
+  const int num_rounds = 100;
+  size_t num_matches = 0;
+  size_t num_expected_matches = 0;
+  internal::Benchmark::run("Contains", keys.size() * num_rounds, [&] {
+    for (int round = 0; round != num_rounds; ++round) {
+      for (const auto& key : keys) {
+        num_matches += contains(key);
+      }
+    }
+  });
+  internal::Benchmark::run("std::search", keys.size() * num_rounds, [&] {
+    for (int round = 0; round != num_rounds; ++round) {
+      for (const auto& key : keys) {
+        num_expected_matches += std::search(key.begin(), key.end(),
+                                            pattern.begin(),
+                                            pattern.end()) != key.end();
+      }
+    }
+  });
+  ASSERT_EQ(num_matches, num_expected_matches);
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
 }  // namespace multimap
@@ -15,10 +15,12 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <chrono>
 #include <cstdio>
 #include <cinttypes>
 #include <iostream>
 #include <boost/filesystem/operations.hpp>
+#include <multimap/internal/Workload.hpp>
 #include <multimap/thirdparty/mt/mt.hpp>
 #include <multimap/Map.hpp>
 
@@ -28,15 +30,28 @@ const auto STATS    = "stats";
 const auto IMPORT   = "import";
 const auto EXPORT   = "export";
 const auto OPTIMIZE = "optimize";
-
-const auto BS     = "--bs";
-const auto CREATE = "--create";
-const auto NPARTS = "--nparts";
-const auto QUIET  = "--quiet";
+const auto VERIFY   = "verify";
+const auto BENCH    = "bench";
+
+const auto BINARY    = "--binary";
+const auto BS        = "--bs";
+const auto CHECKSUMS = "--checksums";
+const auto COMPRESS  = "--compress";
+const auto CREATE    = "--create";
+const auto KEYS      = "--keys";
+const auto LIVE      = "--live";
+const auto NPARTS    = "--nparts";
+const auto OPS       = "--ops";
+const auto QUIET     = "--quiet";
+const auto READS     = "--reads";
+const auto THREADS   = "--threads";
+const auto TUNE      = "--tune";
 // clang-format on
 
-const auto COMMANDS = {HELP, STATS, IMPORT, EXPORT, OPTIMIZE};
-const auto OPTIONS = {BS, CREATE, NPARTS, QUIET};
+const auto COMMANDS = {HELP, STATS, IMPORT, EXPORT, OPTIMIZE, VERIFY, BENCH};
+const auto FLAGS = {BINARY, CHECKSUMS, COMPRESS, CREATE, LIVE, QUIET, TUNE};
+const auto OPTIONS = {BS, KEYS, NPARTS, OPS, READS, THREADS};
+// Flags stand alone, options are followed by a value.
 
 struct CommandLine {
   struct Error : public std::runtime_error {
@@ -52,6 +67,11 @@ bool isCommand(const std::string& argument) {
          std::end(COMMANDS);
 }
 
+bool isFlag(const std::string& argument) {
+  return std::find(std::begin(FLAGS), std::end(FLAGS), argument) !=
+         std::end(FLAGS);
+}
+
 bool isOption(const std::string& argument) {
   return std::find(std::begin(OPTIONS), std::end(OPTIONS), argument) !=
          std::end(OPTIONS);
@@ -70,53 +90,52 @@ CommandLine parseCommandLine(int argc, const char** argv) {
   if (cmd.command != std::string(HELP)) {
     mt::check<E>(it != end, "No MAP given");
     cmd.map = *it++;
-    if (cmd.command != std::string(STATS)) {
+    if (cmd.command != std::string(STATS) &&
+        cmd.command != std::string(VERIFY) &&
+        cmd.command != std::string(BENCH)) {
       mt::check<E>(it != end, "No PATH given");
       cmd.path = *it++;
-      while (it != end) {
-        if (*it == std::string(CREATE)) {
-          cmd.options[*it++];
-          continue;
-        }
-        if (*it == std::string(QUIET)) {
-          cmd.options[*it++];
-          continue;
-        }
-        if (*it == std::string(BS)) {
-          const auto option = *it++;
-          mt::check<E>(it != end, "No value given for '%s'", option);
-          cmd.options[option] = *it++;
-          continue;
-        }
-        if (*it == std::string(NPARTS)) {
-          const auto option = *it++;
-          mt::check<E>(it != end, "No value given for '%s'", option);
-          cmd.options[option] = *it++;
-          continue;
-        }
-        mt::fail<E>("Expected option when reading '%s'", *it);
+    }
+    while (it != end) {
+      if (isFlag(*it)) {
+        cmd.options[*it++];
+        continue;
+      }
+      if (isOption(*it)) {
+        const auto option = *it++;
+        mt::check<E>(it != end, "No value given for '%s'", option);
+        cmd.options[option] = *it++;
+        continue;
       }
+      mt::fail<E>("Expected option when reading '%s'", *it);
     }
   }
   return cmd;
 }
 
-multimap::Options initOptions(const CommandLine& cmd) {
-  multimap::Options options;
+multimap::Map::Options initOptions(const CommandLine& cmd) {
+  multimap::Map::Options options;
   options.create_if_missing = cmd.options.count(CREATE);
   options.quiet = cmd.options.count(QUIET);
+  options.compress = cmd.options.count(COMPRESS);
+  options.checksums = cmd.options.count(CHECKSUMS);
+  options.tune = cmd.options.count(TUNE);
   if (cmd.options.count(BS)) {
     options.block_size = std::stoul(cmd.options.at(BS));
   }
   if (cmd.options.count(NPARTS)) {
     options.num_partitions = std::stoul(cmd.options.at(NPARTS));
   }
+  if (cmd.options.count(THREADS)) {
+    options.num_threads = std::stoul(cmd.options.at(THREADS));
+  }
   return options;
 }
 
 void runHelpCommand(const char* toolname) {
   // clang-format off
-  const multimap::Options default_options{};
+  const multimap::Map::Options default_options{};
+  const multimap::internal::Workload::Options default_workload;
   std::printf(
       "USAGE\n"
       "\n  %s COMMAND path/to/map [PATH] [OPTIONS]"
@@ -124,24 +143,54 @@ void runHelpCommand(const char* toolname) {
       "\n  %-10s     Print this help message and exit."
       "\n  %-10s     Print statistics about an instance."
       "\n  %-10s     Import key-value pairs in Base64 encoding from text files."
-      "\n  %-10s     Export key-value pairs in Base64 encoding to a text file."
+      "\n  %-10s     Export key-value pairs in Base64 encoding to text files."
       "\n  %-10s     Rewrite an instance performing various optimizations."
+      "\n  %-10s     Check the lists and blocks of an instance, including"
+      "\n                 their checksums if any."
+      "\n  %-10s     Run the workload of multimap-workload against an"
+      "\n                 instance and report throughput and latencies."
       "\n\nOPTIONS\n"
-      "\n  %-9s      Create a new instance if missing when importing data."
+      "\n  %-9s      Import or export key-value pairs in binary format."
+      "\n  %-11s    Maintain block checksums when importing data."
+      "\n  %-10s     Compress a binary export or an optimized instance."
+      "\n  %-9s      Create a new instance if missing when importing data"
+      "\n                 or benchmarking."
+      "\n  %-9s      Print the statistics that an instance opened with"
+      "\n                 live stats has published last, while it is open."
       "\n  %-9s NUM  Block size to use for a new instance. Default is %u."
       "\n  %-9s NUM  Number of partitions to use for a new instance."
       " Default is %u."
       "\n  %-9s      Don't print out any status messages."
+      "\n  %-9s NUM  Number of threads to import, export, optimize, or"
+      "\n                 verify with, or of benchmark clients. Default is"
+      " one per"
+      "\n                 hardware thread, or 1 for benchmarks."
+      "\n  %-9s NUM  Number of keys to benchmark with. Default is %" PRIu64 "."
+      "\n  %-9s NUM  Number of benchmark operations. Default is %" PRIu64 "."
+      "\n  %-9s NUM  Fraction of reads in [0, 1] of a benchmark."
+      " Default is %.2f."
+      "\n  %-9s      Recommend a block size and number of partitions from"
+      "\n                 the statistics and metrics of an instance, or"
+      " optimize"
+      "\n                 with the recommended ones unless given."
       "\n\nEXAMPLES\n"
       "\n  %s %-8s path/to/map"
+      "\n  %s %-8s path/to/map %s"
+      "\n  %s %-8s path/to/map %s"
       "\n  %s %-8s path/to/map path/to/input"
       "\n  %s %-8s path/to/map path/to/input.csv"
       "\n  %s %-8s path/to/map path/to/input.csv %s"
+      "\n  %s %-8s path/to/map path/to/input.bin %s"
+      "\n  %s %-8s path/to/map path/to/input %s"
       "\n  %s %-8s path/to/map path/to/output.csv"
+      "\n  %s %-8s path/to/map path/to/output.bin %s %s"
       "\n  %s %-8s path/to/map path/to/output"
       "\n  %s %-8s path/to/map path/to/output %s 128"
       "\n  %s %-8s path/to/map path/to/output %s 42"
       "\n  %s %-8s path/to/map path/to/output %s 42 %s 128"
+      "\n  %s %-8s path/to/map path/to/output %s"
+      "\n  %s %-8s path/to/map %s 8"
+      "\n  %s %-8s path/to/map %s %s 8 %s 0.5"
       "\n\n"
       "\nCopyright (C) 2015-2016 Martin Trenkmann"
       "\n<http://multimap.io>\n",
@@ -151,24 +200,64 @@ void runHelpCommand(const char* toolname) {
       IMPORT,
       EXPORT,
       OPTIMIZE,
+      VERIFY,
+      BENCH,
+      BINARY,
+      CHECKSUMS,
+      COMPRESS,
       CREATE,
+      LIVE,
       BS, default_options.block_size,
       NPARTS, default_options.num_partitions,
       QUIET,
+      THREADS,
+      KEYS, default_workload.num_keys,
+      OPS, default_workload.num_ops,
+      READS, default_workload.read_ratio,
+      TUNE,
       toolname, STATS,
+      toolname, STATS, LIVE,
+      toolname, STATS, TUNE,
       toolname, IMPORT,
       toolname, IMPORT,
       toolname, IMPORT, CREATE,
+      toolname, IMPORT, BINARY,
+      toolname, IMPORT, CHECKSUMS,
       toolname, EXPORT,
+      toolname, EXPORT, BINARY, COMPRESS,
       toolname, OPTIMIZE,
       toolname, OPTIMIZE, BS,
       toolname, OPTIMIZE, NPARTS,
-      toolname, OPTIMIZE, NPARTS, BS);
+      toolname, OPTIMIZE, NPARTS, BS,
+      toolname, OPTIMIZE, TUNE,
+      toolname, VERIFY, THREADS,
+      toolname, BENCH, CREATE, THREADS, READS);
   // clang-format on
 }
 
+void runTuneCommand(const CommandLine& cmd) {
+  const auto tuning =
+      multimap::Map::recommendOptions(cmd.map, initOptions(cmd));
+  for (const auto& reason : tuning.reasons) {
+    std::printf("%s\n", reason.c_str());
+  }
+  std::printf("\nRecommended: %s %" PRIu32 " %s %" PRIu32 "\n", BS,
+              tuning.block_size, NPARTS, tuning.num_partitions);
+}
+
 void runStatsCommand(const CommandLine& cmd) {
-  const auto stats = multimap::Map::stats(cmd.map);
+  if (cmd.options.count(TUNE)) {
+    runTuneCommand(cmd);
+    return;
+  }
+  const bool live = cmd.options.count(LIVE);
+  std::chrono::system_clock::time_point published;
+  const auto stats = live ? multimap::Map::liveStats(cmd.map, &published)
+                          : multimap::Map::stats(cmd.map);
+  if (stats.empty()) {
+    std::printf("No statistics have been published yet.\n");
+    return;
+  }
   const int first_column_width = std::to_string(stats.size()).size();
 
   const auto names = multimap::internal::Stats::names();
@@ -204,15 +293,51 @@ void runStatsCommand(const CommandLine& cmd) {
                 eq_signs(first_column_width).c_str(), second_column_width,
                 names[i].c_str(), third_column_width, totals[i]);
   }
+
+  if (live) {
+    const auto age = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now() - published);
+    std::printf("\nPublished %lld ms ago.\n",
+                static_cast<long long>(age.count()));
+    return;
+  }
+  // Metrics are only saved when the map is closed.
+
+  const auto metrics = multimap::Map::metrics(cmd.map).toVector();
+  if (std::all_of(metrics.begin(), metrics.end(),
+                  [](uint64_t value) { return value == 0; })) {
+    return;
+  }
+  // The metrics have been saved by a map opened with `Options::metrics`.
+  const auto& metric_names = multimap::Map::Metrics::names();
+  const int metric_column_width =
+      std::max_element(metric_names.begin(), metric_names.end(),
+                       [](const std::string& a, const std::string& b) {
+                         return a.size() < b.size();
+                       })->size();
+  std::printf("\n");
+  for (size_t i = 0; i != metrics.size(); ++i) {
+    std::printf("%-*s  %" PRIu64 "\n", metric_column_width,
+                metric_names[i].c_str(), metrics[i]);
+  }
 }
 
 void runImportCommand(const CommandLine& cmd) {
   const auto options = initOptions(cmd);
-  multimap::Map::importFromBase64(cmd.map, cmd.path, options);
+  if (cmd.options.count(BINARY)) {
+    multimap::Map::importFromBinary(cmd.map, cmd.path, options);
+  } else {
+    multimap::Map::importFromBase64(cmd.map, cmd.path, options);
+  }
 }
 
 void runExportCommand(const CommandLine& cmd) {
-  multimap::Map::exportToBase64(cmd.map, cmd.path);
+  const auto options = initOptions(cmd);
+  if (cmd.options.count(BINARY)) {
+    multimap::Map::exportToBinary(cmd.map, cmd.path, options);
+  } else {
+    multimap::Map::exportToBase64(cmd.map, cmd.path, options);
+  }
 }
 
 void runOptimizeCommand(const CommandLine& cmd) {
@@ -226,6 +351,68 @@ void runOptimizeCommand(const CommandLine& cmd) {
   multimap::Map::optimize(cmd.map, cmd.path, options);
 }
 
+bool runVerifyCommand(const CommandLine& cmd) {
+  const auto invalid_blocks =
+      multimap::Map::verifyLists(cmd.map, initOptions(cmd));
+  const int first_column_width = std::to_string(invalid_blocks.size()).size();
+  uint64_t num_invalid_blocks = 0;
+  for (uint32_t i = 0; i != invalid_blocks.size(); ++i) {
+    std::printf("#%-*" PRIu32 "  ", first_column_width, i);
+    if (invalid_blocks[i].empty()) {
+      std::printf("OK\n");
+      continue;
+    }
+    std::printf("%zu invalid blocks:", invalid_blocks[i].size());
+    for (const auto id : invalid_blocks[i]) {
+      std::printf(" %" PRIu32, id);
+    }
+    std::printf("\n");
+    num_invalid_blocks += invalid_blocks[i].size();
+  }
+  return num_invalid_blocks == 0;
+}
+
+void runBenchCommand(const CommandLine& cmd) {
+  typedef multimap::internal::Workload Workload;
+  using E = CommandLine::Error;
+  Workload::Options workload;
+  if (cmd.options.count(THREADS)) {
+    workload.num_threads = std::stoul(cmd.options.at(THREADS));
+    mt::check<E>(workload.num_threads != 0, "Expected at least 1 thread");
+  }
+  if (cmd.options.count(KEYS)) {
+    workload.num_keys = std::stoull(cmd.options.at(KEYS));
+    mt::check<E>(workload.num_keys >= 2, "Expected at least 2 keys");
+  }
+  if (cmd.options.count(OPS)) {
+    workload.num_ops = std::stoull(cmd.options.at(OPS));
+  }
+  if (cmd.options.count(READS)) {
+    workload.read_ratio = std::stod(cmd.options.at(READS));
+    mt::check<E>(workload.read_ratio >= 0 && workload.read_ratio <= 1,
+                 "Invalid ratio of reads '%s'",
+                 cmd.options.at(READS).c_str());
+  }
+
+  const bool exists = boost::filesystem::exists(
+      boost::filesystem::path(cmd.map) / multimap::Map::getNameOfIdFile());
+  auto options = initOptions(cmd);
+  options.quiet = true;
+  options.live_stats_interval = 1000;
+  // The benchmark can be watched via the stats command with --live.
+  multimap::Map map(cmd.map, options);
+  if (!exists) {
+    const auto seconds = Workload::load(&map, workload);
+    Workload::printThroughput("load", workload.num_keys * workload.list_length,
+                              seconds);
+  }
+  multimap::internal::Metrics metrics;
+  const auto seconds = Workload::run(&map, workload, &metrics);
+  Workload::printThroughput("run", workload.num_ops, seconds);
+  Workload::printLatencies(metrics);
+}
+// The load phase is skipped if the map already exists.
+
 int main(int argc, const char** argv) {
   if (argc < 2) {
     runHelpCommand(*argv);
@@ -260,6 +447,15 @@ int main(int argc, const char** argv) {
       return EXIT_SUCCESS;
     }
 
+    if (cmd.command == VERIFY) {
+      return runVerifyCommand(cmd) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (cmd.command == BENCH) {
+      runBenchCommand(cmd);
+      return EXIT_SUCCESS;
+    }
+
   } catch (CommandLine::Error& error) {
     std::cerr << "Invalid command line: " << error.what() << '.' << "\nTry '"
               << *argv << ' ' << HELP << "'." << std::endl;
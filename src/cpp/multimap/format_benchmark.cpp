@@ -0,0 +1,343 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/filesystem/operations.hpp>
+#include <multimap/internal/Metrics.hpp>
+#include <multimap/thirdparty/mt/mt.hpp>
+#include <multimap/FrozenMap.hpp>
+#include <multimap/Map.hpp>
+
+// clang-format off
+const auto BINARY = "--binary";
+const auto BS     = "--bs";
+const auto GETS   = "--gets";
+const auto HELP   = "--help";
+const auto KEEP   = "--keep";
+const auto SEED   = "--seed";
+// clang-format on
+
+typedef multimap::internal::Metrics Metrics;
+
+struct CommandLine {
+  struct Error : public std::runtime_error {
+    Error(const std::string& what) : std::runtime_error(what) {}
+  };
+
+  std::string sample;
+  std::string workdir;
+  bool binary = false;
+  bool keep = false;
+  std::vector<uint32_t> block_sizes = {multimap::Map::Options().block_size};
+  uint64_t num_gets = 100000;
+  uint64_t seed = 1;
+};
+
+struct Format {
+  std::string name;
+  uint32_t block_size;
+  // Zero for the frozen format, which has no blocks.
+  boost::filesystem::path directory;
+};
+
+struct Result {
+  double build_seconds = 0;
+  double open_seconds = 0;
+  uint64_t disk_size = 0;
+  Metrics::Histogram gets;
+  double scan_seconds = 0;
+  uint64_t scan_bytes = 0;
+};
+
+CommandLine parseCommandLine(int argc, const char** argv) {
+  CommandLine cmd;
+  const auto end = std::next(argv, argc);
+  auto it = std::next(argv);
+
+  using E = CommandLine::Error;
+  mt::check<E>(it != end, "No SAMPLE given");
+  cmd.sample = *it++;
+  mt::check<E>(it != end, "No WORKDIR given");
+  cmd.workdir = *it++;
+  while (it != end) {
+    const std::string option = *it++;
+    if (option == BINARY) {
+      cmd.binary = true;
+      continue;
+    }
+    if (option == KEEP) {
+      cmd.keep = true;
+      continue;
+    }
+    mt::check<E>(it != end, "No value given for '%s'", option.c_str());
+    const std::string value = *it++;
+    if (option == BS) {
+      cmd.block_sizes.clear();
+      std::istringstream stream(value);
+      std::string block_size;
+      while (std::getline(stream, block_size, ',')) {
+        cmd.block_sizes.push_back(std::stoul(block_size));
+        mt::check<E>(cmd.block_sizes.back() != 0, "Invalid block size '%s'",
+                     block_size.c_str());
+      }
+      mt::check<E>(!cmd.block_sizes.empty(), "No block size given");
+    } else if (option == GETS) {
+      cmd.num_gets = std::stoull(value);
+    } else if (option == SEED) {
+      cmd.seed = std::stoull(value);
+    } else {
+      mt::fail<E>("Expected option when reading '%s'", option.c_str());
+    }
+  }
+  return cmd;
+}
+
+void runHelpCommand(const char* toolname) {
+  // clang-format off
+  const CommandLine defaults;
+  std::printf(
+      "USAGE\n"
+      "\n  %s path/to/sample path/to/workdir [OPTIONS]"
+      "\n\nBuilds a map from a sample of data in each on-disk format and"
+      "\nreports build time, disk size, open time, latency of random gets,"
+      "\nwhich iterate all values of a key, and scan throughput side by side."
+      "\nThe sample is a file or directory written by the export command of"
+      "\nthe command line tool.  For each block size the formats are"
+      "\n\n  plain         Written by import."
+      "\n  front-coded   Written by import with front coding."
+      "\n  checksums     Written by import with checksums, verified on read."
+      "\n  compressed    Written by optimize from the plain map."
+      "\n\nfollowed by the frozen format, which is written by optimize from"
+      "\na plain map.  Build times of formats written by optimize do"
+      "\nnot include the import.  Reads see the page cache as left by the"
+      "\nbuild.  WORKDIR must not exist and is removed afterwards."
+      "\n\nOPTIONS\n"
+      "\n  %-8s       The sample has been exported with --binary."
+      "\n  %-8s LIST  Comma-separated block sizes. Default is %u."
+      "\n  %-8s NUM   Number of random gets per format. Default is %" PRIu64 "."
+      "\n  %-8s       Keep the maps in WORKDIR."
+      "\n  %-8s NUM   Seed for choosing keys to get. Default is %" PRIu64 "."
+      "\n\nEXAMPLES\n"
+      "\n  %s path/to/sample path/to/workdir"
+      "\n  %s path/to/sample path/to/workdir %s 256,1024,4096 %s"
+      "\n\n"
+      "\nCopyright (C) 2015-2016 Martin Trenkmann"
+      "\n<http://multimap.io>\n",
+      toolname,
+      BINARY,
+      BS, defaults.block_sizes.front(),
+      GETS, defaults.num_gets,
+      KEEP,
+      SEED, defaults.seed,
+      toolname,
+      toolname, BS, BINARY);
+  // clang-format on
+}
+
+template <typename Function>
+double measure(Function function) {
+  const auto start = std::chrono::steady_clock::now();
+  function();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double>(elapsed).count();
+}
+// Returns the time elapsed in seconds.
+
+uint64_t getDiskSize(const boost::filesystem::path& directory) {
+  uint64_t size = 0;
+  boost::filesystem::recursive_directory_iterator it(directory), end;
+  for (; it != end; ++it) {
+    if (boost::filesystem::is_regular_file(it->status())) {
+      size += boost::filesystem::file_size(it->path());
+    }
+  }
+  return size;
+}
+
+std::vector<std::string> chooseKeys(const boost::filesystem::path& directory,
+                                    const CommandLine& cmd) {
+  multimap::Map::Options options;
+  options.readonly = true;
+  options.quiet = true;
+  const multimap::Map map(directory, options);
+  std::vector<std::string> keys;
+  map.forEachKey(
+      [&keys](const multimap::Bytes& key) { keys.push_back(key.toString()); });
+  mt::Check::isFalse(keys.empty(), "The sample has no keys");
+  std::vector<std::string> chosen;
+  chosen.reserve(cmd.num_gets);
+  std::default_random_engine engine(cmd.seed);
+  std::uniform_int_distribution<size_t> index(0, keys.size() - 1);
+  for (uint64_t i = 0; i != cmd.num_gets; ++i) {
+    chosen.push_back(keys[index(engine)]);
+  }
+  return chosen;
+}
+// Returns `cmd.num_gets` keys of the map chosen uniformly at random.
+
+template <typename MapType>
+void measureReads(const MapType& map, const std::vector<std::string>& keys,
+                  Result* result) {
+  Metrics metrics;
+  for (const auto& key : keys) {
+    const Metrics::Timer timer(&metrics, Metrics::Operation::GET);
+    const auto iter = map.get(key);
+    while (iter && iter->hasNext()) {
+      iter->next();
+    }
+  }
+  result->gets = metrics.getSnapshot().get(Metrics::Operation::GET);
+  uint64_t num_bytes = 0;
+  result->scan_seconds = measure([&map, &num_bytes] {
+    map.forEachEntry(
+        [&num_bytes](const multimap::Bytes& key, multimap::Iterator* iter) {
+          num_bytes += key.size();
+          while (iter->hasNext()) {
+            num_bytes += iter->next().size();
+          }
+        });
+  });
+  result->scan_bytes = num_bytes;
+}
+
+void build(const Format& format, const Format* plain, const CommandLine& cmd,
+           Result* result) {
+  boost::filesystem::create_directories(format.directory);
+  multimap::Map::Options options;
+  options.quiet = true;
+  if (plain) {
+    // Compressed and frozen maps can only be written by `optimize()`.
+    options.keepBlockSize();
+    options.keepNumPartitions();
+    options.compress = format.name == "compressed";
+    options.frozen = format.name == "frozen";
+    result->build_seconds = measure([&] {
+      multimap::Map::optimize(plain->directory, format.directory, options);
+    });
+  } else {
+    options.create_if_missing = true;
+    options.block_size = format.block_size;
+    options.front_coding = format.name == "front-coded";
+    options.checksums = format.name == "checksums";
+    result->build_seconds = measure([&] {
+      if (cmd.binary) {
+        multimap::Map::importFromBinary(format.directory, cmd.sample, options);
+      } else {
+        multimap::Map::importFromBase64(format.directory, cmd.sample, options);
+      }
+    });
+  }
+  result->disk_size = getDiskSize(format.directory);
+}
+
+void open(const Format& format, const std::vector<std::string>& keys,
+          Result* result) {
+  if (format.name == "frozen") {
+    std::unique_ptr<multimap::FrozenMap> map;
+    result->open_seconds = measure(
+        [&] { map.reset(new multimap::FrozenMap(format.directory)); });
+    measureReads(*map, keys, result);
+  } else {
+    multimap::Map::Options options;
+    options.readonly = true;
+    options.quiet = true;
+    std::unique_ptr<multimap::Map> map;
+    result->open_seconds = measure(
+        [&] { map.reset(new multimap::Map(format.directory, options)); });
+    measureReads(*map, keys, result);
+  }
+}
+
+void printResult(const Format& format, const Result& result) {
+  const auto block_size =
+      format.block_size ? std::to_string(format.block_size) : "-";
+  std::printf("%-12s %6s %10.3f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+              format.name.c_str(), block_size.c_str(), result.build_seconds,
+              result.disk_size / double(mt::MiB(1)),
+              result.open_seconds * 1e3, result.gets.quantile(0.5) / 1e3,
+              result.gets.quantile(0.99) / 1e3,
+              result.scan_bytes / double(mt::MiB(1)) / result.scan_seconds);
+  std::fflush(stdout);
+}
+
+void runBenchmark(const CommandLine& cmd) {
+  const boost::filesystem::path workdir = cmd.workdir;
+  mt::Check::isFalse(boost::filesystem::exists(workdir),
+                     "'%s' already exists", workdir.c_str());
+  std::vector<Format> formats;
+  const auto names = {"plain", "front-coded", "checksums", "compressed"};
+  for (const auto block_size : cmd.block_sizes) {
+    for (const auto name : names) {
+      const auto directory =
+          workdir / (name + std::string("-") + std::to_string(block_size));
+      formats.push_back(Format{name, block_size, directory});
+    }
+  }
+  formats.push_back(Format{"frozen", 0, workdir / "frozen"});
+
+  std::printf("%-12s %6s %10s %10s %10s %10s %10s %10s\n", "format", "bs",
+              "build s", "size MiB", "open ms", "get p50 us", "get p99 us",
+              "scan MiB/s");
+  std::vector<std::string> keys;
+  const Format* plain = nullptr;
+  for (const auto& format : formats) {
+    Result result;
+    if (format.name == "plain") {
+      build(format, nullptr, cmd, &result);
+      plain = &format;
+    } else if (format.name == "compressed" || format.name == "frozen") {
+      build(format, plain, cmd, &result);
+    } else {
+      build(format, nullptr, cmd, &result);
+    }
+    if (keys.empty()) keys = chooseKeys(format.directory, cmd);
+    open(format, keys, &result);
+    printResult(format, result);
+  }
+  if (!cmd.keep) {
+    boost::filesystem::remove_all(workdir);
+  }
+}
+
+int main(int argc, const char** argv) {
+  if (argc < 2 || argv[1] == std::string(HELP)) {
+    runHelpCommand(*argv);
+    return argc < 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  try {
+    runBenchmark(parseCommandLine(argc, argv));
+    return EXIT_SUCCESS;
+
+  } catch (CommandLine::Error& error) {
+    std::cerr << "Invalid command line: " << error.what() << '.' << "\nTry '"
+              << *argv << ' ' << HELP << "'." << std::endl;
+
+  } catch (std::exception& error) {
+    std::cerr << error.what() << '.' << std::endl;
+  }
+
+  return EXIT_FAILURE;
+}
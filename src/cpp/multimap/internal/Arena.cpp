@@ -20,24 +20,52 @@
 namespace multimap {
 namespace internal {
 
-Arena::Arena(uint32_t chunk_size) : chunk_size_(chunk_size) {
+namespace {
+
+std::atomic<uint64_t> next_arena_id(1);
+
+}  // namespace
+
+const size_t Arena::NUM_THREAD_CHUNKS;
+
+Arena::Arena(uint32_t chunk_size, bool thread_local_chunks)
+    : chunk_size_(chunk_size),
+      id_(next_arena_id++),
+      thread_local_chunks_(thread_local_chunks) {
   MT_REQUIRE_TRUE(mt::isPowerOfTwo(chunk_size_));
   MT_REQUIRE_NOT_ZERO(chunk_size_);
 }
 
 char* Arena::allocate(uint32_t num_bytes) {
   MT_REQUIRE_NOT_ZERO(num_bytes);
+  const auto use_thread_chunk = thread_local_chunks_ && num_bytes <= chunk_size_;
+  if (use_thread_chunk && reusable_.load() == 0) {
+    if (const auto result = allocateFromThreadChunk(num_bytes)) {
+      return result;
+    }
+  }
   std::lock_guard<std::mutex> lock(mutex_);
 
   char* result;
-  if (num_bytes <= chunk_size_) {
-    if (chunks_.empty()) {
-      chunks_.emplace_back(new char[chunk_size_]);
-      chunk_offset_ = 0;
+  const auto free_list = free_lists_.find(num_bytes);
+  if (free_list != free_lists_.end() && !free_list->second.empty()) {
+    result = free_list->second.back();
+    free_list->second.pop_back();
+    reusable_ -= num_bytes;
+
+  } else if (use_thread_chunk) {
+    auto& chunk = getThreadChunk(id_);
+    if (chunk.arena_id != id_ || num_bytes > chunk_size_ - chunk.offset) {
+      chunk.arena_id = id_;
+      chunk.data = allocateChunkUnlocked();
+      chunk.offset = 0;
     }
-    const auto num_bytes_free = chunk_size_ - chunk_offset_;
-    if (num_bytes > num_bytes_free) {
-      chunks_.emplace_back(new char[chunk_size_]);
+    result = chunk.data + chunk.offset;
+    chunk.offset += num_bytes;
+
+  } else if (num_bytes <= chunk_size_) {
+    if (chunks_.empty() || num_bytes > chunk_size_ - chunk_offset_) {
+      allocateChunkUnlocked();
       chunk_offset_ = 0;
     }
     result = chunks_.back().get() + chunk_offset_;
@@ -46,23 +74,64 @@ char* Arena::allocate(uint32_t num_bytes) {
   } else {
     blobs_.emplace_back(new char[num_bytes]);
     result = blobs_.back().get();
+    reserved_ += num_bytes;
   }
 
   allocated_ += num_bytes;
   return result;
 }
 
-uint64_t Arena::allocated() const {
+void Arena::deallocate(char* data, uint32_t num_bytes) {
+  MT_REQUIRE_NOT_NULL(data);
+  MT_REQUIRE_NOT_ZERO(num_bytes);
+  std::lock_guard<std::mutex> lock(mutex_);
+  MT_ASSERT_GE(allocated_.load(), num_bytes);
+  free_lists_[num_bytes].push_back(data);
+  allocated_ -= num_bytes;
+  reusable_ += num_bytes;
+}
+
+uint64_t Arena::allocated() const { return allocated_.load(); }
+
+uint64_t Arena::reserved() const {
   std::lock_guard<std::mutex> lock(mutex_);
-  return allocated_;
+  return reserved_;
 }
 
+uint64_t Arena::reusable() const { return reusable_.load(); }
+
 void Arena::deallocateAll() {
   std::lock_guard<std::mutex> lock(mutex_);
   chunks_.clear();
   blobs_.clear();
+  free_lists_.clear();
   chunk_offset_ = 0;
+  id_ = next_arena_id++;
   allocated_ = 0;
+  reserved_ = 0;
+  reusable_ = 0;
+}
+
+Arena::ThreadChunk& Arena::getThreadChunk(uint64_t arena_id) {
+  static thread_local ThreadChunk chunks[NUM_THREAD_CHUNKS];
+  return chunks[arena_id % NUM_THREAD_CHUNKS];
+}
+
+char* Arena::allocateFromThreadChunk(uint32_t num_bytes) {
+  auto& chunk = getThreadChunk(id_);
+  if (chunk.arena_id != id_ || num_bytes > chunk_size_ - chunk.offset) {
+    return nullptr;
+  }
+  const auto result = chunk.data + chunk.offset;
+  chunk.offset += num_bytes;
+  allocated_ += num_bytes;
+  return result;
+}
+
+char* Arena::allocateChunkUnlocked() {
+  chunks_.emplace_back(new char[chunk_size_]);
+  reserved_ += chunk_size_;
+  return chunks_.back().get();
 }
 
 }  // namespace internal
@@ -18,8 +18,10 @@
 #ifndef MULTIMAP_INTERNAL_ARENA_HPP_INCLUDED
 #define MULTIMAP_INTERNAL_ARENA_HPP_INCLUDED
 
+#include <atomic>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
 #include <vector>
 #include "multimap/thirdparty/mt/mt.hpp"
 
@@ -27,26 +29,71 @@ namespace multimap {
 namespace internal {
 
 class Arena : public mt::Resource {
-  // Objects of this class are thread-safe.
+  // Allocations of up to `chunk_size` bytes are carved out of larger chunks,
+  // bigger ones are served by the system allocator.  Deallocated memory is
+  // kept in a free list per allocation size, which makes reusing the fixed
+  // size blocks of lists cheap.  Objects of this class are thread-safe.
 
  public:
   static const uint32_t DEFAULT_CHUNK_SIZE = 4096;
 
-  explicit Arena(uint32_t chunk_size = DEFAULT_CHUNK_SIZE);
+  explicit Arena(uint32_t chunk_size = DEFAULT_CHUNK_SIZE,
+                 bool thread_local_chunks = false);
+  // If `thread_local_chunks` is true, each thread carves its allocations out
+  // of a chunk of its own, so that allocation does not need to lock the
+  // arena unless a new chunk is needed or deallocated memory is available.
 
   char* allocate(uint32_t nbytes);
 
+  void deallocate(char* data, uint32_t nbytes);
+  // Returns memory obtained from `allocate(nbytes)` to the arena, so that it
+  // is reused by the next allocation of the same size.  The memory is not
+  // returned to the system before `deallocateAll()` is called.
+
   uint64_t allocated() const;
+  // Returns the number of bytes currently handed out by `allocate()`.
+
+  uint64_t reserved() const;
+  // Returns the number of bytes obtained from the system, which also covers
+  // unused parts of chunks and deallocated memory.
+
+  uint64_t reusable() const;
+  // Returns the number of bytes that have been deallocated and are kept in
+  // free lists for reuse.
 
   void deallocateAll();
+  // Must not be called concurrently with other member functions.
 
  private:
+  struct ThreadChunk {
+    uint64_t arena_id;
+    char* data;
+    uint32_t offset;
+  };
+
+  static const size_t NUM_THREAD_CHUNKS = 64;
+
+  static ThreadChunk& getThreadChunk(uint64_t arena_id);
+  // Returns the slot of the calling thread's cache that belongs to the arena
+  // with `arena_id`.  Arenas sharing a slot evict each other.
+
+  char* allocateFromThreadChunk(uint32_t num_bytes);
+
+  char* allocateChunkUnlocked();
+
   mutable std::mutex mutex_;
   std::vector<std::unique_ptr<char[]> > chunks_;
   std::vector<std::unique_ptr<char[]> > blobs_;
+  std::unordered_map<uint32_t, std::vector<char*> > free_lists_;
   uint32_t chunk_offset_ = 0;
   uint32_t chunk_size_ = 0;
-  uint64_t allocated_ = 0;
+  uint64_t id_ = 0;
+  // Identifies the chunks in thread caches that belong to this arena.  It is
+  // renewed by `deallocateAll()` to invalidate them.
+  bool thread_local_chunks_ = false;
+  std::atomic<uint64_t> allocated_{0};
+  uint64_t reserved_ = 0;
+  std::atomic<uint64_t> reusable_{0};
 };
 
 }  // namespace internal
@@ -15,9 +15,14 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstring>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <vector>
 #include "gmock/gmock.h"
 #include "multimap/internal/Arena.hpp"
+#include "multimap/internal/Benchmark.hpp"
 #include "multimap/thirdparty/mt/mt.hpp"
 
 namespace multimap {
@@ -56,5 +61,114 @@ TEST(ArenaTest, DefaultConstructedCanAllocateMemory) {
   ASSERT_EQ(arena.allocated(), 5131);
 }
 
+TEST(ArenaTest, AccountsForReservedAndReusableMemory) {
+  Arena arena(1024);
+  const auto block = arena.allocate(512);
+  ASSERT_EQ(arena.reserved(), 1024);
+  arena.allocate(2048);
+  ASSERT_EQ(arena.reserved(), 1024 + 2048);
+  arena.deallocate(block, 512);
+  ASSERT_EQ(arena.allocated(), 2048);
+  ASSERT_EQ(arena.reusable(), 512);
+  arena.allocate(512);
+  ASSERT_EQ(arena.reusable(), 0);
+  ASSERT_EQ(arena.reserved(), 1024 + 2048);
+  arena.deallocateAll();
+  ASSERT_EQ(arena.allocated(), 0);
+  ASSERT_EQ(arena.reserved(), 0);
+}
+
+TEST(ArenaTest, DeallocatedMemoryIsReusedForSameSize) {
+  Arena arena;
+  const auto small = arena.allocate(128);
+  const auto large = arena.allocate(5000);
+  arena.deallocate(small, 128);
+  arena.deallocate(large, 5000);
+  ASSERT_EQ(arena.allocated(), 0);
+  ASSERT_NE(arena.allocate(64), small);
+  ASSERT_EQ(arena.allocate(128), small);
+  ASSERT_EQ(arena.allocate(5000), large);
+  ASSERT_NE(arena.allocate(128), small);
+  ASSERT_EQ(arena.allocated(), 64 + 128 + 5000 + 128);
+}
+
+TEST(ArenaTest, ThreadLocalChunksAreNotShared) {
+  Arena arena(1024, true);
+  const auto a1 = arena.allocate(16);
+  const auto a2 = arena.allocate(16);
+  ASSERT_EQ(a2, a1 + 16);
+  char* b1 = nullptr;
+  std::thread([&] { b1 = arena.allocate(16); }).join();
+  ASSERT_EQ(arena.allocate(16), a2 + 16);
+  ASSERT_TRUE(b1 < a1 || b1 >= a1 + 1024);
+  ASSERT_EQ(arena.allocated(), 4 * 16);
+  ASSERT_EQ(arena.reserved(), 2 * 1024);
+}
+
+TEST(ArenaTest, ThreadLocalChunksReuseDeallocatedMemory) {
+  Arena arena(1024, true);
+  const auto block = arena.allocate(512);
+  arena.allocate(512);
+  arena.deallocate(block, 512);
+  ASSERT_EQ(arena.allocate(512), block);
+  ASSERT_EQ(arena.reusable(), 0);
+}
+
+TEST(ArenaTest, ThreadLocalChunksAreInvalidatedByDeallocateAll) {
+  Arena arena(1024, true);
+  arena.allocate(16);
+  arena.deallocateAll();
+  ASSERT_EQ(arena.reserved(), 0);
+  ASSERT_NE(arena.allocate(16), nullptr);
+  ASSERT_EQ(arena.allocated(), 16);
+  ASSERT_EQ(arena.reserved(), 1024);
+}
+
+TEST(ArenaTest, ThreadLocalChunksAllowConcurrentAllocation) {
+  Arena arena(1024, true);
+  const size_t num_threads = 4;
+  const size_t num_allocations = 10000;
+  std::vector<std::vector<char*> > results(num_threads);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i != num_threads; ++i) {
+    threads.emplace_back([&arena, &results, i] {
+      for (size_t j = 0; j != num_allocations; ++j) {
+        const auto data = arena.allocate(8);
+        std::memset(data, i, 8);
+        results[i].push_back(data);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(arena.allocated(), num_threads * num_allocations * 8);
+  for (size_t i = 0; i != num_threads; ++i) {
+    for (const auto data : results[i]) {
+      ASSERT_EQ(std::string(8, i), std::string(data, 8));
+    }
+  }
+}
+
+TEST(ArenaTest, DISABLED_BenchmarkAllocate) {
+  const uint32_t num_allocations = 1000000;
+  Arena arena;
+  char* data = nullptr;
+  Benchmark::run("Arena::allocate", num_allocations, [&] {
+    for (uint32_t i = 0; i != num_allocations; ++i) {
+      data = arena.allocate(16 + i % 32);
+    }
+  });
+  data = arena.allocate(47);
+  Benchmark::run("Arena::deallocate+allocate", num_allocations, [&] {
+    for (uint32_t i = 0; i != num_allocations; ++i) {
+      arena.deallocate(data, 47);
+      data = arena.allocate(47);
+    }
+  });
+  ASSERT_TRUE(data != nullptr);
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
 }  // namespace internal
 }  // namespace multimap
@@ -18,6 +18,7 @@
 #ifndef MULTIMAP_INTERNAL_BASE64_HPP_INCLUDED
 #define MULTIMAP_INTERNAL_BASE64_HPP_INCLUDED
 
+#include <string>
 #include "multimap/Bytes.hpp"
 
 namespace multimap {
@@ -39,6 +40,24 @@ struct Base64 {
   static void decode(const std::string& base64, std::string* binary);
   // Decodes a base64 string to binary data. std::string as the target type
   // is used as a self-managing byte buffer, it will contain binary data.
+  // Trailing padding characters are optional.  Throws `std::runtime_error`
+  // if the string contains other characters that are not in the alphabet.
+
+  static void decode(const char* data, size_t size, std::string* binary);
+  // Same as before, but without requiring a string.
+
+  enum class Implementation { SCALAR, SSSE3, AVX2, NEON };
+
+  static Implementation getImplementation();
+  // Returns the implementation in use, which is the fastest one supported by
+  // the CPU unless changed via `setImplementation()`.  Vectorized ones process
+  // blocks of 12 to 48 bytes and leave the rest to the scalar one.
+
+  static bool isSupported(Implementation implementation);
+
+  static void setImplementation(Implementation implementation);
+  // Meant for testing and benchmarking.  Must not be called concurrently with
+  // other functions of this class.  Requires: `isSupported(implementation)`.
 
   Base64() = delete;
 };
@@ -15,8 +15,12 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <chrono>
+#include <cstdio>
+#include <random>
 #include <string>
 #include <type_traits>
+#include <vector>
 #include "gmock/gmock.h"
 #include "multimap/internal/Base64.hpp"
 
@@ -150,5 +154,130 @@ TEST(Base64Test, DecodeTestStringF) {
   ASSERT_EQ(binary, TEST_STRING_F_BINARY);
 }
 
+TEST(Base64Test, DecodeAcceptsMissingPadding) {
+  std::string binary;
+  Base64::decode("YW55IGNhcm5hbCBwbGVhc3VyZS4", &binary);
+  ASSERT_EQ(binary, TEST_STRING_A_BINARY);
+  Base64::decode("YW55IGNhcm5hbCBwbGVhc3VyZQ", &binary);
+  ASSERT_EQ(binary, TEST_STRING_B_BINARY);
+}
+
+std::vector<Base64::Implementation> getSupportedImplementations() {
+  std::vector<Base64::Implementation> implementations;
+  for (const auto implementation :
+       {Base64::Implementation::SCALAR, Base64::Implementation::SSSE3,
+        Base64::Implementation::AVX2, Base64::Implementation::NEON}) {
+    if (Base64::isSupported(implementation)) {
+      implementations.push_back(implementation);
+    }
+  }
+  return implementations;
+}
+
+struct Base64TestWithImplementation
+    : public testing::TestWithParam<Base64::Implementation> {
+  void SetUp() override {
+    default_implementation = Base64::getImplementation();
+    if (Base64::isSupported(GetParam())) {
+      Base64::setImplementation(GetParam());
+    }
+  }
+
+  void TearDown() override {
+    Base64::setImplementation(default_implementation);
+  }
+
+  Base64::Implementation default_implementation =
+      Base64::Implementation::SCALAR;
+};
+
+TEST_P(Base64TestWithImplementation, EncodeAndDecodeTestStrings) {
+  if (!Base64::isSupported(GetParam())) return;
+  const std::pair<std::string, std::string> strings[] = {
+      {TEST_STRING_A_BINARY, TEST_STRING_A_BASE64},
+      {TEST_STRING_B_BINARY, TEST_STRING_B_BASE64},
+      {TEST_STRING_C_BINARY, TEST_STRING_C_BASE64},
+      {TEST_STRING_D_BINARY, TEST_STRING_D_BASE64},
+      {TEST_STRING_E_BINARY, TEST_STRING_E_BASE64},
+      {TEST_STRING_F_BINARY, TEST_STRING_F_BASE64}};
+  std::string result;
+  for (const auto& string : strings) {
+    Base64::encode(string.first, &result);
+    ASSERT_EQ(result, string.second);
+    Base64::decode(string.second, &result);
+    ASSERT_EQ(result, string.first);
+  }
+}
+
+TEST_P(Base64TestWithImplementation, EncodeAndDecodeRandomBytesOfAllSizes) {
+  if (!Base64::isSupported(GetParam())) return;
+  std::mt19937 random;
+  std::string binary;
+  std::string base64;
+  std::string expected;
+  std::string decoded;
+  for (size_t size = 0; size != 300; ++size) {
+    binary.resize(size);
+    for (auto& byte : binary) {
+      byte = random();
+    }
+    Base64::encode(binary, &base64);
+    Base64::setImplementation(Base64::Implementation::SCALAR);
+    Base64::encode(binary, &expected);
+    Base64::setImplementation(GetParam());
+    ASSERT_EQ(base64, expected);
+    Base64::decode(base64, &decoded);
+    ASSERT_EQ(decoded, binary);
+  }
+}
+
+TEST_P(Base64TestWithImplementation, DecodeThrowsOnInvalidCharacterAnywhere) {
+  if (!Base64::isSupported(GetParam())) return;
+  const auto base64 = Base64::encode(TEST_STRING_F_BINARY);
+  std::string binary;
+  for (const char invalid : {'*', '=', '\x80', '\xFF', '\0', ' '}) {
+    for (size_t i = 0; i != base64.size() - 2; ++i) {
+      auto corrupted = base64;
+      corrupted[i] = invalid;
+      ASSERT_THROW(Base64::decode(corrupted, &binary), std::runtime_error);
+    }
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(Parameterized, Base64TestWithImplementation,
+                        testing::Values(Base64::Implementation::SCALAR,
+                                        Base64::Implementation::SSSE3,
+                                        Base64::Implementation::AVX2,
+                                        Base64::Implementation::NEON));
+
+TEST(Base64Test, DISABLED_BenchmarkImplementations) {
+  std::mt19937 random;
+  std::string binary(mt::MiB(64), 0);
+  for (auto& byte : binary) {
+    byte = random();
+  }
+  const auto default_implementation = Base64::getImplementation();
+  const char* names[] = {"scalar", "SSSE3", "AVX2", "NEON"};
+  std::string base64;
+  std::string decoded;
+  for (const auto implementation : getSupportedImplementations()) {
+    Base64::setImplementation(implementation);
+    const auto start = std::chrono::steady_clock::now();
+    Base64::encode(binary, &base64);
+    const auto middle = std::chrono::steady_clock::now();
+    Base64::decode(base64, &decoded);
+    const auto end = std::chrono::steady_clock::now();
+    ASSERT_EQ(decoded, binary);
+    const auto toMiBPerSecond = [&](std::chrono::nanoseconds elapsed) {
+      return binary.size() / 1048576.0 / (elapsed.count() * 1e-9);
+    };
+    std::printf("%s: encode %.0f MiB/s, decode %.0f MiB/s\n",
+                names[static_cast<int>(implementation)],
+                toMiBPerSecond(middle - start), toMiBPerSecond(end - middle));
+  }
+  Base64::setImplementation(default_implementation);
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
 }  // namespace internal
 }  // namespace multimap
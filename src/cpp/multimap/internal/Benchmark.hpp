@@ -0,0 +1,57 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_BENCHMARK_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_BENCHMARK_HPP_INCLUDED
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+namespace multimap {
+namespace internal {
+
+class Benchmark {
+  // Times a function that performs a number of operations and prints one
+  // line with the time per operation and the throughput, so that the output
+  // of runs for different commits can be compared line by line.  The
+  // benchmarks are disabled tests, which target multimap-bench runs.
+
+ public:
+  template <typename Function>
+  static double run(const char* name, uint64_t num_operations,
+                    Function function) {
+    const auto start = std::chrono::steady_clock::now();
+    function();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const double nanoseconds =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    const auto ns_per_op = nanoseconds / num_operations;
+    std::printf("%-40s %12.1f ns/op %14.0f ops/s\n", name, ns_per_op,
+                1e9 / ns_per_op);
+    return ns_per_op;
+  }
+  // Returns the time per operation in nanoseconds.
+  // Requires: `num_operations != 0`.
+
+  Benchmark() = delete;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_BENCHMARK_HPP_INCLUDED
@@ -57,6 +57,11 @@ class BasicBlock {
 
   void rewind() { offset_ = 0; }
 
+  void seek(size_t offset) {
+    MT_REQUIRE_LE(offset, size_);
+    offset_ = offset;
+  }
+
   size_t readData(char* target, size_t size) {
     MT_REQUIRE_NOT_NULL(data_);
     const auto nbytes = std::min(size, remaining());
@@ -68,6 +73,17 @@ class BasicBlock {
   // Returns the number of bytes actually copied which may be less than `size`.
   // Returns 0 if nothing could be extracted.
 
+  const char* readDataInPlace(size_t size) {
+    MT_REQUIRE_NOT_NULL(data_);
+    if (size > remaining()) return nullptr;
+    const char* result = current();
+    offset_ += size;
+    return result;
+  }
+  // Returns a pointer to the next `size` bytes without copying them, if they
+  // are entirely contained in the block.  Returns `nullptr` otherwise, in
+  // which case the offset is not changed and `readData()` should be used.
+
   size_t readSizeWithFlag(uint32_t* size, bool* flag) {
     MT_REQUIRE_NOT_NULL(data_);
     const auto nbytes =
@@ -79,6 +95,16 @@ class BasicBlock {
   // Returns the number of bytes copied.
   // Returns 0 if nothing could be extracted.
 
+  size_t readUint(uint32_t* value) {
+    MT_REQUIRE_NOT_NULL(data_);
+    const auto nbytes = Varint::readUint(current(), remaining(), value);
+    offset_ += nbytes;
+    return nbytes;
+  }
+  // Reads a 32-bit unsigned integer from the stream.
+  // Returns the number of bytes copied.
+  // Returns 0 if nothing could be extracted.
+
   // ---------------------------------------------------------------------------
   // The following interface is only enabled if IsReadOnly is true.
   // ---------------------------------------------------------------------------
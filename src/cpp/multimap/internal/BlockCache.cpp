@@ -0,0 +1,88 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/BlockCache.hpp"
+
+#include <cstring>
+
+namespace multimap {
+namespace internal {
+
+BlockCache::BlockCache(uint64_t capacity, uint32_t block_size)
+    : block_size_(block_size) {
+  MT_REQUIRE_NOT_ZERO(block_size);
+  const auto num_blocks_per_shard = capacity / block_size / NUM_SHARDS;
+  for (auto& shard : shards_) {
+    shard.capacity = num_blocks_per_shard;
+    shard.data.reset(new char[num_blocks_per_shard * block_size]);
+    shard.slots.reserve(num_blocks_per_shard);
+  }
+}
+
+bool BlockCache::get(uint64_t key, char* block) const {
+  auto& shard = getShard(key);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  const auto iter = shard.slots_by_key.find(key);
+  if (iter == shard.slots_by_key.end()) return false;
+  shard.slots[iter->second].referenced = true;
+  std::memcpy(block, shard.data.get() + iter->second * block_size_,
+              block_size_);
+  return true;
+}
+
+void BlockCache::put(uint64_t key, const char* block) {
+  auto& shard = getShard(key);
+  if (shard.capacity == 0) return;
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (shard.slots_by_key.count(key) != 0) return;
+  size_t index = shard.slots.size();
+  if (index != shard.capacity) {
+    shard.slots.emplace_back();
+  } else {
+    while (shard.slots[shard.hand].referenced) {
+      shard.slots[shard.hand].referenced = false;
+      shard.hand = (shard.hand + 1) % shard.capacity;
+    }
+    index = shard.hand;
+    shard.hand = (shard.hand + 1) % shard.capacity;
+    shard.slots_by_key.erase(shard.slots[index].key);
+  }
+  shard.slots[index].key = key;
+  shard.slots[index].referenced = false;
+  shard.slots_by_key[key] = index;
+  std::memcpy(shard.data.get() + index * block_size_, block, block_size_);
+}
+
+std::vector<uint64_t> BlockCache::getKeys() const {
+  std::vector<uint64_t> keys;
+  for (auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    for (const auto& entry : shard.slots_by_key) {
+      keys.push_back(entry.first);
+    }
+  }
+  return keys;
+}
+
+BlockCache::Shard& BlockCache::getShard(uint64_t key) const {
+  // Fibonacci hashing, so that consecutive keys go to different shards.
+  static_assert(NUM_SHARDS == 16, "Shift must match the number of shards");
+  return shards_[(key * 0x9e3779b97f4a7c15ULL) >> 60];
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,84 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_BLOCK_CACHE_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_BLOCK_CACHE_HPP_INCLUDED
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "multimap/thirdparty/mt/mt.hpp"
+
+namespace multimap {
+namespace internal {
+
+class BlockCache : public mt::Resource {
+  // A size-bounded cache of fixed-size blocks that is split into shards with
+  // their own lock, so that concurrent readers rarely contend.  Each shard
+  // evicts blocks with the CLOCK algorithm: a block that is hit gets its
+  // reference bit set, and the clock hand evicts the next block whose bit is
+  // not set, clearing the bits it passes.  This approximates LRU without
+  // reordering anything on a hit.  Objects of this class are thread-safe.
+  //
+  // A single cache can be shared by several stores, which then must use
+  // disjoint keys, e.g. by combining an id of the store and the block id.
+
+ public:
+  static const size_t NUM_SHARDS = 16;
+
+  BlockCache(uint64_t capacity, uint32_t block_size);
+  // `capacity` is the maximum number of bytes held by all cached blocks.
+
+  bool get(uint64_t key, char* block) const;
+  // Copies the block cached for `key` to `block` and returns `true`, or
+  // returns `false` if there is no such block.
+
+  void put(uint64_t key, const char* block);
+  // Inserts a copy of `block` for `key`, possibly evicting another block.
+  // Does nothing if a block for `key` is already cached.
+
+  std::vector<uint64_t> getKeys() const;
+  // Returns the keys of all cached blocks in no particular order.
+
+  uint32_t getBlockSize() const { return block_size_; }
+
+ private:
+  struct Shard {
+    struct Slot {
+      uint64_t key = 0;
+      bool referenced = false;
+    };
+
+    std::mutex mutex;
+    std::unordered_map<uint64_t, size_t> slots_by_key;
+    std::vector<Slot> slots;
+    std::unique_ptr<char[]> data;
+    size_t capacity = 0;  // Maximum number of slots.
+    size_t hand = 0;
+  };
+
+  Shard& getShard(uint64_t key) const;
+
+  mutable Shard shards_[NUM_SHARDS];
+  const uint32_t block_size_;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_BLOCK_CACHE_HPP_INCLUDED
@@ -0,0 +1,104 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <type_traits>
+#include <vector>
+#include "gmock/gmock.h"
+#include "multimap/internal/BlockCache.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+
+const uint32_t BLOCK_SIZE = 64;
+
+std::vector<char> makeBlock(uint64_t key) {
+  return std::vector<char>(BLOCK_SIZE, static_cast<char>('a' + key % 26));
+}
+
+TEST(BlockCacheTest, IsNotDefaultConstructible) {
+  ASSERT_FALSE(std::is_default_constructible<BlockCache>::value);
+}
+
+TEST(BlockCacheTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<BlockCache>::value);
+  ASSERT_FALSE(std::is_copy_assignable<BlockCache>::value);
+}
+
+TEST(BlockCacheTest, GetReturnsBlocksThatHaveBeenPut) {
+  BlockCache cache(mt::MiB(1), BLOCK_SIZE);
+  std::vector<char> block(BLOCK_SIZE);
+  for (uint64_t key = 0; key != 1000; ++key) {
+    ASSERT_FALSE(cache.get(key, block.data()));
+    cache.put(key, makeBlock(key).data());
+  }
+  for (uint64_t key = 0; key != 1000; ++key) {
+    ASSERT_TRUE(cache.get(key, block.data()));
+    ASSERT_THAT(block, Eq(makeBlock(key)));
+  }
+}
+
+TEST(BlockCacheTest, SizeIsBoundedByCapacity) {
+  const uint64_t max_num_blocks = BlockCache::NUM_SHARDS * 4;
+  BlockCache cache(max_num_blocks * BLOCK_SIZE, BLOCK_SIZE);
+  for (uint64_t key = 0; key != max_num_blocks * 10; ++key) {
+    cache.put(key, makeBlock(key).data());
+  }
+  std::vector<char> block(BLOCK_SIZE);
+  uint64_t num_cached = 0;
+  for (uint64_t key = 0; key != max_num_blocks * 10; ++key) {
+    if (cache.get(key, block.data())) {
+      ASSERT_THAT(block, Eq(makeBlock(key)));
+      ++num_cached;
+    }
+  }
+  ASSERT_THAT(num_cached, testing::Le(max_num_blocks));
+  ASSERT_THAT(num_cached, testing::Gt(0));
+}
+
+TEST(BlockCacheTest, ReferencedBlocksAreEvictedLast) {
+  BlockCache cache(BlockCache::NUM_SHARDS * 2 * BLOCK_SIZE, BLOCK_SIZE);
+  const uint64_t hot_key = 0;
+  std::vector<char> block(BLOCK_SIZE);
+  cache.put(hot_key, makeBlock(hot_key).data());
+  for (uint64_t key = 1; key != 1000; ++key) {
+    ASSERT_TRUE(cache.get(hot_key, block.data()));
+    cache.put(key, makeBlock(key).data());
+  }
+  ASSERT_TRUE(cache.get(hot_key, block.data()));
+  ASSERT_THAT(block, Eq(makeBlock(hot_key)));
+}
+
+TEST(BlockCacheTest, PutDoesNotReplaceCachedBlock) {
+  BlockCache cache(mt::MiB(1), BLOCK_SIZE);
+  cache.put(1, makeBlock(1).data());
+  cache.put(1, makeBlock(2).data());
+  std::vector<char> block(BLOCK_SIZE);
+  ASSERT_TRUE(cache.get(1, block.data()));
+  ASSERT_THAT(block, Eq(makeBlock(1)));
+}
+
+TEST(BlockCacheTest, ZeroCapacityCachesNothing) {
+  BlockCache cache(0, BLOCK_SIZE);
+  cache.put(1, makeBlock(1).data());
+  std::vector<char> block(BLOCK_SIZE);
+  ASSERT_FALSE(cache.get(1, block.data()));
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -15,8 +15,11 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <string>
 #include <type_traits>
+#include <vector>
 #include "gmock/gmock.h"
+#include "multimap/internal/Benchmark.hpp"
 #include "multimap/internal/Block.hpp"
 #include "multimap/internal/Generator.hpp"
 
@@ -132,6 +135,23 @@ TEST(ReadWriteBlockTest, WriteValuesLargerThanBlockSize) {
   ASSERT_EQ(block.offset(), block.size());
 }
 
+TEST(ReadWriteBlockTest, ReadDataInPlaceReturnsPointerIntoBlock) {
+  char buf[512];
+  ReadWriteBlock block(buf, sizeof buf);
+  ASSERT_EQ(block.readDataInPlace(100), buf);
+  ASSERT_EQ(block.offset(), 100);
+  ASSERT_EQ(block.readDataInPlace(412), buf + 100);
+  ASSERT_EQ(block.remaining(), 0);
+}
+
+TEST(ReadWriteBlockTest, ReadDataInPlaceReturnsNullIfDataSpansBlock) {
+  char buf[512];
+  ReadWriteBlock block(buf, sizeof buf);
+  ASSERT_EQ(block.readDataInPlace(500), buf);
+  ASSERT_EQ(block.readDataInPlace(13), nullptr);
+  ASSERT_EQ(block.offset(), 500);
+}
+
 TEST(ReadWriteBlockTest, WriteValuesAndIterateOnce) {
   char buf[512];
   ReadWriteBlock block(buf, sizeof buf);
@@ -240,5 +260,44 @@ TEST(ExtendedReadWriteBlockTest, DefaultConstructedHasProperState) {
   ASSERT_FALSE(ExtendedReadWriteBlock().ignore);
 }
 
+TEST(ReadWriteBlockTest, DISABLED_BenchmarkWriteAndReadValues) {
+  const uint32_t num_rounds = 1000000;
+  const std::string value = "http://multimap.io/values/0123456789";
+  std::vector<char> buffer(512);
+  ReadWriteBlock block(buffer.data(), buffer.size());
+  const auto writeValues = [&block, &value] {
+    block.rewind();
+    uint32_t num_values = 0;
+    while (block.writeSizeWithFlag(value.size(), false) != 0 &&
+           block.writeData(value.data(), value.size()) == value.size()) {
+      ++num_values;
+    }
+    return num_values;
+  };
+  const auto num_values_per_block = writeValues();
+  const auto size = block.offset();
+  const auto num_values = num_rounds * num_values_per_block;
+
+  Benchmark::run("ReadWriteBlock::writeData", num_values, [&] {
+    for (uint32_t i = 0; i != num_rounds; ++i) {
+      writeValues();
+    }
+  });
+  uint64_t num_bytes = 0;
+  Benchmark::run("ReadOnlyBlock::readDataInPlace", num_values, [&] {
+    for (uint32_t i = 0; i != num_rounds; ++i) {
+      ReadOnlyBlock view(buffer.data(), size);
+      uint32_t value_size = 0;
+      bool flag = false;
+      for (uint32_t j = 0; j != num_values_per_block; ++j) {
+        view.readSizeWithFlag(&value_size, &flag);
+        num_bytes += view.readDataInPlace(value_size) != nullptr;
+      }
+    }
+  });
+  ASSERT_EQ(num_bytes, num_values);
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
 }  // namespace internal
 }  // namespace multimap
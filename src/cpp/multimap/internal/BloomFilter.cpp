@@ -0,0 +1,185 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/BloomFilter.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <boost/filesystem/operations.hpp>
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+// A filter file consists of a header followed by `num_blocks` blocks of
+// `WORDS_PER_BLOCK` words.
+
+const uint64_t FORMAT_VERSION = 2;
+// Version 2 selects blocks via the lower half of the hash value.  Files of
+// version 1 have a smaller header and are rejected by `open()`.
+
+struct Header {
+  uint64_t num_keys = 0;
+  uint64_t keys_file_size = 0;
+  uint64_t num_blocks = 0;
+  uint64_t num_hashes = 0;
+  uint64_t format_version = FORMAT_VERSION;
+};
+
+static_assert(mt::hasExpectedSize<Header>(40, 40),
+              "struct Header does not have expected size");
+
+const uint64_t WORDS_PER_BLOCK = 8;
+const uint64_t BITS_PER_BLOCK = WORDS_PER_BLOCK * 64;
+
+static_assert(BITS_PER_BLOCK == 512,
+              "forEachBit() selects a bit of a block via 9 bits");
+
+uint64_t hash(const Bytes& key) { return XXH64(key.data(), key.size(), 0); }
+// Filter files are portable, see `KeyIndex`.
+
+uint64_t hash(uint64_t key_hash, const Bytes& value) {
+  return XXH64(value.data(), value.size(), key_hash);
+}
+
+uint64_t getBlockIndex(uint64_t hash, uint64_t num_blocks) {
+  return ((hash & 0xFFFFFFFF) * num_blocks) >> 32;
+}
+// Maps the lower half of `hash` to [0, num_blocks) without a division.  The
+// upper half of a key's hash value selects the partition, see class Map, and
+// hence is almost the same for all keys of a filter.
+
+template <typename Procedure>
+void forEachBit(uint64_t hash, uint64_t num_hashes, Procedure process) {
+  for (uint64_t i = 0; i != num_hashes; ++i) {
+    hash *= 0x9E3779B97F4A7C15ULL;
+    const auto bit = hash >> 55;
+    process(bit / 64, uint64_t(1) << (bit % 64));
+  }
+}
+// Calls `process(word_index, mask)` for each bit of a key within its block.
+// Each bit is taken from the upper 9 bits of a multiplicative hash of the
+// previous one, which depend on all bits of the key's hash value.
+
+}  // namespace
+
+void BloomFilter::Builder::add(const Bytes& key) {
+  hashes_.push_back(hash(key));
+}
+
+void BloomFilter::Builder::add(const Bytes& key, const Bytes& value) {
+  hashes_.push_back(hash(hash(key), value));
+}
+
+void BloomFilter::Builder::add(uint64_t key_hash) {
+  hashes_.push_back(key_hash);
+}
+
+void BloomFilter::Builder::writeToFile(const boost::filesystem::path& file,
+                                       uint64_t num_keys,
+                                       uint64_t keys_file_size,
+                                       double false_positive_rate) const {
+  MT_REQUIRE_GT(false_positive_rate, 0);
+  MT_REQUIRE_LT(false_positive_rate, 1);
+  const auto ln2 = std::log(2.0);
+  const auto bits_per_key = -std::log(false_positive_rate) / (ln2 * ln2);
+  const auto num_bits = std::ceil(bits_per_key * hashes_.size());
+
+  Header header;
+  header.num_keys = num_keys;
+  header.keys_file_size = keys_file_size;
+  header.num_blocks = std::max<uint64_t>(
+      1, static_cast<uint64_t>(num_bits + BITS_PER_BLOCK - 1) / BITS_PER_BLOCK);
+  header.num_hashes = std::max<long>(1, std::min<long>(
+      30, std::lround(bits_per_key * ln2)));
+  MT_ASSERT_LE(header.num_blocks, std::numeric_limits<uint32_t>::max());
+
+  std::vector<uint64_t> words(header.num_blocks * WORDS_PER_BLOCK);
+  for (const auto entry_hash : hashes_) {
+    auto block = &words[getBlockIndex(entry_hash, header.num_blocks) *
+                        WORDS_PER_BLOCK];
+    forEachBit(entry_hash, header.num_hashes,
+               [block](uint64_t word, uint64_t mask) { block[word] |= mask; });
+  }
+
+  const auto stream = mt::fopen(file, "w");
+  mt::fwrite(stream.get(), &header, sizeof header);
+  mt::fwrite(stream.get(), words.data(), words.size() * sizeof words.front());
+}
+
+bool BloomFilter::mayContain(const Bytes& key) const {
+  return mayContain(hash(key));
+}
+
+bool BloomFilter::mayContain(const Bytes& key, const Bytes& value) const {
+  return mayContain(hash(key), value);
+}
+
+bool BloomFilter::mayContain(uint64_t key_hash) const {
+  return mayContainHash(key_hash);
+}
+
+bool BloomFilter::mayContain(uint64_t key_hash, const Bytes& value) const {
+  return mayContainHash(hash(key_hash, value));
+}
+
+bool BloomFilter::mayContainHash(uint64_t entry_hash) const {
+  const auto block =
+      &words_[getBlockIndex(entry_hash, num_blocks_) * WORDS_PER_BLOCK];
+  bool result = true;
+  forEachBit(entry_hash, num_hashes_, [block, &result](uint64_t word,
+                                                       uint64_t mask) {
+    result &= (block[word] & mask) != 0;
+  });
+  return result;
+}
+
+std::unique_ptr<BloomFilter> BloomFilter::open(
+    const boost::filesystem::path& filter_file,
+    const boost::filesystem::path& keys_file, uint64_t num_keys) {
+  if (!boost::filesystem::is_regular_file(filter_file)) return nullptr;
+
+  Header header;
+  const auto filter_size = boost::filesystem::file_size(filter_file);
+  if (filter_size < sizeof header) return nullptr;
+  const auto stream = mt::fopen(filter_file, "r");
+  mt::fread(stream.get(), &header, sizeof header);
+
+  const auto expected_filter_size =
+      sizeof header + header.num_blocks * WORDS_PER_BLOCK * sizeof(uint64_t);
+  if (header.format_version != FORMAT_VERSION ||
+      header.num_keys != num_keys ||
+      header.keys_file_size != boost::filesystem::file_size(keys_file) ||
+      header.num_blocks == 0 || header.num_hashes == 0 ||
+      filter_size != expected_filter_size) {
+    return nullptr;
+  }
+
+  std::unique_ptr<BloomFilter> filter(new BloomFilter());
+  filter->words_.resize(header.num_blocks * WORDS_PER_BLOCK);
+  mt::fread(stream.get(), filter->words_.data(),
+            filter->words_.size() * sizeof filter->words_.front());
+  filter->num_blocks_ = header.num_blocks;
+  filter->num_hashes_ = header.num_hashes;
+  filter->num_keys_ = header.num_keys;
+  return filter;
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,112 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_BLOOM_FILTER_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_BLOOM_FILTER_HPP_INCLUDED
+
+#include <memory>
+#include <vector>
+#include <boost/filesystem/path.hpp>
+#include "multimap/thirdparty/mt/mt.hpp"
+#include "multimap/Bytes.hpp"
+
+namespace multimap {
+namespace internal {
+
+class BloomFilter : public mt::Resource {
+  // An immutable Bloom filter of the keys in a partition's keys file, which
+  // answers most lookups of absent keys without touching the key index, or
+  // of the pairs of keys and values, which does the same for values without
+  // touching the values file.
+  // All bits of a key are set in the same block of 512 bits, so that a query
+  // costs at most one cache miss.  The filter is loaded into memory when it
+  // is opened.  Objects of this class are thread-safe.
+
+ public:
+  // ---------------------------------------------------------------------------
+  // Member types
+  // ---------------------------------------------------------------------------
+
+  class Builder {
+    // Collects the keys while a keys file is written and writes the
+    // corresponding filter file afterwards.
+
+   public:
+    void add(const Bytes& key);
+
+    void add(const Bytes& key, const Bytes& value);
+
+    void add(uint64_t key_hash);
+    // Same as `add(key)`, but with a hash value of the key computed by the
+    // caller, which must pass the same one to `mayContain()`.
+
+    void writeToFile(const boost::filesystem::path& file, uint64_t num_keys,
+                     uint64_t keys_file_size,
+                     double false_positive_rate) const;
+    // `num_keys` and `keys_file_size` describe the keys file the filter
+    // belongs to.  `false_positive_rate` must be in (0, 1).  Since all bits
+    // of an entry are in one block, the actual rate is slightly higher than
+    // requested.
+
+   private:
+    std::vector<uint64_t> hashes_;
+  };
+
+  // ---------------------------------------------------------------------------
+  // Member functions
+  // ---------------------------------------------------------------------------
+
+  bool mayContain(const Bytes& key) const;
+  // Returns `false` if `key` is definitely not in the keys file.
+
+  bool mayContain(const Bytes& key, const Bytes& value) const;
+  // Returns `false` if the list of `key` definitely does not contain `value`.
+
+  bool mayContain(uint64_t key_hash) const;
+  bool mayContain(uint64_t key_hash, const Bytes& value) const;
+  // Same as above, but with the hash value of the key already computed by
+  // the caller, which is either the XXH64 hash value with seed 0 or the one
+  // that has been passed to `Builder::add()`.
+
+  uint64_t size() const { return num_keys_; }
+  // Returns the number of keys in the keys file.
+
+  // ---------------------------------------------------------------------------
+  // Static member functions
+  // ---------------------------------------------------------------------------
+
+  static std::unique_ptr<BloomFilter> open(
+      const boost::filesystem::path& filter_file,
+      const boost::filesystem::path& keys_file, uint64_t num_keys);
+  // Returns `nullptr` if `filter_file` does not exist or if it does not match
+  // `keys_file`.
+
+ private:
+  BloomFilter() = default;
+
+  bool mayContainHash(uint64_t entry_hash) const;
+
+  std::vector<uint64_t> words_;
+  uint64_t num_blocks_ = 0;
+  uint64_t num_hashes_ = 0;
+  uint64_t num_keys_ = 0;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_BLOOM_FILTER_HPP_INCLUDED
@@ -0,0 +1,126 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <type_traits>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/internal/BloomFilter.hpp"
+
+namespace multimap {
+namespace internal {
+
+TEST(BloomFilterTest, IsNotDefaultConstructible) {
+  ASSERT_FALSE(std::is_default_constructible<BloomFilter>::value);
+}
+
+TEST(BloomFilterTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<BloomFilter>::value);
+  ASSERT_FALSE(std::is_copy_assignable<BloomFilter>::value);
+}
+
+struct BloomFilterTestFixture : public testing::Test {
+  void SetUp() override {
+    boost::filesystem::remove_all(directory);
+    boost::filesystem::create_directory(directory);
+    mt::fopen(keys_file, "w");
+  }
+
+  void TearDown() override { boost::filesystem::remove_all(directory); }
+
+  void writeFilterFile(size_t num_keys, double false_positive_rate) const {
+    BloomFilter::Builder builder;
+    for (size_t i = 0; i != num_keys; ++i) {
+      builder.add(makeKey(i));
+    }
+    builder.writeToFile(filter_file, num_keys,
+                        boost::filesystem::file_size(keys_file),
+                        false_positive_rate);
+  }
+
+  static std::string makeKey(size_t i) { return "key" + std::to_string(i); }
+
+  const boost::filesystem::path directory =
+      "/tmp/multimap.BloomFilterTestFixture";
+  const boost::filesystem::path keys_file = directory / "partition.keys";
+  const boost::filesystem::path filter_file = directory / "partition.filter";
+};
+
+TEST_F(BloomFilterTestFixture, OpenReturnsNullIfFilterFileDoesNotExist) {
+  ASSERT_EQ(BloomFilter::open(filter_file, keys_file, 0), nullptr);
+}
+
+TEST_F(BloomFilterTestFixture, OpenReturnsNullIfFilterDoesNotMatchKeysFile) {
+  writeFilterFile(10, 0.01);
+  ASSERT_NE(BloomFilter::open(filter_file, keys_file, 10), nullptr);
+  ASSERT_EQ(BloomFilter::open(filter_file, keys_file, 11), nullptr);
+  mt::fwrite(mt::fopen(keys_file, "w").get(), "x", 1);
+  ASSERT_EQ(BloomFilter::open(filter_file, keys_file, 10), nullptr);
+}
+
+TEST_F(BloomFilterTestFixture, EmptyFilterContainsNoKey) {
+  writeFilterFile(0, 0.01);
+  const auto filter = BloomFilter::open(filter_file, keys_file, 0);
+  ASSERT_NE(filter, nullptr);
+  ASSERT_FALSE(filter->mayContain(makeKey(0)));
+}
+
+TEST_F(BloomFilterTestFixture, ContainsAllKeysAndFewOthers) {
+  const size_t num_keys = 100000;
+  for (const double false_positive_rate : {0.1, 0.01, 0.001}) {
+    writeFilterFile(num_keys, false_positive_rate);
+    const auto filter = BloomFilter::open(filter_file, keys_file, num_keys);
+    ASSERT_NE(filter, nullptr);
+    ASSERT_EQ(filter->size(), num_keys);
+    for (size_t i = 0; i != num_keys; ++i) {
+      ASSERT_TRUE(filter->mayContain(makeKey(i)));
+    }
+    size_t num_false_positives = 0;
+    for (size_t i = num_keys; i != num_keys * 2; ++i) {
+      num_false_positives += filter->mayContain(makeKey(i));
+    }
+    ASSERT_LT(num_false_positives, num_keys * false_positive_rate * 2);
+  }
+}
+
+TEST_F(BloomFilterTestFixture, ContainsAllPairsOfKeysAndValues) {
+  const size_t num_keys = 100;
+  const size_t num_values = 1000;
+  BloomFilter::Builder builder;
+  for (size_t i = 0; i != num_keys; ++i) {
+    for (size_t j = 0; j != num_values; ++j) {
+      builder.add(makeKey(i), std::to_string(j));
+    }
+  }
+  builder.writeToFile(filter_file, num_keys,
+                      boost::filesystem::file_size(keys_file), 0.01);
+  const auto filter = BloomFilter::open(filter_file, keys_file, num_keys);
+  ASSERT_NE(filter, nullptr);
+  size_t num_false_positives = 0;
+  for (size_t i = 0; i != num_keys; ++i) {
+    for (size_t j = 0; j != num_values; ++j) {
+      ASSERT_TRUE(filter->mayContain(makeKey(i), std::to_string(j)));
+      num_false_positives +=
+          filter->mayContain(makeKey(i), std::to_string(j + num_values));
+    }
+    num_false_positives += filter->mayContain(makeKey(i));
+    // Pairs and keys are hashed differently.
+  }
+  ASSERT_LT(num_false_positives, num_keys * num_values * 0.01 * 2);
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,64 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/Checkpointer.hpp"
+
+#include <exception>
+
+namespace multimap {
+namespace internal {
+
+Checkpointer::Checkpointer(std::chrono::milliseconds interval)
+    : interval_(interval), thread_(&Checkpointer::run, this) {}
+
+Checkpointer::~Checkpointer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_one();
+  thread_.join();
+}
+
+void Checkpointer::add(Partition* partition) {
+  MT_REQUIRE_NOT_NULL(partition);
+  std::lock_guard<std::mutex> lock(mutex_);
+  partitions_.push_back(partition);
+}
+
+void Checkpointer::run() {
+  const IoLimiter::Scope scope(IoLimiter::Priority::LOW);
+  std::vector<Partition*> partitions;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cond_.wait_for(lock, interval_, [this] { return stop_; })) {
+    partitions = partitions_;
+    lock.unlock();
+    // Adding partitions is not blocked while checkpointing.
+    for (const auto partition : partitions) {
+      try {
+        partition->checkpoint();
+      } catch (std::exception& error) {
+        mt::log() << "Checkpointer could not checkpoint partition: "
+                  << error.what() << '\n';
+      }
+    }
+    lock.lock();
+  }
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,98 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/Compactor.hpp"
+
+#include <algorithm>
+#include <exception>
+
+namespace multimap {
+namespace internal {
+
+const std::chrono::milliseconds Compactor::DEFAULT_INTERVAL(1000);
+
+Compactor::Compactor(double min_removed_ratio, uint64_t max_bytes_per_second,
+                     std::chrono::milliseconds interval)
+    : interval_(interval),
+      min_removed_ratio_(min_removed_ratio),
+      max_bytes_per_interval_(
+          std::max<uint64_t>(1, max_bytes_per_second * interval.count() / 1000)),
+      thread_(&Compactor::run, this) {}
+
+Compactor::~Compactor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_one();
+  thread_.join();
+}
+
+void Compactor::add(Partition* partition) {
+  MT_REQUIRE_NOT_NULL(partition);
+  std::lock_guard<std::mutex> lock(mutex_);
+  partitions_.push_back(partition);
+}
+
+void Compactor::run() {
+  const IoLimiter::Scope scope(IoLimiter::Priority::LOW);
+  std::vector<Partition*> partitions;
+  size_t first = 0;
+  uint64_t overdraft = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cond_.wait_for(lock, interval_, [this] { return stop_; })) {
+    partitions = partitions_;
+    lock.unlock();
+    // Adding partitions is not blocked while compacting.
+    for (const auto partition : partitions) {
+      try {
+        partition->removeExpiredLists();
+      } catch (std::exception& error) {
+        mt::log() << "Compactor could not remove expired lists: "
+                  << error.what() << '\n';
+      }
+    }
+    auto budget = max_bytes_per_interval_;
+    const auto settled = std::min(budget, overdraft);
+    budget -= settled;
+    overdraft -= settled;
+    // A list is always rewritten as a whole, which may exceed the budget.
+    // The excess is deducted from the following intervals.
+    for (size_t i = 0; i != partitions.size() && budget != 0; ++i) {
+      const auto index = (first + i) % partitions.size();
+      try {
+        const auto num_bytes =
+            partitions[index]->compactLists(min_removed_ratio_, budget);
+        if (num_bytes >= budget) {
+          overdraft = num_bytes - budget;
+          budget = 0;
+          first = index;
+          // Continues with this partition in the next interval.
+        } else {
+          budget -= num_bytes;
+        }
+      } catch (std::exception& error) {
+        mt::log() << "Compactor could not compact lists: " << error.what()
+                  << '\n';
+      }
+    }
+    lock.lock();
+  }
+}
+
+}  // namespace internal
+}  // namespace multimap
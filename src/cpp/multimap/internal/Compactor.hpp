@@ -0,0 +1,68 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_COMPACTOR_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_COMPACTOR_HPP_INCLUDED
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "multimap/internal/Partition.hpp"
+#include "multimap/thirdparty/mt/mt.hpp"
+
+namespace multimap {
+namespace internal {
+
+class Compactor : public mt::Resource {
+  // A background thread that periodically calls `compactLists()` for all
+  // added partitions, so that the space held by removed values is reclaimed
+  // without taking the map offline.  The number of bytes rewritten per second
+  // is limited, so that compaction does not starve foreground I/O.  Lists
+  // whose deadline has passed are removed in each round as well.  Objects
+  // of this class are thread-safe.
+
+ public:
+  static const std::chrono::milliseconds DEFAULT_INTERVAL;
+
+  Compactor(double min_removed_ratio, uint64_t max_bytes_per_second,
+            std::chrono::milliseconds interval = DEFAULT_INTERVAL);
+
+  ~Compactor();
+  // Stops the background thread.
+
+  void add(Partition* partition);
+  // Requires: `partition` is writable and outlives this object.
+
+ private:
+  void run();
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<Partition*> partitions_;
+  const std::chrono::milliseconds interval_;
+  const double min_removed_ratio_;
+  const uint64_t max_bytes_per_interval_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_COMPACTOR_HPP_INCLUDED
@@ -0,0 +1,256 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/Crc32c.hpp"
+
+#include <cstring>
+#include "multimap/thirdparty/mt/mt.hpp"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define MULTIMAP_CRC32C_X86
+#include <nmmintrin.h>
+#endif
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+const uint32_t POLYNOMIAL = 0x82F63B78;
+// The reversed Castagnoli polynomial, which is also used by the `crc32`
+// instruction of SSE 4.2.
+
+struct Table {
+  Table() {
+    for (uint32_t i = 0; i != 256; ++i) {
+      uint32_t crc = i;
+      for (int j = 0; j != 8; ++j) {
+        crc = (crc >> 1) ^ (POLYNOMIAL & (0 - (crc & 1)));
+      }
+      values[0][i] = crc;
+    }
+    for (uint32_t i = 0; i != 256; ++i) {
+      for (int j = 1; j != 8; ++j) {
+        values[j][i] =
+            (values[j - 1][i] >> 8) ^ values[0][values[j - 1][i] & 0xFF];
+      }
+    }
+  }
+  uint32_t values[8][256];
+};
+// Slicing-by-8 tables, so that the scalar implementation processes eight
+// bytes per iteration as well.
+
+const Table TABLE;
+
+const uint32_t HASH_SEEDS[] = {0, 0x243F6A88, 0x85A308D3};
+// Initial values of the three streams of `hash()`, taken from the digits of
+// pi, so that equal words in different streams yield different values.
+
+uint64_t loadWord(const char* data) {
+  uint64_t word;
+  std::memcpy(&word, data, sizeof word);
+  return word;
+}
+
+uint64_t loadTail(const char* data, size_t size) {
+  uint64_t word = 0;
+  if (size != 0) std::memcpy(&word, data, size);
+  return word;
+}
+// Loads fewer than eight bytes padded with zeros.
+
+uint64_t mixHash(uint32_t a, uint32_t b, uint32_t c, size_t size) {
+  uint64_t h = (uint64_t(a) << 32 | b) ^ (c * 0x9E3779B97F4A7C15ULL) ^ size;
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return h;
+}
+// The finalizer of MurmurHash3, which is a bijection, so that it does not
+// add any collisions.  Zero-padding the tail is compensated by `size`.
+
+typedef uint32_t (*Function)(const char* data, size_t size, uint32_t crc);
+// Takes and returns the inverted checksum.
+
+typedef uint64_t (*HashFunction)(const char* data, size_t size);
+
+uint32_t computeScalar(const char* data, size_t size, uint32_t crc) {
+  const auto in = reinterpret_cast<const uint8_t*>(data);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, in + i, sizeof word);
+    word ^= crc;  // Assumes little-endian byte order.
+    crc = TABLE.values[7][word & 0xFF] ^ TABLE.values[6][(word >> 8) & 0xFF] ^
+          TABLE.values[5][(word >> 16) & 0xFF] ^
+          TABLE.values[4][(word >> 24) & 0xFF] ^
+          TABLE.values[3][(word >> 32) & 0xFF] ^
+          TABLE.values[2][(word >> 40) & 0xFF] ^
+          TABLE.values[1][(word >> 48) & 0xFF] ^ TABLE.values[0][word >> 56];
+  }
+  for (; i != size; ++i) {
+    crc = (crc >> 8) ^ TABLE.values[0][(crc ^ in[i]) & 0xFF];
+  }
+  return crc;
+}
+
+uint32_t updateScalar(uint32_t crc, uint64_t word) {
+  return computeScalar(reinterpret_cast<const char*>(&word), sizeof word, crc);
+}
+
+uint64_t hashScalar(const char* data, size_t size) {
+  uint32_t a = HASH_SEEDS[0];
+  uint32_t b = HASH_SEEDS[1];
+  uint32_t c = HASH_SEEDS[2];
+  size_t i = 0;
+  for (; i + 24 <= size; i += 24) {
+    a = updateScalar(a, loadWord(data + i));
+    b = updateScalar(b, loadWord(data + i + 8));
+    c = updateScalar(c, loadWord(data + i + 16));
+  }
+  if (i + 8 <= size) {
+    a = updateScalar(a, loadWord(data + i));
+    i += 8;
+  }
+  if (i + 8 <= size) {
+    b = updateScalar(b, loadWord(data + i));
+    i += 8;
+  }
+  c = updateScalar(c, loadTail(data + i, size - i));
+  return mixHash(a, b, c, size);
+}
+// Must yield the same results as `hashSse42()`.
+
+#if defined(MULTIMAP_CRC32C_X86)
+
+__attribute__((target("sse4.2"))) uint32_t computeSse42(const char* data,
+                                                        size_t size,
+                                                        uint32_t crc) {
+  uint64_t crc64 = crc;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    std::memcpy(&word, data + i, sizeof word);
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = crc64;
+  for (; i != size; ++i) {
+    crc = _mm_crc32_u8(crc, data[i]);
+  }
+  return crc;
+}
+
+__attribute__((target("sse4.2"))) uint64_t hashSse42(const char* data,
+                                                      size_t size) {
+  // The three streams are independent, which hides the latency of the
+  // `crc32` instruction.
+  uint32_t a = HASH_SEEDS[0];
+  uint32_t b = HASH_SEEDS[1];
+  uint32_t c = HASH_SEEDS[2];
+  size_t i = 0;
+  for (; i + 24 <= size; i += 24) {
+    a = _mm_crc32_u64(a, loadWord(data + i));
+    b = _mm_crc32_u64(b, loadWord(data + i + 8));
+    c = _mm_crc32_u64(c, loadWord(data + i + 16));
+  }
+  if (i + 8 <= size) {
+    a = _mm_crc32_u64(a, loadWord(data + i));
+    i += 8;
+  }
+  if (i + 8 <= size) {
+    b = _mm_crc32_u64(b, loadWord(data + i));
+    i += 8;
+  }
+  c = _mm_crc32_u64(c, loadTail(data + i, size - i));
+  return mixHash(a, b, c, size);
+}
+
+#endif  // MULTIMAP_CRC32C_X86
+
+Function getFunction(Crc32c::Implementation implementation) {
+  switch (implementation) {
+#if defined(MULTIMAP_CRC32C_X86)
+    case Crc32c::Implementation::SSE42:
+      return computeSse42;
+#endif
+    default:
+      return computeScalar;
+  }
+}
+
+HashFunction getHashFunction(Crc32c::Implementation implementation) {
+  switch (implementation) {
+#if defined(MULTIMAP_CRC32C_X86)
+    case Crc32c::Implementation::SSE42:
+      return hashSse42;
+#endif
+    default:
+      return hashScalar;
+  }
+}
+
+Crc32c::Implementation getFastestImplementation() {
+#if defined(MULTIMAP_CRC32C_X86)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) return Crc32c::Implementation::SSE42;
+#endif
+  return Crc32c::Implementation::SCALAR;
+}
+
+Crc32c::Implementation implementation = getFastestImplementation();
+Function function = getFunction(implementation);
+HashFunction hash_function = getHashFunction(implementation);
+
+}  // namespace
+
+uint32_t Crc32c::compute(const char* data, size_t size, uint32_t crc) {
+  MT_REQUIRE_TRUE(data != nullptr || size == 0);
+  return ~function(data, size, ~crc);
+}
+
+uint64_t Crc32c::hash(const char* data, size_t size) {
+  MT_REQUIRE_TRUE(data != nullptr || size == 0);
+  return hash_function(data, size);
+}
+
+Crc32c::Implementation Crc32c::getImplementation() { return implementation; }
+
+bool Crc32c::isSupported(Implementation implementation) {
+  switch (implementation) {
+    case Implementation::SCALAR:
+      return true;
+#if defined(MULTIMAP_CRC32C_X86)
+    case Implementation::SSE42:
+      return __builtin_cpu_supports("sse4.2");
+#endif
+    default:
+      return false;
+  }
+}
+
+void Crc32c::setImplementation(Implementation new_implementation) {
+  MT_REQUIRE_TRUE(isSupported(new_implementation));
+  implementation = new_implementation;
+  function = getFunction(new_implementation);
+  hash_function = getHashFunction(new_implementation);
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,57 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_CRC32C_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_CRC32C_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+
+namespace multimap {
+namespace internal {
+
+struct Crc32c {
+  static uint32_t compute(const char* data, size_t size, uint32_t crc = 0);
+  // Returns the CRC-32C (Castagnoli) checksum of `data`.  A checksum of
+  // several pieces can be computed by passing the result for the previous
+  // pieces as `crc`.
+
+  static uint64_t hash(const char* data, size_t size);
+  // Returns a 64-bit hash value of `data` that is computed via three
+  // interleaved CRC-32C streams and a final mixing step.  This is faster than
+  // XXH64 for short data if the `crc32` instruction is available.  The result
+  // does not depend on the implementation and can thus be persisted.
+
+  enum class Implementation { SCALAR, SSE42 };
+
+  static Implementation getImplementation();
+  // Returns the implementation in use, which is the `crc32` instruction of
+  // SSE 4.2 if supported by the CPU unless changed via `setImplementation()`.
+
+  static bool isSupported(Implementation implementation);
+
+  static void setImplementation(Implementation implementation);
+  // Meant for testing and benchmarking.  Must not be called concurrently with
+  // other functions of this class.  Requires: `isSupported(implementation)`.
+
+  Crc32c() = delete;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_CRC32C_HPP_INCLUDED
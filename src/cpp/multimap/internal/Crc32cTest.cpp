@@ -0,0 +1,197 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include "gmock/gmock.h"
+#include "multimap/internal/Benchmark.hpp"
+#include "multimap/internal/Crc32c.hpp"
+#include "multimap/thirdparty/xxhash/xxhash.h"
+#include "multimap/Bytes.hpp"
+
+namespace multimap {
+namespace internal {
+
+std::vector<Crc32c::Implementation> getSupportedCrc32cImplementations() {
+  std::vector<Crc32c::Implementation> implementations;
+  for (const auto implementation :
+       {Crc32c::Implementation::SCALAR, Crc32c::Implementation::SSE42}) {
+    if (Crc32c::isSupported(implementation)) {
+      implementations.push_back(implementation);
+    }
+  }
+  return implementations;
+}
+
+struct Crc32cTestWithImplementation
+    : public testing::TestWithParam<Crc32c::Implementation> {
+  void SetUp() override {
+    default_implementation = Crc32c::getImplementation();
+    Crc32c::setImplementation(GetParam());
+  }
+
+  void TearDown() override {
+    Crc32c::setImplementation(default_implementation);
+  }
+
+  Crc32c::Implementation default_implementation =
+      Crc32c::Implementation::SCALAR;
+};
+
+// Test vectors from RFC 3720, appendix B.4.
+
+TEST_P(Crc32cTestWithImplementation, ComputeTestVectors) {
+  std::string data(32, 0);
+  ASSERT_EQ(Crc32c::compute(data.data(), data.size()), 0x8A9136AA);
+  data.assign(32, '\xFF');
+  ASSERT_EQ(Crc32c::compute(data.data(), data.size()), 0x62A8AB43);
+  for (size_t i = 0; i != data.size(); ++i) {
+    data[i] = i;
+  }
+  ASSERT_EQ(Crc32c::compute(data.data(), data.size()), 0x46DD794E);
+  for (size_t i = 0; i != data.size(); ++i) {
+    data[i] = 31 - i;
+  }
+  ASSERT_EQ(Crc32c::compute(data.data(), data.size()), 0x113FDB5C);
+  ASSERT_EQ(Crc32c::compute("123456789", 9), 0xE3069283);
+  ASSERT_EQ(Crc32c::compute(nullptr, 0), 0);
+}
+
+TEST_P(Crc32cTestWithImplementation, ComputeInPiecesYieldsSameChecksum) {
+  std::string data;
+  for (size_t i = 0; i != 1000; ++i) {
+    data.push_back(i * 7 + i / 13);
+  }
+  const auto expected = Crc32c::compute(data.data(), data.size());
+  for (size_t split = 0; split <= data.size(); split += 37) {
+    const auto crc = Crc32c::compute(data.data(), split);
+    ASSERT_EQ(Crc32c::compute(data.data() + split, data.size() - split, crc),
+              expected);
+  }
+}
+
+TEST(Crc32cTest, ImplementationsYieldSameChecksums) {
+  const auto default_implementation = Crc32c::getImplementation();
+  std::string data;
+  for (size_t i = 0; i != 4099; ++i) {
+    data.push_back(i * 31 + i / 7);
+  }
+  std::vector<uint32_t> checksums;
+  for (const auto implementation : getSupportedCrc32cImplementations()) {
+    Crc32c::setImplementation(implementation);
+    for (size_t offset = 0; offset != 9; ++offset) {
+      const auto checksum =
+          Crc32c::compute(data.data() + offset, data.size() - offset);
+      if (implementation == Crc32c::Implementation::SCALAR) {
+        checksums.push_back(checksum);
+      } else {
+        ASSERT_EQ(checksum, checksums[offset]);
+      }
+    }
+  }
+  Crc32c::setImplementation(default_implementation);
+}
+
+TEST_P(Crc32cTestWithImplementation, HashDependsOnEveryByteAndTheSize) {
+  std::string data(100, 'x');
+  std::set<uint64_t> hashes;
+  for (size_t size = 0; size <= data.size(); ++size) {
+    ASSERT_TRUE(hashes.insert(Crc32c::hash(data.data(), size)).second);
+  }
+  const auto expected = Crc32c::hash(data.data(), data.size());
+  for (size_t i = 0; i != data.size(); ++i) {
+    data[i] = 'y';
+    ASSERT_NE(Crc32c::hash(data.data(), data.size()), expected);
+    ASSERT_TRUE(hashes.insert(Crc32c::hash(data.data(), data.size())).second);
+    data[i] = 'x';
+  }
+  ASSERT_EQ(Crc32c::hash(data.data(), data.size()), expected);
+}
+
+TEST(Crc32cTest, HashIsSameForAllImplementations) {
+  const auto default_implementation = Crc32c::getImplementation();
+  std::string data;
+  for (size_t i = 0; i != 300; ++i) {
+    data.push_back(i * 31 + i / 7);
+  }
+  std::vector<uint64_t> hashes;
+  for (const auto implementation : getSupportedCrc32cImplementations()) {
+    Crc32c::setImplementation(implementation);
+    for (size_t size = 0; size != data.size(); ++size) {
+      const auto hash = Crc32c::hash(data.data(), size);
+      if (implementation == Crc32c::Implementation::SCALAR) {
+        hashes.push_back(hash);
+      } else {
+        ASSERT_EQ(hash, hashes[size]);
+      }
+    }
+  }
+  Crc32c::setImplementation(default_implementation);
+}
+
+template <typename Hash>
+uint64_t runHashBenchmark(const std::string& name,
+                          const std::vector<std::string>& keys, Hash hash) {
+  const size_t num_rounds = 20;
+  uint64_t sum = 0;
+  Benchmark::run(name.c_str(), keys.size() * num_rounds, [&] {
+    for (size_t round = 0; round != num_rounds; ++round) {
+      for (const auto& key : keys) {
+        sum += hash(key);
+      }
+    }
+  });
+  return sum;
+}
+// Returns the sum of all hash values, so that they are not optimized away.
+
+TEST(Crc32cTest, DISABLED_BenchmarkHashVersusOtherKeyHashes) {
+  std::mt19937_64 random;
+  for (const size_t key_size : {16, 40, 100, 200}) {
+    std::vector<std::string> keys(100000, std::string(key_size, 0));
+    for (auto& key : keys) {
+      for (auto& c : key) {
+        c = random();
+      }
+    }
+    const auto suffix = " (" + std::to_string(key_size) + " bytes)";
+    runHashBenchmark("Crc32c::hash" + suffix, keys,
+                     [](const std::string& key) {
+                       return Crc32c::hash(key.data(), key.size());
+                     });
+    runHashBenchmark("XXH64" + suffix, keys, [](const std::string& key) {
+      return XXH64(key.data(), key.size(), 0);
+    });
+    runHashBenchmark("std::hash<Bytes>" + suffix, keys,
+                     [](const std::string& key) {
+                       return std::hash<Bytes>()(Bytes(key));
+                     });
+    runHashBenchmark("mt::fnv1aHash" + suffix, keys,
+                     [](const std::string& key) {
+                       return mt::fnv1aHash(key.data(), key.size());
+                     });
+  }
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
+INSTANTIATE_TEST_CASE_P(Parameterized, Crc32cTestWithImplementation,
+                        testing::ValuesIn(getSupportedCrc32cImplementations()));
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,188 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/Dump.hpp"
+
+#include <limits>
+#include <zlib.h>
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+const char MAGIC[8] = {'M', 'M', 'D', 'U', 'M', 'P', '\0', '\0'};
+
+const uint32_t VERSION = 1;
+
+const uint32_t FLAG_COMPRESSED = 1;
+
+struct Header {
+  char magic[sizeof MAGIC];
+  uint32_t version;
+  uint32_t flags;
+};
+
+struct ChunkHeader {
+  uint32_t payload_size;
+  uint32_t stored_size;
+  uint32_t crc32;
+};
+// A chunk header with all fields zero marks the end of a dump.
+
+void appendUint32(uint32_t value, std::string* buffer) {
+  buffer->append(reinterpret_cast<const char*>(&value), sizeof value);
+}
+
+void appendBytes(const Bytes& bytes, std::string* buffer) {
+  appendUint32(bytes.size(), buffer);
+  buffer->append(bytes.data(), bytes.size());
+}
+
+uint32_t computeCrc32(const char* data, size_t size) {
+  return ::crc32(::crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(data),
+                 size);
+}
+
+}  // namespace
+
+Dump::Writer::Writer(const boost::filesystem::path& file,
+                     const Options& options)
+    : stream_(mt::fopen(file, "w")), options_(options) {
+  mt::Check::notZero(options.chunk_size, "Dump: chunk size must be positive");
+  Header header;
+  std::memcpy(header.magic, MAGIC, sizeof MAGIC);
+  header.version = VERSION;
+  header.flags = options.compress ? FLAG_COMPRESSED : 0;
+  mt::fwrite(stream_.get(), &header, sizeof header);
+  payload_.reserve(options.chunk_size);
+}
+
+Dump::Writer::~Writer() {
+  if (stream_.get()) close();
+}
+
+void Dump::Writer::put(const Bytes& key, Iterator* iter) {
+  while (iter->hasNext()) {
+    putValue(key, iter->next());
+  }
+  endRecord();
+}
+
+void Dump::Writer::close() {
+  endRecord();
+  flushChunk();
+  const ChunkHeader end_marker = {0, 0, 0};
+  mt::fwrite(stream_.get(), &end_marker, sizeof end_marker);
+  stream_.reset();
+}
+
+void Dump::Writer::putValue(const Bytes& key, const Bytes& value) {
+  MT_REQUIRE_LE(key.size(), std::numeric_limits<uint32_t>::max());
+  MT_REQUIRE_LE(value.size(), std::numeric_limits<uint32_t>::max());
+  if (payload_.size() >= options_.chunk_size) {
+    endRecord();
+    flushChunk();
+  }
+  if (num_values_ == 0) {
+    appendBytes(key, &payload_);
+    num_values_offset_ = payload_.size();
+    appendUint32(0, &payload_);
+  }
+  appendBytes(value, &payload_);
+  ++num_values_;
+}
+
+void Dump::Writer::endRecord() {
+  if (num_values_ == 0) return;
+  std::memcpy(&payload_[num_values_offset_], &num_values_, sizeof num_values_);
+  num_values_ = 0;
+}
+
+void Dump::Writer::flushChunk() {
+  if (payload_.empty()) return;
+  MT_REQUIRE_LE(payload_.size(), std::numeric_limits<uint32_t>::max());
+  const std::string* stored = &payload_;
+  if (options_.compress) {
+    auto size = ::compressBound(payload_.size());
+    compressed_.resize(size);
+    const auto status = ::compress2(
+        reinterpret_cast<Bytef*>(&compressed_[0]), &size,
+        reinterpret_cast<const Bytef*>(payload_.data()), payload_.size(),
+        Z_BEST_SPEED);
+    MT_ASSERT_EQ(status, Z_OK);
+    compressed_.resize(size);
+    stored = &compressed_;
+  }
+  ChunkHeader header;
+  header.payload_size = payload_.size();
+  header.stored_size = stored->size();
+  header.crc32 = computeCrc32(stored->data(), stored->size());
+  mt::fwrite(stream_.get(), &header, sizeof header);
+  mt::fwrite(stream_.get(), stored->data(), stored->size());
+  payload_.clear();
+}
+
+Dump::Reader::Reader(const boost::filesystem::path& file)
+    : stream_(mt::fopen(file, "r")), file_(file) {
+  Header header;
+  const auto nbytes = std::fread(&header, 1, sizeof header, stream_.get());
+  mt::Check::isTrue(nbytes == sizeof header &&
+                        std::memcmp(header.magic, MAGIC, sizeof MAGIC) == 0,
+                    "Dump: '%s' is not a binary dump", file.c_str());
+  mt::Check::isEqual(header.version, VERSION,
+                     "Dump: '%s' has unsupported version %u", file.c_str(),
+                     header.version);
+  compressed_ = header.flags & FLAG_COMPRESSED;
+}
+
+bool Dump::Reader::readChunk(Chunk* chunk) {
+  ChunkHeader header;
+  auto nbytes = std::fread(&header, 1, sizeof header, stream_.get());
+  mt::Check::isEqual(nbytes, sizeof header, "Dump: '%s' is truncated",
+                     file_.c_str());
+  if (header.payload_size == 0) return false;
+  chunk->payload_size = header.payload_size;
+  chunk->crc32 = header.crc32;
+  chunk->compressed = compressed_;
+  chunk->data.resize(header.stored_size);
+  nbytes = std::fread(&chunk->data[0], 1, header.stored_size, stream_.get());
+  mt::Check::isEqual(nbytes, header.stored_size, "Dump: '%s' is truncated",
+                     file_.c_str());
+  return true;
+}
+
+void Dump::decode(const Chunk& chunk, std::string* payload) {
+  mt::Check::isEqual(computeCrc32(chunk.data.data(), chunk.data.size()),
+                     chunk.crc32, "Dump: chunk has wrong checksum");
+  if (!chunk.compressed) {
+    mt::Check::isEqual(chunk.data.size(), chunk.payload_size,
+                       "Dump: chunk has wrong size");
+    *payload = chunk.data;
+    return;
+  }
+  payload->resize(chunk.payload_size);
+  uLongf size = chunk.payload_size;
+  const auto status = ::uncompress(
+      reinterpret_cast<Bytef*>(&(*payload)[0]), &size,
+      reinterpret_cast<const Bytef*>(chunk.data.data()), chunk.data.size());
+  mt::Check::isTrue(status == Z_OK && size == chunk.payload_size,
+                    "Dump: could not decompress chunk");
+}
+
+}  // namespace internal
+}  // namespace multimap
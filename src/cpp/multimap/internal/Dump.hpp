@@ -0,0 +1,163 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_DUMP_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_DUMP_HPP_INCLUDED
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <boost/filesystem/path.hpp>
+#include "multimap/thirdparty/mt/mt.hpp"
+#include "multimap/Bytes.hpp"
+#include "multimap/Iterator.hpp"
+
+namespace multimap {
+namespace internal {
+
+struct Dump {
+  // A binary file format for transferring the keys and values of a map, as
+  // written by `Map::exportToBinary()` and read by `Map::importFromBinary()`.
+  // A dump starts with a header that is followed by a sequence of chunks.
+  // Each chunk consists of the size of its payload, the number of bytes that
+  // are stored, the CRC-32 of these bytes, and the stored bytes, which are
+  // either the payload or, if the dump is compressed, the payload compressed
+  // with zlib.  An empty chunk marks the end of the dump.
+  //
+  // The payload of a chunk is a sequence of records, each consisting of a
+  // key, the number of values that follow, and the values.  Keys and values
+  // are prefixed with their size, and all numbers are 32-bit integers in
+  // host byte order.  The values of long lists are split into several
+  // consecutive records with the same key, so that chunks can be decoded
+  // independently of each other.
+
+  struct Options {
+    bool compress = false;
+    // If true, the payload of each chunk is compressed.
+
+    uint32_t chunk_size = mt::MiB(1);
+    // Approximate size of the payload of a chunk.  Chunks are larger if they
+    // contain a single value that exceeds this size.
+  };
+
+  struct Chunk {
+    uint32_t payload_size = 0;
+    uint32_t crc32 = 0;
+    bool compressed = false;
+    std::string data;
+    // The stored bytes.
+  };
+
+  class Writer : public mt::Resource {
+   public:
+    Writer(const boost::filesystem::path& file, const Options& options);
+    // Creates or truncates `file` and writes the header.
+
+    ~Writer();
+    // Calls `close()` if not done before.
+
+    void put(const Bytes& key, Iterator* iter);
+
+    template <typename InputIter>
+    void put(const Bytes& key, InputIter first, InputIter last) {
+      while (first != last) {
+        putValue(key, *first);
+        ++first;
+      }
+      endRecord();
+    }
+    // Appends the values of a list.  Lists without values are skipped.
+
+    void close();
+    // Writes the last chunk and the end marker.
+
+   private:
+    void putValue(const Bytes& key, const Bytes& value);
+    void endRecord();
+    void flushChunk();
+
+    mt::AutoCloseFile stream_;
+    std::string payload_;
+    std::string compressed_;
+    size_t num_values_offset_ = 0;
+    uint32_t num_values_ = 0;
+    Options options_;
+  };
+
+  class Reader : public mt::Resource {
+   public:
+    explicit Reader(const boost::filesystem::path& file);
+    // Opens `file` and checks its header.
+
+    bool readChunk(Chunk* chunk);
+    // Returns false if the end marker has been read.  Fails if the file is
+    // truncated before the end marker.  The stored bytes are not checked
+    // here, so that chunks can be decoded by other threads.
+
+    bool isCompressed() const { return compressed_; }
+
+   private:
+    mt::AutoCloseFile stream_;
+    boost::filesystem::path file_;
+    bool compressed_ = false;
+  };
+
+  static void decode(const Chunk& chunk, std::string* payload);
+  // Checks the CRC-32 of the stored bytes and decompresses them if needed.
+  // Fails if the chunk is corrupt.
+
+  template <typename Procedure>
+  // Required interface:
+  // void process(const Bytes& key, const Bytes& value);
+  static void forEachValue(const std::string& payload, Procedure process) {
+    const char* pos = payload.data();
+    const char* end = pos + payload.size();
+    while (pos != end) {
+      const auto key = readBytes(&pos, end);
+      const auto num_values = readUint32(&pos, end);
+      for (uint32_t i = 0; i != num_values; ++i) {
+        process(key, readBytes(&pos, end));
+      }
+    }
+  }
+  // Calls `process` for each value of a decoded payload in the order in
+  // which the values have been written.
+
+ private:
+  static uint32_t readUint32(const char** pos, const char* end) {
+    uint32_t value;
+    mt::Check::isTrue(static_cast<size_t>(end - *pos) >= sizeof value,
+                      "Dump: unexpected end of chunk");
+    std::memcpy(&value, *pos, sizeof value);
+    *pos += sizeof value;
+    return value;
+  }
+
+  static Bytes readBytes(const char** pos, const char* end) {
+    const auto size = readUint32(pos, end);
+    mt::Check::isTrue(static_cast<size_t>(end - *pos) >= size,
+                      "Dump: unexpected end of chunk");
+    const Bytes bytes(*pos, size);
+    *pos += size;
+    return bytes;
+  }
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_DUMP_HPP_INCLUDED
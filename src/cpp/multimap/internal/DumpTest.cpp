@@ -0,0 +1,169 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/internal/Dump.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::ElementsAre;
+using testing::Eq;
+using testing::Gt;
+
+typedef std::vector<std::pair<std::string, std::string> > Entries;
+
+struct DumpTestWithCompression : public testing::TestWithParam<bool> {
+  void SetUp() override {
+    directory = "/tmp/multimap.DumpTestWithCompression";
+    boost::filesystem::remove_all(directory);
+    MT_ASSERT_TRUE(boost::filesystem::create_directory(directory));
+    file = directory / "dump";
+    options.compress = GetParam();
+  }
+
+  void TearDown() override {
+    MT_ASSERT_TRUE(boost::filesystem::remove_all(directory));
+  }
+
+  Entries readEntries(size_t* num_chunks = nullptr) const {
+    Entries entries;
+    Dump::Reader reader(file);
+    Dump::Chunk chunk;
+    std::string payload;
+    size_t count = 0;
+    while (reader.readChunk(&chunk)) {
+      Dump::decode(chunk, &payload);
+      Dump::forEachValue(payload, [&entries](const Bytes& key,
+                                             const Bytes& value) {
+        entries.emplace_back(key.toString(), value.toString());
+      });
+      ++count;
+    }
+    if (num_chunks) *num_chunks = count;
+    return entries;
+  }
+
+  boost::filesystem::path directory;
+  boost::filesystem::path file;
+  Dump::Options options;
+};
+
+TEST(DumpTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<Dump::Writer>::value);
+  ASSERT_FALSE(std::is_copy_assignable<Dump::Writer>::value);
+  ASSERT_FALSE(std::is_copy_constructible<Dump::Reader>::value);
+  ASSERT_FALSE(std::is_copy_assignable<Dump::Reader>::value);
+}
+
+TEST_P(DumpTestWithCompression, EmptyDumpHasNoEntries) {
+  Dump::Writer(file, options).close();
+  ASSERT_TRUE(readEntries().empty());
+}
+
+TEST_P(DumpTestWithCompression, ValuesAreReadInOrder) {
+  {
+    Dump::Writer writer(file, options);
+    const std::vector<std::string> values = {"1", "2", "3"};
+    writer.put("a", values.begin(), values.end());
+    writer.put("b", values.begin(), values.begin());
+    writer.put("c", values.begin() + 2, values.end());
+    // The writer is closed by its destructor.
+  }
+  ASSERT_THAT(readEntries(), ElementsAre(std::make_pair("a", "1"),
+                                         std::make_pair("a", "2"),
+                                         std::make_pair("a", "3"),
+                                         std::make_pair("c", "3")));
+}
+
+TEST_P(DumpTestWithCompression, LongListsAreSplitAcrossChunks) {
+  options.chunk_size = 100;
+  Entries expected;
+  std::vector<std::string> values;
+  for (auto i = 0; i != 1000; ++i) {
+    values.push_back(std::to_string(i));
+  }
+  values.push_back(std::string(1000, 'x'));
+  // Larger than a chunk.
+  {
+    Dump::Writer writer(file, options);
+    for (const auto key : {"k1", "k2"}) {
+      writer.put(key, values.begin(), values.end());
+      for (const auto& value : values) {
+        expected.emplace_back(key, value);
+      }
+    }
+    writer.close();
+  }
+  size_t num_chunks = 0;
+  ASSERT_THAT(readEntries(&num_chunks), Eq(expected));
+  ASSERT_THAT(num_chunks, Gt(10));
+}
+
+TEST_P(DumpTestWithCompression, CorruptChunkIsDetected) {
+  {
+    Dump::Writer writer(file, options);
+    const std::vector<std::string> values(100, "value");
+    writer.put("key", values.begin(), values.end());
+  }
+  const auto size = boost::filesystem::file_size(file);
+  {
+    const auto stream = mt::fopen(file, "r+");
+    std::fseek(stream.get(), size - 20, SEEK_SET);
+    std::fputc('?', stream.get());
+  }
+  Dump::Reader reader(file);
+  Dump::Chunk chunk;
+  std::string payload;
+  ASSERT_TRUE(reader.readChunk(&chunk));
+  ASSERT_THROW(Dump::decode(chunk, &payload), std::runtime_error);
+}
+
+TEST_P(DumpTestWithCompression, TruncatedDumpIsDetected) {
+  {
+    Dump::Writer writer(file, options);
+    const std::vector<std::string> values(100, "value");
+    writer.put("key", values.begin(), values.end());
+  }
+  boost::filesystem::resize_file(file, boost::filesystem::file_size(file) - 1);
+  Dump::Reader reader(file);
+  Dump::Chunk chunk;
+  ASSERT_TRUE(reader.readChunk(&chunk));
+  ASSERT_THROW(reader.readChunk(&chunk), std::runtime_error);
+}
+
+INSTANTIATE_TEST_CASE_P(Parameterized, DumpTestWithCompression,
+                        testing::Values(false, true));
+
+TEST(DumpTest, OtherFileIsRejected) {
+  const boost::filesystem::path file = "/tmp/multimap.DumpTest";
+  {
+    const auto stream = mt::fopen(file, "w");
+    const std::string text = "a1 b2 c3\n";
+    mt::fwrite(stream.get(), text.data(), text.size());
+  }
+  ASSERT_THROW(Dump::Reader reader(file), std::runtime_error);
+  boost::filesystem::remove(file);
+}
+
+}  // namespace internal
+}  // namespace multimap
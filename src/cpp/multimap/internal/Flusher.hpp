@@ -0,0 +1,68 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_FLUSHER_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_FLUSHER_HPP_INCLUDED
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "multimap/internal/Partition.hpp"
+#include "multimap/thirdparty/mt/mt.hpp"
+
+namespace multimap {
+namespace internal {
+
+class Flusher : public mt::Resource {
+  // A background thread that periodically calls `flushColdLists()` for all
+  // added partitions, so that the memory held by tail blocks of lists is
+  // bounded independent of the number of keys.  Objects of this class are
+  // thread-safe.
+
+ public:
+  static const std::chrono::milliseconds DEFAULT_INTERVAL;
+
+  explicit Flusher(size_t max_num_tail_blocks,
+                   std::chrono::milliseconds interval = DEFAULT_INTERVAL);
+  // `max_num_tail_blocks` is the limit that applies to each partition.
+
+  ~Flusher();
+  // Stops the background thread.  Lists that are not flushed until then
+  // keep their tail block.
+
+  void add(Partition* partition);
+  // Requires: `partition` was opened with `Options::track_tail_blocks` and
+  // outlives this object.
+
+ private:
+  void run();
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<Partition*> partitions_;
+  const std::chrono::milliseconds interval_;
+  const size_t max_num_tail_blocks_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_FLUSHER_HPP_INCLUDED
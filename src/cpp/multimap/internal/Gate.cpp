@@ -0,0 +1,66 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/Gate.hpp"
+
+#include <functional>
+#include <thread>
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+size_t getSlotIndex(size_t num_slots) {
+  static thread_local const size_t index =
+      std::hash<std::thread::id>()(std::this_thread::get_id()) % num_slots;
+  return index;
+}
+
+}  // namespace
+
+Gate::Pass::Pass(Gate* gate)
+    : count_(&gate->slots_[getSlotIndex(NUM_SLOTS)].count) {
+  while (true) {
+    count_->fetch_add(1);
+    if (!gate->closed_.load()) break;
+    // The gate has been closed in between, so `close()` might wait for us.
+    count_->fetch_sub(1);
+    std::unique_lock<std::mutex> lock(gate->mutex_);
+    gate->cond_.wait(lock, [gate] { return !gate->closed_.load(); });
+  }
+}
+
+void Gate::close() {
+  closed_.store(true);
+  for (const auto& slot : slots_) {
+    while (slot.count.load() != 0) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void Gate::open() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_.store(false);
+  }
+  cond_.notify_all();
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,80 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_GATE_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_GATE_HPP_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "multimap/thirdparty/mt/mt.hpp"
+
+namespace multimap {
+namespace internal {
+
+class Gate : public mt::Resource {
+  // Lets any number of threads pass at the same time, until `close()` waits
+  // for all threads that are passing and holds off new ones until `open()`.
+  // Unlike a reader lock, passing only increments and decrements a counter
+  // that is shared with few other threads, like `Store::EpochGuard`, so that
+  // threads passing on different cores do not contend.  A thread must not
+  // close a gate that it is passing.  Objects of this class are thread-safe.
+
+ public:
+  class Pass : public mt::Resource {
+   public:
+    explicit Pass(Gate* gate);
+
+    ~Pass() { count_->fetch_sub(1); }
+
+   private:
+    std::atomic<uint64_t>* count_;
+  };
+
+  Gate() = default;
+
+  void close();
+  // Blocks until all passes that exist have been destroyed.  New passes
+  // wait until `open()` is called.  At most one thread may close the gate
+  // at a time.
+
+  void open();
+
+  bool isClosed() const { return closed_.load(); }
+
+ private:
+  static const size_t NUM_SLOTS = 16;
+
+  struct Slot {
+    std::atomic<uint64_t> count{0};
+
+    char padding[64 - sizeof count];
+    // Avoids false sharing between threads mapped to different slots.
+  };
+
+  Slot slots_[NUM_SLOTS];
+  std::atomic<bool> closed_{false};
+  std::mutex mutex_;
+  std::condition_variable cond_;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_GATE_HPP_INCLUDED
@@ -0,0 +1,92 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "gmock/gmock.h"
+#include "multimap/internal/Gate.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+
+TEST(GateTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<Gate>::value);
+  ASSERT_FALSE(std::is_copy_assignable<Gate>::value);
+}
+
+TEST(GateTest, CloseWaitsForPassesAndHoldsOffNewOnes) {
+  Gate gate;
+  std::atomic<bool> passed(false);
+  std::unique_ptr<Gate::Pass> pass(new Gate::Pass(&gate));
+  std::thread closer([&] {
+    gate.close();
+    ASSERT_TRUE(passed);
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  passed = true;
+  pass.reset();
+  closer.join();
+  ASSERT_TRUE(gate.isClosed());
+
+  std::atomic<bool> entered(false);
+  std::thread passer([&] {
+    const Gate::Pass pass(&gate);
+    entered = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  ASSERT_FALSE(entered);
+  gate.open();
+  passer.join();
+  ASSERT_TRUE(entered);
+}
+
+TEST(GateTest, NoPassExistsWhileClosed) {
+  Gate gate;
+  std::atomic<int> num_passing(0);
+  std::atomic<bool> stop(false);
+  std::atomic<bool> failed(false);
+  std::vector<std::thread> passers;
+  for (int i = 0; i != 4; ++i) {
+    passers.emplace_back([&] {
+      while (!stop) {
+        const Gate::Pass pass(&gate);
+        ++num_passing;
+        --num_passing;
+      }
+    });
+  }
+  for (int round = 0; round != 100; ++round) {
+    gate.close();
+    if (num_passing != 0) failed = true;
+    gate.open();
+  }
+  stop = true;
+  for (auto& passer : passers) {
+    passer.join();
+  }
+  ASSERT_FALSE(failed);
+  ASSERT_THAT(num_passing.load(), Eq(0));
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -18,6 +18,9 @@
 #ifndef MULTIMAP_INTERNAL_GENERATOR_HPP_INCLUDED
 #define MULTIMAP_INTERNAL_GENERATOR_HPP_INCLUDED
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <limits>
 #include <memory>
 #include <random>
@@ -45,20 +48,26 @@ class Generator {
 
 class RandomGenerator : public Generator {
  public:
-  RandomGenerator() : num_unique_(std::numeric_limits<std::size_t>::max()) {}
+  RandomGenerator()
+      : RandomGenerator(std::numeric_limits<std::size_t>::max()) {}
 
-  RandomGenerator(std::size_t num_unique) : num_unique_(num_unique) {}
+  RandomGenerator(std::size_t num_unique)
+      : RandomGenerator(num_unique, std::default_random_engine::default_seed) {}
+
+  RandomGenerator(std::size_t num_unique, std::uint64_t seed)
+      : num_unique_(num_unique), seed_(seed), random_engine_(seed) {}
 
   std::string next() override {
     return std::to_string(distribution_(random_engine_) % num_unique_);
   }
 
-  void reset() override { random_engine_ = std::default_random_engine(); }
+  void reset() override { random_engine_.seed(seed_); }
 
   std::size_t num_unique() const { return num_unique_; }
 
  private:
   const std::size_t num_unique_;
+  const std::uint64_t seed_;
   std::default_random_engine random_engine_;
   std::uniform_int_distribution<std::uint64_t> distribution_;
 };
@@ -67,9 +76,14 @@ class SequenceGenerator : public Generator {
  public:
   SequenceGenerator() : SequenceGenerator(0) {}
 
-  SequenceGenerator(std::size_t start) : start_(start), state_(start) {}
+  SequenceGenerator(std::size_t start)
+      : SequenceGenerator(start, std::numeric_limits<std::size_t>::max()) {}
+
+  SequenceGenerator(std::size_t start, std::size_t num_unique)
+      : start_(start), num_unique_(num_unique), state_(start) {}
+  // Starts over at zero after `num_unique - 1`.
 
-  std::string next() override { return std::to_string(state_++); }
+  std::string next() override { return std::to_string(state_++ % num_unique_); }
 
   void reset() override { state_ = start_; }
 
@@ -77,9 +91,66 @@ class SequenceGenerator : public Generator {
 
  private:
   const std::size_t start_;
+  const std::size_t num_unique_;
   std::size_t state_;
 };
 
+class ZipfianGenerator : public Generator {
+  // Yields numbers in [0, num_unique) whose frequency is proportional to
+  // 1 / (rank + 1)^theta, where 0 is the most frequent one, using the
+  // algorithm of Gray et al., "Quickly Generating Billion-Record Synthetic
+  // Databases", as in YCSB.  Construction takes O(num_unique) time.
+
+ public:
+  ZipfianGenerator(std::size_t num_unique)
+      : ZipfianGenerator(num_unique, 0.99,
+                         std::default_random_engine::default_seed) {}
+
+  ZipfianGenerator(std::size_t num_unique, double theta, std::uint64_t seed)
+      : num_unique_(num_unique),
+        theta_(theta),
+        seed_(seed),
+        random_engine_(seed) {
+    zeta_n_ = zeta(num_unique, theta);
+    alpha_ = 1 / (1 - theta);
+    eta_ = (1 - std::pow(2.0 / num_unique, 1 - theta)) /
+           (1 - zeta(2, theta) / zeta_n_);
+  }
+  // Requires: `num_unique >= 2` and `0 < theta < 1`.
+
+  std::string next() override {
+    const auto u = distribution_(random_engine_);
+    const auto uz = u * zeta_n_;
+    if (uz < 1) return "0";
+    if (uz < 1 + std::pow(0.5, theta_)) return "1";
+    const auto rank = static_cast<std::size_t>(
+        num_unique_ * std::pow(eta_ * u - eta_ + 1, alpha_));
+    return std::to_string(std::min(rank, num_unique_ - 1));
+  }
+
+  void reset() override { random_engine_.seed(seed_); }
+
+  std::size_t num_unique() const { return num_unique_; }
+
+ private:
+  static double zeta(std::size_t n, double theta) {
+    double sum = 0;
+    for (std::size_t i = 1; i <= n; ++i) {
+      sum += 1 / std::pow(i, theta);
+    }
+    return sum;
+  }
+
+  const std::size_t num_unique_;
+  const double theta_;
+  const std::uint64_t seed_;
+  double zeta_n_;
+  double alpha_;
+  double eta_;
+  std::default_random_engine random_engine_;
+  std::uniform_real_distribution<double> distribution_;
+};
+
 }  // namespace internal
 }  // namespace multimap
 
@@ -0,0 +1,181 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/HotKeys.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <thread>
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+const size_t MIN_WIDTH = 1024;
+const size_t MAX_WIDTH = 65536;
+// Each row is indexed by 16 bits of the mixed hash value.
+
+const size_t AGING_PERIOD = 8;
+// The counters are halved after this many samples per counter of a row.
+
+size_t getWidth(size_t capacity) {
+  size_t width = MIN_WIDTH;
+  while (width < capacity * 64 && width < MAX_WIDTH) width *= 2;
+  return width;
+}
+
+}  // namespace
+
+HotKeys::HotKeys(size_t capacity, uint32_t sample_rate)
+    : capacity_(capacity),
+      sample_rate_(sample_rate),
+      width_(getWidth(capacity)),
+      counters_(new std::atomic<uint32_t>[NUM_ROWS * width_]),
+      hashes_(new std::atomic<uint64_t>[capacity]),
+      min_estimate_(0),
+      num_samples_(0) {
+  MT_REQUIRE_NOT_ZERO(capacity);
+  MT_REQUIRE_NOT_ZERO(sample_rate);
+  for (size_t i = 0; i != NUM_ROWS * width_; ++i) {
+    counters_[i].store(0, std::memory_order_relaxed);
+  }
+  for (size_t i = 0; i != capacity_; ++i) {
+    hashes_[i].store(0, std::memory_order_relaxed);
+  }
+  entries_.reserve(capacity_);
+}
+
+std::vector<std::pair<std::string, uint64_t> > HotKeys::getTop(
+    size_t k) const {
+  std::vector<std::pair<std::string, uint64_t> > top;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& entry : entries_) {
+      top.emplace_back(entry.key,
+                       static_cast<uint64_t>(estimate(entry.hash)) *
+                           sample_rate_);
+    }
+  }
+  std::sort(top.begin(), top.end(),
+            [](const std::pair<std::string, uint64_t>& a,
+               const std::pair<std::string, uint64_t>& b) {
+              return a.second > b.second;
+            });
+  if (top.size() > k) top.resize(k);
+  return top;
+}
+
+size_t HotKeys::getNumBytes() const {
+  size_t num_bytes = NUM_ROWS * width_ * sizeof(std::atomic<uint32_t>) +
+                     capacity_ * sizeof(std::atomic<uint64_t>);
+  std::lock_guard<std::mutex> lock(mutex_);
+  num_bytes += entries_.capacity() * sizeof(Entry);
+  for (const auto& entry : entries_) {
+    num_bytes += entry.key.capacity();
+  }
+  return num_bytes;
+}
+
+bool HotKeys::isSampled() const {
+  static thread_local uint64_t state =
+      std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  // Xorshift, which is cheap enough to be called for each access.
+  return ((state >> 32) * sample_rate_) >> 32 == 0;
+}
+
+void HotKeys::recordSample(const Bytes& key, uint64_t hash) {
+  uint32_t estimate = std::numeric_limits<uint32_t>::max();
+  for (size_t row = 0; row != NUM_ROWS; ++row) {
+    auto& counter = counters_[row * width_ + getIndex(hash, row)];
+    estimate =
+        std::min(estimate, counter.fetch_add(1, std::memory_order_relaxed) + 1);
+  }
+  const auto num_samples =
+      num_samples_.fetch_add(1, std::memory_order_relaxed) + 1;
+  if (num_samples % (AGING_PERIOD * width_) == 0) age();
+  if (estimate <= min_estimate_.load(std::memory_order_relaxed)) return;
+
+  const auto tag = hash | 1;
+  for (size_t i = 0; i != capacity_; ++i) {
+    if (hashes_[i].load(std::memory_order_relaxed) == tag) return;
+  }
+  // Most samples that get here are of keys that are tracked already.
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto& entry : entries_) {
+    if (entry.hash == hash && entry.key == key) return;
+  }
+  if (entries_.size() < capacity_) {
+    hashes_[entries_.size()].store(tag, std::memory_order_relaxed);
+    entries_.push_back(Entry{key.toString(), hash});
+    if (entries_.size() < capacity_) return;
+  } else {
+    size_t min_index = 0;
+    uint32_t min_estimate = std::numeric_limits<uint32_t>::max();
+    for (size_t i = 0; i != entries_.size(); ++i) {
+      const auto other_estimate = this->estimate(entries_[i].hash);
+      if (other_estimate < min_estimate) {
+        min_estimate = other_estimate;
+        min_index = i;
+      }
+    }
+    if (estimate <= min_estimate) {
+      min_estimate_.store(min_estimate, std::memory_order_relaxed);
+      return;
+    }
+    hashes_[min_index].store(tag, std::memory_order_relaxed);
+    entries_[min_index] = Entry{key.toString(), hash};
+  }
+  uint32_t min_estimate = std::numeric_limits<uint32_t>::max();
+  for (const auto& entry : entries_) {
+    min_estimate = std::min(min_estimate, this->estimate(entry.hash));
+  }
+  min_estimate_.store(min_estimate, std::memory_order_relaxed);
+}
+
+uint32_t HotKeys::estimate(uint64_t hash) const {
+  uint32_t estimate = std::numeric_limits<uint32_t>::max();
+  for (size_t row = 0; row != NUM_ROWS; ++row) {
+    estimate = std::min(estimate, counters_[row * width_ + getIndex(hash, row)]
+                                      .load(std::memory_order_relaxed));
+  }
+  return estimate;
+}
+
+size_t HotKeys::getIndex(uint64_t hash, size_t row) const {
+  const auto mixed = hash * 0x9e3779b97f4a7c15ULL;
+  return (mixed >> (16 * row)) & (width_ - 1);
+}
+
+void HotKeys::age() {
+  for (size_t i = 0; i != NUM_ROWS * width_; ++i) {
+    auto& counter = counters_[i];
+    counter.store(counter.load(std::memory_order_relaxed) / 2,
+                  std::memory_order_relaxed);
+  }
+  min_estimate_.store(min_estimate_.load(std::memory_order_relaxed) / 2,
+                      std::memory_order_relaxed);
+  // Concurrent increments may get lost, which only lowers the estimates.
+}
+
+}  // namespace internal
+}  // namespace multimap
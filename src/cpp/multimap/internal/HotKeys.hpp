@@ -0,0 +1,103 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_HOT_KEYS_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_HOT_KEYS_HPP_INCLUDED
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "multimap/thirdparty/mt/mt.hpp"
+#include "multimap/Bytes.hpp"
+
+namespace multimap {
+namespace internal {
+
+class HotKeys : public mt::Resource {
+  // Estimates how often keys are accessed and keeps track of the most
+  // frequent ones.  Each thread samples about one in `sample_rate` accesses
+  // at random, which is counted in a count-min sketch of four rows of
+  // atomic counters, indexed by bits of the key's hash value.  Since the
+  // sketch never underestimates, a sampled key whose estimate exceeds the
+  // lowest estimate of the tracked keys replaces that key, which keeps the
+  // estimates of frequent keys accurate with a fixed number of entries, as
+  // the space-saving algorithm does in `LockProfiler`.  Only then a mutex
+  // is acquired and the key copied.  All counters are halved periodically,
+  // so that the estimates follow recent accesses rather than all of them.
+  // Objects of this class are thread-safe.
+
+ public:
+  HotKeys(size_t capacity, uint32_t sample_rate);
+  // Tracks `capacity` keys.
+  // Requires: `capacity` and `sample_rate` are not zero.
+
+  void record(const Bytes& key, uint64_t hash) {
+    if (sample_rate_ == 1 || isSampled()) recordSample(key, hash);
+  }
+  // Counts an access to `key`, whose hash value is `hash`, with a
+  // probability of one in `sample_rate`.
+
+  std::vector<std::pair<std::string, uint64_t> > getTop(size_t k) const;
+  // Returns up to `k` tracked keys with the estimated number of their
+  // recent accesses, i.e. scaled by the sample rate, most frequent first.
+
+  size_t getNumBytes() const;
+  // Returns the number of bytes held by the sketch and the tracked keys.
+
+ private:
+  struct Entry {
+    std::string key;
+    uint64_t hash;
+  };
+
+  bool isSampled() const;
+
+  void recordSample(const Bytes& key, uint64_t hash);
+
+  uint32_t estimate(uint64_t hash) const;
+
+  size_t getIndex(uint64_t hash, size_t row) const;
+
+  void age();
+
+  static const size_t NUM_ROWS = 4;
+
+  const size_t capacity_;
+  const uint32_t sample_rate_;
+  const size_t width_;
+  // Number of counters per row, a power of two.
+  std::unique_ptr<std::atomic<uint32_t>[]> counters_;
+  std::unique_ptr<std::atomic<uint64_t>[]> hashes_;
+  // Hash values of the tracked keys, so that a sample of a tracked key can
+  // be recognized without acquiring `mutex_`.  Zero marks a free entry.
+  std::atomic<uint32_t> min_estimate_;
+  // A lower bound of the estimates of the tracked keys, or zero if fewer
+  // than `capacity_` keys are tracked.
+  std::atomic<uint64_t> num_samples_;
+  mutable std::mutex mutex_;
+  std::vector<Entry> entries_;
+  // Guarded by `mutex_`.
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_HOT_KEYS_HPP_INCLUDED
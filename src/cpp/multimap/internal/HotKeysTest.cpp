@@ -0,0 +1,87 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "gmock/gmock.h"
+#include "multimap/internal/HotKeys.hpp"
+#include "multimap/thirdparty/xxhash/xxhash.h"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+using testing::Ge;
+using testing::Le;
+
+void access(HotKeys* hot_keys, const std::string& key) {
+  hot_keys->record(key, XXH64(key.data(), key.size(), 0));
+}
+
+TEST(HotKeysTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<HotKeys>::value);
+  ASSERT_FALSE(std::is_copy_assignable<HotKeys>::value);
+}
+
+TEST(HotKeysTest, GetTopReturnsNothingIfNothingWasRecorded) {
+  HotKeys hot_keys(10, 1);
+  ASSERT_TRUE(hot_keys.getTop(10).empty());
+}
+
+TEST(HotKeysTest, GetTopReturnsExactCountsOfFewKeys) {
+  HotKeys hot_keys(10, 1);
+  for (int i = 0; i != 3; ++i) {
+    for (int j = 0; j <= i; ++j) {
+      access(&hot_keys, std::to_string(i));
+    }
+  }
+  const auto top = hot_keys.getTop(2);
+  ASSERT_THAT(top.size(), Eq(2));
+  ASSERT_THAT(top[0].first, Eq("2"));
+  ASSERT_THAT(top[0].second, Eq(3));
+  ASSERT_THAT(top[1].first, Eq("1"));
+  ASSERT_THAT(top[1].second, Eq(2));
+}
+
+TEST(HotKeysTest, FrequentKeysAreFoundAmongManyRareOnes) {
+  HotKeys hot_keys(8, 4);
+  std::vector<std::thread> threads;
+  for (int t = 0; t != 4; ++t) {
+    threads.emplace_back([&hot_keys, t] {
+      for (int i = 0; i != 100000; ++i) {
+        access(&hot_keys, "cold" + std::to_string(t * 100000 + i));
+        if (i % 4 == 0) access(&hot_keys, "hot1");
+        if (i % 8 == 0) access(&hot_keys, "hot2");
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const auto top = hot_keys.getTop(2);
+  ASSERT_THAT(top.size(), Eq(2));
+  ASSERT_THAT(top[0].first, Eq("hot1"));
+  ASSERT_THAT(top[1].first, Eq("hot2"));
+  // The counters have been halved several times.
+  ASSERT_THAT(top[0].second, Le(100000));
+  ASSERT_THAT(top[0].second, Ge(top[1].second));
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,87 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/IoLimiter.hpp"
+
+#include <algorithm>
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+thread_local IoLimiter::Priority current_priority =
+    IoLimiter::Priority::FOREGROUND;
+
+}  // namespace
+
+IoLimiter::Scope::Scope(Priority priority) : previous_(current_priority) {
+  current_priority = priority;
+}
+
+IoLimiter::Scope::~Scope() { current_priority = previous_; }
+
+IoLimiter::IoLimiter(uint64_t bytes_per_second)
+    : bytes_per_second_(bytes_per_second),
+      max_tokens_(std::max<double>(1, bytes_per_second / 10.0)),
+      tokens_(max_tokens_),
+      last_refill_(Clock::now()) {
+  MT_REQUIRE_NOT_ZERO(bytes_per_second);
+  for (auto& num_bytes : num_bytes_) {
+    num_bytes = 0;
+  }
+}
+
+void IoLimiter::acquire(uint64_t num_bytes, Priority priority) {
+  if (priority == Priority::FOREGROUND || num_bytes == 0) return;
+  const bool high = priority == Priority::HIGH;
+  auto& num_waiting = num_waiting_[static_cast<size_t>(priority)];
+  auto& num_high_waiting = num_waiting_[static_cast<size_t>(Priority::HIGH)];
+  std::unique_lock<std::mutex> lock(mutex_);
+  ++num_waiting;
+  while (true) {
+    refillUnlocked();
+    if (tokens_ > 0) {
+      if (high || num_high_waiting == 0) break;
+      cond_.wait(lock);
+      // Woken up when a high priority request has been granted.
+    } else {
+      const std::chrono::duration<double> delay(
+          (1 - tokens_) / bytes_per_second_);
+      cond_.wait_for(lock,
+                     std::chrono::duration_cast<Clock::duration>(delay));
+    }
+  }
+  tokens_ -= num_bytes;
+  num_bytes_[static_cast<size_t>(priority)] += num_bytes;
+  if (--num_waiting == 0 && high) {
+    cond_.notify_all();
+  }
+}
+
+IoLimiter::Priority IoLimiter::getPriority() { return current_priority; }
+
+void IoLimiter::refillUnlocked() {
+  const auto now = Clock::now();
+  const std::chrono::duration<double> elapsed = now - last_refill_;
+  tokens_ = std::min(max_tokens_,
+                     tokens_ + elapsed.count() * bytes_per_second_);
+  last_refill_ = now;
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,107 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_IO_LIMITER_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_IO_LIMITER_HPP_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "multimap/thirdparty/mt/mt.hpp"
+
+namespace multimap {
+namespace internal {
+
+class IoLimiter : public mt::Resource {
+  // A token bucket that limits the number of bytes per second that
+  // background threads read and write, so that maintenance work does not
+  // compete with foreground requests for disk bandwidth.  The priority of a
+  // thread is `FOREGROUND` unless it is set via class Scope, and foreground
+  // I/O is never limited.  The bucket holds up to a tenth of a second's
+  // worth of tokens.  A request waits while the bucket is empty and is then
+  // granted as a whole, even if it exceeds the tokens left, so that the
+  // following requests pay off the excess.  Waiting `HIGH` requests are
+  // served before waiting `LOW` ones.  Objects of this class are
+  // thread-safe.
+
+ public:
+  enum class Priority { FOREGROUND, HIGH, LOW };
+  // `HIGH` is meant for flushing, which bounds memory usage, and `LOW` for
+  // compaction, warm-up, checkpoints, and snapshots.
+
+  class Scope : public mt::Resource {
+    // Sets the priority of the calling thread until destroyed.
+
+   public:
+    explicit Scope(Priority priority);
+
+    ~Scope();
+
+   private:
+    const Priority previous_;
+  };
+
+  explicit IoLimiter(uint64_t bytes_per_second);
+  // Requires: `bytes_per_second` is not zero.
+
+  void acquire(uint64_t num_bytes) { acquire(num_bytes, getPriority()); }
+  // Waits until the calling thread may read or write `num_bytes` bytes.
+  // Should not be called with locks held that foreground threads need.
+
+  void acquire(uint64_t num_bytes, Priority priority);
+  // Same as above, but with the given priority instead of the thread's.
+
+  uint64_t getNumBytes(Priority priority) const {
+    return num_bytes_[static_cast<size_t>(priority)].load();
+  }
+  // Returns the number of bytes acquired with `priority` so far.  Requests
+  // with `FOREGROUND` priority are not counted.
+
+  size_t getNumWaiting(Priority priority) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_waiting_[static_cast<size_t>(priority)];
+  }
+  // Returns the number of requests with `priority` that have not been
+  // granted yet.
+
+  uint64_t getBytesPerSecond() const { return bytes_per_second_; }
+
+  static Priority getPriority();
+  // Returns the priority of the calling thread.
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  void refillUnlocked();
+
+  const uint64_t bytes_per_second_;
+  const double max_tokens_;
+  double tokens_;
+  Clock::time_point last_refill_;
+  size_t num_waiting_[3] = {0, 0, 0};
+  mutable std::mutex mutex_;
+  std::condition_variable cond_;
+  std::atomic<uint64_t> num_bytes_[3];
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_IO_LIMITER_HPP_INCLUDED
@@ -0,0 +1,126 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "gmock/gmock.h"
+#include "multimap/internal/IoLimiter.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+using testing::Ge;
+using testing::Lt;
+
+typedef IoLimiter::Priority Priority;
+
+TEST(IoLimiterTest, IsNotDefaultConstructible) {
+  ASSERT_FALSE(std::is_default_constructible<IoLimiter>::value);
+}
+
+TEST(IoLimiterTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<IoLimiter>::value);
+  ASSERT_FALSE(std::is_copy_assignable<IoLimiter>::value);
+}
+
+TEST(IoLimiterTest, ScopeSetsPriorityOfCallingThreadOnly) {
+  ASSERT_THAT(IoLimiter::getPriority(), Eq(Priority::FOREGROUND));
+  {
+    IoLimiter::Scope scope(Priority::LOW);
+    ASSERT_THAT(IoLimiter::getPriority(), Eq(Priority::LOW));
+    {
+      IoLimiter::Scope nested(Priority::HIGH);
+      ASSERT_THAT(IoLimiter::getPriority(), Eq(Priority::HIGH));
+    }
+    ASSERT_THAT(IoLimiter::getPriority(), Eq(Priority::LOW));
+    std::thread thread([] {
+      ASSERT_THAT(IoLimiter::getPriority(), Eq(Priority::FOREGROUND));
+    });
+    thread.join();
+  }
+  ASSERT_THAT(IoLimiter::getPriority(), Eq(Priority::FOREGROUND));
+}
+
+TEST(IoLimiterTest, ForegroundIsNotLimited) {
+  IoLimiter limiter(1000);
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i != 100; ++i) {
+    limiter.acquire(1000);
+  }
+  ASSERT_THAT(std::chrono::steady_clock::now() - start,
+              Lt(std::chrono::milliseconds(100)));
+  ASSERT_THAT(limiter.getNumBytes(Priority::FOREGROUND), Eq(0));
+}
+
+TEST(IoLimiterTest, BackgroundIsLimitedToRate) {
+  IoLimiter limiter(10000);
+  IoLimiter::Scope scope(Priority::LOW);
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i != 30; ++i) {
+    limiter.acquire(100);
+  }
+  // The first 1000 bytes are covered by the initial tokens.
+  ASSERT_THAT(std::chrono::steady_clock::now() - start,
+              Ge(std::chrono::milliseconds(150)));
+  ASSERT_THAT(limiter.getNumBytes(Priority::LOW), Eq(3000));
+  ASSERT_THAT(limiter.getNumBytes(Priority::HIGH), Eq(0));
+}
+
+TEST(IoLimiterTest, LargeRequestIsGrantedAndPaidOffLater) {
+  IoLimiter limiter(10000);
+  const auto start = std::chrono::steady_clock::now();
+  limiter.acquire(2000, Priority::HIGH);
+  ASSERT_THAT(std::chrono::steady_clock::now() - start,
+              Lt(std::chrono::milliseconds(50)));
+  limiter.acquire(1, Priority::HIGH);
+  ASSERT_THAT(std::chrono::steady_clock::now() - start,
+              Ge(std::chrono::milliseconds(90)));
+}
+
+TEST(IoLimiterTest, HighPriorityIsServedBeforeLowPriority) {
+  IoLimiter limiter(10000);
+  limiter.acquire(3000, Priority::LOW);
+  // The bucket is in debt for about 0.3 seconds.
+  std::vector<Priority> order;
+  std::mutex mutex;
+  std::thread low([&] {
+    limiter.acquire(500, Priority::LOW);
+    std::lock_guard<std::mutex> lock(mutex);
+    order.push_back(Priority::LOW);
+  });
+  while (limiter.getNumWaiting(Priority::LOW) == 0) {
+    std::this_thread::yield();
+  }
+  std::thread high([&] {
+    for (int i = 0; i != 3; ++i) {
+      limiter.acquire(500, Priority::HIGH);
+      std::lock_guard<std::mutex> lock(mutex);
+      order.push_back(Priority::HIGH);
+    }
+  });
+  low.join();
+  high.join();
+  ASSERT_THAT(order.size(), Eq(4));
+  ASSERT_THAT(order.front(), Eq(Priority::HIGH));
+}
+
+}  // namespace internal
+}  // namespace multimap
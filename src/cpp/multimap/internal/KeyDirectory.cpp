@@ -0,0 +1,159 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/KeyDirectory.hpp"
+
+#include <algorithm>
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+void writeBits(uint64_t value, uint8_t width, uint64_t position,
+               std::vector<uint64_t>* bits) {
+  if (width == 0) return;
+  const auto word = position / 64;
+  const auto shift = position % 64;
+  (*bits)[word] |= value << shift;
+  if (shift + width > 64) {
+    (*bits)[word + 1] |= value >> (64 - shift);
+  }
+}
+
+uint64_t readBits(const std::vector<uint64_t>& bits, uint8_t width,
+                  uint64_t position) {
+  if (width == 0) return 0;
+  const auto word = position / 64;
+  const auto shift = position % 64;
+  uint64_t value = bits[word] >> shift;
+  if (shift + width > 64) {
+    value |= bits[word + 1] << (64 - shift);
+  }
+  return width == 64 ? value : value & ((1ULL << width) - 1);
+}
+
+template <typename Block>
+void buildTree(const std::vector<Block>& blocks, size_t node,
+               size_t* next_block, std::vector<uint64_t>* tree,
+               std::vector<uint32_t>* tree_blocks) {
+  if (node > blocks.size()) return;
+  buildTree(blocks, 2 * node, next_block, tree, tree_blocks);
+  (*tree)[node] = blocks[*next_block].head;
+  (*tree_blocks)[node] = *next_block;
+  ++*next_block;
+  buildTree(blocks, 2 * node + 1, next_block, tree, tree_blocks);
+}
+// An in-order traversal of the implicit tree visits the nodes in the order
+// of the sorted heads.
+
+}  // namespace
+
+const size_t KeyDirectory::BLOCK_SIZE;
+
+KeyDirectory::KeyDirectory(const std::vector<uint64_t>& keys)
+    : num_keys_(keys.size()) {
+  for (size_t i = 1; i < keys.size(); ++i) {
+    MT_REQUIRE_LT(keys[i - 1], keys[i]);
+  }
+  // Differences are at least one, hence the difference minus one is stored,
+  // which needs no bits at all for runs of consecutive keys.
+  uint64_t num_bits = 0;
+  for (size_t begin = 0; begin < keys.size(); begin += BLOCK_SIZE) {
+    const auto end = std::min(begin + BLOCK_SIZE, keys.size());
+    uint64_t max_delta = 0;
+    for (auto i = begin + 1; i < end; ++i) {
+      max_delta = std::max(max_delta, keys[i] - keys[i - 1] - 1);
+    }
+    const uint8_t width = max_delta ? 64 - __builtin_clzll(max_delta) : 0;
+    Block block;
+    block.head = keys[begin];
+    block.offset = num_bits;
+    block.width = width;
+    blocks_.push_back(block);
+    num_bits += width * (end - begin - 1);
+  }
+  bits_.resize((num_bits + 63) / 64);
+  for (size_t i = 0; i != blocks_.size(); ++i) {
+    const auto begin = i * BLOCK_SIZE;
+    const auto end = std::min(begin + BLOCK_SIZE, keys.size());
+    const auto& block = blocks_[i];
+    auto position = block.offset;
+    for (auto j = begin + 1; j < end; ++j) {
+      writeBits(keys[j] - keys[j - 1] - 1, block.width, position, &bits_);
+      position += block.width;
+    }
+  }
+  tree_.resize(blocks_.size() + 1);
+  tree_blocks_.resize(blocks_.size() + 1);
+  size_t next_block = 0;
+  buildTree(blocks_, 1, &next_block, &tree_, &tree_blocks_);
+}
+
+bool KeyDirectory::contains(uint64_t key) const {
+  if (empty()) return false;
+  const auto index = findBlock(key);
+  const auto num_keys = std::min(BLOCK_SIZE, num_keys_ - index * BLOCK_SIZE);
+  const auto& block = blocks_[index];
+  uint64_t position = block.offset;
+  auto current = block.head;
+  for (size_t i = 1; i != num_keys && current < key; ++i) {
+    current += readBits(bits_, block.width, position) + 1;
+    position += block.width;
+  }
+  return current == key;
+}
+// Decodes the block only up to `key`.
+
+size_t KeyDirectory::getMemoryUsage() const {
+  return blocks_.capacity() * sizeof blocks_[0] +
+         tree_.capacity() * sizeof tree_[0] +
+         tree_blocks_.capacity() * sizeof tree_blocks_[0] +
+         bits_.capacity() * sizeof bits_[0];
+}
+
+size_t KeyDirectory::findBlock(uint64_t key) const {
+  const auto num_blocks = blocks_.size();
+  size_t node = 1;
+  while (node <= num_blocks) {
+    __builtin_prefetch(tree_.data() + std::min(node * 8, num_blocks));
+    // Eight entries fill a cache line, which holds the descendants of `node`
+    // three levels down.
+    node = 2 * node + (tree_[node] <= key);
+  }
+  // Cancels the right turns that were taken after the last left turn.  The
+  // node of the last left turn holds the first head that is greater than
+  // `key`, if any.
+  node >>= __builtin_ffsll(static_cast<long long>(~node));
+  const auto first_greater = node ? tree_blocks_[node] : num_blocks;
+  return first_greater ? first_greater - 1 : 0;
+}
+
+size_t KeyDirectory::decodeBlock(size_t index, uint64_t* keys) const {
+  const auto num_keys = std::min(BLOCK_SIZE, num_keys_ - index * BLOCK_SIZE);
+  const auto& block = blocks_[index];
+  uint64_t position = block.offset;
+  keys[0] = block.head;
+  for (size_t i = 1; i != num_keys; ++i) {
+    keys[i] = keys[i - 1] + readBits(bits_, block.width, position) + 1;
+    position += block.width;
+  }
+  return num_keys;
+}
+
+}  // namespace internal
+}  // namespace multimap
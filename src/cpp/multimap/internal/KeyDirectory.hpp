@@ -0,0 +1,122 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_KEY_DIRECTORY_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_KEY_DIRECTORY_HPP_INCLUDED
+
+#include <cstring>
+#include <vector>
+#include "multimap/thirdparty/mt/mt.hpp"
+
+namespace multimap {
+namespace internal {
+
+class KeyDirectory : public mt::Resource {
+  // An immutable sorted set of 64-bit integer keys.  Keys are grouped into
+  // blocks of `BLOCK_SIZE` keys.  Each block stores its first key, the head,
+  // in full and the differences between consecutive keys bit-packed with the
+  // width of the largest one, so that dense key spaces need a few bits per
+  // key only.  The heads are additionally kept in Eytzinger layout, i.e. in
+  // the order of a breadth-first traversal of a complete binary search tree,
+  // which lets a search touch one cache line per level for the upper levels
+  // of the tree.  A lookup finds the block via the heads and then decodes at
+  // most one block.  Objects of this class are thread-safe.
+
+ public:
+  static const size_t BLOCK_SIZE = 64;
+
+  KeyDirectory() = default;
+
+  explicit KeyDirectory(const std::vector<uint64_t>& keys);
+  // Requires that `keys` is sorted in strictly ascending order.
+
+  bool contains(uint64_t key) const;
+
+  template <typename Procedure>
+  void forEachKey(uint64_t lower, uint64_t upper, Procedure process) const {
+    uint64_t keys[BLOCK_SIZE];
+    for (auto block = findBlock(lower); block < blocks_.size(); ++block) {
+      const auto num_keys = decodeBlock(block, keys);
+      for (size_t i = 0; i != num_keys; ++i) {
+        if (keys[i] >= upper) return;
+        if (keys[i] >= lower) process(keys[i]);
+      }
+    }
+  }
+  // Calls `process` for each key that is not less than `lower` and less than
+  // `upper` in ascending order.
+
+  size_t size() const { return num_keys_; }
+
+  bool empty() const { return num_keys_ == 0; }
+
+  size_t getMemoryUsage() const;
+  // Returns the number of bytes allocated on the heap.
+
+  static uint64_t readKey(const char* data) {
+    uint64_t key;
+    std::memcpy(&key, data, sizeof key);
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__
+    key = __builtin_bswap64(key);
+#endif
+    return key;
+  }
+  // Interprets eight bytes as a big-endian integer, so that integer keys
+  // have the same order as their bytes compared via `std::memcmp()`.
+
+  static void writeKey(uint64_t key, char* data) {
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__
+    key = __builtin_bswap64(key);
+#endif
+    std::memcpy(data, &key, sizeof key);
+  }
+  // The inverse of `readKey()`.
+
+ private:
+  size_t findBlock(uint64_t key) const;
+  // Returns the index of the last block whose head is not greater than
+  // `key`, or zero if there is no such block.
+
+  size_t decodeBlock(size_t block, uint64_t* keys) const;
+  // Writes the keys of `block` to `keys` and returns their number.
+
+  struct Block {
+    uint64_t head;
+    uint64_t offset : 56;
+    // The bit offset of the block's differences in `bits_`.
+
+    uint64_t width : 8;
+  };
+
+  static_assert(mt::hasExpectedSize<Block>(16, 16),
+                "struct KeyDirectory::Block does not have expected size");
+
+  std::vector<Block> blocks_;
+  std::vector<uint64_t> tree_;
+  // The heads in Eytzinger layout, where the root is at index 1.
+
+  std::vector<uint32_t> tree_blocks_;
+  // The block index of each head in `tree_`.
+
+  std::vector<uint64_t> bits_;
+  size_t num_keys_ = 0;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_KEY_DIRECTORY_HPP_INCLUDED
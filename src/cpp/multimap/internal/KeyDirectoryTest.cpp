@@ -0,0 +1,175 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <type_traits>
+#include "gmock/gmock.h"
+#include "multimap/internal/Benchmark.hpp"
+#include "multimap/internal/KeyDirectory.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::ElementsAre;
+using testing::ElementsAreArray;
+using testing::Eq;
+using testing::Lt;
+
+std::vector<uint64_t> getKeysInRange(const KeyDirectory& directory,
+                                     uint64_t lower, uint64_t upper) {
+  std::vector<uint64_t> keys;
+  directory.forEachKey(lower, upper,
+                       [&keys](uint64_t key) { keys.push_back(key); });
+  return keys;
+}
+
+std::vector<uint64_t> makeKeys(size_t num_keys, uint32_t seed) {
+  // Mixes runs of consecutive keys, small gaps, and huge gaps.
+  std::mt19937_64 random(seed);
+  std::vector<uint64_t> keys;
+  uint64_t key = random() % 100;
+  for (size_t i = 0; i != num_keys; ++i) {
+    keys.push_back(key);
+    switch (random() % 4) {
+      case 0:
+        key += 1;
+        break;
+      case 1:
+      case 2:
+        key += 1 + random() % 1000;
+        break;
+      default:
+        key += 1 + random() % (1ULL << 40);
+    }
+  }
+  return keys;
+}
+
+TEST(KeyDirectoryTest, IsDefaultConstructible) {
+  ASSERT_TRUE(std::is_default_constructible<KeyDirectory>::value);
+}
+
+TEST(KeyDirectoryTest, DefaultConstructedHasProperState) {
+  KeyDirectory directory;
+  ASSERT_TRUE(directory.empty());
+  ASSERT_FALSE(directory.contains(0));
+  ASSERT_TRUE(getKeysInRange(directory, 0, -1).empty());
+}
+
+TEST(KeyDirectoryTest, ReadKeyIsInverseOfWriteKeyAndKeepsByteOrder) {
+  char a[8];
+  char b[8];
+  KeyDirectory::writeKey(0x0102030405060708ULL, a);
+  KeyDirectory::writeKey(0x0102030405060709ULL, b);
+  ASSERT_THAT(KeyDirectory::readKey(a), Eq(0x0102030405060708ULL));
+  ASSERT_THAT(a[0], Eq(1));
+  ASSERT_THAT(std::memcmp(a, b, sizeof a), Lt(0));
+}
+
+TEST(KeyDirectoryTest, ContainsExactlyTheGivenKeys) {
+  for (const auto num_keys : {1, 63, 64, 65, 1000, 10000}) {
+    const auto keys = makeKeys(num_keys, num_keys);
+    const KeyDirectory directory(keys);
+    ASSERT_THAT(directory.size(), Eq(keys.size()));
+    for (const auto key : keys) {
+      ASSERT_TRUE(directory.contains(key));
+      ASSERT_EQ(directory.contains(key + 1),
+                std::binary_search(keys.begin(), keys.end(), key + 1));
+      ASSERT_EQ(directory.contains(key - 1),
+                std::binary_search(keys.begin(), keys.end(), key - 1));
+    }
+    ASSERT_THAT(getKeysInRange(directory, 0, -1), ElementsAreArray(keys));
+  }
+}
+
+TEST(KeyDirectoryTest, ForEachKeyVisitsKeysInRange) {
+  const auto keys = makeKeys(5000, 42);
+  const KeyDirectory directory(keys);
+  std::mt19937_64 random(7);
+  for (int i = 0; i != 1000; ++i) {
+    auto lower = keys[random() % keys.size()] + random() % 3 - 1;
+    auto upper = keys[random() % keys.size()] + random() % 3 - 1;
+    if (lower > upper) std::swap(lower, upper);
+    const std::vector<uint64_t> expected(
+        std::lower_bound(keys.begin(), keys.end(), lower),
+        std::lower_bound(keys.begin(), keys.end(), upper));
+    ASSERT_THAT(getKeysInRange(directory, lower, upper),
+                ElementsAreArray(expected));
+  }
+  ASSERT_TRUE(getKeysInRange(directory, 0, keys.front()).empty());
+  ASSERT_TRUE(getKeysInRange(directory, keys.back() + 1, -1).empty());
+}
+
+TEST(KeyDirectoryTest, HandlesLargestPossibleGaps) {
+  const uint64_t max = std::numeric_limits<uint64_t>::max();
+  const std::vector<uint64_t> keys = {0, 1, max - 1, max};
+  const KeyDirectory directory(keys);
+  ASSERT_THAT(getKeysInRange(directory, 0, max), ElementsAre(0, 1, max - 1));
+  ASSERT_THAT(getKeysInRange(directory, 2, max), ElementsAre(max - 1));
+  ASSERT_TRUE(directory.contains(max));
+  ASSERT_FALSE(directory.contains(max - 2));
+}
+
+TEST(KeyDirectoryTest, ConsecutiveKeysNeedLittleMemory) {
+  std::vector<uint64_t> keys(100000);
+  for (size_t i = 0; i != keys.size(); ++i) {
+    keys[i] = 1000000 + i;
+  }
+  const KeyDirectory directory(keys);
+  ASSERT_THAT(directory.getMemoryUsage(), Lt(keys.size()));
+  ASSERT_THAT(getKeysInRange(directory, 0, -1), ElementsAreArray(keys));
+}
+
+TEST(KeyDirectoryTest, ConstructorThrowsIfKeysAreNotStrictlyAscending) {
+  ASSERT_THROW(KeyDirectory(std::vector<uint64_t>({1, 1})),
+               mt::AssertionError);
+  ASSERT_THROW(KeyDirectory(std::vector<uint64_t>({2, 1})),
+               mt::AssertionError);
+}
+
+TEST(KeyDirectoryTest, DISABLED_BenchmarkContainsVersusBinarySearch) {
+  const auto keys = makeKeys(10000000, 1);
+  const KeyDirectory directory(keys);
+  std::printf("KeyDirectory: %.2f bytes per key, sorted vector: %zu\n",
+              double(directory.getMemoryUsage()) / keys.size(),
+              sizeof keys[0]);
+  std::mt19937_64 random(2);
+  std::vector<uint64_t> probes(1000000);
+  for (auto& probe : probes) {
+    probe = keys[random() % keys.size()];
+  }
+  size_t num_found = 0;
+  Benchmark::run("KeyDirectory::contains", probes.size(), [&] {
+    for (const auto probe : probes) {
+      num_found += directory.contains(probe);
+    }
+  });
+  Benchmark::run("std::binary_search", probes.size(), [&] {
+    for (const auto probe : probes) {
+      num_found += std::binary_search(keys.begin(), keys.end(), probe);
+    }
+  });
+  ASSERT_THAT(num_found, Eq(2 * probes.size()));
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,169 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/KeyIndex.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <boost/filesystem/operations.hpp>
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+// An index file consists of a header followed by `num_slots` slots.
+// An empty slot is zero, otherwise the upper 16 bits store some bits of the
+// key's hash value and the lower 48 bits store the key's offset plus one.
+
+struct Header {
+  uint64_t num_keys = 0;
+  uint64_t num_slots = 0;
+  uint64_t keys_file_size = 0;
+};
+
+static_assert(mt::hasExpectedSize<Header>(24, 24),
+              "struct Header does not have expected size");
+
+const uint64_t OFFSET_BITS = 48;
+const uint64_t OFFSET_MASK = (1ULL << OFFSET_BITS) - 1;
+
+uint64_t hash(const Bytes& key) { return XXH64(key.data(), key.size(), 0); }
+// The hash function must not depend on the platform, because index files
+// are portable.  Hence `std::hash<Bytes>` is not used here.
+
+uint64_t getTag(uint64_t hash) { return hash >> OFFSET_BITS; }
+
+uint64_t getNumSlots(uint64_t num_keys) {
+  // Keeps the load factor between 0.25 and 0.5.
+  uint64_t num_slots = 1;
+  while (num_slots < num_keys * 2) num_slots *= 2;
+  return num_slots;
+}
+
+const char* mapFile(const boost::filesystem::path& file, uint64_t size) {
+  if (size == 0) return nullptr;
+  const auto fd = mt::open(file, O_RDONLY);
+  void* data = mt::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd.get(), 0);
+  ::madvise(data, size, MADV_RANDOM);
+  return static_cast<const char*>(data);
+}
+
+}  // namespace
+
+void KeyIndex::Builder::add(const Bytes& key, uint64_t offset) {
+  add(hash(key), offset);
+}
+
+void KeyIndex::Builder::add(uint64_t key_hash, uint64_t offset) {
+  MT_REQUIRE_LT(offset, OFFSET_MASK);
+  hashes_.push_back(key_hash);
+  offsets_.push_back(offset);
+}
+
+void KeyIndex::Builder::writeToFile(const boost::filesystem::path& file,
+                                    uint64_t keys_file_size) const {
+  Header header;
+  header.num_keys = offsets_.size();
+  header.num_slots = getNumSlots(header.num_keys);
+  header.keys_file_size = keys_file_size;
+
+  const auto mask = header.num_slots - 1;
+  std::vector<uint64_t> slots(header.num_slots);
+  for (size_t i = 0; i != offsets_.size(); ++i) {
+    auto pos = hashes_[i] & mask;
+    while (slots[pos] != 0) {
+      pos = (pos + 1) & mask;
+    }
+    slots[pos] = (getTag(hashes_[i]) << OFFSET_BITS) | (offsets_[i] + 1);
+  }
+
+  const auto stream = mt::fopen(file, "w");
+  mt::fwrite(stream.get(), &header, sizeof header);
+  mt::fwrite(stream.get(), slots.data(), slots.size() * sizeof slots.front());
+}
+
+KeyIndex::~KeyIndex() {
+  if (keys_) {
+    mt::munmap(const_cast<char*>(keys_), keys_size_);
+  }
+  if (index_) {
+    mt::munmap(const_cast<char*>(index_), index_size_);
+  }
+}
+
+KeyIndex::Record KeyIndex::find(const Bytes& key) const {
+  return find(key, hash(key));
+}
+
+KeyIndex::Record KeyIndex::find(const Bytes& key, uint64_t key_hash) const {
+  const auto tag = getTag(key_hash);
+  const auto mask = num_slots_ - 1;
+  for (auto pos = key_hash & mask; slots_[pos] != 0; pos = (pos + 1) & mask) {
+    if (getTag(slots_[pos]) == tag) {
+      const auto offset = (slots_[pos] & OFFSET_MASK) - 1;
+      const auto record = readRecord(keys_ + offset);
+      if (record.key == key) return record;
+    }
+  }
+  return Record{Bytes(), nullptr};
+}
+
+std::unique_ptr<KeyIndex> KeyIndex::open(
+    const boost::filesystem::path& index_file,
+    const boost::filesystem::path& keys_file, uint64_t num_keys) {
+  if (!boost::filesystem::is_regular_file(index_file)) return nullptr;
+
+  Header header;
+  const auto index_size = boost::filesystem::file_size(index_file);
+  if (index_size < sizeof header) return nullptr;
+  mt::fread(mt::fopen(index_file, "r").get(), &header, sizeof header);
+
+  const auto keys_size = boost::filesystem::file_size(keys_file);
+  const auto expected_index_size =
+      sizeof header + header.num_slots * sizeof(uint64_t);
+  if (header.num_keys != num_keys || header.keys_file_size != keys_size ||
+      header.num_slots != getNumSlots(num_keys) ||
+      index_size != expected_index_size) {
+    return nullptr;
+  }
+
+  std::unique_ptr<KeyIndex> index(new KeyIndex());
+  index->keys_ = mapFile(keys_file, keys_size);
+  index->keys_size_ = keys_size;
+  index->index_ = mapFile(index_file, index_size);
+  index->slots_ =
+      reinterpret_cast<const uint64_t*>(index->index_ + sizeof header);
+  index->index_size_ = index_size;
+  index->num_slots_ = header.num_slots;
+  index->num_keys_ = header.num_keys;
+  return index;
+}
+
+std::unique_ptr<KeyIndex> KeyIndex::open(
+    const boost::filesystem::path& index_file,
+    const boost::filesystem::path& keys_file) {
+  if (!boost::filesystem::is_regular_file(index_file)) return nullptr;
+
+  Header header;
+  if (boost::filesystem::file_size(index_file) < sizeof header) return nullptr;
+  mt::fread(mt::fopen(index_file, "r").get(), &header, sizeof header);
+  return open(index_file, keys_file, header.num_keys);
+}
+
+}  // namespace internal
+}  // namespace multimap
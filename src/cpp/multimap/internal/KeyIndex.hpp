@@ -0,0 +1,146 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_KEY_INDEX_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_KEY_INDEX_HPP_INCLUDED
+
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <boost/filesystem/path.hpp>
+#include "multimap/thirdparty/mt/mt.hpp"
+#include "multimap/Bytes.hpp"
+
+namespace multimap {
+namespace internal {
+
+class KeyIndex : public mt::Resource {
+  // An immutable open-addressing hash table that maps each key of a
+  // partition to the offset of its record in the partition's keys file.
+  // The index file as well as the keys file are memory-mapped, so that
+  // opening an index takes constant time and keys are resolved lazily
+  // without loading them into memory.  Objects of this class are thread-safe.
+
+ public:
+  // ---------------------------------------------------------------------------
+  // Member types
+  // ---------------------------------------------------------------------------
+
+  struct Record {
+    Bytes key;
+    const char* list;
+    // Points to the serialized list that follows the key.
+  };
+
+  class Builder {
+    // Collects the offsets of all records while a keys file is written
+    // and writes the corresponding index file afterwards.
+
+   public:
+    void add(const Bytes& key, uint64_t offset);
+    // `offset` is the position of the key's record in the keys file.
+
+    void add(uint64_t key_hash, uint64_t offset);
+    // Same as above, but with a hash value of the key computed by the caller,
+    // which must pass the same one to `find()`.
+
+    void writeToFile(const boost::filesystem::path& file,
+                     uint64_t keys_file_size) const;
+
+   private:
+    std::vector<uint64_t> hashes_;
+    std::vector<uint64_t> offsets_;
+  };
+
+  // ---------------------------------------------------------------------------
+  // Member functions
+  // ---------------------------------------------------------------------------
+
+  ~KeyIndex();
+
+  Record find(const Bytes& key) const;
+  // Returns a record whose `list` member is `nullptr` if `key` is not found.
+
+  Record find(const Bytes& key, uint64_t key_hash) const;
+  // Same as above, but with the hash value of `key` already computed by the
+  // caller, which is either the XXH64 hash value with seed 0 or the one that
+  // has been passed to `Builder::add()`.
+
+  template <typename Procedure>
+  void forEachRecord(Procedure process) const {
+    const char* pos = keys_;
+    for (uint64_t i = 0; i != num_keys_; ++i) {
+      const auto record = readRecord(pos);
+      process(record);
+      pos = record.list + getSizeOfList(record.list);
+    }
+  }
+  // Visits all records in the order they appear in the keys file.
+
+  uint64_t size() const { return num_keys_; }
+
+  uint64_t getNumBytesMapped() const { return keys_size_ + index_size_; }
+  // Returns the size of the mapped keys and index file.
+
+  // ---------------------------------------------------------------------------
+  // Static member functions
+  // ---------------------------------------------------------------------------
+
+  static std::unique_ptr<KeyIndex> open(
+      const boost::filesystem::path& index_file,
+      const boost::filesystem::path& keys_file, uint64_t num_keys);
+  // Returns `nullptr` if `index_file` does not exist or if it does not match
+  // `keys_file`, e.g. because the keys file was written by an older version
+  // of the library that did not write an index.
+
+  static std::unique_ptr<KeyIndex> open(
+      const boost::filesystem::path& index_file,
+      const boost::filesystem::path& keys_file);
+  // Same as above, but takes the number of keys from the index file, for
+  // keys files that are only ever accessed via their index.
+
+ private:
+  KeyIndex() = default;
+
+  static Record readRecord(const char* pos) {
+    uint32_t key_size;
+    std::memcpy(&key_size, pos, sizeof key_size);
+    pos += sizeof key_size;
+    return Record{Bytes(pos, key_size), pos + key_size};
+  }
+
+  static uint64_t getSizeOfList(const char* list) {
+    // Needs to be synchronized with `List::writeToStream()`.
+    uint32_t size;
+    const auto header_size = sizeof(uint32_t) * 2;
+    std::memcpy(&size, list + header_size, sizeof size);
+    return header_size + sizeof size + size;
+  }
+
+  const char* keys_ = nullptr;
+  const char* index_ = nullptr;
+  const uint64_t* slots_ = nullptr;
+  uint64_t keys_size_ = 0;
+  uint64_t index_size_ = 0;
+  uint64_t num_slots_ = 0;
+  uint64_t num_keys_ = 0;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_KEY_INDEX_HPP_INCLUDED
@@ -0,0 +1,130 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <type_traits>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/internal/KeyIndex.hpp"
+#include "multimap/internal/List.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::ElementsAreArray;
+
+TEST(KeyIndexTest, IsNotDefaultConstructible) {
+  ASSERT_FALSE(std::is_default_constructible<KeyIndex>::value);
+}
+
+TEST(KeyIndexTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<KeyIndex>::value);
+  ASSERT_FALSE(std::is_copy_assignable<KeyIndex>::value);
+}
+
+struct KeyIndexTestFixture : public testing::Test {
+  void SetUp() override {
+    boost::filesystem::remove_all(directory);
+    boost::filesystem::create_directory(directory);
+  }
+
+  void TearDown() override { boost::filesystem::remove_all(directory); }
+
+  void writeKeysAndIndexFile(const std::vector<std::string>& keys) const {
+    // Writes records in the same format as used by class Partition.
+    List list;
+    KeyIndex::Builder builder;
+    const auto stream = mt::fopen(keys_file, "w");
+    for (const auto& key : keys) {
+      builder.add(key, mt::ftell(stream.get()));
+      const uint32_t key_size = key.size();
+      mt::fwrite(stream.get(), &key_size, sizeof key_size);
+      mt::fwrite(stream.get(), key.data(), key.size());
+      list.writeToStream(stream.get());
+    }
+    builder.writeToFile(index_file, mt::ftell(stream.get()));
+  }
+
+  std::vector<std::string> makeKeys(size_t num_keys) const {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i != num_keys; ++i) {
+      keys.push_back("key" + std::to_string(i));
+    }
+    return keys;
+  }
+
+  const boost::filesystem::path directory = "/tmp/multimap.KeyIndexTestFixture";
+  const boost::filesystem::path keys_file = directory / "partition.keys";
+  const boost::filesystem::path index_file = directory / "partition.index";
+};
+
+TEST_F(KeyIndexTestFixture, OpenReturnsNullIfIndexFileDoesNotExist) {
+  writeKeysAndIndexFile(makeKeys(10));
+  boost::filesystem::remove(index_file);
+  ASSERT_EQ(KeyIndex::open(index_file, keys_file, 10), nullptr);
+}
+
+TEST_F(KeyIndexTestFixture, OpenReturnsNullIfIndexDoesNotMatchKeysFile) {
+  writeKeysAndIndexFile(makeKeys(10));
+  ASSERT_EQ(KeyIndex::open(index_file, keys_file, 11), nullptr);
+  mt::fwrite(mt::fopen(keys_file, "a").get(), "x", 1);
+  ASSERT_EQ(KeyIndex::open(index_file, keys_file, 10), nullptr);
+}
+
+TEST_F(KeyIndexTestFixture, FindReturnsRecordsOfAllKeys) {
+  const auto keys = makeKeys(1000);
+  writeKeysAndIndexFile(keys);
+  const auto index = KeyIndex::open(index_file, keys_file, keys.size());
+  ASSERT_NE(index, nullptr);
+  ASSERT_EQ(index->size(), keys.size());
+  for (const auto& key : keys) {
+    const auto record = index->find(key);
+    ASSERT_NE(record.list, nullptr);
+    ASSERT_EQ(record.key, key);
+  }
+}
+
+TEST_F(KeyIndexTestFixture, FindReturnsNullForMissingKeys) {
+  const auto keys = makeKeys(1000);
+  writeKeysAndIndexFile(keys);
+  const auto index = KeyIndex::open(index_file, keys_file, keys.size());
+  ASSERT_NE(index, nullptr);
+  ASSERT_EQ(index->find("").list, nullptr);
+  ASSERT_EQ(index->find("key").list, nullptr);
+  ASSERT_EQ(index->find("key1000").list, nullptr);
+}
+
+TEST_F(KeyIndexTestFixture, FindInEmptyIndexReturnsNull) {
+  writeKeysAndIndexFile({});
+  const auto index = KeyIndex::open(index_file, keys_file, 0);
+  ASSERT_NE(index, nullptr);
+  ASSERT_EQ(index->find("key").list, nullptr);
+}
+
+TEST_F(KeyIndexTestFixture, ForEachRecordVisitsKeysInFileOrder) {
+  const auto keys = makeKeys(100);
+  writeKeysAndIndexFile(keys);
+  const auto index = KeyIndex::open(index_file, keys_file, keys.size());
+  ASSERT_NE(index, nullptr);
+  std::vector<std::string> actual;
+  index->forEachRecord([&](const KeyIndex::Record& record) {
+    actual.push_back(record.key.toString());
+  });
+  ASSERT_THAT(actual, ElementsAreArray(keys));
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -20,10 +20,49 @@
 namespace multimap {
 namespace internal {
 
+namespace {
+
+const size_t MAX_BLOCKS_PER_COPY = 256;
+// Bounds the buffer of `List::copyBlocks()`.
+
+const size_t MIN_TAIL_BLOCK_SIZE = 16;
+// Size of the tail block allocated for the first value of a list.
+
+const size_t MAX_METADATA_SIZE = 8;
+// Upper bound for the encoded size and shared prefix size of a value.
+
+}  // namespace
+
 uint32_t List::Limits::maxValueSize() {
   return Varint::Limits::MAX_N4_WITH_FLAG;
 }
 
+void List::Counters::add(const Stats& stats) {
+  if (stats.num_values_valid() != 0) {
+    num_keys_valid.fetch_add(1, std::memory_order_relaxed);
+  }
+  num_values_total.fetch_add(stats.num_values_total,
+                             std::memory_order_relaxed);
+  num_values_removed.fetch_add(stats.num_values_removed,
+                               std::memory_order_relaxed);
+}
+
+void List::Counters::update(const Stats& old_stats, const Stats& new_stats) {
+  // Unsigned arithmetic wraps around, so that adding the difference of two
+  // values also works if it is negative.
+  const uint64_t was_valid = old_stats.num_values_valid() != 0;
+  const uint64_t is_valid = new_stats.num_values_valid() != 0;
+  if (is_valid != was_valid) {
+    num_keys_valid.fetch_add(is_valid - was_valid, std::memory_order_relaxed);
+  }
+  num_values_total.fetch_add(
+      uint64_t(new_stats.num_values_total) - old_stats.num_values_total,
+      std::memory_order_relaxed);
+  num_values_removed.fetch_add(
+      uint64_t(new_stats.num_values_removed) - old_stats.num_values_removed,
+      std::memory_order_relaxed);
+}
+
 std::unique_ptr<List> List::readFromStream(std::FILE* stream) {
   std::unique_ptr<List> list(new List());
   readFromStream(stream, list.get());
@@ -37,64 +76,514 @@ void List::readFromStream(std::FILE* stream, List* list) {
   mt::fread(stream, &list->stats_.num_values_removed,
             sizeof list->stats_.num_values_removed);
   list->block_ids_ = UintVector::readFromStream(stream);
+  list->skip_index_.reset();
+  list->dirty_ = false;
+}
+
+std::unique_ptr<List> List::readFromBuffer(const char* buffer) {
+  std::unique_ptr<List> list(new List());
+  readFromBuffer(buffer, list.get());
+  return list;
+}
+
+void List::readFromBuffer(const char* buffer, List* list) {
+  WriterLockGuard<SharedMutex> lock(list->mutex_);
+  std::memcpy(&list->stats_.num_values_total, buffer,
+              sizeof list->stats_.num_values_total);
+  buffer += sizeof list->stats_.num_values_total;
+  std::memcpy(&list->stats_.num_values_removed, buffer,
+              sizeof list->stats_.num_values_removed);
+  buffer += sizeof list->stats_.num_values_removed;
+  list->block_ids_ = UintVector::readFromBuffer(buffer);
+  list->skip_index_.reset();
+  list->dirty_ = false;
+}
+
+size_t List::readFromBuffer(const char* buffer, List* list, Arena* arena) {
+  WriterLockGuard<SharedMutex> lock(list->mutex_);
+  std::memcpy(&list->stats_.num_values_total, buffer,
+              sizeof list->stats_.num_values_total);
+  buffer += sizeof list->stats_.num_values_total;
+  std::memcpy(&list->stats_.num_values_removed, buffer,
+              sizeof list->stats_.num_values_removed);
+  buffer += sizeof list->stats_.num_values_removed;
+  list->block_ids_ = UintVector::readFromBuffer(buffer, arena);
+  list->skip_index_.reset();
+  list->dirty_ = false;
+  return sizeof list->stats_ + list->block_ids_.getSerializedSize();
 }
 
 void List::writeToStream(std::FILE* stream) const {
-  ReaderLockGuard<SharedMutex> lock(mutex_);
+  UpgradeLock<SharedMutex> lock(mutex_);
+  writeToStreamUnlocked(stream);
+}
+
+void List::writeToStreamUnlocked(std::FILE* stream) const {
   mt::fwrite(stream, &stats_.num_values_total, sizeof stats_.num_values_total);
   mt::fwrite(stream, &stats_.num_values_removed,
              sizeof stats_.num_values_removed);
   block_ids_.writeToStream(stream);
 }
 
-void List::appendUnlocked(const Bytes& value, Store* store, Arena* arena) {
+bool List::compact(Store* store, Arena* arena, std::vector<std::string>* values,
+                   std::vector<uint32_t>* block_ids, Counters* counters) {
+  const auto iter = newUniqueIterator(store);
+  // `iter` keeps the list in locked state.
+  CountersUpdate update(*this, counters);
+  values->clear();
+  values->reserve(iter->available());
+  while (iter->hasNext()) {
+    values->push_back(iter->next().toString());
+  }
+  *block_ids = block_ids_.unpack();
+  const auto had_block = block_.hasData();
+  stats_ = Stats();
+  block_ids_.clear(arena);
+  block_.rewind();
+  skip_index_.reset();
+  const auto appended = appended_;
+  for (const auto& value : *values) {
+    appendUnlocked(value, store, arena);
+  }
+  appended_ = appended;
+  // Rewriting the values in their order keeps the list sorted.
+  dirty_ = true;
+  return !had_block && block_.hasData();
+}
+
+bool List::tryReclaim(Arena* arena) {
+  if (pins_.load(std::memory_order_acquire) != 0) return false;
+  WriterLock<SharedMutex> lock(mutex_, TRY_TO_LOCK);
+  if (!lock || dirty_ || stats_.num_values_valid() != 0 ||
+      !block_ids_.empty() || (block_.hasData() && block_.offset() != 0) ||
+      getDeadline() != 0) {
+    return false;
+  }
+  resetUnlocked(arena);
+  return true;
+}
+
+bool List::tryEvict(Arena* arena, bool keep_appended) {
+  if (pins_.load(std::memory_order_acquire) != 0) return false;
+  WriterLock<SharedMutex> lock(mutex_, TRY_TO_LOCK);
+  if (!lock || !isEvictableUnlocked(keep_appended)) return false;
+  resetUnlocked(arena);
+  return true;
+}
+
+void List::resetUnlocked(Arena* arena) {
+  if (block_.hasData()) {
+    arena->deallocate(block_.data(), block_.size());
+    block_ = ReadWriteBlock();
+  }
+  block_ids_.clear(arena);
+  skip_index_.reset();
+  stats_ = Stats();
+  appended_ = false;
+}
+
+uint32_t List::retire(uint32_t num_entries, Store* store, Arena* arena,
+                      std::vector<uint32_t>* block_ids) {
+  uint32_t num_retired = 0;
+  {
+    WriterLockGuard<SharedMutex> lock(mutex_);
+    num_retired = retireUnlocked(0, num_entries, store, arena, block_ids);
+  }
+  const auto num_marked = num_entries - num_retired;
+  if (num_marked != 0) {
+    auto iter = newUniqueIterator(store);
+    while (iter->hasNext()) {
+      iter->next();
+      if (iter->position() >= num_marked) break;
+      iter->remove();
+    }
+  }
+  return num_marked;
+}
+
+std::unique_ptr<Iterator> List::newReverseIterator(const Store& store) const {
+  return std::unique_ptr<Iterator>(new ReverseIterator(*this, store));
+}
+
+List::ReverseIterator::ReverseIterator(const List& list, const Store& store)
+    : iter_(list, store),
+      skip_index_(iter_.getSkipIndex()),
+      num_segments_(skip_index_ ? skip_index_->size() + 1 : 1),
+      available_(iter_.available()) {}
+
+Bytes List::ReverseIterator::next() {
+  MT_REQUIRE_TRUE(hasNext());
+  peekNext();
+  value_ = std::move(values_.back());
+  values_.pop_back();
+  --available_;
+  return value_;
+}
+
+Bytes List::ReverseIterator::peekNext() {
+  MT_REQUIRE_TRUE(hasNext());
+  while (values_.empty()) {
+    loadPreviousSegment();
+  }
+  return values_.back();
+}
+
+uint32_t List::ReverseIterator::skip(uint32_t num_values) {
+  num_values = std::min(num_values, available_);
+  auto remaining = num_values;
+  while (remaining != 0) {
+    if (values_.empty()) {
+      const auto size = getNumValidBefore(num_segments_) -
+                        getNumValidBefore(num_segments_ - 1);
+      if (size <= remaining) {
+        --num_segments_;
+        remaining -= size;
+        continue;
+      }
+      loadPreviousSegment();
+    }
+    const auto n = std::min<size_t>(remaining, values_.size());
+    values_.resize(values_.size() - n);
+    remaining -= n;
+  }
+  available_ -= num_values;
+  return num_values;
+}
+
+uint32_t List::ReverseIterator::getNumValidBefore(size_t segment) const {
+  if (segment == 0) return 0;
+  if (!skip_index_ || segment == skip_index_->size() + 1) {
+    return iter_.snapshot_.stats.num_values_valid();
+  }
+  return skip_index_->getNumValidBefore(segment - 1);
+}
+
+void List::ReverseIterator::loadPreviousSegment() {
+  MT_REQUIRE_NOT_ZERO(num_segments_);
+  const auto segment = --num_segments_;
+  if (segment == 0) {
+    iter_.stream_.seek(0, 0);
+    iter_.position_ = 0;
+  } else {
+    const auto& entry = skip_index_->getEntry(segment - 1);
+    iter_.stream_.seek(entry.block_index, entry.offset);
+    iter_.position_ = entry.position;
+  }
+  // The first value of a segment does not share a prefix with another one.
+  const auto num_valid =
+      getNumValidBefore(segment + 1) - getNumValidBefore(segment);
+  values_.clear();
+  values_.reserve(num_valid);
+  while (values_.size() != num_valid) {
+    bool is_marked_as_removed = false;
+    iter_.readNextEntry(&is_marked_as_removed);
+    if (!is_marked_as_removed) {
+      values_.push_back(iter_.value_.toString());
+    }
+  }
+}
+
+std::unique_ptr<List> List::copyBlocks(const Store& source,
+                                       Store* target) const {
+  UpgradeLock<SharedMutex> lock(mutex_);
+  MT_REQUIRE_ZERO(stats_.num_values_removed);
+  MT_REQUIRE_FALSE(block_.hasData() && block_.offset() != 0);
+  MT_REQUIRE_EQ(source.getBlockSize(), target->getBlockSize());
+  MT_REQUIRE_EQ(source.hasFrontCodedValues(), target->hasFrontCodedValues());
+  std::unique_ptr<List> copy(new List());
+  copy->stats_ = stats_;
+  const auto block_size = source.getBlockSize();
+  const auto block_ids = block_ids_.unpack();
+  std::vector<char> buffer;
+  std::vector<ExtendedReadOnlyBlock> blocks;
+  size_t begin = 0;
+  while (begin != block_ids.size()) {
+    // Blocks with consecutive ids are read with a single call.
+    auto end = begin + 1;
+    while (end != block_ids.size() &&
+           block_ids[end] == block_ids[end - 1] + 1 &&
+           end - begin != MAX_BLOCKS_PER_COPY) {
+      ++end;
+    }
+    buffer.resize((end - begin) * block_size);
+    source.getRange(block_ids[begin], end - begin, buffer.data());
+    blocks.clear();
+    for (size_t i = 0; i != end - begin; ++i) {
+      blocks.emplace_back(buffer.data() + i * block_size, block_size);
+    }
+    target->put(blocks, copy->getMinNextBlockIdUnlocked());
+    for (const auto& block : blocks) {
+      copy->block_ids_.add(block.id);
+    }
+    begin = end;
+  }
+  copy->dirty_ = true;
+  return copy;
+}
+
+void List::appendUnlocked(const Bytes& value, Store* store, Arena* arena,
+                          bool aligned) {
   MT_REQUIRE_LE(value.size(), Limits::maxValueSize());
   MT_REQUIRE_LT(stats_.num_values_total, std::numeric_limits<uint32_t>::max());
+  dirty_ = true;
+  appended_ = true;
+
+  reserveTailBlockUnlocked(value.size() + MAX_METADATA_SIZE,
+                           store->getBlockSize(), arena);
 
-  if (!block_.hasData()) {
-    const auto block_size = store->getBlockSize();
-    char* data = arena->allocate(block_size);
-    block_ = ReadWriteBlock(data, block_size);
+  if (store->hasFrontCodedValues()) {
+    appendFrontCodedUnlocked(value, store, arena);
+    stats_.num_values_total++;
+    return;
   }
 
-  // Write value's metadata.
+  // Write value's metadata.  An aligned value that fits into a block, but
+  // not into the rest of the local block, is written into a new one.
+  if (aligned && block_.offset() != 0 &&
+      value.size() + MAX_METADATA_SIZE > block_.remaining() &&
+      value.size() + MAX_METADATA_SIZE <= store->getBlockSize()) {
+    flushUnlocked(store, nullptr, arena);
+  }
   auto nbytes = block_.writeSizeWithFlag(value.size(), false);
   if (nbytes == 0) {
-    flushUnlocked(store);
+    flushUnlocked(store, nullptr, arena);
     nbytes = block_.writeSizeWithFlag(value.size(), false);
     MT_ASSERT_NOT_ZERO(nbytes);
   }
+  if (const auto skip_index = getSkipIndexForUpdateUnlocked()) {
+    skip_index->addValue(block_.offset() - nbytes);
+  }
 
   // Write value's data.
-  nbytes = block_.writeData(value.data(), value.size());
-  if (nbytes < value.size()) {
-    flushUnlocked(store);
+  writeDataUnlocked(value.data(), value.size(), store, arena);
+  stats_.num_values_total++;
+}
+
+void List::tryRetire(Cap* cap, Store* store, Arena* arena,
+                     Counters* counters) {
+  MT_REQUIRE_NOT_ZERO(cap->max_size);
+  WriterLock<SharedMutex> lock(mutex_, TRY_TO_LOCK);
+  if (!lock || stats_.num_values_valid() <= cap->max_size) return;
+  CountersUpdate update(*this, counters);
+  cap->num_entries_retired +=
+      retireUnlocked(cap->max_size, std::numeric_limits<uint32_t>::max(),
+                     store, arena, &cap->retired_block_ids);
+}
+
+uint32_t List::retireUnlocked(uint32_t min_valid, uint32_t max_entries,
+                              Store* store, Arena* arena,
+                              std::vector<uint32_t>* block_ids) {
+  const auto ids = block_ids_.unpack();
+  const auto num_valid = stats_.num_values_valid();
+  std::vector<char> buffer(store->getBlockSize());
+  size_t num_blocks_retired = 0;
+  uint32_t num_entries_retired = 0;
+  uint32_t num_valid_retired = 0;
+  uint32_t num_entries = 0;
+  uint32_t num_valid_read = 0;
+  uint64_t num_bytes_left = 0;
+  // Number of bytes of a value that continue in the next block.
+
+  for (size_t i = 0; i <= ids.size(); ++i) {
+    if (num_bytes_left == 0) {
+      // Block `i` starts with a value, so blocks before it can be dropped.
+      if (num_entries > max_entries ||
+          uint64_t(num_valid_read) + min_valid > num_valid) {
+        break;
+      }
+      num_blocks_retired = i;
+      num_entries_retired = num_entries;
+      num_valid_retired = num_valid_read;
+    }
+    if (i == ids.size()) break;  // The tail block is never dropped.
+
+    ReadWriteBlock block(buffer.data(), buffer.size());
+    store->get(ids[i], block);
+    if (num_bytes_left >= block.size()) {
+      num_bytes_left -= block.size();
+      continue;
+    }
+    block.seek(num_bytes_left);
+    num_bytes_left = 0;
+    uint32_t size = 0;
+    bool is_marked_as_removed = false;
+    while (block.readSizeWithFlag(&size, &is_marked_as_removed) != 0 &&
+           size != 0) {
+      ++num_entries;
+      num_valid_read += !is_marked_as_removed;
+      uint32_t prefix_size = 0;
+      if (store->hasFrontCodedValues()) {
+        block.readUint(&prefix_size);
+      }
+      const auto suffix_size = size - prefix_size;
+      if (suffix_size > block.remaining()) {
+        num_bytes_left = suffix_size - block.remaining();
+        break;
+      }
+      block.seek(block.offset() + suffix_size);
+    }
+  }
+  if (num_blocks_retired == 0) return 0;
+
+  block_ids->insert(block_ids->end(), ids.begin(),
+                    ids.begin() + num_blocks_retired);
+  block_ids_.clear(arena);
+  for (size_t i = num_blocks_retired; i != ids.size(); ++i) {
+    block_ids_.add(ids[i], arena);
+  }
+  stats_.num_values_removed += num_valid_retired;
+  skip_index_.reset();
+  dirty_ = true;
+  return num_entries_retired;
+}
+
+void List::appendFrontCodedUnlocked(const Bytes& value, Store* store,
+                                    Arena* arena) {
+  const auto encodeMetadata = [&value](uint32_t prefix_size, char* buffer,
+                                       size_t size) {
+    auto nbytes = Varint::writeUintWithFlag(value.size(), false, buffer, size);
+    nbytes += Varint::writeUint(prefix_size, buffer + nbytes, size - nbytes);
+    return nbytes;
+  };
+
+  // Write value's metadata.  If the value does not fit into the local block
+  // as a whole, it is written into a new one without sharing a prefix.
+  char metadata[8];
+  auto prefix_size = getSharedPrefixSizeUnlocked(value);
+  auto nbytes = encodeMetadata(prefix_size, metadata, sizeof metadata);
+  if (nbytes + value.size() - prefix_size > block_.remaining() &&
+      block_.offset() != 0) {
+    flushUnlocked(store, nullptr, arena);
+    prefix_size = 0;
+    nbytes = encodeMetadata(prefix_size, metadata, sizeof metadata);
+  }
+  const auto nbytes_written = block_.writeData(metadata, nbytes);
+  MT_ASSERT_EQ(nbytes_written, nbytes);
+  if (const auto skip_index = getSkipIndexForUpdateUnlocked()) {
+    skip_index->addValue(block_.offset() - nbytes);
+  }
 
-    // The value does not fit into the local block as a whole.
-    // Write the remaining bytes which cover entire blocks directly
-    // to the block file.  Write the rest into the local block.
+  // Write value's suffix.
+  if (writeDataUnlocked(value.data() + prefix_size, value.size() - prefix_size,
+                        store, arena) &&
+      block_.offset() != 0) {
+    // The next value must start at the beginning of a block, otherwise
+    // `getSharedPrefixSizeUnlocked()` could not find the values in it.
+    flushUnlocked(store, nullptr, arena);
+  }
+}
 
+bool List::writeDataUnlocked(const char* data, uint32_t size, Store* store,
+                             Arena* arena) {
+  const auto nbytes = block_.writeData(data, size);
+  if (nbytes == size) return false;
+
+  // The value does not fit into the local block as a whole, which is full
+  // now and has grown to the block size of the store.  Write it together
+  // with the remaining bytes which cover entire blocks directly to the block
+  // file.  Write the rest into the local block.  The blocks get consecutive
+  // ids, so that the value is stored contiguously, except for a rest in the
+  // next block.  This lets `UintVector` store the ids in constant space and
+  // iterators return the value without copying it from a stable store.
+
+  MT_ASSERT_EQ(block_.size(), store->getBlockSize());
+  const auto block_size = block_.size();
+  const char* tail_data = data + nbytes;
+  uint32_t remaining = size - nbytes;
+  if (remaining < block_size) {
+    flushUnlocked(store, nullptr, arena);
+  } else {
     std::vector<ExtendedReadOnlyBlock> blocks;
-    const auto block_size = block_.size();
-    const char* tail_data = value.data() + nbytes;
-    uint32_t remaining = value.size() - nbytes;
+    blocks.emplace_back(block_.data(), block_size);
     while (remaining >= block_size) {
       blocks.emplace_back(tail_data, block_size);
       tail_data += block_size;
       remaining -= block_size;
     }
-    if (!blocks.empty()) {
-      store->put(blocks);
-      for (const auto& block : blocks) {
-        block_ids_.add(block.id);
+    store->putRun(blocks, getMinNextBlockIdUnlocked());
+    for (const auto& block : blocks) {
+      block_ids_.add(block.id, arena);
+      if (const auto skip_index = getSkipIndexForUpdateUnlocked()) {
+        skip_index->addBlock();
       }
     }
-    if (remaining != 0) {
-      nbytes = block_.writeData(tail_data, remaining);
-      MT_ASSERT_EQ(nbytes, remaining);
+    block_.rewind();
+  }
+  if (remaining != 0) {
+    const auto nbytes = block_.writeData(tail_data, remaining);
+    MT_ASSERT_EQ(nbytes, remaining);
+  }
+  return true;
+}
+
+void List::reserveTailBlockUnlocked(size_t nbytes, size_t block_size,
+                                    Arena* arena) {
+  if (block_.hasData() &&
+      (block_.remaining() >= nbytes || block_.size() == block_size)) {
+    return;
+  }
+  auto size = std::max(MIN_TAIL_BLOCK_SIZE, block_.size());
+  while (size < block_.offset() + nbytes && size < block_size) {
+    size *= 2;
+  }
+  size = std::min(size, block_size);
+  char* data = arena->allocate(size);
+  const auto offset = block_.offset();
+  if (block_.hasData()) {
+    std::memcpy(data, block_.data(), offset);
+    arena->deallocate(block_.data(), block_.size());
+  }
+  block_ = ReadWriteBlock(data, size);
+  block_.seek(offset);
+}
+
+uint32_t List::putTailBlockUnlocked(Store* store) {
+  // A list that already has blocks asks for an extent twice as long as its
+  // last run of consecutive blocks, so that long lists are written in ever
+  // longer runs, while lists with a single block do not reserve any.
+  const auto extent_size =
+      block_ids_.empty()
+          ? 1
+          : std::min(2 * block_ids_.getLengthOfLastRun(),
+                     store->getMaxExtentSize());
+  if (block_.size() == store->getBlockSize()) {
+    block_.fillUpWithZeros();
+    return store->put(block_, getMinNextBlockIdUnlocked(), extent_size);
+  }
+  // A tail block that has not grown to full size is padded with zeros.
+  std::vector<char> buffer(store->getBlockSize());
+  std::memcpy(buffer.data(), block_.data(), block_.offset());
+  return store->put(ReadOnlyBlock(buffer.data(), buffer.size()),
+                    getMinNextBlockIdUnlocked(), extent_size);
+}
+
+uint32_t List::getSharedPrefixSizeUnlocked(const Bytes& value) const {
+  if (block_.offset() == 0) return 0;
+  // Let `shared` be the size of the prefix that `value` shares with the
+  // current value.  If the next value shares at most `shared` bytes with the
+  // current one, it equals `value` up to its prefix and the comparison
+  // continues with its suffix.  Otherwise `shared` remains unchanged.
+  ReadOnlyBlock block(block_.data(), block_.offset());
+  uint32_t shared = 0;
+  while (block.remaining() != 0) {
+    uint32_t size = 0;
+    bool flag = false;
+    uint32_t prefix_size = 0;
+    block.readSizeWithFlag(&size, &flag);
+    block.readUint(&prefix_size);
+    const auto suffix = block.readDataInPlace(size - prefix_size);
+    MT_ASSERT_NOT_NULL(suffix);
+    if (prefix_size <= shared) {
+      const auto max_size =
+          std::min<size_t>(size, value.size()) - prefix_size;
+      uint32_t i = 0;
+      while (i != max_size && suffix[i] == value.data()[prefix_size + i]) {
+        ++i;
+      }
+      shared = prefix_size + i;
     }
   }
-  stats_.num_values_total++;
+  return shared;
 }
 
 }  // namespace internal
@@ -18,13 +18,19 @@
 #ifndef MULTIMAP_INTERNAL_LIST_HPP_INCLUDED
 #define MULTIMAP_INTERNAL_LIST_HPP_INCLUDED
 
+#include <atomic>
 #include <cstdio>
+#include <cstring>
 #include <functional>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <vector>
+#include <boost/smart_ptr/intrusive_ptr.hpp>
 #include "multimap/internal/Arena.hpp"
 #include "multimap/internal/Locks.hpp"
 #include "multimap/internal/SharedMutex.hpp"
+#include "multimap/internal/SkipIndex.hpp"
 #include "multimap/internal/Store.hpp"
 #include "multimap/internal/UintVector.hpp"
 #include "multimap/thirdparty/mt/mt.hpp"
@@ -39,6 +45,17 @@ class List : public mt::Resource {
   //
   //   * Dependency injection, e.g. for `List::append()`.
   //   * Mutex allocation only on demand using class SharedMutex.
+  //
+  // If the store has front-coded values, each value is written as its size,
+  // the size of the prefix it shares with the previous value, and the
+  // remaining suffix.  Values only share a prefix with values in the same
+  // block, so that writers never have to look into flushed blocks.
+  //
+  // Appending only adds values behind the ones that readers have seen, and
+  // never modifies flushed blocks.  Therefore, appends and flushes take an
+  // upgrade lock, which iterators do not block, while removing and replacing
+  // values requires the writer lock.  Accessors that read the current state
+  // take the upgrade lock as well.
 
  public:
   struct Limits {
@@ -61,64 +78,156 @@ class List : public mt::Resource {
   static_assert(mt::hasExpectedSize<Stats>(8, 8),
                 "class List::Stats does not have expected size");
 
+  struct Counters {
+    std::atomic<uint64_t> num_keys_valid{0};
+    std::atomic<uint64_t> num_values_total{0};
+    std::atomic<uint64_t> num_values_removed{0};
+
+    void add(const Stats& stats);
+    void update(const Stats& old_stats, const Stats& new_stats);
+  };
+  // Running totals of the stats of many lists.  Updates that are passed a
+  // pointer to an instance apply their change while holding the lock of the
+  // list, hence the totals are exact once all updates have returned.
+
+  struct Cap {
+    uint32_t max_size = 0;
+    // Number of valid values the list is bounded to.  Must not be zero.
+
+    uint32_t num_entries_retired = 0;
+    std::vector<uint32_t> retired_block_ids;
+    // Incremented and appended to by the appending methods, see
+    // `append()`, which might retire leading blocks of the list.
+  };
+
   List() = default;
 
   static std::unique_ptr<List> readFromStream(std::FILE* stream);
   static void readFromStream(std::FILE* stream, List* list);
+  static std::unique_ptr<List> readFromBuffer(const char* buffer);
+  static void readFromBuffer(const char* buffer, List* list);
+
+  static size_t readFromBuffer(const char* buffer, List* list, Arena* arena);
+  // Same as before, but the block ids refer to memory of `arena`, see
+  // `UintVector::readFromBuffer()`.  Returns the number of bytes read.
+
   void writeToStream(std::FILE* stream) const;
 
-  void append(const Bytes& value, Store* store, Arena* arena) {
-    WriterLockGuard<SharedMutex> lock(mutex_);
-    appendUnlocked(value, store, arena);
+  void writeToStreamUnlocked(std::FILE* stream) const;
+
+  bool append(const Bytes& value, Store* store, Arena* arena,
+              Counters* counters = nullptr, Cap* cap = nullptr) {
+    return append(&value, &value + 1, store, arena, counters, cap);
   }
+  // Returns `true` if a new tail block has been allocated from `arena`.
+  // If `counters` is not null, it is updated by the change of the stats.
+  // The same applies to the other operations that modify the list.
+  //
+  // If `cap` is not null, values that fit into a block are not split across
+  // blocks.  If the append has flushed a block, leading blocks are dropped
+  // as long as `cap->max_size` valid values remain, see `retire()`.  Since
+  // only whole blocks are dropped, the list keeps up to about two blocks of
+  // values more.  Dropping requires the writer lock, which is only tried to
+  // be acquired, so that iterators do not block appends; if that fails, a
+  // later append catches up.  Dropped values count as removed, and the
+  // positions of the remaining ones decrease by `cap->num_entries_retired`.
 
   template <typename InputIter>
-  void append(InputIter first, InputIter last, Store* store, Arena* arena) {
-    WriterLockGuard<SharedMutex> lock(mutex_);
-    while (first != last) {
-      appendUnlocked(*first, store, arena);
-      ++first;
+  bool append(InputIter first, InputIter last, Store* store, Arena* arena,
+              Counters* counters = nullptr, Cap* cap = nullptr) {
+    bool has_new_block = false;
+    bool has_flushed = false;
+    {
+      UpgradeLock<SharedMutex> lock(mutex_);
+      CountersUpdate update(*this, counters);
+      const auto had_block = block_.hasData();
+      const auto min_next_block_id = getMinNextBlockIdUnlocked();
+      while (first != last) {
+        appendUnlocked(*first, store, arena, cap != nullptr);
+        ++first;
+      }
+      has_new_block = !had_block && block_.hasData();
+      has_flushed = getMinNextBlockIdUnlocked() != min_next_block_id;
+    }
+    if (cap && has_flushed) {
+      tryRetire(cap, store, arena, counters);
     }
+    return has_new_block;
   }
+  // Returns `true` if a new tail block has been allocated from `arena`.
 
   std::unique_ptr<Iterator> newIterator(const Store& store) const {
     return newSharedIterator(store);
   }
 
   template <typename Predicate>
-  bool removeOne(Predicate predicate, Store* store) {
+  bool removeOne(Predicate predicate, Store* store,
+                 std::vector<uint32_t>* positions = nullptr,
+                 Counters* counters = nullptr) {
     auto iter = newUniqueIterator(store);
+    CountersUpdate update(*this, counters);
     while (iter->hasNext()) {
       if (predicate(iter->next())) {
         iter->remove();
+        if (positions) positions->push_back(iter->position());
         return true;
       }
     }
     return false;
   }
+  // If `positions` is not null, the positions of removed values, as
+  // understood by `removeAt()`, are appended to it.  The same applies to the
+  // other remove and replace operations.
 
   template <typename Predicate>
-  uint32_t removeAll(Predicate predicate, Store* store) {
+  uint32_t removeAll(Predicate predicate, Store* store,
+                     std::vector<uint32_t>* positions = nullptr,
+                     Counters* counters = nullptr) {
     uint32_t num_removed = 0;
     auto iter = newUniqueIterator(store);
+    CountersUpdate update(*this, counters);
     while (iter->hasNext()) {
       if (predicate(iter->next())) {
         iter->remove();
+        if (positions) positions->push_back(iter->position());
         ++num_removed;
       }
     }
     return num_removed;
   }
 
+  void removeAt(uint32_t position, Store* store,
+                Counters* counters = nullptr) {
+    auto iter = newUniqueIterator(store);
+    CountersUpdate update(*this, counters);
+    iter->removeAt(position);
+  }
+  // Marks the value at `position` as removed, where `position` counts all
+  // values written since the list was created or cleared, including removed
+  // ones.  The value is counted as removed even if it has already been
+  // marked as such; this makes it possible to replay a logged removal onto
+  // blocks that might have been updated in place before a crash.
+
+  void replaceAt(uint32_t position, const Bytes& value, Store* store) {
+    newUniqueIterator(store)->replaceAt(position, value);
+  }
+  // Overwrites the value at `position`, counted as for `removeAt()`, which
+  // must have the same size as `value`.  This replays a logged in-place
+  // replacement and has no effect if it has been applied before.
+
   template <typename Function>
-  bool replaceOne(Function map, Store* store, Arena* arena) {
+  bool replaceOne(Function map, Store* store, Arena* arena,
+                  std::vector<uint32_t>* positions = nullptr,
+                  Counters* counters = nullptr) {
     std::vector<std::string> replaced_values;
     auto iter = newUniqueIterator(store);
+    CountersUpdate update(*this, counters);
     while (iter->hasNext()) {
       auto replaced_value = map(iter->next());
       if (!replaced_value.empty()) {
         replaced_values.push_back(std::move(replaced_value));
         iter->remove();
+        if (positions) positions->push_back(iter->position());
         break;
       }
     }
@@ -130,14 +239,18 @@ class List : public mt::Resource {
   }
 
   template <typename Function>
-  uint32_t replaceAll(Function map, Store* store, Arena* arena) {
+  uint32_t replaceAll(Function map, Store* store, Arena* arena,
+                      std::vector<uint32_t>* positions = nullptr,
+                      Counters* counters = nullptr) {
     std::vector<std::string> replaced_values;
     auto iter = newUniqueIterator(store);
+    CountersUpdate update(*this, counters);
     while (iter->hasNext()) {
       auto replaced_value = map(iter->next());
       if (!replaced_value.empty()) {
         replaced_values.push_back(std::move(replaced_value));
         iter->remove();
+        if (positions) positions->push_back(iter->position());
       }
     }
     // `iter` keeps the list in locked state.
@@ -147,74 +260,333 @@ class List : public mt::Resource {
     return replaced_values.size();
   }
 
+  bool replaceOne(const Bytes& old_value, const Bytes& new_value,
+                  Store* store, Arena* arena,
+                  std::vector<uint32_t>* positions = nullptr,
+                  Counters* counters = nullptr) {
+    return replace(old_value, new_value, 1, store, arena, positions,
+                   counters) != 0;
+  }
+
+  uint32_t replaceAll(const Bytes& old_value, const Bytes& new_value,
+                      Store* store, Arena* arena,
+                      std::vector<uint32_t>* positions = nullptr,
+                      Counters* counters = nullptr) {
+    return replace(old_value, new_value, std::numeric_limits<uint32_t>::max(),
+                   store, arena, positions, counters);
+  }
+  // Same as the versions above, but replace values equal to `old_value` by
+  // `new_value`.  If both have the same size, see `isReplacedInPlace()`,
+  // the matches are overwritten and keep their position.  Otherwise they
+  // are removed and `new_value` is appended once per match without being
+  // copied.  In both cases `positions` receives the positions of the
+  // matches.
+
+  static bool isReplacedInPlace(const Bytes& old_value,
+                                const Bytes& new_value, const Store& store) {
+    return old_value.size() == new_value.size() &&
+           !store.hasFrontCodedValues();
+  }
+  // Front-coded values cannot be overwritten, since subsequent values may
+  // share a prefix with them.
+
   Stats getStats() const {
-    ReaderLockGuard<SharedMutex> lock(mutex_);
+    UpgradeLock<SharedMutex> lock(mutex_);
     return getStatsUnlocked();
   }
 
   bool tryGetStats(Stats* stats) const {
-    ReaderLock<SharedMutex> lock(mutex_, TRY_TO_LOCK);
+    UpgradeLock<SharedMutex> lock(mutex_, TRY_TO_LOCK);
     return lock ? (*stats = getStatsUnlocked(), true) : false;
   }
 
   Stats getStatsUnlocked() const { return stats_; }
 
-  void flush(Store* store, Stats* stats = nullptr) {
-    WriterLockGuard<SharedMutex> lock(mutex_);
-    flushUnlocked(store, stats);
+  std::vector<uint32_t> getBlockIdsUnlocked() const {
+    return block_ids_.unpack();
   }
+  // Returns the ids of the blocks in the store that hold the values of the
+  // list in order, which does not include the tail block.
 
-  bool tryFlush(Store* store, Stats* stats = nullptr) {
-    WriterLock<SharedMutex> lock(mutex_, TRY_TO_LOCK);
-    return lock ? (flushUnlocked(store, stats), true) : false;
+  UintVector::Cursor getBlockIdCursorUnlocked() const {
+    return block_ids_.getCursor();
   }
+  // Same as `getBlockIdsUnlocked()`, but decodes the ids on demand.
 
-  void flushUnlocked(Store* store, Stats* stats = nullptr) {
-    if (block_.hasData()) {
-      block_.fillUpWithZeros();
-      block_ids_.add(store->put(block_));
+  void flush(Store* store, Stats* stats = nullptr, Arena* arena = nullptr) {
+    UpgradeLock<SharedMutex> lock(mutex_);
+    flushUnlocked(store, stats, arena);
+  }
+
+  bool tryFlush(Store* store, Stats* stats = nullptr,
+                Arena* arena = nullptr) {
+    UpgradeLock<SharedMutex> lock(mutex_, TRY_TO_LOCK);
+    return lock ? (flushUnlocked(store, stats, arena), true) : false;
+  }
+
+  void flushUnlocked(Store* store, Stats* stats = nullptr,
+                     Arena* arena = nullptr) {
+    if (block_.hasData() && block_.offset() != 0) {
+      // An empty tail block, e.g. after `clear()`, would only waste space.
+      block_ids_.add(putTailBlockUnlocked(store), arena);
       block_.rewind();
+      if (const auto skip_index = getSkipIndexForUpdateUnlocked()) {
+        skip_index->addBlock();
+      }
     }
     if (stats) *stats = stats_;
   }
 
-  uint32_t clear() {
+  bool tryFlushAndRelease(Store* store, Arena* arena) {
+    UpgradeLock<SharedMutex> lock(mutex_, TRY_TO_LOCK);
+    if (!lock) return false;
+    if (block_.hasData()) {
+      flushUnlocked(store, nullptr, arena);
+      arena->deallocate(block_.data(), block_.size());
+      block_ = ReadWriteBlock();
+    }
+    return true;
+  }
+  // Flushes the tail block, if not empty, and returns its memory to `arena`.
+  // The next append allocates a new one.  Returns `false` without doing
+  // anything if the list is currently being updated.
+
+  bool tryReclaim(Arena* arena);
+  // Returns the memory of an empty list to `arena` and resets the list to
+  // the state of a newly constructed one.  Returns `false` without doing
+  // anything if the list is pinned or locked, has been modified since it
+  // was last passed to `tryFlushIfDirty()`, or has valid values or blocks.
+
+  template <typename Procedure>
+  bool tryVisitIfEvictable(bool keep_appended, Procedure process) const {
+    if (pins_.load(std::memory_order_acquire) != 0) return false;
+    UpgradeLock<SharedMutex> lock(mutex_, TRY_TO_LOCK);
+    if (!lock || !isEvictableUnlocked(keep_appended)) return false;
+    process(*this);
+    return true;
+  }
+  // Calls `process` with the list still locked, so that it can be written
+  // via `writeToStreamUnlocked()`, if `tryEvict()` would currently succeed.
+
+  bool tryEvict(Arena* arena, bool keep_appended);
+  // Same as `tryReclaim()`, but the list may have values, which the caller
+  // must have written before, since they are only kept on disk afterwards.
+  // The tail block must have been flushed, and if `keep_appended`, the list
+  // must not have been appended to, since that is not serialized.
+
+  size_t getNumBytesInMemoryUnlocked() const {
+    return getNumBytesOfBlockIdsUnlocked() + getNumBytesOfTailBlockUnlocked();
+  }
+  // Returns the approximate number of bytes held by the block ids and the
+  // tail block, which is rather too low than too high.
+
+  size_t getNumBytesOfBlockIdsUnlocked() const {
+    // The serialized size includes a size field, which is not allocated.
+    return block_ids_.getSerializedSize() - sizeof(uint32_t);
+  }
+
+  size_t getNumBytesOfTailBlockUnlocked() const {
+    return block_.hasData() ? block_.size() : 0;
+  }
+
+  bool tryGetNumBytesInMemory(size_t* block_ids, size_t* tail_block) const {
+    UpgradeLock<SharedMutex> lock(mutex_, TRY_TO_LOCK);
+    if (!lock) return false;
+    *block_ids = getNumBytesOfBlockIdsUnlocked();
+    *tail_block = getNumBytesOfTailBlockUnlocked();
+    return true;
+  }
+  // Same as the two methods above, but returns `false` without doing
+  // anything if the list is currently being updated.
+
+  void pin() const { pins_.fetch_add(1, std::memory_order_relaxed); }
+
+  void unpin() const { pins_.fetch_sub(1, std::memory_order_release); }
+  // A pinned list is not reclaimed.  Class Partition pins a list while it
+  // is used outside the lock of its shard, under which it was looked up.
+
+  template <typename Procedure>
+  bool tryFlushIfDirty(Store* store, Procedure process,
+                       Arena* arena = nullptr) {
+    UpgradeLock<SharedMutex> lock(mutex_, TRY_TO_LOCK);
+    if (!lock) return false;
+    if (dirty_) {
+      flushUnlocked(store, nullptr, arena);
+      process(*this);
+      dirty_ = false;
+    }
+    return true;
+  }
+  // If the list has been modified since it was read or last passed to this
+  // method, flushes the tail block and calls `process` with the list still
+  // locked, so that it can be written via `writeToStreamUnlocked()`.
+  // Returns `false` without doing anything if the list is currently being
+  // updated.
+
+  template <typename Procedure>
+  void flushAndVisit(Store* store, Procedure process, Arena* arena = nullptr) {
+    UpgradeLock<SharedMutex> lock(mutex_);
+    flushUnlocked(store, nullptr, arena);
+    process(*this);
+  }
+  // Same as before, but waits for the lock and calls `process` even if the
+  // list has not been modified, which keeps its dirty state.
+
+  bool isDirty() const {
+    UpgradeLock<SharedMutex> lock(mutex_);
+    return dirty_;
+  }
+
+  bool isDirtyUnlocked() const { return dirty_; }
+
+  bool wasAppendedTo() const {
+    UpgradeLock<SharedMutex> lock(mutex_);
+    return appended_;
+  }
+
+  bool wasAppendedToUnlocked() const { return appended_; }
+  // Returns `true` if values have been appended since the list was read, in
+  // which case an order established before, see `Map::optimize()`, may no
+  // longer hold.
+
+  uint32_t clear(std::vector<uint32_t>* block_ids = nullptr,
+                 Counters* counters = nullptr, Arena* arena = nullptr) {
     WriterLockGuard<SharedMutex> lock(mutex_);
+    CountersUpdate update(*this, counters);
     const auto num_removed = stats_.num_values_valid();
     stats_.num_values_removed = stats_.num_values_total;
-    block_ids_.clear();
+    if (block_ids) {
+      *block_ids = block_ids_.unpack();
+    }
+    block_ids_.clear(arena);
+    block_.rewind();
+    skip_index_.reset();
+    dirty_ = true;
+    // Values in the tail block must not show up again after the next append.
+    deadline_.store(0, std::memory_order_relaxed);
     return num_removed;
   }
+  // Marks all values as removed and returns their number.  If `block_ids` is
+  // not null, the ids of the blocks that are no longer used are assigned.
+  // `arena`, if not null, must be the one passed to the appending methods.
+  // The deadline of the list, if any, is reset as well.
+
+  uint32_t getDeadline() const {
+    return deadline_.load(std::memory_order_relaxed);
+  }
+
+  void setDeadline(uint32_t deadline) {
+    deadline_.store(deadline, std::memory_order_relaxed);
+  }
+  // The deadline is the time in seconds since the epoch from which on class
+  // Partition regards the list as expired, or zero if it never expires.  It
+  // is not part of the serialized list.
+
+  uint32_t retire(uint32_t num_entries, Store* store, Arena* arena,
+                  std::vector<uint32_t>* block_ids);
+  // Replays the retirement of the first `num_entries` values, removed or
+  // not, by an append with a cap.  Since blocks may have been flushed at
+  // other boundaries since, only the leading blocks that hold nothing else
+  // are dropped, and the rest of these values is marked as removed.  The ids
+  // of the dropped blocks are appended to `block_ids`.  Returns the number
+  // of values that have been marked, which still precede the positions that
+  // were logged after the retirement.
+
+  bool compact(Store* store, Arena* arena, std::vector<std::string>* values,
+               std::vector<uint32_t>* block_ids,
+               Counters* counters = nullptr);
+  // Rewrites the valid values into new blocks, so that the list no longer
+  // accounts for removed values.  Copies of the values, which are needed to
+  // log the operation, are assigned to `values`, and the ids of the blocks
+  // that are no longer used to `block_ids`.  Returns `true` if a new tail
+  // block has been allocated from `arena`.
+
+  std::unique_ptr<List> copyBlocks(const Store& source, Store* target) const;
+  // Returns a list with the same values whose blocks have been copied from
+  // `source` to `target` without decoding them.  Requires: the list has no
+  // removed values and no values in its tail block, and both stores have
+  // the same block size and value encoding.
 
   uint32_t size() const {
-    ReaderLockGuard<SharedMutex> lock(mutex_);
+    UpgradeLock<SharedMutex> lock(mutex_);
     return stats_.num_values_valid();
   }
 
   bool empty() const { return size() == 0; }
 
+  uint64_t getNumBytes(uint32_t block_size) const {
+    UpgradeLock<SharedMutex> lock(mutex_);
+    return uint64_t(block_size) * block_ids_.size() +
+           (block_.hasData() ? block_.offset() : 0);
+  }
+  // Returns the number of bytes the list occupies in the store plus the
+  // used part of its tail block, where `block_size` is the block size of
+  // the store.  Removed values count until they are compacted away.
+
+  class ReverseIterator;
+
+  std::unique_ptr<Iterator> newReverseIterator(const Store& store) const;
+  // Returns an iterator that yields the values from the newest to the
+  // oldest, see class ReverseIterator below.
+
  private:
   template <bool IsMutable>
   class Iter : public Iterator {
+    friend class ReverseIterator;
+
+    struct Snapshot : public mt::Resource {
+      Snapshot() = default;
+
+      explicit Snapshot(const List& list) {
+        list.mutex_.lock_upgrade();
+        stats = list.stats_;
+        block_ids = list.block_ids_.copy();
+        if (list.block_.hasData() && list.block_.offset() != 0) {
+          tail.assign(list.block_.data(),
+                      list.block_.data() + list.block_.offset());
+          tail_block = ReadWriteBlock(tail.data(), tail.size());
+        }
+        skip_index = list.skip_index_;
+        appended = list.appended_;
+        list.mutex_.unlock_upgrade_and_lock_shared();
+      }
+      // Copies the state of `list` and leaves it locked by a reader lock.
+
+      List::Stats stats;
+      UintVector block_ids;
+      std::vector<char> tail;
+      ReadWriteBlock tail_block;
+      // Refers to `tail`, which holds the written part of the tail block.
+
+      boost::intrusive_ptr<SkipIndex> skip_index;
+      bool appended = false;
+    };
+    // The part of a list that values can be appended to, as seen by a shared
+    // iterator.  Values in flushed blocks are read from the store, whose
+    // blocks can only be changed by writers.
+
     class Stream : public mt::Resource {
      public:
-      static const uint32_t BLOCK_CACHE_SIZE = 1024;
+      static const uint32_t MIN_READ_AHEAD = 4;
+      // Number of blocks loaded first.  Each further load doubles the number
+      // up to `Store::getMaxReadAhead()`, so that short lookups allocate
+      // little, while long scans read large batches.
 
       MT_ENABLE_IF(IsMutable)
       Stream(List* list, Store* store)
-          : block_ids_(list->block_ids_.unpack()),
+          : block_ids_(list->block_ids_.getCursor()),
+            first_block_ids_(block_ids_),
             last_block_(list->block_.getView()),
-            store_(store) {
-        std::reverse(block_ids_.begin(), block_ids_.end());
-      }
+            store_(store),
+            read_ahead_(std::min(MIN_READ_AHEAD, store->getMaxReadAhead())) {}
 
       MT_DISABLE_IF(IsMutable)
-      Stream(const List& list, const Store& store)
-          : block_ids_(list.block_ids_.unpack()),
-            last_block_(list.block_.getView()),
-            store_(&store) {
-        std::reverse(block_ids_.begin(), block_ids_.end());
-      }
+      Stream(const Snapshot& snapshot, const Store& store)
+          : block_ids_(snapshot.block_ids.getCursor()),
+            first_block_ids_(block_ids_),
+            last_block_(snapshot.tail_block.getView()),
+            store_(&store),
+            read_ahead_(std::min(MIN_READ_AHEAD, store.getMaxReadAhead())) {}
 
       ~Stream() { writeBackMutatedBlocks(); }
 
@@ -230,20 +602,56 @@ class List : public mt::Resource {
             } else {
               size_with_flag_ptr_.index = blocks_index_;
               size_with_flag_ptr_.offset = block.offset() - nbytes;
+              size_with_flag_ptr_.size = nbytes;
               return;
             }
           }
-          if (block_ids_.empty()) {
+          if (!block_ids_.hasNext()) {
             const auto nbytes = last_block_.readSizeWithFlag(size, flag);
             MT_ASSERT_NOT_ZERO(nbytes);
             size_with_flag_ptr_.index = blocks_index_;
             size_with_flag_ptr_.offset = last_block_.offset() - nbytes;
+            size_with_flag_ptr_.size = nbytes;
             return;
           }
           loadNextBlocks(true);
         }
       }
 
+      bool hasNextEntry(uint32_t tail_size) {
+        while (true) {
+          if (blocks_index_ < blocks_.size()) {
+            auto& block = blocks_[blocks_index_];
+            const auto offset = block.offset();
+            uint32_t size = 0;
+            bool flag = false;
+            const auto nbytes = block.readSizeWithFlag(&size, &flag);
+            block.seek(offset);
+            if (nbytes != 0 && size != 0) return true;
+            ++blocks_index_;
+            continue;
+          }
+          if (!block_ids_.hasNext()) {
+            return last_block_.hasData() && last_block_.offset() < tail_size;
+          }
+          loadNextBlocks(true);
+        }
+      }
+      // Returns `true` if there is another entry, removed or not, where
+      // `tail_size` is the number of bytes written to the tail block.  Unlike
+      // the number of values in the list's stats, this does not include the
+      // values dropped by `clear()`.
+
+      void readUint(uint32_t* value) {
+        auto& block = (blocks_index_ < blocks_.size())
+                          ? static_cast<ReadWriteBlock&>(blocks_[blocks_index_])
+                          : last_block_;
+        const auto nbytes = block.readUint(value);
+        MT_ASSERT_NOT_ZERO(nbytes);
+      }
+      // Reads an integer that follows the last extracted size with flag.
+      // Both are always located in the same block.
+
       void readData(char* target, uint32_t size) {
         uint32_t nbytes = 0;
         do {
@@ -256,7 +664,7 @@ class List : public mt::Resource {
             target += nbytes;
             size -= nbytes;
 
-          } else if (block_ids_.empty()) {
+          } else if (!block_ids_.hasNext()) {
             nbytes = last_block_.readData(target, size);
             MT_ASSERT_EQ(nbytes, size);
             size -= nbytes;
@@ -267,6 +675,45 @@ class List : public mt::Resource {
         } while (size > 0);
       }
 
+      void skipData(uint32_t size) {
+        while (size != 0) {
+          if (blocks_index_ < blocks_.size()) {
+            auto& block = blocks_[blocks_index_];
+            const auto nbytes = std::min<size_t>(size, block.remaining());
+            block.readDataInPlace(nbytes);
+            if (nbytes < size) {
+              ++blocks_index_;
+            }
+            size -= nbytes;
+
+          } else if (!block_ids_.hasNext()) {
+            const auto data = last_block_.readDataInPlace(size);
+            MT_ASSERT_NOT_NULL(data);
+            size = 0;
+
+          } else {
+            loadNextBlocks(false);
+          }
+        }
+      }
+      // Same as `readData()`, but does not copy the data.
+
+      const char* readDataInPlace(uint32_t size) {
+        if (blocks_index_ < blocks_.size()) {
+          if (const auto data = blocks_[blocks_index_].readDataInPlace(size)) {
+            return data;
+          }
+          return IsMutable ? nullptr : readContiguousDataInPlace(size);
+        }
+        return block_ids_.hasNext() ? nullptr
+                                   : last_block_.readDataInPlace(size);
+      }
+      // Returns a pointer to the next `size` bytes if they are located in a
+      // single block or in consecutive blocks that are adjacent in memory,
+      // otherwise `nullptr` and `readData()` must be used.  The pointer is
+      // valid until the next call of `readSizeWithFlag()` that moves to
+      // another block.
+
       MT_ENABLE_IF(IsMutable)
       void overwriteLastExtractedFlag(bool value) {
         if (size_with_flag_ptr_.index < blocks_.size()) {
@@ -280,45 +727,196 @@ class List : public mt::Resource {
         }
       }
 
+      MT_ENABLE_IF(IsMutable)
+      void overwriteLastExtractedData(const char* data, uint32_t size) {
+        auto index = size_with_flag_ptr_.index;
+        size_t offset = size_with_flag_ptr_.offset + size_with_flag_ptr_.size;
+        while (size != 0) {
+          if (index < blocks_.size()) {
+            auto& block = blocks_[index];
+            const auto nbytes = std::min<size_t>(size, block.size() - offset);
+            std::memcpy(block.data() + offset, data, nbytes);
+            block.ignore = false;
+            data += nbytes;
+            size -= nbytes;
+            offset = 0;
+            ++index;
+          } else {
+            MT_ASSERT_LE(offset + size, last_block_.size());
+            std::memcpy(last_block_.data() + offset, data, size);
+            size = 0;
+          }
+        }
+      }
+      // Overwrites the data of the value whose size with flag was extracted
+      // last, which must have been read completely and have `size` bytes.
+      // The data directly follows the size with flag, possibly continued in
+      // subsequent blocks, all of which are still loaded.
+
+      void seek(uint32_t block_index, uint32_t offset) {
+        const auto first_loaded = num_block_ids_read_ - blocks_.size();
+        last_block_.seek(0);
+        if (block_index < num_block_ids_read_ && block_index >= first_loaded) {
+          const auto index = block_index - first_loaded;
+          for (auto i = index + 1; i <= blocks_index_ && i < blocks_.size();
+               ++i) {
+            blocks_[i].seek(0);  // Blocks behind are read anew.
+          }
+          blocks_index_ = index;
+          blocks_[blocks_index_].seek(offset);
+          return;
+        }
+        if (block_index < first_loaded) {
+          block_ids_ = first_block_ids_;
+          num_block_ids_read_ = 0;
+        }
+        writeBackMutatedBlocks();
+        blocks_.clear();
+        arena_.deallocateAll();
+        blocks_index_ = 0;
+        block_ids_.skip(block_index - num_block_ids_read_);
+        num_block_ids_read_ = block_index;
+        read_ahead_ = std::min(MIN_READ_AHEAD, store_->getMaxReadAhead());
+        // Reading starts over at a new location.
+        if (block_ids_.hasNext()) {
+          loadNextBlocks(true);
+          blocks_[0].seek(offset);
+        } else {
+          last_block_.seek(offset);
+        }
+      }
+      // Moves to the header at `offset` in the block with the given index,
+      // where the index of the tail block equals the number of flushed
+      // blocks.  Blocks that are no longer loaded when moving backwards are
+      // read again.
+
+      uint32_t getBlockIndexOfLastExtracted() const {
+        return num_block_ids_read_ - blocks_.size() + size_with_flag_ptr_.index;
+      }
+      // Returns the index of the block that contains the last extracted size
+      // with flag, as understood by `seek()`.
+
+      uint32_t getOffsetOfLastExtracted() const {
+        return size_with_flag_ptr_.offset;
+      }
+
+      typename std::conditional<IsMutable, Store, const Store>::type* getStore()
+          const {
+        return store_;
+      }
+
      private:
+      const char* readContiguousDataInPlace(uint32_t size) {
+        const uint64_t block_size = store_->getBlockSize();
+        const auto end = blocks_[blocks_index_].offset() + size;
+        const auto num_blocks = (end + block_size - 1) / block_size;
+        while (blocks_.size() - blocks_index_ < num_blocks &&
+               block_ids_.hasNext()) {
+          loadNextBlocks(false);
+        }
+        if (blocks_.size() - blocks_index_ < num_blocks) {
+          return nullptr;  // The value ends in the tail block.
+        }
+        const auto& first = blocks_[blocks_index_];
+        for (size_t i = 1; i != num_blocks; ++i) {
+          if (blocks_[blocks_index_ + i].data() !=
+              first.data() + block_size * i) {
+            return nullptr;
+          }
+        }
+        const char* data = first.data() + first.offset();
+        blocks_index_ += num_blocks - 1;
+        blocks_[blocks_index_].seek(end - block_size * (num_blocks - 1));
+        return data;
+      }
+      // Large values are written into blocks with consecutive ids, which
+      // are adjacent in memory if they are referenced in a stable store or
+      // have been fetched with a single range read.
+
+      uint32_t nextBlockId() {
+        ++num_block_ids_read_;
+        return block_ids_.next();
+      }
+
+      uint32_t getNumBlocksToLoad() {
+        const auto num_blocks = read_ahead_;
+        read_ahead_ = std::min(read_ahead_ * 2, store_->getMaxReadAhead());
+        return num_blocks;
+      }
+      // Returns an upper bound, because the number of remaining blocks is
+      // not known without decoding their ids.
+
       void loadNextBlocks(bool replace_current_blocks) {
-        const auto block_size = store_->getBlockSize();
+        const auto num_blocks = getNumBlocksToLoad();
         if (replace_current_blocks) {
           writeBackMutatedBlocks();
           blocks_.clear();
           arena_.deallocateAll();
-          blocks_.reserve(BLOCK_CACHE_SIZE);
-          while (blocks_.size() < BLOCK_CACHE_SIZE && !block_ids_.empty()) {
-            char* block_data = arena_.allocate(block_size);
-            blocks_.emplace_back(block_data, block_size, block_ids_.back());
-            block_ids_.pop_back();
-          }
-          store_->get(blocks_);
-          for (auto& block : blocks_) {
-            block.ignore = true;
-            // Triggers that the block is not written back to the
-            // store when `writeBackMutatedBlocks()` is called.
+          blocks_.reserve(num_blocks);
+          if (!IsMutable && store_->hasStableBlocks()) {
+            // Blocks of a read-only store are never remapped and never
+            // written back, so they can be referenced in place.
+            while (blocks_.size() < num_blocks && block_ids_.hasNext()) {
+              blocks_.push_back(referenceStableBlock(nextBlockId()));
+            }
+            blocks_index_ = 0;
+            return;
           }
+          readNextBlocks(num_blocks);
           blocks_index_ = 0;
 
-        } else {
-          std::vector<ExtendedReadWriteBlock> blocks;
-          blocks.reserve(BLOCK_CACHE_SIZE);
-          while (blocks.size() < BLOCK_CACHE_SIZE && !block_ids_.empty()) {
-            char* block_data = arena_.allocate(block_size);
-            blocks.emplace_back(block_data, block_size, block_ids_.back());
-            block_ids_.pop_back();
+        } else if (!IsMutable && store_->hasStableBlocks()) {
+          for (uint32_t i = 0; i != num_blocks && block_ids_.hasNext(); ++i) {
+            blocks_.push_back(referenceStableBlock(nextBlockId()));
           }
-          store_->get(blocks);
-          for (auto& block : blocks) {
-            blocks_.push_back(block);
-            blocks_.back().ignore = true;
-            // Triggers that the block is not written back to the
-            // store when `writeBackMutatedBlocks()` is called.
+
+        } else {
+          readNextBlocks(num_blocks);
+        }
+      }
+
+      void readNextBlocks(uint32_t num_blocks) {
+        const auto max_range = std::numeric_limits<uint32_t>::max() /
+                               store_->getBlockSize();
+        uint32_t first_id = 0;
+        uint32_t count = 0;
+        for (uint32_t i = 0; i != num_blocks && block_ids_.hasNext(); ++i) {
+          const auto id = nextBlockId();
+          if (count != 0 && (id != first_id + count || count == max_range)) {
+            readRange(first_id, count);
+            count = 0;
           }
+          if (count == 0) first_id = id;
+          ++count;
+        }
+        if (count != 0) readRange(first_id, count);
+      }
+      // Appends up to `num_blocks` blocks to `blocks_`.  Blocks with
+      // consecutive ids, as written for large values or by `optimize()`,
+      // are fetched via a single range read.
+
+      void readRange(uint32_t first_id, uint32_t count) {
+        const auto block_size = store_->getBlockSize();
+        char* data = arena_.allocate(block_size * count);
+        store_->getRange(first_id, count, data);
+        for (uint32_t i = 0; i != count; ++i) {
+          blocks_.emplace_back(data + block_size * i, block_size, first_id + i);
+          blocks_.back().ignore = true;
+          // Triggers that the block is not written back to the
+          // store when `writeBackMutatedBlocks()` is called.
         }
       }
 
+      ExtendedReadWriteBlock referenceStableBlock(uint32_t id) const {
+        // The const_cast is safe, because blocks of a read-only store are
+        // marked as ignored and therefore never written back.
+        ExtendedReadWriteBlock block(
+            const_cast<char*>(store_->tryGetStableAddressOf(id)),
+            store_->getBlockSize(), id);
+        block.ignore = true;
+        return block;
+      }
+
       void writeBackMutatedBlocks() {
         // There is a specialization when IsMutable is true.
       }
@@ -326,36 +924,46 @@ class List : public mt::Resource {
       struct IntoBlockPointer {
         uint32_t index = 0;
         uint32_t offset = 0;
+        uint32_t size = 0;
       } size_with_flag_ptr_;
 
-      std::vector<uint32_t> block_ids_;
-      // Elements are in reverse order to allow fast pop_front operation.
+      UintVector::Cursor block_ids_;
+      // Decodes the ids of the list's blocks one by one.
+
+      UintVector::Cursor first_block_ids_;
+      // Copy of `block_ids_` before the first id was read.
+
+      uint32_t num_block_ids_read_ = 0;
 
       std::vector<ExtendedReadWriteBlock> blocks_;
       uint32_t blocks_index_ = 0;
 
       ReadWriteBlock last_block_;
-      // Contains a shallow copy of `list->block_` given in the constructor.
+      // Contains a shallow copy of the list's or the snapshot's tail block
+      // given in the constructor.
 
       typename std::conditional<IsMutable, Store, const Store>::type* store_;
+      uint32_t read_ahead_;
       Arena arena_;
     };
 
    public:
-    Iter() : list_(nullptr) {}
-
     MT_ENABLE_IF(IsMutable)
     Iter(List* list, Store* store)
-        : list_(list), stream_(new Stream(list, store)) {
+        : list_(list),
+          stream_(list, store),
+          front_coded_(store->hasFrontCodedValues()) {
       list_->mutex_.lock();
       stats_.available = list->stats_.num_values_valid();
     }
 
     MT_DISABLE_IF(IsMutable)
     Iter(const List& list, const Store& store)
-        : list_(&list), stream_(new Stream(list, store)) {
-      list_->mutex_.lock_shared();
-      stats_.available = list.stats_.num_values_valid();
+        : list_(&list),
+          snapshot_(list),
+          stream_(snapshot_, store),
+          front_coded_(store.hasFrontCodedValues()) {
+      stats_.available = snapshot_.stats.num_values_valid();
     }
 
     ~Iter() override;
@@ -376,41 +984,352 @@ class List : public mt::Resource {
 
     Bytes peekNext() override {
       if (stats_.load_next_value) {
-        uint32_t value_size = 0;
         bool is_marked_as_removed = false;
         do {
-          stream_->readSizeWithFlag(&value_size, &is_marked_as_removed);
-          value_.resize(value_size);
-          stream_->readData(value_.data(), value_size);
+          readNextEntry(&is_marked_as_removed);
         } while (is_marked_as_removed);
         stats_.load_next_value = false;
       }
-      return Bytes(value_.data(), value_.size());
+      return value_;
     }
     // Preconditions:
     //  * `hasNext()` yields `true`.
 
+    uint32_t skip(uint32_t num_values) override {
+      num_values = std::min(num_values, available());
+      const auto target = available() - num_values;
+      if (num_values >= SkipIndex::INTERVAL) {
+        jumpTo(target, std::integral_constant<bool, IsMutable>());
+      }
+      while (available() != target) {
+        next();
+      }
+      return num_values;
+    }
+
+    template <typename Compare>
+    void skipWhileLess(const Bytes& value, Compare less) {
+      if (const auto skip_index = getSkipIndex()) {
+        size_t first = 0;
+        size_t count = skip_index->size();
+        while (count != 0) {
+          const auto step = count / 2;
+          const auto middle = first + step;
+          if (less(readIndexedValue(skip_index->getEntry(middle)), value)) {
+            first = middle + 1;
+            count -= step + 1;
+          } else {
+            count = step;
+          }
+        }
+        if (first != 0) {
+          jumpTo(skip_index->getEntry(first - 1),
+                 skip_index->getNumValidBefore(first - 1));
+        }
+      }
+      while (hasNext() && less(peekNext(), value)) {
+        next();
+      }
+    }
+    // Skips all values for which `less(value_in_list, value)` is true, so
+    // that `peekNext()` yields the first value that is not less than `value`.
+    // Requires that the list is sorted according to `less`, in which case
+    // the indexed values of a long list are compared via binary search and
+    // only the values behind the last smaller one are decoded in order.
+
+    MT_DISABLE_IF(IsMutable) bool wasAppendedTo() const {
+      return snapshot_.appended;
+    }
+    // Same as `List::wasAppendedTo()` when the iterator was created.
+
     MT_ENABLE_IF(IsMutable) void remove() {
-      stream_->overwriteLastExtractedFlag(true);
+      stream_.overwriteLastExtractedFlag(true);
       ++list_->stats_.num_values_removed;
+      if (const auto skip_index = list_->getSkipIndexForUpdateUnlocked()) {
+        skip_index->remove(position());
+      }
+      list_->dirty_ = true;
+    }
+    // Preconditions:
+    //  * `next()` must have been called.
+
+    MT_ENABLE_IF(IsMutable) void replace(const Bytes& value) {
+      MT_REQUIRE_FALSE(front_coded_);
+      MT_REQUIRE_EQ(value.size(), value_.size());
+      stream_.overwriteLastExtractedData(value.data(), value.size());
+      list_->dirty_ = true;
+      list_->appended_ = true;
     }
+    // Overwrites the value returned by the last call of `next()`, which
+    // keeps its position.  Since the list may no longer be sorted and its
+    // values may no longer match the value filter of the partition, the
+    // list counts as appended to.
     // Preconditions:
     //  * `next()` must have been called.
+    //  * The store has no front-coded values.
+    //  * `value` has the same size as the value returned by `next()`.
+
+    uint32_t position() const { return position_ - 1; }
+    // Returns the position of the value returned by the last call of
+    // `next()`, including removed values that have been skipped.
+    // Preconditions:
+    //  * `next()` must have been called.
+
+    MT_ENABLE_IF(IsMutable) void removeAt(uint32_t position) {
+      MT_REQUIRE_ZERO(position_);
+      bool is_marked_as_removed = false;
+      while (position_ <= position) {
+        readNextEntry(&is_marked_as_removed);
+      }
+      remove();
+    }
+    // Preconditions:
+    //  * No value has been read yet.
+
+    MT_ENABLE_IF(IsMutable)
+    void replaceAt(uint32_t position, const Bytes& value) {
+      MT_REQUIRE_ZERO(position_);
+      bool is_marked_as_removed = false;
+      while (position_ <= position) {
+        readNextEntry(&is_marked_as_removed);
+      }
+      replace(value);
+    }
+    // Preconditions:
+    //  * No value has been read yet.
 
    private:
+    void jumpTo(uint32_t, std::true_type) {}
+    // Unique iterators are only used internally to scan and modify lists.
+
+    void jumpTo(uint32_t num_remaining, std::false_type) {
+      const auto num_valid = snapshot_.stats.num_values_valid() - num_remaining;
+      const auto skip_index = getSkipIndex();
+      SkipIndex::Entry entry;
+      uint32_t num_valid_before = 0;
+      if (skip_index &&
+          skip_index->find(num_valid, &entry, &num_valid_before)) {
+        jumpTo(entry, num_valid_before);
+      }
+    }
+    // Moves to the last indexed value that is followed by at least
+    // `num_remaining` valid values, if that is ahead of the current position.
+
+    void jumpTo(const SkipIndex::Entry& entry, uint32_t num_valid_before) {
+      if (entry.position >= position_) {
+        stream_.seek(entry.block_index, entry.offset);
+        position_ = entry.position;
+        stats_.available = snapshot_.stats.num_values_valid() - num_valid_before;
+        stats_.load_next_value = true;
+      }
+    }
+    // Moves to the indexed value, if that is ahead of the current position.
+    // Indexed values do not share a prefix with their predecessor, which is
+    // why `value_` need not be restored.
+
+    std::string readIndexedValue(const SkipIndex::Entry& entry) const {
+      Stream stream(snapshot_, *stream_.getStore());
+      stream.seek(entry.block_index, entry.offset);
+      uint32_t value_size = 0;
+      bool is_marked_as_removed = false;
+      stream.readSizeWithFlag(&value_size, &is_marked_as_removed);
+      uint32_t prefix_size = 0;
+      if (front_coded_) {
+        stream.readUint(&prefix_size);
+        MT_ASSERT_ZERO(prefix_size);
+      }
+      std::string value(value_size, '\0');
+      if (value_size != 0) {
+        stream.readData(&value[0], value_size);
+      }
+      return value;
+    }
+    // Returns a copy of the indexed value, whether it is removed or not,
+    // without moving the iterator.  Removed values keep their place in the
+    // order of the list.
+
+    const SkipIndex* getSkipIndex() {
+      if (snapshot_.skip_index ||
+          snapshot_.stats.num_values_total < 2 * SkipIndex::INTERVAL) {
+        return snapshot_.skip_index.get();
+      }
+      snapshot_.skip_index = buildSkipIndex();
+      UpgradeLock<SharedMutex> lock(list_->mutex_, TRY_TO_LOCK);
+      if (lock && !list_->skip_index_ &&
+          list_->stats_.num_values_total == snapshot_.stats.num_values_total &&
+          list_->block_.offset() == snapshot_.tail.size()) {
+        list_->skip_index_ = snapshot_.skip_index;
+      }
+      return snapshot_.skip_index.get();
+    }
+    // Returns the index of the snapshot, which is built when it is needed
+    // first.  The index is shared with the list if nothing has been appended
+    // or flushed since the snapshot was taken.  The list is only tried to be
+    // locked, since a waiting writer would block the upgrade lock, while it
+    // waits for the reader lock held by this iterator.
+
+    boost::intrusive_ptr<SkipIndex> buildSkipIndex() const {
+      uint32_t num_blocks = 0;
+      for (auto cursor = snapshot_.block_ids.getCursor(); cursor.hasNext();
+           cursor.next()) {
+        ++num_blocks;
+      }
+      boost::intrusive_ptr<SkipIndex> skip_index(new SkipIndex(num_blocks));
+      Stream stream(snapshot_, *stream_.getStore());
+      const uint32_t tail_size = snapshot_.tail.size();
+      for (uint32_t position = 0; stream.hasNextEntry(tail_size); ++position) {
+        uint32_t value_size = 0;
+        bool is_marked_as_removed = false;
+        stream.readSizeWithFlag(&value_size, &is_marked_as_removed);
+        skip_index->addValue(stream.getBlockIndexOfLastExtracted(),
+                             stream.getOffsetOfLastExtracted());
+        if (is_marked_as_removed) {
+          skip_index->remove(position);
+        }
+        uint32_t prefix_size = 0;
+        if (front_coded_) {
+          stream.readUint(&prefix_size);
+        }
+        stream.skipData(value_size - prefix_size);
+      }
+      return skip_index;
+    }
+
+    void readNextEntry(bool* is_marked_as_removed) {
+      uint32_t value_size = 0;
+      stream_.readSizeWithFlag(&value_size, is_marked_as_removed);
+      uint32_t prefix_size = 0;
+      if (front_coded_) {
+        stream_.readUint(&prefix_size);
+      }
+      if (prefix_size != 0) {
+        // The previous value is located in the same block or in
+        // `buffer_`, hence `value_` is still valid.
+        if (value_.data() != buffer_.data()) {
+          buffer_.assign(value_.data(), value_.data() + prefix_size);
+        }
+        buffer_.resize(value_size);
+        stream_.readData(buffer_.data() + prefix_size,
+                          value_size - prefix_size);
+        value_ = Bytes(buffer_.data(), buffer_.size());
+      } else if (const char* data = stream_.readDataInPlace(value_size)) {
+        // The value is located in contiguous memory, so no copy is needed.
+        value_ = Bytes(data, value_size);
+      } else {
+        buffer_.resize(value_size);
+        stream_.readData(buffer_.data(), value_size);
+        value_ = Bytes(buffer_.data(), buffer_.size());
+      }
+      ++position_;
+    }
+    // Reads the next value into `value_`, whether it is removed or not.
+
     struct Stats {
       uint32_t available = 0;
       bool load_next_value = true;
     };
 
     typename std::conditional<IsMutable, List, const List>::type* list_;
-    std::unique_ptr<Stream> stream_;  // Make stack object
-    std::vector<char> value_;
+    Snapshot snapshot_;
+    // Only used by shared iterators.
+
+    Stream stream_;
+    std::vector<char> buffer_;
+    // Holds a copy of the current value if it spans multiple blocks
+    // or if it shares a prefix with the previous value.
+
+    Bytes value_;
     Stats stats_;
+    uint32_t position_ = 0;
+    bool front_coded_ = false;
   };
 
   typedef Iter<true> UniqueIterator;
+
+ public:
   typedef Iter<false> SharedIterator;
+  // Read-only iterator that can be placed on the stack, e.g. via
+  // `SharedIterator iter(list, store)`, to avoid a heap allocation.  It
+  // yields the values the list had when the iterator was created, and holds
+  // a reader lock on the list until it is destroyed, which blocks removing
+  // and replacing values, but not appending them.
+
+  class ReverseIterator : public Iterator {
+    // Same as class SharedIterator, but yields the values from the newest to
+    // the oldest.  The values between two entries of the skip index of the
+    // list, starting with the last entry, are decoded in order and buffered,
+    // so that the newest `k` values cost about `k + SkipIndex::INTERVAL`
+    // values to decode.  A long list that has no index yet is scanned once
+    // to build it, which later iterators share.
+
+   public:
+    ReverseIterator(const List& list, const Store& store);
+
+    uint32_t available() const override { return available_; }
+
+    bool hasNext() const override { return available_ != 0; }
+
+    Bytes next() override;
+    // Preconditions:
+    //  * `hasNext()` yields `true`.
+
+    Bytes peekNext() override;
+    // Preconditions:
+    //  * `hasNext()` yields `true`.
+
+    uint32_t skip(uint32_t num_values) override;
+    // Skips segments between index entries without decoding them.
+
+   private:
+    uint32_t getNumValidBefore(size_t segment) const;
+    // Segment `i > 0` starts at entry `i - 1` of the index, and segment 0
+    // at the first value.  Passing the number of segments yields the
+    // number of valid values in the list.
+
+    void loadPreviousSegment();
+
+    SharedIterator iter_;
+    const SkipIndex* skip_index_;
+    size_t num_segments_;
+    // Number of segments that have not been loaded yet.
+
+    std::vector<std::string> values_;
+    // The valid values of the current segment that have not been returned.
+
+    std::string value_;
+    uint32_t available_;
+  };
+
+ private:
+  class CountersUpdate {
+   public:
+    CountersUpdate(const List& list, Counters* counters)
+        : list_(list), counters_(counters) {
+      if (counters_) old_stats_ = list_.stats_;
+    }
+
+    ~CountersUpdate() {
+      if (counters_) counters_->update(old_stats_, list_.stats_);
+    }
+
+   private:
+    const List& list_;
+    Counters* counters_;
+    Stats old_stats_;
+  };
+  // Applies the change of the stats of `list` between construction and
+  // destruction to `counters`, if not null.  Must be destroyed before the
+  // lock of the list is released.
+
+  bool isEvictableUnlocked(bool keep_appended) const {
+    return !dirty_ && getDeadline() == 0 &&
+           !(block_.hasData() && block_.offset() != 0) &&
+           !(keep_appended && appended_);
+  }
+
+  void resetUnlocked(Arena* arena);
+  // Returns all memory to `arena` and leaves the list in the state of a
+  // newly constructed one.
 
   std::unique_ptr<UniqueIterator> newUniqueIterator(Store* store) {
     return std::unique_ptr<UniqueIterator>(new UniqueIterator(this, store));
@@ -420,17 +1339,107 @@ class List : public mt::Resource {
     return std::unique_ptr<SharedIterator>(new SharedIterator(*this, store));
   }
 
-  void appendUnlocked(const Bytes& value, Store* store, Arena* arena);
+  uint32_t replace(const Bytes& old_value, const Bytes& new_value,
+                   uint32_t max_replaced, Store* store, Arena* arena,
+                   std::vector<uint32_t>* positions, Counters* counters) {
+    uint32_t num_replaced = 0;
+    const auto in_place = isReplacedInPlace(old_value, new_value, *store);
+    auto iter = newUniqueIterator(store);
+    CountersUpdate update(*this, counters);
+    while (num_replaced != max_replaced && iter->hasNext()) {
+      if (iter->next() == old_value) {
+        if (in_place) {
+          iter->replace(new_value);
+        } else {
+          iter->remove();
+        }
+        if (positions) positions->push_back(iter->position());
+        ++num_replaced;
+      }
+    }
+    // `iter` keeps the list in locked state.
+    for (uint32_t i = 0; !in_place && i != num_replaced; ++i) {
+      appendUnlocked(new_value, store, arena);
+    }
+    return num_replaced;
+  }
+
+  void appendUnlocked(const Bytes& value, Store* store, Arena* arena,
+                      bool aligned = false);
+  // If `aligned` is true, values that fit into a block are not split, so
+  // that blocks can be dropped without cutting a value.  Front-coded values
+  // are aligned anyway.
+
+  void tryRetire(Cap* cap, Store* store, Arena* arena, Counters* counters);
+
+  uint32_t retireUnlocked(uint32_t min_valid, uint32_t max_entries,
+                          Store* store, Arena* arena,
+                          std::vector<uint32_t>* block_ids);
+  // Drops the longest run of leading flushed blocks that ends in front of a
+  // value, holds at most `max_entries` values, and leaves at least
+  // `min_valid` valid values.  Only the dropped blocks and the one behind
+  // them are read.  Returns the number of values dropped.
+
+  void appendFrontCodedUnlocked(const Bytes& value, Store* store,
+                                Arena* arena);
+
+  bool writeDataUnlocked(const char* data, uint32_t size, Store* store,
+                         Arena* arena);
+  // Writes `data` into `block_`.  If it does not fit, flushes `block_` and
+  // writes the remaining data into subsequent blocks.
+  // Returns `true` if the data spans multiple blocks.
+
+  void reserveTailBlockUnlocked(size_t nbytes, size_t block_size,
+                                Arena* arena);
+  // Allocates a tail block from `arena` or grows it, so that `nbytes` more
+  // bytes fit, unless it already has `block_size`.  The tail block starts
+  // small and doubles its size, so that short lists do not hold a full
+  // block of memory each.  Values that do not fit into a full block are
+  // split as before.
+
+  uint32_t putTailBlockUnlocked(Store* store);
+  // Writes the tail block, padded to the block size of `store`, into the
+  // next block of the list's extent, if any, and returns its id.
+
+  uint32_t getMinNextBlockIdUnlocked() const {
+    return block_ids_.empty() ? 0 : block_ids_.back() + 1;
+  }
+  // Block ids must be increasing, hence a reused block must not have a
+  // smaller id than the last block of the list.
+
+  uint32_t getSharedPrefixSizeUnlocked(const Bytes& value) const;
+  // Returns the size of the prefix that `value` shares with the last value
+  // in `block_`, which is computed without decoding any value.
+
+  SkipIndex* getSkipIndexForUpdateUnlocked() {
+    if (skip_index_ && skip_index_->use_count() > 1) {
+      skip_index_.reset(skip_index_->clone());
+    }
+    return skip_index_.get();
+  }
+  // Returns the index, if any, after replacing it by a copy if iterators
+  // share it.  They only acquire it while holding an upgrade lock, so the
+  // index is not shared afterwards as long as the caller holds the lock.
 
   Stats stats_;
   UintVector block_ids_;
   ReadWriteBlock block_;
   mutable SharedMutex mutex_;
+  mutable boost::intrusive_ptr<SkipIndex> skip_index_;
+  // Only exists for long lists that have been skipped through.
+
+  bool dirty_ = false;
+  bool appended_ = false;
+  mutable std::atomic<uint16_t> pins_{0};
+  std::atomic<uint32_t> deadline_{0};
 };
 
-static_assert(mt::hasExpectedSize<List>(36, 48),
+static_assert(mt::hasExpectedSize<List>(48, 64),
               "class List does not have expected size");
 
+template <bool IsMutable>
+const uint32_t List::Iter<IsMutable>::Stream::MIN_READ_AHEAD;
+
 template <>
 inline void List::Iter<true>::Stream::writeBackMutatedBlocks() {
   if (store_) {
@@ -0,0 +1,165 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/ListMap.hpp"
+
+#include <cstring>
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+const uint64_t LSBS = 0x0101010101010101ULL;
+const uint64_t MSBS = 0x8080808080808080ULL;
+
+uint64_t loadGroup(const uint8_t* control) {
+  uint64_t group;
+  std::memcpy(&group, control, sizeof group);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  group = __builtin_bswap64(group);
+#endif
+  return group;
+}
+// Loads eight control bytes such that the byte of the first slot is the least
+// significant byte of the result.
+
+uint64_t matchTag(uint64_t group, uint8_t tag) {
+  const uint64_t x = group ^ (LSBS * tag);
+  return (x - LSBS) & ~x & MSBS;
+}
+// Sets the most significant bit of each byte that is equal to `tag`.  There
+// may be false positives, but only in bytes preceded by a true match, which
+// is fine because keys are compared anyway.
+
+uint64_t matchEmpty(uint64_t group) { return group & ~(group << 6) & MSBS; }
+// Tags never have the most significant bit set, EMPTY and DELETED have.
+// Unlike DELETED, EMPTY does not have bit 1 set, which the shift moves into
+// the position of the most significant bit.
+
+uint64_t matchEmptyOrDeleted(uint64_t group) { return group & MSBS; }
+
+size_t getFirstMatch(uint64_t matches) { return __builtin_ctzll(matches) / 8; }
+
+size_t getGroup(size_t hash) { return hash >> 7; }
+
+uint8_t getTag(size_t hash) { return hash & 0x7f; }
+
+uint32_t getHashBits(size_t hash) {
+  return static_cast<uint64_t>(hash) ^ (static_cast<uint64_t>(hash) >> 32);
+}
+// Folds the upper half of the hash value into the lower one, since slots in
+// the same group are likely to have equal bits in the lower half already.
+
+}  // namespace
+
+const uint8_t ListMap::EMPTY;
+const uint8_t ListMap::DELETED;
+const size_t ListMap::GROUP_SIZE;
+const size_t ListMap::MAX_INLINE_KEY_SIZE;
+const uint8_t ListMap::LONG_KEY;
+const char ListMap::ERASED_KEY_DATA = 0;
+
+List* ListMap::find(const Bytes& key, size_t hash) const {
+  if (control_.empty()) return nullptr;
+  const auto tag = getTag(hash);
+  const auto hash_bits = getHashBits(hash);
+  const auto mask = control_.size() / GROUP_SIZE - 1;
+  auto group = getGroup(hash) & mask;
+  for (size_t step = 1;; ++step) {
+    const auto offset = group * GROUP_SIZE;
+    const auto bits = loadGroup(control_.data() + offset);
+    for (auto matches = matchTag(bits, tag); matches;
+         matches &= matches - 1) {
+      const auto& slot = slots_[offset + getFirstMatch(matches)];
+      if (slot.hash_bits != hash_bits) continue;
+      if (slot.key_size == LONG_KEY) {
+        if (slot.entry->key == key) return &slot.entry->list;
+      } else if (slot.key_size == key.size() &&
+                 std::memcmp(slot.key_data, key.data(), key.size()) == 0) {
+        return &slot.entry->list;
+      }
+    }
+    if (matchEmpty(bits)) return nullptr;
+    group = (group + step) & mask;
+  }
+}
+
+List* ListMap::insert(const Bytes& key, size_t hash) {
+  if ((size() + num_deleted_ + 1) * 8 > control_.size() * 7) {
+    // Keeps the load factor, including tombstones, below 7/8.  The table
+    // only grows if at least half of it would be in use without them.
+    const auto grow = (size() + 1) * 16 > control_.size() * 7;
+    rehash(control_.empty() ? GROUP_SIZE * 2
+                            : control_.size() * (grow ? 2 : 1));
+  }
+  Entry* entry = nullptr;
+  if (free_entries_.empty()) {
+    entries_.emplace_back();
+    entry = &entries_.back();
+  } else {
+    entry = free_entries_.back();
+    free_entries_.pop_back();
+  }
+  entry->key = key;
+  entry->hash = hash;
+  auto& slot = slots_[claimEmptySlot(hash)];
+  slot.entry = entry;
+  slot.hash_bits = getHashBits(hash);
+  if (key.size() <= MAX_INLINE_KEY_SIZE) {
+    slot.key_size = key.size();
+    std::memcpy(slot.key_data, key.data(), key.size());
+  } else {
+    slot.key_size = LONG_KEY;
+  }
+  return &entry->list;
+}
+
+void ListMap::rehash(size_t num_slots) {
+  MT_REQUIRE_TRUE(mt::isPowerOfTwo(num_slots));
+  std::vector<uint8_t> control(num_slots, EMPTY);
+  std::vector<Slot> slots(num_slots);
+  control_.swap(control);
+  slots_.swap(slots);
+  num_deleted_ = 0;
+  // Now `control` and `slots` refer to the old table.
+  for (size_t i = 0; i != control.size(); ++i) {
+    if (isFull(control[i])) {
+      slots_[claimEmptySlot(slots[i].entry->hash)] = slots[i];
+    }
+  }
+}
+
+size_t ListMap::claimEmptySlot(size_t hash) {
+  const auto mask = control_.size() / GROUP_SIZE - 1;
+  auto group = getGroup(hash) & mask;
+  for (size_t step = 1;; ++step) {
+    const auto offset = group * GROUP_SIZE;
+    const auto empty =
+        matchEmptyOrDeleted(loadGroup(control_.data() + offset));
+    if (empty) {
+      const auto pos = offset + getFirstMatch(empty);
+      if (control_[pos] == DELETED) --num_deleted_;
+      control_[pos] = getTag(hash);
+      return pos;
+    }
+    group = (group + step) & mask;
+  }
+}
+
+}  // namespace internal
+}  // namespace multimap
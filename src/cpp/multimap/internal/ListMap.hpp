@@ -0,0 +1,250 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_LIST_MAP_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_LIST_MAP_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "multimap/internal/List.hpp"
+#include "multimap/thirdparty/mt/mt.hpp"
+#include "multimap/Bytes.hpp"
+
+namespace multimap {
+namespace internal {
+
+class ListMap : public mt::Resource {
+  // A flat open-addressing hash table that maps keys to lists.  Slots are
+  // organized in groups of eight and each slot has a control byte which is
+  // either EMPTY or stores seven bits of the key's hash value, so that a
+  // whole group can be probed with a few word-sized (SWAR) operations before
+  // any key is compared.  Lists are stored by value in a deque, so their
+  // addresses remain stable when the table grows.  The deque holds each list
+  // together with its key in insertion order, so that a slot only refers to
+  // its entry and entries can also be visited by index.  Groups are probed in
+  // triangular order, which visits every group once, because the number of
+  // groups is a power of two.  Erased slots become tombstones, which are
+  // dropped when the table is rebuilt, and erased entries of the deque are
+  // reused by subsequent insertions.  Each slot also holds 32 bits of the
+  // hash value of its key and a copy of keys of up to `MAX_INLINE_KEY_SIZE`
+  // bytes, so that a lookup compares these bits first and short keys without
+  // touching the entry, whose key data lives elsewhere, e.g. in an arena.
+  // The full hash value is kept in the entry, since only rehashing needs it.
+  // The data of inserted keys is not copied and must outlive the map.
+  // Objects of this class are not thread-safe.
+
+ public:
+  // ---------------------------------------------------------------------------
+  // Member types
+  // ---------------------------------------------------------------------------
+
+  class const_iterator {
+   public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef std::pair<Bytes, List*> value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const value_type* pointer;
+    typedef value_type reference;
+
+    const_iterator() = default;
+
+    value_type operator*() const {
+      const auto entry = map_->slots_[pos_].entry;
+      return std::make_pair(entry->key, &entry->list);
+    }
+
+    const_iterator& operator++() {
+      ++pos_;
+      skipEmptySlots();
+      return *this;
+    }
+
+    bool operator==(const const_iterator& other) const {
+      return pos_ == other.pos_;
+    }
+
+    bool operator!=(const const_iterator& other) const {
+      return pos_ != other.pos_;
+    }
+
+   private:
+    friend class ListMap;
+
+    const_iterator(const ListMap* map, size_t pos) : map_(map), pos_(pos) {
+      skipEmptySlots();
+    }
+
+    void skipEmptySlots() {
+      while (pos_ != map_->control_.size() && !isFull(map_->control_[pos_])) {
+        ++pos_;
+      }
+    }
+
+    const ListMap* map_ = nullptr;
+    size_t pos_ = 0;
+  };
+
+  // ---------------------------------------------------------------------------
+  // Member functions
+  // ---------------------------------------------------------------------------
+
+  ListMap() = default;
+
+  List* find(const Bytes& key) const { return find(key, hash(key)); }
+  // Returns `nullptr` if `key` is not contained.
+
+  List* find(const Bytes& key, size_t hash) const;
+  // Same as above, but with a hash value precomputed via `hash(key)`.
+
+  List* insert(const Bytes& key) { return insert(key, hash(key)); }
+  // Inserts `key` with a new empty list and returns the list.
+  // Requires that `key` is not already contained.
+
+  List* insert(const Bytes& key, size_t hash);
+  // Same as above, but with a hash value precomputed via `hash(key)`.
+
+  template <typename BinaryPredicate>
+  size_t eraseIf(BinaryPredicate predicate) {
+    size_t num_erased = 0;
+    for (size_t i = 0; i != control_.size(); ++i) {
+      if (!isFull(control_[i])) continue;
+      const auto entry = slots_[i].entry;
+      if (predicate(entry->key, &entry->list)) {
+        control_[i] = DELETED;
+        entry->key = Bytes(&ERASED_KEY_DATA, 0);
+        free_entries_.push_back(entry);
+        ++num_erased;
+      }
+    }
+    num_deleted_ += num_erased;
+    return num_erased;
+  }
+  // Erases each entry for which `predicate(key, list)` yields `true` and
+  // returns their number.  The list of an erased entry is handed out again
+  // by a later insertion, hence `predicate` must leave it in the state of a
+  // newly constructed list when it yields `true`.
+
+  size_t size() const { return entries_.size() - free_entries_.size(); }
+
+  bool empty() const { return size() == 0; }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+
+  const_iterator end() const { return const_iterator(this, control_.size()); }
+
+  std::pair<Bytes, List*> getEntry(size_t index) const {
+    auto& entry = entries_[index];
+    if (entry.key.data() == &ERASED_KEY_DATA) {
+      return std::pair<Bytes, List*>(Bytes(), nullptr);
+    }
+    return std::make_pair(entry.key, &entry.list);
+  }
+  // Returns the key and list of the entry with the given index, or a null
+  // list if the entry has been erased.  Entries are indexed in the order
+  // they were created, counting from zero.  Unlike positions in the table,
+  // indices do not change when the table grows, so that a scan by index can
+  // be paused and resumed while other keys are inserted.
+  // Requires: `index` < `getNumIndices()`
+
+  size_t getNumIndices() const { return entries_.size(); }
+  // Returns the number of entries including erased ones.
+
+  size_t getNumBytesInUse() const { return size() * getNumBytesPerEntry(); }
+  // Returns the approximate number of bytes held by the entries in use,
+  // which does not include the memory of keys.  Erased entries are not
+  // counted, since they are reused by later insertions.
+
+  size_t getNumBytesReserved() const {
+    return control_.capacity() + slots_.capacity() * sizeof(Slot) +
+           entries_.size() * sizeof(Entry) +
+           free_entries_.capacity() * sizeof(Entry*);
+  }
+  // Returns the number of bytes held by the table and all entries,
+  // including free slots and erased entries.
+
+  // ---------------------------------------------------------------------------
+  // Static member functions
+  // ---------------------------------------------------------------------------
+
+  static size_t hash(const Bytes& key) {
+    return XXH64(key.data(), key.size(), 0);
+  }
+  // Returns the XXH64 hash value of `key`, truncated to `size_t`.  This is
+  // the same hash value that class Partition receives from class Map, see
+  // `Partition::Key`, so a key is hashed only once per operation.  Maps with
+  // another key hash pass their own hash values, which is why the entries
+  // keep the hash value of their key instead of recomputing it when the table
+  // grows.
+
+  static size_t getNumBytesPerEntry() {
+    return sizeof(Entry) + sizeof(Slot) + 1;
+  }
+  // Returns the number of bytes of an entry including its slot and control
+  // byte in the table.
+
+ private:
+  static const uint8_t EMPTY = 0x80;
+  static const uint8_t DELETED = 0xFE;
+  static const size_t GROUP_SIZE = 8;
+  static const char ERASED_KEY_DATA;
+  // The key of an erased entry points here.
+
+  static bool isFull(uint8_t control) { return (control & 0x80) == 0; }
+
+  struct Entry {
+    Bytes key;
+    size_t hash;
+    List list;
+  };
+
+  static const size_t MAX_INLINE_KEY_SIZE = 11;
+  static const uint8_t LONG_KEY = 0xFF;
+
+  struct Slot {
+    Entry* entry;
+    uint32_t hash_bits;
+    // The hash value of the key folded to 32 bits.
+    uint8_t key_size;
+    // `LONG_KEY` if the key is not copied into `key_data`.
+    char key_data[MAX_INLINE_KEY_SIZE];
+  };
+  // Takes 24 bytes on 64-bit platforms, as many as three pointers.
+
+  void rehash(size_t num_slots);
+
+  size_t claimEmptySlot(size_t hash);
+  // Returns the position of the first empty or deleted slot on the probe
+  // sequence of `hash` and sets the slot's control byte accordingly.
+
+  std::vector<uint8_t> control_;
+  std::vector<Slot> slots_;
+  mutable std::deque<Entry> entries_;
+  // Mutable, since lists are modifiable via a const map, see `find()`.
+  std::vector<Entry*> free_entries_;
+  size_t num_deleted_ = 0;
+  // Number of tombstones in the table.
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_LIST_MAP_HPP_INCLUDED
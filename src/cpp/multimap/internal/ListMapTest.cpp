@@ -0,0 +1,183 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <set>
+#include <string>
+#include <type_traits>
+#include "gmock/gmock.h"
+#include "multimap/internal/ListMap.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+
+std::vector<std::string> makeKeys(size_t num_keys) {
+  std::vector<std::string> keys;
+  for (size_t i = 0; i != num_keys; ++i) {
+    keys.push_back(std::to_string(i));
+  }
+  return keys;
+}
+
+TEST(ListMapTest, IsDefaultConstructible) {
+  ASSERT_TRUE(std::is_default_constructible<ListMap>::value);
+}
+
+TEST(ListMapTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<ListMap>::value);
+  ASSERT_FALSE(std::is_copy_assignable<ListMap>::value);
+}
+
+TEST(ListMapTest, DefaultConstructedHasProperState) {
+  ListMap map;
+  ASSERT_TRUE(map.empty());
+  ASSERT_THAT(map.size(), Eq(0));
+  ASSERT_TRUE(map.begin() == map.end());
+  ASSERT_EQ(map.find("key"), nullptr);
+}
+
+TEST(ListMapTest, InsertedListsKeepTheirAddressesWhenMapGrows) {
+  ListMap map;
+  std::vector<List*> lists;
+  const auto keys = makeKeys(10000);
+  for (const auto& key : keys) {
+    ASSERT_EQ(map.find(key), nullptr);
+    lists.push_back(map.insert(key));
+    ASSERT_NE(lists.back(), nullptr);
+  }
+  ASSERT_THAT(map.size(), Eq(keys.size()));
+  for (size_t i = 0; i != keys.size(); ++i) {
+    ASSERT_EQ(map.find(keys[i]), lists[i]);
+  }
+  ASSERT_EQ(map.find("not-inserted"), nullptr);
+}
+
+TEST(ListMapTest, FindsKeysInsertedWithOtherHashValuesWhenMapGrows) {
+  ListMap map;
+  const auto keys = makeKeys(10000);
+  std::vector<List*> lists;
+  for (size_t i = 0; i != keys.size(); ++i) {
+    lists.push_back(map.insert(keys[i], ~ListMap::hash(keys[i])));
+  }
+  for (size_t i = 0; i != keys.size(); ++i) {
+    ASSERT_EQ(map.find(keys[i], ~ListMap::hash(keys[i])), lists[i]);
+  }
+}
+
+TEST(ListMapTest, FindsShortAndLongKeysWithEqualHashValues) {
+  // All keys have the same hash value, so only the keys themselves differ.
+  ListMap map;
+  std::vector<std::string> keys;
+  for (size_t size = 0; size != 40; ++size) {
+    keys.push_back(std::string(size, 'k'));
+    keys.push_back(std::string(size, 'k') + 'x');
+  }
+  std::vector<List*> lists;
+  for (const auto& key : keys) {
+    ASSERT_EQ(map.find(key, 42), nullptr);
+    lists.push_back(map.insert(key, 42));
+  }
+  for (size_t i = 0; i != keys.size(); ++i) {
+    ASSERT_EQ(map.find(keys[i], 42), lists[i]);
+    ASSERT_EQ(map.find(keys[i], 43), nullptr);
+  }
+  ASSERT_EQ(map.find(std::string(11, 'x'), 42), nullptr);
+  ASSERT_EQ(map.find(std::string(12, 'x'), 42), nullptr);
+}
+
+TEST(ListMapTest, IterationVisitsAllEntries) {
+  ListMap map;
+  const auto keys = makeKeys(1000);
+  for (const auto& key : keys) {
+    map.insert(key);
+  }
+  std::set<std::string> visited;
+  for (const auto& entry : map) {
+    ASSERT_EQ(map.find(entry.first), entry.second);
+    visited.insert(entry.first.toString());
+  }
+  ASSERT_EQ(visited, std::set<std::string>(keys.begin(), keys.end()));
+}
+
+TEST(ListMapTest, EntriesKeepTheirIndexWhenMapGrows) {
+  ListMap map;
+  const auto keys = makeKeys(10000);
+  std::vector<List*> lists;
+  for (size_t i = 0; i != keys.size(); ++i) {
+    lists.push_back(map.insert(keys[i]));
+  }
+  for (size_t i = 0; i != keys.size(); ++i) {
+    const auto entry = map.getEntry(i);
+    ASSERT_EQ(entry.first, keys[i]);
+    ASSERT_EQ(entry.second, lists[i]);
+  }
+}
+
+TEST(ListMapTest, EraseIfLeavesOtherKeysFindable) {
+  ListMap map;
+  const auto keys = makeKeys(10000);
+  std::vector<List*> lists;
+  for (const auto& key : keys) {
+    lists.push_back(map.insert(key));
+  }
+  const auto is_odd = [](const Bytes& key) {
+    return std::stoul(key.toString()) % 2 != 0;
+  };
+  const auto num_erased = map.eraseIf(
+      [&](const Bytes& key, List* /* list */) { return is_odd(key); });
+  ASSERT_THAT(num_erased, Eq(keys.size() / 2));
+  ASSERT_THAT(map.size(), Eq(keys.size() / 2));
+  ASSERT_THAT(map.getNumIndices(), Eq(keys.size()));
+  for (size_t i = 0; i != keys.size(); ++i) {
+    ASSERT_EQ(map.find(keys[i]), i % 2 != 0 ? nullptr : lists[i]);
+    ASSERT_EQ(map.getEntry(i).second, i % 2 != 0 ? nullptr : lists[i]);
+  }
+  size_t num_visited = 0;
+  for (const auto& entry : map) {
+    ASSERT_FALSE(is_odd(entry.first));
+    ++num_visited;
+  }
+  ASSERT_THAT(num_visited, Eq(keys.size() / 2));
+}
+
+TEST(ListMapTest, InsertAfterEraseReusesEntriesWithoutGrowing) {
+  ListMap map;
+  const auto keys = makeKeys(1000);
+  for (const auto& key : keys) {
+    map.insert(key);
+  }
+  const auto erase_all = [](const Bytes& /* key */, List* /* list */) {
+    return true;
+  };
+  for (size_t round = 0; round != 10; ++round) {
+    ASSERT_THAT(map.eraseIf(erase_all), Eq(keys.size()));
+    ASSERT_TRUE(map.empty());
+    ASSERT_EQ(map.find(keys.front()), nullptr);
+    for (const auto& key : keys) {
+      ASSERT_NE(map.insert(key), nullptr);
+    }
+    ASSERT_THAT(map.size(), Eq(keys.size()));
+    ASSERT_THAT(map.getNumIndices(), Eq(keys.size()));
+  }
+  for (const auto& key : keys) {
+    ASSERT_NE(map.find(key), nullptr);
+  }
+}
+
+}  // namespace internal
+}  // namespace multimap
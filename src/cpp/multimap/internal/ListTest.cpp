@@ -15,10 +15,14 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <functional>
 #include <thread>
 #include <type_traits>
+#include <vector>
 #include <boost/filesystem/operations.hpp>
 #include "gmock/gmock.h"
+#include "multimap/internal/Benchmark.hpp"
 #include "multimap/internal/Generator.hpp"
 #include "multimap/internal/List.hpp"
 
@@ -26,6 +30,8 @@ namespace multimap {
 namespace internal {
 
 using testing::Eq;
+using testing::Gt;
+using testing::Lt;
 
 // -----------------------------------------------------------------------------
 // class List
@@ -72,6 +78,17 @@ struct ListTestIteration : testing::TestWithParam<uint32_t> {
     MT_ASSERT_TRUE(boost::filesystem::remove_all(directory));
   }
 
+  void reopenStoreAsReadOnly() {
+    Store::Options options;
+    options.readonly = true;
+    reopenStore(options);
+  }
+
+  void reopenStore(const Store::Options& options) {
+    store.reset();  // Destructor flushes all data to disk.
+    store.reset(new Store(directory / "store", options));
+  }
+
   Store* getStore() { return store.get(); }
   Arena* getArena() { return &arena; }
 
@@ -182,6 +199,32 @@ TEST_P(ListTestIteration, AddLargeValuesAndIterateTwice) {
   ASSERT_EQ(iter->available(), 0);
 }
 
+TEST_P(ListTestIteration, LargeValuesAreReadInPlaceFromReadOnlyStore) {
+  List list;
+  SequenceGenerator generator;
+  const auto num_values = std::min(GetParam(), 1000u);
+  const size_t size = getStore()->getBlockSize() * 2.5;
+  for (size_t i = 0; i != num_values; ++i) {
+    list.append(generator.generate(size), getStore(), getArena());
+  }
+  list.flush(getStore());
+  reopenStoreAsReadOnly();
+
+  const auto store = getStore();
+  const auto num_bytes = store->getNumBlocks() * store->getBlockSize();
+  const char* begin = num_bytes ? store->tryGetStableAddressOf(0) : nullptr;
+  generator.reset();
+  auto iter = list.newIterator(*getStore());
+  for (size_t i = 0; i != num_values; ++i) {
+    ASSERT_TRUE(iter->hasNext());
+    const auto value = iter->next();
+    ASSERT_EQ(value, generator.generate(size));
+    // The value is a view of the blocks in the mapped data file.
+    ASSERT_TRUE(value.data() >= begin && value.data() < begin + num_bytes);
+  }
+  ASSERT_FALSE(iter->hasNext());
+}
+
 TEST_P(ListTestIteration, FlushValuesBetweenAddingThemAndIterate) {
   List list;
   const auto part_size = 1 + GetParam() / 5;
@@ -199,9 +242,578 @@ TEST_P(ListTestIteration, FlushValuesBetweenAddingThemAndIterate) {
   }
 }
 
+TEST_P(ListTestIteration, TailBlockStartsSmallAndGrowsWithValues) {
+  List list;
+  list.append("0", getStore(), getArena());
+  ASSERT_THAT(getArena()->allocated(), Eq(16));
+  list.append("1", getStore(), getArena());
+  list.append("2", getStore(), getArena());
+  ASSERT_THAT(getArena()->allocated(), Lt(getStore()->getBlockSize()));
+
+  for (size_t i = 3; i < GetParam(); ++i) {
+    list.append(std::to_string(i), getStore(), getArena());
+  }
+  list.flush(getStore(), nullptr, getArena());
+  auto iter = list.newIterator(*getStore());
+  for (size_t i = 0; i < std::max<size_t>(3, GetParam()); ++i) {
+    ASSERT_TRUE(iter->hasNext());
+    ASSERT_THAT(iter->next(), Eq(std::to_string(i)));
+  }
+  ASSERT_FALSE(iter->hasNext());
+}
+
+TEST_P(ListTestIteration, AddMixedValuesAndIterateWithReadOnlyStore) {
+  List list;
+  SequenceGenerator generator;
+  const auto block_size = getStore()->getBlockSize();
+  const size_t sizes[] = {1, block_size / 3, block_size * 2};
+  for (size_t i = 0; i != GetParam(); ++i) {
+    list.append(generator.generate(sizes[i % 3]), getStore(), getArena());
+  }
+  list.flush(getStore());
+  reopenStoreAsReadOnly();
+
+  generator.reset();
+  auto iter = list.newIterator(*getStore());
+  for (size_t i = 0; i != GetParam(); ++i) {
+    const auto expected = generator.generate(sizes[i % 3]);
+    ASSERT_TRUE(iter->hasNext());
+    ASSERT_THAT(iter->peekNext(), Eq(expected));
+    ASSERT_THAT(iter->next(), Eq(expected));
+  }
+  ASSERT_FALSE(iter->hasNext());
+}
+
+TEST_P(ListTestIteration, IterateWithSmallMaxReadAheadFromBothStoreModes) {
+  List list;
+  SequenceGenerator generator;
+  const auto block_size = getStore()->getBlockSize();
+  const size_t sizes[] = {1, block_size / 3, block_size * 2};
+  for (size_t i = 0; i != GetParam(); ++i) {
+    list.append(generator.generate(sizes[i % 3]), getStore(), getArena());
+  }
+  list.flush(getStore());
+
+  for (const bool readonly : {false, true}) {
+    Store::Options options;
+    options.readonly = readonly;
+    options.max_read_ahead = 5;
+    reopenStore(options);
+
+    generator.reset();
+    auto iter = list.newIterator(*getStore());
+    for (size_t i = 0; i != GetParam(); ++i) {
+      ASSERT_TRUE(iter->hasNext());
+      ASSERT_THAT(iter->next(), Eq(generator.generate(sizes[i % 3])));
+    }
+    ASSERT_FALSE(iter->hasNext());
+  }
+}
+
+TEST_P(ListTestIteration, RemoveAtCountsRemovedValuesAsWell) {
+  List list;
+  for (size_t i = 0; i != GetParam(); ++i) {
+    list.append(std::to_string(i), getStore(), getArena());
+  }
+  std::vector<uint32_t> positions;
+  const auto is_even = [](const Bytes& value) {
+    return std::stoi(value.toString()) % 2 == 0;
+  };
+  const auto num_removed = list.removeAll(is_even, getStore(), &positions);
+  ASSERT_EQ(positions.size(), num_removed);
+  for (size_t i = 0; i != positions.size(); ++i) {
+    ASSERT_EQ(positions[i], 2 * i);
+  }
+  if (GetParam() < 2) return;
+
+  list.removeAt(1, getStore());
+  ASSERT_EQ(list.size(), GetParam() - num_removed - 1);
+  auto iter = list.newIterator(*getStore());
+  for (size_t i = 3; i < GetParam(); i += 2) {
+    ASSERT_EQ(iter->next(), std::to_string(i));
+  }
+  ASSERT_FALSE(iter->hasNext());
+}
+
+TEST_P(ListTestIteration, ReplaceByValueAppendsNewValueForEachMatch) {
+  List list;
+  for (size_t i = 0; i != GetParam(); ++i) {
+    list.append(std::to_string(i % 3), getStore(), getArena());
+  }
+  std::vector<uint32_t> positions;
+  const auto num_matches = (GetParam() + 2) / 3;
+  ASSERT_EQ(list.replaceOne("0", "xx", getStore(), getArena(), &positions),
+            num_matches != 0);
+  ASSERT_EQ(list.replaceAll("0", "yy", getStore(), getArena(), &positions),
+            num_matches == 0 ? 0 : num_matches - 1);
+  ASSERT_EQ(positions.size(), num_matches);
+  for (size_t i = 0; i != positions.size(); ++i) {
+    ASSERT_EQ(positions[i], 3 * i);
+  }
+  ASSERT_EQ(list.size(), GetParam());
+  std::vector<std::string> values;
+  auto iter = list.newIterator(*getStore());
+  while (iter->hasNext()) {
+    values.push_back(iter->next().toString());
+  }
+  ASSERT_EQ(std::count(values.begin(), values.end(), "0"), 0);
+  ASSERT_EQ(std::count(values.begin(), values.end(), "xx"), num_matches != 0);
+  ASSERT_EQ(std::count(values.begin(), values.end(), "yy"),
+            num_matches == 0 ? 0 : num_matches - 1);
+}
+
+TEST_P(ListTestIteration, ReplaceByValueOfSameSizeOverwritesInPlace) {
+  const auto value = [](size_t i) {
+    // Every 50th value spans multiple blocks.
+    return (i % 50 == 0) ? std::string(1000, '0') : std::to_string(i % 3);
+  };
+  List list;
+  for (size_t i = 0; i != GetParam(); ++i) {
+    list.append(value(i), getStore(), getArena());
+  }
+  const std::string old_large(1000, '0');
+  const std::string new_large(1000, 'z');
+  std::vector<uint32_t> positions;
+  const auto num_large = (GetParam() + 49) / 50;
+  ASSERT_EQ(list.replaceAll(old_large, new_large, getStore(), getArena(),
+                            &positions),
+            num_large);
+  ASSERT_EQ(positions.size(), num_large);
+  ASSERT_EQ(list.replaceOne("1", "x", getStore(), getArena(), &positions),
+            GetParam() > 1);
+  ASSERT_EQ(list.getStatsUnlocked().num_values_total, GetParam());
+  ASSERT_EQ(list.getStatsUnlocked().num_values_removed, 0);
+
+  list.flush(getStore());
+  reopenStoreAsReadOnly();
+  auto iter = list.newIterator(*getStore());
+  for (size_t i = 0; i != GetParam(); ++i) {
+    ASSERT_TRUE(iter->hasNext());
+    const auto expected = (i % 50 == 0) ? new_large
+                                        : (i == 1) ? "x" : value(i);
+    ASSERT_EQ(iter->next().toString(), expected);
+  }
+  ASSERT_FALSE(iter->hasNext());
+}
+
+TEST_P(ListTestIteration, ClearedListOnlyReturnsValuesAddedAfterwards) {
+  List list;
+  for (size_t i = 0; i != GetParam(); ++i) {
+    list.append(std::to_string(i), getStore(), getArena());
+  }
+  ASSERT_EQ(list.clear(), GetParam());
+  list.append("a", getStore(), getArena());
+  list.append("b", getStore(), getArena());
+  auto iter = list.newIterator(*getStore());
+  ASSERT_EQ(iter->available(), 2);
+  ASSERT_EQ(iter->next(), "a");
+  ASSERT_EQ(iter->next(), "b");
+  ASSERT_FALSE(iter->hasNext());
+}
+
+TEST_P(ListTestIteration, UpdatesMarkListAsDirtyUntilFlushedIfDirty) {
+  List list;
+  ASSERT_FALSE(list.isDirty());
+  for (size_t i = 0; i != GetParam(); ++i) {
+    list.append(std::to_string(i), getStore(), getArena());
+  }
+  ASSERT_EQ(list.isDirty(), GetParam() != 0);
+  size_t num_calls = 0;
+  const auto count = [&num_calls](const List&) { ++num_calls; };
+  ASSERT_TRUE(list.tryFlushIfDirty(getStore(), count));
+  ASSERT_TRUE(list.tryFlushIfDirty(getStore(), count));
+  ASSERT_EQ(num_calls, GetParam() != 0);
+  ASSERT_FALSE(list.isDirty());
+
+  list.removeAll([](const Bytes&) { return true; }, getStore());
+  ASSERT_EQ(list.isDirty(), GetParam() != 0);
+  ASSERT_TRUE(list.tryFlushIfDirty(getStore(), count));
+  list.clear();
+  ASSERT_TRUE(list.isDirty());
+}
+
+void assertSkipYieldsSameValuesAsNext(const List& list, const Store& store,
+                                      const std::vector<std::string>& values,
+                                      uint32_t page_size) {
+  auto iter = list.newIterator(store);
+  size_t i = 0;
+  while (true) {
+    const auto expected = std::min<size_t>(page_size, values.size() - i);
+    ASSERT_EQ(iter->skip(page_size), expected);
+    i += expected;
+    ASSERT_EQ(iter->available(), values.size() - i);
+    if (i == values.size()) break;
+    ASSERT_EQ(iter->next(), values[i++]);
+  }
+  ASSERT_FALSE(iter->hasNext());
+}
+
+TEST_P(ListTestIteration, SkipYieldsSameValuesAsNext) {
+  List list;
+  for (size_t i = 0; i != GetParam(); ++i) {
+    list.append(std::to_string(i), getStore(), getArena());
+  }
+  const auto is_multiple_of = [](const Bytes& value, int n) {
+    return std::stoi(value.toString()) % n == 0;
+  };
+  list.removeAll(std::bind(is_multiple_of, std::placeholders::_1, 3),
+                 getStore());
+  std::vector<std::string> values;
+  for (size_t i = 0; i != GetParam(); ++i) {
+    if (i % 3 != 0) values.push_back(std::to_string(i));
+  }
+  for (const uint32_t page_size : {1, 300, 5000}) {
+    assertSkipYieldsSameValuesAsNext(list, *getStore(), values, page_size);
+  }
+
+  // The index, if built, is maintained by appends and removals.
+  for (size_t i = GetParam(); i != GetParam() + 1000; ++i) {
+    list.append(std::to_string(i), getStore(), getArena());
+    values.push_back(std::to_string(i));
+  }
+  list.removeAll(std::bind(is_multiple_of, std::placeholders::_1, 5),
+                 getStore());
+  values.erase(std::remove_if(values.begin(), values.end(),
+                              std::bind(is_multiple_of, std::placeholders::_1,
+                                        5)),
+               values.end());
+  assertSkipYieldsSameValuesAsNext(list, *getStore(), values, 300);
+}
+
+TEST_P(ListTestIteration, CopyBlocksYieldsSameValues) {
+  List list;
+  for (size_t i = 0; i != GetParam(); ++i) {
+    list.append(std::to_string(i), getStore(), getArena());
+  }
+  list.flush(getStore());
+  const boost::filesystem::path file = "/tmp/multimap.ListTestIteration.copy";
+  boost::filesystem::remove(file);
+  {
+    Store target(file, Store::Options());
+    const auto copy = list.copyBlocks(*getStore(), &target);
+    ASSERT_EQ(copy->getStatsUnlocked().num_values_total, GetParam());
+    auto iter = copy->newIterator(target);
+    for (size_t i = 0; i != GetParam(); ++i) {
+      ASSERT_TRUE(iter->hasNext());
+      ASSERT_EQ(iter->next(), std::to_string(i));
+    }
+    ASSERT_FALSE(iter->hasNext());
+  }
+  boost::filesystem::remove(file);
+}
+
+TEST_P(ListTestIteration, IteratorYieldsValuesAsOfItsCreationWhileAppending) {
+  List list;
+  std::vector<std::string> values;
+  for (size_t i = 0; i != GetParam(); ++i) {
+    list.append(std::to_string(i), getStore(), getArena());
+    values.push_back(std::to_string(i));
+  }
+  auto iter = list.newIterator(*getStore());
+  const auto num_skipped = iter->skip(GetParam() / 2);
+  for (size_t i = GetParam(); i != GetParam() + 1000; ++i) {
+    list.append(std::to_string(i), getStore(), getArena());
+  }
+  ASSERT_EQ(iter->available(), GetParam() - num_skipped);
+  for (size_t i = num_skipped; i != GetParam(); ++i) {
+    ASSERT_EQ(iter->next(), values[i]);
+  }
+  ASSERT_FALSE(iter->hasNext());
+  iter.reset();
+
+  // The index built by the first iterator does not cover the appended values.
+  for (size_t i = GetParam(); i != GetParam() + 1000; ++i) {
+    values.push_back(std::to_string(i));
+  }
+  assertSkipYieldsSameValuesAsNext(list, *getStore(), values, 300);
+}
+
+TEST_P(ListTestIteration, ReverseIteratorYieldsValuesNewestFirst) {
+  List list;
+  std::vector<std::string> values;
+  for (size_t i = 0; i != GetParam(); ++i) {
+    list.append(std::to_string(i), getStore(), getArena());
+    if (i % 5 != 0) {
+      values.push_back(std::to_string(i));
+    }
+  }
+  list.removeAll([](const Bytes& value) {
+    return std::stoul(value.toString()) % 5 == 0;
+  }, getStore());
+  std::reverse(values.begin(), values.end());
+
+  auto iter = list.newReverseIterator(*getStore());
+  ASSERT_EQ(iter->available(), values.size());
+  for (size_t i = 0; i < values.size() && i < 1000; ++i) {
+    ASSERT_EQ(iter->peekNext(), values[i]);
+    ASSERT_EQ(iter->next(), values[i]);
+  }
+  // Skipping moves to older segments.
+  for (size_t i = std::min<size_t>(values.size(), 1000); i < values.size();
+       i += 1001) {
+    ASSERT_EQ(iter->next(), values[i]);
+    ASSERT_EQ(iter->skip(1000), std::min<size_t>(1000, values.size() - i - 1));
+  }
+  ASSERT_FALSE(iter->hasNext());
+}
+
+TEST_P(ListTestIteration, CapIsEnforcedOnceNoIteratorReadsTheList) {
+  List list;
+  List::Cap cap;
+  cap.max_size = 10;
+  auto iter = list.newIterator(*getStore());
+  for (size_t i = 0; i != GetParam(); ++i) {
+    list.append(std::to_string(i), getStore(), getArena(), nullptr, &cap);
+  }
+  // Appending is not blocked, but blocks are not dropped either.
+  ASSERT_EQ(cap.num_entries_retired, 0);
+  ASSERT_EQ(list.size(), GetParam());
+  iter.reset();
+
+  for (size_t i = GetParam(); i != 2 * GetParam(); ++i) {
+    list.append(std::to_string(i), getStore(), getArena(), nullptr, &cap);
+  }
+  ASSERT_EQ(list.size(), 2 * GetParam() - cap.num_entries_retired);
+  ASSERT_GE(list.size(), std::min<uint32_t>(2 * GetParam(), cap.max_size));
+  if (GetParam() >= 1000) {
+    ASSERT_LT(list.size(), 1000);
+  }
+  iter = list.newIterator(*getStore());
+  for (size_t i = 2 * GetParam() - list.size(); i != 2 * GetParam(); ++i) {
+    ASSERT_EQ(iter->next(), std::to_string(i));
+  }
+  ASSERT_FALSE(iter->hasNext());
+}
+
 INSTANTIATE_TEST_CASE_P(Parameterized, ListTestIteration,
                         testing::Values(0, 1, 2, 10, 100, 1000, 1000000));
 
+struct ListTestFrontCoding : testing::TestWithParam<uint32_t> {
+  void SetUp() override {
+    boost::filesystem::remove_all(directory);
+    MT_ASSERT_TRUE(boost::filesystem::create_directory(directory));
+  }
+
+  void TearDown() override {
+    MT_ASSERT_TRUE(boost::filesystem::remove_all(directory));
+  }
+
+  std::string makeValue(size_t i) const {
+    // Every 7th value spans multiple blocks.
+    const auto suffix = std::to_string(i);
+    return "http://multimap.io/values/" +
+           (i % 7 == 0 ? std::string(block_size * 2, 'x') + suffix : suffix);
+  }
+
+  std::unique_ptr<Store> openStore(bool front_coding, bool readonly) const {
+    Store::Options options;
+    options.block_size = block_size;
+    options.front_coding = front_coding;
+    options.readonly = readonly;
+    const auto file = directory / (front_coding ? "front_coded" : "plain");
+    return std::unique_ptr<Store>(new Store(file, options));
+  }
+
+  const boost::filesystem::path directory = "/tmp/multimap.ListTestFrontCoding";
+  const uint32_t block_size = 128;
+  Arena arena;
+};
+
+TEST_P(ListTestFrontCoding, AddValuesRemoveSomeAndIterateWithReadOnlyStore) {
+  List list;
+  auto store = openStore(true, false);
+  for (size_t i = 0; i != GetParam(); ++i) {
+    list.append(makeValue(i), store.get(), &arena);
+  }
+  const auto is_multiple_of_3 = [](const Bytes& value) {
+    const auto string = value.toString();
+    const auto begin = string.find_last_not_of("0123456789") + 1;
+    const auto number = string.substr(begin);
+    return std::stoul(number) % 3 == 0;
+  };
+  ASSERT_THAT(list.removeAll(is_multiple_of_3, store.get()),
+              Eq((GetParam() + 2) / 3));
+  list.flush(store.get());
+  store.reset();  // Destructor flushes all data to disk.
+  store = openStore(true, true);
+
+  auto iter = list.newIterator(*store);
+  ASSERT_THAT(iter->available(), Eq(GetParam() - (GetParam() + 2) / 3));
+  for (size_t i = 0; i != GetParam(); ++i) {
+    if (i % 3 == 0) continue;
+    ASSERT_TRUE(iter->hasNext());
+    ASSERT_THAT(iter->peekNext(), Eq(makeValue(i)));
+    ASSERT_THAT(iter->next(), Eq(makeValue(i)));
+  }
+  ASSERT_FALSE(iter->hasNext());
+}
+
+TEST_P(ListTestFrontCoding, NeedsFewerBlocksForValuesWithSharedPrefixes) {
+  List plain_list;
+  List front_coded_list;
+  auto plain_store = openStore(false, false);
+  auto front_coded_store = openStore(true, false);
+  for (size_t i = 0; i != GetParam(); ++i) {
+    const auto value = "http://multimap.io/values/" + std::to_string(i);
+    plain_list.append(value, plain_store.get(), &arena);
+    front_coded_list.append(value, front_coded_store.get(), &arena);
+  }
+  plain_list.flush(plain_store.get());
+  front_coded_list.flush(front_coded_store.get());
+  ASSERT_LE(front_coded_store->getNumBlocks(), plain_store->getNumBlocks());
+  if (GetParam() >= 100) {
+    ASSERT_LT(front_coded_store->getNumBlocks() * 2,
+              plain_store->getNumBlocks());
+  }
+
+  auto iter = front_coded_list.newIterator(*front_coded_store);
+  for (size_t i = 0; i != GetParam(); ++i) {
+    ASSERT_TRUE(iter->hasNext());
+    ASSERT_THAT(iter->next(),
+                Eq("http://multimap.io/values/" + std::to_string(i)));
+  }
+  ASSERT_FALSE(iter->hasNext());
+}
+
+TEST_P(ListTestFrontCoding, SkipYieldsSameValuesAsNextFromBothStoreModes) {
+  List list;
+  std::vector<std::string> values;
+  for (const bool front_coding : {false, true}) {
+    auto store = openStore(front_coding, false);
+    for (size_t i = 0; i != GetParam(); ++i) {
+      values.push_back(makeValue(i));
+      list.append(values.back(), store.get(), &arena);
+    }
+    for (const bool readonly : {false, true}) {
+      list.flush(store.get());
+      store.reset();  // Destructor flushes all data to disk.
+      store = openStore(front_coding, readonly);
+      for (const uint32_t page_size : {1, 300, 1000}) {
+        assertSkipYieldsSameValuesAsNext(list, *store, values, page_size);
+      }
+    }
+    list.clear();
+    values.clear();
+  }
+}
+
+TEST_P(ListTestFrontCoding, SkipWhileLessFindsFirstValueNotLessInSortedList) {
+  std::vector<std::string> values;
+  for (size_t i = 0; i != GetParam(); ++i) {
+    values.push_back(makeValue(i));
+  }
+  std::sort(values.begin(), values.end());
+  for (const bool front_coding : {false, true}) {
+    auto store = openStore(front_coding, false);
+    List list;
+    for (const auto& value : values) {
+      list.append(value, store.get(), &arena);
+    }
+    const auto is_removed = [](const Bytes& value) {
+      return value.size() % 3 == 0;
+    };
+    list.removeAll(is_removed, store.get());
+    for (size_t i = 0; i < values.size(); i += 97) {
+      for (const auto& target : {values[i], values[i] + '!'}) {
+        auto expected = std::lower_bound(values.begin(), values.end(), target);
+        while (expected != values.end() && is_removed(*expected)) {
+          ++expected;
+        }
+        uint32_t num_comparisons = 0;
+        const auto less = [&num_comparisons](const Bytes& a, const Bytes& b) {
+          ++num_comparisons;
+          return a < b;
+        };
+        List::SharedIterator iter(list, *store);
+        iter.skipWhileLess(target, less);
+        ASSERT_EQ(iter.available(), values.end() - expected -
+                                        std::count_if(expected, values.end(),
+                                                      is_removed));
+        if (expected != values.end()) {
+          ASSERT_EQ(iter.next(), *expected);
+        }
+        ASSERT_LT(num_comparisons, 4 * SkipIndex::INTERVAL + 64);
+        // Long lists are searched via their index.
+      }
+    }
+  }
+}
+
+TEST_P(ListTestFrontCoding, ReverseIteratorYieldsSameValuesAsIterator) {
+  for (const bool front_coding : {false, true}) {
+    auto store = openStore(front_coding, false);
+    List list;
+    std::vector<std::string> values;
+    for (size_t i = 0; i != GetParam(); ++i) {
+      values.push_back(makeValue(i));
+      list.append(values.back(), store.get(), &arena);
+    }
+    std::reverse(values.begin(), values.end());
+    for (const bool readonly : {false, true}) {
+      list.flush(store.get());
+      store.reset();  // Destructor flushes all data to disk.
+      store = openStore(front_coding, readonly);
+      // The first iterator builds the index of long lists, which the
+      // second one shares.
+      for (int i = 0; i != 2; ++i) {
+        auto iter = list.newReverseIterator(*store);
+        for (const auto& value : values) {
+          ASSERT_TRUE(iter->hasNext());
+          ASSERT_THAT(iter->next(), Eq(value));
+        }
+        ASSERT_FALSE(iter->hasNext());
+      }
+    }
+  }
+}
+
+TEST_P(ListTestFrontCoding, CapRetiresLeadingBlocksThatCanBeReplayed) {
+  const uint32_t max_size = 50;
+  for (const bool front_coding : {false, true}) {
+    auto store = openStore(front_coding, false);
+    List list;
+    List replayed;
+    List::Cap cap;
+    cap.max_size = max_size;
+    for (size_t i = 0; i != GetParam(); ++i) {
+      list.append(makeValue(i), store.get(), &arena, nullptr, &cap);
+      replayed.append(makeValue(i), store.get(), &arena);
+      if (i % 10 == 0) {
+        // Blocks of the replayed list end at other values.
+        replayed.flush(store.get());
+      }
+    }
+    const auto size = list.size();
+    ASSERT_GE(size, std::min(GetParam(), max_size));
+    ASSERT_LT(size, 2 * max_size);
+    ASSERT_EQ(list.getStats().num_values_total, GetParam());
+    ASSERT_EQ(cap.num_entries_retired, GetParam() - size);
+    ASSERT_EQ(cap.retired_block_ids.empty(), cap.num_entries_retired == 0);
+
+    std::vector<uint32_t> block_ids;
+    const auto num_marked = replayed.retire(cap.num_entries_retired,
+                                            store.get(), &arena, &block_ids);
+    ASSERT_LT(num_marked, max_size);
+    ASSERT_EQ(replayed.size(), size);
+    if (size != 0) {
+      // Logged positions are shifted by the number of marked values.
+      list.removeAt(0, store.get());
+      replayed.removeAt(num_marked, store.get());
+    }
+    auto iter = list.newIterator(*store);
+    auto replayed_iter = replayed.newIterator(*store);
+    for (size_t i = GetParam() - size + 1; i < GetParam(); ++i) {
+      ASSERT_THAT(iter->next(), Eq(makeValue(i)));
+      ASSERT_THAT(replayed_iter->next(), Eq(makeValue(i)));
+    }
+    ASSERT_FALSE(iter->hasNext());
+    ASSERT_FALSE(replayed_iter->hasNext());
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(Parameterized, ListTestFrontCoding,
+                        testing::Values(0, 1, 2, 10, 100, 1000, 100000));
+
 // -----------------------------------------------------------------------------
 // class List / Concurrency
 // -----------------------------------------------------------------------------
@@ -237,9 +849,29 @@ TEST(ListTest, ReaderDoesNotBlockReader2) {
   ASSERT_TRUE(list.empty());
 }
 
+TEST(ListTest, ReaderDoesNotBlockAppender) {
+  List list;
+  Arena arena;
+  Store store;
+  list.append("value", &store, &arena);
+
+  // Reader
+  auto iter = list.newIterator(store);
+
+  // Appender
+  std::thread([&] { list.append("value", &store, &arena); }).join();
+
+  ASSERT_THAT(iter->available(), Eq(1));
+  ASSERT_THAT(iter->next(), Eq("value"));
+  ASSERT_FALSE(iter->hasNext());
+  ASSERT_THAT(list.size(), Eq(2));
+}
+
 TEST(ListTest, ReaderBlocksWriter) {
   List list;
+  Arena arena;
   Store store;
+  list.append("value", &store, &arena);
 
   // Reader
   auto iter = list.newIterator(store);
@@ -247,8 +879,7 @@ TEST(ListTest, ReaderBlocksWriter) {
   // Writer
   bool writer_has_finished = false;
   std::thread writer([&] {
-    Arena arena;
-    list.append("value", &store, &arena);
+    list.removeOne([](const Bytes& /* value */) { return true; }, &store);
     writer_has_finished = true;
   });
 
@@ -390,6 +1021,38 @@ TEST_P(ListIteratorTestWithParam, Iterate) {
 INSTANTIATE_TEST_CASE_P(Parameterized, ListIteratorTestWithParam,
                         testing::Values(0, 1, 2, 10, 100, 1000, 1000000));
 
+TEST(ListTest, DISABLED_BenchmarkAppendAndIterate) {
+  const uint32_t num_values = 10000000;
+  const boost::filesystem::path directory = "/tmp/multimap.ListTestBenchmark";
+  boost::filesystem::remove_all(directory);
+  MT_ASSERT_TRUE(boost::filesystem::create_directory(directory));
+  {
+    std::vector<std::string> values;
+    SequenceGenerator generator;
+    for (uint32_t i = 0; i != num_values; ++i) {
+      values.push_back(generator.next());
+    }
+    Arena arena;
+    Store store(directory / "store", Store::Options());
+    List list;
+    Benchmark::run("List::append", num_values, [&] {
+      for (const auto& value : values) {
+        list.append(value, &store, &arena);
+      }
+    });
+    uint64_t num_bytes = 0;
+    Benchmark::run("List::Iterator::next", num_values, [&] {
+      const auto iter = list.newIterator(store);
+      while (iter->hasNext()) {
+        num_bytes += iter->next().size();
+      }
+    });
+    ASSERT_THAT(num_bytes, Gt(num_values));
+  }
+  boost::filesystem::remove_all(directory);
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
 // TODO Move that into List::remove() unit tests
 /*
 TEST_P(ExclusiveListIteratorTestWithParam, IterateOnceAndRemoveEvery23thValue) {
@@ -0,0 +1,216 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/LockProfiler.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+const char* LOCK_CLASS_NAMES[] = {"partition", "list", "store"};
+
+static_assert(sizeof LOCK_CLASS_NAMES / sizeof LOCK_CLASS_NAMES[0] ==
+                  LockProfiler::NUM_LOCK_CLASSES,
+              "LOCK_CLASS_NAMES does not match LockProfiler::LockClass");
+
+const char* COUNT_NAMES[] = {"lock_acquisitions", "lock_contentions",
+                             "lock_wait_time", "lock_wait_time_max",
+                             "lock_hold_time"};
+// Times are reported in nanoseconds.
+
+const size_t NUM_SLOTS = 16;
+
+struct alignas(64) Slot {
+  struct Counts {
+    std::atomic<uint64_t> acquisitions;
+    std::atomic<uint64_t> contentions;
+    std::atomic<uint64_t> wait_time;
+    std::atomic<uint64_t> max_wait_time;
+    std::atomic<uint64_t> hold_time;
+  };
+
+  Counts counts[LockProfiler::NUM_LOCK_CLASSES];
+};
+// Aligned to a cache line, so that threads mapped to adjacent slots do not
+// invalidate each other's caches.
+
+Slot slots[NUM_SLOTS];
+// Zero-initialized, because it has static storage duration.
+
+Slot::Counts& getCounts(LockProfiler::LockClass lock_class) {
+  static thread_local const size_t index =
+      std::hash<std::thread::id>()(std::this_thread::get_id()) % NUM_SLOTS;
+  return slots[index].counts[static_cast<size_t>(lock_class)];
+}
+
+struct ContendedKeys {
+  static const size_t CAPACITY = 2 * LockProfiler::MAX_CONTENDED_KEYS;
+
+  void add(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto min = entries.end();
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+      if (it->first == key) {
+        it->second++;
+        return;
+      }
+      if (min == entries.end() || it->second < min->second) min = it;
+    }
+    if (entries.size() < CAPACITY) {
+      entries.emplace_back(key, 1);
+    } else {
+      min->first = key;
+      min->second++;
+    }
+  }
+  // Space-saving algorithm: a key that is not tracked replaces the one with
+  // the lowest count and takes over that count, which keeps the counts of
+  // frequent keys accurate with a fixed number of entries.
+
+  std::mutex mutex;
+  std::vector<std::pair<std::string, uint64_t> > entries;
+};
+
+ContendedKeys& getContendedKeys() {
+  static ContendedKeys contended_keys;
+  return contended_keys;
+}
+
+struct CurrentKey {
+  std::string key;
+  bool is_set = false;
+};
+
+CurrentKey& getCurrentKey() {
+  static thread_local CurrentKey current_key;
+  return current_key;
+}
+
+}  // namespace
+
+const size_t LockProfiler::NUM_LOCK_CLASSES;
+const size_t LockProfiler::MAX_CONTENDED_KEYS;
+
+const std::vector<std::string>& LockProfiler::Snapshot::names() {
+  static std::vector<std::string> names;
+  static std::once_flag once;
+  std::call_once(once, [] {
+    for (const auto lock_class : LOCK_CLASS_NAMES) {
+      for (const auto count : COUNT_NAMES) {
+        names.push_back(std::string(lock_class) + '_' + count);
+      }
+    }
+  });
+  return names;
+}
+
+std::vector<uint64_t> LockProfiler::Snapshot::toVector() const {
+  std::vector<uint64_t> values;
+  for (const auto& count : counts) {
+    values.push_back(count.acquisitions);
+    values.push_back(count.contentions);
+    values.push_back(count.wait_time);
+    values.push_back(count.max_wait_time);
+    values.push_back(count.hold_time);
+  }
+  return values;
+}
+
+void LockProfiler::recordAcquisition(LockClass lock_class) {
+  getCounts(lock_class).acquisitions.fetch_add(1, std::memory_order_relaxed);
+}
+
+void LockProfiler::recordWait(LockClass lock_class, uint64_t nanoseconds) {
+  auto& counts = getCounts(lock_class);
+  counts.contentions.fetch_add(1, std::memory_order_relaxed);
+  counts.wait_time.fetch_add(nanoseconds, std::memory_order_relaxed);
+  auto max = counts.max_wait_time.load(std::memory_order_relaxed);
+  while (nanoseconds > max &&
+         !counts.max_wait_time.compare_exchange_weak(
+             max, nanoseconds, std::memory_order_relaxed)) {
+  }
+  const auto& current_key = getCurrentKey();
+  if (current_key.is_set) getContendedKeys().add(current_key.key);
+}
+
+void LockProfiler::recordHold(LockClass lock_class, uint64_t nanoseconds) {
+  getCounts(lock_class).hold_time.fetch_add(nanoseconds,
+                                            std::memory_order_relaxed);
+}
+
+void LockProfiler::setCurrentKeyUnconditionally(const Bytes& key) {
+  auto& current_key = getCurrentKey();
+  current_key.key.assign(key.data(), key.size());
+  current_key.is_set = true;
+}
+
+LockProfiler::Snapshot LockProfiler::getSnapshot() {
+  Snapshot snapshot;
+  for (const auto& slot : slots) {
+    for (size_t i = 0; i != NUM_LOCK_CLASSES; ++i) {
+      const auto& source = slot.counts[i];
+      auto& target = snapshot.counts[i];
+      target.acquisitions +=
+          source.acquisitions.load(std::memory_order_relaxed);
+      target.contentions += source.contentions.load(std::memory_order_relaxed);
+      target.wait_time += source.wait_time.load(std::memory_order_relaxed);
+      target.max_wait_time = std::max<uint64_t>(
+          target.max_wait_time,
+          source.max_wait_time.load(std::memory_order_relaxed));
+      target.hold_time += source.hold_time.load(std::memory_order_relaxed);
+    }
+  }
+  auto& contended_keys = getContendedKeys();
+  {
+    std::lock_guard<std::mutex> lock(contended_keys.mutex);
+    snapshot.contended_keys = contended_keys.entries;
+  }
+  std::sort(snapshot.contended_keys.begin(), snapshot.contended_keys.end(),
+            [](const std::pair<std::string, uint64_t>& a,
+               const std::pair<std::string, uint64_t>& b) {
+              return a.second > b.second;
+            });
+  if (snapshot.contended_keys.size() > MAX_CONTENDED_KEYS) {
+    snapshot.contended_keys.resize(MAX_CONTENDED_KEYS);
+  }
+  return snapshot;
+}
+
+void LockProfiler::reset() {
+  for (auto& slot : slots) {
+    for (auto& counts : slot.counts) {
+      counts.acquisitions.store(0, std::memory_order_relaxed);
+      counts.contentions.store(0, std::memory_order_relaxed);
+      counts.wait_time.store(0, std::memory_order_relaxed);
+      counts.max_wait_time.store(0, std::memory_order_relaxed);
+      counts.hold_time.store(0, std::memory_order_relaxed);
+    }
+  }
+  auto& contended_keys = getContendedKeys();
+  std::lock_guard<std::mutex> lock(contended_keys.mutex);
+  contended_keys.entries.clear();
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,218 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_LOCK_PROFILER_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_LOCK_PROFILER_HPP_INCLUDED
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "multimap/Bytes.hpp"
+
+namespace multimap {
+namespace internal {
+
+class LockProfiler {
+  // Counts acquisitions of the locks of partition shards, lists, and stores,
+  // how many of them had to wait and for how long, and how long the locks
+  // were held, per lock class and process-wide.  It also tracks the keys
+  // whose operations waited most often.  Threads report to one of several
+  // slots, so that profiling does not add contention on its own.
+  //
+  // The locks only report if the library is compiled with the macro
+  // MULTIMAP_LOCK_PROFILING defined, as done by the target in
+  // multimap-library-prof.pro.  Otherwise `ProfiledMutexIfEnabled` is the
+  // plain mutex type and the profile remains empty.
+
+ public:
+  enum class LockClass { PARTITION, LIST, STORE, NUM_LOCK_CLASSES };
+  // `PARTITION` are the locks of the shards of a partition that guard its
+  // table of lists, `LIST` are the locks of single lists, and `STORE` are
+  // the locks that serialize appending blocks to a data file.
+
+  static const size_t NUM_LOCK_CLASSES =
+      static_cast<size_t>(LockClass::NUM_LOCK_CLASSES);
+
+  static const size_t MAX_CONTENDED_KEYS = 16;
+
+  struct Counts {
+    uint64_t acquisitions = 0;
+    uint64_t contentions = 0;
+    // Acquisitions that had to wait, because the lock was not available.
+
+    uint64_t wait_time = 0;
+    uint64_t max_wait_time = 0;
+    uint64_t hold_time = 0;
+    // Times in nanoseconds.  Hold times are only measured for exclusive and
+    // upgrade ownership, which has a single owner at a time.
+  };
+
+  struct Snapshot {
+    Counts counts[NUM_LOCK_CLASSES];
+
+    std::vector<std::pair<std::string, uint64_t> > contended_keys;
+    // Up to `MAX_CONTENDED_KEYS` keys with the estimated number of
+    // contentions of their operations, most frequent first.  The estimate
+    // is an upper bound, but a key that has waited more often than any key
+    // not listed is never missing.
+
+    const Counts& get(LockClass lock_class) const {
+      return counts[static_cast<size_t>(lock_class)];
+    }
+
+    static const std::vector<std::string>& names();
+
+    std::vector<uint64_t> toVector() const;
+    // Returns the counts of each lock class in the order of `names()`.
+  };
+
+  static constexpr bool isEnabled() {
+#if defined(MULTIMAP_LOCK_PROFILING)
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  static void recordAcquisition(LockClass lock_class);
+
+  static void recordWait(LockClass lock_class, uint64_t nanoseconds);
+  // Counts a contention of the key that the thread has set last.
+
+  static void recordHold(LockClass lock_class, uint64_t nanoseconds);
+
+  static void setCurrentKey(const Bytes& key) {
+    if (isEnabled()) setCurrentKeyUnconditionally(key);
+  }
+  // Partitions set the key whose list they look up, so that contentions
+  // that follow in the same thread are attributed to it.
+
+  static void setCurrentKeyUnconditionally(const Bytes& key);
+
+  static Snapshot getSnapshot();
+
+  static void reset();
+
+  static uint64_t getNanosecondsSince(
+      std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  }
+
+  LockProfiler() = delete;
+};
+
+template <typename Mutex, LockProfiler::LockClass LOCK_CLASS>
+class ProfiledMutex : public Mutex {
+  // Wraps a mutex type and reports its acquisitions to `LockProfiler`.
+  // Each acquisition is tried first, and only timed if that fails.  The
+  // shared and upgrade functions are only available for shared mutexes.
+
+ public:
+  void lock() {
+    if (!Mutex::try_lock()) {
+      const auto start = std::chrono::steady_clock::now();
+      Mutex::lock();
+      LockProfiler::recordWait(LOCK_CLASS,
+                               LockProfiler::getNanosecondsSince(start));
+    }
+    onExclusiveAcquired();
+  }
+
+  bool try_lock() {
+    if (!Mutex::try_lock()) return false;
+    onExclusiveAcquired();
+    return true;
+  }
+
+  void unlock() {
+    const auto acquired = acquired_;
+    Mutex::unlock();
+    LockProfiler::recordHold(LOCK_CLASS,
+                             LockProfiler::getNanosecondsSince(acquired));
+  }
+
+  void lock_shared() {
+    if (!Mutex::try_lock_shared()) {
+      const auto start = std::chrono::steady_clock::now();
+      Mutex::lock_shared();
+      LockProfiler::recordWait(LOCK_CLASS,
+                               LockProfiler::getNanosecondsSince(start));
+    }
+    LockProfiler::recordAcquisition(LOCK_CLASS);
+  }
+
+  bool try_lock_shared() {
+    if (!Mutex::try_lock_shared()) return false;
+    LockProfiler::recordAcquisition(LOCK_CLASS);
+    return true;
+  }
+
+  void lock_upgrade() {
+    if (!Mutex::try_lock_upgrade()) {
+      const auto start = std::chrono::steady_clock::now();
+      Mutex::lock_upgrade();
+      LockProfiler::recordWait(LOCK_CLASS,
+                               LockProfiler::getNanosecondsSince(start));
+    }
+    onExclusiveAcquired();
+  }
+
+  bool try_lock_upgrade() {
+    if (!Mutex::try_lock_upgrade()) return false;
+    onExclusiveAcquired();
+    return true;
+  }
+
+  void unlock_upgrade() {
+    const auto acquired = acquired_;
+    Mutex::unlock_upgrade();
+    LockProfiler::recordHold(LOCK_CLASS,
+                             LockProfiler::getNanosecondsSince(acquired));
+  }
+
+  void unlock_upgrade_and_lock_shared() {
+    const auto acquired = acquired_;
+    Mutex::unlock_upgrade_and_lock_shared();
+    LockProfiler::recordHold(LOCK_CLASS,
+                             LockProfiler::getNanosecondsSince(acquired));
+  }
+  // The shared ownership that follows is not timed.
+
+ private:
+  void onExclusiveAcquired() {
+    acquired_ = std::chrono::steady_clock::now();
+    LockProfiler::recordAcquisition(LOCK_CLASS);
+  }
+
+  std::chrono::steady_clock::time_point acquired_;
+  // Written and read by the exclusive or upgrade owner only.
+};
+
+template <typename Mutex, LockProfiler::LockClass LOCK_CLASS>
+using ProfiledMutexIfEnabled =
+    typename std::conditional<LockProfiler::isEnabled(),
+                              ProfiledMutex<Mutex, LOCK_CLASS>, Mutex>::type;
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_LOCK_PROFILER_HPP_INCLUDED
@@ -0,0 +1,161 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <boost/thread/shared_mutex.hpp>
+#include "gmock/gmock.h"
+#include "multimap/internal/LockProfiler.hpp"
+#include "multimap/internal/Locks.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+using testing::Ge;
+using testing::Gt;
+using testing::SizeIs;
+
+typedef ProfiledMutex<boost::shared_mutex, LockProfiler::LockClass::LIST>
+    ProfiledSharedMutex;
+
+class ObservableMutex : public boost::shared_mutex {
+  // Counts failed attempts to acquire the mutex exclusively, which
+  // `ProfiledMutex` makes right before it waits for it.
+
+ public:
+  bool try_lock() {
+    if (boost::shared_mutex::try_lock()) return true;
+    ++num_failed_attempts_;
+    return false;
+  }
+
+  uint32_t getNumFailedAttempts() const { return num_failed_attempts_; }
+
+ private:
+  std::atomic<uint32_t> num_failed_attempts_{0};
+};
+
+struct LockProfilerTestFixture : public testing::Test {
+  void SetUp() override { LockProfiler::reset(); }
+
+  void TearDown() override { LockProfiler::reset(); }
+};
+
+TEST(LockProfilerTest, IsEnabledOnlyIfMacroIsDefined) {
+#if defined(MULTIMAP_LOCK_PROFILING)
+  ASSERT_TRUE(LockProfiler::isEnabled());
+  ASSERT_TRUE((std::is_same<ProfiledMutexIfEnabled<
+                                std::mutex, LockProfiler::LockClass::STORE>,
+                            ProfiledMutex<std::mutex,
+                                          LockProfiler::LockClass::STORE> >::
+                   value));
+#else
+  ASSERT_FALSE(LockProfiler::isEnabled());
+  ASSERT_TRUE((std::is_same<ProfiledMutexIfEnabled<
+                                std::mutex, LockProfiler::LockClass::STORE>,
+                            std::mutex>::value));
+#endif
+}
+
+TEST(LockProfilerTest, NamesMatchValues) {
+  ASSERT_THAT(LockProfiler::getSnapshot().toVector(),
+              SizeIs(LockProfiler::Snapshot::names().size()));
+}
+
+TEST_F(LockProfilerTestFixture, ProfiledMutexCountsAcquisitionsPerClass) {
+  ProfiledMutex<std::mutex, LockProfiler::LockClass::STORE> mutex;
+  {
+    std::lock_guard<decltype(mutex)> lock(mutex);
+  }
+  ASSERT_TRUE(mutex.try_lock());
+  ASSERT_FALSE(mutex.try_lock());
+  mutex.unlock();
+
+  const auto snapshot = LockProfiler::getSnapshot();
+  const auto& counts = snapshot.get(LockProfiler::LockClass::STORE);
+  ASSERT_THAT(counts.acquisitions, Eq(2));
+  ASSERT_THAT(counts.contentions, Eq(0));
+  ASSERT_THAT(counts.wait_time, Eq(0));
+  const auto& other = snapshot.get(LockProfiler::LockClass::PARTITION);
+  ASSERT_THAT(other.acquisitions, Eq(0));
+}
+
+TEST_F(LockProfilerTestFixture, ProfiledMutexSupportsSharedAndUpgradeLocks) {
+  ProfiledSharedMutex mutex;
+  {
+    ReaderLockGuard<ProfiledSharedMutex> lock1(mutex);
+    ReaderLockGuard<ProfiledSharedMutex> lock2(mutex);
+  }
+  mutex.lock_upgrade();
+  mutex.unlock_upgrade_and_lock_shared();
+  mutex.unlock_shared();
+  {
+    WriterLockGuard<ProfiledSharedMutex> lock(mutex);
+  }
+  const auto snapshot = LockProfiler::getSnapshot();
+  ASSERT_THAT(snapshot.get(LockProfiler::LockClass::LIST).acquisitions, Eq(4));
+}
+
+TEST_F(LockProfilerTestFixture, ProfiledMutexMeasuresWaitAndHoldTime) {
+  ProfiledMutex<ObservableMutex, LockProfiler::LockClass::LIST> mutex;
+  mutex.lock();
+  std::thread thread([&mutex] {
+    LockProfiler::setCurrentKeyUnconditionally("key");
+    WriterLockGuard<decltype(mutex)> lock(mutex);
+  });
+  while (mutex.getNumFailedAttempts() == 0) {
+    std::this_thread::yield();
+  }
+  mutex.unlock();
+  thread.join();
+
+  const auto snapshot = LockProfiler::getSnapshot();
+  const auto& counts = snapshot.get(LockProfiler::LockClass::LIST);
+  ASSERT_THAT(counts.acquisitions, Eq(2));
+  ASSERT_THAT(counts.contentions, Eq(1));
+  ASSERT_THAT(counts.wait_time, Gt(0));
+  ASSERT_THAT(counts.max_wait_time, Eq(counts.wait_time));
+  ASSERT_THAT(counts.hold_time, Gt(0));
+  ASSERT_THAT(snapshot.contended_keys, SizeIs(1));
+  ASSERT_THAT(snapshot.contended_keys.front().first, Eq("key"));
+  ASSERT_THAT(snapshot.contended_keys.front().second, Eq(1));
+}
+
+TEST_F(LockProfilerTestFixture, ContendedKeysKeepsMostFrequentKeys) {
+  const auto num_keys = 4 * LockProfiler::MAX_CONTENDED_KEYS;
+  for (size_t i = 0; i != num_keys; ++i) {
+    LockProfiler::setCurrentKeyUnconditionally(std::to_string(i));
+    LockProfiler::recordWait(LockProfiler::LockClass::PARTITION, 1);
+  }
+  LockProfiler::setCurrentKeyUnconditionally("hot");
+  for (size_t i = 0; i != num_keys; ++i) {
+    LockProfiler::recordWait(LockProfiler::LockClass::PARTITION, 1);
+  }
+  const auto snapshot = LockProfiler::getSnapshot();
+  ASSERT_THAT(snapshot.contended_keys,
+              SizeIs(LockProfiler::MAX_CONTENDED_KEYS));
+  ASSERT_THAT(snapshot.contended_keys.front().first, Eq("hot"));
+  ASSERT_THAT(snapshot.contended_keys.front().second, Ge(num_keys));
+  ASSERT_THAT(snapshot.get(LockProfiler::LockClass::PARTITION).contentions,
+              Eq(2 * num_keys));
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -31,6 +31,10 @@ using ReaderLock = boost::shared_lock<SharedMutex>;
 template <typename SharedMutex>
 using ReaderLockGuard = boost::shared_lock_guard<SharedMutex>;
 
+template <typename SharedMutex>
+using UpgradeLock = boost::upgrade_lock<SharedMutex>;
+// Excludes other upgrade and writer locks, but not reader locks.
+
 template <typename SharedMutex>
 using WriterLock = boost::unique_lock<SharedMutex>;
 
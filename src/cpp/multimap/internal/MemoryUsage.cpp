@@ -0,0 +1,54 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/MemoryUsage.hpp"
+
+namespace multimap {
+namespace internal {
+
+const std::vector<std::string>& MemoryUsage::names() {
+  static std::vector<std::string> names = {
+      "arena_allocated", "arena_reserved", "hash_tables",
+      "block_ids",       "tail_blocks",    "write_buffer",
+      "mapped_values",   "mapped_keys",    "mutex_pool"};
+  return names;
+}
+
+MemoryUsage MemoryUsage::total(const std::vector<MemoryUsage>& usages) {
+  MemoryUsage total;
+  for (const auto& usage : usages) {
+    total.arena_allocated += usage.arena_allocated;
+    total.arena_reserved += usage.arena_reserved;
+    total.hash_tables += usage.hash_tables;
+    total.block_ids += usage.block_ids;
+    total.tail_blocks += usage.tail_blocks;
+    total.write_buffer += usage.write_buffer;
+    total.mapped_values += usage.mapped_values;
+    total.mapped_keys += usage.mapped_keys;
+    total.mutex_pool += usage.mutex_pool;
+  }
+  return total;
+}
+
+std::vector<uint64_t> MemoryUsage::toVector() const {
+  return {arena_allocated, arena_reserved, hash_tables,
+          block_ids,       tail_blocks,    write_buffer,
+          mapped_values,   mapped_keys,    mutex_pool};
+}
+
+}  // namespace internal
+}  // namespace multimap
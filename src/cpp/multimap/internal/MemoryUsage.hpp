@@ -0,0 +1,69 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_MEMORY_USAGE_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_MEMORY_USAGE_HPP_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace multimap {
+namespace internal {
+
+struct MemoryUsage {
+  // Number of bytes held by the components of an open partition.  Unlike
+  // class Stats, nothing is written to disk.
+  uint64_t arena_allocated = 0;
+  uint64_t arena_reserved = 0;
+  // Memory of the partition's arena, which holds keys, block ids, and tail
+  // blocks.  Reserved bytes include chunks that are not handed out yet.
+  uint64_t hash_tables = 0;
+  // Memory of the hash tables that map keys to lists, including free slots.
+  uint64_t block_ids = 0;
+  uint64_t tail_blocks = 0;
+  // Parts of `arena_allocated` that are held by the block ids of lists,
+  // encoded as `UintVector`, and by their tail blocks.  Lists that are
+  // locked when visited are not accounted for.
+  uint64_t write_buffer = 0;
+  // Capacity of the write buffer of the values file.
+  uint64_t mapped_values = 0;
+  uint64_t mapped_keys = 0;
+  // Number of bytes of the values file and of keys files, i.e. the indexed
+  // keys file of a read-only partition and spill files, that are mapped.
+  // They only take up memory as far as the kernel caches them.
+  uint64_t mutex_pool = 0;
+  // Memory of the process-wide pool of list mutexes, which is only set in
+  // the total of a map.
+
+  uint64_t heap() const {
+    return arena_reserved + hash_tables + write_buffer + mutex_pool;
+  }
+  // Returns the number of bytes allocated on the heap, which excludes the
+  // mapped files and the parts of the arena.
+
+  static const std::vector<std::string>& names();
+
+  static MemoryUsage total(const std::vector<MemoryUsage>& usages);
+
+  std::vector<uint64_t> toVector() const;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_MEMORY_USAGE_HPP_INCLUDED
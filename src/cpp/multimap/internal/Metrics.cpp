@@ -0,0 +1,199 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/Metrics.hpp"
+
+#include <cmath>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <boost/filesystem/operations.hpp>
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+const char* OPERATION_NAMES[] = {"put",      "write",       "get",
+                                 "get_many", "contains",    "remove",
+                                 "replace",  "lock_wait",   "store_flush",
+                                 "store_remap"};
+
+static_assert(sizeof OPERATION_NAMES / sizeof OPERATION_NAMES[0] ==
+                  Metrics::NUM_OPERATIONS,
+              "OPERATION_NAMES does not match Metrics::Operation");
+
+const char* SUMMARY_NAMES[] = {"count",       "latency_avg", "latency_p50",
+                               "latency_p90", "latency_p99", "latency_max"};
+// Latencies are reported in nanoseconds.
+
+size_t getSlotIndex(size_t num_slots) {
+  static thread_local const size_t index =
+      std::hash<std::thread::id>()(std::this_thread::get_id()) % num_slots;
+  return index;
+}
+
+}  // namespace
+
+size_t Metrics::getBucketIndex(uint64_t value) {
+  if (value < NUM_SUB_BUCKETS) return value;
+  const size_t exponent = 63 - __builtin_clzll(value);
+  const auto shift = exponent - NUM_SUB_BUCKETS_LOG2;
+  const auto sub_bucket = (value >> shift) - NUM_SUB_BUCKETS;
+  return (shift + 1) * NUM_SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t Metrics::getBucketUpperBound(size_t index) {
+  MT_REQUIRE_LT(index, NUM_BUCKETS);
+  if (index < NUM_SUB_BUCKETS) return index;
+  const auto shift = index / NUM_SUB_BUCKETS - 1;
+  const uint64_t sub_bucket = index % NUM_SUB_BUCKETS;
+  const auto lower_bound = (NUM_SUB_BUCKETS + sub_bucket) << shift;
+  return lower_bound + ((uint64_t(1) << shift) - 1);
+}
+
+uint64_t Metrics::Histogram::quantile(double q) const {
+  if (count == 0) return 0;
+  const auto rank = mt::max(uint64_t(1), uint64_t(std::ceil(q * count)));
+  uint64_t num_values = 0;
+  for (size_t i = 0; i != buckets.size(); ++i) {
+    num_values += buckets[i];
+    if (num_values >= rank) {
+      return mt::min(getBucketUpperBound(i), max);
+    }
+  }
+  return max;
+}
+
+const std::vector<std::string>& Metrics::Snapshot::names() {
+  static std::vector<std::string> names;
+  static std::once_flag once;
+  std::call_once(once, [] {
+    for (const auto operation : OPERATION_NAMES) {
+      for (const auto summary : SUMMARY_NAMES) {
+        names.push_back(std::string(operation) + '_' + summary);
+      }
+    }
+    names.push_back("bytes_read");
+    names.push_back("bytes_written");
+  });
+  return names;
+}
+
+std::vector<uint64_t> Metrics::Snapshot::toVector() const {
+  std::vector<uint64_t> values;
+  for (const auto& histogram : histograms) {
+    values.push_back(histogram.count);
+    values.push_back(histogram.mean());
+    values.push_back(histogram.quantile(0.5));
+    values.push_back(histogram.quantile(0.9));
+    values.push_back(histogram.quantile(0.99));
+    values.push_back(histogram.max);
+  }
+  values.push_back(bytes_read);
+  values.push_back(bytes_written);
+  return values;
+}
+
+Metrics::Snapshot Metrics::Snapshot::readFromFile(
+    const boost::filesystem::path& file) {
+  Snapshot snapshot;
+  const auto size = boost::filesystem::file_size(file);
+  mt::Check::isTrue(size == NUM_OPERATIONS * (3 + NUM_BUCKETS) * 8 + 2 * 8,
+                    "Unexpected size of metrics file %s", file.c_str());
+  const auto stream = mt::fopen(file, "r");
+  for (auto& histogram : snapshot.histograms) {
+    mt::fread(stream.get(), &histogram.count, sizeof histogram.count);
+    mt::fread(stream.get(), &histogram.sum, sizeof histogram.sum);
+    mt::fread(stream.get(), &histogram.max, sizeof histogram.max);
+    mt::fread(stream.get(), histogram.buckets.data(),
+              histogram.buckets.size() * sizeof histogram.buckets[0]);
+  }
+  mt::fread(stream.get(), &snapshot.bytes_read, sizeof snapshot.bytes_read);
+  mt::fread(stream.get(), &snapshot.bytes_written,
+            sizeof snapshot.bytes_written);
+  return snapshot;
+}
+
+void Metrics::Snapshot::writeToFile(const boost::filesystem::path& file) const {
+  const auto stream = mt::fopen(file, "w");
+  for (const auto& histogram : histograms) {
+    mt::fwrite(stream.get(), &histogram.count, sizeof histogram.count);
+    mt::fwrite(stream.get(), &histogram.sum, sizeof histogram.sum);
+    mt::fwrite(stream.get(), &histogram.max, sizeof histogram.max);
+    mt::fwrite(stream.get(), histogram.buckets.data(),
+               histogram.buckets.size() * sizeof histogram.buckets[0]);
+  }
+  mt::fwrite(stream.get(), &bytes_read, sizeof bytes_read);
+  mt::fwrite(stream.get(), &bytes_written, sizeof bytes_written);
+}
+
+Metrics::Metrics() : slots_(new Slot[NUM_SLOTS]) {
+  for (size_t i = 0; i != NUM_SLOTS; ++i) {
+    auto& slot = slots_[i];
+    for (auto& counts : slot.counts) {
+      counts.count = 0;
+      counts.sum = 0;
+      counts.max = 0;
+      for (auto& bucket : counts.buckets) {
+        bucket = 0;
+      }
+    }
+    slot.bytes_read = 0;
+    slot.bytes_written = 0;
+  }
+}
+
+void Metrics::record(Operation operation, uint64_t nanoseconds) {
+  auto& counts = getSlot().counts[static_cast<size_t>(operation)];
+  counts.count.fetch_add(1, std::memory_order_relaxed);
+  counts.sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+  counts.buckets[getBucketIndex(nanoseconds)].fetch_add(
+      1, std::memory_order_relaxed);
+  auto max = counts.max.load(std::memory_order_relaxed);
+  while (nanoseconds > max &&
+         !counts.max.compare_exchange_weak(max, nanoseconds,
+                                           std::memory_order_relaxed)) {
+  }
+}
+
+Metrics::Snapshot Metrics::getSnapshot() const {
+  Snapshot snapshot;
+  for (size_t i = 0; i != NUM_SLOTS; ++i) {
+    const auto& slot = slots_[i];
+    for (size_t j = 0; j != NUM_OPERATIONS; ++j) {
+      const auto& counts = slot.counts[j];
+      auto& histogram = snapshot.histograms[j];
+      for (size_t k = 0; k != NUM_BUCKETS; ++k) {
+        histogram.buckets[k] += counts.buckets[k].load();
+      }
+      histogram.count += counts.count.load();
+      histogram.sum += counts.sum.load();
+      histogram.max = mt::max(histogram.max, counts.max.load());
+    }
+    snapshot.bytes_read += slot.bytes_read.load();
+    snapshot.bytes_written += slot.bytes_written.load();
+  }
+  return snapshot;
+}
+// The counters of a slot are not read at once, so that a snapshot taken
+// during updates may count a value in `count` but not in its bucket.
+
+Metrics::Slot& Metrics::getSlot() { return slots_[getSlotIndex(NUM_SLOTS)]; }
+
+}  // namespace internal
+}  // namespace multimap
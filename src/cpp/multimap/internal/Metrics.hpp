@@ -0,0 +1,186 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_METRICS_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_METRICS_HPP_INCLUDED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/filesystem/path.hpp>
+#include "multimap/thirdparty/mt/mt.hpp"
+
+namespace multimap {
+namespace internal {
+
+class Metrics : public mt::Resource {
+  // Records the latency of operations in histograms and counts bytes read
+  // and written.  Updates go to one of several slots chosen by the calling
+  // thread, so that threads rarely write to the same cache lines, and are
+  // aggregated when a snapshot is taken.  Objects of this class are
+  // thread-safe.
+  //
+  // Latencies are measured in nanoseconds and counted in buckets in the
+  // manner of HDR histograms: each power of two is divided into
+  // `NUM_SUB_BUCKETS` equally sized buckets, so that any quantile is
+  // reported with a relative error of at most 1 / NUM_SUB_BUCKETS.
+
+ public:
+  enum class Operation {
+    PUT,
+    WRITE,
+    GET,
+    GET_MANY,
+    CONTAINS,
+    REMOVE,
+    REPLACE,
+    LOCK_WAIT,
+    STORE_FLUSH,
+    STORE_REMAP,
+    NUM_OPERATIONS
+  };
+  // `WRITE` is the application of a `WriteBatch`.  `LOCK_WAIT` is the time
+  // that updates wait for the lock of a partition shard, which is only
+  // measured if the lock is not available right away.  `STORE_FLUSH` and
+  // `STORE_REMAP` are writing the buffer of a store to its data file and
+  // mapping the grown file respectively.
+
+  static const size_t NUM_OPERATIONS =
+      static_cast<size_t>(Operation::NUM_OPERATIONS);
+
+  static const size_t NUM_SUB_BUCKETS_LOG2 = 3;
+  static const size_t NUM_SUB_BUCKETS = 1 << NUM_SUB_BUCKETS_LOG2;
+  static const size_t NUM_BUCKETS =
+      (64 - NUM_SUB_BUCKETS_LOG2 + 1) * NUM_SUB_BUCKETS;
+
+  static size_t getBucketIndex(uint64_t value);
+
+  static uint64_t getBucketUpperBound(size_t index);
+  // Returns the largest value that is counted in the bucket.
+
+  struct Histogram {
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    std::vector<uint64_t> buckets;
+
+    Histogram() : buckets(NUM_BUCKETS) {}
+
+    uint64_t mean() const { return count ? sum / count : 0; }
+
+    uint64_t quantile(double q) const;
+    // Returns an upper bound of the value below which a fraction `q` of
+    // the values lies, e.g. `quantile(0.99)` for the 99th percentile.
+  };
+
+  struct Snapshot {
+    Histogram histograms[NUM_OPERATIONS];
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+    // Bytes of blocks read from and written to the data files.
+
+    const Histogram& get(Operation operation) const {
+      return histograms[static_cast<size_t>(operation)];
+    }
+
+    static const std::vector<std::string>& names();
+
+    std::vector<uint64_t> toVector() const;
+    // Returns the count and the mean, 50th, 90th, 99th percentile, and
+    // maximum latency of each operation, followed by the byte counters, in
+    // the order of `names()`.
+
+    static Snapshot readFromFile(const boost::filesystem::path& file);
+
+    void writeToFile(const boost::filesystem::path& file) const;
+    // The file contains the buckets of all histograms, so that quantiles
+    // can still be computed after reading it.
+  };
+
+  class Timer : public mt::Resource {
+    // Records the time from construction to destruction for `operation`.
+    // Does nothing if `metrics` is null.
+
+   public:
+    Timer(Metrics* metrics, Operation operation)
+        : metrics_(metrics), operation_(operation) {
+      if (metrics_) start_ = std::chrono::steady_clock::now();
+    }
+
+    ~Timer() {
+      if (metrics_) metrics_->record(operation_, start_);
+    }
+
+   private:
+    Metrics* metrics_;
+    Operation operation_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  Metrics();
+
+  void record(Operation operation, uint64_t nanoseconds);
+
+  void record(Operation operation,
+              std::chrono::steady_clock::time_point start) {
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    record(operation,
+           std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+               .count());
+  }
+
+  void addBytesRead(uint64_t num_bytes) {
+    getSlot().bytes_read.fetch_add(num_bytes, std::memory_order_relaxed);
+  }
+
+  void addBytesWritten(uint64_t num_bytes) {
+    getSlot().bytes_written.fetch_add(num_bytes, std::memory_order_relaxed);
+  }
+
+  Snapshot getSnapshot() const;
+
+ private:
+  static const size_t NUM_SLOTS = 16;
+
+  struct Slot {
+    struct Counts {
+      std::atomic<uint64_t> count;
+      std::atomic<uint64_t> sum;
+      std::atomic<uint64_t> max;
+      std::atomic<uint64_t> buckets[NUM_BUCKETS];
+    };
+
+    Counts counts[NUM_OPERATIONS];
+    std::atomic<uint64_t> bytes_read;
+    std::atomic<uint64_t> bytes_written;
+
+    char padding[64];
+    // Avoids false sharing between threads mapped to adjacent slots.
+  };
+
+  Slot& getSlot();
+
+  std::unique_ptr<Slot[]> slots_;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_METRICS_HPP_INCLUDED
@@ -0,0 +1,120 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <limits>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/internal/Metrics.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+using testing::Ge;
+using testing::Le;
+
+TEST(MetricsTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<Metrics>::value);
+  ASSERT_FALSE(std::is_copy_assignable<Metrics>::value);
+}
+
+TEST(MetricsTest, BucketsCoverAllValuesWithBoundedRelativeError) {
+  size_t previous_index = 0;
+  for (uint64_t value = 0; value != 100000; ++value) {
+    const auto index = Metrics::getBucketIndex(value);
+    ASSERT_THAT(index, Ge(previous_index));
+    ASSERT_THAT(Metrics::getBucketUpperBound(index), Ge(value));
+    ASSERT_THAT(Metrics::getBucketUpperBound(index),
+                Le(value + value / Metrics::NUM_SUB_BUCKETS));
+    previous_index = index;
+  }
+  const auto max_value = std::numeric_limits<uint64_t>::max();
+  ASSERT_THAT(Metrics::getBucketIndex(max_value), Eq(Metrics::NUM_BUCKETS - 1));
+  ASSERT_THAT(Metrics::getBucketUpperBound(Metrics::NUM_BUCKETS - 1),
+              Eq(max_value));
+}
+
+TEST(MetricsTest, SnapshotIsEmptyInitially) {
+  Metrics metrics;
+  const auto snapshot = metrics.getSnapshot();
+  for (const auto value : snapshot.toVector()) {
+    ASSERT_THAT(value, Eq(0));
+  }
+  ASSERT_THAT(snapshot.toVector().size(),
+              Eq(Metrics::Snapshot::names().size()));
+}
+
+TEST(MetricsTest, SnapshotAggregatesRecordsOfAllThreads) {
+  Metrics metrics;
+  std::vector<std::thread> threads;
+  for (int i = 0; i != 4; ++i) {
+    threads.emplace_back([&metrics] {
+      for (uint64_t value = 1; value <= 1000; ++value) {
+        metrics.record(Metrics::Operation::GET, value);
+      }
+      metrics.addBytesRead(10);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const auto snapshot = metrics.getSnapshot();
+  const auto& histogram = snapshot.get(Metrics::Operation::GET);
+  ASSERT_THAT(histogram.count, Eq(4000));
+  ASSERT_THAT(histogram.mean(), Eq(500));
+  ASSERT_THAT(histogram.max, Eq(1000));
+  ASSERT_THAT(histogram.quantile(0.5), Ge(500));
+  ASSERT_THAT(histogram.quantile(0.5), Le(500 + 500 / 8));
+  ASSERT_THAT(histogram.quantile(0.99), Ge(990));
+  ASSERT_THAT(histogram.quantile(1), Eq(1000));
+  ASSERT_THAT(snapshot.get(Metrics::Operation::PUT).count, Eq(0));
+  ASSERT_THAT(snapshot.bytes_read, Eq(40));
+}
+
+TEST(MetricsTest, TimerRecordsOneValueAndIgnoresNullMetrics) {
+  Metrics metrics;
+  {
+    const Metrics::Timer timer(&metrics, Metrics::Operation::PUT);
+    const Metrics::Timer ignored(nullptr, Metrics::Operation::PUT);
+  }
+  ASSERT_THAT(metrics.getSnapshot().get(Metrics::Operation::PUT).count,
+              Eq(1));
+}
+
+TEST(MetricsTest, WriteToFileThenReadFromFileYieldsSameSnapshot) {
+  Metrics metrics;
+  for (uint64_t value = 0; value != 100; ++value) {
+    metrics.record(Metrics::Operation::REMOVE, value * value);
+  }
+  metrics.addBytesWritten(123);
+  const auto file = boost::filesystem::temp_directory_path() /
+                    boost::filesystem::unique_path();
+  metrics.getSnapshot().writeToFile(file);
+  const auto snapshot = Metrics::Snapshot::readFromFile(file);
+  boost::filesystem::remove(file);
+  ASSERT_THAT(snapshot.toVector(), Eq(metrics.getSnapshot().toVector()));
+  const auto& buckets = snapshot.get(Metrics::Operation::REMOVE).buckets;
+  ASSERT_THAT(buckets, Eq(metrics.getSnapshot()
+                              .get(Metrics::Operation::REMOVE)
+                              .buckets));
+}
+
+}  // namespace internal
+}  // namespace multimap
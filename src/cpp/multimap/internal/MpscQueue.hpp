@@ -0,0 +1,123 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_MPSC_QUEUE_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_MPSC_QUEUE_HPP_INCLUDED
+
+#include <atomic>
+#include <memory>
+#include "multimap/thirdparty/mt/mt.hpp"
+
+namespace multimap {
+namespace internal {
+
+template <typename T>
+class MpscQueue : public mt::Resource {
+  // A bounded FIFO queue for any number of producer threads and exactly one
+  // consumer thread.  Each slot of the ring buffer has a sequence number
+  // that tells whether it is free or holds an element of the current round,
+  // so that producers claim slots by advancing the tail index via
+  // compare-and-swap without taking locks.  Elements are filled and consumed
+  // in place and stay in their slots, so that memory they own, e.g. the
+  // capacity of a string, is reused by the next round.  Waiting for space
+  // or elements is up to the caller.
+
+ public:
+  explicit MpscQueue(size_t capacity)
+      : slots_(new Slot[capacity]), mask_(capacity - 1) {
+    MT_REQUIRE_NOT_ZERO(capacity);
+    MT_REQUIRE_TRUE(mt::isPowerOfTwo(capacity));
+    for (size_t i = 0; i != capacity; ++i) {
+      slots_[i].sequence = i;
+    }
+  }
+
+  template <typename Procedure>
+  bool tryPush(Procedure fill) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    while (true) {
+      auto& slot = slots_[tail & mask_];
+      const auto sequence = slot.sequence.load(std::memory_order_acquire);
+      if (sequence == tail) {
+        if (tail_.compare_exchange_weak(tail, tail + 1,
+                                        std::memory_order_relaxed)) {
+          fill(&slot.element);
+          slot.sequence.store(tail + 1, std::memory_order_release);
+          return true;
+        }
+        // The failed exchange has loaded the current tail.
+      } else if (sequence < tail) {
+        return false;  // The slot still holds an element of the last round.
+      } else {
+        tail = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+  // Claims the next slot and calls `fill(T*)` with its element unless the
+  // queue is full.  `fill` must not throw, since the consumer waits for the
+  // claimed slot.  Thread-safe.
+
+  template <typename Procedure>
+  bool tryPop(Procedure consume) {
+    auto& slot = slots_[head_ & mask_];
+    if (slot.sequence.load(std::memory_order_acquire) != head_ + 1) {
+      return false;
+    }
+    consume(&slot.element);
+    slot.sequence.store(head_ + mask_ + 1, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+  // Calls `consume(T*)` with the oldest element unless the queue is empty.
+  // The element is left in the slot as `consume` leaves it.  Must only be
+  // called by the consumer thread.
+
+  bool empty() const {
+    return slots_[head_ & mask_].sequence.load(std::memory_order_acquire) !=
+           head_ + 1;
+  }
+  // Must only be called by the consumer thread.
+
+  uint64_t getNumPushes() const { return tail_.load(); }
+  // Returns the number of elements pushed so far, including those whose
+  // `fill` has not returned yet.  Elements are popped in the order they
+  // were counted.  Thread-safe.
+
+  size_t capacity() const { return mask_ + 1; }
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> sequence;
+    T element;
+  };
+
+  std::unique_ptr<Slot[]> slots_;
+  const uint64_t mask_;
+
+  uint64_t head_ = 0;
+  // Only accessed by the consumer thread.
+
+  char padding_[64 - sizeof(uint64_t)];
+  std::atomic<uint64_t> tail_{0};
+  // Written by producers, so it is kept in a different cache line than the
+  // index of the consumer.
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_MPSC_QUEUE_HPP_INCLUDED
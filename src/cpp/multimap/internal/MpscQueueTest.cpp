@@ -0,0 +1,102 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "gmock/gmock.h"
+#include "multimap/internal/MpscQueue.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+
+TEST(MpscQueueTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<MpscQueue<int> >::value);
+  ASSERT_FALSE(std::is_copy_assignable<MpscQueue<int> >::value);
+}
+
+TEST(MpscQueueTest, PushFailsIfFullAndPopFailsIfEmpty) {
+  MpscQueue<int> queue(4);
+  ASSERT_THAT(queue.capacity(), Eq(4));
+  int element = 0;
+  const auto pop = [&element](int* slot) { element = *slot; };
+  ASSERT_TRUE(queue.empty());
+  ASSERT_FALSE(queue.tryPop(pop));
+  for (int round = 0; round != 10; ++round) {
+    for (int i = 1; i != 5; ++i) {
+      ASSERT_TRUE(queue.tryPush([i](int* slot) { *slot = i; }));
+    }
+    ASSERT_FALSE(queue.tryPush([](int* slot) { *slot = 5; }));
+    ASSERT_FALSE(queue.empty());
+    for (int expected = 1; expected != 5; ++expected) {
+      ASSERT_TRUE(queue.tryPop(pop));
+      ASSERT_THAT(element, Eq(expected));
+    }
+    ASSERT_FALSE(queue.tryPop(pop));
+    ASSERT_THAT(queue.getNumPushes(), Eq(4 * (round + 1)));
+  }
+}
+
+TEST(MpscQueueTest, SlotsKeepTheirElementsForReuse) {
+  MpscQueue<std::string> queue(1);
+  ASSERT_TRUE(queue.tryPush([](std::string* slot) { slot->assign(100, 'x'); }));
+  ASSERT_TRUE(queue.tryPop([](std::string* slot) { slot->clear(); }));
+  ASSERT_TRUE(queue.tryPush([](std::string* slot) {
+    ASSERT_TRUE(slot->empty());
+    ASSERT_THAT(slot->capacity(), testing::Ge(100));
+  }));
+}
+
+TEST(MpscQueueTest, ConsumerReceivesElementsOfEachProducerInOrder) {
+  const int num_producers = 4;
+  const int num_elements = 200000;
+  MpscQueue<std::pair<int, int> > queue(64);
+  std::vector<std::thread> producers;
+  for (int p = 0; p != num_producers; ++p) {
+    producers.emplace_back([&queue, p] {
+      for (int i = 0; i != num_elements; ++i) {
+        const auto fill = [p, i](std::pair<int, int>* slot) {
+          *slot = std::make_pair(p, i);
+        };
+        while (!queue.tryPush(fill)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  std::vector<int> next(num_producers, 0);
+  std::pair<int, int> element;
+  for (int i = 0; i != num_producers * num_elements; ++i) {
+    while (!queue.tryPop(
+        [&element](std::pair<int, int>* slot) { element = *slot; })) {
+      std::this_thread::yield();
+    }
+    ASSERT_THAT(element.second, Eq(next[element.first]++));
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  ASSERT_TRUE(queue.empty());
+  ASSERT_THAT(next, testing::Each(Eq(num_elements)));
+}
+
+}  // namespace internal
+}  // namespace multimap
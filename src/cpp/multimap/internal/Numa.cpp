@@ -0,0 +1,100 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/Numa.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <boost/filesystem/operations.hpp>
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+std::string readFirstLine(const std::string& filename) {
+  std::ifstream input(filename);
+  std::string line;
+  std::getline(input, line);
+  return line;
+}
+
+}  // namespace
+
+std::vector<int> Numa::getNodes() {
+  auto nodes = parseList(readFirstLine("/sys/devices/system/node/online"));
+  if (nodes.empty()) nodes.push_back(0);
+  return nodes;
+}
+
+std::vector<int> Numa::getCpusOfNode(int node) {
+  return parseList(readFirstLine("/sys/devices/system/node/node" +
+                                 std::to_string(node) + "/cpulist"));
+}
+
+bool Numa::bindCurrentThreadToNode(int node) {
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+  const auto cpus = getCpusOfNode(node);
+  if (cpus.empty() || node < 0 || node >= 64) return false;
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (const auto cpu : cpus) {
+    if (cpu < CPU_SETSIZE) CPU_SET(cpu, &cpu_set);
+  }
+  if (sched_setaffinity(0, sizeof cpu_set, &cpu_set) != 0) return false;
+  const int MPOL_PREFERRED = 1;
+  const unsigned long node_mask = 1UL << node;
+  syscall(SYS_set_mempolicy, MPOL_PREFERRED, &node_mask,
+          sizeof node_mask * 8);
+  // Failing to set the policy, e.g. in a container that forbids it, still
+  // leaves first-touch allocation, which follows the CPU affinity.
+  return true;
+#else
+  (void)node;
+  return false;
+#endif
+}
+
+std::vector<int> Numa::parseList(const std::string& list) {
+  std::vector<int> result;
+  std::istringstream input(list);
+  std::string range;
+  while (std::getline(input, range, ',')) {
+    const auto dash = range.find('-');
+    try {
+      const auto first = std::stoi(range.substr(0, dash));
+      const auto last = (dash == std::string::npos)
+                            ? first
+                            : std::stoi(range.substr(dash + 1));
+      for (auto i = first; i <= last; ++i) {
+        result.push_back(i);
+      }
+    } catch (const std::exception&) {
+      return std::vector<int>();
+    }
+  }
+  return result;
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,53 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_NUMA_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_NUMA_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+
+namespace multimap {
+namespace internal {
+
+struct Numa {
+  // Access to the NUMA topology of the machine as reported by Linux sysfs,
+  // without depending on libnuma.  On other systems, or if sysfs is not
+  // available, the machine is treated as a single node.
+
+  static std::vector<int> getNodes();
+  // Returns the ids of all online nodes in ascending order, at least one.
+
+  static std::vector<int> getCpusOfNode(int node);
+  // Returns the ids of the CPUs of `node`, which may be empty.
+
+  static bool bindCurrentThreadToNode(int node);
+  // Restricts the calling thread to the CPUs of `node` and makes it prefer
+  // memory of `node` for its allocations, so that memory it touches first
+  // is node-local.  Returns `false` if this is not supported, in which case
+  // the thread is left unchanged.
+
+  static std::vector<int> parseList(const std::string& list);
+  // Parses a list such as "0-3,8,10-11" as used by sysfs.
+
+  Numa() = delete;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_NUMA_HPP_INCLUDED
@@ -0,0 +1,55 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <vector>
+#include "gmock/gmock.h"
+#include "multimap/internal/Numa.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+using testing::ElementsAre;
+using testing::IsEmpty;
+using testing::Not;
+
+TEST(NumaTest, ParseListReadsSinglesAndRanges) {
+  ASSERT_THAT(Numa::parseList("0"), ElementsAre(0));
+  ASSERT_THAT(Numa::parseList("0-3"), ElementsAre(0, 1, 2, 3));
+  ASSERT_THAT(Numa::parseList("0-1,4,6-7"), ElementsAre(0, 1, 4, 6, 7));
+}
+
+TEST(NumaTest, ParseListOfEmptyOrMalformedInputIsEmpty) {
+  ASSERT_THAT(Numa::parseList(""), IsEmpty());
+  ASSERT_THAT(Numa::parseList("x"), IsEmpty());
+  ASSERT_THAT(Numa::parseList("0,a-2"), IsEmpty());
+}
+
+TEST(NumaTest, GetNodesReturnsAtLeastOneSortedNode) {
+  const auto nodes = Numa::getNodes();
+  ASSERT_THAT(nodes, Not(IsEmpty()));
+  ASSERT_TRUE(std::is_sorted(nodes.begin(), nodes.end()));
+}
+
+TEST(NumaTest, BindingToUnknownNodeFails) {
+  ASSERT_FALSE(Numa::bindCurrentThreadToNode(-1));
+  ASSERT_FALSE(Numa::bindCurrentThreadToNode(1 << 20));
+}
+
+}  // namespace internal
+}  // namespace multimap
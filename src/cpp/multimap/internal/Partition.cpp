@@ -17,7 +17,13 @@
 
 #include "multimap/internal/Partition.hpp"
 
+#include <fcntl.h>
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstring>
+#include <random>
+#include <unordered_map>
 #include <boost/filesystem/operations.hpp>
 #include "multimap/internal/Base64.hpp"
 
@@ -27,6 +33,134 @@ namespace internal {
 const char* Partition::ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION =
     "Attempt to modify read-only partition";
 
+const size_t Partition::NUM_SHARDS_LOG2;
+const size_t Partition::NUM_SHARDS;
+const size_t Partition::NUM_WAL_MUTEXES;
+const uint32_t Partition::DELTA_BATCH_END;
+const size_t Partition::MAX_NUM_SPILL_FILES;
+
+namespace {
+
+const char* NEW_FILE_SUFFIX = ".new";
+
+class Stopwatch {
+ public:
+  Stopwatch() : start_(std::chrono::steady_clock::now()), lap_(start_) {}
+
+  uint64_t lap() {
+    const auto now = std::chrono::steady_clock::now();
+    const auto elapsed = now - lap_;
+    lap_ = now;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+        .count();
+  }
+  // Returns the nanoseconds since the previous call, or since construction.
+
+  uint64_t total() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now() - start_)
+        .count();
+  }
+
+ private:
+  const std::chrono::steady_clock::time_point start_;
+  std::chrono::steady_clock::time_point lap_;
+};
+
+void sync(const std::string& file) {
+  const auto fd = mt::open(file, O_RDONLY);
+  mt::fsync(fd.get());
+}
+
+class MappedKeysFile : public mt::Resource {
+  // Maps a keys file for a single sequential scan, which replaces several
+  // small reads per key with page faults the kernel can read ahead.
+
+ public:
+  explicit MappedKeysFile(const std::string& file)
+      : file_(file), size_(boost::filesystem::file_size(file)) {
+    if (size_ != 0) {
+      const auto fd = mt::open(file, O_RDONLY);
+      void* data =
+          mt::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+      ::madvise(data, size_, MADV_SEQUENTIAL);
+      data_ = static_cast<const char*>(data);
+    }
+    position_ = data_;
+  }
+
+  ~MappedKeysFile() {
+    if (data_) mt::munmap(const_cast<char*>(data_), size_);
+  }
+
+  const char* peek(uint64_t nbytes) const {
+    mt::Check::isTrue(nbytes <= size_ - (position_ - data_),
+                      "Keys file '%s' is truncated", file_.c_str());
+    return position_;
+  }
+  // Returns the current position, which must be followed by at least
+  // `nbytes` bytes.
+
+  const char* read(uint64_t nbytes) {
+    const auto data = peek(nbytes);
+    position_ += nbytes;
+    return data;
+  }
+
+ private:
+  const std::string file_;
+  const char* data_ = nullptr;
+  const char* position_ = nullptr;
+  uint64_t size_ = 0;
+};
+
+std::vector<uint32_t> readBlockIdsFromFile(const std::string& file) {
+  const auto stream = mt::fopen(file, "r");
+  return UintVector::readFromStream(stream.get()).unpack();
+}
+
+void writeBlockIdsToFile(const std::vector<uint32_t>& ids,
+                         const std::string& file) {
+  UintVector vector;
+  for (const auto id : ids) {
+    const auto added = vector.add(id);
+    MT_ASSERT_TRUE(added);
+  }
+  const auto stream = mt::fopen(file, "w");
+  vector.writeToStream(stream.get());
+}
+
+void addToStats(const Bytes& key, const List::Stats& list_stats,
+                Stats* stats) {
+  stats->num_values_total += list_stats.num_values_total;
+  stats->num_values_valid += list_stats.num_values_valid();
+  const auto list_size = list_stats.num_values_valid();
+  if (list_size != 0) {
+    ++stats->num_keys_valid;
+    stats->key_size_avg += key.size();
+    stats->key_size_max = mt::max(stats->key_size_max, key.size());
+    stats->key_size_min = stats->key_size_min
+                              ? mt::min(stats->key_size_min, key.size())
+                              : key.size();
+    stats->list_size_avg += list_size;
+    stats->list_size_max = mt::max(stats->list_size_max, list_size);
+    stats->list_size_min = stats->list_size_min
+                               ? mt::min(stats->list_size_min, list_size)
+                               : list_size;
+  }
+}
+// Accumulates the stats of a list.  Averages are summed up until
+// `averageStats()` is called.
+
+void averageStats(Stats* stats) {
+  if (stats->num_keys_valid) {
+    stats->key_size_avg /= stats->num_keys_valid;
+    stats->list_size_avg /= stats->num_keys_valid;
+  }
+}
+
+}  // namespace
+
 uint32_t Partition::Limits::maxKeySize() { return Varint::Limits::MAX_N4; }
 
 uint32_t Partition::Limits::maxValueSize() {
@@ -38,127 +172,1092 @@ Partition::Partition(const boost::filesystem::path& prefix)
 
 Partition::Partition(const boost::filesystem::path& prefix,
                      const Options& options)
-    : prefix_(prefix) {
+    : arena_(Arena::DEFAULT_CHUNK_SIZE, true),
+      metrics_(options.metrics),
+      prefix_(prefix),
+      track_tail_blocks_(options.track_tail_blocks),
+      max_values_per_key_(options.max_values_per_key),
+      sorted_(options.sorted),
+      key_hash_(options.key_hash),
+      bloom_filter_false_positive_rate_(
+          options.bloom_filter_false_positive_rate),
+      durability_(options.durability),
+      on_close_(options.on_close) {
+  Stopwatch stopwatch;
+  Timings timings;
+  // Keys and tail blocks are allocated by concurrent writers.
   Store::Options store_options;
   store_options.readonly = options.readonly;
   store_options.block_size = options.block_size;
   store_options.buffer_size = options.buffer_size;
+  store_options.background_flush = options.background_flush;
+  store_options.num_write_lanes = options.num_write_lanes;
+  store_options.durability = options.durability;
+  store_options.compress = options.compress;
+  store_options.front_coding = options.front_coding;
+  store_options.populate = options.populate;
+  store_options.huge_pages = options.huge_pages;
+  store_options.lock_in_memory = options.lock_in_memory;
+  store_options.direct_io = options.direct_io;
+  store_options.max_read_ahead = options.max_read_ahead;
+  store_options.max_extent_size = options.max_extent_size;
+  store_options.checksums = options.checksums;
+  store_options.block_cache = options.block_cache;
+  store_options.block_cache_id = options.block_cache_id;
+  store_options.metrics = options.metrics;
+  store_options.io_limiter = options.io_limiter;
+  const auto wal_filename = getNameOfWalFile(prefix.string());
+  const auto has_wal = boost::filesystem::is_regular_file(wal_filename);
+  mt::Check::isFalse(has_wal && options.readonly,
+                     "Partition '%s' has a write-ahead log that must be "
+                     "recovered by opening it in writable mode",
+                     prefix.c_str());
+  completeCheckpoint(prefix.string(), has_wal);
+  if (!options.readonly) {
+    // Spilled lists are also in the keys file or in the delta.
+    removeSpillFiles(prefix);
+  }
+  const auto delta_filename = getNameOfDeltaFile(prefix.string());
+  const auto has_delta = boost::filesystem::is_regular_file(delta_filename) &&
+                         boost::filesystem::file_size(delta_filename) != 0;
   const auto stats_filename = getNameOfStatsFile(prefix.string());
+  stopwatch.lap();
   if (boost::filesystem::is_regular_file(stats_filename)) {
     stats_ = Stats::readFromFile(stats_filename);
     store_options.block_size = stats_.block_size;
     const auto keys_filename = getNameOfKeysFile(prefix.string());
-    const auto keys_input = mt::fopen(keys_filename, "r");
-    for (size_t i = 0; i != stats_.num_keys_valid; ++i) {
-      auto key = readBytesFromStream(
-          keys_input.get(), [this](int size) { return arena_.allocate(size); });
-      auto list = List::readFromStream(keys_input.get());
-      stats_.num_values_total -= list->getStatsUnlocked().num_values_total;
-      stats_.num_values_valid -= list->getStatsUnlocked().num_values_valid();
-      map_.emplace(key, std::move(list));
-    }
-
-    // Reset stats, but preserve number of total and valid values.
-    Stats stats;
-    stats.num_values_total = stats_.num_values_total;
-    stats.num_values_valid = stats_.num_values_valid;
-    stats_ = stats;
+    if (!has_delta) {
+      // Lists of the delta may have changed in any way.
+      value_filter_ =
+          BloomFilter::open(getNameOfValueFilterFile(prefix.string()),
+                            keys_filename, stats_.num_keys_valid);
+    }
+    // Deadlines are attached to lists, which requires all of them in memory.
+    const auto has_deadlines = boost::filesystem::is_regular_file(
+        getNameOfExpiryFile(prefix.string()));
+    if (options.readonly && !has_delta && !has_deadlines) {
+      // If there is an index, keys are resolved lazily and stats_ keeps the
+      // stats of the whole partition, which cannot change in read-only mode.
+      index_ = KeyIndex::open(getNameOfIndexFile(prefix.string()),
+                              keys_filename, stats_.num_keys_valid);
+      if (index_) {
+        filter_ = BloomFilter::open(getNameOfFilterFile(prefix.string()),
+                                    keys_filename, stats_.num_keys_valid);
+      }
+    }
+    if (!index_) {
+      // The file is mapped and parsed in place.  Keys and block ids are
+      // copied into the arena, which avoids small allocations per list.
+      MappedKeysFile keys_input(keys_filename);
+      for (size_t i = 0; i != stats_.num_keys_valid; ++i) {
+        uint32_t size;
+        std::memcpy(&size, keys_input.read(sizeof size), sizeof size);
+        char* key_data = arena_.allocate(size);
+        std::memcpy(key_data, keys_input.read(size), size);
+        const Bytes key(key_data, size);
+        const auto hash = Key::hash(key, key_hash_);
+        const auto list = getShard(hash).map.insert(key, hash);
+
+        const auto header_size = sizeof(List::Stats) + sizeof size;
+        std::memcpy(&size, keys_input.peek(header_size) + sizeof(List::Stats),
+                    sizeof size);
+        // The size of the list's block ids, which follow its stats.
+        keys_input.read(List::readFromBuffer(
+            keys_input.peek(header_size + size), list, &arena_));
+        stats_.num_values_total -= list->getStatsUnlocked().num_values_total;
+        stats_.num_values_valid -= list->getStatsUnlocked().num_values_valid();
+      }
+
+      // Reset stats, but preserve number of total and valid values.
+      Stats stats;
+      stats.num_values_total = stats_.num_values_total;
+      stats.num_values_valid = stats_.num_values_valid;
+      stats_ = stats;
+    }
+    timings.read_keys = stopwatch.lap();
+  }
+  if (has_delta) {
+    // The stats keep counting values that were in lists of the keys file,
+    // so that lists replaced by the delta are accounted for as before.
+    auto max_checkpoint_id = std::numeric_limits<uint64_t>::max();
+    std::vector<char> buffer;
+    Wal::Record record;
+    if (has_wal && Wal::readFirstRecord(wal_filename, &buffer, &record) &&
+        record.type == Wal::RecordType::CHECKPOINT) {
+      // A batch written after the log has been reset for the last time is
+      // incomplete, because the log still covers its updates.
+      max_checkpoint_id = record.checkpoint_id;
+    }
+    const auto num_bytes_valid = forEachDeltaEntry(
+        delta_filename, max_checkpoint_id,
+        [this](const Bytes& key, const char* list) {
+          List::readFromBuffer(list, getListOrCreate(hashKey(key)));
+        },
+        &checkpoint_id_);
+    if (!options.readonly &&
+        num_bytes_valid != boost::filesystem::file_size(delta_filename)) {
+      boost::filesystem::resize_file(delta_filename, num_bytes_valid);
+    }
+    timings.replay_delta = stopwatch.lap();
+  }
+  const auto expiry_filename = getNameOfExpiryFile(prefix.string());
+  if (boost::filesystem::is_regular_file(expiry_filename)) {
+    readDeadlines(expiry_filename);
   }
   store_.reset(new Store(getNameOfValuesFile(prefix.string()), store_options));
+  const auto free_blocks_filename = getNameOfFreeBlocksFile(prefix.string());
+  if (!options.readonly &&
+      boost::filesystem::is_regular_file(free_blocks_filename)) {
+    // The file is written when the partition is closed and removed here,
+    // because reused blocks become part of lists.  After a crash the blocks
+    // are lost, but never handed out twice.
+    store_->reuse(readBlockIdsFromFile(free_blocks_filename));
+    boost::filesystem::remove(free_blocks_filename);
+  }
+  if (has_wal || (options.write_ahead_log && !options.readonly)) {
+    if (has_wal) {
+      stopwatch.lap();
+      replayWal(wal_filename);
+      timings.replay_wal = stopwatch.lap();
+    }
+    Wal::Options wal_options;
+    wal_options.sync = options.sync_write_ahead_log;
+    wal_.reset(new Wal(wal_filename, wal_options));
+    if (!has_wal) {
+      wal_->reset(checkpoint_id_);
+    }
+  }
+  if (options.change_feed && !options.readonly) {
+    feed_.reset(new Wal(getNameOfFeedFile(prefix.string()), Wal::Options()));
+  }
+  if (options.hot_keys != 0) {
+    hot_keys_.reset(
+        new HotKeys(options.hot_keys, options.hot_keys_sample_rate));
+  }
+  warm_up_size_ = options.warm_up_size;
+  if (!index_) {
+    // Lists of the keys file, the delta, and the log are counted once.
+    // From now on, updates maintain the counters.
+    stopwatch.lap();
+    uint64_t num_keys_total = 0;
+    for (const auto& shard : shards_) {
+      for (const auto& entry : shard.map) {
+        counters_.add(entry.second->getStatsUnlocked());
+      }
+      num_keys_total += shard.map.size();
+    }
+    num_keys_total_ = num_keys_total;
+    timings.build_index = stopwatch.lap();
+  }
+  if (options.on_open) {
+    timings.total = stopwatch.total();
+    options.on_open(timings);
+  }
 }
 
 Partition::~Partition() {
-  if (!prefix_.empty() && !isReadOnly()) {
-    const auto keys_file = getNameOfKeysFile(prefix_.string());
-    const auto old_keys_file = keys_file + ".old";
-    if (boost::filesystem::is_regular_file(keys_file)) {
-      boost::filesystem::rename(keys_file, old_keys_file);
+  if (!prefix_.empty() && warm_up_size_ != 0) {
+    try {
+      writeHotBlocks();
+    } catch (std::exception& error) {
+      mt::log() << "Partition could not write hot blocks: " << error.what()
+                << '\n';
     }
+  }
+  if (prefix_.empty() || isReadOnly()) return;
 
-    List::Stats list_stats;
+  Stopwatch stopwatch;
+  Timings timings;
+  const auto sync_files = shouldSyncFiles(true);
+  if (deadlines_changed_) {
+    writeDeadlines(sync_files);
+  }
+  // Lists that are still locked are only saved by a full checkpoint.
+  const auto free_blocks_file = getNameOfFreeBlocksFile(prefix_.string());
+  if (!shouldCompact() && writeDelta(sync_files)) {
+    store_->releaseExtents();
+    const auto free_block_ids = getFreeBlockIds();
+    store_.reset();  // Writes buffered blocks.
+    timings.flush_lists = stopwatch.lap();
+    wal_.reset();
+    boost::filesystem::remove(getNameOfWalFile(prefix_.string()));
+    if (!free_block_ids.empty()) {
+      writeBlockIdsToFile(free_block_ids, free_blocks_file);
+    }
+    removeSpillFiles(prefix_);
+    if (on_close_) {
+      timings.total = stopwatch.total();
+      on_close_(timings);
+    }
+    return;
+  }
+
+  List::Stats list_stats;
+  KeyIndex::Builder index_builder;
+  BloomFilter::Builder filter_builder;
+  const auto keys_file = getNameOfKeysFile(prefix_.string()) + NEW_FILE_SUFFIX;
+  const auto index_file =
+      getNameOfIndexFile(prefix_.string()) + NEW_FILE_SUFFIX;
+  const auto filter_file =
+      getNameOfFilterFile(prefix_.string()) + NEW_FILE_SUFFIX;
+  const auto has_filter = bloom_filter_false_positive_rate_ != 0;
+  const auto stats_file =
+      getNameOfStatsFile(prefix_.string()) + NEW_FILE_SUFFIX;
+  {
     const auto stream = mt::fopen(keys_file, "w");
-    for (const auto& entry : map_) {
-      auto& key = entry.first;
-      auto& list = *entry.second;
-      if (list.tryFlush(store_.get(), &list_stats)) {
-        // Ok, everything is fine.
-      } else {
-        const auto key_as_base64 = Base64::encode(key);
-        mt::log() << "The list with the key " << key_as_base64
-                  << " (Base64) was still locked when shutting down.\n"
-                  << " The last known state of the list has been safed,"
-                  << " but ongoing updates, if any, may be lost.\n";
-        list.flushUnlocked(store_.get(), &list_stats);
-      }
-      stats_.num_values_total += list_stats.num_values_total;
-      stats_.num_values_valid += list_stats.num_values_valid();
-      const auto list_size = list_stats.num_values_valid();
-      if (list_size != 0) {
-        ++stats_.num_keys_valid;
-        stats_.key_size_avg += key.size();
-        stats_.key_size_max = mt::max(stats_.key_size_max, key.size());
-        stats_.key_size_min = stats_.key_size_min
-                                  ? mt::min(stats_.key_size_min, key.size())
-                                  : key.size();
-        stats_.list_size_avg += list_size;
-        stats_.list_size_max = mt::max(stats_.list_size_max, list_size);
-        stats_.list_size_min = stats_.list_size_min
-                                   ? mt::min(stats_.list_size_min, list_size)
-                                   : list_size;
+    const auto write_list = [&](const Bytes& key, const List& list) {
+      addToStats(key, list_stats, &stats_);
+      if (list_stats.num_values_valid() != 0) {
+        const auto hash = Key::hash(key, key_hash_);
+        index_builder.add(hash, mt::ftell(stream.get()));
+        if (has_filter) filter_builder.add(hash);
         writeBytesToStream(key, stream.get());
         list.writeToStream(stream.get());
       }
+    };
+    for (const auto& shard : shards_) {
+      for (const auto& entry : shard.map) {
+        auto& key = entry.first;
+        auto& list = *entry.second;
+        timings.write_keys += stopwatch.lap();
+        if (list.tryFlush(store_.get(), &list_stats, &arena_)) {
+          // Ok, everything is fine.
+        } else {
+          const auto key_as_base64 = Base64::encode(key);
+          mt::log() << "The list with the key " << key_as_base64
+                    << " (Base64) was still locked when shutting down.\n"
+                    << " The last known state of the list has been safed,"
+                    << " but ongoing updates, if any, may be lost.\n";
+          list.flushUnlocked(store_.get(), &list_stats, &arena_);
+        }
+        timings.flush_lists += stopwatch.lap();
+        write_list(key, list);
+      }
     }
-    if (stats_.num_keys_valid) {
-      stats_.key_size_avg /= stats_.num_keys_valid;
-      stats_.list_size_avg /= stats_.num_keys_valid;
+    // Spilled lists are merged into the keys file.
+    forEachSpilledList(true, [&](const Bytes& key, const char* buffer) {
+      List list;
+      List::readFromBuffer(buffer, &list);
+      list_stats = list.getStatsUnlocked();
+      write_list(key, list);
+    });
+    index_builder.writeToFile(index_file, mt::ftell(stream.get()));
+    if (has_filter) {
+      filter_builder.writeToFile(filter_file, stats_.num_keys_valid,
+                                 mt::ftell(stream.get()),
+                                 bloom_filter_false_positive_rate_);
     }
-    stats_.block_size = store_->getBlockSize();
-    stats_.num_blocks = store_->getNumBlocks();
-    stats_.num_keys_total = map_.size();
+  }
+  averageStats(&stats_);
+  stats_.block_size = store_->getBlockSize();
+  stats_.num_blocks = store_->getNumBlocks();
+  stats_.num_keys_total = getNumKeys();
 
-    stats_.writeToFile(getNameOfStatsFile(prefix_.string()));
+  store_->releaseExtents();
+  const auto free_block_ids = getFreeBlockIds();
+  timings.write_keys += stopwatch.lap();
+  store_.reset();  // Writes buffered blocks.
+  timings.flush_lists += stopwatch.lap();
+  if (sync_files) {
+    sync(getNameOfValuesFile(prefix_.string()));
+    sync(keys_file);
+    sync(index_file);
+    if (has_filter) sync(filter_file);
+  }
+  stats_.writeToFile(stats_file);
+  if (sync_files) {
+    sync(stats_file);
+  }
+  wal_.reset();
+  boost::filesystem::remove(getNameOfWalFile(prefix_.string()));
+  completeCheckpoint(prefix_.string(), false);
+  if (!free_block_ids.empty()) {
+    writeBlockIdsToFile(free_block_ids, free_blocks_file);
+  }
+  removeSpillFiles(prefix_);
+  if (on_close_) {
+    timings.write_stats = stopwatch.lap();
+    timings.total = stopwatch.total();
+    on_close_(timings);
+  }
+}
 
-    if (boost::filesystem::is_regular_file(old_keys_file)) {
-      const auto status = boost::filesystem::remove(old_keys_file);
-      MT_ASSERT_TRUE(status);
+Stats Partition::getStats() const {
+  Stats stats = stats_;
+  stats.memory_allocated = arena_.allocated();
+  stats.memory_reserved = arena_.reserved();
+  stats.memory_reusable = arena_.reusable();
+  stats.block_cache_hits = store_->getNumBlockCacheHits();
+  stats.block_cache_misses = store_->getNumBlockCacheMisses();
+  if (index_) return stats;
+
+  List::Stats list_stats;
+  for (const auto& shard : shards_) {
+    ReaderLockGuard<ShardMutex> lock(shard.mutex);
+    for (const auto& entry : shard.map) {
+      if (entry.second->tryGetStats(&list_stats)) {
+        addToStats(entry.first, list_stats, &stats);
+      }
     }
+    stats.num_keys_total += shard.map.size();
   }
+  forEachSpilledList(true, [&](const Bytes& key, const char* list) {
+    addToStats(key, readStatsOfList(list), &stats);
+    stats.num_keys_total++;
+  });
+  averageStats(&stats);
+  stats.block_size = store_->getBlockSize();
+  stats.num_blocks = store_->getNumBlocks();
+  return stats;
 }
 
-Stats Partition::getStats() const {
-  boost::shared_lock<boost::shared_mutex> lock(mutex_);
+Stats Partition::getCurrentStats() const {
   Stats stats = stats_;
+  stats.memory_allocated = arena_.allocated();
+  stats.memory_reserved = arena_.reserved();
+  stats.memory_reusable = arena_.reusable();
+  stats.block_cache_hits = store_->getNumBlockCacheHits();
+  stats.block_cache_misses = store_->getNumBlockCacheMisses();
+  if (index_) return stats;
+
+  const auto num_values_removed =
+      counters_.num_values_removed.load(std::memory_order_relaxed);
+  const auto num_values_total =
+      counters_.num_values_total.load(std::memory_order_relaxed);
+  stats.num_keys_total += num_keys_total_.load(std::memory_order_relaxed);
+  stats.num_keys_valid +=
+      counters_.num_keys_valid.load(std::memory_order_relaxed);
+  stats.num_values_total += num_values_total;
+  stats.num_values_valid += mt::max(num_values_total, num_values_removed) -
+                            num_values_removed;
+  // The counters are not updated at once, so that concurrent updates can be
+  // seen in part.
+  stats.block_size = store_->getBlockSize();
+  stats.num_blocks = store_->getNumBlocks();
+  return stats;
+}
+
+SampledStats Partition::getSampledStats(size_t num_samples) const {
+  SampledStats sampled;
+  auto& stats = sampled.stats;
+  stats = getCurrentStats();
+  if (index_) {
+    sampled.num_samples = stats.num_keys_valid;
+    return sampled;
+  }
+
+  std::vector<size_t> num_indices(NUM_SHARDS);
+  size_t total_num_indices = 0;
+  for (size_t i = 0; i != NUM_SHARDS; ++i) {
+    ReaderLockGuard<ShardMutex> lock(shards_[i].mutex);
+    num_indices[i] = shards_[i].map.getNumIndices();
+    total_num_indices += num_indices[i];
+  }
+  if (total_num_indices == 0) return sampled;
+
+  std::vector<std::vector<size_t> > samples(NUM_SHARDS);
+  std::mt19937_64 random(std::random_device{}());
+  std::uniform_int_distribution<size_t> distribution(0,
+                                                     total_num_indices - 1);
+  for (size_t i = 0; i != num_samples; ++i) {
+    auto index = distribution(random);
+    size_t shard = 0;
+    while (index >= num_indices[shard]) {
+      index -= num_indices[shard++];
+    }
+    samples[shard].push_back(index);
+  }
+
+  double key_size_sum = 0;
+  double key_size_sum_of_squares = 0;
+  double list_size_sum = 0;
+  double list_size_sum_of_squares = 0;
+  Stats sample;
   List::Stats list_stats;
-  for (const auto& entry : map_) {
-    if (entry.second->tryGetStats(&list_stats)) {
-      stats.num_values_total += list_stats.num_values_total;
-      stats.num_values_valid += list_stats.num_values_valid();
-      const auto list_size = list_stats.num_values_valid();
-      if (list_size != 0) {
-        const auto& key = entry.first;
-        stats.num_keys_valid++;
-        stats.key_size_avg += key.size();
-        stats.key_size_max = mt::max(stats.key_size_max, key.size());
-        stats.key_size_min = stats.key_size_min
-                                 ? mt::min(stats.key_size_min, key.size())
-                                 : key.size();
-        stats.list_size_avg += list_size;
-        stats.list_size_max = mt::max(stats.list_size_max, list_size);
-        stats.list_size_min = stats.list_size_min
-                                  ? mt::min(stats.list_size_min, list_size)
-                                  : list_size;
+  for (size_t i = 0; i != NUM_SHARDS; ++i) {
+    if (samples[i].empty()) continue;
+    ReaderLockGuard<ShardMutex> lock(shards_[i].mutex);
+    for (const auto index : samples[i]) {
+      if (index >= shards_[i].map.getNumIndices()) continue;
+      // The shard may have been rebuilt in the meantime.
+      const auto entry = shards_[i].map.getEntry(index);
+      if (!entry.second || !entry.second->tryGetStats(&list_stats)) continue;
+      const double list_size = list_stats.num_values_valid();
+      if (list_size == 0) continue;
+      addToStats(entry.first, list_stats, &sample);
+      key_size_sum += entry.first.size();
+      key_size_sum_of_squares += entry.first.size() * entry.first.size();
+      list_size_sum += list_size;
+      list_size_sum_of_squares += list_size * list_size;
+    }
+  }
+  const auto n = sample.num_keys_valid;
+  sampled.num_samples = n;
+  if (n == 0) return sampled;
+  averageStats(&sample);
+  stats.key_size_avg = sample.key_size_avg;
+  stats.key_size_max = sample.key_size_max;
+  stats.key_size_min = sample.key_size_min;
+  stats.list_size_avg = sample.list_size_avg;
+  stats.list_size_max = sample.list_size_max;
+  stats.list_size_min = sample.list_size_min;
+  if (n > 1) {
+    const auto error = [n](double sum, double sum_of_squares) {
+      const auto variance = (sum_of_squares - sum * sum / n) / (n - 1);
+      return 1.96 * std::sqrt(std::max(0.0, variance) / n);
+    };
+    sampled.key_size_avg_error = error(key_size_sum, key_size_sum_of_squares);
+    sampled.list_size_avg_error =
+        error(list_size_sum, list_size_sum_of_squares);
+  }
+  return sampled;
+}
+
+void Partition::checkpoint() {
+  mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
+  std::lock_guard<std::mutex> lock(checkpoint_mutex_);
+  {
+    // Shard locks are acquired first, because removing keys by predicate
+    // updates lists while holding the lock of the shard.
+    std::vector<ReaderLock<ShardMutex> > shard_locks;
+    shard_locks.reserve(NUM_SHARDS);
+    for (const auto& shard : shards_) {
+      shard_locks.emplace_back(shard.mutex);
+    }
+    WriterLock<boost::shared_mutex> update_lock(checkpoint_update_mutex_,
+                                                boost::defer_lock);
+    if (wal_) update_lock.lock();
+    const auto sync_files = shouldSyncFiles(false);
+    std::vector<uint32_t> released_block_ids;
+    {
+      // Blocks released from now on may belong to lists written before.
+      std::lock_guard<std::mutex> lock(released_block_ids_mutex_);
+      released_block_ids.swap(released_block_ids_);
+    }
+    if (deadlines_changed_.exchange(false)) {
+      writeDeadlines(sync_files);
+    }
+    if (writeDelta(sync_files)) {
+      if (wal_) wal_->reset(checkpoint_id_);
+      store_->reuse(released_block_ids);
+    } else {
+      std::lock_guard<std::mutex> lock(released_block_ids_mutex_);
+      released_block_ids_.insert(released_block_ids_.end(),
+                                 released_block_ids.begin(),
+                                 released_block_ids.end());
+    }
+  }
+  reclaimEmptyLists();
+}
+
+uint64_t Partition::snapshot(const boost::filesystem::path& prefix) {
+  mt::Check::isFalse(isReadOnly(),
+                     "Partition: a read-only partition can be copied as is");
+  std::lock_guard<std::mutex> lock(checkpoint_mutex_);
+  // Shard locks prevent spilled lists from being loaded meanwhile.
+  std::vector<ReaderLock<ShardMutex> > shard_locks;
+  shard_locks.reserve(NUM_SHARDS);
+  for (const auto& shard : shards_) {
+    shard_locks.emplace_back(shard.mutex);
+  }
+  WriterLock<boost::shared_mutex> update_lock(checkpoint_update_mutex_,
+                                              boost::defer_lock);
+  if (wal_) update_lock.lock();
+  update_gate_.close();
+  try {
+    writeSnapshot(prefix);
+  } catch (...) {
+    update_gate_.open();
+    throw;
+  }
+  const auto feed_size = feed_ ? feed_->size() : 0;
+  update_gate_.open();
+  return feed_size;
+}
+
+uint64_t Partition::followChangeFeed(const boost::filesystem::path& feed_file,
+                                     uint64_t offset, uint64_t* num_records) {
+  mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
+  std::lock_guard<std::mutex> lock(follow_mutex_);
+  std::string put_key;
+  std::vector<std::string> put_values;
+  uint64_t num_applied = 0;
+  const auto end_offset = Wal::forEachRecord(
+      feed_file, offset, [&](const Wal::Record& record) {
+        ++num_applied;
+        if (!put_values.empty() &&
+            (record.type != Wal::RecordType::PUT || record.key != put_key)) {
+          applyPuts(put_key, put_values);
+          put_values.clear();
+        }
+        if (record.type == Wal::RecordType::PUT) {
+          // Fields of `record` refer to a buffer that is reused.
+          if (put_values.empty()) put_key = record.key.toString();
+          put_values.push_back(record.value.toString());
+          return;
+        }
+        if (record.type == Wal::RecordType::CHECKPOINT) return;
+        const auto list = getListOrCreate(hashKey(record.key));
+        update(list,
+               [&] {
+                 applyRecord(record, list, &followed_num_marked_, &counters_);
+                 return true;
+               },
+               [&record](Wal* wal) { return wal->appendRecord(record); });
+      });
+  if (!put_values.empty()) {
+    applyPuts(put_key, put_values);
+  }
+  if (num_records) *num_records += num_applied;
+  return end_offset;
+}
+
+void Partition::applyPuts(const Bytes& key,
+                          const std::vector<std::string>& values) {
+  const auto list = getListOrCreate(hashKey(key));
+  const auto has_new_tail_block = update(
+      list,
+      [&] {
+        return list->append(values.begin(), values.end(), store_.get(),
+                            &arena_, &counters_);
+      },
+      [&](Wal* wal) {
+        uint64_t sequence_number = 0;
+        for (const auto& value : values) {
+          sequence_number = wal->appendPut(key, value);
+        }
+        return sequence_number;
+      });
+  if (has_new_tail_block && track_tail_blocks_) {
+    addTailList(list);
+  }
+}
+
+void Partition::warmUp() const {
+  const auto file = getNameOfHotBlocksFile(prefix_.string());
+  if (boost::filesystem::is_regular_file(file)) {
+    store_->prefetch(readBlockIdsFromFile(file));
+  }
+}
+
+void Partition::writeHotBlocks() const {
+  const auto max_num_blocks = warm_up_size_ / store_->getBlockSize();
+  std::vector<uint32_t> block_ids;
+  if (hot_keys_) {
+    const auto hot_keys =
+        hot_keys_->getTop(std::numeric_limits<size_t>::max());
+    for (const auto& entry : hot_keys) {
+      if (block_ids.size() >= max_num_blocks) break;
+      if (const auto list = findList(hashKey(entry.first))) {
+        const auto ids = list->getBlockIdsUnlocked();
+        block_ids.insert(block_ids.end(), ids.begin(), ids.end());
       }
     }
   }
-  if (stats.num_keys_valid) {
-    stats.key_size_avg /= stats.num_keys_valid;
-    stats.list_size_avg /= stats.num_keys_valid;
+  // The lists of the hottest keys come first.
+  const auto cached_ids = store_->getCachedBlockIds();
+  block_ids.insert(block_ids.end(), cached_ids.begin(), cached_ids.end());
+  if (block_ids.size() > max_num_blocks) block_ids.resize(max_num_blocks);
+  std::sort(block_ids.begin(), block_ids.end());
+  block_ids.erase(std::unique(block_ids.begin(), block_ids.end()),
+                  block_ids.end());
+
+  const auto file = getNameOfHotBlocksFile(prefix_.string());
+  const auto new_file = boost::filesystem::unique_path(file + ".%%%%%%%%");
+  // Other processes that have the partition open read-only may close it at
+  // the same time.
+  writeBlockIdsToFile(block_ids, new_file.string());
+  boost::filesystem::rename(new_file, file);
+}
+
+void Partition::writeSnapshot(const boost::filesystem::path& prefix) {
+  const auto p = prefix.string();
+  const std::string outdated_files[] = {
+      getNameOfDeltaFile(p),       getNameOfExpiryFile(p),
+      getNameOfFeedFile(p),        getNameOfFilterFile(p),
+      getNameOfFreeBlocksFile(p),
+      getNameOfValueFilterFile(p), getNameOfWalFile(p)};
+  for (const auto& file : outdated_files) {
+    boost::filesystem::remove(file);
+  }
+  Stats stats;
+  KeyIndex::Builder index_builder;
+  BloomFilter::Builder filter_builder;
+  const auto has_filter = bloom_filter_false_positive_rate_ != 0;
+  {
+    const auto stream = mt::fopen(getNameOfKeysFile(p), "w");
+    mt::AutoCloseFile expiry_stream;
+    const auto write_list = [&](const Bytes& key, const List& list,
+                                uint32_t deadline) {
+      const auto list_stats = list.getStatsUnlocked();
+      addToStats(key, list_stats, &stats);
+      ++stats.num_keys_total;
+      if (list_stats.num_values_valid() == 0) return;
+      const auto hash = Key::hash(key, key_hash_);
+      index_builder.add(hash, mt::ftell(stream.get()));
+      if (has_filter) filter_builder.add(hash);
+      writeBytesToStream(key, stream.get());
+      list.writeToStreamUnlocked(stream.get());
+      if (deadline != 0) {
+        if (!expiry_stream.get()) {
+          expiry_stream = mt::fopen(getNameOfExpiryFile(p), "w");
+        }
+        writeBytesToStream(key, expiry_stream.get());
+        mt::fwrite(expiry_stream.get(), &deadline, sizeof deadline);
+      }
+    };
+    for (const auto& shard : shards_) {
+      for (const auto& entry : shard.map) {
+        const auto& key = entry.first;
+        const auto deadline = entry.second->getDeadline();
+        entry.second->flushAndVisit(store_.get(),
+                                    [&](const List& list) {
+                                      write_list(key, list, deadline);
+                                    },
+                                    &arena_);
+      }
+    }
+    forEachSpilledList(false, [&](const Bytes& key, const char* buffer) {
+      // The shard locks are already held.
+      const auto hash = Key::hash(key, key_hash_);
+      if (getShard(hash).map.find(key, hash)) return;
+      List list;
+      List::readFromBuffer(buffer, &list);
+      write_list(key, list, 0);
+    });
+    index_builder.writeToFile(getNameOfIndexFile(p), mt::ftell(stream.get()));
+    if (has_filter) {
+      filter_builder.writeToFile(getNameOfFilterFile(p), stats.num_keys_valid,
+                                 mt::ftell(stream.get()),
+                                 bloom_filter_false_positive_rate_);
+    }
   }
+  store_->copyTo(getNameOfValuesFile(p));
+  averageStats(&stats);
   stats.block_size = store_->getBlockSize();
   stats.num_blocks = store_->getNumBlocks();
-  stats.num_keys_total = map_.size();
-  return stats;
+  stats.writeToFile(getNameOfStatsFile(p));
+  const auto free_block_ids = getFreeBlockIds();
+  if (!free_block_ids.empty()) {
+    writeBlockIdsToFile(free_block_ids, getNameOfFreeBlocksFile(p));
+  }
+  if (shouldSyncFiles(true)) {
+    sync(getNameOfValuesFile(p));
+    sync(getNameOfKeysFile(p));
+    sync(getNameOfStatsFile(p));
+  }
+}
+
+template <typename Predicate>
+size_t Partition::eraseListsUnlocked(Shard* shard, Predicate predicate) {
+  std::vector<Bytes> keys;
+  std::vector<const List*> lists;
+  shard->map.eraseIf([&](const Bytes& key, List* list) {
+    if (!predicate(key, list)) return false;
+    keys.push_back(key);
+    lists.push_back(list);
+    return true;
+  });
+  if (keys.empty()) return 0;
+  for (const auto& key : keys) {
+    if (!key.empty()) {
+      arena_.deallocate(const_cast<char*>(key.data()), key.size());
+    }
+  }
+  if (track_tail_blocks_) {
+    std::sort(lists.begin(), lists.end());
+    std::lock_guard<std::mutex> tail_lists_lock(tail_lists_mutex_);
+    tail_lists_.erase(
+        std::remove_if(tail_lists_.begin(), tail_lists_.end(),
+                       [&lists](const TailList& tail_list) {
+                         return std::binary_search(lists.begin(), lists.end(),
+                                                   tail_list.list);
+                       }),
+        tail_lists_.end());
+  }
+  // The key order caches may refer to the keys.
+  sorted_keys_.reset();
+  key_directory_.reset();
+  return keys.size();
+}
+
+size_t Partition::reclaimEmptyLists() {
+  if (index_) return 0;
+  size_t num_reclaimed = 0;
+  std::lock_guard<std::mutex> key_order_lock(key_order_mutex_);
+  for (auto& shard : shards_) {
+    const auto lock = lockShardForUpdate(shard);
+    const auto num_erased =
+        eraseListsUnlocked(&shard, [this](const Bytes& key, List* list) {
+          // Otherwise an outdated list would be loaded from a spill file.
+          return !isSpilled(key, Key::hash(key, key_hash_)) &&
+                 list->tryReclaim(&arena_);
+        });
+    num_keys_total_.fetch_sub(num_erased, std::memory_order_relaxed);
+    num_reclaimed += num_erased;
+  }
+  return num_reclaimed;
+}
+
+uint64_t Partition::getMemoryUsage() const {
+  uint64_t memory_usage = arena_.allocated();
+  for (const auto& shard : shards_) {
+    ReaderLockGuard<ShardMutex> lock(shard.mutex);
+    memory_usage += shard.map.getNumBytesInUse();
+  }
+  return memory_usage;
+}
+
+MemoryUsage Partition::getMemoryBreakdown() const {
+  MemoryUsage usage;
+  usage.arena_allocated = arena_.allocated();
+  usage.arena_reserved = arena_.reserved();
+  size_t block_ids = 0;
+  size_t tail_block = 0;
+  for (const auto& shard : shards_) {
+    ReaderLockGuard<ShardMutex> lock(shard.mutex);
+    usage.hash_tables += shard.map.getNumBytesReserved();
+    for (const auto& entry : shard.map) {
+      if (entry.second->tryGetNumBytesInMemory(&block_ids, &tail_block)) {
+        usage.block_ids += block_ids;
+        usage.tail_blocks += tail_block;
+      }
+    }
+  }
+  usage.write_buffer = store_->getBufferSize();
+  usage.mapped_values = store_->getNumBytesMapped();
+  if (index_) usage.mapped_keys += index_->getNumBytesMapped();
+  std::lock_guard<std::mutex> lock(spill_files_mutex_);
+  for (const auto& file : *spill_files_) {
+    usage.mapped_keys += file->index->getNumBytesMapped();
+  }
+  for (const auto& file : retired_spill_files_) {
+    usage.mapped_keys += file->index->getNumBytesMapped();
+  }
+  return usage;
+}
+
+size_t Partition::spillColdLists(uint64_t max_memory_usage) {
+  mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
+  // Lists that are not dirty cannot become so before they are evicted,
+  // because the lists of all unlocked shards may be modified, but not
+  // flushed.
+  std::lock_guard<std::mutex> lock(checkpoint_mutex_);
+  const auto memory_usage = getMemoryUsage();
+  if (memory_usage <= max_memory_usage) return 0;
+  const auto num_bytes_to_free = memory_usage - max_memory_usage;
+  // Whether values were appended is not serialized, but needed to answer
+  // `hasSortedValues()` and to bypass the value filter.
+  const bool keep_appended = sorted_ || value_filter_;
+
+  // Phase 1: The candidates are written while their shards are read-locked.
+  auto file = std::make_shared<SpillFile>();
+  file->filename = getNameOfSpillFile(prefix_.string(), next_spill_file_id_++);
+  std::vector<std::vector<const List*> > lists_by_shard(NUM_SHARDS);
+  uint64_t num_bytes_freed = 0;
+  size_t num_written = 0;
+  {
+    KeyIndex::Builder index_builder;
+    const auto stream = mt::fopen(file->filename, "w");
+    for (size_t s = 0; s != NUM_SHARDS; ++s) {
+      const auto& shard = shards_[s];
+      ReaderLockGuard<ShardMutex> shard_lock(shard.mutex);
+      for (const auto& entry : shard.map) {
+        if (num_bytes_freed >= num_bytes_to_free) break;
+        const auto& key = entry.first;
+        entry.second->tryVisitIfEvictable(keep_appended, [&](const List& list) {
+          index_builder.add(Key::hash(key, key_hash_), mt::ftell(stream.get()));
+          writeBytesToStream(key, stream.get());
+          list.writeToStreamUnlocked(stream.get());
+          num_bytes_freed += key.size() + list.getNumBytesInMemoryUnlocked() +
+                             ListMap::getNumBytesPerEntry();
+          lists_by_shard[s].push_back(entry.second);
+          ++num_written;
+        });
+      }
+    }
+    if (num_written != 0) {
+      index_builder.writeToFile(file->filename + ".index",
+                                mt::ftell(stream.get()));
+    }
+  }
+  if (num_written == 0) {
+    boost::filesystem::remove(file->filename);
+    return 0;
+  }
+  file->index = KeyIndex::open(file->filename + ".index", file->filename);
+  mt::Check::notNull(file->index.get(), "Partition: Cannot open '%s.index'",
+                     file->filename.c_str());
+  size_t num_spill_files = 0;
+  {
+    std::lock_guard<std::mutex> spill_files_lock(spill_files_mutex_);
+    auto files = std::make_shared<SpillFiles>(*spill_files_);
+    files->push_back(file);
+    num_spill_files = files->size();
+    spill_files_ = files;
+  }
+  has_spill_files_.store(true, std::memory_order_release);
+
+  // Phase 2: Lookups find the new file once the lists are evicted.  Lists
+  // that have been modified in the meantime are kept and the outdated copy
+  // is ignored, since lists in memory take precedence.
+  size_t num_evicted = 0;
+  {
+    std::lock_guard<std::mutex> key_order_lock(key_order_mutex_);
+    for (size_t s = 0; s != NUM_SHARDS; ++s) {
+      auto& lists = lists_by_shard[s];
+      if (lists.empty()) continue;
+      std::sort(lists.begin(), lists.end());
+      auto& shard = shards_[s];
+      const auto shard_lock = lockShardForUpdate(shard);
+      const auto num_erased =
+          eraseListsUnlocked(&shard, [&](const Bytes&, List* list) {
+            return std::binary_search(lists.begin(), lists.end(), list) &&
+                   list->tryEvict(&arena_, keep_appended);
+          });
+      // Counted before the shard is unlocked, see `loadSpilledListUnlocked()`.
+      num_spilled_lists_.fetch_add(num_erased, std::memory_order_relaxed);
+      num_evicted += num_erased;
+    }
+  }
+  if (num_spill_files > MAX_NUM_SPILL_FILES) {
+    mergeSpillFiles();
+  }
+  return num_evicted;
+}
+
+uint32_t Partition::removeExpiredLists() {
+  mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
+  const auto now = getCurrentTime();
+  uint32_t num_removed = 0;
+  Deadline deadline;
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(deadlines_mutex_);
+      if (deadlines_.empty() || deadlines_.top().first > now) break;
+      deadline = deadlines_.top();
+      deadlines_.pop();
+    }
+    const auto key = hashKey(deadline.second);
+    const auto list = findList(key);
+    if (list && list->getDeadline() == deadline.first) {
+      clear(key, list);
+      ++num_removed;
+    }
+  }
+  return num_removed;
+}
+
+uint32_t Partition::getCurrentTime() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+size_t Partition::flushColdLists(size_t max_num_tail_blocks) {
+  MT_REQUIRE_TRUE(track_tail_blocks_);
+  std::lock_guard<std::mutex> lock(tail_lists_mutex_);
+  size_t num_flushed = 0;
+  List::Stats list_stats;
+  for (auto num_visits = tail_lists_.size();
+       num_visits != 0 && tail_lists_.size() > max_num_tail_blocks;
+       --num_visits) {
+    auto tail_list = tail_lists_.front();
+    tail_lists_.pop_front();
+    if (!tail_list.list->tryGetStats(&list_stats)) {
+      tail_lists_.push_back(tail_list);  // The list is in use.
+    } else if (list_stats.num_values_total != tail_list.num_values_total) {
+      tail_list.num_values_total = list_stats.num_values_total;
+      tail_lists_.push_back(tail_list);
+    } else if (tail_list.list->tryFlushAndRelease(store_.get(), &arena_)) {
+      ++num_flushed;
+    } else {
+      tail_lists_.push_back(tail_list);
+    }
+  }
+  return num_flushed;
+}
+
+size_t Partition::getNumTailBlocks() const {
+  std::lock_guard<std::mutex> lock(tail_lists_mutex_);
+  return tail_lists_.size();
+}
+
+uint64_t Partition::compactLists(double min_removed_ratio,
+                                 uint64_t max_num_bytes) {
+  mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
+  if (store_->isCompressed()) return 0;
+  std::lock_guard<std::mutex> lock(compaction_mutex_);
+  uint64_t num_bytes = 0;
+  List::Stats list_stats;
+  std::vector<std::string> values;
+  std::vector<uint32_t> block_ids;
+  for (size_t i = 0; i != NUM_SHARDS && num_bytes < max_num_bytes; ++i) {
+    const auto& shard = shards_[compaction_shard_];
+    {
+      ReaderLockGuard<ShardMutex> shard_lock(shard.mutex);
+      for (const auto& entry : shard.map) {
+        if (num_bytes >= max_num_bytes) break;
+        const auto& key = entry.first;
+        const auto list = entry.second;
+        if (!list->tryGetStats(&list_stats) ||
+            list_stats.num_values_removed == 0 ||
+            list_stats.num_values_removed <
+                min_removed_ratio * list_stats.num_values_total) {
+          continue;
+        }
+        // The rewrite is logged as clearing the list and appending the
+        // valid values, which replays to the same positions.
+        const auto has_new_tail_block = update(
+            list,
+            [&] {
+              return list->compact(store_.get(), &arena_, &values, &block_ids,
+                                   &counters_);
+            },
+            [&](Wal* wal) {
+              auto sequence_number = wal->appendClear(key);
+              for (const auto& value : values) {
+                sequence_number = wal->appendPut(key, value);
+              }
+              return sequence_number;
+            });
+        if (has_new_tail_block && track_tail_blocks_) {
+          addTailList(list);
+        }
+        for (const auto& value : values) {
+          num_bytes += value.size();
+        }
+        releaseBlocks(block_ids);
+      }
+    }
+    if (num_bytes < max_num_bytes) {
+      compaction_shard_ = (compaction_shard_ + 1) % NUM_SHARDS;
+    }
+  }
+  return num_bytes;
+}
+
+std::vector<uint32_t> Partition::getFreeBlockIds() const {
+  auto ids = store_->getReusableBlocks();
+  {
+    std::lock_guard<std::mutex> lock(released_block_ids_mutex_);
+    ids.insert(ids.end(), released_block_ids_.begin(),
+               released_block_ids_.end());
+  }
+  std::sort(ids.begin(), ids.end());
+  return ids;
+}
+
+void Partition::releaseBlocks(const std::vector<uint32_t>& block_ids) {
+  if (block_ids.empty() || store_->isCompressed()) return;
+  // Compressed blocks vary in size and cannot be replaced in place.
+  std::lock_guard<std::mutex> lock(released_block_ids_mutex_);
+  released_block_ids_.insert(released_block_ids_.end(), block_ids.begin(),
+                             block_ids.end());
+}
+
+void Partition::addTailList(List* list) {
+  std::lock_guard<std::mutex> lock(tail_lists_mutex_);
+  tail_lists_.push_back(TailList{list, 0});
+  // A new list gets a second chance when it is visited first.
+}
+
+std::vector<uint32_t> Partition::getCorruptBlocks(
+    const boost::filesystem::path& prefix, const Options& options) {
+  Store::Options store_options;
+  store_options.readonly = true;
+  store_options.block_size = options.block_size;
+  store_options.compress = options.compress;
+  store_options.direct_io = options.direct_io;
+  store_options.checksums = true;
+  const auto values_file = getNameOfValuesFile(prefix.string());
+  const Store store(values_file, store_options);
+  mt::Check::isTrue(store.hasChecksums(), "Partition: '%s' has no checksums",
+                    values_file.c_str());
+  return store.getCorruptBlocks();
+}
+
+std::vector<uint32_t> Partition::getInvalidBlocks(
+    const boost::filesystem::path& prefix, const Options& options) {
+  std::vector<uint32_t> invalid_block_ids;
+  uint64_t num_blocks = 0;
+  {
+    Store::Options store_options;
+    store_options.readonly = true;
+    store_options.block_size = options.block_size;
+    store_options.compress = options.compress;
+    store_options.direct_io = options.direct_io;
+    store_options.checksums = true;
+    const Store store(getNameOfValuesFile(prefix.string()), store_options);
+    if (store.hasChecksums()) {
+      invalid_block_ids = store.getCorruptBlocks();
+    }
+    num_blocks = store.getNumBlocks();
+  }
+  std::vector<bool> is_used(num_blocks);
+  forEachList(prefix, options, [&](const Bytes&, const List& list,
+                                   const Store& store) {
+    const auto block_ids = list.getBlockIdsUnlocked();
+    bool is_valid = true;
+    // Blocks that do not exist must not be read.
+    for (const auto id : block_ids) {
+      if (id >= num_blocks || is_used[id]) {
+        invalid_block_ids.push_back(id);
+        is_valid = false;
+      } else {
+        is_used[id] = true;
+      }
+    }
+    if (!is_valid) return;
+    try {
+      uint64_t num_values = 0;
+      List::SharedIterator iter(list, store);
+      while (iter.hasNext()) {
+        iter.next();
+        ++num_values;
+      }
+      is_valid = num_values == list.getStatsUnlocked().num_values_valid();
+    } catch (const std::exception&) {
+      is_valid = false;
+    }
+    if (!is_valid) {
+      invalid_block_ids.insert(invalid_block_ids.end(), block_ids.begin(),
+                               block_ids.end());
+    }
+  }, ScanOrder::BLOCKS);
+  std::sort(invalid_block_ids.begin(), invalid_block_ids.end());
+  invalid_block_ids.erase(
+      std::unique(invalid_block_ids.begin(), invalid_block_ids.end()),
+      invalid_block_ids.end());
+  return invalid_block_ids;
+}
+
+std::string Partition::getNameOfDeltaFile(const std::string& prefix) {
+  return prefix + ".delta";
+}
+
+std::string Partition::getNameOfExpiryFile(const std::string& prefix) {
+  return prefix + ".expiry";
+}
+
+std::string Partition::getNameOfFeedFile(const std::string& prefix) {
+  return prefix + ".feed";
+}
+
+std::string Partition::getNameOfFilterFile(const std::string& prefix) {
+  return prefix + ".filter";
+}
+
+std::string Partition::getNameOfFreeBlocksFile(const std::string& prefix) {
+  return prefix + ".free";
+}
+
+std::string Partition::getNameOfHotBlocksFile(const std::string& prefix) {
+  return prefix + ".hot";
+}
+
+std::string Partition::getNameOfIndexFile(const std::string& prefix) {
+  return prefix + ".index";
 }
 
 std::string Partition::getNameOfKeysFile(const std::string& prefix) {
@@ -169,9 +1268,601 @@ std::string Partition::getNameOfStatsFile(const std::string& prefix) {
   return prefix + ".stats";
 }
 
+std::string Partition::getNameOfValueFilterFile(const std::string& prefix) {
+  return prefix + ".vfilter";
+}
+
 std::string Partition::getNameOfValuesFile(const std::string& prefix) {
   return prefix + ".values";
 }
 
+std::string Partition::getNameOfWalFile(const std::string& prefix) {
+  return prefix + ".wal";
+}
+
+std::string Partition::getNameOfSpillFile(const std::string& prefix,
+                                          uint64_t id) {
+  return prefix + ".spill." + std::to_string(id);
+}
+
+void Partition::getKeysInRange(const Bytes& lower, const Bytes& upper,
+                               std::vector<std::string>* keys) const {
+  std::lock_guard<std::mutex> lock(key_order_mutex_);
+  const auto sorted_keys = getSortedKeysUnlocked();
+  auto iter = std::lower_bound(sorted_keys->begin(), sorted_keys->end(),
+                               lower);
+  for (; iter != sorted_keys->end(); ++iter) {
+    if (!upper.empty() && !(*iter < upper)) break;
+    if (hasValues(*iter)) keys->push_back(iter->toString());
+  }
+}
+
+void Partition::getKeysInRange(uint64_t lower, uint64_t upper,
+                               std::vector<uint64_t>* keys) const {
+  char data[sizeof(uint64_t)];
+  const auto directory = getKeyDirectory();
+  directory->forEachKey(lower, upper, [&](uint64_t key) {
+    KeyDirectory::writeKey(key, data);
+    if (hasValues(Bytes(data, sizeof data))) keys->push_back(key);
+  });
+}
+
+size_t Partition::getNumKeys() const {
+  size_t num_keys = 0;
+  for (const auto& shard : shards_) {
+    ReaderLockGuard<ShardMutex> lock(shard.mutex);
+    num_keys += shard.map.size();
+  }
+  return num_keys + num_spilled_lists_.load(std::memory_order_relaxed);
+}
+
+std::vector<Bytes> Partition::getAllKeys() const {
+  std::vector<Bytes> keys;
+  if (index_) {
+    index_->forEachRecord([&keys](const KeyIndex::Record& record) {
+      keys.push_back(record.key);
+    });
+  } else {
+    for (const auto& shard : shards_) {
+      ReaderLockGuard<ShardMutex> lock(shard.mutex);
+      for (const auto& entry : shard.map) {
+        keys.push_back(entry.first);
+      }
+    }
+    forEachSpilledList(true, [&keys](const Bytes& key, const char*) {
+      keys.push_back(key);
+    });
+  }
+  return keys;
+}
+
+std::shared_ptr<const std::vector<Bytes> >
+Partition::getSortedKeysUnlocked() const {
+  const auto num_keys_total = num_keys_total_.load();
+  if (!sorted_keys_ || sorted_keys_num_keys_ != num_keys_total) {
+    auto keys = getAllKeys();
+    std::sort(keys.begin(), keys.end());
+    sorted_keys_ = std::make_shared<const std::vector<Bytes> >(std::move(keys));
+    sorted_keys_num_keys_ = num_keys_total;
+  }
+  return sorted_keys_;
+}
+
+std::shared_ptr<const KeyDirectory> Partition::getKeyDirectory() const {
+  std::lock_guard<std::mutex> lock(key_order_mutex_);
+  const auto num_keys_total = num_keys_total_.load();
+  if (!key_directory_ || key_directory_num_keys_ != num_keys_total) {
+    std::vector<uint64_t> keys;
+    for (const auto& key : getAllKeys()) {
+      if (key.size() == sizeof(uint64_t)) {
+        keys.push_back(KeyDirectory::readKey(key.data()));
+      }
+    }
+    std::sort(keys.begin(), keys.end());
+    key_directory_.reset(new KeyDirectory(keys));
+    key_directory_num_keys_ = num_keys_total;
+  }
+  return key_directory_;
+}
+
+bool Partition::hasSortedValues() const {
+  if (!sorted_) return false;
+  for (const auto& shard : shards_) {
+    ReaderLockGuard<ShardMutex> lock(shard.mutex);
+    for (const auto& entry : shard.map) {
+      if (entry.second->wasAppendedToUnlocked()) return false;
+    }
+  }
+  return true;
+}
+
+std::vector<Partition::PinnedList> Partition::getLists(
+    const std::vector<Bytes>& keys, const std::vector<uint64_t>& hashes,
+    const std::vector<size_t>& indices) const {
+  if (hot_keys_) {
+    for (const auto index : indices) {
+      hot_keys_->record(keys[index], hashes[index]);
+    }
+  }
+  std::vector<PinnedList> lists(indices.size());
+  for (size_t s = 0; s != NUM_SHARDS; ++s) {
+    const auto& shard = shards_[s];
+    ReaderLock<ShardMutex> lock(shard.mutex, boost::defer_lock);
+    for (size_t i = 0; i != indices.size(); ++i) {
+      const size_t hash = hashes[indices[i]];
+      if (getShardIndex(hash) == s) {
+        if (!lock.owns_lock()) lock.lock();
+        lists[i] = PinnedList(shard.map.find(keys[indices[i]], hash));
+      }
+    }
+  }
+  if (index_) {
+    for (size_t i = 0; i != indices.size(); ++i) {
+      const auto hash = hashes[indices[i]];
+      if (!lists[i] && (!filter_ || filter_->mayContain(hash))) {
+        lists[i] = PinnedList(getListFromIndex(keys[indices[i]], hash));
+      }
+    }
+  } else {
+    for (size_t i = 0; i != indices.size(); ++i) {
+      if (!lists[i]) {
+        lists[i] = PinnedList(
+            getListFromSpillFiles(keys[indices[i]], hashes[indices[i]]));
+      }
+    }
+  }
+  for (auto& list : lists) {
+    if (list && isExpired(*list)) list = PinnedList();
+  }
+  return lists;
+}
+
+void Partition::putMany(const std::vector<Bytes>& keys,
+                        const std::vector<uint64_t>& hashes,
+                        const std::vector<Bytes>& values,
+                        const std::vector<size_t>& indices) {
+  mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
+  if (hot_keys_) {
+    for (const auto index : indices) {
+      hot_keys_->record(keys[index], hashes[index]);
+    }
+  }
+  struct Run {
+    size_t index;
+    // Of the first put of the key in `keys`.
+    size_t shard_index;
+    size_t begin;
+    size_t end;
+    // The values of the key in `grouped_values`.
+    PinnedList list;
+  };
+  std::vector<Run> runs;
+  std::vector<uint32_t> run_of_put(indices.size());
+
+  // Puts are grouped by key via open addressing, which unlike sorting takes
+  // linear time.  The table is at most half full.
+  const uint32_t EMPTY = -1;
+  size_t table_size = 16;
+  while (table_size < indices.size() * 2) table_size *= 2;
+  std::vector<uint32_t> table(table_size, EMPTY);
+  for (size_t i = 0; i != indices.size(); ++i) {
+    const auto index = indices[i];
+    MT_REQUIRE_LE(keys[index].size(), Limits::maxKeySize());
+    auto slot = hashes[index] & (table_size - 1);
+    while (table[slot] != EMPTY) {
+      const auto other = runs[table[slot]].index;
+      if (hashes[other] == hashes[index] && keys[other] == keys[index]) break;
+      slot = (slot + 1) & (table_size - 1);
+    }
+    if (table[slot] == EMPTY) {
+      table[slot] = runs.size();
+      runs.push_back(
+          Run{index, getShardIndex(hashes[index]), 0, 0, PinnedList()});
+    }
+    run_of_put[i] = table[slot];
+    runs[table[slot]].end++;
+  }
+
+  // Values are stored grouped by key, but in their original order per key.
+  size_t offset = 0;
+  for (auto& run : runs) {
+    run.begin = offset;
+    offset += run.end;
+    run.end = run.begin;
+  }
+  std::vector<Bytes> grouped_values(indices.size());
+  for (size_t i = 0; i != indices.size(); ++i) {
+    grouped_values[runs[run_of_put[i]].end++] = values[indices[i]];
+  }
+
+  // The lists are looked up or created with one lock acquisition per shard.
+  std::vector<Run*> runs_by_shard(runs.size());
+  for (size_t i = 0; i != runs.size(); ++i) {
+    runs_by_shard[i] = &runs[i];
+  }
+  std::sort(runs_by_shard.begin(), runs_by_shard.end(),
+            [](const Run* a, const Run* b) {
+              return a->shard_index < b->shard_index;
+            });
+  size_t i = 0;
+  while (i != runs_by_shard.size()) {
+    auto& shard = shards_[runs_by_shard[i]->shard_index];
+    const auto lock = lockShardForUpdate(shard);
+    do {
+      auto& run = *runs_by_shard[i];
+      run.list = PinnedList(getListOrCreateUnlocked(&shard, keys[run.index],
+                                                    hashes[run.index]));
+    } while (++i != runs_by_shard.size() &&
+             &shards_[runs_by_shard[i]->shard_index] == &shard);
+  }
+
+  for (const auto& run : runs) {
+    append(Key(keys[run.index], hashes[run.index]), run.list,
+           grouped_values.begin() + run.begin,
+           grouped_values.begin() + run.end);
+  }
+}
+
+bool Partition::writeDelta(bool sync_files) {
+  const auto delta_file = getNameOfDeltaFile(prefix_.string());
+  mt::AutoCloseFile stream;
+  bool is_complete = true;
+  for (const auto& shard : shards_) {
+    for (const auto& entry : shard.map) {
+      const auto& key = entry.first;
+      const auto written = entry.second->tryFlushIfDirty(
+          store_.get(), [&](const List& list) {
+            if (!stream.get()) {
+              stream = mt::fopen(delta_file, "a");
+            }
+            writeBytesToStream(key, stream.get());
+            list.writeToStreamUnlocked(stream.get());
+          },
+          &arena_);
+      is_complete = is_complete && written;
+    }
+  }
+  if (stream.get()) {
+    // The blocks referenced by the batch must be in the values file before
+    // the batch becomes valid via its trailer.
+    store_->flush();
+    if (sync_files) {
+      sync(getNameOfValuesFile(prefix_.string()));
+    }
+    ++checkpoint_id_;
+    mt::fwrite(stream.get(), &DELTA_BATCH_END, sizeof DELTA_BATCH_END);
+    mt::fwrite(stream.get(), &checkpoint_id_, sizeof checkpoint_id_);
+    stream.reset();
+    if (sync_files) {
+      sync(delta_file);
+    }
+  }
+  return is_complete;
+}
+
+bool Partition::shouldSyncFiles(bool closing) const {
+  if (wal_ && wal_->getOptions().sync) return true;
+  switch (durability_) {
+    case Store::Durability::NONE:
+      return false;
+    case Store::Durability::ON_CLOSE:
+      return closing;
+    default:
+      return true;
+  }
+}
+
+bool Partition::shouldCompact() const {
+  const auto keys_file = getNameOfKeysFile(prefix_.string());
+  if (!boost::filesystem::is_regular_file(keys_file)) return true;
+
+  // No other thread accesses the lists when the partition is closed.
+  size_t num_keys = num_spilled_lists_.load(std::memory_order_relaxed);
+  size_t num_dirty_lists = 0;
+  for (const auto& shard : shards_) {
+    for (const auto& entry : shard.map) {
+      ++num_keys;
+      num_dirty_lists += entry.second->isDirtyUnlocked();
+    }
+  }
+  const auto delta_file = getNameOfDeltaFile(prefix_.string());
+  const auto delta_size = boost::filesystem::is_regular_file(delta_file)
+                              ? boost::filesystem::file_size(delta_file)
+                              : 0;
+  // Merging the delta pays off once it makes up a considerable fraction of
+  // the keys file, since each entry in it is read in addition when opening.
+  return 2 * num_dirty_lists > num_keys ||
+         2 * delta_size > boost::filesystem::file_size(keys_file);
+}
+
+uint64_t Partition::forEachDeltaEntry(
+    const std::string& file, uint64_t max_checkpoint_id,
+    const std::function<void(const Bytes& key, const char* list)>& process,
+    uint64_t* checkpoint_id) {
+  struct Entry {
+    size_t key_offset;
+    uint32_t key_size;
+    size_t list_offset;
+  };
+  const auto file_size = boost::filesystem::file_size(file);
+  const auto stream = mt::fopen(file, "r");
+  std::vector<char> batch;
+  std::vector<Entry> entries;
+  const auto read = [&](size_t size) {
+    // Guards against garbage sizes at the end of the file.
+    if (size > file_size - mt::ftell(stream.get())) return false;
+    batch.resize(batch.size() + size);
+    return std::fread(batch.data() + batch.size() - size, 1, size,
+                      stream.get()) == size;
+  };
+  uint64_t num_bytes_valid = 0;
+  uint32_t key_size = 0;
+  while (std::fread(&key_size, sizeof key_size, 1, stream.get()) == 1) {
+    if (key_size == DELTA_BATCH_END) {
+      uint64_t id = 0;
+      if (std::fread(&id, sizeof id, 1, stream.get()) != 1) break;
+      if (id > max_checkpoint_id) break;
+      for (const auto& entry : entries) {
+        process(Bytes(batch.data() + entry.key_offset, entry.key_size),
+                batch.data() + entry.list_offset);
+      }
+      batch.clear();
+      entries.clear();
+      num_bytes_valid = mt::ftell(stream.get());
+      *checkpoint_id = id;
+      continue;
+    }
+    Entry entry;
+    entry.key_offset = batch.size();
+    entry.key_size = key_size;
+    if (!read(key_size)) break;
+    entry.list_offset = batch.size();
+    // Number of values total and removed, followed by the block ids.
+    if (!read(3 * sizeof(uint32_t))) break;
+    uint32_t block_ids_size = 0;
+    std::memcpy(&block_ids_size, batch.data() + batch.size() - sizeof(uint32_t),
+                sizeof block_ids_size);
+    if (!read(block_ids_size)) break;
+    entries.push_back(entry);
+  }
+  return num_bytes_valid;
+}
+
+void Partition::replayWal(const std::string& wal_file) {
+  NumMarkedByKey num_marked_by_key;
+  Wal::forEachRecord(wal_file, [&](const Wal::Record& record) {
+    if (record.type == Wal::RecordType::CHECKPOINT) return;
+    applyRecord(record, getListOrCreate(hashKey(record.key)),
+                &num_marked_by_key, nullptr);
+  });
+}
+
+void Partition::applyRecord(const Wal::Record& record, List* list,
+                            NumMarkedByKey* num_marked_by_key,
+                            List::Counters* counters) {
+  uint32_t offset = 0;
+  if (!num_marked_by_key->empty()) {
+    const auto num_marked = num_marked_by_key->find(record.key.toString());
+    if (num_marked != num_marked_by_key->end()) offset = num_marked->second;
+  }
+  switch (record.type) {
+    case Wal::RecordType::PUT:
+      if (list->append(record.value, store_.get(), &arena_, counters) &&
+          track_tail_blocks_) {
+        addTailList(list);
+      }
+      break;
+    case Wal::RecordType::REMOVE:
+      list->removeAt(record.position + offset, store_.get(), counters);
+      break;
+    case Wal::RecordType::REPLACE:
+      list->replaceAt(record.position + offset, record.value, store_.get());
+      break;
+    case Wal::RecordType::RETIRE: {
+      std::vector<uint32_t> block_ids;
+      (*num_marked_by_key)[record.key.toString()] = list->retire(
+          record.position + offset, store_.get(), &arena_, &block_ids);
+      releaseBlocks(block_ids);
+      break;
+    }
+    case Wal::RecordType::EXPIRE:
+      list->setDeadline(record.deadline);
+      addDeadline(record.key, record.deadline);
+      break;
+    case Wal::RecordType::CLEAR: {
+      if (list->getDeadline() != 0) {
+        deadlines_changed_ = true;
+      }
+      std::vector<uint32_t> block_ids;
+      list->clear(&block_ids, counters, &arena_);
+      releaseBlocks(block_ids);
+      num_marked_by_key->erase(record.key.toString());
+      break;
+    }
+    default:
+      MT_FAIL("Default case in switch statement reached");
+  }
+}
+
+void Partition::readDeadlines(const std::string& file) {
+  const auto file_size = boost::filesystem::file_size(file);
+  const auto stream = mt::fopen(file, "r");
+  std::vector<char> key;
+  uint32_t deadline;
+  while (mt::ftell(stream.get()) != file_size) {
+    readBytesFromStream(stream.get(), &key);
+    mt::fread(stream.get(), &deadline, sizeof deadline);
+    const auto hashed_key = hashKey(Bytes(key.data(), key.size()));
+    const auto list = findList(hashed_key);
+    // The list may have been removed after the file was written.
+    if (list && !list->empty()) {
+      list->setDeadline(deadline);
+      addDeadline(hashed_key, deadline);
+    }
+  }
+  deadlines_changed_ = false;
+}
+
+void Partition::writeDeadlines(bool sync_file) const {
+  const auto file = getNameOfExpiryFile(prefix_.string());
+  const auto new_file = file + NEW_FILE_SUFFIX;
+  bool has_deadlines = false;
+  {
+    const auto stream = mt::fopen(new_file, "w");
+    for (const auto& shard : shards_) {
+      for (const auto& entry : shard.map) {
+        const auto deadline = entry.second->getDeadline();
+        if (deadline != 0) {
+          writeBytesToStream(entry.first, stream.get());
+          mt::fwrite(stream.get(), &deadline, sizeof deadline);
+          has_deadlines = true;
+        }
+      }
+    }
+  }
+  if (has_deadlines) {
+    if (sync_file) sync(new_file);
+    boost::filesystem::rename(new_file, file);
+  } else {
+    boost::filesystem::remove(new_file);
+    boost::filesystem::remove(file);
+  }
+}
+
+void Partition::completeCheckpoint(const std::string& prefix, bool has_wal) {
+  const std::string files[] = {
+      getNameOfKeysFile(prefix), getNameOfIndexFile(prefix),
+      getNameOfFilterFile(prefix), getNameOfValueFilterFile(prefix),
+      getNameOfStatsFile(prefix)};
+  const auto is_complete =
+      !has_wal && boost::filesystem::is_regular_file(
+                      getNameOfStatsFile(prefix) + NEW_FILE_SUFFIX);
+  if (is_complete) {
+    // The new keys file contains all lists of the delta.
+    boost::filesystem::remove(getNameOfDeltaFile(prefix));
+  }
+  for (const auto& file : files) {
+    const auto new_file = file + NEW_FILE_SUFFIX;
+    if (boost::filesystem::is_regular_file(new_file)) {
+      if (is_complete) {
+        boost::filesystem::rename(new_file, file);
+      } else {
+        // The checkpoint was interrupted, the current files are still valid.
+        boost::filesystem::remove(new_file);
+      }
+    } else if (is_complete && (file == getNameOfFilterFile(prefix) ||
+                               file == getNameOfValueFilterFile(prefix))) {
+      boost::filesystem::remove(file);
+      // Filters are only written on request and an old one would not match
+      // the new keys file.  Value filters are only written by
+      // `PartitionBuilder`, which sees all values anyway.
+    }
+  }
+}
+
+List* Partition::getListFromIndex(const Bytes& key, uint64_t hash) const {
+  const auto record = index_->find(key, hash);
+  if (!record.list) return nullptr;
+  auto& shard = getShard(hash);
+  WriterLockGuard<ShardMutex> lock(shard.mutex);
+  if (const auto list = shard.map.find(record.key, hash)) return list;
+  const auto list = shard.map.insert(record.key, hash);
+  List::readFromBuffer(record.list, list);
+  return list;
+}
+
+List* Partition::loadSpilledListUnlocked(Shard* shard, const Bytes& key,
+                                         size_t hash) const {
+  if (!has_spill_files_.load(std::memory_order_acquire)) return nullptr;
+  const auto files = getSpillFiles();
+  for (auto file = files->rbegin(); file != files->rend(); ++file) {
+    const auto record = (*file)->index->find(key, hash);
+    if (!record.list) continue;
+    // The key is copied, because the file is unmapped when the partition is
+    // closed, but lists may be evicted again before.
+    const auto key_data = arena_.allocate(key.size());
+    std::memcpy(key_data, key.data(), key.size());
+    const auto list = shard->map.insert(Bytes(key_data, key.size()), hash);
+    List::readFromBuffer(record.list, list, &arena_);
+    num_spilled_lists_.fetch_sub(1, std::memory_order_relaxed);
+    return list;
+  }
+  return nullptr;
+}
+
+bool Partition::isSpilled(const Bytes& key, uint64_t hash) const {
+  if (!has_spill_files_.load(std::memory_order_acquire)) return false;
+  for (const auto& file : *getSpillFiles()) {
+    if (file->index->find(key, hash).list) return true;
+  }
+  return false;
+}
+
+void Partition::mergeSpillFiles() {
+  const auto files = getSpillFiles();
+  auto merged = std::make_shared<SpillFile>();
+  merged->filename =
+      getNameOfSpillFile(prefix_.string(), next_spill_file_id_++);
+  size_t num_written = 0;
+  {
+    KeyIndex::Builder index_builder;
+    const auto stream = mt::fopen(merged->filename, "w");
+    // Lists in memory are skipped, since evicting them writes them again.
+    forEachSpilledList(true, [&](const Bytes& key, const char* buffer) {
+      List list;
+      List::readFromBuffer(buffer, &list);
+      index_builder.add(Key::hash(key, key_hash_), mt::ftell(stream.get()));
+      writeBytesToStream(key, stream.get());
+      list.writeToStream(stream.get());
+      ++num_written;
+    });
+    if (num_written != 0) {
+      index_builder.writeToFile(merged->filename + ".index",
+                                mt::ftell(stream.get()));
+    }
+  }
+  auto new_files = std::make_shared<SpillFiles>();
+  if (num_written != 0) {
+    merged->index =
+        KeyIndex::open(merged->filename + ".index", merged->filename);
+    mt::Check::notNull(merged->index.get(),
+                       "Partition: Cannot open '%s.index'",
+                       merged->filename.c_str());
+    new_files->push_back(merged);
+  } else {
+    boost::filesystem::remove(merged->filename);
+  }
+  {
+    std::lock_guard<std::mutex> lock(spill_files_mutex_);
+    // Keys and lists that have been read from the old files stay valid.
+    retired_spill_files_.insert(retired_spill_files_.end(), files->begin(),
+                                files->end());
+    spill_files_ = new_files;
+  }
+  for (const auto& file : *files) {
+    boost::filesystem::remove(file->filename);
+    boost::filesystem::remove(file->filename + ".index");
+  }
+}
+
+void Partition::removeSpillFiles(const boost::filesystem::path& prefix) {
+  const auto directory = prefix.has_parent_path()
+                             ? prefix.parent_path()
+                             : boost::filesystem::current_path();
+  if (!boost::filesystem::is_directory(directory)) return;
+  const auto spill_file_prefix = prefix.filename().string() + ".spill.";
+  std::vector<boost::filesystem::path> files;
+  for (const auto& entry : boost::filesystem::directory_iterator(directory)) {
+    const auto filename = entry.path().filename().string();
+    if (filename.compare(0, spill_file_prefix.size(), spill_file_prefix) ==
+        0) {
+      files.push_back(entry.path());
+    }
+  }
+  for (const auto& file : files) {
+    boost::filesystem::remove(file);
+  }
+}
+
 }  // namespace internal
 }  // namespace multimap
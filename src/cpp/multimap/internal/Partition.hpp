@@ -18,15 +18,35 @@
 #ifndef MULTIMAP_INTERNAL_PARTITION_HPP_INCLUDED
 #define MULTIMAP_INTERNAL_PARTITION_HPP_INCLUDED
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
 #include <unordered_map>
 #include <vector>
 #include <boost/filesystem/path.hpp>
 #include <boost/thread/shared_mutex.hpp>
 #include "multimap/internal/Arena.hpp"
+#include "multimap/internal/BloomFilter.hpp"
+#include "multimap/internal/Crc32c.hpp"
+#include "multimap/internal/Gate.hpp"
+#include "multimap/internal/HotKeys.hpp"
+#include "multimap/internal/KeyDirectory.hpp"
+#include "multimap/internal/KeyIndex.hpp"
 #include "multimap/internal/List.hpp"
+#include "multimap/internal/ListMap.hpp"
+#include "multimap/internal/LockProfiler.hpp"
 #include "multimap/internal/Locks.hpp"
+#include "multimap/internal/MemoryUsage.hpp"
+#include "multimap/internal/Metrics.hpp"
 #include "multimap/internal/Stats.hpp"
+#include "multimap/internal/Wal.hpp"
 #include "multimap/thirdparty/mt/mt.hpp"
 #include "multimap/Iterator.hpp"
 
@@ -46,10 +66,167 @@ class Partition : public mt::Resource {
     static uint32_t maxValueSize();
   };
 
+  enum class KeyHash : uint64_t { XXH64, CRC32C };
+  // The function that computes the hash values of keys, see `Key::hash()`.
+  // Since they are persisted in key indexes and Bloom filters and select
+  // the partition of a key, it is recorded per map, see `Map::Id`.
+
+  class Key : public Bytes {
+   public:
+    Key(const char* key) : Key(Bytes(key)) {}
+
+    Key(const std::string& key) : Key(Bytes(key)) {}
+
+    Key(const Bytes& key) : Key(key, hash(key)) {}
+
+    Key(const Bytes& key, uint64_t hash) : Bytes(key), hash_(hash) {}
+    // Requires: `hash == Key::hash(key, function)` with the key hash
+    // function of the partition.
+
+    uint64_t hash() const { return hash_; }
+
+    static uint64_t hash(const Bytes& key) {
+      return XXH64(key.data(), key.size(), 0);
+    }
+    // The same hash value is used to select a partition, see class Map, and
+    // within the partition for its shards, class ListMap, class KeyIndex,
+    // and class BloomFilter.
+
+    static uint64_t hash(const Bytes& key, KeyHash function) {
+      return function == KeyHash::CRC32C ? Crc32c::hash(key.data(), key.size())
+                                         : hash(key);
+    }
+    // Same as above, but with the given hash function.
+
+   private:
+    uint64_t hash_;
+  };
+  // A key together with its hash value, which is computed only once by the
+  // caller and then passed down to all data structures that need it.
+
+  struct Timings {
+    // Nanoseconds spent in each phase of opening or closing a partition.
+    // Phases that do not apply are zero.
+
+    uint64_t read_keys = 0;
+    // Reading the keys file into the in-memory index, or opening the key
+    // index and filters of a read-only partition instead.
+
+    uint64_t replay_delta = 0;
+    uint64_t replay_wal = 0;
+
+    uint64_t build_index = 0;
+    // Counting the lists of the in-memory index, which initializes the
+    // running counters, see `getCurrentStats()`.
+
+    uint64_t flush_lists = 0;
+    // Writing the tail blocks of all lists and the buffered blocks of the
+    // store, or writing the delta file, if that suffices.
+
+    uint64_t write_keys = 0;
+    // Writing the keys file, the key index, and the Bloom filter.
+
+    uint64_t write_stats = 0;
+    // Writing the stats file and forcing all files to stable storage, if
+    // the write-ahead log is synced.
+
+    uint64_t total = 0;
+  };
+
   struct Options {
     uint32_t block_size = 512;
     uint32_t buffer_size = mt::MiB(1);
     bool readonly = false;
+    bool compress = false;
+    bool front_coding = false;
+
+    bool background_flush = false;
+    // If true, the store writes full buffers in a background thread, see
+    // `Store::Options::background_flush`.
+
+    uint32_t num_write_lanes = 0;
+    // Passed to `Store::Options`, so that concurrent writers append blocks
+    // without waiting for each other.
+
+    bool sorted = false;
+    // If true, the values of each list are sorted, see `Map::optimize()`,
+    // so that lookups by value can use binary search on lists that are not
+    // appended to.
+
+    KeyHash key_hash = KeyHash::XXH64;
+    // Must be the same function that the keys passed to the partition have
+    // been hashed with.  Keys that the partition reads from its own files
+    // are hashed with this function as well.
+
+    double bloom_filter_false_positive_rate = 0;
+    // If not zero, a Bloom filter of the keys with this false-positive rate
+    // is written whenever the keys file is rewritten.  A read-only partition
+    // consults the filter, if present, before its key index.
+
+    bool track_tail_blocks = false;
+    // If true, lists that allocate a tail block in `put()` are tracked, so
+    // that `flushColdLists()` can bound the memory held by tail blocks.
+
+    uint32_t max_values_per_key = 0;
+    // If not zero, puts retire the oldest values of lists that exceed this
+    // number of values in whole blocks, see `List::append()`.
+
+    bool write_ahead_log = false;
+    // If true, updates are recorded in a write-ahead log before they return,
+    // so that they survive a crash and are replayed when the partition is
+    // opened the next time.  A partition that has a log from a previous run
+    // keeps using it, regardless of this option.
+
+    bool sync_write_ahead_log = false;
+    // If true, each update waits until its log record is on stable storage.
+
+    bool change_feed = false;
+    // If true, updates are also appended to a change feed, which has the
+    // same format as the write-ahead log, but is never truncated, so that
+    // replicas can follow it, see `followChangeFeed()`.  Updates made while
+    // the partition is opened without this option are not recorded.
+
+    uint32_t hot_keys = 0;
+    uint32_t hot_keys_sample_rate = 16;
+    // If `hot_keys` is not zero, accesses to keys via `put()`, `get()`, and
+    // the other operations on single keys are sampled to track this number
+    // of the most frequently accessed keys, see class HotKeys.
+
+    uint64_t warm_up_size = 0;
+    // If not zero, the ids of up to this many bytes of hot blocks, i.e. the
+    // blocks of the lists of hot keys and blocks in the block cache, are
+    // written to a file when the partition is closed, even in read-only
+    // mode, so that `warmUp()` can read them ahead after it is reopened.
+
+    Store::Durability durability = Store::Durability::NONE;
+    // Unless NONE, the files written when the partition is closed are forced
+    // to stable storage.  PERIODIC and PER_BATCH do so for checkpoints too,
+    // and are passed on to the store, see `Store::Options::durability`.
+    // Files are always synced if the write-ahead log is.
+
+    bool populate = false;
+    bool huge_pages = false;
+    bool lock_in_memory = false;
+    bool direct_io = false;
+    uint32_t max_read_ahead = 1024;
+    uint32_t max_extent_size = 1;
+    bool checksums = false;
+    std::shared_ptr<BlockCache> block_cache;
+    uint32_t block_cache_id = 0;
+    std::shared_ptr<Metrics> metrics;
+    // Passed to `Store::Options`.  The partition records the time that
+    // updates wait for the lock of a shard in `metrics` as well.
+
+    std::shared_ptr<IoLimiter> io_limiter;
+    // Passed to `Store::Options`.
+
+    std::function<void(const Timings&)> on_open;
+    // If set, called at the end of the constructor with the time spent in
+    // each phase of opening the partition.
+
+    std::function<void(const Timings&)> on_close;
+    // If set, called at the end of the destructor of a writable partition
+    // with the time spent in each phase of closing it.  Must not throw.
   };
 
   // ---------------------------------------------------------------------------
@@ -62,175 +239,806 @@ class Partition : public mt::Resource {
 
   ~Partition();
 
-  void put(const Bytes& key, const Bytes& value) {
+  void put(const Key& key, const Bytes& value) {
     mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
-    getListOrCreate(key)->append(value, store_.get(), &arena_);
+    if (hot_keys_) hot_keys_->record(key, key.hash());
+    const auto list = getListOrCreate(key);
+    List::Cap cap;
+    const auto cap_or_null = initCap(&cap);
+    const auto has_new_tail_block = update(
+        list,
+        [&] {
+          return list->append(value, store_.get(), &arena_, &counters_,
+                              cap_or_null);
+        },
+        [&](Wal* wal) {
+          return logRetire(wal, key, cap, wal->appendPut(key, value));
+        });
+    releaseBlocks(cap.retired_block_ids);
+    if (has_new_tail_block && track_tail_blocks_) {
+      addTailList(list);
+    }
   }
 
   template <typename InputIter>
-  void put(const Bytes& key, InputIter first, InputIter last) {
+  void put(const Key& key, InputIter first, InputIter last) {
     mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
-    getListOrCreate(key)->append(first, last, store_.get(), &arena_);
+    if (hot_keys_) hot_keys_->record(key, key.hash());
+    append(key, getListOrCreate(key), first, last);
   }
+  // If the partition has a write-ahead log, the values are traversed twice,
+  // hence `InputIter` must be a forward iterator.
+
+  void putMany(const std::vector<Bytes>& keys,
+               const std::vector<uint64_t>& hashes,
+               const std::vector<Bytes>& values,
+               const std::vector<size_t>& indices);
+  // Same as calling `put()` for `keys[indices[i]]` and `values[indices[i]]`
+  // for all `i` in this order, but the lists are looked up with a single
+  // acquisition of each shard lock, and the values of each key are appended
+  // with a single acquisition of its list lock.
 
-  std::unique_ptr<Iterator> get(const Bytes& key) const {
+  std::unique_ptr<Iterator> get(const Key& key) const {
     const auto list = getList(key);
     return list ? list->newIterator(*store_) : std::unique_ptr<Iterator>();
   }
 
-  bool contains(const Bytes& key) const {
+  std::unique_ptr<Iterator> getReverse(const Key& key) const {
+    const auto list = getList(key);
+    return list ? list->newReverseIterator(*store_)
+                : std::unique_ptr<Iterator>();
+  }
+  // Same as `get()`, but the iterator yields the newest values first.
+
+  template <typename Procedure>
+  bool get(const Key& key, Procedure process) const {
+    if (const auto list = getList(key)) {
+      List::SharedIterator iter(*list, *store_);
+      process(&iter);
+      return true;
+    }
+    return false;
+  }
+  // Same as `get()`, but passes the iterator to `process` instead of
+  // returning it, which allows to place the iterator on the stack.
+  // Returns `false` without calling `process` if `key` is not found.
+
+  bool contains(const Key& key) const {
     const auto list = getList(key);
     return list ? !list->empty() : false;
   }
 
-  uint32_t remove(const Bytes& key) {
+  void getMany(const std::vector<Bytes>& keys,
+               const std::vector<uint64_t>& hashes,
+               const std::vector<size_t>& indices,
+               std::vector<std::unique_ptr<Iterator> >* iterators) const {
+    const auto lists = getLists(keys, hashes, indices);
+    for (size_t i = 0; i != indices.size(); ++i) {
+      if (lists[i]) {
+        (*iterators)[indices[i]] = lists[i]->newIterator(*store_);
+      }
+    }
+  }
+  // Looks up `keys[indices[i]]` for all `i` and assigns the resulting
+  // iterators to `iterators->at(indices[i])`.  Unlike calling `get()` for
+  // each key, the lock of each shard is acquired at most once.  `hashes[j]`
+  // must be equal to `Key::hash(keys[j])`.
+
+  void containsMany(const std::vector<Bytes>& keys,
+                    const std::vector<uint64_t>& hashes,
+                    const std::vector<size_t>& indices,
+                    std::vector<bool>* results) const {
+    const auto lists = getLists(keys, hashes, indices);
+    for (size_t i = 0; i != indices.size(); ++i) {
+      (*results)[indices[i]] = lists[i] ? !lists[i]->empty() : false;
+    }
+  }
+  // Same as `getMany()`, but for `contains()`.
+
+  uint32_t count(const Key& key) const {
+    const auto list = getList(key);
+    return list ? list->size() : 0;
+  }
+
+  void countMany(const std::vector<Bytes>& keys,
+                 const std::vector<uint64_t>& hashes,
+                 const std::vector<size_t>& indices,
+                 std::vector<uint32_t>* results) const {
+    const auto lists = getLists(keys, hashes, indices);
+    for (size_t i = 0; i != indices.size(); ++i) {
+      (*results)[indices[i]] = lists[i] ? lists[i]->size() : 0;
+    }
+  }
+  // Same as `getMany()`, but for `count()`.
+
+  uint64_t byteSize(const Key& key) const {
+    const auto list = getList(key);
+    return list ? list->getNumBytes(store_->getBlockSize()) : 0;
+  }
+
+  uint32_t remove(const Key& key) {
     mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
     const auto list = getList(key);
-    return list ? list->clear() : 0;
+    return list ? clear(key, list) : 0;
   }
 
   template <typename Predicate>
   uint32_t removeOne(Predicate predicate) {
     mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
-    WriterLockGuard<boost::shared_mutex> lock(mutex_);
-    uint32_t num_values_removed = 0;
-    for (const auto& entry : map_) {
-      if (predicate(entry.first)) {
-        num_values_removed += entry.second->clear();
-        break;
+    for (const auto& shard : shards_) {
+      const auto lock = lockShardForUpdate(shard);
+      for (const auto& entry : shard.map) {
+        if (predicate(entry.first)) {
+          return clear(entry.first, entry.second);
+        }
       }
     }
-    return num_values_removed;
+    const auto keys = getSpilledKeys(predicate);
+    return keys.empty() ? 0 : remove(hashKey(keys.front()));
   }
 
   template <typename Predicate>
   std::pair<uint32_t, uint64_t> removeAll(Predicate predicate) {
     mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
-    WriterLockGuard<boost::shared_mutex> lock(mutex_);
     uint32_t num_keys_removed = 0;
     uint64_t num_values_removed = 0;
-    for (const auto& entry : map_) {
-      if (predicate(entry.first)) {
-        num_values_removed += entry.second->clear();
+    std::vector<std::pair<Bytes, PinnedList> > matches;
+    for (const auto& shard : shards_) {
+      // The predicate is evaluated for all keys of the shard under the
+      // reader lock, and the writer lock is only taken to clear the matching
+      // lists.  The matches are pinned, so that they are not reclaimed in
+      // between.
+      matches.clear();
+      {
+        ReaderLockGuard<ShardMutex> lock(shard.mutex);
+        for (const auto& entry : shard.map) {
+          if (predicate(entry.first)) {
+            matches.emplace_back(entry.first, PinnedList(entry.second));
+          }
+        }
+      }
+      if (matches.empty()) continue;
+      const auto lock = lockShardForUpdate(shard);
+      for (const auto& match : matches) {
+        num_values_removed += clear(match.first, match.second);
+        num_keys_removed++;
+      }
+    }
+    for (const auto& key : getSpilledKeys(predicate)) {
+      num_values_removed += remove(hashKey(key));
+      num_keys_removed++;
+    }
+    return std::make_pair(num_keys_removed, num_values_removed);
+  }
+
+  template <typename Predicate>
+  std::pair<uint32_t, uint64_t> removeAllInChunks(Predicate predicate,
+                                                  size_t chunk_size) {
+    mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
+    MT_REQUIRE_NOT_ZERO(chunk_size);
+    uint32_t num_keys_removed = 0;
+    uint64_t num_values_removed = 0;
+    std::vector<std::pair<Bytes, PinnedList> > matches;
+    for (const auto& shard : shards_) {
+      size_t index = 0;
+      while (true) {
+        matches.clear();
+        {
+          ReaderLockGuard<ShardMutex> lock(shard.mutex);
+          const auto end =
+              std::min(index + chunk_size, shard.map.getNumIndices());
+          if (index == end) break;
+          for (; index != end; ++index) {
+            const auto entry = shard.map.getEntry(index);
+            if (entry.second && predicate(entry.first)) {
+              matches.emplace_back(entry.first, PinnedList(entry.second));
+            }
+          }
+        }
+        for (const auto& match : matches) {
+          const auto num_removed = clear(match.first, match.second);
+          if (num_removed != 0) {
+            num_values_removed += num_removed;
+            num_keys_removed++;
+          }
+        }
+      }
+    }
+    for (const auto& key : getSpilledKeys(predicate)) {
+      const auto num_removed = remove(hashKey(key));
+      if (num_removed != 0) {
+        num_values_removed += num_removed;
         num_keys_removed++;
       }
     }
     return std::make_pair(num_keys_removed, num_values_removed);
   }
+  // Same as `removeAll()`, but the keys of each shard are visited in chunks
+  // of `chunk_size` in the order they were inserted.  The shard's reader
+  // lock is held while the predicate is evaluated for one chunk and no lock
+  // of the shard is held while matching lists are cleared, which is what
+  // `remove()` does, too.  Keys inserted during the scan are visited if
+  // their shard has not been finished yet.  Only keys that had values are
+  // counted as removed.
+
+  bool expire(const Key& key, uint32_t deadline) {
+    mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
+    const auto list = getList(key);
+    if (!list || list->empty()) return false;
+    update(list,
+           [&] {
+             list->setDeadline(deadline);
+             return true;
+           },
+           [&](Wal* wal) { return wal->appendExpire(key, deadline); });
+    addDeadline(key, deadline);
+    return true;
+  }
+  // Sets the deadline of the list of `key`, see `List::getDeadline()`, and
+  // returns `true`, or returns `false` if `key` has no values.  A deadline
+  // of zero means that the list never expires.  From the deadline on, the
+  // key is treated as if it did not exist by lookups and scans, and its
+  // values are removed by `removeExpiredLists()`.  Removing all values of
+  // a key also removes its deadline.
 
   template <typename Predicate>
-  bool removeOne(const Bytes& key, Predicate predicate) {
+  bool removeOne(const Key& key, Predicate predicate) {
     mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
     const auto list = getList(key);
-    return list ? list->removeOne(predicate, store_.get()) : false;
+    if (!list) return false;
+    std::vector<uint32_t> positions;
+    return update(
+        list,
+        [&] {
+          return list->removeOne(predicate, store_.get(),
+                                 isLogged() ? &positions : nullptr,
+                                 &counters_);
+        },
+        [&](Wal* wal) { return logUpdate(wal, key, positions, {}); });
   }
 
   template <typename Predicate>
-  uint32_t removeAll(const Bytes& key, Predicate predicate) {
+  uint32_t removeAll(const Key& key, Predicate predicate) {
     mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
     const auto list = getList(key);
-    return list ? list->removeAll(predicate, store_.get()) : 0;
+    if (!list) return 0;
+    std::vector<uint32_t> positions;
+    return update(
+        list,
+        [&] {
+          return list->removeAll(predicate, store_.get(),
+                                 isLogged() ? &positions : nullptr,
+                                 &counters_);
+        },
+        [&](Wal* wal) { return logUpdate(wal, key, positions, {}); });
   }
 
-  bool replaceOne(const Bytes& key, const Bytes& old_value,
+  bool replaceOne(const Key& key, const Bytes& old_value,
                   const Bytes& new_value) {
-    return replaceOne(key, [&old_value, &new_value](const Bytes& value) {
-      return (value == old_value) ? new_value.toString() : std::string();
-    });
+    return replace(key, old_value, new_value, false) != 0;
   }
 
   template <typename Function>
-  bool replaceOne(const Bytes& key, Function map) {
+  bool replaceOne(const Key& key, Function map) {
     mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
     const auto list = getList(key);
-    return list ? list->replaceOne(map, store_.get(), &arena_) : false;
+    if (!list) return false;
+    std::vector<uint32_t> positions;
+    std::vector<std::string> new_values;
+    const auto logging_map = makeLoggingMap(map, &new_values);
+    return update(
+        list,
+        [&] {
+          return list->replaceOne(logging_map, store_.get(), &arena_,
+                                  isLogged() ? &positions : nullptr,
+                                  &counters_);
+        },
+        [&](Wal* wal) { return logUpdate(wal, key, positions, new_values); });
   }
 
-  uint32_t replaceAll(const Bytes& key, const Bytes& old_value,
+  uint32_t replaceAll(const Key& key, const Bytes& old_value,
                       const Bytes& new_value) {
-    return replaceAll(key, [&old_value, &new_value](const Bytes& value) {
-      return (value == old_value) ? new_value.toString() : std::string();
-    });
+    return replace(key, old_value, new_value, true);
   }
 
+  void replaceMany(const std::vector<Bytes>& keys,
+                   const std::vector<uint64_t>& hashes,
+                   const std::vector<Bytes>& old_values,
+                   const std::vector<Bytes>& new_values,
+                   const std::vector<size_t>& indices,
+                   std::vector<uint32_t>* results) {
+    for (const auto index : indices) {
+      (*results)[index] = replace(Key(keys[index], hashes[index]),
+                                  old_values[index], new_values[index], true);
+    }
+  }
+  // Same as calling `replaceAll()` for `keys[indices[i]]`,
+  // `old_values[indices[i]]`, and `new_values[indices[i]]` for all `i` and
+  // assigning the results to `results->at(indices[i])`.  `hashes[j]` must
+  // be equal to `Key::hash(keys[j])`.
+
   template <typename Function>
-  uint32_t replaceAll(const Bytes& key, Function map) {
+  uint32_t replaceAll(const Key& key, Function map) {
     mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
     const auto list = getList(key);
-    return list ? list->replaceAll(map, store_.get(), &arena_) : 0;
+    if (!list) return 0;
+    std::vector<uint32_t> positions;
+    std::vector<std::string> new_values;
+    const auto logging_map = makeLoggingMap(map, &new_values);
+    return update(
+        list,
+        [&] {
+          return list->replaceAll(logging_map, store_.get(), &arena_,
+                                  isLogged() ? &positions : nullptr,
+                                  &counters_);
+        },
+        [&](Wal* wal) { return logUpdate(wal, key, positions, new_values); });
   }
 
   template <typename Procedure>
   void forEachKey(Procedure process) const {
-    ReaderLockGuard<boost::shared_mutex> lock(mutex_);
-    for (const auto& entry : map_) {
-      if (!entry.second->empty()) {
-        process(entry.first);
+    if (index_) {
+      index_->forEachRecord(
+          [&process](const KeyIndex::Record& record) { process(record.key); });
+      return;
+    }
+    forEachSpilledList(true, [&process](const Bytes& key, const char* list) {
+      if (readStatsOfList(list).num_values_valid() != 0) process(key);
+    });
+    for (const auto& shard : shards_) {
+      ReaderLockGuard<ShardMutex> lock(shard.mutex);
+      for (const auto& entry : shard.map) {
+        if (!entry.second->empty() && !isExpired(*entry.second)) {
+          process(entry.first);
+        }
       }
     }
   }
+  // Keys that are loaded from a spill file concurrently, see
+  // `spillColdLists()`, may be visited twice.
+
+  void getKeysInRange(const Bytes& lower, const Bytes& upper,
+                      std::vector<std::string>* keys) const;
+  // Appends copies of the keys that are not less than `lower` and less than
+  // `upper` to `keys` in ascending order, where an empty `upper` means no
+  // upper bound.  Keys without values are skipped, as by `forEachKey()`.
+  // They are looked up via binary search in a sorted array of all keys of
+  // the partition, which is built on first use and rebuilt if keys have
+  // been inserted or reclaimed since.
+
+  void getKeysInRange(uint64_t lower, uint64_t upper,
+                      std::vector<uint64_t>* keys) const;
+  // Appends the keys that consist of eight bytes and whose big-endian value
+  // is not less than `lower` and less than `upper` to `keys` in ascending
+  // order, see `KeyDirectory::readKey()`.  Keys without values are skipped,
+  // as by `forEachKey()`.  The keys are looked up in a directory of all such
+  // keys of the partition, which is built on first use and rebuilt if new
+  // keys have been inserted since.
 
   template <typename Procedure>
-  void forEachValue(const Bytes& key, Procedure process) const {
+  void forEachValue(const Key& key, Procedure process) const {
     if (auto list = getList(key)) {
-      auto iter = list->newIterator(*store_);
-      while (iter->hasNext()) {
-        process(iter->next());
+      List::SharedIterator iter(*list, *store_);
+      while (iter.hasNext()) {
+        process(iter.next());
+      }
+    }
+  }
+
+  bool mayContainValue(const Key& key, const Bytes& value) const {
+    if (const auto list = getList(key)) {
+      return !value_filter_ || list->wasAppendedTo() ||
+             value_filter_->mayContain(key.hash(), value);
+    }
+    return false;
+  }
+  // Returns `false` if the list of `key` definitely does not contain `value`.
+  // If the partition has been written by `PartitionBuilder` with a value
+  // filter, this is decided without reading values for lists that have not
+  // been appended to since, otherwise `true` is returned for existing keys.
+
+  bool hasValueFilter() const { return value_filter_ != nullptr; }
+
+  typedef std::function<bool(const Bytes&, const Bytes&)> Compare;
+
+  bool containsValue(const Key& key, const Bytes& value,
+                     const Compare& compare) const {
+    if (const auto list = getList(key)) {
+      List::SharedIterator iter(*list, *store_);
+      if (value_filter_ && !iter.wasAppendedTo() &&
+          !value_filter_->mayContain(key.hash(), value)) {
+        return false;
+      }
+      if (compare && isSorted(iter)) {
+        iter.skipWhileLess(value, compare);
+        while (iter.hasNext() && !compare(value, iter.peekNext())) {
+          if (iter.next() == value) return true;
+        }
+        return false;
+      }
+      while (iter.hasNext()) {
+        if (iter.next() == value) return true;
+      }
+    }
+    return false;
+  }
+  // Returns `true` if the list of `key` contains a value that is equal to
+  // `value`.  Values ruled out by the value filter are not searched at all.
+  // If the list is sorted and `compare` is given, the values equivalent to
+  // `value` are found via binary search, otherwise all values are compared.
+
+  template <typename Procedure>
+  void forEachValueInRange(const Key& key, const Bytes& lower,
+                           const Bytes& upper, const Compare& compare,
+                           Procedure process) const {
+    if (const auto list = getList(key)) {
+      List::SharedIterator iter(*list, *store_);
+      if (isSorted(iter)) {
+        iter.skipWhileLess(lower, compare);
+        while (iter.hasNext() && compare(iter.peekNext(), upper)) {
+          process(iter.next());
+        }
+        return;
+      }
+      while (iter.hasNext()) {
+        const auto value = iter.next();
+        if (!compare(value, lower) && compare(value, upper)) {
+          process(value);
+        }
       }
     }
   }
+  // Calls `process` for each value of `key` that is not less than `lower`
+  // and less than `upper` according to `compare`, in the order of the list.
+
+  bool hasSortedValues() const;
+  // Returns `true` if the partition was opened with `Options::sorted` and no
+  // list has been appended to since.  Must not be called concurrently with
+  // updates.
 
   template <typename BinaryProcedure>
   void forEachEntry(BinaryProcedure process) const {
-    ReaderLockGuard<boost::shared_mutex> lock(mutex_);
+    if (index_) {
+      List list;
+      store_->adviseAccessPattern(Store::AccessPattern::WILLNEED);
+      index_->forEachRecord([&](const KeyIndex::Record& record) {
+        List::readFromBuffer(record.list, &list);
+        List::SharedIterator iter(list, *store_);
+        process(record.key, &iter);
+      });
+      store_->adviseAccessPattern(Store::AccessPattern::NORMAL);
+      return;
+    }
+    std::vector<std::pair<Bytes, PinnedList> > entries;
     store_->adviseAccessPattern(Store::AccessPattern::WILLNEED);
-    for (const auto& entry : map_) {
-      auto iter = entry.second->newIterator(*store_);
-      if (iter->hasNext()) {
-        process(entry.first, iter.get());
+    forEachSpilledList(true, [&](const Bytes& key, const char* buffer) {
+      List list;
+      List::readFromBuffer(buffer, &list);
+      List::SharedIterator iter(list, *store_);
+      if (iter.hasNext()) {
+        process(key, &iter);
+      }
+    });
+    for (const auto& shard : shards_) {
+      entries.clear();
+      {
+        ReaderLockGuard<ShardMutex> lock(shard.mutex);
+        for (const auto& entry : shard.map) {
+          if (!isExpired(*entry.second)) {
+            entries.emplace_back(entry.first, PinnedList(entry.second));
+          }
+        }
+      }
+      for (const auto& entry : entries) {
+        List::SharedIterator iter(*entry.second, *store_);
+        if (iter.hasNext()) {
+          process(entry.first, &iter);
+        }
       }
     }
     store_->adviseAccessPattern(Store::AccessPattern::NORMAL);
   }
+  // Calls `process` for each key and an iterator over its values, which are
+  // the values of the list when it is visited.  A shard is only locked while
+  // its keys are collected, and values can be put concurrently, also by
+  // `process`.  Removing or replacing values of the list that is being
+  // visited waits until `process` returns, hence `process` must not do so
+  // for its own key.  Lists that have been spilled are visited first and may
+  // be visited twice if they are loaded back concurrently.  Updates of such
+  // lists are not visible to `process`.
 
   Stats getStats() const;
   // Returns various statistics about the partition.
   // The data is collected upon request and triggers a full partition scan.
 
+  Stats getCurrentStats() const;
+  // Same as `getStats()`, but returns running totals instead of visiting
+  // all lists, which makes the call cheap enough to be polled frequently.
+  // Only numbers of keys and values are provided, while sizes of keys and
+  // lists are zero.  Unlike `getStats()`, the totals also account for lists
+  // that are being updated during the call.
+
+  SampledStats getSampledStats(size_t num_samples) const;
+  // Same as `getCurrentStats()`, but also estimates the sizes of keys and
+  // lists from `num_samples` keys drawn uniformly at random with
+  // replacement, so that the cost of the call does not depend on the
+  // number of keys.  Keys with an empty list are drawn, but not counted.
+  // Lists that have been spilled are not sampled.  The sizes of a frozen
+  // partition are exact, since they are stored with it.
+
+  void checkpoint();
+  // Appends the lists that have been modified since the last checkpoint to
+  // the partition's delta file, so that they survive a crash without
+  // rewriting the keys file.  With a write-ahead log, updates are blocked
+  // meanwhile and the log is truncated afterwards, unless a modified list
+  // was locked and had to be skipped.  The delta file is merged into the
+  // keys file when the partition is closed and the delta has grown large
+  // compared to it.  Afterwards, empty lists are reclaimed, see
+  // `reclaimEmptyLists()`.
+
+  uint64_t snapshot(const boost::filesystem::path& prefix);
+  // Writes the current state of the partition as a new partition with the
+  // given prefix, which can be opened while this one continues to be used.
+  // Tail blocks are flushed and the lists are written to a new keys file
+  // together with its index, filter, and stats, while updates of the
+  // partition wait.  The values file is cloned via a reflink, if the file
+  // system supports it, so that updates are paused for milliseconds, and
+  // copied otherwise.  Existing files with the prefix are replaced.
+  // Returns the size of the change feed, if any, at the time of the copy,
+  // from which on a replica opened from it follows the feed, or zero.
+
+  uint64_t followChangeFeed(const boost::filesystem::path& feed_file,
+                            uint64_t offset, uint64_t* num_records);
+  // Applies the records of the change feed of another partition, starting
+  // at `offset`, and returns the offset after the last complete record.
+  // Adds the number of applied records to `num_records`, if not null.
+  // Records refer to values by position, so this partition must be a
+  // snapshot of the other one, taken at `offset`, that has only been
+  // updated by this function since.  Runs of puts to the same key are
+  // appended as a batch.  Concurrent calls are serialized.
+
+  size_t reclaimEmptyLists();
+  // Erases the keys whose lists are empty and have been written to the
+  // delta file since they became empty, and returns the memory of the keys
+  // and lists to the arena, which reuses it for keys inserted later.  Lists
+  // that are pinned or locked are skipped.  Returns the number of erased
+  // keys.  An indexed partition is left unchanged.
+
+  uint32_t removeExpiredLists();
+  // Removes all values of the keys whose deadline has passed and returns the
+  // number of such keys.  The deadlines are kept in a priority queue, so
+  // that the cost is proportional to the number of expired keys, not to the
+  // number of keys in the partition.
+
+  static uint32_t getCurrentTime();
+  // Returns the number of seconds since the epoch, to which deadlines are
+  // compared.
+
   bool isReadOnly() const { return store_->isReadOnly(); }
 
+  bool isIndexed() const { return index_ != nullptr; }
+
+  bool hasBloomFilter() const { return filter_ != nullptr; }
+
+  bool hasWriteAheadLog() const { return wal_ != nullptr; }
+
+  bool hasChangeFeed() const { return feed_ != nullptr; }
+  // Returns `true` if the partition was opened in read-only mode and keys are
+  // resolved lazily via the partition's index file.  Otherwise, all keys have
+  // been loaded into memory when the partition was opened.
+
   uint32_t getBlockSize() const { return store_->getBlockSize(); }
 
+  size_t flushColdLists(size_t max_num_tail_blocks);
+  // Flushes the tail blocks of tracked lists and returns their memory to the
+  // arena until at most `max_num_tail_blocks` are left.  Lists are visited
+  // in the order in which they allocated their tail block.  A list that has
+  // been appended to since its last visit gets a second chance and is moved
+  // to the back, which approximates flushing the least recently used lists
+  // first.  Returns the number of flushed lists.
+  // Requires: `Options::track_tail_blocks` is true.
+
+  size_t getNumTailBlocks() const;
+  // Returns the number of tracked lists that hold a tail block.
+
+  uint64_t compactLists(double min_removed_ratio, uint64_t max_num_bytes);
+  // Rewrites lists in which the share of removed values is at least
+  // `min_removed_ratio` into new blocks, until values of `max_num_bytes` in
+  // total have been rewritten, and returns that number.  The next call
+  // continues with the shard where this one has stopped.  Lists that are
+  // locked are skipped.  The blocks that are no longer used are reused for
+  // new blocks after the next checkpoint, or when the partition is opened
+  // the next time.  Has no effect if the partition is compressed.
+
+  std::vector<uint32_t> getFreeBlockIds() const;
+  // Returns the ids of blocks that are not used by any list, which are
+  // either reusable or wait for a checkpoint, in ascending order.
+
+  uint64_t getMemoryUsage() const;
+  // Returns the approximate number of bytes held by the keys and lists in
+  // memory, including their tail blocks.
+
+  MemoryUsage getMemoryBreakdown() const;
+  // Returns the number of bytes held by each component of the partition.
+  // Unlike `getMemoryUsage()`, all lists are visited.
+
+  void warmUp() const;
+  // Brings the blocks that were hot when the partition was closed the last
+  // time with `Options::warm_up_size` into memory, see `Store::prefetch()`.
+  // Does nothing if there are no such blocks.  Thread-safe, so that it can
+  // be called in the background while the partition is used.
+
+  std::vector<std::pair<std::string, uint64_t> > getHotKeys(size_t k) const {
+    return hot_keys_ ? hot_keys_->getTop(k)
+                     : std::vector<std::pair<std::string, uint64_t> >();
+  }
+  // Returns up to `k` of the most frequently accessed keys with their
+  // estimated number of recent accesses, most frequent first, or nothing
+  // if the partition has not been opened with `Options::hot_keys`.
+
+  size_t spillColdLists(uint64_t max_memory_usage);
+  // Writes lists that have not been modified since the last checkpoint to a
+  // new spill file and evicts them from memory, until the memory usage is
+  // about `max_memory_usage`, and returns the number of evicted lists.
+  // Lookups of evicted keys load their lists back from the spill files,
+  // newest first.  Lists that are dirty, pinned, locked, or have a deadline
+  // are skipped, hence a checkpoint should precede.  Since evicted lists are
+  // also in the keys or the delta file, spill files are not needed for
+  // recovery.  They are merged when there are more than a few, and into the
+  // keys file when the partition is closed, after which they are removed.
+
+  size_t getNumSpilledLists() const {
+    return num_spilled_lists_.load(std::memory_order_relaxed);
+  }
+
   // ---------------------------------------------------------------------------
   // Static member functions
   // ---------------------------------------------------------------------------
 
+  enum class ScanOrder { KEYS, BLOCKS };
+  // The order in which `forEachList()` visits the lists of a partition.
+  // KEYS is the order of the keys file.  BLOCKS visits the lists of each
+  // batch that is read ahead in the order of their first block, so that
+  // the values file is read mostly from front to back.
+
   template <typename BinaryProcedure>
   static void forEachEntry(const boost::filesystem::path& prefix,
-                           const Options& options, BinaryProcedure process) {
-    List list;
-    std::vector<char> key;
+                           const Options& options, BinaryProcedure process,
+                           ScanOrder order = ScanOrder::KEYS) {
+    forEachList(prefix, options,
+                [&process](const Bytes& key, const List& list,
+                           const Store& store) {
+                  List::SharedIterator iter(list, store);
+                  process(key, &iter);
+                },
+                order);
+  }
+  // Calls `process` for each key and an iterator over its values.
+
+  template <typename Procedure>
+  // Required interface:
+  // void process(const Bytes& key, const List& list, const Store& store);
+  static void forEachList(const boost::filesystem::path& prefix,
+                          const Options& options, Procedure process,
+                          ScanOrder order = ScanOrder::KEYS) {
     Store::Options store_options;
     store_options.readonly = true;
     store_options.block_size = options.block_size;
     store_options.buffer_size = options.buffer_size;
+    store_options.compress = options.compress;
+    store_options.front_coding = options.front_coding;
     Store store(getNameOfValuesFile(prefix.string()), store_options);
     store.adviseAccessPattern(Store::AccessPattern::WILLNEED);
+    std::unordered_map<std::string, std::unique_ptr<List> > delta;
+    const auto delta_file = getNameOfDeltaFile(prefix.string());
+    if (boost::filesystem::is_regular_file(delta_file)) {
+      uint64_t checkpoint_id = 0;
+      forEachDeltaEntry(delta_file, std::numeric_limits<uint64_t>::max(),
+                        [&delta](const Bytes& key, const char* list) {
+                          delta[key.toString()] = List::readFromBuffer(list);
+                        },
+                        &checkpoint_id);
+    }
     const auto stats = Stats::readFromFile(getNameOfStatsFile(prefix.string()));
     const auto keys_file = mt::fopen(getNameOfKeysFile(prefix.string()), "r");
-    for (size_t i = 0; i != stats.num_keys_valid; ++i) {
-      readBytesFromStream(keys_file.get(), &key);
-      List::readFromStream(keys_file.get(), &list);
-      const auto iter = list.newIterator(store);
-      process(Bytes(key.data(), key.size()), iter.get());
+    size_t num_keys_read = 0;
+    std::vector<char> key;
+    std::vector<uint32_t> block_ids;
+    const auto read_batch = [&](std::vector<ScanEntry>* batch) {
+      batch->clear();
+      block_ids.clear();
+      while (num_keys_read != stats.num_keys_valid &&
+             block_ids.size() < SCAN_READ_AHEAD_NUM_BLOCKS) {
+        ++num_keys_read;
+        readBytesFromStream(keys_file.get(), &key);
+        ScanEntry entry;
+        entry.key.assign(key.data(), key.size());
+        entry.list = List::readFromStream(keys_file.get());
+        const auto iter = delta.find(entry.key);
+        if (iter != delta.end()) {
+          entry.list = std::move(iter->second);
+          delta.erase(iter);
+          if (entry.list->empty()) continue;
+        }
+        const auto ids = entry.list->getBlockIdsUnlocked();
+        if (!ids.empty()) entry.first_block_id = ids.front();
+        block_ids.insert(block_ids.end(), ids.begin(), ids.end());
+        batch->push_back(std::move(entry));
+      }
+      std::sort(block_ids.begin(), block_ids.end());
+      store.readAhead(block_ids);
+    };
+    std::vector<ScanEntry> batch;
+    std::vector<ScanEntry> next_batch;
+    read_batch(&batch);
+    while (!batch.empty()) {
+      read_batch(&next_batch);
+      // The blocks of the next batch are read while this one is processed.
+      if (order == ScanOrder::BLOCKS) {
+        std::stable_sort(batch.begin(), batch.end(),
+                         [](const ScanEntry& a, const ScanEntry& b) {
+                           return a.first_block_id < b.first_block_id;
+                         });
+      }
+      for (const auto& entry : batch) {
+        process(Bytes(entry.key), *entry.list, store);
+      }
+      batch.swap(next_batch);
+    }
+    for (const auto& entry : delta) {
+      if (!entry.second->empty()) {
+        process(Bytes(entry.first), *entry.second, store);
+      }
     }
   }
+  // Calls `process` for each key, its list, and the store that holds the
+  // blocks of the list.  Lists in the delta file replace those in the keys
+  // file.  Lists are read from the keys file in batches of about
+  // `SCAN_READ_AHEAD_NUM_BLOCKS` blocks, whose reading is started via
+  // `Store::readAhead()` before the previous batch is processed, in sorted
+  // order of their ids.  With `ScanOrder::BLOCKS` the lists of a batch are
+  // visited by their first block as well.
+
+  static std::vector<uint32_t> getCorruptBlocks(
+      const boost::filesystem::path& prefix, const Options& options);
+  // Returns the ids of the blocks in the values file that do not match the
+  // checksums saved by the last writable store with `Options::checksums`.
+  // Throws `std::runtime_error` if there are no such checksums.
+
+  static std::vector<uint32_t> getInvalidBlocks(
+      const boost::filesystem::path& prefix, const Options& options);
+  // Reads the lists of the partition as `forEachList()` does and returns
+  // the ids of the blocks that are referenced by a list, but do not exist
+  // or belong to another list as well, together with those of lists whose
+  // values cannot be decoded or whose number does not match the stats of
+  // the list.  If the values file has checksums, blocks that do not match
+  // them are included.  The ids are sorted and unique.
 
+  static std::string getNameOfDeltaFile(const std::string& prefix);
+  static std::string getNameOfExpiryFile(const std::string& prefix);
+  static std::string getNameOfFeedFile(const std::string& prefix);
+  static std::string getNameOfFilterFile(const std::string& prefix);
+  static std::string getNameOfFreeBlocksFile(const std::string& prefix);
+  static std::string getNameOfHotBlocksFile(const std::string& prefix);
+  static std::string getNameOfIndexFile(const std::string& prefix);
   static std::string getNameOfKeysFile(const std::string& prefix);
   static std::string getNameOfStatsFile(const std::string& prefix);
+  static std::string getNameOfValueFilterFile(const std::string& prefix);
   static std::string getNameOfValuesFile(const std::string& prefix);
+  static std::string getNameOfWalFile(const std::string& prefix);
+  static std::string getNameOfSpillFile(const std::string& prefix,
+                                        uint64_t id);
 
  private:
+  struct ScanEntry {
+    std::string key;
+    std::unique_ptr<List> list;
+    uint32_t first_block_id = 0;
+  };
+  // A list that `forEachList()` has read ahead.
+
+  static const size_t SCAN_READ_AHEAD_NUM_BLOCKS = 4096;
+
   static void readBytesFromStream(std::FILE* stream, std::vector<char>* bytes) {
     uint32_t size;
     mt::fread(stream, &size, sizeof size);
@@ -238,48 +1046,580 @@ class Partition : public mt::Resource {
     mt::fread(stream, bytes->data(), bytes->size());
   }
 
-  template <typename Allocate>
-  static Bytes readBytesFromStream(std::FILE* stream, Allocate allocate) {
-    uint32_t size;
-    mt::fread(stream, &size, sizeof size);
-    char* data = allocate(size);
-    mt::fread(stream, data, size);
-    return Bytes(data, size);
-  }
-
   void writeBytesToStream(const Bytes& bytes, std::FILE* stream) const {
     const uint32_t size = bytes.size();
     mt::fwrite(stream, &size, sizeof size);
     mt::fwrite(stream, bytes.data(), bytes.size());
   }
 
-  List* getList(const Bytes& key) const {
-    ReaderLockGuard<boost::shared_mutex> lock(mutex_);
-    const auto iter = map_.find(key);
-    return (iter != map_.end()) ? iter->second.get() : nullptr;
+  typedef ProfiledMutexIfEnabled<boost::shared_mutex,
+                                 LockProfiler::LockClass::PARTITION>
+      ShardMutex;
+
+  struct Shard {
+    mutable ShardMutex mutex;
+    ListMap map;
+  };
+  // The lists are distributed over several shards, each of which is guarded
+  // by its own lock.  Lookups take a shared lock of a single shard, so that
+  // inserting a new key only blocks operations on keys of the same shard.
+
+  static const size_t NUM_SHARDS_LOG2 = 4;
+  static const size_t NUM_SHARDS = 1 << NUM_SHARDS_LOG2;
+
+  static size_t getShardIndex(size_t hash) {
+    return (hash >> (32 - NUM_SHARDS_LOG2)) & (NUM_SHARDS - 1);
+  }
+  // Uses the most significant bits of the lower half, since class ListMap
+  // uses the least significant bits to probe the table and class Map uses
+  // the upper half to select the partition, see `Map::getPartitionIndex()`.
+  // The lower half is also what remains of the hash value if `size_t` has
+  // only 32 bits.
+
+  Shard& getShard(size_t hash) const { return shards_[getShardIndex(hash)]; }
+
+  size_t getNumKeys() const;
+
+  std::vector<Bytes> getAllKeys() const;
+  // Returns the keys of all lists including those without values, which may
+  // get values later without changing the number of keys, unless they are
+  // reclaimed in between.
+
+  std::shared_ptr<const std::vector<Bytes> > getSortedKeysUnlocked() const;
+  // Requires: the caller holds `key_order_mutex_`, which keeps the keys
+  // from being reclaimed.
+
+  std::shared_ptr<const KeyDirectory> getKeyDirectory() const;
+
+  bool hasValues(const Bytes& key) const {
+    if (index_) return true;
+    const auto list = findList(hashKey(key));
+    return list && !isExpired(*list) && !list->empty();
+  }
+  // Returns `true` if the list of `key`, which is known to exist, is not
+  // empty.  The lists of the keys file of an indexed partition are never
+  // empty, and such a partition is read-only.
+
+  bool isSorted(const List::SharedIterator& iter) const {
+    return sorted_ && !iter.wasAppendedTo();
+  }
+  // Returns `true` if the values that `iter` yields are sorted.
+
+  class PinnedList {
+   public:
+    PinnedList() = default;
+
+    explicit PinnedList(List* list) : list_(list) {
+      if (list_) list_->pin();
+    }
+
+    PinnedList(PinnedList&& other) : list_(other.list_) {
+      other.list_ = nullptr;
+    }
+
+    PinnedList& operator=(PinnedList&& other) {
+      if (list_) list_->unpin();
+      list_ = other.list_;
+      other.list_ = nullptr;
+      return *this;
+    }
+
+    ~PinnedList() {
+      if (list_) list_->unpin();
+    }
+
+    operator List*() const { return list_; }
+
+    List* operator->() const { return list_; }
+
+   private:
+    List* list_ = nullptr;
+  };
+  // Pins a list for the lifetime of the object, so that it is not reclaimed
+  // while it is used without holding the lock of its shard, see
+  // `reclaimEmptyLists()`.  Must be created under that lock.
+
+  PinnedList getList(const Key& key) const {
+    if (hot_keys_) hot_keys_->record(key, key.hash());
+    auto list = findList(key);
+    if (list && isExpired(*list)) return PinnedList();
+    return list;
+  }
+  // Same as `findList()`, but an expired list is not found.  Counts as an
+  // access to `key`, see `Options::hot_keys`.
+
+  static bool isExpired(const List& list) {
+    const auto deadline = list.getDeadline();
+    return deadline != 0 && deadline <= getCurrentTime();
+  }
+
+  PinnedList findList(const Key& key) const {
+    LockProfiler::setCurrentKey(key);
+    if (filter_ && !filter_->mayContain(key.hash())) return PinnedList();
+    // Only an indexed partition has a filter, whose cache of lists is a
+    // subset of the keys file.
+    const size_t hash = key.hash();
+    {
+      auto& shard = getShard(hash);
+      ReaderLockGuard<ShardMutex> lock(shard.mutex);
+      if (const auto list = shard.map.find(key, hash)) {
+        return PinnedList(list);
+      }
+    }
+    if (index_) return PinnedList(getListFromIndex(key, key.hash()));
+    return PinnedList(getListFromSpillFiles(key, key.hash()));
   }
 
-  List* getListOrCreate(const Bytes& key) {
+  std::vector<PinnedList> getLists(const std::vector<Bytes>& keys,
+                                    const std::vector<uint64_t>& hashes,
+                                    const std::vector<size_t>& indices) const;
+
+  List* getListFromIndex(const Bytes& key, uint64_t hash) const;
+  // Looks up `key` in the index and caches the deserialized list in its
+  // shard.  The cached key refers to the mapped keys file and is not copied.
+
+  struct SpillFile {
+    std::string filename;
+    std::unique_ptr<KeyIndex> index;
+  };
+  // A spill file has the format of the keys file and is indexed the same
+  // way.  It may contain outdated lists of keys that are in memory again.
+
+  typedef std::vector<std::shared_ptr<const SpillFile> > SpillFiles;
+
+  std::shared_ptr<const SpillFiles> getSpillFiles() const {
+    std::lock_guard<std::mutex> lock(spill_files_mutex_);
+    return spill_files_;
+  }
+  // Returns the current spill files, oldest first.  The files are kept
+  // mapped until the partition is closed, so that keys read from them
+  // remain valid, even after they have been merged.
+
+  List* getListFromSpillFiles(const Bytes& key, uint64_t hash) const {
+    if (!has_spill_files_.load(std::memory_order_acquire)) return nullptr;
+    auto& shard = getShard(hash);
+    const auto lock = lockShardForUpdate(shard);
+    if (const auto list = shard.map.find(key, hash)) return list;
+    return loadSpilledListUnlocked(&shard, key, hash);
+  }
+
+  List* loadSpilledListUnlocked(Shard* shard, const Bytes& key,
+                                size_t hash) const;
+  // Inserts the list of `key` from the newest spill file that contains it
+  // into `shard`, or returns `nullptr` if there is none.
+  // Requires: the caller holds a writer lock of `shard`, which does not
+  // contain `key`.
+
+  template <typename Procedure>
+  void forEachSpilledList(bool skip_lists_in_memory, Procedure process) const {
+    if (!has_spill_files_.load(std::memory_order_acquire)) return;
+    const auto files = getSpillFiles();
+    for (auto file = files->rbegin(); file != files->rend(); ++file) {
+      (*file)->index->forEachRecord([&](const KeyIndex::Record& record) {
+        const auto hash = Key::hash(record.key, key_hash_);
+        for (auto newer = files->rbegin(); newer != file; ++newer) {
+          if ((*newer)->index->find(record.key, hash).list) return;
+        }
+        if (skip_lists_in_memory) {
+          const auto& shard = getShard(hash);
+          ReaderLockGuard<ShardMutex> lock(shard.mutex);
+          if (shard.map.find(record.key, hash)) return;
+        }
+        process(record.key, record.list);
+      });
+    }
+  }
+  // Calls `process` with the key and the serialized list of each record in
+  // the spill files that is not outdated by a newer spill file and, if
+  // `skip_lists_in_memory`, whose key is not in memory.
+
+  template <typename Predicate>
+  std::vector<Bytes> getSpilledKeys(Predicate predicate) const {
+    std::vector<Bytes> keys;
+    forEachSpilledList(true, [&](const Bytes& key, const char*) {
+      if (predicate(key)) keys.push_back(key);
+    });
+    return keys;
+  }
+
+  bool isSpilled(const Bytes& key, uint64_t hash) const;
+  // Returns `true` if `key` is in any spill file, including outdated ones.
+
+  static List::Stats readStatsOfList(const char* list) {
+    List::Stats stats;
+    std::memcpy(&stats, list, sizeof stats);
+    return stats;
+  }
+  // Needs to be synchronized with `List::writeToStream()`.
+
+  template <typename Predicate>
+  size_t eraseListsUnlocked(Shard* shard, Predicate predicate);
+  // Erases the entries of `shard` for which `predicate(key, list)` yields
+  // `true`, which must leave the list as newly constructed, and returns the
+  // memory of their keys to the arena.  Returns the number of erased keys.
+  // Requires: the caller holds `key_order_mutex_` and a writer lock of
+  // `shard`.
+
+  void mergeSpillFiles();
+  // Replaces all spill files by one that contains their current lists.
+  // Requires: the caller holds `checkpoint_mutex_`.
+
+  static void removeSpillFiles(const boost::filesystem::path& prefix);
+  // Removes all spill files of the partition, including those that are
+  // left over from a process that did not close the partition.
+
+  static const size_t MAX_NUM_SPILL_FILES = 8;
+
+  Key hashKey(const Bytes& key) const {
+    return Key(key, Key::hash(key, key_hash_));
+  }
+  // Hashes a key that has been read from one of the partition's own files.
+
+  PinnedList getListOrCreate(const Key& key) {
     MT_REQUIRE_LE(key.size(), Limits::maxKeySize());
-    WriterLockGuard<boost::shared_mutex> lock(mutex_);
-    const auto emplace_result = map_.emplace(key, std::unique_ptr<List>());
-    if (emplace_result.second) {
-      // Overrides the inserted key with a new deep copy.
-      const auto new_key_data = arena_.allocate(key.size());
-      std::memcpy(new_key_data, key.data(), key.size());
-      const auto old_key_ptr = const_cast<Bytes*>(&emplace_result.first->first);
-      *old_key_ptr = Bytes(new_key_data, key.size());
-      emplace_result.first->second.reset(new List());
+    LockProfiler::setCurrentKey(key);
+    const size_t hash = key.hash();
+    auto& shard = getShard(hash);
+    {
+      ReaderLockGuard<ShardMutex> lock(shard.mutex);
+      if (const auto list = shard.map.find(key, hash)) {
+        return PinnedList(list);
+      }
+    }
+    const auto lock = lockShardForUpdate(shard);
+    return PinnedList(getListOrCreateUnlocked(&shard, key, hash));
+  }
+
+  WriterLock<ShardMutex> lockShardForUpdate(const Shard& shard) const {
+    WriterLock<ShardMutex> lock(shard.mutex, TRY_TO_LOCK);
+    if (!lock) {
+      const Metrics::Timer timer(metrics_.get(),
+                                 Metrics::Operation::LOCK_WAIT);
+      lock.lock();
+    }
+    return lock;
+  }
+  // Acquires the writer lock of `shard` and records the time it had to be
+  // waited for, if at all.
+
+  List* getListOrCreateUnlocked(Shard* shard, const Bytes& key, size_t hash) {
+    if (const auto list = shard->map.find(key, hash)) return list;
+    if (const auto list = loadSpilledListUnlocked(shard, key, hash)) {
+      return list;
     }
-    return emplace_result.first->second.get();
+    // Inserts a deep copy of the key.
+    const auto new_key_data = arena_.allocate(key.size());
+    std::memcpy(new_key_data, key.data(), key.size());
+    num_keys_total_.fetch_add(1, std::memory_order_relaxed);
+    return shard->map.insert(Bytes(new_key_data, key.size()), hash);
   }
+  // Requires: the caller holds a writer lock of `shard`.
+
+  template <typename InputIter>
+  void append(const Key& key, List* list, InputIter first, InputIter last) {
+    List::Cap cap;
+    const auto cap_or_null = initCap(&cap);
+    const auto has_new_tail_block = update(
+        list,
+        [&] {
+          return list->append(first, last, store_.get(), &arena_, &counters_,
+                              cap_or_null);
+        },
+        [&](Wal* wal) {
+          uint64_t sequence_number = 0;
+          for (auto iter = first; iter != last; ++iter) {
+            sequence_number = wal->appendPut(key, *iter);
+          }
+          return logRetire(wal, key, cap, sequence_number);
+        });
+    releaseBlocks(cap.retired_block_ids);
+    if (has_new_tail_block && track_tail_blocks_) {
+      addTailList(list);
+    }
+  }
+
+  List::Cap* initCap(List::Cap* cap) const {
+    cap->max_size = max_values_per_key_;
+    return max_values_per_key_ != 0 ? cap : nullptr;
+  }
+  // Returns `cap` if puts cap lists, otherwise `nullptr`.
+
+  static uint64_t logRetire(Wal* wal, const Bytes& key, const List::Cap& cap,
+                            uint64_t sequence_number) {
+    return cap.num_entries_retired != 0
+               ? wal->appendRetire(key, cap.num_entries_retired)
+               : sequence_number;
+  }
+  // Logs the values retired by an append, if any, behind its values, and
+  // returns the sequence number of the last record.
+
+  struct TailList {
+    List* list;
+    uint32_t num_values_total;
+    // Number of values in the list when it was visited last.
+  };
+
+  void addTailList(List* list);
+
+  static const size_t NUM_WAL_MUTEXES = 64;
+
+  std::mutex& getWalMutex(const List* list) {
+    return wal_mutexes_[std::hash<const List*>()(list) % NUM_WAL_MUTEXES];
+  }
+
+  bool isLogged() const { return wal_ || feed_; }
+  // Returns whether updates are recorded by position.
+
+  template <typename Apply, typename Log>
+  auto update(List* list, Apply apply, Log log) -> decltype(apply()) {
+    if (!wal_) {
+      const Gate::Pass pass(&update_gate_);
+      if (!feed_) return apply();
+      std::unique_lock<std::mutex> lock(getWalMutex(list));
+      const auto result = apply();
+      const auto sequence_number = log(feed_.get());
+      lock.unlock();
+      feed_->commit(sequence_number);
+      return result;
+    }
+    ReaderLock<boost::shared_mutex> checkpoint_lock(checkpoint_update_mutex_);
+    std::unique_lock<std::mutex> lock(getWalMutex(list));
+    const auto result = apply();
+    const auto sequence_number = log(wal_.get());
+    const auto feed_sequence_number = feed_ ? log(feed_.get()) : 0;
+    lock.unlock();
+    checkpoint_lock.unlock();
+    wal_->commit(sequence_number);
+    if (feed_) feed_->commit(feed_sequence_number);
+    return result;
+  }
+  // Calls `apply`, which updates `list`.  If there is a write-ahead log,
+  // the update is recorded via `log`, which returns the sequence number of
+  // the last record, and the call blocks until it has been committed.  The
+  // same goes for the change feed, which is written but not synced.
+  // Updates of the same list are recorded in the order they are applied,
+  // which is what replaying them by position relies on.  A checkpoint
+  // cannot start in between, see `checkpoint()`.  Without a log, a snapshot
+  // waits for ongoing updates via `update_gate_` instead.
+
+  void writeHotBlocks() const;
+  // Writes the ids of hot blocks, see `Options::warm_up_size`.
+
+  void writeSnapshot(const boost::filesystem::path& prefix);
+  // Requires: the caller holds `checkpoint_mutex_` and shared locks of all
+  // shards, and updates are blocked.
+
+  uint32_t replace(const Key& key, const Bytes& old_value,
+                   const Bytes& new_value, bool all) {
+    mt::Check::isFalse(isReadOnly(), ATTEMPT_TO_MODIFY_READ_ONLY_PARTITION);
+    const auto list = getList(key);
+    if (!list) return 0;
+    std::vector<uint32_t> positions;
+    const auto positions_or_null = isLogged() ? &positions : nullptr;
+    return update(
+        list,
+        [&] {
+          return all ? list->replaceAll(old_value, new_value, store_.get(),
+                                        &arena_, positions_or_null, &counters_)
+                     : list->replaceOne(old_value, new_value, store_.get(),
+                                        &arena_, positions_or_null,
+                                        &counters_);
+        },
+        [&](Wal* wal) {
+          uint64_t sequence_number = 0;
+          if (List::isReplacedInPlace(old_value, new_value, *store_)) {
+            for (const auto position : positions) {
+              sequence_number = wal->appendReplace(key, position, new_value);
+            }
+            return sequence_number;
+          }
+          sequence_number = logUpdate(wal, key, positions, {});
+          for (size_t i = 0; i != positions.size(); ++i) {
+            sequence_number = wal->appendPut(key, new_value);
+          }
+          return sequence_number;
+        });
+  }
+  // Replaces values without copying `new_value` for each match, as the
+  // versions that take a function have to.  Values of the same size are
+  // overwritten in place, which is logged as such.
+
+  uint32_t clear(const Bytes& key, List* list) {
+    if (list->getDeadline() != 0) {
+      deadlines_changed_ = true;
+    }
+    std::vector<uint32_t> block_ids;
+    const auto num_removed =
+        update(list,
+               [this, list, &block_ids] {
+                 return list->clear(&block_ids, &counters_, &arena_);
+               },
+               [&key](Wal* wal) { return wal->appendClear(key); });
+    releaseBlocks(block_ids);
+    return num_removed;
+  }
+
+  void releaseBlocks(const std::vector<uint32_t>& block_ids);
+  // Adds `block_ids`, which are no longer used by any list, to the blocks
+  // that become reusable after the next checkpoint.
+
+  void addDeadline(const Bytes& key, uint32_t deadline) {
+    if (deadline != 0) {
+      std::lock_guard<std::mutex> lock(deadlines_mutex_);
+      deadlines_.emplace(deadline, key.toString());
+    }
+    deadlines_changed_ = true;
+  }
+
+  void readDeadlines(const std::string& file);
+
+  void writeDeadlines(bool sync_file) const;
+  // Writes the deadlines of all lists to the expiry file, which is read
+  // when the partition is opened, or removes the file if there are none.
+  // Requires: the caller prevents concurrent updates.
+
+  static uint64_t logUpdate(Wal* wal, const Bytes& key,
+                            const std::vector<uint32_t>& removed_positions,
+                            const std::vector<std::string>& appended_values) {
+    uint64_t sequence_number = 0;
+    for (const auto position : removed_positions) {
+      sequence_number = wal->appendRemove(key, position);
+    }
+    for (const auto& value : appended_values) {
+      sequence_number = wal->appendPut(key, value);
+    }
+    return sequence_number;
+  }
+
+  template <typename Function>
+  std::function<std::string(const Bytes&)> makeLoggingMap(
+      Function map, std::vector<std::string>* new_values) const {
+    if (!isLogged()) return map;
+    return [map, new_values](const Bytes& value) {
+      auto new_value = map(value);
+      if (!new_value.empty()) {
+        new_values->push_back(new_value);
+      }
+      return new_value;
+    };
+  }
+  // Returns `map` that additionally collects the values it replaces with.
+
+  void replayWal(const std::string& wal_file);
+
+  typedef std::unordered_map<std::string, uint32_t> NumMarkedByKey;
+
+  void applyRecord(const Wal::Record& record, List* list,
+                   NumMarkedByKey* num_marked_by_key,
+                   List::Counters* counters);
+  // Applies a record of the write-ahead log or a change feed to `list`,
+  // which belongs to `record.key`.  `num_marked_by_key` holds the number of
+  // values per key that have been retired, but are still in front of the
+  // list, since they were marked as removed, see `List::retire()`.  Logged
+  // positions are shifted by their number.
+
+  void applyPuts(const Bytes& key, const std::vector<std::string>& values);
+  // Appends `values` to the list of `key` as a replica of a change feed.
+
+  bool writeDelta(bool sync_files);
+  // Appends the dirty lists and a batch trailer to the delta file, unless
+  // there are none.  Returns `false` if a dirty list was locked and skipped.
+  // Requires: the caller holds shared locks of all shards.
+
+  bool shouldSyncFiles(bool closing) const;
+  // Returns whether the files written by a checkpoint or, if `closing`, by
+  // the destructor are to be forced to stable storage.
+
+  bool shouldCompact() const;
+  // Returns `true` if closing the partition should rewrite the keys file
+  // rather than append the dirty lists to the delta file.
+
+  static const uint32_t DELTA_BATCH_END = 0xFFFFFFFF;
+  // The delta file consists of batches, one per checkpoint.  Each batch is a
+  // sequence of entries in the format of the keys file, terminated by this
+  // value, which is not a valid key size, followed by a 64-bit batch id.
+  // Batch ids start at 1 and increase by one until the file is merged.
+
+  static uint64_t forEachDeltaEntry(
+      const std::string& file, uint64_t max_checkpoint_id,
+      const std::function<void(const Bytes& key, const char* list)>& process,
+      uint64_t* checkpoint_id);
+  // Calls `process` for each entry of all complete batches with an id not
+  // greater than `max_checkpoint_id` and returns the size of these batches.
+  // `list` is in the format read by `List::readFromBuffer()`.  The id of the
+  // last batch processed is stored in `checkpoint_id`.
+
+  static void completeCheckpoint(const std::string& prefix, bool has_wal);
+  // A full checkpoint is first written to new files.  These replace the
+  // current ones, and the delta file is removed, once the new stats file,
+  // which is written last, exists and the log, if any, has been removed.
+  // This is the point at which the checkpoint becomes valid.
 
-  mutable boost::shared_mutex mutex_;
-  std::unordered_map<Bytes, std::unique_ptr<List> > map_;
+  mutable Shard shards_[NUM_SHARDS];
+  std::unique_ptr<KeyIndex> index_;
+  std::unique_ptr<BloomFilter> filter_;
+  std::unique_ptr<BloomFilter> value_filter_;
   std::unique_ptr<Store> store_;
-  Arena arena_;
+  mutable Arena arena_;
+  // Mutable, since lookups load spilled lists, see `spillColdLists()`.
   Stats stats_;
+  std::shared_ptr<Metrics> metrics_;
+  List::Counters counters_;
+  // Running totals of the stats of all lists, see `getCurrentStats()`.
+  std::atomic<uint64_t> num_keys_total_{0};
+  mutable std::mutex key_order_mutex_;
+  mutable std::shared_ptr<const std::vector<Bytes> > sorted_keys_;
+  mutable std::shared_ptr<const KeyDirectory> key_directory_;
+  mutable uint64_t sorted_keys_num_keys_ = 0;
+  mutable uint64_t key_directory_num_keys_ = 0;
+  // The values of `num_keys_total_` when the array and the directory were
+  // built, both of which are guarded by `key_order_mutex_`.
   boost::filesystem::path prefix_;
+  mutable std::mutex tail_lists_mutex_;
+  std::deque<TailList> tail_lists_;
+  typedef std::pair<uint32_t, std::string> Deadline;
+  std::mutex deadlines_mutex_;
+  std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline> >
+      deadlines_;
+  // The deadlines of lists with their keys, earliest first.  An entry is
+  // skipped if the deadline of its key has been changed since.
+  std::atomic<bool> deadlines_changed_{false};
+  // Whether the expiry file is outdated.
+  bool track_tail_blocks_ = false;
+  uint32_t max_values_per_key_ = 0;
+  bool sorted_ = false;
+  KeyHash key_hash_ = KeyHash::XXH64;
+  double bloom_filter_false_positive_rate_ = 0;
+  Store::Durability durability_ = Store::Durability::NONE;
+  std::function<void(const Timings&)> on_close_;
+  std::unique_ptr<Wal> wal_;
+  std::unique_ptr<Wal> feed_;
+  std::unique_ptr<HotKeys> hot_keys_;
+  uint64_t warm_up_size_ = 0;
+  std::mutex wal_mutexes_[NUM_WAL_MUTEXES];
+  std::mutex follow_mutex_;
+  NumMarkedByKey followed_num_marked_;
+  // Guarded by `follow_mutex_`, see `followChangeFeed()`.
+  boost::shared_mutex checkpoint_update_mutex_;
+  Gate update_gate_;
+  std::mutex checkpoint_mutex_;
+  std::mutex compaction_mutex_;
+  size_t compaction_shard_ = 0;
+  mutable std::mutex released_block_ids_mutex_;
+  std::vector<uint32_t> released_block_ids_;
+  // Blocks that compacted lists no longer use, but which are still referenced
+  // by the last checkpoint, so that they cannot be reused before the next.
+  uint64_t checkpoint_id_ = 0;
+  // The id of the last batch in the delta file.
+  mutable std::mutex spill_files_mutex_;
+  std::shared_ptr<const SpillFiles> spill_files_ =
+      std::make_shared<const SpillFiles>();
+  std::vector<std::shared_ptr<const SpillFile> > retired_spill_files_;
+  // Merged spill files, which are no longer consulted.
+  std::atomic<bool> has_spill_files_{false};
+  mutable std::atomic<size_t> num_spilled_lists_{0};
+  // Number of evicted lists, which are only in the spill files.
+  uint64_t next_spill_file_id_ = 0;
 };
 
 }  // namespace internal
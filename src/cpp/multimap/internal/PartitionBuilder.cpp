@@ -0,0 +1,169 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/PartitionBuilder.hpp"
+
+#include <boost/filesystem/operations.hpp>
+#include "multimap/internal/Base64.hpp"
+#include "multimap/internal/Partition.hpp"
+
+namespace multimap {
+namespace internal {
+
+PartitionBuilder::PartitionBuilder(const boost::filesystem::path& prefix,
+                                   const Options& options)
+    : bloom_filter_false_positive_rate_(
+          options.bloom_filter_false_positive_rate),
+      value_filter_false_positive_rate_(
+          options.value_filter_false_positive_rate),
+      prefix_(prefix) {
+  const auto stats_filename = Partition::getNameOfStatsFile(prefix.string());
+  mt::Check::isFalse(boost::filesystem::exists(stats_filename),
+                     "Partition '%s' already exists", prefix.c_str());
+  Store::Options store_options;
+  store_options.block_size = options.block_size;
+  store_options.buffer_size = options.buffer_size;
+  store_options.compress = options.compress;
+  store_options.front_coding = options.front_coding;
+  const auto values_filename = Partition::getNameOfValuesFile(prefix.string());
+  store_.reset(new Store(values_filename, store_options));
+  const auto keys_filename = Partition::getNameOfKeysFile(prefix.string());
+  keys_file_ = mt::fopen(keys_filename, "w");
+  keys_file_buffer_.reset(new char[options.buffer_size]);
+  std::setvbuf(keys_file_.get(), keys_file_buffer_.get(), _IOFBF,
+               options.buffer_size);
+  stats_.block_size = store_->getBlockSize();
+}
+
+PartitionBuilder::~PartitionBuilder() {
+  if (!finished()) {
+    finish();
+  }
+}
+
+void PartitionBuilder::put(const Bytes& key, const Bytes& value) {
+  MT_REQUIRE_FALSE(finished());
+  if (!list_ || key != key_) {
+    beginList(key);
+  }
+  list_->append(value, store_.get(), &list_arena_);
+  if (value_filter_false_positive_rate_ != 0) {
+    value_filter_builder_.add(key_, value);
+  }
+}
+
+void PartitionBuilder::put(const Bytes& key, const List& list,
+                           const Store& store) {
+  MT_REQUIRE_FALSE(finished());
+  const auto stats = list.getStats();
+  const auto copy_blocks =
+      stats.num_values_removed == 0 && value_filter_false_positive_rate_ == 0 &&
+      store.getBlockSize() == store_->getBlockSize() &&
+      store.hasFrontCodedValues() == store_->hasFrontCodedValues();
+  if (!copy_blocks) {
+    List::SharedIterator iter(list, store);
+    while (iter.hasNext()) {
+      put(key, iter.next());
+    }
+    return;
+  }
+  if (stats.num_values_total == 0) return;
+  beginList(key);
+  list_ = list.copyBlocks(store, store_.get());
+}
+
+void PartitionBuilder::beginList(const Bytes& key) {
+  MT_REQUIRE_LE(key.size(), Partition::Limits::maxKeySize());
+  finishCurrentList();
+  const auto key_data = key_arena_.allocate(key.size());
+  std::memcpy(key_data, key.data(), key.size());
+  key_ = Bytes(key_data, key.size());
+  mt::Check::isTrue(keys_.insert(key_).second,
+                    "Values of key '%s' (Base64) are not consecutive",
+                    Base64::encode(key).c_str());
+  list_.reset(new List());
+  first_block_id_ = store_->getNumBlocks();
+}
+
+void PartitionBuilder::finish() {
+  MT_REQUIRE_FALSE(finished());
+  finishCurrentList();
+  if (stats_.num_keys_valid) {
+    stats_.key_size_avg /= stats_.num_keys_valid;
+    stats_.list_size_avg /= stats_.num_keys_valid;
+  }
+  stats_.num_blocks = store_->getNumBlocks();
+  stats_.num_keys_total = keys_.size();
+  const auto keys_file_size = mt::ftell(keys_file_.get());
+  keys_file_.reset();
+  store_.reset();  // Destructor flushes all data to disk.
+  index_builder_.writeToFile(
+      Partition::getNameOfIndexFile(prefix_.string()), keys_file_size);
+  if (bloom_filter_false_positive_rate_ != 0) {
+    filter_builder_.writeToFile(
+        Partition::getNameOfFilterFile(prefix_.string()),
+        stats_.num_keys_valid, keys_file_size,
+        bloom_filter_false_positive_rate_);
+  }
+  if (value_filter_false_positive_rate_ != 0) {
+    value_filter_builder_.writeToFile(
+        Partition::getNameOfValueFilterFile(prefix_.string()),
+        stats_.num_keys_valid, keys_file_size,
+        value_filter_false_positive_rate_);
+  }
+  stats_.writeToFile(Partition::getNameOfStatsFile(prefix_.string()));
+}
+
+void PartitionBuilder::finishCurrentList() {
+  if (!list_) return;
+  List::Stats list_stats;
+  list_->flush(store_.get(), &list_stats);
+  uint64_t num_blocks = 0;
+  for (auto cursor = list_->getBlockIdCursorUnlocked(); cursor.hasNext();
+       ++num_blocks) {
+    MT_ASSERT_EQ(cursor.next(), first_block_id_ + num_blocks);
+  }
+  MT_ASSERT_EQ(store_->getNumBlocks(), first_block_id_ + num_blocks);
+  // No other list has put blocks in between.
+  const auto list_size = list_stats.num_values_valid();
+  stats_.num_values_total += list_stats.num_values_total;
+  stats_.num_values_valid += list_size;
+  ++stats_.num_keys_valid;
+  stats_.key_size_avg += key_.size();
+  stats_.key_size_max = mt::max(stats_.key_size_max, key_.size());
+  stats_.key_size_min = stats_.key_size_min
+                            ? mt::min(stats_.key_size_min, key_.size())
+                            : key_.size();
+  stats_.list_size_avg += list_size;
+  stats_.list_size_max = mt::max(stats_.list_size_max, list_size);
+  stats_.list_size_min = stats_.list_size_min
+                             ? mt::min(stats_.list_size_min, list_size)
+                             : list_size;
+  index_builder_.add(key_, mt::ftell(keys_file_.get()));
+  if (bloom_filter_false_positive_rate_ != 0) filter_builder_.add(key_);
+  const uint32_t key_size = key_.size();
+  mt::fwrite(keys_file_.get(), &key_size, sizeof key_size);
+  mt::fwrite(keys_file_.get(), key_.data(), key_.size());
+  list_->writeToStream(keys_file_.get());
+  list_.reset();
+  list_arena_.deallocateAll();
+  // The list's block was allocated from `list_arena_` and is not needed
+  // anymore, so that memory usage does not grow with the number of keys.
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,107 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_PARTITION_BUILDER_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_PARTITION_BUILDER_HPP_INCLUDED
+
+#include <memory>
+#include <unordered_set>
+#include <boost/filesystem/path.hpp>
+#include "multimap/internal/Arena.hpp"
+#include "multimap/internal/BloomFilter.hpp"
+#include "multimap/internal/KeyIndex.hpp"
+#include "multimap/internal/List.hpp"
+#include "multimap/internal/Stats.hpp"
+#include "multimap/internal/Store.hpp"
+#include "multimap/thirdparty/mt/mt.hpp"
+
+namespace multimap {
+namespace internal {
+
+class PartitionBuilder : public mt::Resource {
+  // Writes a new partition from input whose values are grouped by key, i.e.
+  // all values of a key must be put consecutively.  In contrast to
+  // `Partition::put()` no locks are taken and only the list of the current
+  // key is held in memory, so the values, keys and stats files are written
+  // sequentially.  Hence the blocks of each list are consecutive in the
+  // values file and lists appear in the same order as in the keys file,
+  // which is checked when a list is finished.  The result can be opened as
+  // a regular `Partition`.
+  // Objects of this class are not thread-safe.
+
+ public:
+  struct Options {
+    uint32_t block_size = 512;
+    uint32_t buffer_size = mt::MiB(1);
+    bool compress = false;
+    bool front_coding = false;
+    double bloom_filter_false_positive_rate = 0;
+    // See `Partition::Options`.
+
+    double value_filter_false_positive_rate = 0;
+    // If not zero, a Bloom filter of all pairs of keys and values with this
+    // false-positive rate is written, see `Partition::mayContainValue()`.
+  };
+
+  PartitionBuilder(const boost::filesystem::path& prefix,
+                   const Options& options);
+
+  ~PartitionBuilder();
+  // Calls `finish()` if not already done.
+
+  void put(const Bytes& key, const Bytes& value);
+  // Throws if `key` has already been completed, i.e. if another key
+  // was put in between.
+
+  void put(const Bytes& key, const List& list, const Store& store);
+  // Puts all values of `list`, whose blocks are stored in `store`.  If the
+  // list has no removed values and `store` has the same block size and
+  // value encoding, its blocks are copied without decoding the values.
+  // Throws if `key` has already been put.
+
+  void finish();
+  // Writes all remaining data to disk.  No more values can be put afterwards.
+
+  bool finished() const { return store_ == nullptr; }
+
+ private:
+  void beginList(const Bytes& key);
+  void finishCurrentList();
+
+  std::unique_ptr<Store> store_;
+  std::unique_ptr<List> list_;
+  std::unordered_set<Bytes> keys_;
+  KeyIndex::Builder index_builder_;
+  BloomFilter::Builder filter_builder_;
+  BloomFilter::Builder value_filter_builder_;
+  double bloom_filter_false_positive_rate_ = 0;
+  double value_filter_false_positive_rate_ = 0;
+  std::unique_ptr<char[]> keys_file_buffer_;
+  mt::AutoCloseFile keys_file_;
+  Arena list_arena_;
+  Arena key_arena_;
+  Bytes key_;
+  uint64_t first_block_id_ = 0;
+  // Id of the first block of the current list.
+  Stats stats_;
+  boost::filesystem::path prefix_;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_PARTITION_BUILDER_HPP_INCLUDED
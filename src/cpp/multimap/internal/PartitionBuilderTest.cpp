@@ -0,0 +1,149 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <type_traits>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/internal/Generator.hpp"
+#include "multimap/internal/Partition.hpp"
+#include "multimap/internal/PartitionBuilder.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+
+TEST(PartitionBuilderTest, IsNotDefaultConstructible) {
+  ASSERT_FALSE(std::is_default_constructible<PartitionBuilder>::value);
+}
+
+TEST(PartitionBuilderTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<PartitionBuilder>::value);
+  ASSERT_FALSE(std::is_copy_assignable<PartitionBuilder>::value);
+}
+
+struct PartitionBuilderTestFixture : public testing::Test {
+  void SetUp() override {
+    boost::filesystem::remove_all(directory);
+    MT_ASSERT_TRUE(boost::filesystem::create_directory(directory));
+  }
+
+  void TearDown() override { boost::filesystem::remove_all(directory); }
+
+  const boost::filesystem::path directory =
+      "/tmp/multimap.PartitionBuilderTestFixture";
+  const boost::filesystem::path prefix = directory / "partition";
+};
+
+TEST_F(PartitionBuilderTestFixture, ConstructorThrowsIfPartitionExists) {
+  Partition::Options options;
+  Partition(prefix, options).put("key", "value");
+  ASSERT_THROW(PartitionBuilder(prefix, PartitionBuilder::Options()),
+               std::runtime_error);
+}
+
+TEST_F(PartitionBuilderTestFixture, PutThrowsIfValuesAreNotConsecutive) {
+  PartitionBuilder builder(prefix, PartitionBuilder::Options());
+  builder.put("a", "1");
+  builder.put("b", "1");
+  ASSERT_THROW(builder.put("a", "2"), std::runtime_error);
+}
+
+TEST_F(PartitionBuilderTestFixture, BuiltPartitionCanBeOpenedAndRead) {
+  const size_t num_keys = 1000;
+  const size_t block_size = 128;
+  SequenceGenerator generator;
+  {
+    PartitionBuilder::Options options;
+    options.block_size = block_size;
+    options.buffer_size = block_size * 4;
+    PartitionBuilder builder(prefix, options);
+    for (size_t k = 0; k != num_keys; ++k) {
+      for (size_t v = 0; v != k % 10; ++v) {
+        builder.put(std::to_string(k), generator.generate(k % 300));
+      }
+    }
+  }
+  Partition::Options options;
+  options.readonly = true;
+  Partition partition(prefix, options);
+  const auto stats = partition.getStats();
+  ASSERT_THAT(stats.block_size, Eq(block_size));
+  ASSERT_THAT(stats.num_keys_valid, Eq(num_keys - num_keys / 10));
+  ASSERT_THAT(stats.list_size_max, Eq(9));
+  ASSERT_THAT(stats.list_size_min, Eq(1));
+
+  generator.reset();
+  for (size_t k = 0; k != num_keys; ++k) {
+    auto iter = partition.get(std::to_string(k));
+    if (k % 10 == 0) {
+      ASSERT_TRUE(iter == nullptr);
+      continue;
+    }
+    ASSERT_THAT(iter->available(), Eq(k % 10));
+    while (iter->hasNext()) {
+      ASSERT_THAT(iter->next(), Eq(generator.generate(k % 300)));
+    }
+  }
+}
+
+TEST_F(PartitionBuilderTestFixture, ListsAreWrittenConsecutivelyInKeyOrder) {
+  // Values are put round-robin, so that the blocks of the source lists are
+  // interleaved.  The copy is built once by decoding values and once by
+  // copying blocks.
+  const auto source_prefix = directory / "source";
+  {
+    Partition partition(source_prefix, Partition::Options());
+    for (size_t v = 0; v != 50; ++v) {
+      for (size_t k = 0; k != 100; ++k) {
+        partition.put(std::to_string(k), std::string(k % 50 + 1, 'v'));
+      }
+    }
+  }
+  Partition::Options source_options;
+  source_options.readonly = true;
+  for (const auto block_size : {128, 512}) {
+    boost::filesystem::remove(Partition::getNameOfStatsFile(prefix.string()));
+    boost::filesystem::remove(Partition::getNameOfValuesFile(prefix.string()));
+    {
+      PartitionBuilder::Options options;
+      options.block_size = block_size;
+      PartitionBuilder builder(prefix, options);
+      Partition::forEachList(
+          source_prefix, source_options,
+          [&builder](const Bytes& key, const List& list, const Store& store) {
+            builder.put(key, list, store);
+          },
+          Partition::ScanOrder::BLOCKS);
+    }
+    uint32_t next_block_id = 0;
+    size_t num_keys = 0;
+    Partition::forEachList(
+        prefix, source_options,
+        [&](const Bytes&, const List& list, const Store&) {
+          for (const auto id : list.getBlockIdsUnlocked()) {
+            ASSERT_THAT(id, Eq(next_block_id++));
+          }
+          ++num_keys;
+        });
+    ASSERT_THAT(num_keys, Eq(100));
+    ASSERT_THAT(next_block_id, testing::Gt(100));
+  }
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -15,10 +15,13 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <cmath>
+#include <limits>
 #include <thread>
 #include <type_traits>
 #include <boost/filesystem/operations.hpp>
 #include "gmock/gmock.h"
+#include "multimap/internal/Benchmark.hpp"
 #include "multimap/internal/Partition.hpp"
 #include "multimap/callables.hpp"
 
@@ -26,7 +29,11 @@ namespace multimap {
 namespace internal {
 
 using testing::Eq;
+using testing::Ge;
+using testing::Gt;
+using testing::Lt;
 using testing::ElementsAre;
+using testing::ElementsAreArray;
 using testing::UnorderedElementsAre;
 
 std::unique_ptr<Partition> openPartition(const boost::filesystem::path& prefix,
@@ -224,6 +231,31 @@ TEST_F(PartitionTestFixture, RemoveAllKeysRemovesAllMatches) {
   ASSERT_TRUE(partition->get(k3)->hasNext());
 }
 
+TEST_F(PartitionTestFixture, RemoveAllInChunksRemovesMatchesOfExistingKeys) {
+  auto partition = openOrCreatePartition(prefix);
+  for (size_t i = 0; i != 1000; ++i) {
+    partition->put(std::to_string(i), v1);
+  }
+  const auto is_even = [](const Bytes& key) {
+    return std::stoul(key.toString()) % 2 == 0;
+  };
+  std::thread writer([&] {
+    for (size_t i = 1000; i != 2000; ++i) {
+      partition->put(std::to_string(i), v1);
+    }
+  });
+  const auto result = partition->removeAllInChunks(is_even, 7);
+  writer.join();
+  ASSERT_THAT(result.first, Ge(500));
+  ASSERT_THAT(result.second, Eq(result.first));
+  for (size_t i = 0; i != 1000; ++i) {
+    ASSERT_THAT(partition->get(std::to_string(i))->hasNext(), Eq(i % 2 != 0));
+  }
+  // Keys that had no values left are not counted again.
+  ASSERT_THAT(partition->removeAllInChunks(is_even, 1).first,
+              Eq(1000 - result.first));
+}
+
 TEST_F(PartitionTestFixture, RemoveOneValueRemovesFirstMatch) {
   auto partition = openOrCreatePartition(prefix);
   partition->put(k1, v1);
@@ -430,6 +462,49 @@ TEST_F(PartitionTestFixture, ForEachEntryIgnoresEmptyLists) {
   ASSERT_THAT(mapping.at(k3), ElementsAre(v1, v2, v3));
 }
 
+TEST_F(PartitionTestFixture, ForEachEntryAllowsPutsOfNewKeysWhileScanning) {
+  auto partition = openOrCreatePartition(prefix);
+  const size_t num_values = 1000;
+  for (size_t i = 0; i != num_values; ++i) {
+    partition->put(k1, std::to_string(i));
+    partition->put(k2, std::to_string(i));
+  }
+  size_t num_values_seen = 0;
+  partition->forEachEntry([&](const Bytes& key, Iterator* iter) {
+    if (key != k1 && key != k2) return;
+    for (size_t i = 0; iter->hasNext(); ++i) {
+      ASSERT_THAT(iter->next().toString(), Eq(std::to_string(i)));
+      partition->put(key.toString() + std::to_string(i), v1);
+      ++num_values_seen;
+    }
+  });
+  ASSERT_THAT(num_values_seen, Eq(2 * num_values));
+  for (size_t i = 0; i != num_values; ++i) {
+    ASSERT_TRUE(partition->contains(k1 + std::to_string(i)));
+    ASSERT_TRUE(partition->contains(k2 + std::to_string(i)));
+  }
+}
+
+TEST_F(PartitionTestFixture, ForEachEntryIteratesSnapshotsWhileValuesArePut) {
+  auto partition = openOrCreatePartition(prefix);
+  const size_t num_values = 1000;
+  for (size_t i = 0; i != num_values; ++i) {
+    partition->put(k1, std::to_string(i));
+    partition->put(k2, std::to_string(i));
+  }
+  size_t num_values_seen = 0;
+  partition->forEachEntry([&](const Bytes& key, Iterator* iter) {
+    for (size_t i = 0; iter->hasNext(); ++i) {
+      ASSERT_THAT(iter->next().toString(), Eq(std::to_string(i)));
+      ++num_values_seen;
+      partition->put(key, v1);
+    }
+  });
+  ASSERT_THAT(num_values_seen, Eq(2 * num_values));
+  ASSERT_THAT(partition->get(k1)->available(), Eq(2 * num_values));
+  ASSERT_THAT(partition->get(k2)->available(), Eq(2 * num_values));
+}
+
 TEST_F(PartitionTestFixture, GetStatsReturnsCorrectValues) {
   auto partition = openOrCreatePartition(prefix);
   partition->put("k", "vvvvv");
@@ -552,6 +627,74 @@ TEST_F(PartitionTestFixture, GetStatsReturnsCorrectValuesAfterRemovingValues) {
   ASSERT_THAT(stats.num_values_valid, Eq(12));
 }
 
+TEST_F(PartitionTestFixture, GetSampledStatsEstimatesSizesOfKeysAndLists) {
+  auto partition = openOrCreatePartition(prefix);
+  ASSERT_THAT(partition->getSampledStats(100).num_samples, Eq(0));
+  for (int k = 0; k != 1000; ++k) {
+    const auto key = std::string(1 + k % 2, 'k') + std::to_string(k);
+    for (int v = 0; v <= k % 4; ++v) {
+      partition->put(key, std::to_string(v));
+    }
+  }
+  partition->put("empty", "x");
+  partition->remove("empty");
+
+  const auto stats = partition->getStats();
+  const auto sampled = partition->getSampledStats(10000);
+  ASSERT_THAT(sampled.num_samples, testing::Le(10000));
+  ASSERT_THAT(sampled.num_samples, Gt(9000));
+  ASSERT_THAT(sampled.stats.num_keys_valid, Eq(stats.num_keys_valid));
+  ASSERT_THAT(sampled.stats.num_values_valid, Eq(stats.num_values_valid));
+  ASSERT_THAT(sampled.stats.list_size_min, Eq(1));
+  ASSERT_THAT(sampled.stats.list_size_max, Eq(4));
+  ASSERT_THAT(sampled.stats.key_size_max, Eq(stats.key_size_max));
+  ASSERT_THAT(sampled.list_size_avg_error, Gt(0));
+  ASSERT_THAT(sampled.list_size_avg_error, Lt(0.1));
+  // The exact and the estimated average are rounded down.
+  ASSERT_THAT(std::abs(double(sampled.stats.list_size_avg) -
+                       double(stats.list_size_avg)),
+              testing::Le(1));
+  ASSERT_THAT(std::abs(double(sampled.stats.key_size_avg) -
+                       double(stats.key_size_avg)),
+              testing::Le(1));
+}
+
+TEST_F(PartitionTestFixture, GetCurrentStatsReturnsSameCountsAsGetStats) {
+  const auto assertSameCounts = [](const Partition& partition) {
+    const auto stats = partition.getStats();
+    const auto current_stats = partition.getCurrentStats();
+    ASSERT_THAT(current_stats.num_keys_total, Eq(stats.num_keys_total));
+    ASSERT_THAT(current_stats.num_keys_valid, Eq(stats.num_keys_valid));
+    ASSERT_THAT(current_stats.num_values_total, Eq(stats.num_values_total));
+    ASSERT_THAT(current_stats.num_values_valid, Eq(stats.num_values_valid));
+    ASSERT_THAT(current_stats.num_blocks, Eq(stats.num_blocks));
+  };
+  {
+    auto partition = openOrCreatePartition(prefix);
+    assertSameCounts(*partition);
+    for (int i = 0; i != 100; ++i) {
+      partition->put(std::to_string(i % 10), std::to_string(i));
+    }
+    const std::vector<std::string> values = {"a", "b", "c"};
+    partition->put("k", values.begin(), values.end());
+    assertSameCounts(*partition);
+
+    partition->remove("0");
+    partition->removeOne("1", Equal("11"));
+    partition->removeAll("2", [](const Bytes&) { return true; });
+    partition->replaceOne("k", "a", "aa");
+    partition->replaceAll("3", [](const Bytes& value) {
+      return value.toString() + "x";
+    });
+    partition->removeAll([](const Bytes& key) { return key == "4"; });
+    assertSameCounts(*partition);
+
+    partition->compactLists(0, -1);
+    assertSameCounts(*partition);
+  }
+  assertSameCounts(*openOrCreatePartition(prefix));
+}
+
 TEST_F(PartitionTestFixture, IsReadOnlyReturnsCorrectValue) {
   {
     auto partition = openOrCreatePartition(prefix);
@@ -612,6 +755,115 @@ TEST_F(PartitionTestFixture, GetBlockSizeReturnsCorrectValue) {
   ASSERT_THAT(partition->getBlockSize(), Eq(Partition::Options().block_size));
 }
 
+TEST_F(PartitionTestFixture, ReadOnlyPartitionResolvesKeysViaIndex) {
+  Stats expected_stats;
+  {
+    auto partition = openOrCreatePartition(prefix);
+    ASSERT_FALSE(partition->isIndexed());
+    for (const auto& key : keys) {
+      partition->put(key, values.begin(), values.end());
+    }
+    partition->put("empty", v1);
+    partition->remove("empty");
+  }
+  expected_stats = openOrCreatePartition(prefix)->getStats();
+  auto partition = openOrCreatePartitionAsReadOnly(prefix);
+  ASSERT_TRUE(partition->isIndexed());
+  auto stats = partition->getStats();
+  // Keys are resolved lazily, so memory usage is expected to differ.
+  stats.memory_allocated = expected_stats.memory_allocated;
+  stats.memory_reserved = expected_stats.memory_reserved;
+  stats.memory_reusable = expected_stats.memory_reusable;
+  // Closing the unmodified partition did not rewrite the stats, which still
+  // count the key of the removed list.
+  ASSERT_THAT(stats.num_keys_total, Eq(expected_stats.num_keys_total + 1));
+  stats.num_keys_total = expected_stats.num_keys_total;
+  ASSERT_THAT(stats.toVector(), ElementsAreArray(expected_stats.toVector()));
+
+  for (const auto& key : keys) {
+    ASSERT_TRUE(partition->contains(key));
+    auto iter = partition->get(key);
+    ASSERT_TRUE(iter != nullptr);
+    ASSERT_THAT(iter->available(), Eq(values.size()));
+    for (const auto& value : values) {
+      ASSERT_THAT(iter->next(), Eq(value));
+    }
+  }
+  ASSERT_FALSE(partition->contains("empty"));
+  ASSERT_FALSE(partition->contains("missing"));
+  ASSERT_TRUE(partition->get("missing") == nullptr);
+
+  std::vector<std::string> actual_keys;
+  partition->forEachKey(
+      [&](const Bytes& key) { actual_keys.push_back(key.toString()); });
+  ASSERT_THAT(actual_keys, UnorderedElementsAre(k1, k2, k3));
+
+  size_t num_values = 0;
+  partition->forEachEntry([&](const Bytes& /* key */, Iterator* iter) {
+    while (iter->hasNext()) {
+      iter->next();
+      ++num_values;
+    }
+  });
+  ASSERT_THAT(num_values, Eq(keys.size() * values.size()));
+}
+
+TEST_F(PartitionTestFixture, ReadOnlyPartitionLoadsKeysIfIndexIsMissing) {
+  {
+    auto partition = openOrCreatePartition(prefix);
+    partition->put(k1, v1);
+  }
+  boost::filesystem::remove(Partition::getNameOfIndexFile(prefix.string()));
+  auto partition = openOrCreatePartitionAsReadOnly(prefix);
+  ASSERT_FALSE(partition->isIndexed());
+  ASSERT_TRUE(partition->contains(k1));
+}
+
+TEST_F(PartitionTestFixture, ReadOnlyPartitionConsultsBloomFilterIfWritten) {
+  const auto make_key = [](int i) { return "key" + std::to_string(i); };
+  {
+    Partition::Options options;
+    options.bloom_filter_false_positive_rate = 0.01;
+    Partition partition(prefix, options);
+    for (int i = 0; i != 1000; ++i) {
+      partition.put(make_key(i), v1);
+    }
+  }
+  {
+    auto partition = openOrCreatePartitionAsReadOnly(prefix);
+    ASSERT_TRUE(partition->isIndexed());
+    ASSERT_TRUE(partition->hasBloomFilter());
+    for (int i = 0; i != 1000; ++i) {
+      ASSERT_TRUE(partition->contains(make_key(i)));
+    }
+    for (int i = 1000; i != 2000; ++i) {
+      ASSERT_FALSE(partition->contains(make_key(i)));
+    }
+    const std::vector<std::string> many_key_strings = {make_key(1),
+                                                       make_key(1001)};
+    const std::vector<Bytes> many_keys(many_key_strings.begin(),
+                                       many_key_strings.end());
+    std::vector<bool> results(2);
+    const std::vector<uint64_t> hashes = {Partition::Key::hash(many_keys[0]),
+                                          Partition::Key::hash(many_keys[1])};
+    partition->containsMany(many_keys, hashes, {0, 1}, &results);
+    ASSERT_THAT(results, ElementsAre(true, false));
+  }
+  {
+    auto partition = openOrCreatePartition(prefix);
+    for (int i = 0; i != 1000; ++i) {
+      partition->put(make_key(i), v2);
+    }
+    // Rewrites the keys file, but without a filter.
+  }
+  ASSERT_FALSE(boost::filesystem::exists(
+      Partition::getNameOfFilterFile(prefix.string())));
+  auto partition = openOrCreatePartitionAsReadOnly(prefix);
+  ASSERT_TRUE(partition->isIndexed());
+  ASSERT_FALSE(partition->hasBloomFilter());
+  ASSERT_TRUE(partition->contains(make_key(999)));
+}
+
 // -----------------------------------------------------------------------------
 // class Partition / Mutability
 // -----------------------------------------------------------------------------
@@ -749,6 +1001,615 @@ TEST_F(PartitionTestFixture, GetDifferentListsDoesNotBlock) {
   ASSERT_TRUE(iter2->hasNext());
 }
 
+TEST_F(PartitionTestFixture, ConcurrentPutsOfNewKeysAndGetsSucceed) {
+  auto partition = openOrCreatePartition(prefix);
+  partition->put(k1, v1);
+  const size_t num_threads = 4;
+  const size_t num_keys_per_thread = 1000;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t != num_threads; ++t) {
+    threads.emplace_back([&, t] {
+      for (size_t i = 0; i != num_keys_per_thread; ++i) {
+        const auto key = std::to_string(t) + '-' + std::to_string(i);
+        partition->put(key, v1);
+        ASSERT_TRUE(partition->contains(key));
+        ASSERT_TRUE(partition->contains(k1));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const auto stats = partition->getStats();
+  ASSERT_THAT(stats.num_keys_valid, Eq(1 + num_threads * num_keys_per_thread));
+}
+
+TEST_F(PartitionTestFixture, ConcurrentPutsWithWriteLanesSurviveReopen) {
+  Partition::Options options;
+  options.num_write_lanes = 4;
+  const size_t num_threads = 4;
+  const size_t num_values_per_key = 1000;
+  const auto makeValue = [](size_t t, size_t i) {
+    return std::to_string(t) + '-' + std::to_string(i) + std::string(50, 'x');
+  };
+  {
+    auto partition = openPartition(prefix, options);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t != num_threads; ++t) {
+      threads.emplace_back([&, t] {
+        for (size_t i = 0; i != num_values_per_key; ++i) {
+          partition->put(std::to_string(i % 10), makeValue(t, i));
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+  auto partition = openPartition(prefix, options);
+  std::vector<std::string> expected;
+  for (size_t t = 0; t != num_threads; ++t) {
+    for (size_t i = 0; i != num_values_per_key; ++i) {
+      expected.push_back(makeValue(t, i));
+    }
+  }
+  std::vector<std::string> actual;
+  for (size_t k = 0; k != 10; ++k) {
+    auto iter = partition->get(std::to_string(k));
+    while (iter->hasNext()) {
+      actual.push_back(iter->next().toString());
+    }
+  }
+  std::sort(expected.begin(), expected.end());
+  std::sort(actual.begin(), actual.end());
+  ASSERT_THAT(actual, ElementsAreArray(expected));
+}
+
+TEST_F(PartitionTestFixture, FlushColdListsFlushesListsNotAppendedTo) {
+  Partition::Options options;
+  options.track_tail_blocks = true;
+  const size_t num_keys = 100;
+  {
+    auto partition = openPartition(prefix, options);
+    for (size_t i = 0; i != num_keys; ++i) {
+      partition->put(std::to_string(i), std::to_string(i));
+    }
+    ASSERT_THAT(partition->getNumTailBlocks(), Eq(num_keys));
+    ASSERT_THAT(partition->flushColdLists(10), Eq(0));
+    // Each list gets a second chance when visited first.
+
+    for (size_t i = 0; i != 5; ++i) {
+      partition->put(std::to_string(i), std::to_string(i));
+    }
+    ASSERT_THAT(partition->flushColdLists(0), Eq(num_keys - 5));
+    ASSERT_THAT(partition->getNumTailBlocks(), Eq(5));
+
+    // Lists that were flushed allocate a new tail block when appended to.
+    for (size_t i = 0; i != num_keys; ++i) {
+      partition->put(std::to_string(i), std::to_string(i));
+    }
+    ASSERT_THAT(partition->getNumTailBlocks(), Eq(num_keys));
+    for (size_t i = 0; i != num_keys; ++i) {
+      auto iter = partition->get(std::to_string(i));
+      const auto num_values = (i < 5) ? 3 : 2;
+      ASSERT_THAT(iter->available(), Eq(num_values));
+      while (iter->hasNext()) {
+        ASSERT_THAT(iter->next(), Eq(std::to_string(i)));
+      }
+    }
+  }
+  auto partition = openPartition(prefix, options);
+  ASSERT_THAT(partition->getNumTailBlocks(), Eq(0));
+  for (size_t i = 0; i != num_keys; ++i) {
+    auto iter = partition->get(std::to_string(i));
+    ASSERT_THAT(iter->available(), Eq((i < 5) ? 3 : 2));
+  }
+}
+
+TEST_F(PartitionTestFixture, FlushColdListsFlushesListsThatAreBeingRead) {
+  Partition::Options options;
+  options.track_tail_blocks = true;
+  auto partition = openPartition(prefix, options);
+  partition->put(k1, v1);
+  partition->put(k2, v2);
+  partition->flushColdLists(0);
+  auto iter = partition->get(k1);
+  ASSERT_THAT(partition->flushColdLists(0), Eq(2));
+  ASSERT_THAT(partition->getNumTailBlocks(), Eq(0));
+  ASSERT_THAT(iter->next(), Eq(v1));
+  ASSERT_FALSE(iter->hasNext());
+}
+
+TEST_F(PartitionTestFixture, FlushColdListsMakesMemoryReusable) {
+  Partition::Options options;
+  options.track_tail_blocks = true;
+  auto partition = openPartition(prefix, options);
+  partition->put(k1, v1);
+  partition->put(k2, v2);
+  // Both lists hold a tail block of the smallest size, which fits the value.
+  const uint32_t tail_block_size = 16;
+  const auto stats = partition->getStats();
+  ASSERT_THAT(stats.memory_reusable, Eq(0));
+  ASSERT_TRUE(stats.memory_allocated >= 2 * tail_block_size);
+  ASSERT_TRUE(stats.memory_reserved >= stats.memory_allocated);
+
+  partition->flushColdLists(0);
+  ASSERT_THAT(partition->flushColdLists(0), Eq(2));
+  const auto flushed_stats = partition->getStats();
+  ASSERT_THAT(flushed_stats.memory_reusable, Eq(2 * tail_block_size));
+  // The ids of the flushed blocks take the smallest size class of 8 bytes.
+  ASSERT_THAT(flushed_stats.memory_allocated,
+              Eq(stats.memory_allocated - 2 * tail_block_size + 2 * 8));
+  ASSERT_THAT(flushed_stats.memory_reserved, Eq(stats.memory_reserved));
+
+  // New tail blocks are taken from the reusable memory.
+  partition->put(k1, v1);
+  ASSERT_THAT(partition->getStats().memory_reusable, Eq(tail_block_size));
+  ASSERT_THAT(partition->getStats().memory_reserved, Eq(stats.memory_reserved));
+}
+
+std::vector<std::string> readValues(const Partition& partition,
+                                    const Bytes& key) {
+  std::vector<std::string> values;
+  partition.forEachValue(
+      key, [&values](const Bytes& value) { values.push_back(value.toString()); });
+  return values;
+}
+
+void copyPartitionFiles(const boost::filesystem::path& from_prefix,
+                        const boost::filesystem::path& to_prefix) {
+  const auto from_name = from_prefix.filename().string();
+  for (boost::filesystem::directory_iterator it(from_prefix.parent_path()), end;
+       it != end; ++it) {
+    const auto name = it->path().filename().string();
+    if (name.compare(0, from_name.size(), from_name) == 0) {
+      boost::filesystem::copy_file(
+          it->path(), to_prefix.string() + name.substr(from_name.size()));
+    }
+  }
+}
+// Takes a snapshot of the files of an open partition, which is what a crash
+// of the process would leave behind.
+
+TEST_F(PartitionTestFixture, WriteAheadLogRecoversUpdatesAfterCrash) {
+  Partition::Options options;
+  options.write_ahead_log = true;
+  {
+    auto partition = openPartition(prefix, options);
+    ASSERT_TRUE(partition->hasWriteAheadLog());
+    partition->put(k1, v1);
+    partition->put(k1, v2);
+    partition->put(k2, v1);
+  }
+  ASSERT_FALSE(boost::filesystem::exists(
+      Partition::getNameOfWalFile(prefix.string())));
+
+  const auto crashed_prefix = directory / "crashed";
+  {
+    auto partition = openPartition(prefix, options);
+    partition->put(k1, v3);
+    ASSERT_TRUE(partition->removeOne(k1, Equal(v1)));
+    ASSERT_TRUE(partition->replaceOne(k2, v1, v2));
+    partition->put(k3, v1);
+    ASSERT_THAT(partition->remove(k3), Eq(1));
+    partition->put(k3, v2);
+    copyPartitionFiles(prefix, crashed_prefix);
+  }
+  // An interrupted checkpoint must not replace the files of the last one.
+  mt::fopen(Partition::getNameOfKeysFile(crashed_prefix.string()) + ".new",
+            "w");
+
+  ASSERT_THROW(openOrCreatePartitionAsReadOnly(crashed_prefix),
+               std::runtime_error);
+  {
+    auto partition = openPartition(crashed_prefix, Partition::Options());
+    ASSERT_TRUE(partition->hasWriteAheadLog());
+    ASSERT_THAT(readValues(*partition, k1), ElementsAre(v2, v3));
+    ASSERT_THAT(readValues(*partition, k2), ElementsAre(v2));
+    ASSERT_THAT(readValues(*partition, k3), ElementsAre(v2));
+    ASSERT_THAT(partition->getStats().num_values_valid, Eq(4));
+  }
+  ASSERT_FALSE(boost::filesystem::exists(
+      Partition::getNameOfWalFile(crashed_prefix.string())));
+  auto partition = openOrCreatePartitionAsReadOnly(crashed_prefix);
+  ASSERT_THAT(readValues(*partition, k1), ElementsAre(v2, v3));
+  ASSERT_THAT(readValues(*partition, k2), ElementsAre(v2));
+  ASSERT_THAT(readValues(*partition, k3), ElementsAre(v2));
+}
+
+TEST_F(PartitionTestFixture, ReplaceOfSameSizeKeepsOrderAndIsLogged) {
+  Partition::Options options;
+  options.write_ahead_log = true;
+  const auto crashed_prefix = directory / "crashed";
+  const std::string large_value(1000, 'a');
+  const std::string new_large_value(1000, 'b');
+  {
+    auto partition = openPartition(prefix, options);
+    partition->put(k1, v1);
+    partition->put(k1, large_value);
+    partition->put(k1, v2);
+    partition->put(k1, v1);
+    partition->checkpoint();
+    ASSERT_THAT(partition->replaceAll(k1, v1, v3), Eq(2));
+    ASSERT_TRUE(partition->replaceOne(k1, large_value, new_large_value));
+    ASSERT_THAT(readValues(*partition, k1),
+                ElementsAre(v3, new_large_value, v2, v3));
+    ASSERT_THAT(partition->getStats().num_values_total, Eq(4));
+    copyPartitionFiles(prefix, crashed_prefix);
+  }
+  auto partition = openPartition(crashed_prefix, options);
+  ASSERT_THAT(readValues(*partition, k1),
+              ElementsAre(v3, new_large_value, v2, v3));
+  ASSERT_THAT(partition->getStats().num_values_total, Eq(4));
+}
+
+TEST_F(PartitionTestFixture, PutManyKeepsOrderPerKeyAndIsLogged) {
+  Partition::Options options;
+  options.write_ahead_log = true;
+  const auto crashed_prefix = directory / "crashed";
+  {
+    auto partition = openPartition(prefix, options);
+    partition->put(k2, v3);
+    const std::vector<Bytes> keys = {k1, k2, k1, k3, k1};
+    const std::vector<Bytes> values = {v1, v1, v2, v1, v3};
+    std::vector<uint64_t> hashes;
+    for (const auto& key : keys) {
+      hashes.push_back(Partition::Key::hash(key));
+    }
+    partition->putMany(keys, hashes, values, {0, 1, 2, 3, 4});
+    ASSERT_THAT(readValues(*partition, k1), ElementsAre(v1, v2, v3));
+    ASSERT_THAT(readValues(*partition, k2), ElementsAre(v3, v1));
+    ASSERT_THAT(readValues(*partition, k3), ElementsAre(v1));
+    copyPartitionFiles(prefix, crashed_prefix);
+  }
+  auto partition = openPartition(crashed_prefix, options);
+  ASSERT_THAT(readValues(*partition, k1), ElementsAre(v1, v2, v3));
+  ASSERT_THAT(readValues(*partition, k2), ElementsAre(v3, v1));
+  ASSERT_THAT(readValues(*partition, k3), ElementsAre(v1));
+}
+
+TEST_F(PartitionTestFixture, WriteAheadLogCanBeReplayedTwice) {
+  Partition::Options options;
+  options.write_ahead_log = true;
+  options.sync_write_ahead_log = true;
+  const auto crashed_prefix = directory / "crashed";
+  const auto crashed_again_prefix = directory / "crashed-again";
+  {
+    auto partition = openPartition(prefix, options);
+    for (size_t i = 0; i != 1000; ++i) {
+      partition->put(k1, std::to_string(i));
+    }
+    ASSERT_THAT(partition->removeAll(k1, [](const Bytes& value) {
+      return std::stoi(value.toString()) % 3 == 0;
+    }), Eq(334));
+    copyPartitionFiles(prefix, crashed_prefix);
+  }
+  {
+    auto partition = openPartition(crashed_prefix, options);
+    partition->put(k2, v1);
+    copyPartitionFiles(crashed_prefix, crashed_again_prefix);
+  }
+  auto partition = openPartition(crashed_again_prefix, options);
+  const auto values = readValues(*partition, k1);
+  ASSERT_THAT(values.size(), Eq(666));
+  for (const auto& value : values) {
+    ASSERT_NE(std::stoi(value) % 3, 0);
+  }
+  ASSERT_THAT(readValues(*partition, k2), ElementsAre(v1));
+}
+
+TEST_F(PartitionTestFixture, CheckpointSurvivesCrashWithoutWriteAheadLog) {
+  const auto crashed_prefix = directory / "crashed";
+  {
+    auto partition = openOrCreatePartition(prefix);
+    partition->put(k1, v1);
+    partition->put(k2, v1);
+    partition->checkpoint();
+    partition->put(k1, v2);  // Lost in the crash.
+    ASSERT_THAT(partition->remove(k2), Eq(1));
+    partition->checkpoint();
+    partition->put(k3, v3);  // Lost in the crash.
+    copyPartitionFiles(prefix, crashed_prefix);
+  }
+  auto partition = openOrCreatePartitionAsReadOnly(crashed_prefix);
+  ASSERT_THAT(readValues(*partition, k1), ElementsAre(v1, v2));
+  ASSERT_FALSE(partition->contains(k2));
+  ASSERT_FALSE(partition->contains(k3));
+}
+
+TEST_F(PartitionTestFixture, CloseOnlyAppendsFewModifiedListsToDelta) {
+  const auto keys_file = Partition::getNameOfKeysFile(prefix.string());
+  const auto delta_file = Partition::getNameOfDeltaFile(prefix.string());
+  {
+    auto partition = openOrCreatePartition(prefix);
+    for (size_t i = 0; i != 100; ++i) {
+      partition->put(std::to_string(i), v1);
+    }
+  }
+  const auto keys_file_size = boost::filesystem::file_size(keys_file);
+  ASSERT_FALSE(boost::filesystem::exists(delta_file));
+  {
+    auto partition = openOrCreatePartition(prefix);
+    partition->put("0", v2);
+    partition->remove("1");
+  }
+  ASSERT_THAT(boost::filesystem::file_size(keys_file), Eq(keys_file_size));
+  ASSERT_TRUE(boost::filesystem::is_regular_file(delta_file));
+  {
+    auto partition = openOrCreatePartitionAsReadOnly(prefix);
+    ASSERT_FALSE(partition->isIndexed());
+    ASSERT_THAT(readValues(*partition, "0"), ElementsAre(v1, v2));
+    ASSERT_FALSE(partition->contains("1"));
+    ASSERT_THAT(readValues(*partition, "2"), ElementsAre(v1));
+    ASSERT_THAT(partition->getStats().num_keys_valid, Eq(99));
+  }
+  std::vector<std::string> keys;
+  Partition::forEachEntry(prefix, Partition::Options(),
+                          [&](const Bytes& key, Iterator* iter) {
+                            keys.push_back(key.toString());
+                            if (key == "0") {
+                              ASSERT_THAT(iter->available(), Eq(2));
+                            }
+                          });
+  ASSERT_THAT(keys.size(), Eq(99));
+
+  // Rewriting most lists merges the delta into the keys file.
+  {
+    auto partition = openOrCreatePartition(prefix);
+    for (size_t i = 0; i != 100; ++i) {
+      partition->put(std::to_string(i), v3);
+    }
+  }
+  ASSERT_FALSE(boost::filesystem::exists(delta_file));
+  auto partition = openOrCreatePartitionAsReadOnly(prefix);
+  ASSERT_TRUE(partition->isIndexed());
+  ASSERT_THAT(readValues(*partition, "0"), ElementsAre(v1, v2, v3));
+  ASSERT_THAT(readValues(*partition, "1"), ElementsAre(v3));
+}
+
+TEST_F(PartitionTestFixture, ForEachListVisitsListsInKeyOrBlockOrder) {
+  // Values are put round-robin, so that the blocks of each list are spread
+  // over the values file and the lists span more than one read-ahead batch.
+  const size_t num_keys = 2000;
+  const size_t num_values = 20;
+  const std::string value(100, 'v');
+  {
+    auto partition = openOrCreatePartition(prefix);
+    for (size_t i = 0; i != num_values; ++i) {
+      for (size_t k = 0; k != num_keys; ++k) {
+        partition->put(std::to_string(k), value);
+      }
+    }
+  }
+  const auto scan = [&](Partition::ScanOrder order,
+                        std::vector<std::string>* keys) {
+    size_t num_descents = 0;
+    uint32_t prev_block_id = 0;
+    Partition::forEachList(prefix, Partition::Options(),
+                           [&](const Bytes& key, const List& list,
+                               const Store& store) {
+                             keys->push_back(key.toString());
+                             const auto ids = list.getBlockIdsUnlocked();
+                             ASSERT_THAT(ids.size(), testing::Gt(1));
+                             num_descents += ids.front() < prev_block_id;
+                             prev_block_id = ids.front();
+                             List::SharedIterator iter(list, store);
+                             ASSERT_THAT(iter.available(), Eq(num_values));
+                           },
+                           order);
+    return num_descents;
+  };
+  std::vector<std::string> keys_in_key_order;
+  scan(Partition::ScanOrder::KEYS, &keys_in_key_order);
+  std::vector<std::string> keys_in_block_order;
+  const auto num_descents =
+      scan(Partition::ScanOrder::BLOCKS, &keys_in_block_order);
+  ASSERT_THAT(keys_in_key_order.size(), Eq(num_keys));
+  ASSERT_THAT(keys_in_block_order,
+              testing::UnorderedElementsAreArray(keys_in_key_order));
+  // Lists are only sorted within each batch.
+  ASSERT_THAT(num_descents, testing::Lt(10));
+}
+
+TEST_F(PartitionTestFixture, CheckpointTruncatesWriteAheadLog) {
+  Partition::Options options;
+  options.write_ahead_log = true;
+  const auto wal_file = Partition::getNameOfWalFile(prefix.string());
+  const auto crashed_prefix = directory / "crashed";
+  {
+    auto partition = openPartition(prefix, options);
+    const auto empty_wal_size = boost::filesystem::file_size(wal_file);
+    for (size_t i = 0; i != 100; ++i) {
+      partition->put(k1, std::to_string(i));
+    }
+    ASSERT_THAT(boost::filesystem::file_size(wal_file), Gt(empty_wal_size));
+    partition->checkpoint();
+    ASSERT_THAT(boost::filesystem::file_size(wal_file), Eq(empty_wal_size));
+    partition->put(k1, v1);
+    partition->put(k2, v2);
+    copyPartitionFiles(prefix, crashed_prefix);
+  }
+  auto partition = openPartition(crashed_prefix, options);
+  const auto values = readValues(*partition, k1);
+  ASSERT_THAT(values.size(), Eq(101));
+  ASSERT_THAT(values.back(), Eq(v1));
+  ASSERT_THAT(readValues(*partition, k2), ElementsAre(v2));
+}
+
+TEST_F(PartitionTestFixture, CheckpointIsDiscardedIfLogWasNotTruncated) {
+  Partition::Options options;
+  options.write_ahead_log = true;
+  const auto wal_file = Partition::getNameOfWalFile(prefix.string());
+  const auto crashed_prefix = directory / "crashed";
+  {
+    auto partition = openPartition(prefix, options);
+    partition->put(k1, v1);
+    partition->checkpoint();
+    partition->put(k1, v2);
+    boost::filesystem::copy_file(wal_file, directory / "wal");
+    partition->checkpoint();
+    copyPartitionFiles(prefix, crashed_prefix);
+  }
+  // A crash after writing the second batch, but before truncating the log.
+  boost::filesystem::copy_file(
+      directory / "wal", Partition::getNameOfWalFile(crashed_prefix.string()),
+      boost::filesystem::copy_option::overwrite_if_exists);
+  {
+    auto partition = openPartition(crashed_prefix, options);
+    ASSERT_THAT(readValues(*partition, k1), ElementsAre(v1, v2));
+    partition->put(k1, v3);
+  }
+  auto partition = openOrCreatePartitionAsReadOnly(crashed_prefix);
+  ASSERT_THAT(readValues(*partition, k1), ElementsAre(v1, v2, v3));
+}
+
+std::vector<std::string> putNumberedValues(Partition* partition,
+                                           const Bytes& key, size_t num) {
+  std::vector<std::string> values;
+  for (size_t i = 0; i != num; ++i) {
+    values.push_back(std::to_string(i));
+    partition->put(key, values.back());
+  }
+  return values;
+}
+
+bool isEven(const Bytes& value) {
+  return std::stoul(value.toString()) % 2 == 0;
+}
+
+TEST_F(PartitionTestFixture, CompactListsRewritesListsWithRemovedValues) {
+  auto partition = openOrCreatePartition(prefix);
+  const auto values = putNumberedValues(partition.get(), k1, 1000);
+  partition->checkpoint();
+  const auto num_blocks = partition->getStats().num_blocks;
+  ASSERT_THAT(partition->removeAll(k1, isEven), Eq(500));
+  ASSERT_TRUE(partition->getFreeBlockIds().empty());
+
+  ASSERT_THAT(partition->compactLists(0.6, -1), Eq(0));
+  ASSERT_THAT(partition->compactLists(0.5, -1), Gt(0));
+  ASSERT_THAT(partition->compactLists(0.5, -1), Eq(0));
+  std::vector<std::string> expected;
+  for (const auto& value : values) {
+    if (!isEven(value)) expected.push_back(value);
+  }
+  ASSERT_THAT(readValues(*partition, k1), ElementsAreArray(expected));
+  ASSERT_THAT(partition->getFreeBlockIds().size(), Gt(num_blocks / 2));
+  const auto stats = partition->getStats();
+  ASSERT_THAT(stats.num_values_total, Eq(500));
+  ASSERT_THAT(stats.num_values_valid, Eq(500));
+}
+
+TEST_F(PartitionTestFixture, CompactListsStopsWhenBudgetIsExhausted) {
+  auto partition = openOrCreatePartition(prefix);
+  putNumberedValues(partition.get(), k1, 100);
+  putNumberedValues(partition.get(), k2, 100);
+  ASSERT_THAT(partition->removeAll(k1, isEven), Eq(50));
+  ASSERT_THAT(partition->removeAll(k2, isEven), Eq(50));
+  ASSERT_THAT(partition->compactLists(0.5, 1), Gt(0));
+  ASSERT_THAT(partition->getStats().num_values_total, Eq(150));
+  ASSERT_THAT(partition->compactLists(0.5, 1), Gt(0));
+  ASSERT_THAT(partition->getStats().num_values_total, Eq(100));
+  ASSERT_THAT(partition->compactLists(0.5, 1), Eq(0));
+}
+
+TEST_F(PartitionTestFixture, FreeBlocksAreReusedAfterCheckpoint) {
+  auto partition = openOrCreatePartition(prefix);
+  putNumberedValues(partition.get(), k1, 1000);
+  partition->checkpoint();
+  partition->removeAll(k1, isEven);
+  partition->compactLists(0.5, -1);
+  partition->checkpoint();
+  const auto num_blocks = partition->getStats().num_blocks;
+  const auto num_free_blocks = partition->getFreeBlockIds().size();
+  ASSERT_THAT(num_free_blocks, Gt(0));
+
+  const auto values = putNumberedValues(partition.get(), k2, 500);
+  partition->checkpoint();
+  ASSERT_THAT(partition->getStats().num_blocks, Eq(num_blocks));
+  ASSERT_THAT(partition->getFreeBlockIds().size(), Gt(0));
+  ASSERT_THAT(partition->getFreeBlockIds().size(), Lt(num_free_blocks));
+  ASSERT_THAT(readValues(*partition, k2), ElementsAreArray(values));
+}
+
+TEST_F(PartitionTestFixture, RemoveReleasesBlocksOfList) {
+  auto partition = openOrCreatePartition(prefix);
+  putNumberedValues(partition.get(), k1, 1000);
+  partition->checkpoint();
+  const auto num_blocks = partition->getStats().num_blocks;
+  ASSERT_THAT(num_blocks, Gt(0));
+  ASSERT_THAT(partition->remove(k1), Eq(1000));
+  ASSERT_THAT(partition->getFreeBlockIds().size(), Eq(num_blocks));
+}
+
+TEST_F(PartitionTestFixture, RemovingAndPuttingListsDoesNotGrowStore) {
+  Partition::Options options;
+  options.write_ahead_log = true;
+  auto partition = openPartition(prefix, options);
+  uint64_t num_blocks = 0;
+  for (size_t round = 0; round != 5; ++round) {
+    const auto& key = (round % 2 == 0) ? k1 : k2;
+    const auto values = putNumberedValues(partition.get(), key, 1000);
+    partition->checkpoint();
+    ASSERT_THAT(readValues(*partition, key), ElementsAreArray(values));
+    if (round == 0) {
+      num_blocks = partition->getStats().num_blocks;
+    }
+    ASSERT_THAT(partition->getStats().num_blocks, Eq(num_blocks));
+    partition->remove(key);
+    partition->checkpoint();
+  }
+}
+
+TEST_F(PartitionTestFixture, FreeBlocksAreReusedAfterReopening) {
+  std::vector<uint32_t> free_block_ids;
+  {
+    auto partition = openOrCreatePartition(prefix);
+    putNumberedValues(partition.get(), k1, 1000);
+    partition->checkpoint();
+    partition->removeAll(k1, isEven);
+    partition->compactLists(0.5, -1);
+    free_block_ids = partition->getFreeBlockIds();
+    ASSERT_FALSE(free_block_ids.empty());
+  }
+  auto partition = openOrCreatePartition(prefix);
+  ASSERT_THAT(partition->getFreeBlockIds(), ElementsAreArray(free_block_ids));
+  const auto num_blocks = partition->getStats().num_blocks;
+  const auto values = putNumberedValues(partition.get(), k2, 100);
+  partition->checkpoint();
+  ASSERT_THAT(partition->getStats().num_blocks, Eq(num_blocks));
+  ASSERT_THAT(readValues(*partition, k2), ElementsAreArray(values));
+  ASSERT_THAT(readValues(*partition, k1).size(), Eq(500));
+}
+
+TEST_F(PartitionTestFixture, OpenAndCloseReportTimingsOfEachPhase) {
+  std::vector<Partition::Timings> opened;
+  std::vector<Partition::Timings> closed;
+  Partition::Options options;
+  options.on_open = [&](const Partition::Timings& timings) {
+    opened.push_back(timings);
+  };
+  options.on_close = [&](const Partition::Timings& timings) {
+    closed.push_back(timings);
+  };
+  putNumberedValues(openPartition(prefix, options).get(), k1, 1000);
+  ASSERT_THAT(opened.size(), Eq(1));
+  ASSERT_THAT(opened.front().read_keys, Eq(0));
+  ASSERT_THAT(closed.size(), Eq(1));
+  ASSERT_THAT(closed.front().flush_lists, Gt(0));
+  ASSERT_THAT(closed.front().write_keys, Gt(0));
+  ASSERT_THAT(closed.front().total,
+              testing::Ge(closed.front().flush_lists +
+                          closed.front().write_keys +
+                          closed.front().write_stats));
+
+  openPartition(prefix, options);
+  ASSERT_THAT(opened.size(), Eq(2));
+  ASSERT_THAT(opened.back().read_keys, Gt(0));
+  ASSERT_THAT(opened.back().total, testing::Ge(opened.back().read_keys +
+                                               opened.back().build_index));
+  ASSERT_THAT(closed.size(), Eq(2));
+}
+
 TEST_F(PartitionTestFixture, GetSameListTwiceDoesNotBlock) {
   auto partition = openOrCreatePartition(prefix);
   partition->put(k1, v1);
@@ -758,6 +1619,315 @@ TEST_F(PartitionTestFixture, GetSameListTwiceDoesNotBlock) {
   ASSERT_TRUE(iter2->hasNext());
 }
 
+TEST_F(PartitionTestFixture, CheckpointReclaimsKeysOfEmptyLists) {
+  Partition::Options options;
+  options.write_ahead_log = true;
+  auto partition = openPartition(prefix, options);
+  for (size_t i = 0; i != 100; ++i) {
+    partition->put(std::to_string(i), v1);
+  }
+  partition->checkpoint();
+  for (size_t i = 0; i != 100; i += 2) {
+    partition->remove(std::to_string(i));
+  }
+  // Lists are only reclaimed once they have been written as empty.
+  ASSERT_THAT(partition->reclaimEmptyLists(), Eq(0));
+  ASSERT_THAT(partition->getStats().num_keys_total, Eq(100));
+  partition->checkpoint();
+  ASSERT_THAT(partition->getStats().num_keys_total, Eq(50));
+  ASSERT_THAT(partition->getCurrentStats().num_keys_total, Eq(50));
+  ASSERT_EQ(partition->get(std::string("0")), nullptr);
+
+  partition->put(std::string("0"), v2);
+  partition->put(std::string("1"), v2);
+  partition->checkpoint();
+  ASSERT_THAT(partition->getCurrentStats().num_keys_total, Eq(51));
+  partition.reset();
+
+  partition = openPartition(prefix, options);
+  ASSERT_THAT(readValues(*partition, "0"), ElementsAre(v2));
+  ASSERT_THAT(readValues(*partition, "1"), ElementsAre(v1, v2));
+  ASSERT_THAT(readValues(*partition, "2"), ElementsAre());
+  size_t num_keys = 0;
+  partition->forEachKey([&num_keys](const Bytes& /* key */) { ++num_keys; });
+  ASSERT_THAT(num_keys, Eq(51));
+}
+
+size_t countSpillFiles(const boost::filesystem::path& directory) {
+  size_t num_files = 0;
+  for (boost::filesystem::directory_iterator it(directory), end; it != end;
+       ++it) {
+    const auto filename = it->path().filename().string();
+    num_files += filename.find(".spill.") != std::string::npos;
+  }
+  return num_files;
+}
+
+TEST_F(PartitionTestFixture, SpillColdListsEvictsCleanListsOnly) {
+  auto partition = openOrCreatePartition(prefix);
+  for (size_t i = 0; i != 1000; ++i) {
+    partition->put(std::to_string(i), v1);
+  }
+  // All lists have been modified since the last checkpoint.
+  ASSERT_THAT(partition->spillColdLists(0), Eq(0));
+  ASSERT_THAT(countSpillFiles(directory), Eq(0));
+
+  partition->checkpoint();
+  const auto memory_usage = partition->getMemoryUsage();
+  partition->put(std::string("0"), v2);
+  ASSERT_THAT(partition->spillColdLists(0), Eq(999));
+  ASSERT_THAT(partition->getNumSpilledLists(), Eq(999));
+  ASSERT_THAT(partition->getMemoryUsage(), Lt(memory_usage / 10));
+  ASSERT_THAT(partition->getStats().num_keys_total, Eq(1000));
+  ASSERT_THAT(partition->getStats().num_keys_valid, Eq(1000));
+  ASSERT_THAT(partition->getStats().num_values_valid, Eq(1001));
+
+  // A lookup loads the list back.
+  ASSERT_THAT(readValues(*partition, "0"), ElementsAre(v1, v2));
+  ASSERT_THAT(readValues(*partition, "7"), ElementsAre(v1));
+  ASSERT_THAT(partition->getNumSpilledLists(), Eq(998));
+  ASSERT_THAT(partition->getStats().num_keys_total, Eq(1000));
+}
+
+TEST_F(PartitionTestFixture, SpilledListsCanBeUpdated) {
+  auto partition = openOrCreatePartition(prefix);
+  for (size_t i = 0; i != 100; ++i) {
+    partition->put(std::to_string(i), v1);
+  }
+  partition->checkpoint();
+  ASSERT_THAT(partition->spillColdLists(0), Eq(100));
+
+  partition->put(std::string("1"), v2);
+  ASSERT_THAT(partition->remove(std::string("2")), Eq(1));
+  const auto is_3 = [](const Bytes& key) { return key == Bytes("3"); };
+  ASSERT_TRUE(partition->removeOne(is_3));
+  ASSERT_THAT(readValues(*partition, "1"), ElementsAre(v1, v2));
+  ASSERT_THAT(readValues(*partition, "2"), ElementsAre());
+  ASSERT_THAT(readValues(*partition, "3"), ElementsAre());
+
+  // The updated lists are spilled again and outdate their old copies.
+  partition->checkpoint();
+  ASSERT_THAT(partition->spillColdLists(0), Gt(0));
+  ASSERT_THAT(partition->getNumSpilledLists(), Eq(100));
+  ASSERT_THAT(readValues(*partition, "1"), ElementsAre(v1, v2));
+  ASSERT_THAT(readValues(*partition, "2"), ElementsAre());
+
+  size_t num_keys = 0;
+  partition->forEachKey([&num_keys](const Bytes& /* key */) { ++num_keys; });
+  ASSERT_THAT(num_keys, Eq(98));
+  size_t num_values = 0;
+  partition->forEachEntry([&num_values](const Bytes& /* key */,
+                                        Iterator* iter) {
+    while (iter->hasNext()) {
+      iter->next();
+      ++num_values;
+    }
+  });
+  ASSERT_THAT(num_values, Eq(99));
+  const auto result = partition->removeAll(
+      [](const Bytes& key) { return key.size() == 1; });
+  ASSERT_THAT(result.first, Eq(10));
+  ASSERT_THAT(result.second, Eq(9));
+}
+
+TEST_F(PartitionTestFixture, SpillFilesAreMergedAndRemovedOnClose) {
+  auto partition = openOrCreatePartition(prefix);
+  for (size_t round = 0; round != 20; ++round) {
+    for (size_t i = 0; i != 10; ++i) {
+      partition->put(std::to_string(round * 10 + i), v1);
+    }
+    partition->put(std::string("0"), v2);
+    partition->checkpoint();
+    ASSERT_THAT(partition->spillColdLists(0), Gt(0));
+    // A spill file and its index.
+    ASSERT_THAT(countSpillFiles(directory), Lt(20));
+  }
+  ASSERT_THAT(partition->getStats().num_keys_total, Eq(200));
+  ASSERT_THAT(readValues(*partition, "0").size(), Eq(21));
+  ASSERT_THAT(readValues(*partition, "199"), ElementsAre(v1));
+  partition.reset();
+  ASSERT_THAT(countSpillFiles(directory), Eq(0));
+
+  partition = openOrCreatePartition(prefix);
+  ASSERT_THAT(partition->getStats().num_keys_total, Eq(200));
+  ASSERT_THAT(readValues(*partition, "0").size(), Eq(21));
+  ASSERT_THAT(readValues(*partition, "199"), ElementsAre(v1));
+  ASSERT_THAT(partition->getStats().num_values_valid, Eq(220));
+}
+
+TEST_F(PartitionTestFixture, SnapshotCanBeOpenedWhileOriginalIsUpdated) {
+  const auto snapshot_prefix = directory / "snapshot";
+  auto partition = openOrCreatePartition(prefix);
+  for (size_t i = 0; i != 100; ++i) {
+    partition->put(std::to_string(i), v1);
+  }
+  partition->checkpoint();
+  ASSERT_THAT(partition->spillColdLists(0), Eq(100));
+  partition->put(k1, v1);
+  partition->put(k1, v2);
+  partition->put(k2, v1);
+  ASSERT_THAT(partition->remove(k2), Eq(1));
+  ASSERT_TRUE(partition->expire(k1, std::numeric_limits<uint32_t>::max()));
+  partition->snapshot(snapshot_prefix);
+
+  partition->put(k1, v3);
+  partition->put(std::string("5"), v2);
+  ASSERT_THAT(partition->remove(std::string("6")), Eq(1));
+  {
+    const auto snapshot = openOrCreatePartitionAsReadOnly(snapshot_prefix);
+    ASSERT_THAT(readValues(*snapshot, k1), ElementsAre(v1, v2));
+    ASSERT_THAT(readValues(*snapshot, k2), ElementsAre());
+    ASSERT_THAT(readValues(*snapshot, "5"), ElementsAre(v1));
+    ASSERT_THAT(readValues(*snapshot, "6"), ElementsAre(v1));
+    const auto stats = snapshot->getStats();
+    ASSERT_THAT(stats.num_keys_valid, Eq(101));
+    ASSERT_THAT(stats.num_values_valid, Eq(102));
+  }
+  ASSERT_TRUE(boost::filesystem::is_regular_file(
+      Partition::getNameOfExpiryFile(snapshot_prefix.string())));
+
+  // The snapshot is a partition of its own that can be updated.
+  {
+    const auto snapshot = openOrCreatePartition(snapshot_prefix);
+    snapshot->put(k3, v3);
+  }
+  const auto snapshot = openOrCreatePartitionAsReadOnly(snapshot_prefix);
+  ASSERT_THAT(readValues(*snapshot, k3), ElementsAre(v3));
+  ASSERT_THAT(readValues(*snapshot, k1), ElementsAre(v1, v2));
+  partition.reset();
+  partition = openOrCreatePartitionAsReadOnly(prefix);
+  ASSERT_THAT(readValues(*partition, k1), ElementsAre(v1, v2, v3));
+  ASSERT_THAT(readValues(*partition, "5"), ElementsAre(v1, v2));
+  ASSERT_THAT(readValues(*partition, "6"), ElementsAre());
+}
+
+TEST_F(PartitionTestFixture, MemoryBreakdownAccountsForEachComponent) {
+  auto partition = openOrCreatePartition(prefix);
+  auto usage = partition->getMemoryBreakdown();
+  ASSERT_THAT(usage.arena_allocated, Eq(0));
+  ASSERT_THAT(usage.write_buffer, Gt(0));
+
+  for (size_t i = 0; i != 100; ++i) {
+    partition->put(std::to_string(i), v1);
+  }
+  usage = partition->getMemoryBreakdown();
+  ASSERT_THAT(usage.hash_tables, Gt(0));
+  ASSERT_THAT(usage.tail_blocks, Gt(0));
+  ASSERT_THAT(usage.block_ids, Eq(0));
+  ASSERT_THAT(usage.block_ids + usage.tail_blocks,
+              Lt(usage.arena_allocated));
+  ASSERT_THAT(usage.arena_allocated,
+              Eq(partition->getStats().memory_allocated));
+
+  partition->checkpoint();
+  usage = partition->getMemoryBreakdown();
+  ASSERT_THAT(usage.block_ids, Gt(0));
+  ASSERT_THAT(usage.mapped_keys, Eq(0));
+  partition->spillColdLists(0);
+  usage = partition->getMemoryBreakdown();
+  ASSERT_THAT(usage.tail_blocks, Eq(0));
+  ASSERT_THAT(usage.mapped_keys, Gt(0));
+}
+
+TEST_F(PartitionTestFixture, ExpiredKeysAreHiddenAndRemovedLazily) {
+  auto partition = openOrCreatePartition(prefix);
+  partition->put(k1, v1);
+  partition->put(k2, v2);
+  partition->put(k3, v3);
+  ASSERT_FALSE(partition->expire(std::string("k4"), 1));
+  const auto now = Partition::getCurrentTime();
+  ASSERT_TRUE(partition->expire(k1, now));
+  ASSERT_TRUE(partition->expire(k2, now + 3600));
+  ASSERT_TRUE(partition->expire(k3, now + 1));
+  ASSERT_TRUE(partition->expire(k3, 0));
+
+  ASSERT_EQ(partition->get(k1), nullptr);
+  ASSERT_FALSE(partition->contains(k1));
+  ASSERT_TRUE(partition->contains(k2));
+  ASSERT_TRUE(partition->contains(k3));
+  std::vector<std::string> keys;
+  partition->forEachKey(
+      [&keys](const Bytes& key) { keys.push_back(key.toString()); });
+  ASSERT_THAT(keys, UnorderedElementsAre(k2, k3));
+
+  ASSERT_THAT(partition->removeExpiredLists(), Eq(1));
+  ASSERT_THAT(partition->removeExpiredLists(), Eq(0));
+  ASSERT_THAT(partition->getStats().num_values_valid, Eq(2));
+  // The deadline is gone with the values.
+  partition->put(k1, v1);
+  ASSERT_TRUE(partition->contains(k1));
+}
+
+TEST_F(PartitionTestFixture, DeadlinesAreRecoveredAfterCrash) {
+  Partition::Options options;
+  options.write_ahead_log = true;
+  const auto crashed_prefix = directory / "crashed";
+  const auto expiry_file =
+      Partition::getNameOfExpiryFile(crashed_prefix.string());
+  {
+    auto partition = openPartition(prefix, options);
+    partition->put(k1, v1);
+    partition->put(k2, v2);
+    ASSERT_TRUE(partition->expire(k1, Partition::getCurrentTime() + 3600));
+    partition->checkpoint();
+    // The deadline of `k2` is only in the log.
+    ASSERT_TRUE(partition->expire(k2, 1));
+    copyPartitionFiles(prefix, crashed_prefix);
+  }
+  ASSERT_TRUE(boost::filesystem::exists(expiry_file));
+  auto partition = openPartition(crashed_prefix, options);
+  ASSERT_TRUE(partition->contains(k1));
+  ASSERT_FALSE(partition->contains(k2));
+  ASSERT_THAT(partition->removeExpiredLists(), Eq(1));
+  ASSERT_TRUE(partition->expire(k1, 0));
+  partition->checkpoint();
+  ASSERT_FALSE(boost::filesystem::exists(expiry_file));
+}
+
+TEST_F(PartitionTestFixture, CappedListsAreRecoveredAfterCrash) {
+  Partition::Options options;
+  options.write_ahead_log = true;
+  options.track_tail_blocks = true;
+  options.max_values_per_key = 100;
+  const auto get_values = [this](const Partition& partition) {
+    std::vector<std::string> values;
+    const auto iter = partition.get(k1);
+    while (iter->hasNext()) {
+      values.push_back(iter->next().toString());
+    }
+    return values;
+  };
+  const auto ends_with = [](char c) {
+    return [c](const Bytes& value) { return value.toString().back() == c; };
+  };
+  const auto crashed_prefix = directory / "crashed";
+  std::vector<std::string> values;
+  {
+    auto partition = openPartition(prefix, options);
+    for (int i = 0; i != 3000; ++i) {
+      partition->put(k1, std::to_string(i));
+      if (i % 37 == 0) {
+        // Flushes are not logged, so blocks end elsewhere when replayed.
+        partition->flushColdLists(0);
+      }
+      if (i == 1000) {
+        partition->checkpoint();
+      } else if (i == 2000) {
+        partition->removeAll(k1, ends_with('7'));
+      }
+    }
+    partition->removeAll(k1, ends_with('3'));
+    partition->replaceOne(k1, "2999", "x");
+    values = get_values(*partition);
+    ASSERT_THAT(values.size(), Gt(80));
+    ASSERT_THAT(values.size(), Lt(1000));
+    ASSERT_THAT(values.back(), Eq("x"));
+    copyPartitionFiles(prefix, crashed_prefix);
+  }
+  auto partition = openPartition(crashed_prefix, options);
+  ASSERT_THAT(get_values(*partition), ElementsAreArray(values));
+}
+
 TEST_F(PartitionTestFixture, RemoveKeyBlocksIfListIsLocked) {
   auto partition = openOrCreatePartition(prefix);
   partition->put(k1, v1);
@@ -938,5 +2108,30 @@ TEST(PartitionStatsTest, NamesAndToVectorHaveSameDimension) {
   ASSERT_THAT(Stats::names().size(), Eq(Stats().toVector().size()));
 }
 
+TEST_F(PartitionTestFixture, DISABLED_BenchmarkPutAndGet) {
+  const uint32_t num_keys = 100000;
+  const uint32_t num_values_per_key = 10;
+  std::vector<std::string> keys;
+  for (uint32_t i = 0; i != num_keys; ++i) {
+    keys.push_back("key" + std::to_string(i));
+  }
+  auto partition = openOrCreatePartition(prefix);
+  Benchmark::run("Partition::put", num_keys * num_values_per_key, [&] {
+    for (uint32_t i = 0; i != num_values_per_key; ++i) {
+      for (const auto& key : keys) {
+        partition->put(key, v1);
+      }
+    }
+  });
+  uint64_t num_values = 0;
+  Benchmark::run("Partition::get", num_keys, [&] {
+    for (const auto& key : keys) {
+      num_values += partition->get(key)->available();
+    }
+  });
+  ASSERT_THAT(num_values, Eq(num_keys * num_values_per_key));
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
 }  // namespace internal
 }  // namespace multimap
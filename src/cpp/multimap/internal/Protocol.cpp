@@ -0,0 +1,109 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/Protocol.hpp"
+
+#include <cerrno>
+#include <sys/socket.h>
+#include "multimap/internal/Varint.hpp"
+#include "multimap/thirdparty/mt/mt.hpp"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+// Sockets that may outlive their peer should then set SO_NOSIGPIPE.
+#endif
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+void appendUint(uint32_t value, std::string* output) {
+  char buffer[4];
+  const auto nbytes = Varint::writeUint(value, buffer, sizeof buffer);
+  output->append(buffer, nbytes);
+}
+
+}  // namespace
+
+const uint32_t Protocol::MAX_MESSAGE_SIZE = Varint::Limits::MAX_N4;
+
+void Protocol::append(const Message& message, std::string* output) {
+  std::string body(1, static_cast<char>(message.code));
+  appendFields(message.fields, &body);
+  mt::Check::isLessEqual(body.size(), MAX_MESSAGE_SIZE,
+                         "Protocol: Message of %zu bytes is too large",
+                         body.size());
+  appendUint(body.size(), output);
+  output->append(body);
+}
+
+size_t Protocol::parse(const char* data, size_t size, Message* message) {
+  uint32_t body_size = 0;
+  const auto nbytes = Varint::readUint(data, size, &body_size);
+  if (nbytes == 0) return 0;
+  // Four bytes always suffice for a varint, so that it is incomplete.
+  mt::Check::notZero(body_size, "Protocol: Message without code");
+  if (size - nbytes < body_size) return 0;
+  const auto body = data + nbytes;
+  message->code = static_cast<uint8_t>(body[0]);
+  message->fields = parseFields(body + 1, body_size - 1);
+  return nbytes + body_size;
+}
+
+void Protocol::appendFields(const std::vector<std::string>& fields,
+                            std::string* output) {
+  for (const auto& field : fields) {
+    mt::Check::isLessEqual(field.size(), MAX_MESSAGE_SIZE,
+                           "Protocol: Field of %zu bytes is too large",
+                           field.size());
+    appendUint(field.size(), output);
+    output->append(field);
+  }
+}
+
+std::vector<std::string> Protocol::parseFields(const char* data,
+                                               size_t size) {
+  std::vector<std::string> fields;
+  const auto end = data + size;
+  while (data != end) {
+    uint32_t field_size = 0;
+    const auto nbytes = Varint::readUint(data, end - data, &field_size);
+    mt::Check::notZero(nbytes, "Protocol: Truncated field size");
+    data += nbytes;
+    mt::Check::isLessEqual(field_size, static_cast<size_t>(end - data),
+                           "Protocol: Truncated field");
+    fields.emplace_back(data, field_size);
+    data += field_size;
+  }
+  return fields;
+}
+
+void Protocol::sendAll(int socket, const std::string& data) {
+  size_t offset = 0;
+  while (offset != data.size()) {
+    const auto result = ::send(socket, data.data() + offset,
+                               data.size() - offset, MSG_NOSIGNAL);
+    if (result == -1 && errno == EINTR) continue;
+    mt::Check::notEqual(result, -1, "send() failed because of '%s'",
+                        mt::errnostr());
+    offset += result;
+  }
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,110 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_PROTOCOL_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_PROTOCOL_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace multimap {
+namespace internal {
+
+struct Protocol {
+  // The binary protocol spoken between `Server` and `Client` over TCP.
+  //
+  // Each request and each response is a message with the format
+  //
+  //   varint size | uint8 code | field 1 | ... | field n
+  //
+  // where `size` is the number of bytes that follow it and each field is
+  // encoded as a varint size followed by that many bytes.  Clients may send
+  // any number of requests without waiting for responses, which the server
+  // returns in the same order.  Per request, the fields are:
+  //
+  //   Opcode         Request fields     Response fields
+  //   PUT            key value...       -
+  //   GET            key                value...
+  //   CONTAINS       key                flag
+  //   REMOVE         key                varint number of values removed
+  //   GET_MANY       key...             one encoded field list per key
+  //   CONTAINS_MANY  key...             one flag byte per key
+  //
+  // A flag is a single byte that is 0 or 1.  If a request fails, the
+  // response has `Status::ERROR` and the error message as its only field.
+
+  enum class Opcode : uint8_t {
+    PUT = 1,
+    GET = 2,
+    CONTAINS = 3,
+    REMOVE = 4,
+    GET_MANY = 5,
+    CONTAINS_MANY = 6
+  };
+
+  enum class Status : uint8_t { OK = 0, ERROR = 1 };
+
+  struct Message {
+    uint8_t code = 0;
+    // An `Opcode` for requests and a `Status` for responses.
+
+    std::vector<std::string> fields;
+
+    Message() = default;
+
+    Message(Opcode opcode, std::vector<std::string> fields)
+        : code(static_cast<uint8_t>(opcode)), fields(std::move(fields)) {}
+
+    Message(Status status, std::vector<std::string> fields)
+        : code(static_cast<uint8_t>(status)), fields(std::move(fields)) {}
+  };
+
+  static const uint32_t MAX_MESSAGE_SIZE;
+  // Maximum value of the size prefix of a message.
+
+  static void append(const Message& message, std::string* output);
+  // Appends the encoding of `message` to `output`.  Throws
+  // `std::runtime_error` if the message is larger than `MAX_MESSAGE_SIZE`.
+
+  static size_t parse(const char* data, size_t size, Message* message);
+  // Decodes the message at the beginning of `data` into `message` and
+  // returns the number of bytes consumed, or zero if `data` does not hold a
+  // complete message yet.  Throws `std::runtime_error` if the message is
+  // malformed.
+
+  static void appendFields(const std::vector<std::string>& fields,
+                           std::string* output);
+  // Appends the encoding of `fields`, which is also used to nest lists of
+  // values in a single field.
+
+  static std::vector<std::string> parseFields(const char* data, size_t size);
+  // Decodes all `size` bytes of `data` as written by `appendFields()`.
+  // Throws `std::runtime_error` if the encoding is malformed.
+
+  static void sendAll(int socket, const std::string& data);
+  // Writes all of `data` to `socket`, retrying after partial writes.
+  // Throws `std::runtime_error` if the connection fails.
+
+  Protocol() = delete;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_PROTOCOL_HPP_INCLUDED
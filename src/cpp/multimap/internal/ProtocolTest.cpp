@@ -0,0 +1,81 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <string>
+#include <vector>
+#include "gmock/gmock.h"
+#include "multimap/internal/Protocol.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::ElementsAre;
+using testing::Eq;
+using testing::IsEmpty;
+
+TEST(ProtocolTest, MessageSurvivesRoundTrip) {
+  std::string buffer;
+  Protocol::append(Protocol::Message(Protocol::Opcode::PUT,
+                                     {"key", "", std::string(1000, 'v')}),
+                   &buffer);
+  Protocol::Message message;
+  ASSERT_THAT(Protocol::parse(buffer.data(), buffer.size(), &message),
+              Eq(buffer.size()));
+  ASSERT_THAT(message.code, Eq(static_cast<uint8_t>(Protocol::Opcode::PUT)));
+  ASSERT_THAT(message.fields,
+              ElementsAre("key", "", std::string(1000, 'v')));
+}
+
+TEST(ProtocolTest, ParseReturnsZeroUntilMessageIsComplete) {
+  std::string buffer;
+  Protocol::append(Protocol::Message(Protocol::Opcode::GET, {"key"}), &buffer);
+  Protocol::append(Protocol::Message(Protocol::Status::OK, {}), &buffer);
+  const auto first_size = buffer.size() - 2;
+  Protocol::Message message;
+  for (size_t i = 0; i != first_size; ++i) {
+    ASSERT_THAT(Protocol::parse(buffer.data(), i, &message), Eq(0));
+  }
+  ASSERT_THAT(Protocol::parse(buffer.data(), buffer.size(), &message),
+              Eq(first_size));
+  ASSERT_THAT(Protocol::parse(buffer.data() + first_size, 2, &message),
+              Eq(2));
+  ASSERT_THAT(message.code, Eq(static_cast<uint8_t>(Protocol::Status::OK)));
+  ASSERT_THAT(message.fields, IsEmpty());
+}
+
+TEST(ProtocolTest, NestedFieldsSurviveRoundTrip) {
+  std::string field;
+  Protocol::appendFields({"a", "bc"}, &field);
+  ASSERT_THAT(Protocol::parseFields(field.data(), field.size()),
+              ElementsAre("a", "bc"));
+  ASSERT_THAT(Protocol::parseFields(field.data(), 0), IsEmpty());
+}
+
+TEST(ProtocolTest, ParseThrowsIfMessageIsMalformed) {
+  const std::string truncated_field("\x03\x01\x05x", 4);
+  Protocol::Message message;
+  ASSERT_THROW(Protocol::parse(truncated_field.data(), truncated_field.size(),
+                               &message),
+               std::runtime_error);
+  const std::string without_code("\x00", 1);
+  ASSERT_THROW(
+      Protocol::parse(without_code.data(), without_code.size(), &message),
+      std::runtime_error);
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -17,32 +17,51 @@
 
 #include "multimap/internal/SharedMutex.hpp"
 
-#include <mutex>
+#include <algorithm>
+#include <cstdint>
 
 namespace multimap {
 namespace internal {
 
 namespace {
 
-std::mutex shared_mutex_allocation_mutex;
+const size_t NUM_ALLOCATION_MUTEXES_LOG2 = 6;
+
+struct alignas(64) AllocationMutex {
+  std::mutex mutex;
+};
+// Padded to a cache line, so that threads using different mutexes do not
+// invalidate each other's caches.
+
+AllocationMutex allocation_mutexes[1 << NUM_ALLOCATION_MUTEXES_LOG2];
+
+std::mutex& getAllocationMutex(const SharedMutex* shared_mutex) {
+  const uint64_t address = reinterpret_cast<uintptr_t>(shared_mutex);
+  const auto index = (address * 0x9E3779B97F4A7C15ull) >>
+                     (64 - NUM_ALLOCATION_MUTEXES_LOG2);
+  return allocation_mutexes[index].mutex;
+}
+// Multiplicative hashing spreads instances that are laid out with a regular
+// stride, such as members of lists in an array, over all mutexes.
 
 }  // namespace
 
 void SharedMutex::lock() {
+  auto& allocation_mutex = getAllocationMutex(this);
   {
-    std::lock_guard<std::mutex> lock(shared_mutex_allocation_mutex);
+    std::lock_guard<std::mutex> lock(allocation_mutex);
     if (!mutex_) {
       mutex_ = allocate();
     }
     mutex_->refcount++;
   }
-  // shared_mutex_allocation_mutex is unlocked here in order to avoid
-  // a deadlock, because the following mutex acquisition might block.
+  // The allocation mutex is unlocked here in order to avoid a deadlock,
+  // because the following mutex acquisition might block.
   mutex_->lock();
 }
 
 bool SharedMutex::try_lock() {
-  std::lock_guard<std::mutex> lock(shared_mutex_allocation_mutex);
+  std::lock_guard<std::mutex> lock(getAllocationMutex(this));
   if (!mutex_) {
     mutex_ = allocate();
   }
@@ -52,7 +71,7 @@ bool SharedMutex::try_lock() {
 }
 
 void SharedMutex::unlock() {
-  std::lock_guard<std::mutex> lock(shared_mutex_allocation_mutex);
+  std::lock_guard<std::mutex> lock(getAllocationMutex(this));
   MT_ASSERT_NOT_ZERO(mutex_->refcount);
   mutex_->unlock();
   mutex_->refcount--;
@@ -62,20 +81,21 @@ void SharedMutex::unlock() {
 }
 
 void SharedMutex::lock_shared() {
+  auto& allocation_mutex = getAllocationMutex(this);
   {
-    std::lock_guard<std::mutex> lock(shared_mutex_allocation_mutex);
+    std::lock_guard<std::mutex> lock(allocation_mutex);
     if (!mutex_) {
       mutex_ = allocate();
     }
     mutex_->refcount++;
   }
-  // shared_mutex_allocation_mutex is unlocked here in order to avoid
-  // a deadlock, because the following mutex acquisition might block.
+  // The allocation mutex is unlocked here in order to avoid a deadlock,
+  // because the following mutex acquisition might block.
   mutex_->lock_shared();
 }
 
 bool SharedMutex::try_lock_shared() {
-  std::lock_guard<std::mutex> lock(shared_mutex_allocation_mutex);
+  std::lock_guard<std::mutex> lock(getAllocationMutex(this));
   if (!mutex_) {
     mutex_ = allocate();
   }
@@ -85,7 +105,7 @@ bool SharedMutex::try_lock_shared() {
 }
 
 void SharedMutex::unlock_shared() {
-  std::lock_guard<std::mutex> lock(shared_mutex_allocation_mutex);
+  std::lock_guard<std::mutex> lock(getAllocationMutex(this));
   MT_ASSERT_NOT_ZERO(mutex_->refcount);
   mutex_->unlock_shared();
   mutex_->refcount--;
@@ -94,18 +114,56 @@ void SharedMutex::unlock_shared() {
   }
 }
 
+void SharedMutex::lock_upgrade() {
+  auto& allocation_mutex = getAllocationMutex(this);
+  {
+    std::lock_guard<std::mutex> lock(allocation_mutex);
+    if (!mutex_) {
+      mutex_ = allocate();
+    }
+    mutex_->refcount++;
+  }
+  // The allocation mutex is unlocked here in order to avoid a deadlock,
+  // because the following mutex acquisition might block.
+  mutex_->lock_upgrade();
+}
+
+bool SharedMutex::try_lock_upgrade() {
+  std::lock_guard<std::mutex> lock(getAllocationMutex(this));
+  if (!mutex_) {
+    mutex_ = allocate();
+  }
+  const auto success = mutex_->try_lock_upgrade();
+  if (success) mutex_->refcount++;
+  return success;
+}
+
+void SharedMutex::unlock_upgrade() {
+  std::lock_guard<std::mutex> lock(getAllocationMutex(this));
+  MT_ASSERT_NOT_ZERO(mutex_->refcount);
+  mutex_->unlock_upgrade();
+  mutex_->refcount--;
+  if (mutex_->refcount == 0) {
+    deallocate(std::move(mutex_));
+  }
+}
+
+void SharedMutex::unlock_upgrade_and_lock_shared() {
+  std::lock_guard<std::mutex> lock(getAllocationMutex(this));
+  MT_ASSERT_NOT_ZERO(mutex_->refcount);
+  mutex_->unlock_upgrade_and_lock_shared();
+  // The reference is handed over to the shared ownership.
+}
+
 size_t SharedMutex::getCurrentPoolSize() {
-  std::lock_guard<std::mutex> lock(shared_mutex_allocation_mutex);
   return Pool::instance().getCurrentSize();
 }
 
 size_t SharedMutex::getMaximumPoolSize() {
-  std::lock_guard<std::mutex> lock(shared_mutex_allocation_mutex);
   return Pool::instance().getMaximumSize();
 }
 
 void SharedMutex::setMaximumPoolSize(size_t size) {
-  std::lock_guard<std::mutex> lock(shared_mutex_allocation_mutex);
   Pool::instance().setMaximumSize(size);
 }
 
@@ -114,40 +172,83 @@ SharedMutex::Pool& SharedMutex::Pool::instance() {
   return instance;
 }
 
-// Note: This function needs external locking.
-size_t SharedMutex::Pool::getCurrentSize() const { return mutexes_.size(); }
+size_t SharedMutex::Pool::getCurrentSize() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t size = mutexes_.size();
+  for (const auto cache : thread_caches_) {
+    size += cache->size.load(std::memory_order_relaxed);
+  }
+  return size;
+}
 
-// Note: This function needs external locking.
 size_t SharedMutex::Pool::getMaximumSize() const { return max_size_; }
 
-// Note: This function needs external locking.
 void SharedMutex::Pool::setMaximumSize(size_t size) { max_size_ = size; }
 
-// Note: This function needs external locking.
 void SharedMutex::Pool::push(std::unique_ptr<RefCountedMutex> mutex) {
-  if (mutexes_.size() < max_size_) {
+  auto& cache = getThreadCache();
+  const auto max_size = max_size_.load(std::memory_order_relaxed);
+  const auto cache_size = cache.mutexes.size();
+  if (cache_size < MAX_THREAD_CACHE_SIZE &&
+      cache_size + shared_size_.load(std::memory_order_relaxed) < max_size) {
+    cache.mutexes.push_back(std::move(mutex));
+    cache.size.store(cache.mutexes.size(), std::memory_order_relaxed);
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (cache_size + mutexes_.size() < max_size) {
     mutexes_.push_back(std::move(mutex));
+    shared_size_.store(mutexes_.size(), std::memory_order_relaxed);
   }
 }
 
-// Note: This function needs external locking.
 std::unique_ptr<SharedMutex::RefCountedMutex> SharedMutex::Pool::pop() {
   std::unique_ptr<RefCountedMutex> mutex;
+  auto& cache = getThreadCache();
+  if (!cache.mutexes.empty()) {
+    mutex = std::move(cache.mutexes.back());
+    cache.mutexes.pop_back();
+    cache.size.store(cache.mutexes.size(), std::memory_order_relaxed);
+    return mutex;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
   if (!mutexes_.empty()) {
     mutex = std::move(mutexes_.back());
     mutexes_.pop_back();
+    shared_size_.store(mutexes_.size(), std::memory_order_relaxed);
   }
   return mutex;
 }
 
-// Note: This function needs external locking.
+SharedMutex::Pool::ThreadCache::ThreadCache() {
+  auto& pool = Pool::instance();
+  std::lock_guard<std::mutex> lock(pool.mutex_);
+  pool.thread_caches_.push_back(this);
+}
+
+SharedMutex::Pool::ThreadCache::~ThreadCache() {
+  auto& pool = Pool::instance();
+  std::lock_guard<std::mutex> lock(pool.mutex_);
+  for (auto& mutex : mutexes) {
+    if (pool.mutexes_.size() >= pool.max_size_) break;
+    pool.mutexes_.push_back(std::move(mutex));
+  }
+  pool.shared_size_.store(pool.mutexes_.size(), std::memory_order_relaxed);
+  pool.thread_caches_.erase(std::find(pool.thread_caches_.begin(),
+                                      pool.thread_caches_.end(), this));
+}
+
+SharedMutex::Pool::ThreadCache& SharedMutex::Pool::getThreadCache() {
+  thread_local ThreadCache cache;
+  return cache;
+}
+
 std::unique_ptr<SharedMutex::RefCountedMutex> SharedMutex::allocate() {
   auto mutex = Pool::instance().pop();
   if (!mutex) mutex.reset(new RefCountedMutex());
   return mutex;
 }
 
-// Note: This function needs external locking.
 void SharedMutex::deallocate(std::unique_ptr<RefCountedMutex> mutex) {
   Pool::instance().push(std::move(mutex));
 }
@@ -18,8 +18,12 @@
 #ifndef MULTIMAP_INTERNAL_SHARED_MUTEX_HPP_INCLUDED
 #define MULTIMAP_INTERNAL_SHARED_MUTEX_HPP_INCLUDED
 
+#include <atomic>
 #include <memory>
+#include <mutex>
+#include <vector>
 #include <boost/thread/shared_mutex.hpp>
+#include "multimap/internal/LockProfiler.hpp"
 #include "multimap/thirdparty/mt/mt.hpp"
 
 namespace multimap {
@@ -31,6 +35,11 @@ class SharedMutex : public mt::Resource {
   // to allow many simultaneous instances. In contrast to the mentioned mutexes
   // it allocates the actual mutex only on demand from a mutex pool or the free
   // store, and deallocates it when all locks have been released.
+  //
+  // The pointer to the actual mutex and its reference count are guarded by
+  // one of several allocation mutexes, which is chosen by the address of the
+  // instance, and the pool keeps a small cache per thread, so that locking
+  // different instances from different threads rarely contends.
 
  public:
   SharedMutex() = default;
@@ -47,12 +56,29 @@ class SharedMutex : public mt::Resource {
 
   void unlock_shared();
 
+  void lock_upgrade();
+
+  bool try_lock_upgrade();
+
+  void unlock_upgrade();
+
+  void unlock_upgrade_and_lock_shared();
+  // Upgrade ownership is exclusive among upgrade owners, but shared with
+  // shared owners, with the same semantics as in boost::shared_mutex.
+
   static size_t getCurrentPoolSize();
   static size_t getMaximumPoolSize();
+  static size_t getSizeOfPooledMutex() { return sizeof(RefCountedMutex); }
   static void setMaximumPoolSize(size_t size);
+  // The maximum is checked when a mutex is returned to the pool, hence
+  // lowering it does not release mutexes that are already pooled.  Each
+  // thread only takes its own cache into account, so that the maximum can
+  // be exceeded by the caches of other threads.
 
  private:
-  struct RefCountedMutex : public boost::shared_mutex {
+  struct RefCountedMutex
+      : public ProfiledMutexIfEnabled<boost::shared_mutex,
+                                      LockProfiler::LockClass::LIST> {
     uint32_t refcount = 0;
   };
 
@@ -64,10 +90,29 @@ class SharedMutex : public mt::Resource {
     void push(std::unique_ptr<RefCountedMutex> mutex);
     std::unique_ptr<RefCountedMutex> pop();
 
+    static const size_t MAX_THREAD_CACHE_SIZE = 32;
+
    private:
+    struct ThreadCache {
+      ThreadCache();
+      ~ThreadCache();
+      std::vector<std::unique_ptr<RefCountedMutex>> mutexes;
+      std::atomic<size_t> size{0};
+      // Mirrors `mutexes.size()` for other threads.
+    };
+    // Mutexes that can be reused by the owning thread without locking.
+    // They are returned to the shared part of the pool when the thread exits.
+
+    static ThreadCache& getThreadCache();
+
     Pool() = default;
-    size_t max_size_ = 1000;
+    std::atomic<size_t> max_size_{1000};
+    std::atomic<size_t> shared_size_{0};
+    // Mirrors `mutexes_.size()` for reading without locking.
+
+    mutable std::mutex mutex_;
     std::vector<std::unique_ptr<RefCountedMutex>> mutexes_;
+    std::vector<const ThreadCache*> thread_caches_;
   };
 
   static std::unique_ptr<RefCountedMutex> allocate();
@@ -0,0 +1,167 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "gmock/gmock.h"
+#include "multimap/internal/Locks.hpp"
+#include "multimap/internal/SharedMutex.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+using testing::Le;
+
+TEST(SharedMutexTest, IsDefaultConstructible) {
+  ASSERT_TRUE(std::is_default_constructible<SharedMutex>::value);
+}
+
+TEST(SharedMutexTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<SharedMutex>::value);
+  ASSERT_FALSE(std::is_copy_assignable<SharedMutex>::value);
+}
+
+TEST(SharedMutexTest, ReleasedMutexIsReturnedToPoolAndReused) {
+  SharedMutex mutex;
+  mutex.lock();
+  const auto pool_size = SharedMutex::getCurrentPoolSize();
+  mutex.unlock();
+  ASSERT_THAT(SharedMutex::getCurrentPoolSize(), Eq(pool_size + 1));
+  mutex.lock_shared();
+  ASSERT_THAT(SharedMutex::getCurrentPoolSize(), Eq(pool_size));
+  mutex.unlock_shared();
+}
+
+TEST(SharedMutexTest, PoolDoesNotGrowBeyondMaximumSize) {
+  const auto max_pool_size = SharedMutex::getMaximumPoolSize();
+  SharedMutex::setMaximumPoolSize(SharedMutex::getCurrentPoolSize());
+  std::vector<SharedMutex> mutexes(2 * SharedMutex::getMaximumPoolSize() + 100);
+  for (auto& mutex : mutexes) {
+    mutex.lock();
+  }
+  for (auto& mutex : mutexes) {
+    mutex.unlock();
+  }
+  ASSERT_THAT(SharedMutex::getCurrentPoolSize(),
+              Le(SharedMutex::getMaximumPoolSize()));
+  SharedMutex::setMaximumPoolSize(max_pool_size);
+}
+
+TEST(SharedMutexTest, ManyThreadsLockingManyMutexesKeepCountsConsistent) {
+  const size_t num_threads = 8;
+  const size_t num_rounds = 20000;
+  std::vector<SharedMutex> mutexes(1000);
+  std::vector<uint32_t> counters(mutexes.size());
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t != num_threads; ++t) {
+    threads.emplace_back([&, t] {
+      for (size_t i = 0; i != num_rounds; ++i) {
+        const auto j = (i * 7919 + t) % mutexes.size();
+        if (i % 4 == 0) {
+          ReaderLockGuard<SharedMutex> lock(mutexes[j]);
+          (void)counters[j];
+        } else {
+          WriterLockGuard<SharedMutex> lock(mutexes[j]);
+          ++counters[j];
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  uint64_t sum = 0;
+  for (const auto counter : counters) {
+    sum += counter;
+  }
+  ASSERT_THAT(sum, Eq(num_threads * num_rounds * 3 / 4));
+}
+
+TEST(SharedMutexTest, DISABLED_BenchmarkLockingDistinctMutexesFromManyThreads) {
+  const size_t num_rounds = 1000000;
+  const size_t num_mutexes_per_thread = 1000;
+
+  // Reference for the previous implementation, in which allocating and
+  // releasing every mutex was guarded by a single global mutex.
+  struct GloballyGuardedMutex {
+    std::unique_ptr<boost::shared_mutex> mutex;
+    uint32_t refcount = 0;
+  };
+  std::mutex global_mutex;
+  std::vector<std::unique_ptr<boost::shared_mutex> > global_pool;
+
+  typedef std::chrono::microseconds Micros;
+  const auto run = [&](size_t num_threads, bool global) {
+    std::vector<SharedMutex> mutexes(num_threads * num_mutexes_per_thread);
+    std::vector<GloballyGuardedMutex> guarded(mutexes.size());
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t != num_threads; ++t) {
+      threads.emplace_back([&, t] {
+        const auto first = t * num_mutexes_per_thread;
+        for (size_t i = 0; i != num_rounds; ++i) {
+          const auto j = first + i % num_mutexes_per_thread;
+          if (global) {
+            auto& entry = guarded[j];
+            {
+              std::lock_guard<std::mutex> lock(global_mutex);
+              if (!entry.mutex) {
+                if (global_pool.empty()) {
+                  entry.mutex.reset(new boost::shared_mutex());
+                } else {
+                  entry.mutex = std::move(global_pool.back());
+                  global_pool.pop_back();
+                }
+              }
+              ++entry.refcount;
+            }
+            entry.mutex->lock();
+            std::lock_guard<std::mutex> lock(global_mutex);
+            entry.mutex->unlock();
+            if (--entry.refcount == 0) {
+              global_pool.push_back(std::move(entry.mutex));
+            }
+          } else {
+            mutexes[j].lock();
+            mutexes[j].unlock();
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    return std::chrono::duration_cast<Micros>(
+               std::chrono::steady_clock::now() - start).count();
+  };
+
+  for (const size_t num_threads : {1, 2, 4, 8}) {
+    std::printf("%zu threads: global lock %ld us, SharedMutex %ld us\n",
+                num_threads, static_cast<long>(run(num_threads, true)),
+                static_cast<long>(run(num_threads, false)));
+  }
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,114 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/SkipIndex.hpp"
+
+#include <algorithm>
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+uint32_t lowestBit(uint32_t i) { return i & (0 - i); }
+
+uint32_t getPrefixSum(const std::vector<uint32_t>& tree, uint32_t i) {
+  uint32_t sum = 0;
+  for (; i != 0; i -= lowestBit(i)) {
+    sum += tree[i - 1];
+  }
+  return sum;
+}
+// Returns the sum of the first `i` counts.
+
+}  // namespace
+
+SkipIndex::SkipIndex(uint32_t num_blocks) : num_blocks_(num_blocks) {}
+
+SkipIndex* SkipIndex::clone() const {
+  const auto copy = new SkipIndex(num_blocks_);
+  copy->entries_ = entries_;
+  copy->fenwick_tree_ = fenwick_tree_;
+  copy->num_removed_before_first_ = num_removed_before_first_;
+  copy->num_values_ = num_values_;
+  copy->next_position_ = next_position_;
+  copy->last_block_index_ = last_block_index_;
+  return copy;
+}
+
+void SkipIndex::addValue(uint32_t offset) { addValue(num_blocks_, offset); }
+
+void SkipIndex::addValue(uint32_t block_index, uint32_t offset) {
+  const auto position = num_values_++;
+  const auto is_first_in_block = block_index != last_block_index_;
+  last_block_index_ = block_index;
+  if (!is_first_in_block || position < next_position_) return;
+
+  Entry entry;
+  entry.position = position;
+  entry.block_index = block_index;
+  entry.offset = offset;
+  entries_.push_back(entry);
+  // Appends a zero count, whose node in the tree sums up the counts of the
+  // entries it covers.
+  const uint32_t i = fenwick_tree_.size() + 1;
+  fenwick_tree_.push_back(getPrefixSum(fenwick_tree_, i - 1) -
+                          getPrefixSum(fenwick_tree_, i - lowestBit(i)));
+  next_position_ = position + INTERVAL;
+}
+
+void SkipIndex::remove(uint32_t position) {
+  MT_REQUIRE_LT(position, num_values_);
+  const auto it = std::upper_bound(
+      entries_.begin(), entries_.end(), position,
+      [](uint32_t pos, const Entry& entry) { return pos < entry.position; });
+  if (it == entries_.begin()) {
+    ++num_removed_before_first_;
+    return;
+  }
+  // The removed value belongs to the gap that starts with entry `i - 1`.
+  for (uint32_t i = it - entries_.begin(); i <= fenwick_tree_.size();
+       i += lowestBit(i)) {
+    ++fenwick_tree_[i - 1];
+  }
+}
+
+bool SkipIndex::find(uint32_t num_valid, Entry* entry,
+                     uint32_t* num_valid_before) const {
+  // The number of valid values in front of an entry never decreases.
+  size_t first = 0;
+  size_t last = entries_.size();
+  while (first != last) {
+    const auto middle = first + (last - first) / 2;
+    if (getNumValidBefore(middle) <= num_valid) {
+      first = middle + 1;
+    } else {
+      last = middle;
+    }
+  }
+  if (first == 0) return false;
+  *entry = entries_[first - 1];
+  *num_valid_before = getNumValidBefore(first - 1);
+  return true;
+}
+
+uint32_t SkipIndex::getNumRemovedBefore(size_t index) const {
+  return num_removed_before_first_ + getPrefixSum(fenwick_tree_, index);
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,121 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_SKIP_INDEX_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_SKIP_INDEX_HPP_INCLUDED
+
+#include <limits>
+#include <vector>
+#include <boost/smart_ptr/intrusive_ref_counter.hpp>
+#include "multimap/thirdparty/mt/mt.hpp"
+
+namespace multimap {
+namespace internal {
+
+class SkipIndex
+    : public mt::Resource,
+      public boost::intrusive_ref_counter<SkipIndex,
+                                          boost::thread_safe_counter> {
+  // Sparse index of the values of a list.  Roughly every `INTERVAL` values,
+  // the first value whose header starts in a new block is recorded together
+  // with its location, so that an iterator can jump close to any value
+  // without decoding the values in front of it.  Such a value never shares a
+  // prefix with its predecessor, hence it can be decoded on its own.
+  //
+  // Positions count all values including removed ones, see
+  // `List::removeAt()`.  The number of removed values in front of each entry
+  // is maintained in a Fenwick tree, so that entries can also be found by the
+  // number of valid values in front of them in logarithmic time.
+  //
+  // Lists share their index with the iterators that use it, which see the
+  // values of the list as of their creation.  Hence, a list copies its index
+  // before appending to it while iterators refer to it.
+
+ public:
+  static const uint32_t INTERVAL = 256;
+
+  struct Entry {
+    uint32_t position = 0;
+    uint32_t block_index = 0;
+    // Index of the block in the list, where the index of the tail block
+    // equals the number of flushed blocks.
+
+    uint32_t offset = 0;
+    // Offset of the value's header in the block.
+  };
+
+  explicit SkipIndex(uint32_t num_blocks);
+  // Creates an index for an empty list that consists of `num_blocks` flushed
+  // blocks.  The values that are in these blocks must be added via the
+  // second version of `addValue()` in the order of the list.
+
+  SkipIndex* clone() const;
+  // Returns a new copy of the index, which is not shared by anyone.
+
+  void addBlock() { ++num_blocks_; }
+  // Must be called for each block that is flushed to the store.
+
+  void addValue(uint32_t offset);
+  // Must be called for each value that is appended to the list, where
+  // `offset` is the offset of its header in the tail block.
+
+  void addValue(uint32_t block_index, uint32_t offset);
+  // Same as before, but for values that are located in flushed blocks,
+  // which is the case when an existing list is indexed.
+
+  void remove(uint32_t position);
+  // Must be called for each value that is marked as removed.
+
+  bool find(uint32_t num_valid, Entry* entry,
+            uint32_t* num_valid_before) const;
+  // Finds the last entry that is preceded by at most `num_valid` valid
+  // values.  Returns `false` if there is no such entry.  Otherwise, the
+  // entry and the number of valid values in front of it are assigned.
+
+  const Entry& getEntry(size_t index) const { return entries_[index]; }
+
+  uint32_t getNumValidBefore(size_t index) const {
+    return entries_[index].position - getNumRemovedBefore(index);
+  }
+  // Returns the number of valid values in front of the entry with `index`.
+
+  uint32_t getNumBlocks() const { return num_blocks_; }
+
+  uint32_t getNumValues() const { return num_values_; }
+
+  size_t size() const { return entries_.size(); }
+
+ private:
+  uint32_t getNumRemovedBefore(size_t index) const;
+  // Returns the number of removed values in front of `entries_[index]`.
+
+  std::vector<Entry> entries_;
+  std::vector<uint32_t> fenwick_tree_;
+  // Counts the removed values between adjacent entries.
+
+  uint32_t num_removed_before_first_ = 0;
+  uint32_t num_blocks_ = 0;
+  uint32_t num_values_ = 0;
+  uint32_t next_position_ = 0;
+  uint32_t last_block_index_ = std::numeric_limits<uint32_t>::max();
+  // Index of the block that contains the header of the last value.
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_SKIP_INDEX_HPP_INCLUDED
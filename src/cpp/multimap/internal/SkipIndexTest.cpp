@@ -0,0 +1,129 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <type_traits>
+#include <boost/smart_ptr/intrusive_ptr.hpp>
+#include "gmock/gmock.h"
+#include "multimap/internal/SkipIndex.hpp"
+
+namespace multimap {
+namespace internal {
+
+TEST(SkipIndexTest, IsNotDefaultConstructible) {
+  ASSERT_FALSE(std::is_default_constructible<SkipIndex>::value);
+}
+
+TEST(SkipIndexTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<SkipIndex>::value);
+  ASSERT_FALSE(std::is_copy_assignable<SkipIndex>::value);
+}
+
+struct SkipIndexTestFixture : public testing::Test {
+  void SetUp() override {
+    // Each block holds 100 values of 5 bytes.
+    for (uint32_t block = 0; block != 10; ++block) {
+      for (uint32_t offset = 0; offset != 500; offset += 5) {
+        index.addValue(offset);
+      }
+      index.addBlock();
+    }
+  }
+
+  SkipIndex index{0};
+  SkipIndex::Entry entry;
+  uint32_t num_valid_before = 0;
+};
+
+TEST(SkipIndexTest, FindFailsIfEmpty) {
+  SkipIndex index(3);
+  SkipIndex::Entry entry;
+  uint32_t num_valid_before = 0;
+  ASSERT_FALSE(index.find(0, &entry, &num_valid_before));
+  ASSERT_EQ(index.getNumBlocks(), 3);
+  ASSERT_EQ(index.getNumValues(), 0);
+}
+
+TEST_F(SkipIndexTestFixture, IndexesFirstValueOfBlockAfterInterval) {
+  ASSERT_EQ(index.getNumBlocks(), 10);
+  ASSERT_EQ(index.getNumValues(), 1000);
+  ASSERT_EQ(index.size(), 4);
+  // Entries are at positions 0, 300, 600, and 900.
+
+  ASSERT_TRUE(index.find(350, &entry, &num_valid_before));
+  ASSERT_EQ(entry.position, 300);
+  ASSERT_EQ(entry.block_index, 3);
+  ASSERT_EQ(entry.offset, 0);
+  ASSERT_EQ(num_valid_before, 300);
+
+  ASSERT_TRUE(index.find(299, &entry, &num_valid_before));
+  ASSERT_EQ(entry.position, 0);
+  ASSERT_TRUE(index.find(5000, &entry, &num_valid_before));
+  ASSERT_EQ(entry.position, 900);
+}
+
+TEST_F(SkipIndexTestFixture, FindCountsOnlyValidValues) {
+  index.remove(10);
+  index.remove(299);
+  index.remove(300);
+  index.remove(650);
+  ASSERT_TRUE(index.find(297, &entry, &num_valid_before));
+  ASSERT_EQ(entry.position, 0);
+  ASSERT_TRUE(index.find(298, &entry, &num_valid_before));
+  ASSERT_EQ(entry.position, 300);
+  ASSERT_EQ(num_valid_before, 298);
+  ASSERT_TRUE(index.find(597, &entry, &num_valid_before));
+  ASSERT_EQ(entry.position, 600);
+  ASSERT_EQ(num_valid_before, 597);
+  ASSERT_TRUE(index.find(900, &entry, &num_valid_before));
+  ASSERT_EQ(entry.position, 900);
+  ASSERT_EQ(num_valid_before, 896);
+}
+
+TEST_F(SkipIndexTestFixture, CloneIsIndependentOfOriginal) {
+  index.remove(10);
+  boost::intrusive_ptr<SkipIndex> copy(index.clone());
+  copy->remove(20);
+  copy->addBlock();
+  copy->addValue(0);
+  ASSERT_EQ(index.getNumBlocks(), 10);
+  ASSERT_EQ(index.getNumValues(), 1000);
+  ASSERT_EQ(copy->getNumBlocks(), 11);
+  ASSERT_EQ(copy->getNumValues(), 1001);
+  ASSERT_TRUE(index.find(300, &entry, &num_valid_before));
+  ASSERT_EQ(num_valid_before, 299);
+  ASSERT_TRUE(copy->find(300, &entry, &num_valid_before));
+  ASSERT_EQ(num_valid_before, 298);
+}
+
+TEST(SkipIndexTest, IndexesOnlyValuesThatStartInNewBlock) {
+  SkipIndex index(0);
+  index.addValue(0, 7);
+  for (uint32_t i = 1; i != 1000; ++i) {
+    index.addValue(0, 7 + i);
+  }
+  index.addValue(2, 3);
+  ASSERT_EQ(index.size(), 2);
+  SkipIndex::Entry entry;
+  uint32_t num_valid_before = 0;
+  ASSERT_TRUE(index.find(1000, &entry, &num_valid_before));
+  ASSERT_EQ(entry.position, 1000);
+  ASSERT_EQ(entry.block_index, 2);
+  ASSERT_EQ(entry.offset, 3);
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,212 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/Sorter.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <boost/filesystem/operations.hpp>
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+const uint32_t ARENA_CHUNK_SIZE = mt::MiB(1);
+
+const size_t RUN_BUFFER_SIZE = mt::KiB(64);
+// Size of the stdio buffer of each run.  Merging many runs reads from all
+// of them, so this is kept small.
+
+}  // namespace
+
+class Sorter::MemoryIter : public Iterator {
+ public:
+  explicit MemoryIter(const std::vector<Bytes>& values) : values_(values) {}
+
+  uint32_t available() const override { return values_.size() - index_; }
+
+  bool hasNext() const override { return index_ != values_.size(); }
+
+  Bytes next() override {
+    MT_REQUIRE_TRUE(hasNext());
+    return values_[index_++];
+  }
+
+  Bytes peekNext() override {
+    MT_REQUIRE_TRUE(hasNext());
+    return values_[index_];
+  }
+
+  uint32_t skip(uint32_t num_values) override {
+    const auto num_skipped = std::min(num_values, available());
+    index_ += num_skipped;
+    return num_skipped;
+  }
+
+ private:
+  const std::vector<Bytes>& values_;
+  size_t index_ = 0;
+};
+
+class Sorter::MergeIter : public Iterator {
+ public:
+  MergeIter(const std::vector<std::unique_ptr<Run> >& runs,
+            const Compare& compare, uint32_t num_values)
+      : runs_(runs), available_(num_values) {
+    heap_order_ = [this, &compare](size_t a, size_t b) {
+      const Bytes lhs = runs_[a]->value;
+      const Bytes rhs = runs_[b]->value;
+      if (compare(rhs, lhs)) return true;
+      return !compare(lhs, rhs) && a > b;
+    };
+    // The front of the heap is the run with the smallest current value.
+    // Runs with equal values are ordered by index, which keeps the sort
+    // stable.
+    for (size_t i = 0; i != runs_.size(); ++i) {
+      if (runs_[i]->readNext()) heap_.push_back(i);
+    }
+    std::make_heap(heap_.begin(), heap_.end(), heap_order_);
+  }
+
+  uint32_t available() const override { return available_; }
+
+  bool hasNext() const override { return available_ != 0; }
+
+  Bytes next() override {
+    MT_REQUIRE_TRUE(hasNext());
+    std::pop_heap(heap_.begin(), heap_.end(), heap_order_);
+    auto& run = *runs_[heap_.back()];
+    value_.swap(run.value);
+    if (run.readNext()) {
+      std::push_heap(heap_.begin(), heap_.end(), heap_order_);
+    } else {
+      heap_.pop_back();
+    }
+    --available_;
+    return value_;
+  }
+
+  Bytes peekNext() override {
+    MT_REQUIRE_TRUE(hasNext());
+    return runs_[heap_.front()]->value;
+  }
+
+  uint32_t skip(uint32_t num_values) override {
+    uint32_t num_skipped = 0;
+    while (num_skipped != num_values && hasNext()) {
+      next();
+      ++num_skipped;
+    }
+    return num_skipped;
+  }
+
+ private:
+  const std::vector<std::unique_ptr<Run> >& runs_;
+  std::function<bool(size_t, size_t)> heap_order_;
+  std::vector<size_t> heap_;
+  std::string value_;
+  uint32_t available_ = 0;
+};
+
+Sorter::Sorter(const Compare& compare, const Options& options)
+    : compare_(compare), options_(options), arena_(ARENA_CHUNK_SIZE) {
+  MT_REQUIRE_TRUE(static_cast<bool>(compare_));
+  if (options_.directory.empty()) {
+    options_.directory = boost::filesystem::temp_directory_path();
+  }
+}
+
+Sorter::~Sorter() = default;
+
+void Sorter::add(const Bytes& value) {
+  clearIfSorted();
+  MT_REQUIRE_LT(num_values_, std::numeric_limits<uint32_t>::max());
+  char* data = nullptr;
+  if (!value.empty()) {
+    data = arena_.allocate(value.size());
+    std::memcpy(data, value.data(), value.size());
+  }
+  values_.emplace_back(data, value.size());
+  num_bytes_ += value.size() + sizeof(Bytes);
+  ++num_values_;
+  if (num_bytes_ >= options_.max_memory) {
+    writeRun();
+  }
+}
+
+std::unique_ptr<Iterator> Sorter::sort() {
+  clearIfSorted();
+  sorted_ = true;
+  if (runs_.empty()) {
+    std::stable_sort(values_.begin(), values_.end(), compare_);
+    return std::unique_ptr<Iterator>(new MemoryIter(values_));
+  }
+  if (!values_.empty()) {
+    writeRun();
+  }
+  for (const auto& run : runs_) {
+    std::rewind(run->file.get());
+  }
+  return std::unique_ptr<Iterator>(new MergeIter(runs_, compare_, num_values_));
+}
+
+bool Sorter::Run::readNext() {
+  if (num_values_left == 0) return false;
+  uint32_t size;
+  mt::fread(file.get(), &size, sizeof size);
+  value.resize(size);
+  if (size != 0) mt::fread(file.get(), &value[0], size);
+  --num_values_left;
+  return true;
+}
+
+void Sorter::writeRun() {
+  std::stable_sort(values_.begin(), values_.end(), compare_);
+  std::unique_ptr<Run> run(new Run());
+  const auto path = options_.directory /
+                    boost::filesystem::unique_path("multimap.sort.%%%%-%%%%");
+  run->file = mt::fopen(path, "w+");
+  boost::filesystem::remove(path);
+  run->buffer.reset(new char[RUN_BUFFER_SIZE]);
+  std::setvbuf(run->file.get(), run->buffer.get(), _IOFBF, RUN_BUFFER_SIZE);
+  for (const auto& value : values_) {
+    const uint32_t size = value.size();
+    mt::fwrite(run->file.get(), &size, sizeof size);
+    mt::fwrite(run->file.get(), value.data(), value.size());
+  }
+  run->num_values_left = values_.size();
+  runs_.push_back(std::move(run));
+  values_.clear();
+  arena_.deallocateAll();
+  num_bytes_ = 0;
+}
+
+void Sorter::clearIfSorted() {
+  if (!sorted_) return;
+  values_.clear();
+  runs_.clear();
+  arena_.deallocateAll();
+  num_bytes_ = 0;
+  num_values_ = 0;
+  sorted_ = false;
+}
+
+}  // namespace internal
+}  // namespace multimap
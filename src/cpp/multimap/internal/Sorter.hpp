@@ -0,0 +1,103 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_SORTER_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_SORTER_HPP_INCLUDED
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/filesystem/path.hpp>
+#include "multimap/internal/Arena.hpp"
+#include "multimap/thirdparty/mt/mt.hpp"
+#include "multimap/Bytes.hpp"
+#include "multimap/Iterator.hpp"
+
+namespace multimap {
+namespace internal {
+
+class Sorter : public mt::Resource {
+  // Sorts the values of a list using a bounded amount of memory.  Values are
+  // copied into an arena and only references to them are sorted.  Whenever
+  // the memory in use exceeds `Options::max_memory`, the values are sorted and
+  // written to a temporary file as a run, and `sort()` merges all runs.  The
+  // sort is stable.  Objects of this class are not thread-safe.
+
+ public:
+  typedef std::function<bool(const Bytes&, const Bytes&)> Compare;
+
+  struct Options {
+    uint64_t max_memory = mt::MiB(64);
+
+    boost::filesystem::path directory;
+    // Where runs are written.  If empty, the system's temporary directory is
+    // used.  The files are unlinked right after creation.
+  };
+
+  Sorter(const Compare& compare, const Options& options);
+
+  ~Sorter();
+
+  void add(const Bytes& value);
+
+  std::unique_ptr<Iterator> sort();
+  // Returns an iterator over all values added since the last call of this
+  // function in ascending order.  The iterator must be destroyed before the
+  // next call of `add()` or `sort()`.  Values returned by the iterator are
+  // valid until it is advanced.
+
+  size_t getNumRuns() const { return runs_.size(); }
+  // Returns the number of runs that have been written for the values added
+  // since the last but one call of `sort()`.
+
+ private:
+  struct Run : public mt::Resource {
+    std::unique_ptr<char[]> buffer;
+    mt::AutoCloseFile file;
+    // Declared after `buffer`, which it uses until it is closed.
+    std::string value;
+    uint32_t num_values_left = 0;
+    // Not counting `value`.
+
+    bool readNext();
+  };
+  // A sorted sequence of values in a temporary file, each prefixed with its
+  // size.  When merging, `value` holds the current value of the run.
+
+  class MemoryIter;
+  class MergeIter;
+
+  void writeRun();
+  void clearIfSorted();
+
+  Compare compare_;
+  Options options_;
+  Arena arena_;
+  std::vector<Bytes> values_;
+  std::vector<std::unique_ptr<Run> > runs_;
+  uint64_t num_bytes_ = 0;
+  // Memory used by the values that have not been written to a run.
+
+  uint64_t num_values_ = 0;
+  bool sorted_ = false;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_SORTER_HPP_INCLUDED
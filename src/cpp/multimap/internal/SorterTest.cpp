@@ -0,0 +1,140 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <algorithm>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "gmock/gmock.h"
+#include "multimap/internal/Sorter.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::ElementsAre;
+using testing::Eq;
+using testing::Gt;
+
+const Sorter::Compare LESS_THAN = [](const Bytes& a, const Bytes& b) {
+  return a < b;
+};
+
+std::vector<std::string> readAll(Iterator* iter) {
+  std::vector<std::string> values;
+  while (iter->hasNext()) {
+    values.push_back(iter->next().toString());
+  }
+  return values;
+}
+
+struct SorterTestWithMaxMemory : public testing::TestWithParam<uint64_t> {
+  Sorter::Options getOptions() const {
+    Sorter::Options options;
+    options.max_memory = GetParam();
+    return options;
+  }
+};
+
+TEST(SorterTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<Sorter>::value);
+  ASSERT_FALSE(std::is_copy_assignable<Sorter>::value);
+}
+
+TEST_P(SorterTestWithMaxMemory, SortsValues) {
+  Sorter sorter(LESS_THAN, getOptions());
+  std::vector<std::string> expected;
+  for (auto i = 0; i != 10000; ++i) {
+    expected.push_back(std::to_string((i * 7919) % 10007));
+    sorter.add(expected.back());
+  }
+  expected.push_back("");
+  sorter.add(expected.back());
+  std::sort(expected.begin(), expected.end());
+  const auto iter = sorter.sort();
+  ASSERT_THAT(iter->available(), Eq(expected.size()));
+  ASSERT_THAT(readAll(iter.get()), Eq(expected));
+  ASSERT_THAT(iter->available(), Eq(0));
+}
+
+TEST_P(SorterTestWithMaxMemory, SortIsStable) {
+  const Sorter::Compare compare_first_char = [](const Bytes& a,
+                                                const Bytes& b) {
+    return a.data()[0] < b.data()[0];
+  };
+  Sorter sorter(compare_first_char, getOptions());
+  std::vector<std::string> expected;
+  for (auto i = 0; i != 10000; ++i) {
+    expected.push_back(std::string(1, 'a' + i % 26) + std::to_string(i));
+    sorter.add(expected.back());
+  }
+  std::stable_sort(expected.begin(), expected.end(),
+                   [](const std::string& a, const std::string& b) {
+                     return a[0] < b[0];
+                   });
+  ASSERT_THAT(readAll(sorter.sort().get()), Eq(expected));
+}
+
+TEST_P(SorterTestWithMaxMemory, PeekNextAndSkipDoNotChangeOrder) {
+  Sorter sorter(LESS_THAN, getOptions());
+  for (const auto value : {"4", "2", "5", "1", "3"}) {
+    sorter.add(value);
+  }
+  const auto iter = sorter.sort();
+  ASSERT_THAT(iter->peekNext(), Eq("1"));
+  ASSERT_THAT(iter->skip(2), Eq(2));
+  ASSERT_THAT(iter->next(), Eq("3"));
+  ASSERT_THAT(iter->available(), Eq(2));
+  ASSERT_THAT(iter->skip(10), Eq(2));
+  ASSERT_FALSE(iter->hasNext());
+}
+
+TEST_P(SorterTestWithMaxMemory, SorterCanBeReused) {
+  Sorter sorter(LESS_THAN, getOptions());
+  for (const auto value : {"c", "b", "a"}) {
+    sorter.add(value);
+  }
+  ASSERT_THAT(readAll(sorter.sort().get()), ElementsAre("a", "b", "c"));
+  ASSERT_TRUE(readAll(sorter.sort().get()).empty());
+  for (const auto value : {"z", "y"}) {
+    sorter.add(value);
+  }
+  ASSERT_THAT(readAll(sorter.sort().get()), ElementsAre("y", "z"));
+}
+
+INSTANTIATE_TEST_CASE_P(Parameterized, SorterTestWithMaxMemory,
+                        testing::Values(1, mt::KiB(4), mt::MiB(64)));
+
+TEST(SorterTest, SpillsRunsWhenMaxMemoryIsExceeded) {
+  Sorter::Options options;
+  options.max_memory = mt::KiB(4);
+  Sorter sorter(LESS_THAN, options);
+  for (auto i = 0; i != 10000; ++i) {
+    sorter.add(std::to_string(i));
+  }
+  ASSERT_THAT(sorter.getNumRuns(), Gt(10));
+  options.max_memory = mt::MiB(64);
+  Sorter other_sorter(LESS_THAN, options);
+  for (auto i = 0; i != 10000; ++i) {
+    other_sorter.add(std::to_string(i));
+  }
+  ASSERT_THAT(other_sorter.getNumRuns(), Eq(0));
+  ASSERT_THAT(readAll(sorter.sort().get()),
+              Eq(readAll(other_sorter.sort().get())));
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,71 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/Spiller.hpp"
+
+#include <exception>
+
+namespace multimap {
+namespace internal {
+
+const std::chrono::milliseconds Spiller::DEFAULT_INTERVAL(100);
+
+Spiller::Spiller(uint64_t max_memory_usage,
+                 std::chrono::milliseconds interval)
+    : interval_(interval),
+      max_memory_usage_(max_memory_usage),
+      thread_(&Spiller::run, this) {}
+
+Spiller::~Spiller() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_one();
+  thread_.join();
+}
+
+void Spiller::add(Partition* partition) {
+  MT_REQUIRE_NOT_NULL(partition);
+  std::lock_guard<std::mutex> lock(mutex_);
+  partitions_.push_back(partition);
+}
+
+void Spiller::run() {
+  std::vector<Partition*> partitions;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cond_.wait_for(lock, interval_, [this] { return stop_; })) {
+    partitions = partitions_;
+    lock.unlock();
+    // Adding partitions is not blocked while spilling.
+    for (const auto partition : partitions) {
+      try {
+        if (partition->getMemoryUsage() > max_memory_usage_) {
+          partition->checkpoint();
+          partition->spillColdLists(max_memory_usage_ / 2);
+        }
+      } catch (std::exception& error) {
+        mt::log() << "Spiller could not spill cold lists: " << error.what()
+                  << '\n';
+      }
+    }
+    lock.lock();
+  }
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,68 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_SPILLER_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_SPILLER_HPP_INCLUDED
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "multimap/internal/Partition.hpp"
+#include "multimap/thirdparty/mt/mt.hpp"
+
+namespace multimap {
+namespace internal {
+
+class Spiller : public mt::Resource {
+  // A background thread that periodically checks the memory usage of all
+  // added partitions.  A partition that exceeds the limit is checkpointed,
+  // which flushes the tail blocks of its modified lists, and then evicts
+  // lists via `spillColdLists()` until it uses about half of the limit, so
+  // that ingestion is not interrupted by each new key.  Objects of this
+  // class are thread-safe.
+
+ public:
+  static const std::chrono::milliseconds DEFAULT_INTERVAL;
+
+  explicit Spiller(uint64_t max_memory_usage,
+                   std::chrono::milliseconds interval = DEFAULT_INTERVAL);
+  // `max_memory_usage` is the limit in bytes that applies to each partition.
+
+  ~Spiller();
+  // Stops the background thread.
+
+  void add(Partition* partition);
+  // Requires: `partition` is writable and outlives this object.
+
+ private:
+  void run();
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<Partition*> partitions_;
+  const std::chrono::milliseconds interval_;
+  const uint64_t max_memory_usage_;
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_SPILLER_HPP_INCLUDED
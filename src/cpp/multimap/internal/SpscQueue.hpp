@@ -0,0 +1,82 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_SPSC_QUEUE_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_SPSC_QUEUE_HPP_INCLUDED
+
+#include <atomic>
+#include <utility>
+#include <vector>
+#include "multimap/thirdparty/mt/mt.hpp"
+
+namespace multimap {
+namespace internal {
+
+template <typename T>
+class SpscQueue : public mt::Resource {
+  // A bounded FIFO queue for exactly one producer thread and one consumer
+  // thread.  Both synchronize via two atomic indices into a ring buffer
+  // without taking locks, so that neither side ever waits for the other to
+  // be scheduled.  Waiting for space or elements is up to the caller.
+
+ public:
+  explicit SpscQueue(size_t capacity) : slots_(capacity + 1) {
+    MT_REQUIRE_NOT_ZERO(capacity);
+  }
+
+  bool tryPush(T&& element) {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    const auto next = increment(tail);
+    if (next == head_.load(std::memory_order_acquire)) return false;
+    slots_[tail] = std::move(element);
+    tail_.store(next, std::memory_order_release);
+    return true;
+  }
+  // Moves `element` into the queue unless it is full.  Must only be called
+  // by the producer thread.
+
+  bool tryPop(T* element) {
+    const auto head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire)) return false;
+    *element = std::move(slots_[head]);
+    head_.store(increment(head), std::memory_order_release);
+    return true;
+  }
+  // Moves the oldest element to `element` unless the queue is empty.  Must
+  // only be called by the consumer thread.
+
+  size_t capacity() const { return slots_.size() - 1; }
+
+ private:
+  size_t increment(size_t index) const {
+    return (index + 1 == slots_.size()) ? 0 : index + 1;
+  }
+
+  std::vector<T> slots_;
+  // One slot always stays empty to tell a full queue from an empty one.
+
+  std::atomic<size_t> head_{0};
+  char padding_[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> tail_{0};
+  // The indices are written by different threads, so they are kept in
+  // different cache lines.
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_SPSC_QUEUE_HPP_INCLUDED
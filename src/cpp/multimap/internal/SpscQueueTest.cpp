@@ -0,0 +1,87 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include "gmock/gmock.h"
+#include "multimap/internal/SpscQueue.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+
+TEST(SpscQueueTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<SpscQueue<int> >::value);
+  ASSERT_FALSE(std::is_copy_assignable<SpscQueue<int> >::value);
+}
+
+TEST(SpscQueueTest, PushFailsIfFullAndPopFailsIfEmpty) {
+  SpscQueue<int> queue(3);
+  ASSERT_THAT(queue.capacity(), Eq(3));
+  int element = 0;
+  ASSERT_FALSE(queue.tryPop(&element));
+  for (int round = 0; round != 10; ++round) {
+    ASSERT_TRUE(queue.tryPush(1));
+    ASSERT_TRUE(queue.tryPush(2));
+    ASSERT_TRUE(queue.tryPush(3));
+    ASSERT_FALSE(queue.tryPush(4));
+    for (int expected = 1; expected != 4; ++expected) {
+      ASSERT_TRUE(queue.tryPop(&element));
+      ASSERT_THAT(element, Eq(expected));
+    }
+    ASSERT_FALSE(queue.tryPop(&element));
+  }
+}
+
+TEST(SpscQueueTest, MovesElementsOnlyOnSuccess) {
+  SpscQueue<std::unique_ptr<int> > queue(1);
+  std::unique_ptr<int> first(new int(1));
+  std::unique_ptr<int> second(new int(2));
+  ASSERT_TRUE(queue.tryPush(std::move(first)));
+  ASSERT_TRUE(first == nullptr);
+  ASSERT_FALSE(queue.tryPush(std::move(second)));
+  ASSERT_TRUE(second != nullptr);
+  std::unique_ptr<int> element;
+  ASSERT_TRUE(queue.tryPop(&element));
+  ASSERT_THAT(*element, Eq(1));
+}
+
+TEST(SpscQueueTest, ConsumerReceivesAllElementsInOrder) {
+  const int num_elements = 1000000;
+  SpscQueue<int> queue(64);
+  std::thread producer([&queue] {
+    for (int i = 0; i != num_elements; ++i) {
+      while (!queue.tryPush(int(i))) {
+        std::this_thread::yield();
+      }
+    }
+  });
+  int element = 0;
+  for (int i = 0; i != num_elements; ++i) {
+    while (!queue.tryPop(&element)) {
+      std::this_thread::yield();
+    }
+    ASSERT_THAT(element, Eq(i));
+  }
+  producer.join();
+  ASSERT_FALSE(queue.tryPop(&element));
+}
+
+}  // namespace internal
+}  // namespace multimap
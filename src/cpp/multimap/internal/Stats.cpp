@@ -17,6 +17,10 @@
 
 #include "multimap/internal/Stats.hpp"
 
+#include <cmath>
+#include <cstddef>
+#include <boost/filesystem/operations.hpp>
+
 namespace multimap {
 namespace internal {
 
@@ -26,7 +30,8 @@ const std::vector<std::string>& Stats::names() {
       "key_size_min",   "list_size_avg",    "list_size_max",
       "list_size_min",  "num_blocks",       "num_keys_total",
       "num_keys_valid", "num_values_total", "num_values_valid",
-      "num_partitions"};
+      "num_partitions", "memory_allocated", "memory_reserved",
+      "memory_reusable", "block_cache_hits", "block_cache_misses"};
   return names;
 }
 
@@ -55,6 +60,11 @@ Stats Stats::total(const std::vector<Stats>& stats) {
     total.num_keys_valid += stat.num_keys_valid;
     total.num_values_total += stat.num_values_total;
     total.num_values_valid += stat.num_values_valid;
+    total.memory_allocated += stat.memory_allocated;
+    total.memory_reserved += stat.memory_reserved;
+    total.memory_reusable += stat.memory_reusable;
+    total.block_cache_hits += stat.block_cache_hits;
+    total.block_cache_misses += stat.block_cache_misses;
   }
   if (total.num_keys_valid != 0) {
     double key_size_avg = 0;
@@ -92,27 +102,64 @@ Stats Stats::max(const std::vector<Stats>& stats) {
         std::max(max.num_values_total, stat.num_values_total);
     max.num_values_valid =
         std::max(max.num_values_valid, stat.num_values_valid);
+    max.memory_allocated =
+        std::max(max.memory_allocated, stat.memory_allocated);
+    max.memory_reserved = std::max(max.memory_reserved, stat.memory_reserved);
+    max.memory_reusable = std::max(max.memory_reusable, stat.memory_reusable);
+    max.block_cache_hits =
+        std::max(max.block_cache_hits, stat.block_cache_hits);
+    max.block_cache_misses =
+        std::max(max.block_cache_misses, stat.block_cache_misses);
   }
   return max;
 }
 
 Stats Stats::readFromFile(const boost::filesystem::path& file) {
   Stats stats;
+  const auto size = boost::filesystem::file_size(file);
+  mt::Check::isEqual(size, offsetof(Stats, memory_allocated),
+                     "Unexpected size of stats file %s", file.c_str());
   const auto stream = mt::fopen(file, "r");
-  mt::fread(stream.get(), &stats, sizeof stats);
+  mt::fread(stream.get(), &stats, size);
   return stats;
 }
 
 void Stats::writeToFile(const boost::filesystem::path& file) const {
   const auto stream = mt::fopen(file.c_str(), "w");
-  mt::fwrite(stream.get(), this, sizeof *this);
+  mt::fwrite(stream.get(), this, offsetof(Stats, memory_allocated));
 }
 
 std::vector<uint64_t> Stats::toVector() const {
   return {block_size,     key_size_avg,   key_size_max,     key_size_min,
           list_size_avg,  list_size_max,  list_size_min,    num_blocks,
           num_keys_total, num_keys_valid, num_values_total, num_values_valid,
-          num_partitions};
+          num_partitions, memory_allocated, memory_reserved, memory_reusable,
+          block_cache_hits, block_cache_misses};
+}
+
+SampledStats SampledStats::total(const std::vector<SampledStats>& stats) {
+  SampledStats total;
+  std::vector<Stats> partition_stats;
+  partition_stats.reserve(stats.size());
+  for (const auto& stat : stats) {
+    partition_stats.push_back(stat.stats);
+    total.num_samples += stat.num_samples;
+  }
+  total.stats = Stats::total(partition_stats);
+  if (total.stats.num_keys_valid != 0) {
+    double key_size_variance = 0;
+    double list_size_variance = 0;
+    for (const auto& stat : stats) {
+      const auto w = stat.stats.num_keys_valid /
+                     static_cast<double>(total.stats.num_keys_valid);
+      key_size_variance += std::pow(w * stat.key_size_avg_error, 2);
+      list_size_variance += std::pow(w * stat.list_size_avg_error, 2);
+    }
+    // The samples of different partitions are independent.
+    total.key_size_avg_error = std::sqrt(key_size_variance);
+    total.list_size_avg_error = std::sqrt(list_size_variance);
+  }
+  return total;
 }
 
 }  // namespace internal
@@ -46,6 +46,15 @@ struct Stats {
   uint64_t num_values_total = 0;
   uint64_t num_values_valid = 0;
   uint64_t num_partitions = 0;
+  uint64_t memory_allocated = 0;
+  uint64_t memory_reserved = 0;
+  uint64_t memory_reusable = 0;
+  // Memory usage of the in-memory part of a partition, i.e. keys and tail
+  // blocks of lists.  Only set for open partitions, not written to disk.
+  uint64_t block_cache_hits = 0;
+  uint64_t block_cache_misses = 0;
+  // Number of blocks that were or were not found in the block cache when
+  // they were read.  Only set for open partitions, not written to disk.
 
   static const std::vector<std::string>& names();
 
@@ -63,10 +72,30 @@ struct Stats {
 static_assert(std::is_standard_layout<Stats>::value,
               "Stats is no standard layout type");
 
-static_assert(mt::hasExpectedSize<Stats>(104, 104),
+static_assert(mt::hasExpectedSize<Stats>(144, 144),
               "Stats does not have expected size");
 // sizeof(Stats) must be equal on 32- and 64-bit systems for portability.
 
+struct SampledStats {
+  // Stats whose sizes of keys and lists are estimated from a random sample
+  // of keys, see `Partition::getSampledStats()`.  The minimums and maximums
+  // are those of the sample, which bound the true ones from the inside.
+
+  Stats stats;
+
+  uint64_t num_samples = 0;
+  // Number of keys with a non-empty list that the estimates are based on.
+
+  double key_size_avg_error = 0;
+  double list_size_avg_error = 0;
+  // Half-widths of the 95% confidence intervals of `stats.key_size_avg` and
+  // `stats.list_size_avg`, or zero if the sizes are exact.
+
+  static SampledStats total(const std::vector<SampledStats>& stats);
+  // Combines the estimates of several partitions, weighted by their numbers
+  // of valid keys, like `Stats::total()`.
+};
+
 }  // namespace internal
 }  // namespace multimap
 
@@ -0,0 +1,186 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/StatsPublisher.hpp"
+
+#include <atomic>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <boost/filesystem/operations.hpp>
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+const uint64_t MAGIC = 0x4d4d4c4956455354ULL;
+
+const size_t MAX_NUM_READ_ATTEMPTS = 1000;
+// A reader gives up after this many attempts to get a consistent copy, e.g.
+// if the publishing process has crashed while writing.
+
+}  // namespace
+
+struct StatsPublisher::Header {
+  uint64_t magic;
+  std::atomic<uint64_t> sequence;
+  std::atomic<uint64_t> num_partitions;
+  std::atomic<int64_t> published;
+  // Milliseconds since the epoch of `Clock`.
+};
+// Followed by `num_partitions` instances of struct Stats.
+
+StatsPublisher::StatsPublisher(const boost::filesystem::path& file,
+                               std::chrono::milliseconds interval)
+    : file_(file),
+      interval_(interval),
+      fd_(mt::open(file, O_RDWR | O_CREAT | O_TRUNC, 0644)) {
+  static_assert(mt::hasExpectedSize<Header>(32, 32),
+                "StatsPublisher::Header does not have expected size");
+  resize(0);
+  header_->magic = MAGIC;
+  thread_ = std::thread(&StatsPublisher::run, this);
+}
+
+StatsPublisher::~StatsPublisher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_one();
+  thread_.join();
+  mt::munmap(header_, mapped_size_);
+  fd_.reset();
+  boost::system::error_code error;
+  boost::filesystem::remove(file_, error);
+}
+
+void StatsPublisher::add(size_t index, const Partition* partition) {
+  MT_REQUIRE_NOT_NULL(partition);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (index >= partitions_.size()) {
+    partitions_.resize(index + 1);
+    stats_.resize(index + 1);
+  }
+  partitions_[index] = partition;
+}
+
+void StatsPublisher::set(size_t index, const Stats& stats) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (index >= partitions_.size()) {
+    partitions_.resize(index + 1);
+    stats_.resize(index + 1);
+  }
+  stats_[index] = stats;
+}
+
+std::vector<Stats> StatsPublisher::read(const boost::filesystem::path& file,
+                                        Clock::time_point* published) {
+  const auto fd = mt::open(file, O_RDONLY);
+  void* data = nullptr;
+  uint64_t size = 0;
+  std::vector<Stats> stats;
+  for (size_t i = 0; i != MAX_NUM_READ_ATTEMPTS; ++i) {
+    if (i != 0) std::this_thread::yield();
+    const auto file_size = boost::filesystem::file_size(file);
+    if (file_size < sizeof(Header)) continue;
+    if (file_size != size) {
+      if (data) mt::munmap(data, size);
+      data = mt::mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd.get(), 0);
+      size = file_size;
+    }
+    // The file only grows while it is being published to.
+
+    const auto header = static_cast<const Header*>(data);
+    const auto sequence = header->sequence.load(std::memory_order_acquire);
+    if (header->magic != MAGIC || sequence % 2 != 0) continue;
+    const auto num_partitions =
+        header->num_partitions.load(std::memory_order_relaxed);
+    if (num_partitions > (size - sizeof(Header)) / sizeof(Stats)) continue;
+    stats.resize(num_partitions);
+    std::memcpy(stats.data(), static_cast<const char*>(data) + sizeof(Header),
+                num_partitions * sizeof(Stats));
+    const auto milliseconds = header->published.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header->sequence.load(std::memory_order_relaxed) == sequence) {
+      mt::munmap(data, size);
+      if (published) {
+        *published = Clock::time_point(std::chrono::duration_cast<
+            Clock::duration>(std::chrono::milliseconds(milliseconds)));
+      }
+      return stats;
+    }
+  }
+  if (data) mt::munmap(data, size);
+  mt::fail("Could not read published stats from '%s'", file.c_str());
+  return stats;
+}
+
+void StatsPublisher::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cond_.wait_for(lock, interval_, [this] { return stop_; })) {
+    lock.unlock();
+    // Adding partitions is not blocked while publishing.
+    try {
+      publish();
+    } catch (std::exception& error) {
+      mt::log() << "StatsPublisher could not publish stats: " << error.what()
+                << '\n';
+    }
+    lock.lock();
+  }
+}
+
+void StatsPublisher::publish() {
+  std::vector<const Partition*> partitions;
+  std::vector<Stats> stats;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    partitions = partitions_;
+    stats = stats_;
+  }
+  for (size_t i = 0; i != partitions.size(); ++i) {
+    if (partitions[i]) stats[i] = partitions[i]->getCurrentStats();
+  }
+  resize(stats.size());
+
+  const auto sequence = header_->sequence.load(std::memory_order_relaxed);
+  header_->sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  header_->num_partitions.store(stats.size(), std::memory_order_relaxed);
+  std::memcpy(reinterpret_cast<char*>(header_) + sizeof(Header), stats.data(),
+              stats.size() * sizeof(Stats));
+  const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+      Clock::now().time_since_epoch());
+  header_->published.store(now.count(), std::memory_order_relaxed);
+  header_->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void StatsPublisher::resize(uint64_t num_partitions) {
+  const auto size = sizeof(Header) + num_partitions * sizeof(Stats);
+  if (size <= mapped_size_) return;
+  mt::truncate(fd_.get(), size);
+  if (header_) mt::munmap(header_, mapped_size_);
+  header_ = static_cast<Header*>(mt::mmap(
+      nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_.get(), 0));
+  mapped_size_ = size;
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,97 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_STATS_PUBLISHER_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_STATS_PUBLISHER_HPP_INCLUDED
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <boost/filesystem/path.hpp>
+#include "multimap/internal/Partition.hpp"
+#include "multimap/internal/Stats.hpp"
+#include "multimap/thirdparty/mt/mt.hpp"
+
+namespace multimap {
+namespace internal {
+
+class StatsPublisher : public mt::Resource {
+  // A background thread that periodically copies the current stats of all
+  // added partitions, see `Partition::getCurrentStats()`, into a memory-
+  // mapped file, so that other processes can read them at any time via
+  // `read()` without calling into the publishing process.  Readers only map
+  // the file, and updates of the file are guarded by a sequence number that
+  // is odd while the stats are being written, so that neither side waits for
+  // the other.  Objects of this class are thread-safe.
+
+ public:
+  typedef std::chrono::system_clock Clock;
+
+  StatsPublisher(const boost::filesystem::path& file,
+                 std::chrono::milliseconds interval);
+  // Creates or truncates `file`.
+
+  ~StatsPublisher();
+  // Stops the background thread and removes the file, since the stats files
+  // of the partitions are up to date once they are closed.
+
+  void add(size_t index, const Partition* partition);
+  // Publishes the stats of `partition` as those of partition `index` from
+  // the next interval on.
+  // Requires: `partition` outlives this object.
+
+  void set(size_t index, const Stats& stats);
+  // Publishes `stats` as those of partition `index` until a partition is
+  // added for it, e.g. for partitions of a lazily opened map.
+
+  static std::vector<Stats> read(const boost::filesystem::path& file,
+                                 Clock::time_point* published = nullptr);
+  // Returns the stats last published to `file`, and if `published` is not
+  // null, sets it to the time they were published.  Throws if `file` has
+  // not been written by this class.
+
+ private:
+  struct Header;
+
+  void run();
+
+  void publish();
+
+  void resize(uint64_t num_partitions);
+  // Grows the file and its mapping to hold the stats of `num_partitions`.
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<const Partition*> partitions_;
+  std::vector<Stats> stats_;
+  // Indexed by partition, and guarded by `mutex_`.
+  const boost::filesystem::path file_;
+  const std::chrono::milliseconds interval_;
+  mt::AutoCloseFd fd_;
+  Header* header_ = nullptr;
+  uint64_t mapped_size_ = 0;
+  // Only accessed by the constructor, the destructor, and the thread.
+  bool stop_ = false;
+  std::thread thread_;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_STATS_PUBLISHER_HPP_INCLUDED
@@ -0,0 +1,87 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/internal/StatsPublisher.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+
+const boost::filesystem::path FILENAME = "/tmp/multimap.StatsPublisherTest";
+
+std::vector<Stats> readWhenPublished(size_t num_partitions,
+                                     StatsPublisher::Clock::time_point* time) {
+  for (int i = 0; i != 1000; ++i) {
+    const auto stats = StatsPublisher::read(FILENAME, time);
+    if (stats.size() == num_partitions) return stats;
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  return std::vector<Stats>();
+}
+
+TEST(StatsPublisherTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<StatsPublisher>::value);
+  ASSERT_FALSE(std::is_copy_assignable<StatsPublisher>::value);
+}
+
+TEST(StatsPublisherTest, ReadReturnsPublishedStatsUntilDestroyed) {
+  const auto start = StatsPublisher::Clock::now();
+  {
+    StatsPublisher publisher(FILENAME, std::chrono::milliseconds(10));
+    ASSERT_TRUE(StatsPublisher::read(FILENAME).empty());
+
+    Stats stats;
+    stats.num_keys_valid = 23;
+    publisher.set(1, stats);
+    StatsPublisher::Clock::time_point published;
+    auto result = readWhenPublished(2, &published);
+    ASSERT_THAT(result.size(), Eq(2));
+    ASSERT_THAT(result[0].num_keys_valid, Eq(0));
+    ASSERT_THAT(result[1].num_keys_valid, Eq(23));
+    ASSERT_TRUE(published >= start - std::chrono::seconds(1));
+
+    // Grows the file while it is mapped by readers.
+    stats.num_values_total = 42;
+    publisher.set(99, stats);
+    result = readWhenPublished(100, nullptr);
+    ASSERT_THAT(result.size(), Eq(100));
+    ASSERT_THAT(result[1].num_keys_valid, Eq(23));
+    ASSERT_THAT(result[99].num_values_total, Eq(42));
+  }
+  ASSERT_FALSE(boost::filesystem::exists(FILENAME));
+  ASSERT_ANY_THROW(StatsPublisher::read(FILENAME));
+}
+
+TEST(StatsPublisherTest, ReadThrowsIfFileHasNotBeenPublishedTo) {
+  const auto stream = std::fopen(FILENAME.c_str(), "w");
+  ASSERT_TRUE(stream != nullptr);
+  std::fputs("This is no file of published stats.", stream);
+  std::fclose(stream);
+  ASSERT_ANY_THROW(StatsPublisher::read(FILENAME));
+  boost::filesystem::remove(FILENAME);
+}
+
+}  // namespace internal
+}  // namespace multimap
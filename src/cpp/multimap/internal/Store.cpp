@@ -17,128 +17,1175 @@
 
 #include "multimap/internal/Store.hpp"
 
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <thread>
 #include <boost/filesystem/operations.hpp>
+#include <zlib.h>
+#include "multimap/internal/Crc32c.hpp"
 
 namespace multimap {
 namespace internal {
 
+namespace {
+
+std::string getNameOfChecksumsFile(const boost::filesystem::path& file) {
+  return file.string() + ".crc";
+}
+// The checksums file holds [uint32 checksums[num_blocks]].
+
+const uint64_t COMPRESSED_FILE_MAGIC = 0x4d554c54495a4c42ULL;
+// Marks the end of the data file of a compressed store.  The file ends with
+// [uint64 offsets[num_blocks + 1]][uint64 num_blocks][uint64 magic].
+
+const uint32_t WHOLE_FILE_SEGMENT_SHIFT = 32;
+// Block ids have 32 bits, so that all blocks fall into the first segment.
+
+const uint64_t DIRECT_IO_ALIGNMENT = 4096;
+// Offsets, sizes, and buffers for `O_DIRECT` must be aligned to the logical
+// block size of the device, which is at most the page size in practice.
+
+const uint32_t MAX_NUM_BLOCKS_PER_READ = 256;
+// Limits the size of the scratch buffer of a single coalesced read.
+
+struct FreeDeleter {
+  void operator()(char* data) const { std::free(data); }
+};
+
+std::unique_ptr<char, FreeDeleter> allocateAligned(uint64_t size) {
+  void* data = nullptr;
+  const auto result = ::posix_memalign(&data, DIRECT_IO_ALIGNMENT, size);
+  mt::Check::isZero(result, "posix_memalign() failed");
+  return std::unique_ptr<char, FreeDeleter>(static_cast<char*>(data));
+}
+
+uint32_t getSegmentShift(uint32_t block_size, uint64_t segment_size) {
+  // Segments must start at a page boundary to be mapped.  The page size is a
+  // power of two, so some power of two number of blocks is a multiple of it.
+  const uint64_t page_size = ::sysconf(_SC_PAGESIZE);
+  uint32_t shift = 0;
+  while ((uint64_t(block_size) << shift) < segment_size ||
+         (uint64_t(block_size) << shift) % page_size != 0) {
+    ++shift;
+  }
+  MT_ASSERT_LT(shift, WHOLE_FILE_SEGMENT_SHIFT);
+  return shift;
+}
+
+size_t getReaderSlotIndex(size_t num_slots) {
+  static thread_local const size_t index =
+      std::hash<std::thread::id>()(std::this_thread::get_id()) % num_slots;
+  return index;
+}
+
+}  // namespace
+
+const char* Store::CANNOT_REPLACE_COMPRESSED_BLOCK =
+    "Store: blocks of a compressed store cannot be replaced";
+
 Store::Store(const boost::filesystem::path& filename, const Options& options)
     : options_(options) {
   MT_REQUIRE_NOT_ZERO(getBlockSize());
-  if (boost::filesystem::is_regular_file(filename)) {
+  MT_REQUIRE_NOT_ZERO(options.max_read_ahead);
+  MT_REQUIRE_NOT_ZERO(options.max_extent_size);
+  if (options.readonly && options.direct_io && !options.compress &&
+      boost::filesystem::is_regular_file(filename)) {
+    openDirect(filename);
+  } else if (boost::filesystem::is_regular_file(filename)) {
     fd_ = mt::open(filename, options.readonly ? O_RDONLY : O_RDWR);
     mt::seek(fd_.get(), 0, SEEK_END);
     const auto length = mt::tell(fd_.get());
-    mt::Check::isZero(length % getBlockSize(),
-                      "Store: block size does not match size of data file");
-    if (length != 0) {
-      auto prot = PROT_READ;
-      if (!options.readonly) {
-        prot |= PROT_WRITE;
+    if (isCompressed()) {
+      openCompressed(length);
+    } else if (length != 0) {
+      mt::Check::isZero(length % getBlockSize(),
+                        "Store: block size does not match size of data file");
+      std::unique_ptr<Mapping> mapping(new Mapping());
+      if (options.readonly) {
+        mapping->segments.push_back(mapDataFile(length, PROT_READ));
+        mapping->segment_size = length;
+        mapping->segment_shift = WHOLE_FILE_SEGMENT_SHIFT;
+      } else {
+        mapSegments(mapping.get(), length);
       }
-      mapped_.data = mt::mmap(nullptr, length, prot, MAP_SHARED, fd_.get(), 0);
-      mapped_.size = length;
+      mapping->size = length;
+      mapped_.store(mapping.release());
     }
 
   } else {
     fd_ = mt::open(filename, O_RDWR | O_CREAT, 0644);
   }
+  if (options.readonly && (isCompressed() || isDirect())) {
+    cache_ = options.block_cache;
+    if (cache_) {
+      mt::Check::isEqual(cache_->getBlockSize(), getBlockSize(),
+                         "Store: block size does not match block cache");
+    }
+  }
   if (!options.readonly) {
     mt::Check::isZero(options.buffer_size % getBlockSize(),
                       "Store: buffer size must be a multiple of block size");
     buffer_.data.reset(new char[options.buffer_size]);
     buffer_.size = options.buffer_size;
+    if (isCompressed()) {
+      compressed_.offsets.push_back(0);
+      compressed_.buffer_size = ::compressBound(getBlockSize());
+      compressed_.buffer.reset(new char[compressed_.buffer_size]);
+    } else if (options.background_flush) {
+      flushing_buffer_.data.reset(new char[options.buffer_size]);
+      flushing_buffer_.size = options.buffer_size;
+      flusher_ = std::thread(&Store::runFlusher, this);
+    }
+  }
+  if (options.checksums && !isCompressed()) {
+    openChecksums(filename);
+  } else if (!options.readonly) {
+    boost::filesystem::remove(getNameOfChecksumsFile(filename));
+    // Would not match the blocks anymore once they are changed.
+  }
+  if (!options.readonly && !isCompressed() && !hasChecksums() &&
+      options.durability == Durability::NONE) {
+    lanes_ = std::vector<Lane>(options.num_write_lanes);
   }
 }
 
 Store::~Store() {
+  if (flusher_.joinable()) {
+    {
+      std::lock_guard<Mutex> lock(mutex_);
+      stop_flusher_ = true;
+    }
+    flush_cond_.notify_all();
+    flusher_.join();
+    // A failed write has already been logged.
+  }
   if (fd_.get() != -1) {
-    if (mapped_.data) {
-      mt::munmap(mapped_.data, mapped_.size);
+    const auto mapping = mapped_.load();
+    if (mapping != &empty_mapping_) {
+      for (const auto segment : mapping->segments) {
+        mt::munmap(segment, mapping->segment_size);
+      }
+      delete mapping;
     }
     if (!buffer_.empty()) {
-      mt::write(fd_.get(), buffer_.data.get(), buffer_.offset);
+      writeBufferUnlocked();
+    }
+    if (isCompressed() && !isReadOnly()) {
+      writeOffsetTableUnlocked();
+    }
+    if (!isReadOnly()) {
+      mt::truncate(fd_.get(), mt::tell(fd_.get()));
+      // Releases disk space that has been preallocated beyond the end.
+      if (hasChecksums()) {
+        writeChecksums();
+      }
     }
   }
 }
 
 void Store::adviseAccessPattern(AccessPattern pattern) const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  switch (pattern) {
-    case AccessPattern::NORMAL:
-      fill_page_cache_ = false;
-      break;
-    case AccessPattern::WILLNEED:
-      fill_page_cache_ = true;
-      break;
-    default:
-      MT_FAIL("Default case in switch statement reached");
+  access_pattern_ = pattern;
+  if (isCompressed() || isReadOnly()) {
+    // The mapping is never replaced.
+    adviseUnlocked(mapped_.load(), pattern, 0);
+  } else {
+    const EpochGuard guard(this);
+    adviseUnlocked(guard.mapping(), pattern, 0);
   }
 }
 
-uint32_t Store::putUnlocked(const char* block) {
-  if (buffer_.full()) {
-    // Flush buffer and remap data file.
-    buffer_.flushTo(fd_.get());
-    const auto new_size = mt::tell(fd_.get());
-    const auto prot = PROT_READ | PROT_WRITE;
-    if (mapped_.data) {
-      // fsync(fd_);
-      // Since Linux provides a so-called unified virtual memory system, it
-      // is not necessary to write the content of the buffer cache to disk to
-      // ensure that the newly appended data is visible after the remapping.
-      // In a unified virtual memory system, memory mappings and blocks of the
-      // buffer cache share the same pages of physical memory. [kerrisk p1032]
-      MT_ASSERT_LT(mapped_.size, new_size);
-#ifdef _GNU_SOURCE
-      mapped_.data =
-          mt::mremap(mapped_.data, mapped_.size, new_size, MREMAP_MAYMOVE);
-#else
-      mt::munmap(mapped_.data, mapped_.size);
-      mapped_.data =
-          mt::mmap(nullptr, new_size, prot, MAP_SHARED, fd_.get(), 0);
-#endif
+void Store::prefetch(const std::vector<uint32_t>& ids) const {
+  MT_REQUIRE_TRUE(std::is_sorted(ids.begin(), ids.end()));
+  const bool via_cache = isCompressed() || isDirect();
+  if (via_cache && !cache_) return;
+  const auto num_blocks = getNumBlocks();
+  std::unique_ptr<char[]> buffer;
+  size_t begin = 0;
+  while (begin != ids.size()) {
+    auto end = begin + 1;
+    while (end != ids.size() && ids[end] == ids[end - 1] + 1 &&
+           end - begin != MAX_NUM_BLOCKS_PER_READ) {
+      ++end;
+    }
+    const auto first_id = ids[begin];
+    const uint32_t count = end - begin;
+    begin = end;
+    if (first_id + uint64_t(count) > num_blocks) continue;
+    if (via_cache) {
+      if (!buffer) {
+        buffer.reset(new char[MAX_NUM_BLOCKS_PER_READ * getBlockSize()]);
+      }
+      getRange(first_id, count, buffer.get());
+      // Puts the blocks into the cache.
+    } else if (isReadOnly()) {
+      limitIo(count);
+      prefetchMapped(mapped_.load(), first_id, count);
     } else {
-      mapped_.data =
-          mt::mmap(nullptr, new_size, prot, MAP_SHARED, fd_.get(), 0);
+      limitIo(count);
+      const EpochGuard guard(this);
+      prefetchMapped(guard.mapping(), first_id, count);
+    }
+  }
+}
+
+void Store::readAhead(const std::vector<uint32_t>& ids) const {
+  MT_REQUIRE_TRUE(isReadOnly());
+  MT_REQUIRE_TRUE(std::is_sorted(ids.begin(), ids.end()));
+  const auto mapping = mapped_.load();
+  if (isDirect() || mapping->segments.empty()) return;
+  const auto num_blocks = getNumBlocks();
+  const uint64_t page_size = ::sysconf(_SC_PAGESIZE);
+  const auto advise = [this, mapping, page_size](uint64_t begin,
+                                                 uint64_t end) {
+    begin -= begin % page_size;
+    if (options_.io_limiter) options_.io_limiter->acquire(end - begin);
+    ::madvise(mapping->segments.front() + begin, end - begin, MADV_WILLNEED);
+    // Only a hint, whose failure is not an error.
+  };
+  uint64_t begin = 0;
+  uint64_t end = 0;
+  for (const auto id : ids) {
+    if (id >= num_blocks) break;
+    uint64_t offset = id * getBlockSize();
+    uint64_t next_offset = offset + getBlockSize();
+    if (isCompressed()) {
+      offset = compressed_.mapped_offsets[id];
+      next_offset = compressed_.mapped_offsets[id + 1];
+    }
+    if (offset > end + page_size) {
+      // Not on the same or the next page as the previous block.
+      if (begin != end) advise(begin, end);
+      begin = offset;
+    }
+    end = std::max(end, next_offset);
+  }
+  if (begin != end) advise(begin, end);
+}
+
+std::vector<uint32_t> Store::getCachedBlockIds() const {
+  std::vector<uint32_t> ids;
+  if (!cache_) return ids;
+  for (const auto key : cache_->getKeys()) {
+    if (key >> 32 == options_.block_cache_id) ids.push_back(key);
+  }
+  std::sort(ids.begin(), ids.end());
+  return ids;
+}
+
+Store::EpochGuard::EpochGuard(const Store* store) {
+  auto& slot = store->reader_slots_[getReaderSlotIndex(NUM_READER_SLOTS)];
+  while (true) {
+    const auto epoch = store->epoch_.load();
+    count_ = &slot.count[epoch % 2];
+    count_->fetch_add(1);
+    if (store->epoch_.load() == epoch) break;
+    // A remap has started in between, so the writer might not wait for us.
+    count_->fetch_sub(1);
+  }
+  mapping_ = store->mapped_.load();
+}
+
+Store::EpochGuard::~EpochGuard() { count_->fetch_sub(1); }
+
+void Store::getRange(uint32_t first_id, uint32_t count, char* target) const {
+  addBytesRead(count);
+  limitIo(count);
+  const auto block_size = getBlockSize();
+  if (isCompressed()) {
+    for (uint32_t i = 0; i != count; ++i) {
+      getCompressed(first_id + i, target + block_size * i);
+    }
+    return;
+  }
+  if (isDirect()) {
+    MT_REQUIRE_LE(uint64_t(first_id) + count,
+                  mapped_.load()->getNumBlocks(block_size));
+    uint32_t first_miss = 0;
+    for (uint32_t i = 0; i <= count; ++i) {
+      // Reads each run of blocks that are not cached with a single call.
+      if (i != count && !tryGetCached(first_id + i, target + block_size * i)) {
+        continue;
+      }
+      if (first_miss != i) {
+        readDirect(first_id + first_miss, i - first_miss,
+                   target + block_size * first_miss);
+        for (auto j = first_miss; j != i; ++j) {
+          putCached(first_id + j, target + block_size * j);
+        }
+      }
+      first_miss = i + 1;
     }
-    mapped_.size = new_size;
+    verifyRange(first_id, count, target);
+    return;
+  }
+  uint64_t num_copied = 0;
+  {
+    const EpochGuard guard(this);
+    const auto num_blocks_mapped = guard.mapping()->getNumBlocks(block_size);
+    if (first_id < num_blocks_mapped) {
+      num_copied = std::min<uint64_t>(count, num_blocks_mapped - first_id);
+      auto destination = target;
+      guard.mapping()->forEachPart(
+          uint64_t(block_size) * first_id, block_size * num_copied,
+          [&destination](const char* data, uint64_t length) {
+            std::memcpy(destination, data, length);
+            destination += length;
+          });
+    }
+  }
+  // The guard must be released before locking `mutex_`, see `get()`.
+  if (num_copied != count) {
+    std::lock_guard<Mutex> lock(mutex_);
+    for (auto i = num_copied; i != count; ++i) {
+      getUnlocked(first_id + i, target + block_size * i);
+    }
+  }
+  verifyRange(first_id, count, target);
+}
+
+void Store::reuse(const std::vector<uint32_t>& ids) {
+  if (isCompressed()) return;
+  std::lock_guard<Mutex> lock(mutex_);
+  for (const auto id : ids) {
+    MT_REQUIRE_LT(id, getNumBlocksUnlocked());
+    reusable_ids_.insert(id);
+  }
+}
+
+void Store::releaseExtents() {
+  for (auto& lane : lanes_) {
+    std::lock_guard<std::mutex> lane_lock(lane.mutex);
+    std::lock_guard<Mutex> lock(mutex_);
+    for (auto id = lane.next_id; id != lane.end_id; ++id) {
+      reusable_ids_.insert(id);
+    }
+    lane.next_id = lane.end_id = 0;
+  }
+  std::lock_guard<Mutex> lock(mutex_);
+  for (const auto& extent : extents_) {
+    for (auto id = extent.first; id != extent.second; ++id) {
+      reusable_ids_.insert(id);
+    }
+  }
+  extents_.clear();
+}
+
+std::vector<uint32_t> Store::getReusableBlocks() const {
+  std::lock_guard<Mutex> lock(mutex_);
+  return std::vector<uint32_t>(reusable_ids_.begin(), reusable_ids_.end());
+}
+
+uint64_t Store::getNumBytesMapped() const {
+  const EpochGuard guard(this);
+  return guard.mapping()->size.load();
+}
+
+bool Store::tryGetMapped(uint32_t id, char* block) const {
+  const EpochGuard guard(this);
+  if (id < guard.mapping()->getNumBlocks(getBlockSize())) {
+    copyFromMapped(guard.mapping(), id, block);
+    return true;
+  }
+  return false;
+}
+
+bool Store::tryReplaceMapped(uint32_t id, const char* block) {
+  const EpochGuard guard(this);
+  if (id < guard.mapping()->getNumBlocks(getBlockSize())) {
+    copyToMapped(guard.mapping(), id, block);
+    return true;
+  }
+  return false;
+}
+
+void Store::copyFromMapped(const Mapping* mapping, uint32_t id,
+                           char* block) const {
+  std::memcpy(block, mapping->getAddressOf(id, getBlockSize()),
+              getBlockSize());
+}
+
+void Store::copyToMapped(const Mapping* mapping, uint32_t id,
+                         const char* block) {
+  MT_REQUIRE_NOT_NULL(block);
+  std::memcpy(mapping->getAddressOf(id, getBlockSize()), block,
+              getBlockSize());
+}
+
+const char* Store::tryGetStableAddressOf(uint32_t id) const {
+  if (!hasStableBlocks()) return nullptr;
+  // A read-only store is never remapped, so the mapping remains
+  // valid and can be read without any epoch protection.
+  const auto mapping = mapped_.load();
+  MT_REQUIRE_LT(id, mapping->getNumBlocks(getBlockSize()));
+  addBytesRead(1);
+  limitIo(1);
+  const auto address = mapping->getAddressOf(id, getBlockSize());
+  verify(id, address);
+  return address;
+}
+
+void Store::flush() {
+  if (isCompressed()) return;
+  std::lock_guard<Mutex> lock(mutex_);
+  waitForFlushUnlocked();
+  if (!buffer_.empty()) {
+    flushBufferUnlocked();
+  }
+}
+
+void Store::copyTo(const boost::filesystem::path& file) {
+  mt::Check::isFalse(isReadOnly(), "Store: cannot copy a read-only store");
+  std::lock_guard<Mutex> lock(mutex_);
+  waitForFlushUnlocked();
+  if (!buffer_.empty()) {
+    flushBufferUnlocked();
+  }
+  const auto length = mt::tell(fd_.get());
+  const auto target = mt::open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#ifdef FICLONE
+  if (::ioctl(target.get(), FICLONE, fd_.get()) == 0) return;
+#endif
+  if (options_.io_limiter) {
+    options_.io_limiter->acquire(length);
+    // Only waits until earlier requests are paid off, since the copy is
+    // granted as a whole, while `mutex_` is held anyway until it is done.
+  }
+  std::unique_ptr<char[]> chunk(new char[buffer_.size]);
+  for (uint64_t offset = 0; offset < length; offset += buffer_.size) {
+    const auto size = std::min<uint64_t>(buffer_.size, length - offset);
+    mt::pread(fd_.get(), chunk.get(), size, offset);
+    mt::write(target.get(), chunk.get(), size);
+  }
+  if (options_.metrics) {
+    options_.metrics->addBytesWritten(length);
+  }
+}
+
+uint32_t Store::putUnlocked(const char* block) {
+  if (isCompressed()) return putCompressedUnlocked(block);
+  if (buffer_.full() && flusher_.joinable()) {
+    scheduleFlushUnlocked();
+  } else if (buffer_.full()) {
+    flushBufferUnlocked();
+    // fsync(fd_);
+    // Since Linux provides a so-called unified virtual memory system, it
+    // is not necessary to write the content of the buffer cache to disk to
+    // ensure that the newly appended data is visible after the remapping.
+    // In a unified virtual memory system, memory mappings and blocks of the
+    // buffer cache share the same pages of physical memory. [kerrisk p1032]
   }
 
   std::memcpy(buffer_.data.get() + buffer_.offset, block, getBlockSize());
   buffer_.offset += getBlockSize();
 
-  return getNumBlocksUnlocked() - 1;
+  const uint32_t id = getNumBlocksUnlocked() - 1;
+  updateChecksumUnlocked(id, block);
+  return id;
 }
 
-void Store::getUnlocked(uint32_t id, char* block) const {
-  if (fill_page_cache_) {
-    fill_page_cache_ = false;
-    // Touch each block to load it into the OS page cache.
-    const auto num_blocks_mapped = mapped_.getNumBlocks(getBlockSize());
-    for (uint32_t i = 0; i != num_blocks_mapped; ++i) {
-      std::memcpy(block, getAddressOf(i), getBlockSize());
+uint32_t Store::putUnlocked(const char* block, uint32_t min_id) {
+  const auto id = tryPutReusedUnlocked(block, min_id);
+  return (id != NO_ID) ? id : putUnlocked(block);
+}
+
+uint32_t Store::putUnlocked(const char* block, uint32_t min_id,
+                            uint32_t extent_size) {
+  const auto extent_id = tryPutIntoExtentUnlocked(block, min_id);
+  if (extent_id != NO_ID) return extent_id;
+  if (extent_size < 2 || isCompressed()) {
+    return putUnlocked(block, min_id);
+  }
+  const auto id = putUnlocked(block);
+  const std::vector<char> zeros(getBlockSize());
+  for (uint32_t i = 1; i != extent_size; ++i) {
+    putUnlocked(zeros.data());
+  }
+  extents_.emplace(id + 1, id + extent_size);
+  return id;
+}
+
+uint32_t Store::appendRunUnlocked(const std::vector<const char*>& blocks) {
+  waitForFlushUnlocked();
+  if (!buffer_.empty()) {
+    flushBufferUnlocked();
+  }
+  const Metrics::Timer timer(options_.metrics.get(),
+                             Metrics::Operation::STORE_FLUSH);
+  const uint32_t first_id = getNumBlocksUnlocked();
+  const auto offset = mt::tell(fd_.get());
+  const auto block_size = getBlockSize();
+  std::vector<struct iovec> iov;
+  for (size_t begin = 0; begin < blocks.size(); begin += IOV_MAX) {
+    const auto end = std::min<size_t>(begin + IOV_MAX, blocks.size());
+    iov.clear();
+    for (auto i = begin; i != end; ++i) {
+      iov.push_back({const_cast<char*>(blocks[i]), block_size});
     }
+    mt::writev(fd_.get(), iov.data(), iov.size(), iov.size() * block_size);
+  }
+  const auto length = uint64_t(block_size) * blocks.size();
+  for (size_t i = 0; i != blocks.size(); ++i) {
+    updateChecksumUnlocked(first_id + i, blocks[i]);
   }
+  if (options_.metrics) {
+    options_.metrics->addBytesWritten(length);
+  }
+  syncWrittenRange(offset, length);
+  publishUnlocked(offset + length);
+  return first_id;
+}
+
+const uint32_t Store::NO_ID;
+
+uint32_t Store::tryPutReusedUnlocked(const char* block, uint32_t min_id) {
+  const auto iter = reusable_ids_.lower_bound(min_id);
+  if (iter == reusable_ids_.end()) return NO_ID;
+  const auto id = *iter;
+  reusable_ids_.erase(iter);
+  replaceUnlocked(id, block);
+  return id;
+}
+
+uint32_t Store::tryPutIntoExtentUnlocked(const char* block, uint32_t min_id) {
+  const auto iter = extents_.find(min_id);
+  if (iter == extents_.end()) return NO_ID;
+  const auto end = iter->second;
+  extents_.erase(iter);
+  if (min_id + 1 != end) {
+    extents_.emplace(min_id + 1, end);
+  }
+  replaceUnlocked(min_id, block);
+  return min_id;
+}
+
+const uint32_t Store::NO_RUN;
+
+uint32_t Store::findReusableRunUnlocked(uint32_t min_id,
+                                        uint32_t count) const {
+  uint32_t first_id = NO_RUN;
+  uint32_t length = 0;
+  for (auto it = reusable_ids_.lower_bound(min_id);
+       it != reusable_ids_.end() && length != count; ++it) {
+    if (length != 0 && *it == first_id + length) {
+      ++length;
+    } else {
+      first_id = *it;
+      length = 1;
+    }
+  }
+  return (count != 0 && length == count) ? first_id : NO_RUN;
+}
+
+void Store::getUnlocked(uint32_t id, char* block) const {
   std::memcpy(block, getAddressOf(id), getBlockSize());
 }
 
 void Store::replaceUnlocked(uint32_t id, const char* block) {
   MT_REQUIRE_NOT_NULL(block);
+  if (isInFlushingBufferUnlocked(id)) {
+    replaced_while_flushing_.push_back(id);
+  }
   std::memcpy(getAddressOf(id), block, getBlockSize());
+  updateChecksumUnlocked(id, block);
 }
 
 char* Store::getAddressOf(uint32_t id) const {
   MT_REQUIRE_LT(id, getNumBlocksUnlocked());
 
-  const auto num_blocks_mapped = mapped_.getNumBlocks(getBlockSize());
+  const auto mapping = mapped_.load();
+  const auto num_blocks_mapped = mapping->getNumBlocks(getBlockSize());
   if (id < num_blocks_mapped) {
-    const auto offset = getBlockSize() * id;
-    return static_cast<char*>(mapped_.data) + offset;
-  } else {
+    return mapping->getAddressOf(id, getBlockSize());
+  }
+  const auto num_blocks_flushing =
+      flushing_buffer_.getNumBlocks(getBlockSize());
+  if (id < num_blocks_mapped + num_blocks_flushing) {
     const auto offset = getBlockSize() * (id - num_blocks_mapped);
-    return buffer_.data.get() + offset;
+    return flushing_buffer_.data.get() + offset;
+  }
+  const auto offset =
+      getBlockSize() * (id - num_blocks_mapped - num_blocks_flushing);
+  return buffer_.data.get() + offset;
+}
+
+std::vector<uint32_t> Store::getCorruptBlocks() const {
+  MT_REQUIRE_TRUE(isReadOnly());
+  MT_REQUIRE_TRUE(hasChecksums());
+  std::vector<uint32_t> ids;
+  const auto block_size = getBlockSize();
+  const uint32_t num_blocks = checksums_.size();
+  std::unique_ptr<char[]> buffer;
+  for (uint32_t first_id = 0; first_id < num_blocks;) {
+    // Reads blocks in batches, which bypasses the block cache.
+    const auto count =
+        std::min(num_blocks - first_id, MAX_NUM_BLOCKS_PER_READ);
+    const char* data = nullptr;
+    if (isDirect()) {
+      if (!buffer) buffer.reset(new char[block_size * count]);
+      readDirect(first_id, count, buffer.get());
+      data = buffer.get();
+    } else {
+      data = mapped_.load()->getAddressOf(first_id, block_size);
+      // A read-only data file is mapped as a single segment.
+    }
+    addBytesRead(count);
+    for (uint32_t i = 0; i != count; ++i) {
+      const auto checksum = Crc32c::compute(data + block_size * i, block_size);
+      if (checksum != checksums_[first_id + i]) {
+        ids.push_back(first_id + i);
+      }
+    }
+    first_id += count;
+  }
+  return ids;
+}
+
+void Store::openChecksums(const boost::filesystem::path& file) {
+  checksums_file_ = getNameOfChecksumsFile(file);
+  const auto num_blocks = getNumBlocksUnlocked();
+  if (boost::filesystem::is_regular_file(checksums_file_)) {
+    mt::Check::isEqual(
+        boost::filesystem::file_size(checksums_file_),
+        num_blocks * sizeof(uint32_t),
+        "Store: number of checksums in '%s' does not match the data file",
+        checksums_file_.c_str());
+    checksums_.resize(num_blocks);
+    const auto stream = mt::fopen(checksums_file_, "r");
+    mt::fread(stream.get(), checksums_.data(),
+              checksums_.size() * sizeof(uint32_t));
+  } else if (isReadOnly()) {
+    return;  // Nothing to verify against.
+  } else {
+    checksums_.reserve(num_blocks);
+    for (uint32_t id = 0; id != num_blocks; ++id) {
+      checksums_.push_back(Crc32c::compute(getAddressOf(id), getBlockSize()));
+    }
+  }
+  if (isReadOnly()) {
+    verified_.reset(new std::atomic<uint64_t>[(num_blocks + 63) / 64]());
+  } else {
+    boost::filesystem::remove(checksums_file_);
+  }
+  has_checksums_ = true;
+}
+
+void Store::writeChecksums() const {
+  const auto stream = mt::fopen(checksums_file_, "w");
+  mt::fwrite(stream.get(), checksums_.data(),
+             checksums_.size() * sizeof(uint32_t));
+}
+
+void Store::updateChecksumUnlocked(uint32_t id, const char* block) {
+  if (!hasChecksums()) return;
+  const auto checksum = Crc32c::compute(block, getBlockSize());
+  if (id == checksums_.size()) {
+    checksums_.push_back(checksum);
+  } else {
+    checksums_[id] = checksum;
+  }
+}
+
+void Store::verifyRange(uint32_t first_id, uint32_t count,
+                        const char* blocks) const {
+  if (!verified_) return;
+  for (uint32_t i = 0; i != count; ++i) {
+    verifyOnce(first_id + i, blocks + getBlockSize() * i);
+  }
+}
+
+void Store::verifyOnce(uint32_t id, const char* block) const {
+  MT_REQUIRE_LT(id, checksums_.size());
+  auto& word = verified_[id / 64];
+  const uint64_t bit = uint64_t(1) << (id % 64);
+  if (word.load() & bit) return;
+  mt::Check::isEqual(Crc32c::compute(block, getBlockSize()), checksums_[id],
+                     "Store: block %u does not match its checksum in '%s'",
+                     id, checksums_file_.c_str());
+  word.fetch_or(bit);
+}
+
+char* Store::mapDataFile(uint64_t length, int prot) const {
+  auto flags = MAP_SHARED;
+  if (options_.readonly && options_.populate) {
+    flags |= MAP_POPULATE;
+  }
+  const auto data =
+      static_cast<char*>(mt::mmap(nullptr, length, prot, flags, fd_.get(), 0));
+  if (options_.readonly && options_.huge_pages) {
+    // Only a hint, which fails if transparent huge pages are not supported.
+    ::madvise(data, length, MADV_HUGEPAGE);
+  }
+  if (options_.readonly && options_.lock_in_memory) {
+    mt::mlock(data, length);
+  }
+  return data;
+}
+
+void Store::mapSegments(Mapping* mapping, uint64_t new_size) const {
+  if (mapping->segments.empty()) {
+    mapping->segment_shift =
+        getSegmentShift(getBlockSize(), options_.segment_size);
+    mapping->segment_size = uint64_t(getBlockSize())
+                            << mapping->segment_shift;
+  }
+  while (mapping->getCapacity() < new_size) {
+    const auto offset = mapping->getCapacity();
+    mapping->segments.push_back(static_cast<char*>(
+        mt::mmap(nullptr, mapping->segment_size, PROT_READ | PROT_WRITE,
+                 MAP_SHARED, fd_.get(), offset)));
+#ifdef FALLOC_FL_KEEP_SIZE
+    // Preallocates disk space for the segment without changing the size of
+    // the file.  This is only an optimization against fragmentation.
+    ::fallocate(fd_.get(), FALLOC_FL_KEEP_SIZE, offset,
+                mapping->segment_size);
+#endif
+  }
+}
+
+void Store::flushBufferUnlocked() {
+  const Metrics::Timer timer(options_.metrics.get(),
+                             Metrics::Operation::STORE_FLUSH);
+  const auto offset = mt::tell(fd_.get());
+  const auto length = buffer_.offset;
+  writeBufferUnlocked();
+  syncWrittenRange(offset, length);
+  publishUnlocked(offset + length);
+}
+
+void Store::writeBufferUnlocked() {
+  if (options_.metrics) {
+    options_.metrics->addBytesWritten(buffer_.offset);
+  }
+  buffer_.flushTo(fd_.get());
+}
+
+void Store::syncWrittenRange(uint64_t offset, uint64_t length) const {
+  switch (options_.durability) {
+    case Durability::PERIODIC:
+      mt::syncFileRange(fd_.get(), offset, length, SYNC_FILE_RANGE_WRITE);
+      break;
+    case Durability::PER_BATCH:
+      mt::fdatasync(fd_.get());
+      break;
+    default:
+      break;
+  }
+}
+
+void Store::publishUnlocked(uint64_t new_size) {
+  const auto mapping = mapped_.load();
+  if (new_size <= mapping->getCapacity()) {
+    mapping->size = new_size;
+  } else {
+    remapUnlocked(new_size);
+  }
+}
+
+void Store::scheduleFlushUnlocked() {
+  waitForFlushUnlocked();
+  std::swap(buffer_, flushing_buffer_);
+  flush_cond_.notify_all();
+}
+
+void Store::waitForFlushUnlocked() const {
+  while (!flushing_buffer_.empty() && !flush_error_) {
+    flush_cond_.wait(mutex_);
+  }
+  if (flush_error_) std::rethrow_exception(flush_error_);
+}
+
+uint32_t Store::appendToLane(const char* block, uint32_t min_id,
+                             uint32_t extent_size) {
+  const auto index =
+      std::hash<std::thread::id>()(std::this_thread::get_id()) % lanes_.size();
+  auto lane = &lanes_[index];
+  std::unique_lock<std::mutex> lane_lock(lane->mutex);
+  if (lane->next_id < min_id) {
+    // The range of the lane precedes the caller's last block, which another
+    // thread has appended via another lane.  That lane is likely to have
+    // room for the block as well.
+    lane_lock.unlock();
+    for (size_t i = 1; i != lanes_.size() && !lane_lock; ++i) {
+      auto& other = lanes_[(index + i) % lanes_.size()];
+      std::unique_lock<std::mutex> other_lock(other.mutex);
+      if (other.next_id >= min_id &&
+          other.end_id - other.next_id >= extent_size) {
+        lane = &other;
+        lane_lock = std::move(other_lock);
+      }
+    }
+    if (!lane_lock) lane_lock.lock();
+  }
+  if (lane->next_id < min_id || lane->end_id - lane->next_id < extent_size) {
+    reserveLaneRange(lane, extent_size);
+  }
+  const auto id = lane->next_id;
+  lane->next_id += extent_size;
+  {
+    const EpochGuard guard(this);
+    copyToMapped(guard.mapping(), id, block);
+  }
+  if (extent_size > 1) {
+    // The other blocks of the extent are zero, like the rest of the range.
+    std::lock_guard<Mutex> lock(mutex_);
+    extents_.emplace(id + 1, id + extent_size);
+  }
+  if (options_.metrics) {
+    options_.metrics->addBytesWritten(getBlockSize());
+  }
+  return id;
+}
+
+void Store::reserveLaneRange(Lane* lane, uint32_t count) {
+  std::lock_guard<Mutex> lock(mutex_);
+  for (auto id = lane->next_id; id != lane->end_id; ++id) {
+    reusable_ids_.insert(id);
+  }
+  // Blocks in `buffer_` must precede the range in the data file.
+  waitForFlushUnlocked();
+  if (!buffer_.empty()) {
+    flushBufferUnlocked();
+  }
+  count = std::max<uint32_t>(count, buffer_.size / getBlockSize());
+  const uint32_t first_id = getNumBlocksUnlocked();
+  const auto new_size = getBlockSize() * (first_id + count);
+  mt::truncate(fd_.get(), new_size);
+  mt::seek(fd_.get(), new_size, SEEK_SET);
+  publishUnlocked(new_size);
+  lane->next_id = first_id;
+  lane->end_id = first_id + count;
+}
+
+void Store::runFlusher() {
+  std::unique_lock<Mutex> lock(mutex_);
+  while (true) {
+    flush_cond_.wait(lock, [this] {
+      return !flushing_buffer_.empty() || stop_flusher_;
+    });
+    if (flushing_buffer_.empty()) break;
+    const auto offset = mt::tell(fd_.get());
+    // Blocks are neither appended nor published until the buffer is empty.
+    lock.unlock();
+    try {
+      const Metrics::Timer timer(options_.metrics.get(),
+                                 Metrics::Operation::STORE_FLUSH);
+      mt::write(fd_.get(), flushing_buffer_.data.get(),
+                flushing_buffer_.offset);
+      if (options_.metrics) {
+        options_.metrics->addBytesWritten(flushing_buffer_.offset);
+      }
+      lock.lock();
+      // The buffer holds the current content of replaced blocks, which may
+      // have been written before they were replaced.
+      const auto first_id = offset / getBlockSize();
+      for (const auto id : replaced_while_flushing_) {
+        mt::pwrite(fd_.get(), getAddressOf(id), getBlockSize(),
+                   offset + getBlockSize() * (id - first_id));
+      }
+      replaced_while_flushing_.clear();
+      syncWrittenRange(offset, flushing_buffer_.offset);
+      const auto new_size = offset + flushing_buffer_.offset;
+      flushing_buffer_.offset = 0;
+      publishUnlocked(new_size);
+    } catch (std::exception& error) {
+      if (!lock) lock.lock();
+      mt::log() << "Store could not flush its buffer: " << error.what()
+                << '\n';
+      flush_error_ = std::current_exception();
+      flush_cond_.notify_all();
+      break;
+    }
+    flush_cond_.notify_all();
+  }
+}
+
+void Store::remapUnlocked(uint64_t new_size) {
+  const Metrics::Timer timer(options_.metrics.get(),
+                             Metrics::Operation::STORE_REMAP);
+  // Segments are added rather than calling `mremap()`, because the latter
+  // may move the region while lock-free readers are still using it, and
+  // remapping the whole file would let readers fault in all pages again.
+  const auto old_mapping = mapped_.load();
+  MT_ASSERT_LT(old_mapping->getCapacity(), new_size);
+  std::unique_ptr<Mapping> new_mapping(new Mapping());
+  new_mapping->segments = old_mapping->segments;
+  new_mapping->segment_size = old_mapping->segment_size;
+  new_mapping->segment_shift = old_mapping->segment_shift;
+  mapSegments(new_mapping.get(), new_size);
+  new_mapping->size = new_size;
+  adviseUnlocked(new_mapping.get(), access_pattern_, old_mapping->size);
+  mapped_.store(new_mapping.release());
+
+  // Readers that enter from now on will see the new mapping.  Wait for all
+  // readers that entered in the previous epoch before releasing the old one.
+  const auto old_epoch = epoch_.fetch_add(1);
+  for (const auto& slot : reader_slots_) {
+    while (slot.count[old_epoch % 2].load() != 0) {
+      std::this_thread::yield();
+    }
+  }
+  if (old_mapping != &empty_mapping_) {
+    delete old_mapping;
+    // Its segments are still mapped as part of the new mapping.
+  }
+}
+
+void Store::prefetchMapped(const Mapping* mapping, uint32_t first_id,
+                           uint32_t count) const {
+  const auto block_size = getBlockSize();
+  if (mapping->segments.empty() ||
+      first_id + uint64_t(count) > mapping->getNumBlocks(block_size)) {
+    return;
+  }
+  // Blocks that are still buffered are in memory anyway.
+  const uint64_t page_size = ::sysconf(_SC_PAGESIZE);
+  const uint64_t offset = first_id * block_size;
+  const uint64_t aligned_offset = offset - offset % page_size;
+  const auto length = offset - aligned_offset + count * block_size;
+  mapping->forEachPart(aligned_offset, length, [](char* data, uint64_t size) {
+#if defined(MADV_POPULATE_READ)
+    if (::madvise(data, size, MADV_POPULATE_READ) == 0) return;
+    // Also maps the pages, but is not supported before Linux 5.14.
+#endif
+    ::madvise(data, size, MADV_WILLNEED);
+    // Only a hint, whose failure is not an error.
+  });
+}
+
+void Store::adviseUnlocked(const Mapping* mapping, AccessPattern pattern,
+                           uint64_t offset) const {
+  if (fd_.get() == -1) return;
+  int madvice = MADV_NORMAL;
+  int fadvice = POSIX_FADV_NORMAL;
+  switch (pattern) {
+    case AccessPattern::NORMAL:
+      break;
+    case AccessPattern::SEQUENTIAL:
+      madvice = MADV_SEQUENTIAL;
+      fadvice = POSIX_FADV_SEQUENTIAL;
+      break;
+    case AccessPattern::RANDOM:
+      madvice = MADV_RANDOM;
+      fadvice = POSIX_FADV_RANDOM;
+      break;
+    case AccessPattern::WILLNEED:
+      madvice = MADV_WILLNEED;
+      fadvice = POSIX_FADV_WILLNEED;
+      break;
+    default:
+      MT_FAIL("Default case in switch statement reached");
+  }
+  if (pattern != AccessPattern::WILLNEED) {
+    // Readahead behavior applies to the mapping and the file as a whole.
+    offset = 0;
+  }
+  const uint64_t page_size = ::sysconf(_SC_PAGESIZE);
+  offset -= offset % page_size;
+  // `madvise()` requires a page-aligned address.
+  const auto size = pattern == AccessPattern::WILLNEED
+                        ? mapping->size.load()
+                        : mapping->getCapacity();
+  if (offset < size) {
+    mapping->forEachPart(offset, size - offset,
+                         [madvice](char* data, uint64_t length) {
+                           mt::madvise(data, length, madvice);
+                         });
+  }
+  mt::fadvise(fd_.get(), offset, 0, fadvice);
+}
+
+void Store::openCompressed(uint64_t length) {
+  if (length == 0) return;
+  mt::Check::isTrue(options_.readonly,
+                    "Store: compressed data files can only be read");
+  uint64_t footer[2];
+  mt::Check::isTrue(length >= sizeof footer,
+                    "Store: data file is not compressed");
+  mt::pread(fd_.get(), footer, sizeof footer, length - sizeof footer);
+  const auto num_blocks = footer[0];
+  const auto table_size = (num_blocks + 1) * sizeof(uint64_t);
+  mt::Check::isTrue(footer[1] == COMPRESSED_FILE_MAGIC &&
+                        length >= sizeof footer + table_size,
+                    "Store: data file is not compressed");
+
+  std::unique_ptr<Mapping> mapping(new Mapping());
+  mapping->segments.push_back(mapDataFile(length, PROT_READ));
+  mapping->segment_size = length;
+  mapping->segment_shift = WHOLE_FILE_SEGMENT_SHIFT;
+  mapping->size = length;
+  compressed_.mapped_offsets = reinterpret_cast<const uint64_t*>(
+      mapping->segments.front() + length - sizeof footer - table_size);
+  compressed_.num_mapped_blocks = num_blocks;
+  mapped_.store(mapping.release());
+}
+
+void Store::getCompressed(uint32_t id, char* block) const {
+  MT_REQUIRE_TRUE(isReadOnly());
+  MT_REQUIRE_LT(id, compressed_.getNumBlocks());
+  // A compressed store is read-only when it is read, so the mapping is
+  // never replaced and can be used without any epoch protection.
+  const auto mapping = mapped_.load();
+  const auto begin = compressed_.mapped_offsets[id];
+  const auto size = compressed_.mapped_offsets[id + 1] - begin;
+  const auto data =
+      reinterpret_cast<const Bytef*>(mapping->segments.front() + begin);
+  if (size == getBlockSize()) {
+    // The block was not compressible and has been stored verbatim.
+    std::memcpy(block, data, size);
+    return;
+  }
+  if (tryGetCached(id, block)) return;
+  uLongf block_size = getBlockSize();
+  const auto status =
+      ::uncompress(reinterpret_cast<Bytef*>(block), &block_size, data, size);
+  mt::Check::isTrue(status == Z_OK && block_size == getBlockSize(),
+                    "Store: could not decompress block %u", id);
+  putCached(id, block);
+}
+
+uint32_t Store::putCompressedUnlocked(const char* block) {
+  auto size = static_cast<uLongf>(compressed_.buffer_size);
+  const auto status = ::compress2(
+      reinterpret_cast<Bytef*>(compressed_.buffer.get()), &size,
+      reinterpret_cast<const Bytef*>(block), getBlockSize(), Z_BEST_SPEED);
+  MT_ASSERT_EQ(status, Z_OK);
+  const char* data = compressed_.buffer.get();
+  if (size >= getBlockSize()) {
+    data = block;
+    size = getBlockSize();
+  }
+  if (size > buffer_.size - buffer_.offset) {
+    writeBufferUnlocked();
+  }
+  std::memcpy(buffer_.data.get() + buffer_.offset, data, size);
+  buffer_.offset += size;
+  compressed_.offsets.push_back(compressed_.offsets.back() + size);
+  return compressed_.offsets.size() - 2;
+}
+
+void Store::writeOffsetTableUnlocked() {
+  const char padding[sizeof(uint64_t)] = {};
+  const auto padding_size = (sizeof padding - compressed_.offsets.back() %
+                             sizeof padding) % sizeof padding;
+  mt::write(fd_.get(), padding, padding_size);
+  // Aligns the offset table for reading it from the mapped file.
+  const uint64_t footer[] = {compressed_.offsets.size() - 1,
+                             COMPRESSED_FILE_MAGIC};
+  mt::write(fd_.get(), compressed_.offsets.data(),
+            compressed_.offsets.size() * sizeof compressed_.offsets.front());
+  mt::write(fd_.get(), footer, sizeof footer);
+}
+
+bool Store::tryGetCached(uint32_t id, char* block) const {
+  if (!cache_) return false;
+  if (cache_->get(uint64_t(options_.block_cache_id) << 32 | id, block)) {
+    num_cache_hits_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+  }
+  num_cache_misses_.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void Store::putCached(uint32_t id, const char* block) const {
+  if (cache_) {
+    cache_->put(uint64_t(options_.block_cache_id) << 32 | id, block);
+  }
+}
+
+void Store::openDirect(const boost::filesystem::path& filename) {
+  direct_ = true;
+  const auto fd = ::open(filename.c_str(), O_RDONLY | O_DIRECT);
+  if (fd != -1) {
+    fd_ = mt::AutoCloseFd(fd);
+  } else {
+    mt::Check::isEqual(errno, EINVAL, "open() failed for '%s' because of '%s'",
+                       filename.c_str(), mt::errnostr());
+    // The file system does not support `O_DIRECT`.
+    fd_ = mt::open(filename, O_RDONLY);
+  }
+  const auto length = mt::seek(fd_.get(), 0, SEEK_END);
+  mt::Check::isZero(length % getBlockSize(),
+                    "Store: block size does not match size of data file");
+  std::unique_ptr<Mapping> mapping(new Mapping());
+  mapping->size = length;
+  // Only tells the number of blocks, there is no mapped data.
+  mapped_.store(mapping.release());
+}
+
+void Store::getDirect(uint32_t id, char* block) const {
+  MT_REQUIRE_LT(id, mapped_.load()->getNumBlocks(getBlockSize()));
+  if (tryGetCached(id, block)) return;
+  readDirect(id, 1, block);
+  putCached(id, block);
+}
+
+void Store::getDirect(std::vector<ExtendedReadWriteBlock>& blocks) const {
+  std::vector<ExtendedReadWriteBlock*> misses;
+  for (auto& block : blocks) {
+    if (block.ignore) continue;
+    MT_REQUIRE_LT(block.id, mapped_.load()->getNumBlocks(getBlockSize()));
+    if (!tryGetCached(block.id, block.data())) {
+      misses.push_back(&block);
+    }
+  }
+  std::sort(misses.begin(), misses.end(),
+            [](const ExtendedReadWriteBlock* lhs,
+               const ExtendedReadWriteBlock* rhs) { return lhs->id < rhs->id; });
+  const auto block_size = getBlockSize();
+  std::unique_ptr<char[]> run_data;
+  for (size_t first = 0; first != misses.size();) {
+    // Coalesces blocks with consecutive ids into a single read.
+    auto last = first + 1;
+    while (last != misses.size() &&
+           misses[last]->id == misses[last - 1]->id + 1 &&
+           last - first != MAX_NUM_BLOCKS_PER_READ) {
+      ++last;
+    }
+    const uint32_t num_blocks = last - first;
+    if (num_blocks == 1) {
+      readDirect(misses[first]->id, 1, misses[first]->data());
+    } else {
+      if (!run_data) {
+        run_data.reset(new char[MAX_NUM_BLOCKS_PER_READ * block_size]);
+      }
+      readDirect(misses[first]->id, num_blocks, run_data.get());
+      for (auto i = first; i != last; ++i) {
+        std::memcpy(misses[i]->data(), run_data.get() + (i - first) * block_size,
+                    block_size);
+      }
+    }
+    for (auto i = first; i != last; ++i) {
+      putCached(misses[i]->id, misses[i]->data());
+    }
+    first = last;
+  }
+}
+
+void Store::readDirect(uint32_t id, uint32_t num_blocks, char* target) const {
+  const auto begin = getBlockSize() * id;
+  const auto end = begin + getBlockSize() * num_blocks;
+  const auto aligned_begin = begin - begin % DIRECT_IO_ALIGNMENT;
+  const auto aligned_end = (end + DIRECT_IO_ALIGNMENT - 1) /
+                           DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+  const auto size = aligned_end - aligned_begin;
+  const auto data = allocateAligned(size);
+  uint64_t num_bytes_read = 0;
+  while (aligned_begin + num_bytes_read < end) {
+    const auto result =
+        ::pread(fd_.get(), data.get() + num_bytes_read,
+                size - num_bytes_read, aligned_begin + num_bytes_read);
+    mt::Check::notEqual(result, -1, "pread() failed because of '%s'",
+                        mt::errnostr());
+    mt::Check::notZero(result, "Store: unexpected end of data file");
+    // The aligned range may extend beyond the end of the file.
+    num_bytes_read += result;
   }
+  std::memcpy(target, data.get() + (begin - aligned_begin), end - begin);
 }
 
 }  // namespace internal
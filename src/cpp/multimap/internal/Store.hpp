@@ -18,22 +18,168 @@
 #ifndef MULTIMAP_INTERNAL_STORE_HPP_INCLUDED
 #define MULTIMAP_INTERNAL_STORE_HPP_INCLUDED
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
 #include <memory>
 #include <mutex>
+#include <set>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <unordered_map>
+#include <vector>
 #include <boost/filesystem/path.hpp>
 #include "multimap/internal/Block.hpp"
+#include "multimap/internal/BlockCache.hpp"
+#include "multimap/internal/IoLimiter.hpp"
+#include "multimap/internal/LockProfiler.hpp"
+#include "multimap/internal/Metrics.hpp"
 #include "multimap/thirdparty/mt/mt.hpp"
 
 namespace multimap {
 namespace internal {
 
 class Store : public mt::Resource {
+  // Blocks that have already been flushed to the data file are immutable with
+  // respect to their location, so reading or replacing them does not need to
+  // take `mutex_`.  Instead, readers load an atomically published snapshot of
+  // the current mapping.  When the mapping has to grow, a new one is created
+  // and published while the old one is retired and released only after all
+  // readers that might still use it have left (epoch-based reclamation).
+  // Only the append path via the write buffer is serialized by `mutex_`.
+  //
+  // In writable mode, the data file is mapped in fixed-size segments, see
+  // `Options::segment_size`, and the last segment may extend beyond the end
+  // of the file, which is valid as long as only the part within the file is
+  // accessed.  Flushing the write buffer appends to the file and publishes
+  // the new size within the current mapping.  The mapping is only replaced
+  // when the file outgrows its last segment, in which case the new mapping
+  // shares all existing segments and maps one more, so that blocks never
+  // move and the cost of growing does not depend on the size of the file.
+  //
+  // If `Options::compress` is set, each block is compressed with zlib when it
+  // is put and the data file holds variable-length blocks followed by a table
+  // of their offsets.  Such a store is append-only: it is written once, e.g.
+  // by `PartitionBuilder`, and can only be reopened in read-only mode.
+  //
+  // If `Options::direct_io` is set, a read-only store does not map its data
+  // file, but reads blocks via `pread()` from a file descriptor opened with
+  // `O_DIRECT`, which bypasses the page cache.  Adjacent blocks that are
+  // requested together are read with a single call.
+  //
+  // Read-only stores that are compressed or use direct I/O consult the block
+  // cache passed via `Options::block_cache`, if any, before decompressing or
+  // reading a block.  Other stores copy blocks from the mapping, which is
+  // not more expensive than copying them from a cache.
+  //
+  // If `Options::checksums` is set, a writable store maintains a CRC-32C
+  // checksum of each block, which it writes to a file next to the data file
+  // when it is closed.  The file is removed when a store is opened in
+  // writable mode, so that it never describes blocks that have changed since,
+  // e.g. after a crash.  A read-only store verifies each block against its
+  // checksum the first time the block is read.
+  //
+  // If `Options::background_flush` is set, a writable store has a second
+  // buffer and a thread that writes a full buffer to the data file, while
+  // blocks are put into the other one.  The blocks of the buffer being
+  // written remain accessible via `mutex_` until they are published as part
+  // of the mapping, and blocks replaced in the meantime are written again
+  // right before that.  A put only waits if the other buffer fills up while
+  // the write is still going on.
+  //
+  // If `Options::num_write_lanes` is not zero, a writable store lets threads
+  // append blocks without waiting for each other.  Each thread writes into
+  // one of the lanes, which holds a range of ids at the end of the data file
+  // that has been reserved in bulk, and copies the block straight into the
+  // mapping, which already covers the range.  Only reserving the next range
+  // locks `mutex_`.  Extents and reusable blocks are still looked up with
+  // `mutex_` locked.  Unused ids of a lane become reusable when the lane
+  // moves on to a new range and when `releaseExtents()` is called.
+  //
+  // `Options::durability` decides what the store does after writing a full
+  // buffer: nothing, start the writeback of the written range via
+  // `sync_file_range()`, so that a later sync has less to wait for, or
+  // force it to stable storage via `fdatasync()`.
+
  public:
+  enum class Durability { NONE, ON_CLOSE, PERIODIC, PER_BATCH };
+  // Policies for forcing written data to stable storage, from the fastest to
+  // the safest.  A store itself only acts on the last two, the other files
+  // of a partition are handled by class Partition.
+
   struct Options {
     uint32_t block_size = 512;
     uint32_t buffer_size = mt::MiB(1);
     bool readonly = false;
+    bool compress = false;
+
+    bool front_coding = false;
+    // Not interpreted by the store itself, but tells `List` to front-code the
+    // values it writes into the blocks of this store.
+
+    bool populate = false;
+    bool huge_pages = false;
+    bool lock_in_memory = false;
+    // Tune the mapping of the data file in read-only mode via `MAP_POPULATE`,
+    // `MADV_HUGEPAGE`, and `mlock()` respectively.  Have no effect in
+    // writable mode, where the data file is mapped in segments.
+
+    uint64_t segment_size = mt::MiB(64);
+    // Has no effect in read-only mode.  A writable data file is mapped in
+    // segments of this size, rounded up to a power of two number of blocks
+    // that is a multiple of the page size.  Growing the file maps new
+    // segments, whereas existing ones are never moved or unmapped, so that
+    // readers do not fault their pages in again.
+
+    bool direct_io = false;
+    // Has only an effect for read-only stores that are not compressed.
+    // Falls back to buffered I/O if the file system does not support
+    // `O_DIRECT`.
+
+    uint32_t max_read_ahead = 1024;
+    // Not interpreted by the store itself, but limits the number of blocks
+    // that a `List` iterator loads from this store at once.
+
+    uint32_t max_extent_size = 1;
+    // Not interpreted by the store itself, but limits the number of blocks
+    // that a `List` reserves at once via `put()` with an extent size.
+
+    bool checksums = false;
+    // Has no effect for compressed stores, whose blocks are already checked
+    // by zlib.  In read-only mode, blocks are only verified if the checksums
+    // file exists.
+
+    std::shared_ptr<BlockCache> block_cache;
+    uint32_t block_cache_id = 0;
+    // Blocks are cached with the key `block_cache_id << 32 | block_id`, so
+    // that stores sharing a cache must have distinct ids.
+
+    std::shared_ptr<Metrics> metrics;
+    // If not null, receives the number of bytes read and written as well as
+    // the latency of flushing the buffer and of remapping the data file.
+
+    std::shared_ptr<IoLimiter> io_limiter;
+    // If not null, limits the blocks that background threads get, put,
+    // replace, prefetch, or copy, see `IoLimiter::Scope`.  Blocks are
+    // charged before `mutex_` is locked, so that a waiting thread does not
+    // hold up others, and when they are put rather than when the buffer is
+    // written, which may happen on a foreground thread.
+
+    bool background_flush = false;
+    // Has only an effect for writable stores that are not compressed, which
+    // then allocate the buffer twice.
+
+    uint32_t num_write_lanes = 0;
+    // Has only an effect for writable stores that are not compressed, do not
+    // maintain checksums, and have no durability other than `NONE`, because
+    // blocks in lanes are never written via `buffer_`.  Each lane reserves
+    // `buffer_size` bytes at a time, and threads are assigned to lanes by
+    // the hash value of their id.
+
+    Durability durability = Durability::NONE;
+    // Has no effect in read-only mode.
   };
 
   Store() = default;
@@ -49,13 +195,16 @@ class Store : public mt::Resource {
   template <bool IsMutable>
   uint32_t put(const BasicBlock<IsMutable>& block) {
     MT_REQUIRE_EQ(block.size(), getBlockSize());
-    std::lock_guard<std::mutex> lock(mutex_);
+    limitIo(1);
+    if (hasWriteLanes()) return appendToLane(block.data(), 0, 1);
+    std::lock_guard<Mutex> lock(mutex_);
     return putUnlocked(block.data());
   }
 
   template <bool IsMutable>
   void put(std::vector<ExtendedBasicBlock<IsMutable> >& blocks) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    limitIo(countBlocks(blocks));
+    std::lock_guard<Mutex> lock(mutex_);
     for (auto& block : blocks) {
       if (!block.ignore) {
         MT_REQUIRE_EQ(block.size(), getBlockSize());
@@ -64,92 +213,357 @@ class Store : public mt::Resource {
     }
   }
 
-  void get(uint32_t id, ReadWriteBlock& block) const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    getUnlocked(id, block.data());
+  template <bool IsMutable>
+  uint32_t put(const BasicBlock<IsMutable>& block, uint32_t min_id) {
+    MT_REQUIRE_EQ(block.size(), getBlockSize());
+    limitIo(1);
+    if (hasWriteLanes()) {
+      {
+        std::lock_guard<Mutex> lock(mutex_);
+        const auto id = tryPutReusedUnlocked(block.data(), min_id);
+        if (id != NO_ID) return id;
+      }
+      return appendToLane(block.data(), min_id, 1);
+    }
+    std::lock_guard<Mutex> lock(mutex_);
+    return putUnlocked(block.data(), min_id);
+  }
+  // Same as `put()`, but writes the block into the reusable block with the
+  // smallest id not less than `min_id`, if any, see `reuse()`.
+
+  template <bool IsMutable>
+  void put(std::vector<ExtendedBasicBlock<IsMutable> >& blocks,
+           uint32_t min_id) {
+    limitIo(countBlocks(blocks));
+    std::lock_guard<Mutex> lock(mutex_);
+    for (auto& block : blocks) {
+      if (!block.ignore) {
+        MT_REQUIRE_EQ(block.size(), getBlockSize());
+        block.id = putUnlocked(block.data(), min_id);
+        min_id = block.id + 1;
+      }
+    }
   }
+  // Same as before, the assigned ids are increasing.
 
-  void get(ExtendedReadWriteBlock& block) const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    getUnlocked(block.id, block.data());
+  template <bool IsMutable>
+  void putRun(std::vector<ExtendedBasicBlock<IsMutable> >& blocks,
+              uint32_t min_id) {
+    limitIo(blocks.size());
+    std::lock_guard<Mutex> lock(mutex_);
+    auto id = findReusableRunUnlocked(min_id, blocks.size());
+    if (id == NO_RUN && !isCompressed() &&
+        blocks.size() * getBlockSize() >= buffer_.size) {
+      std::vector<const char*> data;
+      data.reserve(blocks.size());
+      for (const auto& block : blocks) {
+        MT_REQUIRE_EQ(block.size(), getBlockSize());
+        data.push_back(block.data());
+      }
+      id = appendRunUnlocked(data);
+      for (auto& block : blocks) {
+        block.id = id++;
+      }
+      return;
+    }
+    for (auto& block : blocks) {
+      MT_REQUIRE_EQ(block.size(), getBlockSize());
+      if (id == NO_RUN) {
+        block.id = putUnlocked(block.data());
+      } else {
+        reusable_ids_.erase(id);
+        replaceUnlocked(id, block.data());
+        block.id = id++;
+      }
+    }
   }
+  // Same as before, but the assigned ids are consecutive.  Reusable blocks
+  // are only taken if there are enough with consecutive ids not less than
+  // `min_id`, otherwise all blocks are appended.  Appended runs that are at
+  // least as large as the buffer are written to the data file directly, see
+  // `appendRunUnlocked()`.  Blocks marked as ignored are not supported.
+
+  template <bool IsMutable>
+  uint32_t put(const BasicBlock<IsMutable>& block, uint32_t min_id,
+               uint32_t extent_size) {
+    MT_REQUIRE_EQ(block.size(), getBlockSize());
+    limitIo(1);
+    if (hasWriteLanes()) {
+      {
+        std::lock_guard<Mutex> lock(mutex_);
+        auto id = tryPutIntoExtentUnlocked(block.data(), min_id);
+        if (id == NO_ID && extent_size < 2) {
+          id = tryPutReusedUnlocked(block.data(), min_id);
+        }
+        if (id != NO_ID) return id;
+      }
+      return appendToLane(block.data(), min_id, std::max(extent_size, 1u));
+    }
+    std::lock_guard<Mutex> lock(mutex_);
+    return putUnlocked(block.data(), min_id, extent_size);
+  }
+  // Same as `put()` with a minimum id, but if `min_id` is the next unused
+  // block of an extent, i.e. a run of blocks appended at once, the block is
+  // written there.  Otherwise, if `extent_size` is greater than one, a new
+  // extent of that many blocks is appended, whose first block takes `block`.
+  // A caller that always passes the id following its last block thus gets
+  // consecutive ids, which `UintVector` stores in constant space.  The
+  // unused blocks of extents are made reusable by `releaseExtents()`.
+  // Compressed stores ignore `extent_size`.
+
+  void releaseExtents();
+  // Makes the unused blocks of all extents reusable, see `reuse()`.  Should
+  // be called before the ids of reusable blocks are saved.
+
+  void reuse(const std::vector<uint32_t>& ids);
+  // Makes the blocks with `ids` available to `put()` with a minimum id.
+  // Has no effect for compressed stores, which cannot overwrite blocks.
+  // Requires: the blocks are no longer referenced, neither by the caller nor
+  // by any state that may be recovered after a crash.
+
+  std::vector<uint32_t> getReusableBlocks() const;
+  // Returns the ids of blocks that have been passed to `reuse()` and have not
+  // been overwritten yet in ascending order.
+
+  void get(uint32_t id, ReadWriteBlock& block) const {
+    addBytesRead(1);
+    limitIo(1);
+    if (isCompressed()) {
+      getCompressed(id, block.data());
+    } else if (isDirect()) {
+      getDirect(id, block.data());
+    } else if (!tryGetMapped(id, block.data())) {
+      std::lock_guard<Mutex> lock(mutex_);
+      getUnlocked(id, block.data());
+    }
+    verify(id, block.data());
+  }
+
+  void get(ExtendedReadWriteBlock& block) const { get(block.id, block); }
 
   void get(std::vector<ExtendedReadWriteBlock>& blocks) const {
-    std::lock_guard<std::mutex> lock(mutex_);
+    if (options_.metrics || options_.io_limiter) {
+      const auto num_blocks = countBlocks(blocks);
+      addBytesRead(num_blocks);
+      limitIo(num_blocks);
+    }
+    if (isCompressed()) {
+      for (auto& block : blocks) {
+        if (!block.ignore) getCompressed(block.id, block.data());
+      }
+      return;
+    }
+    if (isDirect()) {
+      getDirect(blocks);
+      verify(blocks);
+      return;
+    }
+    uint64_t num_blocks_mapped = 0;
+    {
+      const EpochGuard guard(this);
+      num_blocks_mapped = guard.mapping()->getNumBlocks(getBlockSize());
+      for (auto& block : blocks) {
+        if (!block.ignore && block.id < num_blocks_mapped) {
+          copyFromMapped(guard.mapping(), block.id, block.data());
+        }
+      }
+    }
+    // The guard must be released before locking `mutex_`, because a remap
+    // in progress holds `mutex_` while waiting for all readers to leave.
+    std::unique_lock<Mutex> lock(mutex_, std::defer_lock);
     for (auto& block : blocks) {
-      if (!block.ignore) {
+      if (!block.ignore && block.id >= num_blocks_mapped) {
+        if (!lock) lock.lock();
         getUnlocked(block.id, block.data());
       }
     }
+    verify(blocks);
   }
 
+  void getRange(uint32_t first_id, uint32_t count, char* target) const;
+  // Copies `count` blocks with consecutive ids starting at `first_id` into
+  // `target`, which must provide space for `count * getBlockSize()` bytes.
+  // Mapped blocks are copied with a single `memcpy()` and blocks read with
+  // direct I/O are read with as few `pread()` calls as the cache permits.
+
   template <bool IsMutable>
   void replace(uint32_t id, const BasicBlock<IsMutable>& block) {
     MT_REQUIRE_EQ(block.size(), getBlockSize());
-    std::lock_guard<std::mutex> lock(mutex_);
-    replaceUnlocked(id, block.data());
+    mt::Check::isFalse(isCompressed(), CANNOT_REPLACE_COMPRESSED_BLOCK);
+    limitIo(1);
+    if (hasChecksums() || !tryReplaceMapped(id, block.data())) {
+      // Checksums are updated with `mutex_` locked.
+      std::lock_guard<Mutex> lock(mutex_);
+      replaceUnlocked(id, block.data());
+    }
   }
 
   template <bool IsMutable>
   void replace(const ExtendedBasicBlock<IsMutable>& block) {
-    MT_REQUIRE_EQ(block.size(), getBlockSize());
-    std::lock_guard<std::mutex> lock(mutex_);
-    replaceUnlocked(block.id, block.data());
+    replace(block.id, block);
   }
 
   template <bool IsMutable>
   void replace(const std::vector<ExtendedBasicBlock<IsMutable> >& blocks) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    mt::Check::isFalse(isCompressed(), CANNOT_REPLACE_COMPRESSED_BLOCK);
+    limitIo(countBlocks(blocks));
+    uint64_t num_blocks_mapped = 0;
+    if (!hasChecksums()) {
+      const EpochGuard guard(this);
+      num_blocks_mapped = guard.mapping()->getNumBlocks(getBlockSize());
+      for (const auto& block : blocks) {
+        if (!block.ignore && block.id < num_blocks_mapped) {
+          MT_REQUIRE_EQ(block.size(), getBlockSize());
+          copyToMapped(guard.mapping(), block.id, block.data());
+        }
+      }
+    }
+    std::unique_lock<Mutex> lock(mutex_, std::defer_lock);
     for (const auto& block : blocks) {
-      if (!block.ignore) {
+      if (!block.ignore && block.id >= num_blocks_mapped) {
         MT_REQUIRE_EQ(block.size(), getBlockSize());
+        if (!lock) lock.lock();
         replaceUnlocked(block.id, block.data());
       }
     }
   }
 
-  enum class AccessPattern { NORMAL, WILLNEED };
+  void flush();
+  // Writes buffered blocks to the data file, so that they are accessible
+  // via a new store opened for the same file, even if this process crashes.
+  // Does nothing for compressed stores, which are written on destruction.
+
+  void copyTo(const boost::filesystem::path& file);
+  // Flushes the store and copies its data file to `file`, which is replaced
+  // if it exists.  The copy is a reflink via `FICLONE` if the file system
+  // supports it, which shares all extents until either file is modified,
+  // and a plain copy otherwise.  Blocks put meanwhile wait, but blocks that
+  // are replaced via the mapping or appended to a write lane do not, so the
+  // caller must prevent that.
+  // Requires: the store is writable.
+
+  const char* tryGetStableAddressOf(uint32_t id) const;
+  // Returns a pointer to the block with `id` in the mapped data file if
+  // `hasStableBlocks()` is true, otherwise `nullptr`.  The pointer remains
+  // valid for the lifetime of the store and allows reading without copying.
+
+  bool hasStableBlocks() const {
+    return isReadOnly() && !isCompressed() && !isDirect();
+  }
+
+  void prefetch(const std::vector<uint32_t>& ids) const;
+  // Brings the blocks with `ids`, which must be sorted, into memory, so that
+  // reading them later does not wait for the disk.  Mapped blocks are paged
+  // in via `madvise()`, and the blocks of a compressed store or one using
+  // direct I/O are read into the block cache, if any.  Runs of consecutive
+  // ids are read at once.  Ids of blocks that do not exist are ignored.
+
+  void readAhead(const std::vector<uint32_t>& ids) const;
+  // Asks the kernel via `madvise(MADV_WILLNEED)` to start reading the blocks
+  // with `ids`, which must be sorted, and returns without waiting for them.
+  // Blocks that are close to each other in the data file are requested
+  // together.  Does nothing for stores using direct I/O.
+  // Requires: `isReadOnly()`
+
+  std::vector<uint32_t> getCachedBlockIds() const;
+  // Returns the ids of the blocks of this store that are in the block
+  // cache, if any, in ascending order.
+
+  enum class AccessPattern { NORMAL, SEQUENTIAL, RANDOM, WILLNEED };
   // The names are borrowed from `posix_fadvise`.
 
   void adviseAccessPattern(AccessPattern pattern) const;
+  // Passes `pattern` as a hint to the kernel via `madvise()` for the mapped
+  // data file and via `posix_fadvise()` for the file itself.  The hint is
+  // reapplied when the mapping grows.  `WILLNEED` starts asynchronous
+  // readahead of the whole file and returns without waiting for it.
 
   bool isReadOnly() const { return buffer_.size == 0; }
 
+  bool isCompressed() const { return options_.compress; }
+
+  bool isDirect() const { return direct_; }
+  // Returns `true` if blocks are read via `pread()` instead of a mapping.
+
+  bool hasFrontCodedValues() const { return options_.front_coding; }
+
+  bool hasChecksums() const { return has_checksums_; }
+  // Returns `true` if a writable store maintains checksums or if a read-only
+  // store verifies blocks, see `Options::checksums`.
+
+  std::vector<uint32_t> getCorruptBlocks() const;
+  // Compares every block with its checksum, even if it has been verified
+  // before, and returns the ids of those that do not match in ascending
+  // order.  Requires: `isReadOnly()` and `hasChecksums()`.
+
+  uint32_t getMaxReadAhead() const { return options_.max_read_ahead; }
+
+  uint32_t getMaxExtentSize() const { return options_.max_extent_size; }
+
   uint64_t getBlockSize() const { return options_.block_size; }
   // uint64 is used to promote uint64 conversion
   // of other operands in arithmetic expressions.
 
   uint64_t getNumBlocks() const {
-    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<Mutex> lock(mutex_);
     return getNumBlocksUnlocked();
   }
 
- private:
-  // ---------------------------------------------------------------------------
-  // Private non-thread-safe interface, needs external synchronization.
-  // ---------------------------------------------------------------------------
+  uint64_t getNumBlockCacheHits() const { return num_cache_hits_.load(); }
 
-  uint32_t putUnlocked(const char* block);
+  uint64_t getNumBlockCacheMisses() const { return num_cache_misses_.load(); }
 
-  void getUnlocked(uint32_t id, char* block) const;
+  uint64_t getBufferSize() const {
+    return buffer_.size + flushing_buffer_.size;
+  }
+  // Returns the capacity of the write buffers, which is zero in read-only
+  // mode.
 
-  void replaceUnlocked(uint32_t id, const char* block);
+  uint64_t getNumBytesMapped() const;
+  // Returns the number of bytes of the data file that are currently mapped.
 
-  char* getAddressOf(uint32_t id) const;
+ private:
+  static const char* CANNOT_REPLACE_COMPRESSED_BLOCK;
 
-  uint64_t getNumBlocksUnlocked() const {
-    return mapped_.getNumBlocks(options_.block_size) +
-           buffer_.getNumBlocks(options_.block_size);
-  }
+  struct Mapping {
+    std::vector<char*> segments;
+    uint64_t segment_size = 0;
+    uint32_t segment_shift = 0;
+    // Segment i maps `segment_size` bytes of the data file starting at
+    // offset `i * segment_size`, which is `1 << segment_shift` blocks.
+    // A read-only data file is mapped as a single segment.
 
-  struct Mapped {
-    void* data = nullptr;
-    uint64_t size = 0;
+    std::atomic<uint64_t> size{0};
+    // Number of bytes of the data file that are accessible via `segments`.
+    // Only grows while the mapping is published, with `mutex_` locked.
+
+    uint64_t getCapacity() const { return segment_size * segments.size(); }
+    // Number of bytes mapped, which may exceed the size of the data file.
 
     // Requires: `block_size` != 0
     uint64_t getNumBlocks(uint32_t block_size) const {
-      return size / block_size;
+      return size.load() / block_size;
+    }
+
+    char* getAddressOf(uint64_t id, uint32_t block_size) const {
+      const auto mask = (uint64_t(1) << segment_shift) - 1;
+      return segments[id >> segment_shift] + (id & mask) * block_size;
+    }
+    // Blocks never cross the boundary of a segment.
+
+    template <typename Procedure>
+    void forEachPart(uint64_t offset, uint64_t length,
+                     Procedure process) const {
+      while (length != 0) {
+        const auto begin = offset % segment_size;
+        const auto part = std::min(length, segment_size - begin);
+        process(segments[offset / segment_size] + begin, part);
+        offset += part;
+        length -= part;
+      }
     }
+    // Calls `process(data, length)` for each contiguous part of the given
+    // range of the data file.  Requires: `offset + length <= getCapacity()`
   };
 
   struct Buffer {
@@ -172,12 +586,328 @@ class Store : public mt::Resource {
     }
   };
 
-  mutable std::mutex mutex_;
-  mutable bool fill_page_cache_ = false;
+  static const size_t NUM_READER_SLOTS = 16;
+
+  struct ReaderSlot {
+    std::atomic<uint64_t> count[2];
+    // Number of readers that entered in an even or odd epoch respectively.
+
+    char padding[64 - sizeof count];
+    // Avoids false sharing between threads mapped to different slots.
+
+    ReaderSlot() {
+      count[0] = 0;
+      count[1] = 0;
+    }
+  };
+
+  class EpochGuard {
+    // Registers the calling thread as a reader of the currently published
+    // mapping.  The mapping returned by `mapping()` stays valid for the
+    // lifetime of the guard, even if the store is remapped concurrently.
+
+   public:
+    explicit EpochGuard(const Store* store);
+
+    ~EpochGuard();
+
+    const Mapping* mapping() const { return mapping_; }
+
+   private:
+    std::atomic<uint64_t>* count_;
+    const Mapping* mapping_;
+  };
+
+  // ---------------------------------------------------------------------------
+  // Private lock-free interface.
+  // ---------------------------------------------------------------------------
+
+  bool tryGetMapped(uint32_t id, char* block) const;
+  // Copies the block with `id` if it is part of the published mapping,
+  // otherwise returns `false`, in which case the block must be read from
+  // `buffer_` with `mutex_` locked.
+
+  bool tryReplaceMapped(uint32_t id, const char* block);
+  // Overwrites the block with `id` if it is part of the published mapping,
+  // otherwise returns `false`, in which case the block must be written to
+  // `buffer_` with `mutex_` locked.
+
+  void copyFromMapped(const Mapping* mapping, uint32_t id, char* block) const;
+  // Requires an active `EpochGuard` that returned `mapping`.
+
+  void copyToMapped(const Mapping* mapping, uint32_t id, const char* block);
+  // Requires an active `EpochGuard` that returned `mapping`.
+
+  // ---------------------------------------------------------------------------
+  // Private non-thread-safe interface, needs external synchronization.
+  // ---------------------------------------------------------------------------
+
+  uint32_t putUnlocked(const char* block);
+
+  uint32_t putUnlocked(const char* block, uint32_t min_id);
+
+  uint32_t putUnlocked(const char* block, uint32_t min_id,
+                       uint32_t extent_size);
+
+  uint32_t appendRunUnlocked(const std::vector<const char*>& blocks);
+  // Writes `blocks` to the end of the data file with a single `writev()`
+  // per `IOV_MAX` blocks, bypassing `buffer_`, whose blocks are flushed
+  // before, and returns the id of the first one.  This saves copying the
+  // blocks of a large value into the buffer and remapping the data file
+  // more than once while the value is written.
+
+  static const uint32_t NO_ID = -1;
+
+  uint32_t tryPutReusedUnlocked(const char* block, uint32_t min_id);
+  // Writes `block` into the reusable block with the smallest id not less
+  // than `min_id` and returns its id, or `NO_ID` if there is none.
+
+  uint32_t tryPutIntoExtentUnlocked(const char* block, uint32_t min_id);
+  // Writes `block` into the extent whose next unused id is `min_id` and
+  // returns that id, or `NO_ID` if there is no such extent.
+
+  static const uint32_t NO_RUN = -1;
+
+  uint32_t findReusableRunUnlocked(uint32_t min_id, uint32_t count) const;
+  // Returns the first id of `count` consecutive reusable blocks with ids not
+  // less than `min_id` or `NO_RUN` if there are none.
+
+  void getUnlocked(uint32_t id, char* block) const;
+
+  void replaceUnlocked(uint32_t id, const char* block);
+
+  char* getAddressOf(uint32_t id) const;
+
+  char* mapDataFile(uint64_t length, int prot) const;
+
+  void mapSegments(Mapping* mapping, uint64_t new_size) const;
+  // Appends segments to `mapping` until it covers `new_size` bytes.
+
+  void flushBufferUnlocked();
+
+  void writeBufferUnlocked();
+  // Writes the buffer to the data file and empties it.
+
+  void syncWrittenRange(uint64_t offset, uint64_t length) const;
+  // Applies `Options::durability` to a range just written to the data file.
+
+  void publishUnlocked(uint64_t new_size);
+  // Makes the data file up to `new_size` accessible via the mapping.
+
+  void scheduleFlushUnlocked();
+  // Hands the full buffer over to the background thread and continues with
+  // the other one once that has been written.
+
+  void waitForFlushUnlocked() const;
+  // Waits until the background thread has written the buffer it was given
+  // and rethrows an error it encountered, if any.
+
+  void runFlusher();
+
+  // ---------------------------------------------------------------------------
+  // Private interface for write lanes.
+  // ---------------------------------------------------------------------------
+
+  struct Lane {
+    std::mutex mutex;
+    uint32_t next_id = 0;
+    uint32_t end_id = 0;
+    // The ids in [next_id, end_id) are reserved, but not used yet.
+    // Guarded by `mutex`.
+  };
+
+  bool hasWriteLanes() const { return !lanes_.empty(); }
+
+  uint32_t appendToLane(const char* block, uint32_t min_id,
+                        uint32_t extent_size);
+  // Writes `block` into the next unused id of the calling thread's lane and
+  // returns that id.  If `extent_size` is greater than one, the following
+  // ids of the lane form an extent, see `put()`.  If the lane's next id is
+  // less than `min_id`, another lane is taken or a new range is reserved,
+  // so that the ids of a list keep increasing.
+
+  void reserveLaneRange(Lane* lane, uint32_t count);
+  // Makes the remaining ids of `lane` reusable and reserves at least `count`
+  // new ones at the end of the data file, which is grown and remapped, so
+  // that they can be written via the mapping.  Requires `lane->mutex` to be
+  // locked, but not `mutex_`, which is always locked after a lane's mutex.
+
+  bool isInFlushingBufferUnlocked(uint32_t id) const {
+    const auto num_blocks_mapped =
+        mapped_.load()->getNumBlocks(options_.block_size);
+    return id >= num_blocks_mapped &&
+           id < num_blocks_mapped +
+                    flushing_buffer_.getNumBlocks(options_.block_size);
+  }
+
+  // ---------------------------------------------------------------------------
+  // Private interface for checksums.
+  // ---------------------------------------------------------------------------
+
+  void openChecksums(const boost::filesystem::path& file);
+
+  void writeChecksums() const;
+
+  void updateChecksumUnlocked(uint32_t id, const char* block);
+  // Sets the checksum of the block with `id`, which may be the next one.
+
+  void verify(uint32_t id, const char* block) const {
+    if (verified_) verifyOnce(id, block);
+  }
+
+  void verify(const std::vector<ExtendedReadWriteBlock>& blocks) const {
+    if (!verified_) return;
+    for (const auto& block : blocks) {
+      if (!block.ignore) verifyOnce(block.id, block.data());
+    }
+  }
+
+  void verifyRange(uint32_t first_id, uint32_t count,
+                   const char* blocks) const;
+
+  void verifyOnce(uint32_t id, const char* block) const;
+  // Throws `std::runtime_error` if `block` does not match its checksum,
+  // unless it has been verified before.
+
+  void limitIo(uint64_t num_blocks) const {
+    if (options_.io_limiter) {
+      options_.io_limiter->acquire(num_blocks * getBlockSize());
+    }
+  }
+  // Waits if the calling thread is a background thread that exceeds the
+  // rate of `Options::io_limiter`.  Must not be called with `mutex_` held.
+
+  template <typename ExtendedBlock>
+  static uint64_t countBlocks(const std::vector<ExtendedBlock>& blocks) {
+    return std::count_if(
+        blocks.begin(), blocks.end(),
+        [](const ExtendedBlock& block) { return !block.ignore; });
+  }
+  // Returns the number of blocks that are not marked as ignored.
+
+  void addBytesRead(uint64_t num_blocks) const {
+    if (options_.metrics) {
+      options_.metrics->addBytesRead(num_blocks * getBlockSize());
+    }
+  }
+
+  void remapUnlocked(uint64_t new_size);
+  // Publishes a copy of the mapping with additional segments that cover
+  // `new_size` bytes.  The segments are shared with the old mapping, which
+  // is released once no reader uses it anymore.
+
+  void prefetchMapped(const Mapping* mapping, uint32_t first_id,
+                      uint32_t count) const;
+
+  void adviseUnlocked(const Mapping* mapping, AccessPattern pattern,
+                      uint64_t offset) const;
+  // Applies `pattern` to the part of `mapping` that starts at `offset`.
+
+  uint64_t getNumBlocksUnlocked() const {
+    if (isCompressed()) return compressed_.getNumBlocks();
+    return mapped_.load()->getNumBlocks(options_.block_size) +
+           flushing_buffer_.getNumBlocks(options_.block_size) +
+           buffer_.getNumBlocks(options_.block_size);
+  }
+
+  // ---------------------------------------------------------------------------
+  // Private interface for compressed stores.
+  // ---------------------------------------------------------------------------
+
+  struct CompressedBlocks {
+    std::vector<uint64_t> offsets;
+    // Offsets of all blocks written so far, followed by the end offset.
+
+    const uint64_t* mapped_offsets = nullptr;
+    uint64_t num_mapped_blocks = 0;
+    // Points to the offset table of a mapped data file in read-only mode.
+
+    std::unique_ptr<char[]> buffer;
+    uint64_t buffer_size = 0;
+    // Holds the result of compressing a single block.
+
+    uint64_t getNumBlocks() const {
+      if (mapped_offsets) return num_mapped_blocks;
+      return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+  };
+
+  void openCompressed(uint64_t length);
+
+  void getCompressed(uint32_t id, char* block) const;
+
+  uint32_t putCompressedUnlocked(const char* block);
+
+  void writeOffsetTableUnlocked();
+
+  // ---------------------------------------------------------------------------
+  // Private interface for the block cache.
+  // ---------------------------------------------------------------------------
+
+  bool tryGetCached(uint32_t id, char* block) const;
+  // Returns `false` on a miss or if there is no cache.
+
+  void putCached(uint32_t id, const char* block) const;
+
+  // ---------------------------------------------------------------------------
+  // Private interface for direct stores.
+  // ---------------------------------------------------------------------------
+
+  void openDirect(const boost::filesystem::path& file);
+
+  void getDirect(uint32_t id, char* block) const;
+
+  void getDirect(std::vector<ExtendedReadWriteBlock>& blocks) const;
+
+  void readDirect(uint32_t id, uint32_t num_blocks, char* target) const;
+  // Reads `num_blocks` consecutive blocks starting at `id` into `target`.
+
+  typedef ProfiledMutexIfEnabled<std::mutex, LockProfiler::LockClass::STORE>
+      Mutex;
+
+  mutable Mutex mutex_;
+  std::set<uint32_t> reusable_ids_;
+  std::unordered_map<uint32_t, uint32_t> extents_;
+  // Maps the next unused id of each extent to its end.
+  // Guarded by `mutex_`.
+
+  mutable std::atomic<AccessPattern> access_pattern_{AccessPattern::NORMAL};
+  mutable ReaderSlot reader_slots_[NUM_READER_SLOTS];
+  std::atomic<uint64_t> epoch_{0};
+  std::atomic<Mapping*> mapped_{&empty_mapping_};
+  Mapping empty_mapping_;
   mt::AutoCloseFd fd_;
   Options options_;
-  Mapped mapped_;
   Buffer buffer_;
+  CompressedBlocks compressed_;
+  std::shared_ptr<BlockCache> cache_;
+  mutable std::atomic<uint64_t> num_cache_hits_{0};
+  mutable std::atomic<uint64_t> num_cache_misses_{0};
+  bool direct_ = false;
+
+  std::vector<uint32_t> checksums_;
+  // Guarded by `mutex_` in writable mode.
+
+  std::unique_ptr<std::atomic<uint64_t>[]> verified_;
+  // One bit per block of a read-only store that is set once the block has
+  // matched its checksum.  Null if blocks are not verified.
+
+  std::string checksums_file_;
+  bool has_checksums_ = false;
+
+  Buffer flushing_buffer_;
+  // Holds the blocks that the background thread is writing, which follow
+  // the mapped ones and precede those in `buffer_`.  Empty unless a flush
+  // is in progress.
+  std::vector<uint32_t> replaced_while_flushing_;
+  mutable std::condition_variable_any flush_cond_;
+  bool stop_flusher_ = false;
+  std::exception_ptr flush_error_;
+  std::thread flusher_;
+  // Guarded by `mutex_`.  Not joinable unless `Options::background_flush`.
+
+  std::vector<Lane> lanes_;
+  // Empty unless the store has write lanes, see `Options::num_write_lanes`.
 };
 
 }  // namespace internal
@@ -15,13 +15,24 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <numeric>
+#include <random>
+#include <thread>
 #include <type_traits>
+#include <boost/filesystem/operations.hpp>
 #include "gmock/gmock.h"
+#include "multimap/internal/Benchmark.hpp"
 #include "multimap/internal/Store.hpp"
 
 namespace multimap {
 namespace internal {
 
+using testing::ElementsAre;
+using testing::Eq;
+
 TEST(StoreTest, IsDefaultConstructible) {
   ASSERT_TRUE(std::is_default_constructible<Store>::value);
 }
@@ -36,5 +47,803 @@ TEST(StoreTest, IsNotMoveConstructibleOrAssignable) {
   ASSERT_FALSE(std::is_move_assignable<Store>::value);
 }
 
+struct StoreTestFixture : public testing::Test {
+  void SetUp() override {
+    boost::filesystem::remove_all(directory);
+    boost::filesystem::create_directory(directory);
+  }
+
+  void TearDown() override { boost::filesystem::remove_all(directory); }
+
+  std::vector<char> makeBlockData(uint32_t id) const {
+    return std::vector<char>(block_size, static_cast<char>('a' + id % 26));
+  }
+
+  const boost::filesystem::path directory = "/tmp/multimap.StoreTestFixture";
+  const boost::filesystem::path file = directory / "store";
+  const uint32_t block_size = 128;
+};
+
+TEST_F(StoreTestFixture, PutThenGetReturnsSameBlocksAfterReopen) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 4;
+  const uint32_t num_blocks = 100;
+  {
+    Store store(file, options);
+    for (uint32_t i = 0; i != num_blocks; ++i) {
+      auto data = makeBlockData(i);
+      ASSERT_THAT(store.put(ReadWriteBlock(data.data(), data.size())), Eq(i));
+    }
+  }
+  options.readonly = true;
+  Store store(file, options);
+  ASSERT_THAT(store.getNumBlocks(), Eq(num_blocks));
+  std::vector<char> data(block_size);
+  ReadWriteBlock block(data.data(), data.size());
+  for (uint32_t i = 0; i != num_blocks; ++i) {
+    store.get(i, block);
+    ASSERT_THAT(data, Eq(makeBlockData(i)));
+  }
+}
+
+TEST_F(StoreTestFixture, PutIntoExtentsYieldsConsecutiveIds) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 4;
+  Store store(file, options);
+  const auto a = makeBlockData(0);
+  const auto b = makeBlockData(1);
+  const ReadOnlyBlock block_a(a.data(), a.size());
+  const ReadOnlyBlock block_b(b.data(), b.size());
+
+  // Two writers take turns, each continuing after its last block.
+  const auto a0 = store.put(block_a, 0, 4);
+  const auto b0 = store.put(block_b, 0, 4);
+  ASSERT_THAT(a0, Eq(0));
+  ASSERT_THAT(b0, Eq(4));
+  ASSERT_THAT(store.getNumBlocks(), Eq(8));
+  for (uint32_t i = 1; i != 4; ++i) {
+    ASSERT_THAT(store.put(block_a, a0 + i, 4), Eq(a0 + i));
+    ASSERT_THAT(store.put(block_b, b0 + i, 4), Eq(b0 + i));
+  }
+  ASSERT_THAT(store.getNumBlocks(), Eq(8));
+
+  // A full extent is followed by a new one, an extent size of one does not
+  // reserve anything.
+  ASSERT_THAT(store.put(block_a, a0 + 4, 2), Eq(8));
+  ASSERT_THAT(store.put(block_b, b0 + 4, 1), Eq(10));
+  ASSERT_THAT(store.getNumBlocks(), Eq(11));
+
+  std::vector<char> data(block_size);
+  ReadWriteBlock block(data.data(), data.size());
+  for (uint32_t i = 0; i != 4; ++i) {
+    store.get(a0 + i, block);
+    ASSERT_THAT(data, Eq(a));
+    store.get(b0 + i, block);
+    ASSERT_THAT(data, Eq(b));
+  }
+
+  // The unused block of the last extent becomes reusable.
+  ASSERT_TRUE(store.getReusableBlocks().empty());
+  store.releaseExtents();
+  ASSERT_THAT(store.getReusableBlocks(), testing::ElementsAre(9));
+  ASSERT_THAT(store.put(block_b, 9, 1), Eq(9));
+  ASSERT_THAT(store.getNumBlocks(), Eq(11));
+}
+
+TEST_F(StoreTestFixture, PutRunReusesOnlyConsecutiveBlocks) {
+  Store::Options options;
+  options.block_size = block_size;
+  Store store(file, options);
+  const auto data = makeBlockData(0);
+  for (uint32_t i = 0; i != 10; ++i) {
+    store.put(ReadOnlyBlock(data.data(), data.size()));
+  }
+  store.reuse({1, 3, 4, 6, 7, 8});
+  const auto putRun = [&](size_t count, uint32_t min_id) {
+    std::vector<ExtendedReadOnlyBlock> blocks(
+        count, ExtendedReadOnlyBlock(data.data(), data.size()));
+    store.putRun(blocks, min_id);
+    std::vector<uint32_t> ids;
+    for (const auto& block : blocks) {
+      ids.push_back(block.id);
+    }
+    return ids;
+  };
+  ASSERT_THAT(putRun(3, 0), testing::ElementsAre(6, 7, 8));
+  ASSERT_THAT(putRun(2, 4), testing::ElementsAre(10, 11));
+  ASSERT_THAT(putRun(2, 0), testing::ElementsAre(3, 4));
+  ASSERT_THAT(store.getReusableBlocks(), testing::ElementsAre(1));
+}
+
+TEST_F(StoreTestFixture, PutRunWritesLargeRunsDirectlyToDataFile) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 4;
+  options.checksums = true;
+  for (const bool background_flush : {false, true}) {
+    options.background_flush = background_flush;
+    {
+      Store store(file, options);
+      const auto first = makeBlockData(0);
+      store.put(ReadOnlyBlock(first.data(), first.size()));
+      std::vector<std::vector<char> > data;
+      std::vector<ExtendedReadOnlyBlock> blocks;
+      for (uint32_t i = 1; i != 11; ++i) {
+        data.push_back(makeBlockData(i));
+      }
+      for (const auto& block : data) {
+        blocks.emplace_back(block.data(), block.size());
+      }
+      store.putRun(blocks, 0);
+      for (uint32_t i = 0; i != blocks.size(); ++i) {
+        ASSERT_THAT(blocks[i].id, Eq(i + 1));
+      }
+      // The buffered block and the run have been written.
+      ASSERT_THAT(boost::filesystem::file_size(file), Eq(block_size * 11));
+
+      const auto last = makeBlockData(11);
+      ASSERT_THAT(store.put(ReadOnlyBlock(last.data(), last.size())), Eq(11));
+      std::vector<char> range(block_size * 12);
+      store.getRange(0, 12, range.data());
+      for (uint32_t i = 0; i != 12; ++i) {
+        ASSERT_TRUE(std::equal(range.begin() + block_size * i,
+                               range.begin() + block_size * (i + 1),
+                               makeBlockData(i).begin()));
+      }
+    }
+    Store::Options readonly_options = options;
+    readonly_options.readonly = true;
+    const Store store(file, readonly_options);
+    ASSERT_THAT(store.getNumBlocks(), Eq(12));
+    ASSERT_TRUE(store.getCorruptBlocks().empty());
+    boost::filesystem::remove(file);
+    boost::filesystem::remove(file.string() + ".crc");
+  }
+}
+
+TEST_F(StoreTestFixture, WriteLanesLetThreadsAppendConcurrently) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 16;
+  options.num_write_lanes = 4;
+  const uint32_t num_threads = 8;
+  const uint32_t num_blocks_per_thread = 500;
+  const auto makeData = [this](uint32_t value) {
+    std::vector<char> data(block_size);
+    std::memcpy(data.data(), &value, sizeof value);
+    return data;
+  };
+  std::vector<std::vector<uint32_t> > ids(num_threads);
+  {
+    Store store(file, options);
+    const auto data = makeBlockData(0);
+    store.put(ReadOnlyBlock(data.data(), data.size()));
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t != num_threads; ++t) {
+      threads.emplace_back([&, t] {
+        // Each thread appends to its own list, whose ids must increase.
+        uint32_t next_id = 0;
+        for (uint32_t i = 0; i != num_blocks_per_thread; ++i) {
+          const auto data = makeData(t * num_blocks_per_thread + i);
+          const ReadOnlyBlock block(data.data(), data.size());
+          if (i % 2 == 0) {
+            next_id = store.put(block, next_id);
+          } else {
+            next_id = store.put(block, next_id, 3);
+          }
+          ids[t].push_back(next_id++);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    std::vector<uint32_t> all_ids;
+    for (const auto& thread_ids : ids) {
+      ASSERT_TRUE(std::is_sorted(thread_ids.begin(), thread_ids.end()));
+      all_ids.insert(all_ids.end(), thread_ids.begin(), thread_ids.end());
+    }
+    std::sort(all_ids.begin(), all_ids.end());
+    ASSERT_TRUE(std::adjacent_find(all_ids.begin(), all_ids.end()) ==
+                all_ids.end());
+
+    // Unused ids of lanes and extents become reusable.
+    const auto num_blocks = store.getNumBlocks();
+    store.releaseExtents();
+    const auto reusable_ids = store.getReusableBlocks();
+    ASSERT_THAT(reusable_ids.size() + all_ids.size() + 1, Eq(num_blocks));
+    ASSERT_THAT(store.put(ReadOnlyBlock(data.data(), data.size()), 0),
+                Eq(reusable_ids.front()));
+  }
+  options.readonly = true;
+  const Store store(file, options);
+  std::vector<char> data(block_size);
+  ReadWriteBlock block(data.data(), data.size());
+  for (uint32_t t = 0; t != num_threads; ++t) {
+    for (uint32_t i = 0; i != num_blocks_per_thread; ++i) {
+      store.get(ids[t][i], block);
+      ASSERT_THAT(data, Eq(makeData(t * num_blocks_per_thread + i)));
+    }
+  }
+}
+
+TEST_F(StoreTestFixture, GetRangeReturnsSameBlocksInAllModes) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 4;
+  const uint32_t num_blocks = 100;
+  const auto checkRanges = [&](const Store& store) {
+    std::vector<char> data(block_size * 30);
+    for (uint32_t first_id = 0; first_id < num_blocks; first_id += 30) {
+      const auto count = std::min(30u, num_blocks - first_id);
+      store.getRange(first_id, count, data.data());
+      for (uint32_t i = 0; i != count; ++i) {
+        ASSERT_TRUE(std::equal(data.begin() + block_size * i,
+                               data.begin() + block_size * (i + 1),
+                               makeBlockData(first_id + i).begin()));
+      }
+    }
+  };
+  {
+    Store store(file, options);
+    for (uint32_t i = 0; i != num_blocks; ++i) {
+      auto data = makeBlockData(i);
+      store.put(ReadWriteBlock(data.data(), data.size()));
+    }
+    // The last range spans mapped blocks and blocks in the write buffer.
+    checkRanges(store);
+  }
+  options.readonly = true;
+  checkRanges(Store(file, options));
+
+  options.direct_io = true;
+  options.block_cache = std::make_shared<BlockCache>(block_size * 1000,
+                                                     block_size);
+  Store store(file, options);
+  std::vector<char> data(block_size);
+  ReadWriteBlock block(data.data(), data.size());
+  store.get(33, block);  // Splits the range [30, 60) into two reads.
+  checkRanges(store);
+  ASSERT_THAT(store.getNumBlockCacheHits(), Eq(1));
+}
+
+TEST_F(StoreTestFixture, ConcurrentGetsDuringRemapsReturnConsistentBlocks) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 2;  // Causes a remap every two puts.
+  Store store(file, options);
+
+  std::atomic<uint32_t> num_blocks_put(0);
+  std::atomic<bool> failed(false);
+  const uint32_t num_blocks = 5000;
+
+  std::thread writer([&] {
+    for (uint32_t i = 0; i != num_blocks; ++i) {
+      auto data = makeBlockData(i);
+      store.put(ReadWriteBlock(data.data(), data.size()));
+      num_blocks_put = i + 1;
+    }
+  });
+
+  std::vector<std::thread> readers;
+  for (size_t r = 0; r != 4; ++r) {
+    readers.emplace_back([&, r] {
+      std::vector<char> data(block_size);
+      ReadWriteBlock block(data.data(), data.size());
+      uint32_t num_available = 0;
+      while (num_available != num_blocks) {
+        num_available = num_blocks_put;
+        for (uint32_t id = r; id < num_available; id += 97) {
+          store.get(id, block);
+          if (data != makeBlockData(id)) failed = true;
+        }
+      }
+    });
+  }
+
+  writer.join();
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  ASSERT_FALSE(failed);
+  ASSERT_THAT(store.getNumBlocks(), Eq(num_blocks));
+}
+
+TEST_F(StoreTestFixture, BlocksAreAccessibleAcrossSegmentBoundaries) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 8;
+  options.segment_size = 1;  // Rounded up to the page size.
+  const uint32_t num_blocks = 1000;
+  const auto checkBlocks = [&](const Store& store) {
+    std::vector<char> data(block_size * 100);
+    for (uint32_t first_id = 0; first_id < num_blocks; first_id += 100) {
+      store.getRange(first_id, 100, data.data());
+      for (uint32_t i = 0; i != 100; ++i) {
+        ASSERT_TRUE(std::equal(data.begin() + block_size * i,
+                               data.begin() + block_size * (i + 1),
+                               makeBlockData(first_id + i + 1).begin()));
+      }
+    }
+  };
+  {
+    Store store(file, options);
+    for (uint32_t i = 0; i != num_blocks; ++i) {
+      auto data = makeBlockData(i);
+      store.put(ReadWriteBlock(data.data(), data.size()));
+    }
+    store.flush();
+    ASSERT_THAT(store.getNumBytesMapped(), Eq(block_size * num_blocks));
+    for (uint32_t i = 0; i != num_blocks; ++i) {
+      auto data = makeBlockData(i + 1);
+      store.replace(i, ReadWriteBlock(data.data(), data.size()));
+    }
+    store.adviseAccessPattern(Store::AccessPattern::RANDOM);
+    store.prefetch({30, 31, 32, 33});
+    checkBlocks(store);
+  }
+  {
+    Store store(file, options);
+    auto data = makeBlockData(num_blocks + 1);
+    store.put(ReadWriteBlock(data.data(), data.size()));
+    checkBlocks(store);
+  }
+  options.readonly = true;
+  checkBlocks(Store(file, options));
+}
+
+TEST_F(StoreTestFixture, BackgroundFlushKeepsBlocksReadableAndReplaceable) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 4;
+  options.background_flush = true;
+  const uint32_t num_blocks = 2000;
+  {
+    Store store(file, options);
+    ASSERT_THAT(store.getBufferSize(), Eq(2 * options.buffer_size));
+    std::vector<char> data(block_size);
+    ReadWriteBlock block(data.data(), data.size());
+    for (uint32_t i = 0; i != num_blocks; ++i) {
+      auto put_data = makeBlockData(i);
+      ASSERT_THAT(store.put(ReadWriteBlock(put_data.data(), put_data.size())),
+                  Eq(i));
+      if (i < 6) continue;
+      // Replaces blocks that are likely being written in the background.
+      const uint32_t id = i - 6;
+      store.get(id, block);
+      ASSERT_THAT(data, Eq(makeBlockData(id)));
+      auto new_data = makeBlockData(id + 1);
+      store.replace(id, ReadWriteBlock(new_data.data(), new_data.size()));
+    }
+    store.flush();
+    ASSERT_THAT(store.getNumBlocks(), Eq(num_blocks));
+  }
+  options.readonly = true;
+  Store store(file, options);
+  ASSERT_THAT(store.getNumBlocks(), Eq(num_blocks));
+  ASSERT_THAT(store.getBufferSize(), Eq(0));
+  std::vector<char> data(block_size);
+  ReadWriteBlock block(data.data(), data.size());
+  for (uint32_t id = 0; id != num_blocks; ++id) {
+    store.get(id, block);
+    const auto expected = id < num_blocks - 6 ? id + 1 : id;
+    ASSERT_THAT(data, Eq(makeBlockData(expected))) << id;
+  }
+}
+
+TEST_F(StoreTestFixture, CopyToIncludesBufferedBlocks) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 4;
+  const auto copy = directory / "copy";
+  const uint32_t num_blocks = 10;
+  {
+    Store store(file, options);
+    for (uint32_t i = 0; i != num_blocks; ++i) {
+      auto data = makeBlockData(i);
+      store.put(ReadWriteBlock(data.data(), data.size()));
+    }
+    store.copyTo(copy);
+    auto data = makeBlockData(num_blocks);
+    store.put(ReadWriteBlock(data.data(), data.size()));
+    store.replace(0, ReadWriteBlock(data.data(), data.size()));
+  }
+  options.readonly = true;
+  Store store(copy, options);
+  ASSERT_THAT(store.getNumBlocks(), Eq(num_blocks));
+  std::vector<char> data(block_size);
+  ReadWriteBlock block(data.data(), data.size());
+  for (uint32_t i = 0; i != num_blocks; ++i) {
+    store.get(i, block);
+    ASSERT_THAT(data, Eq(makeBlockData(i)));
+  }
+}
+
+TEST_F(StoreTestFixture, DataFileHasExactSizeDespiteReservedMapping) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 4;
+  const uint32_t num_blocks = 1000;
+  for (uint32_t round = 0; round != 2; ++round) {
+    // The second round appends to an existing data file.
+    Store store(file, options);
+    for (uint32_t i = 0; i != num_blocks; ++i) {
+      const auto id = round * num_blocks + i;
+      auto data = makeBlockData(id);
+      ASSERT_THAT(store.put(ReadWriteBlock(data.data(), data.size())), Eq(id));
+    }
+    store.flush();
+    const uint64_t expected_size = (round + 1) * num_blocks * block_size;
+    ASSERT_THAT(boost::filesystem::file_size(file), Eq(expected_size));
+    std::vector<char> data(block_size);
+    ReadWriteBlock block(data.data(), data.size());
+    for (uint32_t id = 0; id != (round + 1) * num_blocks; ++id) {
+      store.get(id, block);
+      ASSERT_THAT(data, Eq(makeBlockData(id)));
+    }
+  }
+  ASSERT_THAT(boost::filesystem::file_size(file),
+              Eq(2ULL * num_blocks * block_size));
+}
+
+TEST_F(StoreTestFixture, AdvisedAccessPatternsDoNotChangeBlocks) {
+  const Store::AccessPattern patterns[] = {
+      Store::AccessPattern::SEQUENTIAL, Store::AccessPattern::RANDOM,
+      Store::AccessPattern::WILLNEED, Store::AccessPattern::NORMAL};
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 2;
+  const uint32_t num_blocks = 100;
+  {
+    Store store(file, options);
+    for (uint32_t i = 0; i != num_blocks; ++i) {
+      // The advice must be reapplied to each new mapping.
+      store.adviseAccessPattern(patterns[i % 4]);
+      auto data = makeBlockData(i);
+      ASSERT_THAT(store.put(ReadWriteBlock(data.data(), data.size())), Eq(i));
+    }
+  }
+  options.readonly = true;
+  Store store(file, options);
+  std::vector<char> data(block_size);
+  ReadWriteBlock block(data.data(), data.size());
+  for (const auto pattern : patterns) {
+    store.adviseAccessPattern(pattern);
+    for (uint32_t i = 0; i != num_blocks; ++i) {
+      store.get(i, block);
+      ASSERT_THAT(data, Eq(makeBlockData(i)));
+    }
+  }
+}
+
+TEST_F(StoreTestFixture, PopulatedAndLockedMappingReturnsSameBlocks) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 4;
+  options.populate = true;
+  options.huge_pages = true;
+  options.lock_in_memory = true;
+  const uint32_t num_blocks = 100;
+  {
+    Store store(file, options);
+    for (uint32_t i = 0; i != num_blocks; ++i) {
+      auto data = makeBlockData(i);
+      ASSERT_THAT(store.put(ReadWriteBlock(data.data(), data.size())), Eq(i));
+    }
+  }
+  options.readonly = true;
+  Store store(file, options);
+  std::vector<char> data(block_size);
+  ReadWriteBlock block(data.data(), data.size());
+  for (uint32_t i = 0; i != num_blocks; ++i) {
+    store.get(i, block);
+    ASSERT_THAT(data, Eq(makeBlockData(i)));
+  }
+}
+
+TEST_F(StoreTestFixture, DirectIoReturnsSameBlocksAsMappedStore) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 4;
+  const uint32_t num_blocks = 1000;
+  {
+    Store store(file, options);
+    for (uint32_t i = 0; i != num_blocks; ++i) {
+      auto data = makeBlockData(i);
+      ASSERT_THAT(store.put(ReadWriteBlock(data.data(), data.size())), Eq(i));
+    }
+  }
+  options.readonly = true;
+  options.direct_io = true;
+  options.block_cache = std::make_shared<BlockCache>(block_size * 100,
+                                                     block_size);
+  Store store(file, options);
+  ASSERT_TRUE(store.isDirect());
+  ASSERT_FALSE(store.hasStableBlocks());
+  ASSERT_THAT(store.getNumBlocks(), Eq(num_blocks));
+  std::vector<char> data(block_size);
+  ReadWriteBlock block(data.data(), data.size());
+  for (uint32_t i = 0; i < num_blocks; i += 7) {
+    store.get(i, block);
+    ASSERT_THAT(data, Eq(makeBlockData(i)));
+  }
+  ASSERT_THAT(store.getNumBlockCacheHits(), Eq(0));
+  ASSERT_THAT(store.getNumBlockCacheMisses(), Eq(143));
+  store.get(994, block);
+  ASSERT_THAT(data, Eq(makeBlockData(994)));
+  ASSERT_THAT(store.getNumBlockCacheHits(), Eq(1));
+  // Batches mix cached and uncached blocks with consecutive ids.
+  std::vector<std::vector<char> > batch_data(50, std::vector<char>(block_size));
+  std::vector<ExtendedReadWriteBlock> batch;
+  for (uint32_t i = 0; i != batch_data.size(); ++i) {
+    batch.emplace_back(batch_data[i].data(), block_size, i * 3 % 50 + 900);
+  }
+  batch[10].ignore = true;
+  store.get(batch);
+  for (uint32_t i = 0; i != batch.size(); ++i) {
+    if (i != 10) {
+      ASSERT_THAT(batch_data[i], Eq(makeBlockData(batch[i].id)));
+    }
+  }
+}
+
+TEST_F(StoreTestFixture, StoresSharingBlockCacheDoNotSeeEachOthersBlocks) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 4;
+  const auto other_file = directory / "other_store";
+  {
+    Store store(file, options);
+    Store other_store(other_file, options);
+    for (uint32_t i = 0; i != 10; ++i) {
+      auto data = makeBlockData(i);
+      auto other_data = makeBlockData(i + 1);
+      store.put(ReadWriteBlock(data.data(), data.size()));
+      other_store.put(ReadWriteBlock(other_data.data(), other_data.size()));
+    }
+  }
+  options.readonly = true;
+  options.direct_io = true;
+  options.block_cache = std::make_shared<BlockCache>(mt::MiB(1), block_size);
+  Store store(file, options);
+  options.block_cache_id = 1;
+  Store other_store(other_file, options);
+  std::vector<char> data(block_size);
+  ReadWriteBlock block(data.data(), data.size());
+  for (uint32_t round = 0; round != 2; ++round) {
+    for (uint32_t i = 0; i != 10; ++i) {
+      store.get(i, block);
+      ASSERT_THAT(data, Eq(makeBlockData(i)));
+      other_store.get(i, block);
+      ASSERT_THAT(data, Eq(makeBlockData(i + 1)));
+    }
+  }
+  ASSERT_THAT(store.getNumBlockCacheHits(), Eq(10));
+  ASSERT_THAT(other_store.getNumBlockCacheHits(), Eq(10));
+}
+
+TEST_F(StoreTestFixture, PrefetchReadsExistingBlocksIntoCacheOrMapping) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 4;
+  {
+    Store store(file, options);
+    for (uint32_t i = 0; i != 10; ++i) {
+      const auto data = makeBlockData(i);
+      store.put(ReadOnlyBlock(data.data(), data.size()));
+    }
+    store.prefetch({1, 2, 9, 100});
+  }
+  options.readonly = true;
+  {
+    Store store(file, options);
+    store.prefetch({0, 1, 2, 5, 9, 10});
+    ASSERT_TRUE(store.getCachedBlockIds().empty());
+  }
+  options.direct_io = true;
+  options.block_cache = std::make_shared<BlockCache>(mt::MiB(1), block_size);
+  Store store(file, options);
+  store.prefetch({2, 3, 4, 7, 10, 100});
+  ASSERT_THAT(store.getCachedBlockIds(), ElementsAre(2, 3, 4, 7));
+  std::vector<char> data(block_size);
+  ReadWriteBlock block(data.data(), data.size());
+  store.get(3, block);
+  ASSERT_THAT(data, Eq(makeBlockData(3)));
+  ASSERT_THAT(store.getNumBlockCacheHits(), Eq(1));
+}
+
+TEST_F(StoreTestFixture, ReadAheadIgnoresBlocksThatDoNotExist) {
+  Store::Options options;
+  options.block_size = block_size;
+  for (const auto compress : {false, true}) {
+    boost::filesystem::remove(file);
+    options.readonly = false;
+    options.compress = compress;
+    {
+      Store store(file, options);
+      for (uint32_t i = 0; i != 10; ++i) {
+        const auto data = makeBlockData(i);
+        store.put(ReadOnlyBlock(data.data(), data.size()));
+      }
+    }
+    options.readonly = true;
+    Store store(file, options);
+    store.readAhead({});
+    store.readAhead({0, 1, 2, 5, 9, 10, 100});
+    std::vector<char> data(block_size);
+    ReadWriteBlock block(data.data(), data.size());
+    store.get(9, block);
+    ASSERT_THAT(data, Eq(makeBlockData(9)));
+  }
+}
+
+TEST_F(StoreTestFixture, IoLimiterChargesBackgroundThreadsOnly) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.io_limiter = std::make_shared<IoLimiter>(mt::GiB(1));
+  Store store(file, options);
+  const auto data = makeBlockData(1);
+  for (uint32_t i = 0; i != 10; ++i) {
+    store.put(ReadOnlyBlock(data.data(), data.size()));
+  }
+  std::vector<char> buffer(block_size);
+  ReadWriteBlock block(buffer.data(), buffer.size());
+  store.get(0, block);
+  const auto& limiter = *options.io_limiter;
+  ASSERT_THAT(limiter.getNumBytes(IoLimiter::Priority::LOW), Eq(0));
+
+  std::thread thread([&] {
+    const IoLimiter::Scope scope(IoLimiter::Priority::LOW);
+    store.put(ReadOnlyBlock(data.data(), data.size()));
+    store.get(0, block);
+    store.replace(1, ReadOnlyBlock(data.data(), data.size()));
+  });
+  thread.join();
+  ASSERT_THAT(limiter.getNumBytes(IoLimiter::Priority::LOW),
+              Eq(3 * block_size));
+  ASSERT_THAT(limiter.getNumBytes(IoLimiter::Priority::HIGH), Eq(0));
+}
+
+TEST_F(StoreTestFixture, ChecksumsDetectCorruptBlocksOnRead) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 4;
+  options.checksums = true;
+  const uint32_t num_blocks = 20;
+  {
+    Store store(file, options);
+    for (uint32_t i = 0; i != num_blocks; ++i) {
+      const auto data = makeBlockData(i);
+      store.put(ReadOnlyBlock(data.data(), data.size()));
+    }
+    // Replaces a mapped and a buffered block.
+    const auto data = makeBlockData(100);
+    store.replace(2, ReadOnlyBlock(data.data(), data.size()));
+    store.replace(num_blocks - 1, ReadOnlyBlock(data.data(), data.size()));
+  }
+  {
+    const auto fd = mt::open(file, O_WRONLY);
+    const char byte = '!';
+    mt::pwrite(fd.get(), &byte, sizeof byte, block_size * 5 + 7);
+  }
+
+  options.readonly = true;
+  for (const bool direct_io : {false, true}) {
+    options.direct_io = direct_io;
+    Store store(file, options);
+    ASSERT_TRUE(store.hasChecksums());
+    ASSERT_THAT(store.getCorruptBlocks(), testing::ElementsAre(5));
+
+    std::vector<char> data(block_size);
+    ReadWriteBlock block(data.data(), data.size());
+    store.get(2, block);
+    ASSERT_THAT(data, Eq(makeBlockData(100)));
+    store.get(num_blocks - 1, block);
+    ASSERT_THAT(data, Eq(makeBlockData(100)));
+    ASSERT_THROW(store.get(5, block), std::runtime_error);
+
+    std::vector<char> range(block_size * 4);
+    store.getRange(6, 4, range.data());
+    ASSERT_THROW(store.getRange(3, 4, range.data()), std::runtime_error);
+  }
+}
+
+TEST_F(StoreTestFixture, ChecksumsAreDroppedByStoreWithoutChecksums) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.checksums = true;
+  const auto checksums_file = file.string() + ".crc";
+  const auto data = makeBlockData(0);
+  {
+    Store store(file, options);
+    store.put(ReadOnlyBlock(data.data(), data.size()));
+  }
+  ASSERT_TRUE(boost::filesystem::is_regular_file(checksums_file));
+  {
+    Store::Options other_options = options;
+    other_options.checksums = false;
+    Store store(file, other_options);
+    ASSERT_FALSE(boost::filesystem::exists(checksums_file));
+    store.put(ReadOnlyBlock(data.data(), data.size()));
+  }
+  Store::Options readonly_options = options;
+  readonly_options.readonly = true;
+  ASSERT_FALSE(Store(file, readonly_options).hasChecksums());
+
+  // A writable store computes missing checksums from the data file.
+  { Store store(file, options); }
+  const Store store(file, readonly_options);
+  ASSERT_TRUE(store.hasChecksums());
+  ASSERT_THAT(store.getNumBlocks(), Eq(2));
+  ASSERT_TRUE(store.getCorruptBlocks().empty());
+}
+
+TEST_F(StoreTestFixture, CompressedPutThenGetReturnsSameBlocksAfterReopen) {
+  Store::Options options;
+  options.block_size = block_size;
+  options.buffer_size = block_size * 4;
+  options.compress = true;
+  const uint32_t num_blocks = 100;
+  std::mt19937 random;
+  std::vector<std::vector<char> > blocks;
+  for (uint32_t i = 0; i != num_blocks; ++i) {
+    blocks.push_back(makeBlockData(i));
+    if (i % 10 == 0) {
+      // Random data is not compressible and is stored verbatim.
+      for (auto& byte : blocks.back()) {
+        byte = static_cast<char>(random());
+      }
+    }
+  }
+  {
+    Store store(file, options);
+    for (uint32_t i = 0; i != num_blocks; ++i) {
+      auto& data = blocks[i];
+      ASSERT_THAT(store.put(ReadWriteBlock(data.data(), data.size())), Eq(i));
+    }
+    ASSERT_THAT(store.getNumBlocks(), Eq(num_blocks));
+  }
+  ASSERT_LT(boost::filesystem::file_size(file), num_blocks * block_size / 2);
+  ASSERT_THROW(Store(file, options), std::runtime_error);
+
+  options.readonly = true;
+  Store store(file, options);
+  ASSERT_FALSE(store.hasStableBlocks());
+  ASSERT_THAT(store.getNumBlocks(), Eq(num_blocks));
+  std::vector<char> data(block_size);
+  ReadWriteBlock block(data.data(), data.size());
+  for (uint32_t i = 0; i != num_blocks; ++i) {
+    store.get(i, block);
+    ASSERT_THAT(data, Eq(blocks[i]));
+  }
+  ASSERT_THROW(store.replace(0, block), std::runtime_error);
+}
+
+TEST_F(StoreTestFixture, DISABLED_BenchmarkPutAndGet) {
+  const uint32_t num_blocks = 1000000;
+  Store::Options options;
+  options.block_size = block_size;
+  Store store(file, options);
+  auto data = makeBlockData(0);
+  Benchmark::run("Store::put", num_blocks, [&] {
+    for (uint32_t i = 0; i != num_blocks; ++i) {
+      store.put(ReadWriteBlock(data.data(), data.size()));
+    }
+  });
+  std::vector<uint32_t> ids(num_blocks);
+  std::iota(ids.begin(), ids.end(), 0);
+  std::shuffle(ids.begin(), ids.end(), std::default_random_engine());
+  ReadWriteBlock block(data.data(), data.size());
+  Benchmark::run("Store::get", num_blocks, [&] {
+    for (const auto id : ids) {
+      store.get(id, block);
+    }
+  });
+  ASSERT_THAT(data, Eq(makeBlockData(0)));
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
 }  // namespace internal
 }  // namespace multimap
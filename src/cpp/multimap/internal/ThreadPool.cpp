@@ -0,0 +1,64 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/ThreadPool.hpp"
+
+namespace multimap {
+namespace internal {
+
+ThreadPool::ThreadPool(size_t num_threads) {
+  if (num_threads == 0) {
+    num_threads = getDefaultNumThreads();
+  }
+  threads_.reserve(num_threads);
+  for (size_t i = 0; i != num_threads; ++i) {
+    threads_.emplace_back(&ThreadPool::run, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+size_t ThreadPool::getDefaultNumThreads() {
+  return mt::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void ThreadPool::run() {
+  std::function<void()> task;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+      if (tasks_.empty()) break;  // stop_ is true.
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+    task();
+    // Exceptions are caught by std::packaged_task.
+  }
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,78 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_THREAD_POOL_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_THREAD_POOL_HPP_INCLUDED
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "multimap/thirdparty/mt/mt.hpp"
+
+namespace multimap {
+namespace internal {
+
+class ThreadPool : public mt::Resource {
+  // A fixed number of worker threads that execute submitted tasks in FIFO
+  // order.  Exceptions thrown by a task are propagated to the caller via the
+  // future returned by `submit()`.  Objects of this class are thread-safe.
+
+ public:
+  explicit ThreadPool(size_t num_threads);
+  // If `num_threads` is zero, `getDefaultNumThreads()` threads are started.
+
+  ~ThreadPool();
+  // Executes all pending tasks and joins all worker threads.
+
+  template <typename Task>
+  std::future<void> submit(Task task) {
+    const auto packaged_task =
+        std::make_shared<std::packaged_task<void()> >(std::move(task));
+    auto future = packaged_task->get_future();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      MT_ASSERT_FALSE(stop_);
+      tasks_.emplace_back([packaged_task] { (*packaged_task)(); });
+    }
+    cond_.notify_one();
+    return future;
+  }
+
+  size_t size() const { return threads_.size(); }
+
+  static size_t getDefaultNumThreads();
+  // Returns the number of hardware threads, but at least 1.
+
+ private:
+  void run();
+
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::deque<std::function<void()> > tasks_;
+  std::vector<std::thread> threads_;
+  bool stop_ = false;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_THREAD_POOL_HPP_INCLUDED
@@ -0,0 +1,74 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <atomic>
+#include <stdexcept>
+#include <type_traits>
+#include "gmock/gmock.h"
+#include "multimap/internal/ThreadPool.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+
+TEST(ThreadPoolTest, IsNotDefaultConstructible) {
+  ASSERT_FALSE(std::is_default_constructible<ThreadPool>::value);
+}
+
+TEST(ThreadPoolTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<ThreadPool>::value);
+  ASSERT_FALSE(std::is_copy_assignable<ThreadPool>::value);
+}
+
+TEST(ThreadPoolTest, ConstructedWithZeroThreadsUsesDefaultNumThreads) {
+  ThreadPool pool(0);
+  ASSERT_THAT(pool.size(), Eq(ThreadPool::getDefaultNumThreads()));
+}
+
+TEST(ThreadPoolTest, SubmittedTasksAreExecuted) {
+  std::atomic<int> counter(0);
+  std::vector<std::future<void> > futures;
+  ThreadPool pool(4);
+  for (int i = 0; i != 1000; ++i) {
+    futures.push_back(pool.submit([&counter] { ++counter; }));
+  }
+  for (auto& future : futures) {
+    future.get();
+  }
+  ASSERT_THAT(counter.load(), Eq(1000));
+}
+
+TEST(ThreadPoolTest, DestructorExecutesPendingTasks) {
+  std::atomic<int> counter(0);
+  {
+    ThreadPool pool(1);
+    for (int i = 0; i != 100; ++i) {
+      pool.submit([&counter] { ++counter; });
+    }
+  }
+  ASSERT_THAT(counter.load(), Eq(100));
+}
+
+TEST(ThreadPoolTest, ExceptionIsPropagatedViaFuture) {
+  ThreadPool pool(1);
+  auto future = pool.submit([] { throw std::runtime_error("error"); });
+  ASSERT_THROW(future.get(), std::runtime_error);
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,147 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/Tuning.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+double estimateCost(const std::vector<Stats>& stats, uint64_t block_size) {
+  double cost = 0;
+  for (const auto& stat : stats) {
+    if (stat.num_keys_valid == 0) continue;
+    const double bytes_per_list =
+        double(stat.num_blocks) * stat.block_size / stat.num_keys_valid;
+    const auto payload = std::max(1.0, bytes_per_list - stat.block_size / 2.0);
+    const auto num_blocks = std::ceil(payload / block_size);
+    cost += stat.num_keys_valid * num_blocks *
+            (block_size + Tuning::BLOCK_OVERHEAD);
+  }
+  return cost;
+}
+
+uint64_t getCount(const Metrics::Snapshot& metrics,
+                  Metrics::Operation operation) {
+  return metrics.get(operation).count;
+}
+
+}  // namespace
+
+const uint32_t Tuning::MIN_BLOCK_SIZE;
+const uint32_t Tuning::MAX_BLOCK_SIZE;
+const uint32_t Tuning::BLOCK_OVERHEAD;
+const uint64_t Tuning::MIN_PARTITION_SIZE;
+const uint64_t Tuning::MAX_PARTITION_SIZE;
+const double Tuning::MAX_WAIT_RATIO = 0.01;
+
+Tuning Tuning::recommend(const std::vector<Stats>& stats,
+                         const Metrics::Snapshot& metrics,
+                         uint32_t num_threads) {
+  MT_REQUIRE_FALSE(stats.empty());
+  Tuning tuning;
+  const auto total = Stats::total(stats);
+  const uint32_t current_block_size = Stats::max(stats).block_size;
+  const uint32_t current_num_partitions = stats.size();
+  const auto num_bytes = total.num_blocks * current_block_size;
+  std::ostringstream reason;
+
+  tuning.block_size = current_block_size;
+  if (total.num_keys_valid == 0) {
+    tuning.reasons.push_back("Keep the block size, since there are no lists.");
+  } else {
+    const auto current_cost = estimateCost(stats, current_block_size);
+    auto best_cost = current_cost;
+    auto best_block_size = current_block_size;
+    for (auto size = MIN_BLOCK_SIZE; size <= MAX_BLOCK_SIZE; size *= 2) {
+      const auto cost = estimateCost(stats, size);
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_block_size = size;
+      }
+    }
+    if (best_cost <= 0.9 * current_cost) {
+      tuning.block_size = best_block_size;
+      reason << "Use a block size of " << best_block_size
+             << ", which is estimated to take "
+             << int(100 - 100 * best_cost / current_cost)
+             << "% less space for lists of about "
+             << (num_bytes / total.num_keys_valid) << " bytes.";
+    } else {
+      reason << "Keep the block size, which fits lists of about "
+             << (num_bytes / total.num_keys_valid) << " bytes.";
+    }
+    tuning.reasons.push_back(reason.str());
+    reason.str("");
+  }
+
+  uint64_t num_partitions = std::max(num_threads, 1u);
+  const auto min_for_size =
+      (num_bytes + MAX_PARTITION_SIZE - 1) / MAX_PARTITION_SIZE;
+  const auto max_for_size =
+      std::max<uint64_t>(1, num_bytes / MIN_PARTITION_SIZE);
+  if (min_for_size > num_partitions) {
+    num_partitions = min_for_size;
+    reason << "Use " << num_partitions << " partitions to keep each below "
+           << (MAX_PARTITION_SIZE >> 20) << " MiB.";
+  } else if (max_for_size < num_partitions) {
+    num_partitions = max_for_size;
+    reason << "Use " << num_partitions << " partition"
+           << (num_partitions == 1 ? "" : "s") << " for "
+           << (num_bytes >> 20) << " MiB of data, which needs no more than one"
+           << " per " << (MIN_PARTITION_SIZE >> 20) << " MiB.";
+  } else {
+    reason << "Use " << num_partitions << " partition"
+           << (num_partitions == 1 ? "" : "s") << " to keep " << num_threads
+           << " thread" << (num_threads == 1 ? "" : "s") << " busy.";
+  }
+  tuning.reasons.push_back(reason.str());
+  reason.str("");
+
+  const auto num_updates = getCount(metrics, Metrics::Operation::PUT) +
+                           getCount(metrics, Metrics::Operation::WRITE) +
+                           getCount(metrics, Metrics::Operation::REMOVE) +
+                           getCount(metrics, Metrics::Operation::REPLACE);
+  const auto num_waits = getCount(metrics, Metrics::Operation::LOCK_WAIT);
+  if (num_updates == 0) {
+    tuning.reasons.push_back(
+        "Lock contention is unknown, since no metrics have been recorded.");
+  } else {
+    const auto wait_ratio = double(num_waits) / num_updates;
+    reason << int(100 * wait_ratio + 0.5) << "% of " << num_updates
+           << " updates waited for a lock";
+    if (wait_ratio > MAX_WAIT_RATIO) {
+      num_partitions =
+          std::max<uint64_t>(num_partitions, 2 * current_num_partitions);
+      reason << ", so use at least " << 2 * current_num_partitions
+             << " partitions.";
+    } else {
+      reason << '.';
+    }
+    tuning.reasons.push_back(reason.str());
+  }
+  tuning.num_partitions = mt::nextPrime(num_partitions);
+  return tuning;
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -0,0 +1,77 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_TUNING_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_TUNING_HPP_INCLUDED
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "multimap/internal/Metrics.hpp"
+#include "multimap/internal/Stats.hpp"
+
+namespace multimap {
+namespace internal {
+
+struct Tuning {
+  // A block size and number of partitions for a map, which are recommended
+  // from the stats of its partitions and the metrics it has recorded, see
+  // `recommend()`.  Both can be applied by rewriting the map, see
+  // `Map::Options::tune`.
+
+  uint32_t block_size = 0;
+  uint32_t num_partitions = 0;
+
+  std::vector<std::string> reasons;
+  // One sentence per decision, meant to be shown to the user.
+
+  static const uint32_t MIN_BLOCK_SIZE = 64;
+  static const uint32_t MAX_BLOCK_SIZE = 64 * 1024;
+
+  static const uint32_t BLOCK_OVERHEAD = 64;
+  // Bytes that each block is charged in addition to its size, which stand
+  // for its id in memory and the read it may cost.
+
+  static const uint64_t MIN_PARTITION_SIZE = mt::MiB(16);
+  static const uint64_t MAX_PARTITION_SIZE = mt::GiB(2);
+
+  static const double MAX_WAIT_RATIO;
+  // Share of updates that may wait for the lock of a partition shard before
+  // more partitions are recommended.
+
+  static Tuning recommend(const std::vector<Stats>& stats,
+                          const Metrics::Snapshot& metrics,
+                          uint32_t num_threads);
+  // Returns the block size from `MIN_BLOCK_SIZE` to `MAX_BLOCK_SIZE` that
+  // minimizes the bytes of all lists including `BLOCK_OVERHEAD`, where the
+  // payload of a list is estimated per partition as its share of blocks
+  // minus half a block, which its last block leaves empty on average.  A
+  // new block size is only recommended if it saves at least 10%, since the
+  // estimate is coarse for lists that fit into a single block.
+  //
+  // The number of partitions is at least `num_threads`, so that operations
+  // on all partitions keep each thread busy, and large enough to keep each
+  // partition below `MAX_PARTITION_SIZE`, but does not exceed one per
+  // `MIN_PARTITION_SIZE` of data.  It is doubled if more than
+  // `MAX_WAIT_RATIO` of the updates in `metrics` waited for a lock.  Like
+  // `Map::Options::num_partitions`, it is rounded up to a prime.
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_TUNING_HPP_INCLUDED
@@ -0,0 +1,98 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "gmock/gmock.h"
+#include "multimap/internal/Tuning.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+using testing::Ge;
+using testing::Gt;
+
+std::vector<Stats> makeStats(uint32_t num_partitions, uint64_t block_size,
+                             uint64_t num_keys, uint64_t num_blocks) {
+  Stats stats;
+  stats.block_size = block_size;
+  stats.num_keys_valid = num_keys;
+  stats.num_keys_total = num_keys;
+  stats.num_blocks = num_blocks;
+  return std::vector<Stats>(num_partitions, stats);
+}
+
+TEST(TuningTest, RecommendsSmallerBlocksForShortLists) {
+  // Each list occupies a single block, which is half empty on average.
+  const auto tuning =
+      Tuning::recommend(makeStats(23, 512, 1000, 1000), Metrics::Snapshot(), 4);
+  ASSERT_THAT(tuning.block_size, Eq(256));
+  ASSERT_THAT(tuning.reasons.size(), Eq(3));
+}
+
+TEST(TuningTest, RecommendsLargerBlocksForLongLists) {
+  const auto tuning = Tuning::recommend(makeStats(23, 512, 100, 100 * 2000),
+                                        Metrics::Snapshot(), 4);
+  ASSERT_THAT(tuning.block_size, Ge(4096));
+  ASSERT_THAT(tuning.block_size, testing::Le(Tuning::MAX_BLOCK_SIZE));
+}
+
+TEST(TuningTest, KeepsBlockSizeIfSavingsAreSmall) {
+  // Lists of about 1800 bytes fit into four blocks of 512 bytes and would
+  // save less than 10% with larger blocks.
+  const auto tuning = Tuning::recommend(makeStats(23, 512, 1000, 4000),
+                                        Metrics::Snapshot(), 4);
+  ASSERT_THAT(tuning.block_size, Eq(512));
+}
+
+TEST(TuningTest, KeepsBlockSizeOfEmptyMap) {
+  const auto tuning =
+      Tuning::recommend(makeStats(23, 512, 0, 0), Metrics::Snapshot(), 4);
+  ASSERT_THAT(tuning.block_size, Eq(512));
+  ASSERT_THAT(tuning.num_partitions, Eq(1));
+}
+
+TEST(TuningTest, RecommendsNumPartitionsBySizeOfData) {
+  // 1 MiB of data does not need more than a single partition.
+  auto tuning =
+      Tuning::recommend(makeStats(23, 512, 100, 100), Metrics::Snapshot(), 8);
+  ASSERT_THAT(tuning.num_partitions, Eq(1));
+
+  // 10 GiB of data are spread over all threads.
+  tuning = Tuning::recommend(makeStats(23, 512, 10000, mt::MiB(1) * 20 / 23),
+                             Metrics::Snapshot(), 8);
+  ASSERT_THAT(tuning.num_partitions, Eq(11));
+
+  // 100 GiB of data are kept in partitions below 2 GiB.
+  tuning = Tuning::recommend(makeStats(23, 512, 10000, mt::MiB(1) * 200 / 23),
+                             Metrics::Snapshot(), 8);
+  ASSERT_THAT(tuning.num_partitions, Eq(mt::nextPrime(50)));
+}
+
+TEST(TuningTest, RecommendsMorePartitionsIfUpdatesWaitForLocks) {
+  const auto stats = makeStats(23, 512, 10000, mt::MiB(1) * 20 / 23);
+  Metrics::Snapshot metrics;
+  metrics.histograms[size_t(Metrics::Operation::PUT)].count = 1000;
+  metrics.histograms[size_t(Metrics::Operation::LOCK_WAIT)].count = 5;
+  ASSERT_THAT(Tuning::recommend(stats, metrics, 8).num_partitions, Eq(11));
+
+  metrics.histograms[size_t(Metrics::Operation::LOCK_WAIT)].count = 50;
+  ASSERT_THAT(Tuning::recommend(stats, metrics, 8).num_partitions,
+              Eq(mt::nextPrime(46)));
+}
+
+}  // namespace internal
+}  // namespace multimap
@@ -17,11 +17,11 @@
 
 #include "multimap/internal/UintVector.hpp"
 
-#include "multimap/internal/Varint.hpp"
-
 namespace multimap {
 namespace internal {
 
+const uint32_t UintVector::IN_ARENA;
+
 namespace {
 
 uint32_t readUint32(const char* source, uint32_t* target) {
@@ -34,74 +34,224 @@ uint32_t writeUint32(uint32_t source, char* target) {
   return sizeof source;
 }
 
+uint32_t writeFixedSizeVarint(uint32_t source, char* target) {
+  // Same format as `Varint::writeUint()`, but always uses four bytes,
+  // so that the value can be updated in place.
+  std::uint8_t* ptr = reinterpret_cast<std::uint8_t*>(target);
+  ptr[0] = (source >> 24) | 0xC0;
+  ptr[1] = (source >> 16);
+  ptr[2] = (source >> 8);
+  ptr[3] = (source);
+  return 4;
+}
+
+// Values are stored as varint-encoded deltas, followed by a 32-bit tail that
+// holds the last value.  Since values are strictly increasing, a delta of
+// zero only occurs as the first element and is otherwise used as a marker
+// for a run of consecutive values:  it is followed by the length of the run,
+// written as a four-byte varint.  A run thus costs five bytes regardless of
+// its length.  The two high bits of the tail, which a value never uses,
+// tell how many deltas of one have been written since the last other delta,
+// up to `RUN`, which means that the vector ends with a run.  Hence, runs are
+// at least `RUN` values long.
+
+const uint32_t RUN = 3;
+const uint32_t STATE_SHIFT = 30;
+
+uint32_t getSizeClass(uint32_t nbytes) {
+  // Multiples of 8 up to 64 bytes, then four classes per power of two, so
+  // that at most a fifth of an allocation is unused.
+  if (nbytes <= 64) return (nbytes + 7) & ~7U;
+  uint32_t step = 16;
+  while (step * 4 < nbytes) step *= 2;
+  return (nbytes + step - 1) & ~(step - 1);
+}
+
 }  // namespace
 
 UintVector UintVector::readFromStream(std::FILE* stream) {
   UintVector vector;
   mt::fread(stream, &vector.offset_, sizeof vector.offset_);
-  vector.data_.reset(new char[vector.offset_]);
-  mt::fread(stream, vector.data_.get(), vector.offset_);
-  vector.size_ = vector.offset_;
+  if (vector.offset_ != 0) {
+    vector.data_ = new char[vector.offset_];
+    vector.size_ = vector.offset_;
+    mt::fread(stream, vector.data_, vector.offset_);
+  }
+  return vector;
+}
+
+UintVector UintVector::readFromBuffer(const char* buffer) {
+  UintVector vector;
+  buffer += readUint32(buffer, &vector.offset_);
+  if (vector.offset_ != 0) {
+    vector.data_ = new char[vector.offset_];
+    vector.size_ = vector.offset_;
+    std::memcpy(vector.data_, buffer, vector.offset_);
+  }
+  return vector;
+}
+
+UintVector UintVector::readFromBuffer(const char* buffer, Arena* arena) {
+  UintVector vector;
+  buffer += readUint32(buffer, &vector.offset_);
+  if (vector.offset_ != 0) {
+    vector.data_ = arena->allocate(vector.offset_);
+    vector.size_ = vector.offset_ | IN_ARENA;
+    std::memcpy(vector.data_, buffer, vector.offset_);
+  }
   return vector;
 }
 
 void UintVector::writeToStream(std::FILE* stream) const {
   mt::fwrite(stream, &offset_, sizeof offset_);
-  mt::fwrite(stream, data_.get(), offset_);
+  mt::fwrite(stream, data_, offset_);
+}
+
+UintVector UintVector::copy() const {
+  UintVector vector;
+  if (offset_ != 0) {
+    vector.data_ = new char[offset_];
+    vector.size_ = offset_;
+    std::memcpy(vector.data_, data_, offset_);
+  }
+  vector.offset_ = offset_;
+  return vector;
 }
 
 std::vector<uint32_t> UintVector::unpack() const {
   std::vector<uint32_t> values;
   if (!empty()) {
-    uint32_t delta = 0;
-    uint32_t value = 0;
-    uint32_t nbytes = 0;
-    uint32_t offset = 0;
-    uint32_t remaining = offset_ - sizeof value;
-    while (remaining > 0) {
-      nbytes = Varint::readUint(data_.get() + offset, remaining, &delta);
-      offset += nbytes;
-      remaining -= nbytes;
-      values.push_back(value + delta);
-      value = values.back();
+    // Decodes the deltas in bulk and then computes their prefix sums,
+    // expanding runs on the way.
+    size_t num_deltas = offset_ - sizeof(uint32_t);  // Upper bound.
+    std::vector<uint32_t> deltas(num_deltas);
+    const auto nbytes = Varint::readUints(data_, num_deltas,
+                                          deltas.data(), &num_deltas);
+    MT_ASSERT_EQ(nbytes, offset_ - sizeof(uint32_t));
+    values.reserve(num_deltas);
+    values.push_back(deltas[0]);
+    for (size_t i = 1; i < num_deltas; ++i) {
+      if (deltas[i] == 0) {
+        MT_ASSERT_LT(i + 1, num_deltas);
+        const auto length = deltas[++i];
+        for (uint32_t j = 0; j != length; ++j) {
+          values.push_back(values.back() + 1);
+        }
+      } else {
+        values.push_back(values.back() + deltas[i]);
+      }
     }
   }
   return values;
 }
 
-bool UintVector::add(uint32_t value) {
-  allocateMoreIfFull();
+bool UintVector::add(uint32_t value, Arena* arena) {
+  allocateMoreIfFull(arena);
   if (empty()) {
     if (value <= Varint::Limits::MAX_N4) {
-      offset_ += Varint::writeUint(value, current(), size_);
+      offset_ += Varint::writeUint(value, current(), remaining());
       offset_ += writeUint32(value, current());
       return true;
     }
   } else {
-    uint32_t prev_value;
-    offset_ -= sizeof prev_value;
-    readUint32(current(), &prev_value);
-    MT_ASSERT_LT(prev_value, value);
-    const uint32_t delta = value - prev_value;
+    auto tail = popTail();
+    MT_ASSERT_LT(tail.value, value);
+    const uint32_t delta = value - tail.value;
+    if (delta == 1) {
+      if (tail.state == RUN) {
+        uint32_t length = 0;
+        Varint::readUint(current() - 4, 4, &length);
+        if (length != Varint::Limits::MAX_N4) {
+          writeFixedSizeVarint(length + 1, current() - 4);
+          pushTail(Tail{value, RUN});
+          return true;
+        }
+        tail.state = 0;  // Start over with a new run.
+      } else if (tail.state + 1 == RUN) {
+        // Replaces the single-byte deltas written so far with a run.
+        offset_ -= tail.state;
+        *current() = 0;
+        ++offset_;
+        offset_ += writeFixedSizeVarint(RUN, current());
+        pushTail(Tail{value, RUN});
+        return true;
+      }
+      offset_ += Varint::writeUint(delta, current(), remaining());
+      pushTail(Tail{value, tail.state + 1});
+      return true;
+    }
     if (delta <= Varint::Limits::MAX_N4) {
       offset_ += Varint::writeUint(delta, current(), remaining());
-      offset_ += writeUint32(value, current());
+      pushTail(Tail{value, 0});
       return true;
     }
+    pushTail(tail);
   }
   return false;
 }
 
-void UintVector::allocateMoreIfFull() {
+uint32_t UintVector::back() const {
+  MT_REQUIRE_FALSE(empty());
+  uint32_t word;
+  readUint32(current() - sizeof word, &word);
+  return word & Varint::Limits::MAX_N4;
+}
+
+uint32_t UintVector::getLengthOfLastRun() const {
+  MT_REQUIRE_FALSE(empty());
+  uint32_t word;
+  readUint32(current() - sizeof word, &word);
+  const auto state = word >> STATE_SHIFT;
+  if (state != RUN) return state + 1;
+  uint32_t length = 0;
+  Varint::readUint(current() - sizeof word - 4, 4, &length);
+  return length + 1;
+}
+
+UintVector::Tail UintVector::popTail() {
+  uint32_t word;
+  offset_ -= sizeof word;
+  readUint32(current(), &word);
+  return Tail{word & Varint::Limits::MAX_N4, word >> STATE_SHIFT};
+}
+
+void UintVector::pushTail(const Tail& tail) {
+  offset_ += writeUint32(tail.value | (tail.state << STATE_SHIFT), current());
+}
+
+void UintVector::clear(Arena* arena) {
+  if (isInArena()) {
+    if (arena) arena->deallocate(data_, capacity());
+  } else if (capacity() != 0) {
+    delete[] data_;
+  }
+  data_ = nullptr;
+  offset_ = 0;
+  size_ = 0;
+}
+
+void UintVector::allocateMoreIfFull(Arena* arena) {
   const uint32_t required_size = sizeof(uint32_t) * 2;
-  if (required_size > size_ - offset_) {
-    const uint32_t new_end_offset = size_ * 1.5;
-    const auto new_size = std::max(new_end_offset, required_size);
-    std::unique_ptr<char[]> new_data(new char[new_size]);
-    std::memcpy(new_data.get(), data_.get(), offset_);
-    data_ = std::move(new_data);
-    size_ = new_size;
+  const auto moves_out_of_arena = isInArena() && !arena;
+  if (required_size <= remaining() && !moves_out_of_arena) return;
+
+  char* new_data;
+  uint32_t new_size;
+  if (arena) {
+    new_size = getSizeClass(std::max(offset_ + required_size,
+                                     capacity() + capacity() / 4));
+    new_data = arena->allocate(new_size);
+  } else {
+    const uint32_t new_end_offset = capacity() * 1.5;
+    new_size = std::max(new_end_offset, required_size);
+    new_data = new char[new_size];
   }
+  if (offset_ != 0) std::memcpy(new_data, data_, offset_);
+  const auto old_offset = offset_;
+  clear(arena);
+  data_ = new_data;
+  offset_ = old_offset;
+  size_ = arena ? (new_size | IN_ARENA) : new_size;
 }
 
 }  // namespace internal
@@ -18,9 +18,12 @@
 #ifndef MULTIMAP_INTERNAL_UINT_VECTOR_HPP_INCLUDED
 #define MULTIMAP_INTERNAL_UINT_VECTOR_HPP_INCLUDED
 
+#include <algorithm>
 #include <cstring>
 #include <memory>
 #include <vector>
+#include "multimap/internal/Arena.hpp"
+#include "multimap/internal/Varint.hpp"
 #include "multimap/thirdparty/mt/mt.hpp"
 
 namespace multimap {
@@ -28,37 +31,181 @@ namespace internal {
 
 class UintVector {
  public:
+  class Cursor {
+   public:
+    Cursor() = default;
+
+    bool hasNext() const { return position_ != end_ || run_remaining_ != 0; }
+
+    uint32_t next() {
+      MT_REQUIRE_TRUE(hasNext());
+      if (run_remaining_ != 0) {
+        --run_remaining_;
+        return ++value_;
+      }
+      uint32_t delta = 0;
+      position_ += Varint::readUint(position_, end_ - position_, &delta);
+      if (delta == 0 && position_ != begin_ + 1) {
+        // A zero delta that is not the first value starts a run.
+        position_ +=
+            Varint::readUint(position_, end_ - position_, &run_remaining_);
+        --run_remaining_;
+        delta = 1;
+      }
+      value_ += delta;
+      return value_;
+    }
+    // Preconditions:
+    //  * `hasNext()` yields `true`.
+
+    void skip(uint32_t num_values) {
+      while (num_values != 0) {
+        if (run_remaining_ != 0) {
+          const auto n = std::min(num_values, run_remaining_);
+          run_remaining_ -= n;
+          value_ += n;
+          num_values -= n;
+        } else {
+          next();
+          --num_values;
+        }
+      }
+    }
+    // Same as calling `next()` `num_values` times, but skips runs of
+    // consecutive values at once.
+
+    uint32_t skipAll() {
+      uint32_t num_values = 0;
+      while (hasNext()) {
+        next();
+        num_values += 1 + run_remaining_;
+        value_ += run_remaining_;
+        run_remaining_ = 0;
+      }
+      return num_values;
+    }
+    // Skips the remaining values and returns their number.
+
+   private:
+    friend class UintVector;
+
+    Cursor(const char* begin, const char* end)
+        : begin_(begin), position_(begin), end_(end) {}
+
+    const char* begin_ = nullptr;
+    const char* position_ = nullptr;
+    const char* end_ = nullptr;
+    uint32_t value_ = 0;
+    uint32_t run_remaining_ = 0;
+  };
+  // Forward cursor that decodes the values one by one.  It refers to the
+  // data of the vector and is invalidated by the next call of `add()`.
+
   UintVector() = default;
 
-  UintVector(UintVector&&) = default;
-  UintVector& operator=(UintVector&&) = default;
+  ~UintVector() { clear(); }
+
+  UintVector(UintVector&& other)
+      : data_(other.data_), offset_(other.offset_), size_(other.size_) {
+    other.data_ = nullptr;
+    other.offset_ = 0;
+    other.size_ = 0;
+  }
+
+  UintVector& operator=(UintVector&& other) {
+    if (this != &other) {
+      clear();
+      std::swap(data_, other.data_);
+      std::swap(offset_, other.offset_);
+      std::swap(size_, other.size_);
+    }
+    return *this;
+  }
 
   static UintVector readFromStream(std::FILE* stream);
 
+  static UintVector readFromBuffer(const char* buffer);
+  // Same as `readFromStream()`, but reads from memory, e.g. a mapped file.
+
+  static UintVector readFromBuffer(const char* buffer, Arena* arena);
+  // Same as before, but copies the data into memory of `arena`, which must
+  // outlive the vector and is passed to `add()` and `clear()` from then on.
+  // The memory is not padded, so that reading many vectors, most of which
+  // are never appended to, neither allocates each one separately nor leaves
+  // slack behind.
+
   void writeToStream(std::FILE* stream) const;
 
+  uint32_t getSerializedSize() const { return sizeof offset_ + offset_; }
+  // Returns the number of bytes written by `writeToStream()`.
+
+  UintVector copy() const;
+  // Returns a deep copy, which is not affected by later calls of `add()`.
+
   std::vector<uint32_t> unpack() const;
 
-  bool add(uint32_t value);
+  Cursor getCursor() const {
+    if (empty()) return Cursor();
+    return Cursor(data_, current() - sizeof(uint32_t));
+  }
+
+  bool add(uint32_t value, Arena* arena = nullptr);
+  // If `arena` is not null, the data is kept in memory of `arena`, which
+  // must outlive the vector.  It grows in size classes and memory it no
+  // longer uses is returned to `arena`, so that vectors of similar size
+  // reuse each other's memory.  Once a vector uses an arena, the same arena
+  // must be passed in subsequent calls.  If `arena` is null, the data moves
+  // to memory owned by the vector.
+
+  uint32_t back() const;
+  // Returns the value added last.
+  // Preconditions:
+  //  * `empty()` yields `false`.
+
+  uint32_t getLengthOfLastRun() const;
+  // Returns the number of consecutive values at the end of the vector, i.e.
+  // values that each exceed their predecessor by one, including `back()`.
+  // Preconditions:
+  //  * `empty()` yields `false`.
+
+  uint32_t size() const { return getCursor().skipAll(); }
+  // Returns the number of values.  Runs of consecutive values are counted
+  // at once, other values are decoded, but nothing is allocated.
 
   bool empty() const { return offset_ == 0; }
 
-  void clear() {
-    data_.reset();
-    offset_ = 0;
-    size_ = 0;
-  }
+  void clear(Arena* arena = nullptr);
+  // Returns the memory to `arena` if the vector uses it.  Otherwise memory of
+  // an arena stays allocated until the arena is destroyed.
 
  private:
-  void allocateMoreIfFull();
+  static const uint32_t IN_ARENA = 1U << 31;
+
+  bool isInArena() const { return size_ & IN_ARENA; }
+
+  uint32_t capacity() const { return size_ & ~IN_ARENA; }
+
+  void allocateMoreIfFull(Arena* arena);
+
+  char* current() const { return data_ + offset_; }
+
+  struct Tail {
+    uint32_t value;
+    uint32_t state;
+  };
+
+  Tail popTail();
+  // Removes the tail, which must be written back via `pushTail()`.
 
-  char* current() const { return data_.get() + offset_; }
+  void pushTail(const Tail& tail);
 
-  uint32_t remaining() const { return size_ - offset_; }
+  uint32_t remaining() const { return capacity() - offset_; }
 
-  std::unique_ptr<char[]> data_;
+  char* data_ = nullptr;
   uint32_t offset_ = 0;
   uint32_t size_ = 0;
+  // The capacity of `data_`.  The highest bit tells whether `data_` refers
+  // to memory of an arena instead of memory owned by the vector.
 };
 
 static_assert(mt::hasExpectedSize<UintVector>(12, 16),
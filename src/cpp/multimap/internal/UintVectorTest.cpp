@@ -15,8 +15,10 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <cstdio>
 #include <type_traits>
 #include "gmock/gmock.h"
+#include "multimap/internal/Benchmark.hpp"
 #include "multimap/internal/UintVector.hpp"
 #include "multimap/internal/Varint.hpp"
 
@@ -71,6 +73,164 @@ TEST(UintVectorTest, AddIncreasingValuesAndUnpack) {
   ASSERT_THAT(vector.unpack(), ElementsAreArray(values));
 }
 
+TEST(UintVectorTest, CursorYieldsSameValuesAsUnpack) {
+  UintVector vector;
+  ASSERT_FALSE(vector.getCursor().hasNext());
+  std::vector<uint32_t> values;
+  for (uint32_t value = 0; value < 10000000; value += 1 + value / 3) {
+    vector.add(value);
+    values.push_back(value);
+  }
+  auto cursor = vector.getCursor();
+  for (const auto value : values) {
+    ASSERT_TRUE(cursor.hasNext());
+    ASSERT_EQ(cursor.next(), value);
+  }
+  ASSERT_FALSE(cursor.hasNext());
+  ASSERT_THAT(vector.unpack(), ElementsAreArray(values));
+}
+
+TEST(UintVectorTest, AddRunsOfConsecutiveValuesAndUnpack) {
+  UintVector vector;
+  std::vector<uint32_t> values;
+  uint32_t value = 0;
+  for (uint32_t length = 1; length != 10; ++length) {
+    for (uint32_t i = 0; i != length; ++i) {
+      vector.add(value);
+      values.push_back(value++);
+    }
+    value += length;
+  }
+  ASSERT_THAT(vector.unpack(), ElementsAreArray(values));
+
+  auto cursor = vector.getCursor();
+  for (const auto value : values) {
+    ASSERT_TRUE(cursor.hasNext());
+    ASSERT_EQ(cursor.next(), value);
+  }
+  ASSERT_FALSE(cursor.hasNext());
+}
+
+TEST(UintVectorTest, ConsecutiveValuesNeedConstantSpace) {
+  UintVector vector;
+  std::vector<uint32_t> values;
+  for (uint32_t value = 1; value != 100001; ++value) {
+    vector.add(value);
+    values.push_back(value);
+  }
+  const auto stream = std::tmpfile();
+  ASSERT_TRUE(stream != nullptr);
+  vector.writeToStream(stream);
+  ASSERT_LT(std::ftell(stream), 16);
+
+  std::rewind(stream);
+  auto copy = UintVector::readFromStream(stream);
+  std::fclose(stream);
+  ASSERT_THAT(copy.unpack(), ElementsAreArray(values));
+
+  copy.add(100001);
+  copy.add(100003);
+  values.push_back(100001);
+  values.push_back(100003);
+  ASSERT_THAT(copy.unpack(), ElementsAreArray(values));
+}
+
+TEST(UintVectorTest, GetLengthOfLastRunCountsTrailingConsecutiveValues) {
+  UintVector vector;
+  vector.add(10);
+  ASSERT_EQ(vector.getLengthOfLastRun(), 1);
+  vector.add(11);
+  ASSERT_EQ(vector.getLengthOfLastRun(), 2);
+  vector.add(12);
+  ASSERT_EQ(vector.getLengthOfLastRun(), 3);
+  for (uint32_t value = 13; value != 100; ++value) {
+    vector.add(value);
+    ASSERT_EQ(vector.getLengthOfLastRun(), value - 9);
+  }
+  vector.add(200);
+  ASSERT_EQ(vector.getLengthOfLastRun(), 1);
+  vector.add(201);
+  ASSERT_EQ(vector.getLengthOfLastRun(), 2);
+  vector.add(300);
+  ASSERT_EQ(vector.getLengthOfLastRun(), 1);
+}
+
+TEST(UintVectorTest, SizeCountsValuesIncludingRuns) {
+  UintVector vector;
+  ASSERT_EQ(vector.size(), 0);
+  uint32_t num_values = 0;
+  for (uint32_t value = 0; value < 100000; value += 1 + (value % 100 == 0)) {
+    vector.add(value);
+    ++num_values;
+  }
+  ASSERT_EQ(vector.size(), num_values);
+  ASSERT_EQ(vector.size(), vector.unpack().size());
+}
+
+TEST(UintVectorTest, ReadFromBufferIntoArenaAndAdd) {
+  UintVector vector;
+  std::vector<uint32_t> values;
+  for (uint32_t value = 0; value < 1000; value += 1 + value / 7) {
+    vector.add(value);
+    values.push_back(value);
+  }
+  const auto stream = std::tmpfile();
+  ASSERT_TRUE(stream != nullptr);
+  vector.writeToStream(stream);
+  std::vector<char> buffer(std::ftell(stream));
+  ASSERT_THAT(buffer.size(), testing::Eq(vector.getSerializedSize()));
+  std::rewind(stream);
+  ASSERT_EQ(std::fread(buffer.data(), 1, buffer.size(), stream),
+            buffer.size());
+  std::fclose(stream);
+
+  Arena arena;
+  auto copy = UintVector::readFromBuffer(buffer.data(), &arena);
+  ASSERT_THAT(arena.allocated(), testing::Gt(0));
+  ASSERT_THAT(copy.unpack(), ElementsAreArray(values));
+
+  // Moves the data out of the arena first.
+  copy.add(1000);
+  copy.add(1001);
+  values.push_back(1000);
+  values.push_back(1001);
+  ASSERT_THAT(copy.unpack(), ElementsAreArray(values));
+
+  UintVector moved;
+  moved = std::move(copy);
+  ASSERT_TRUE(copy.empty());
+  ASSERT_THAT(moved.unpack(), ElementsAreArray(values));
+}
+
+TEST(UintVectorTest, AddWithArenaReusesMemoryOfSameSizeClass) {
+  Arena arena;
+  std::vector<uint32_t> values;
+  UintVector vector;
+  for (uint32_t value = 0; value < 100000; value += 1 + value % 1000) {
+    vector.add(value, &arena);
+    values.push_back(value);
+  }
+  ASSERT_THAT(vector.unpack(), ElementsAreArray(values));
+  // Outgrown buffers have been returned to the arena.
+  ASSERT_THAT(arena.reusable(), testing::Gt(0));
+
+  const auto allocated = arena.allocated();
+  vector.clear(&arena);
+  ASSERT_TRUE(vector.empty());
+  ASSERT_THAT(arena.allocated(), testing::Lt(allocated));
+
+  // A vector of the same length is served from the free lists only.
+  const auto reserved = arena.reserved();
+  UintVector other;
+  for (const auto value : values) {
+    other.add(value, &arena);
+  }
+  ASSERT_THAT(other.unpack(), ElementsAreArray(values));
+  ASSERT_EQ(arena.reserved(), reserved);
+  other.clear(&arena);
+  ASSERT_EQ(arena.allocated(), 0);
+}
+
 TEST(UintVectorTest, AddDecreasingValuesAndThrow) {
   UintVector vector;
   uint32_t values[] = {Varint::Limits::MAX_N4, 10000000};
@@ -78,5 +238,24 @@ TEST(UintVectorTest, AddDecreasingValuesAndThrow) {
   ASSERT_THROW(vector.add(values[1]), mt::AssertionError);
 }
 
+TEST(UintVectorTest, DISABLED_BenchmarkAddAndIterate) {
+  const uint32_t num_values = 10000000;
+  UintVector vector;
+  Benchmark::run("UintVector::add", num_values, [&] {
+    for (uint32_t i = 0; i != num_values; ++i) {
+      vector.add(i * 3);
+    }
+  });
+  uint64_t sum = 0;
+  Benchmark::run("UintVector::Cursor::next", num_values, [&] {
+    auto cursor = vector.getCursor();
+    while (cursor.hasNext()) {
+      sum += cursor.next();
+    }
+  });
+  ASSERT_EQ(sum, 3 * (uint64_t(num_values) * (num_values - 1) / 2));
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
 }  // namespace internal
 }  // namespace multimap
@@ -84,6 +84,36 @@ uint32_t Varint::readUint(const char* buffer, size_t size, uint32_t* value) {
   return 0;
 }
 
+size_t Varint::readUints(const char* buffer, size_t size, uint32_t* values,
+                         size_t* num_values) {
+  MT_REQUIRE_NOT_NULL(buffer);
+  MT_REQUIRE_NOT_NULL(values);
+  MT_REQUIRE_NOT_NULL(num_values);
+
+  const std::uint8_t* ptr = reinterpret_cast<const std::uint8_t*>(buffer);
+  const std::uint8_t* end = ptr + size;
+  size_t count = 0;
+  while (count != *num_values && end - ptr >= 4) {
+    // The two high bits of the first byte encode the length, the remaining
+    // bits form a big-endian number.  Loading four bytes at once allows to
+    // extract the value with a single shift.
+    const uint32_t word = (ptr[0] << 24) | (ptr[1] << 16) | (ptr[2] << 8) |
+                          static_cast<uint32_t>(ptr[3]);
+    const uint32_t length = (word >> 30) + 1;
+    values[count++] = (word & 0x3FFFFFFF) >> (32 - length * 8);
+    ptr += length;
+  }
+  while (count != *num_values) {
+    const auto nbytes = readUint(reinterpret_cast<const char*>(ptr),
+                                 end - ptr, values + count);
+    if (nbytes == 0) break;
+    ptr += nbytes;
+    ++count;
+  }
+  *num_values = count;
+  return ptr - reinterpret_cast<const std::uint8_t*>(buffer);
+}
+
 uint32_t Varint::readUintWithFlag(const char* buffer, size_t size,
                                   uint32_t* value, bool* flag) {
   MT_REQUIRE_NOT_NULL(buffer);
@@ -56,6 +56,18 @@ struct Varint {
   //  * `buffer` is not null
   //  * `value` is not null
 
+  static size_t readUints(const char* buffer, size_t size, uint32_t* values,
+                          size_t* num_values);
+  // Reads up to `*num_values` 32-bit unsigned integers from `buffer` into
+  // `values` and sets `*num_values` to the number of integers read.
+  // Returns the number of bytes read.  As long as four bytes are available,
+  // integers are decoded without branching on their length, which makes this
+  // faster than calling `readUint()` in a loop.
+  // Preconditions:
+  //  * `buffer` is not null
+  //  * `values` is not null
+  //  * `num_values` is not null
+
   static uint32_t readUintWithFlag(const char* buffer, size_t size,
                                    uint32_t* value, bool* flag);
   // Reads a 32-bit unsigned integer with flag from `buffer` into `value` and
@@ -15,9 +15,15 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
+#include <chrono>
+#include <cstdio>
 #include <cstring>  // For std::memset
+#include <numeric>
+#include <random>
 #include <type_traits>
+#include <vector>
 #include "gmock/gmock.h"
+#include "multimap/internal/Benchmark.hpp"
 #include "multimap/internal/Varint.hpp"
 #include "multimap/thirdparty/mt/mt.hpp"
 
@@ -26,6 +32,7 @@ namespace internal {
 
 using testing::Eq;
 using testing::ElementsAre;
+using testing::ElementsAreArray;
 
 struct VarintTestFixture : public testing::Test {
   void SetUp() override {
@@ -458,6 +465,96 @@ TEST_F(VarintTestFixture, WriteAndReadSequenceOfValues) {
   ASSERT_THAT(p - b32, Eq(10));
 }
 
+std::vector<char> writeUints(const std::vector<uint32_t>& values) {
+  std::vector<char> buffer(values.size() * 4);
+  size_t offset = 0;
+  for (const auto value : values) {
+    offset += Varint::writeUint(value, buffer.data() + offset,
+                                buffer.size() - offset);
+  }
+  buffer.resize(offset);
+  return buffer;
+}
+
+std::vector<uint32_t> generateUints(size_t num_values) {
+  const uint32_t maxima[] = {Varint::Limits::MAX_N1, Varint::Limits::MAX_N2,
+                             Varint::Limits::MAX_N3, Varint::Limits::MAX_N4};
+  std::mt19937 generator(42);
+  std::vector<uint32_t> values(num_values);
+  for (auto& value : values) {
+    value = generator() % (maxima[generator() % 4] + 1);
+  }
+  return values;
+}
+
+TEST(VarintTest, ReadUintsYieldsSameValuesAsReadUint) {
+  const auto expected = generateUints(1000);
+  const auto buffer = writeUints(expected);
+  for (const size_t size : {buffer.size(), buffer.size() - 1}) {
+    std::vector<uint32_t> actual(expected.size());
+    size_t num_values = actual.size();
+    const auto nbytes =
+        Varint::readUints(buffer.data(), size, actual.data(), &num_values);
+    actual.resize(num_values);
+
+    std::vector<uint32_t> values;
+    size_t offset = 0;
+    uint32_t value = 0;
+    while (const auto n = Varint::readUint(buffer.data() + offset,
+                                           size - offset, &value)) {
+      values.push_back(value);
+      offset += n;
+    }
+    ASSERT_THAT(actual, Eq(values));
+    ASSERT_THAT(nbytes, Eq(offset));
+  }
+}
+
+TEST(VarintTest, ReadUintsStopsAfterRequestedNumberOfValues) {
+  const auto expected = generateUints(100);
+  const auto buffer = writeUints(expected);
+  std::vector<uint32_t> actual(expected.size());
+  size_t num_values = 10;
+  const auto nbytes = Varint::readUints(buffer.data(), buffer.size(),
+                                        actual.data(), &num_values);
+  ASSERT_THAT(num_values, Eq(10));
+  ASSERT_THAT(nbytes, Eq(writeUints(std::vector<uint32_t>(
+                                        expected.begin(), expected.begin() + 10))
+                             .size()));
+  actual.resize(num_values);
+  ASSERT_THAT(actual, ElementsAreArray(expected.data(), 10));
+}
+
+TEST(VarintTest, DISABLED_BenchmarkReadUintsAgainstReadUint) {
+  const auto num_values = 10000000;
+  const auto buffer = writeUints(generateUints(num_values));
+  std::vector<uint32_t> values(num_values);
+
+  auto start = std::chrono::steady_clock::now();
+  size_t offset = 0;
+  for (auto& value : values) {
+    offset += Varint::readUint(buffer.data() + offset, buffer.size() - offset,
+                               &value);
+  }
+  const auto scalar_time = std::chrono::steady_clock::now() - start;
+  const auto scalar_sum = std::accumulate(values.begin(), values.end(), 0u);
+
+  start = std::chrono::steady_clock::now();
+  size_t num_decoded = values.size();
+  Varint::readUints(buffer.data(), buffer.size(), values.data(), &num_decoded);
+  const auto bulk_time = std::chrono::steady_clock::now() - start;
+  const auto bulk_sum = std::accumulate(values.begin(), values.end(), 0u);
+  ASSERT_THAT(bulk_sum, Eq(scalar_sum));
+
+  typedef std::chrono::microseconds Micros;
+  std::printf("readUint: %ld us, readUints: %ld us\n",
+              static_cast<long>(
+                  std::chrono::duration_cast<Micros>(scalar_time).count()),
+              static_cast<long>(
+                  std::chrono::duration_cast<Micros>(bulk_time).count()));
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
 TEST_F(VarintTestFixture, WriteAndReadSequenceOfValuesWithTrueFlags) {
   uint32_t values[] = {
       (Varint::Limits::MAX_N1_WITH_FLAG - Varint::Limits::MIN_N1_WITH_FLAG) / 2,
@@ -589,5 +686,27 @@ TEST_F(VarintTestFixture, WriteFalseFlagToEmptyBufferThrows) {
   ASSERT_THROW(Varint::writeFlag(false, b4, 0), mt::AssertionError);
 }
 
+TEST(VarintTest, DISABLED_BenchmarkWriteUintAndReadUint) {
+  const uint32_t num_values = 10000000;
+  std::vector<char> buffer(num_values * 4);
+  size_t size = 0;
+  Benchmark::run("Varint::writeUint", num_values, [&] {
+    for (uint32_t i = 0; i != num_values; ++i) {
+      size += Varint::writeUint(i, buffer.data() + size, buffer.size() - size);
+    }
+  });
+  uint64_t sum = 0;
+  Benchmark::run("Varint::readUint", num_values, [&] {
+    size_t offset = 0;
+    uint32_t value = 0;
+    for (uint32_t i = 0; i != num_values; ++i) {
+      offset += Varint::readUint(buffer.data() + offset, size - offset, &value);
+      sum += value;
+    }
+  });
+  ASSERT_THAT(sum, Eq(uint64_t(num_values) * (num_values - 1) / 2));
+}
+// Run with --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+
 }  // namespace internal
 }  // namespace multimap
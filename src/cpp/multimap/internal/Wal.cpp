@@ -0,0 +1,284 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/Wal.hpp"
+
+#include <fcntl.h>
+#include <cstring>
+#include <zlib.h>
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+const size_t HEADER_SIZE = 2 * sizeof(uint32_t);
+// Each record starts with the size and the CRC-32 of its payload.
+
+void appendUint32(uint32_t value, std::vector<char>* buffer) {
+  const auto data = reinterpret_cast<const char*>(&value);
+  buffer->insert(buffer->end(), data, data + sizeof value);
+}
+
+void appendUint64(uint64_t value, std::vector<char>* buffer) {
+  const auto data = reinterpret_cast<const char*>(&value);
+  buffer->insert(buffer->end(), data, data + sizeof value);
+}
+
+void appendBytes(const Bytes& bytes, std::vector<char>* buffer) {
+  appendUint32(bytes.size(), buffer);
+  buffer->insert(buffer->end(), bytes.begin(), bytes.end());
+}
+
+bool parseUint32(const char** pos, const char* end, uint32_t* value) {
+  if (static_cast<size_t>(end - *pos) < sizeof *value) return false;
+  std::memcpy(value, *pos, sizeof *value);
+  *pos += sizeof *value;
+  return true;
+}
+
+bool parseUint64(const char** pos, const char* end, uint64_t* value) {
+  if (static_cast<size_t>(end - *pos) < sizeof *value) return false;
+  std::memcpy(value, *pos, sizeof *value);
+  *pos += sizeof *value;
+  return true;
+}
+
+bool parseBytes(const char** pos, const char* end, Bytes* bytes) {
+  uint32_t size = 0;
+  if (!parseUint32(pos, end, &size)) return false;
+  if (static_cast<size_t>(end - *pos) < size) return false;
+  *bytes = Bytes(*pos, size);
+  *pos += size;
+  return true;
+}
+
+uint32_t computeCrc32(const char* data, size_t size) {
+  return ::crc32(::crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(data),
+                 size);
+}
+
+}  // namespace
+
+Wal::Wal(const boost::filesystem::path& file, const Options& options)
+    : options_(options) {
+  uint64_t num_bytes_valid = 0;
+  if (boost::filesystem::is_regular_file(file)) {
+    num_bytes_valid = forEachRecord(file, [](const Record&) {});
+  }
+  fd_ = mt::open(file, O_WRONLY | O_CREAT, 0644);
+  mt::truncate(fd_.get(), num_bytes_valid);
+  mt::seek(fd_.get(), num_bytes_valid, SEEK_SET);
+  num_bytes_appended_ = num_bytes_valid;
+  num_bytes_committed_ = num_bytes_valid;
+}
+
+Wal::~Wal() { commit(size()); }
+
+uint64_t Wal::appendPut(const Bytes& key, const Bytes& value) {
+  return append(RecordType::PUT, key, value, 0);
+}
+
+uint64_t Wal::appendRemove(const Bytes& key, uint32_t position) {
+  return append(RecordType::REMOVE, key, Bytes(), position);
+}
+
+uint64_t Wal::appendClear(const Bytes& key) {
+  return append(RecordType::CLEAR, key, Bytes(), 0);
+}
+
+uint64_t Wal::appendReplace(const Bytes& key, uint32_t position,
+                            const Bytes& value) {
+  return append(RecordType::REPLACE, key, value, position);
+}
+
+uint64_t Wal::appendExpire(const Bytes& key, uint32_t deadline) {
+  return append(RecordType::EXPIRE, key, Bytes(), deadline);
+}
+
+uint64_t Wal::appendRetire(const Bytes& key, uint32_t num_entries) {
+  return append(RecordType::RETIRE, key, Bytes(), num_entries);
+}
+
+uint64_t Wal::appendRecord(const Record& record) {
+  switch (record.type) {
+    case RecordType::REMOVE:
+    case RecordType::REPLACE:
+    case RecordType::RETIRE:
+      return append(record.type, record.key, record.value, record.position);
+    case RecordType::CHECKPOINT:
+      return append(record.type, record.key, record.value,
+                    record.checkpoint_id);
+    case RecordType::EXPIRE:
+      return append(record.type, record.key, record.value, record.deadline);
+    default:
+      return append(record.type, record.key, record.value, 0);
+  }
+}
+
+void Wal::commit(uint64_t sequence_number) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  std::vector<char> buffer;
+  while (num_bytes_committed_ < sequence_number) {
+    if (is_committing_) {
+      committed_.wait(lock);
+      continue;
+    }
+    // This thread becomes the leader and writes all records buffered so far,
+    // including those of threads that are waiting.
+    is_committing_ = true;
+    buffer.swap(buffer_);
+    const auto num_bytes_appended = num_bytes_appended_;
+    lock.unlock();
+    try {
+      mt::write(fd_.get(), buffer.data(), buffer.size());
+      if (options_.sync) {
+        mt::fsync(fd_.get());
+      }
+    } catch (...) {
+      lock.lock();
+      is_committing_ = false;
+      committed_.notify_all();
+      throw;
+    }
+    buffer.clear();
+    lock.lock();
+    is_committing_ = false;
+    num_bytes_committed_ = num_bytes_appended;
+    committed_.notify_all();
+  }
+}
+
+void Wal::reset(uint64_t checkpoint_id) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (is_committing_) {
+    committed_.wait(lock);
+  }
+  buffer_.clear();
+  appendUnlocked(RecordType::CHECKPOINT, Bytes(), Bytes(), checkpoint_id);
+  mt::truncate(fd_.get(), 0);
+  mt::seek(fd_.get(), 0, SEEK_SET);
+  mt::write(fd_.get(), buffer_.data(), buffer_.size());
+  if (options_.sync) {
+    mt::fsync(fd_.get());
+  }
+  buffer_.clear();
+  num_bytes_committed_ = num_bytes_appended_;
+  committed_.notify_all();
+}
+
+uint64_t Wal::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return num_bytes_appended_;
+}
+
+bool Wal::readFirstRecord(const boost::filesystem::path& file,
+                          std::vector<char>* buffer, Record* record) {
+  const auto stream = mt::fopen(file, "r");
+  return readRecord(stream.get(), boost::filesystem::file_size(file), buffer,
+                    record);
+}
+
+bool Wal::readRecord(std::FILE* stream, uint64_t num_bytes_left,
+                     std::vector<char>* buffer, Record* record) {
+  uint32_t header[2];
+  if (num_bytes_left < HEADER_SIZE) return false;
+  if (std::fread(header, 1, HEADER_SIZE, stream) != HEADER_SIZE) return false;
+  if (header[0] > num_bytes_left - HEADER_SIZE) return false;
+  buffer->resize(header[0]);
+  if (std::fread(buffer->data(), 1, buffer->size(), stream) != header[0]) {
+    return false;
+  }
+  if (computeCrc32(buffer->data(), buffer->size()) != header[1]) return false;
+
+  const char* pos = buffer->data();
+  const char* end = pos + buffer->size();
+  if (pos == end) return false;
+  record->type = static_cast<RecordType>(*pos++);
+  if (!parseBytes(&pos, end, &record->key)) return false;
+  switch (record->type) {
+    case RecordType::PUT:
+      if (!parseBytes(&pos, end, &record->value)) return false;
+      break;
+    case RecordType::REMOVE:
+      if (!parseUint32(&pos, end, &record->position)) return false;
+      break;
+    case RecordType::CLEAR:
+      break;
+    case RecordType::CHECKPOINT:
+      if (!parseUint64(&pos, end, &record->checkpoint_id)) return false;
+      break;
+    case RecordType::REPLACE:
+      if (!parseUint32(&pos, end, &record->position)) return false;
+      if (!parseBytes(&pos, end, &record->value)) return false;
+      break;
+    case RecordType::EXPIRE:
+      if (!parseUint32(&pos, end, &record->deadline)) return false;
+      break;
+    case RecordType::RETIRE:
+      if (!parseUint32(&pos, end, &record->position)) return false;
+      break;
+    default:
+      return false;
+  }
+  return pos == end;
+}
+
+uint64_t Wal::append(RecordType type, const Bytes& key, const Bytes& value,
+                     uint64_t number) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return appendUnlocked(type, key, value, number);
+}
+
+uint64_t Wal::appendUnlocked(RecordType type, const Bytes& key,
+                             const Bytes& value, uint64_t number) {
+  const auto header_offset = buffer_.size();
+  buffer_.resize(header_offset + HEADER_SIZE);
+  buffer_.push_back(static_cast<char>(type));
+  appendBytes(key, &buffer_);
+  switch (type) {
+    case RecordType::PUT:
+      appendBytes(value, &buffer_);
+      break;
+    case RecordType::REMOVE:
+      appendUint32(number, &buffer_);
+      break;
+    case RecordType::CHECKPOINT:
+      appendUint64(number, &buffer_);
+      break;
+    case RecordType::REPLACE:
+      appendUint32(number, &buffer_);
+      appendBytes(value, &buffer_);
+      break;
+    case RecordType::EXPIRE:
+    case RecordType::RETIRE:
+      appendUint32(number, &buffer_);
+      break;
+    default:
+      break;
+  }
+  const uint32_t header[] = {
+      static_cast<uint32_t>(buffer_.size() - header_offset - HEADER_SIZE),
+      computeCrc32(buffer_.data() + header_offset + HEADER_SIZE,
+                   buffer_.size() - header_offset - HEADER_SIZE)};
+  std::memcpy(buffer_.data() + header_offset, header, HEADER_SIZE);
+  num_bytes_appended_ += buffer_.size() - header_offset;
+  return num_bytes_appended_;
+}
+
+}  // namespace internal
+}  // namespace multimap
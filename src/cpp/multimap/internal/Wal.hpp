@@ -0,0 +1,173 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_WAL_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_WAL_HPP_INCLUDED
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+#include <boost/filesystem/operations.hpp>
+#include "multimap/thirdparty/mt/mt.hpp"
+#include "multimap/Bytes.hpp"
+
+namespace multimap {
+namespace internal {
+
+class Wal : public mt::Resource {
+  // An append-only write-ahead log that records the updates of a partition
+  // since its last checkpoint, so that they can be replayed after a crash.
+  // Records are buffered in memory and written by `commit()`.  Concurrent
+  // committers are served by a single write, so that the cost of syncing is
+  // shared among them (group commit).  Objects of this class are thread-safe.
+
+ public:
+  struct Options {
+    bool sync = false;
+    // If true, `commit()` does not return before the records have been
+    // forced to stable storage via fsync().  Otherwise, records survive a
+    // crash of the process, but not necessarily of the operating system.
+  };
+
+  enum class RecordType : uint8_t {
+    PUT = 1,
+    REMOVE = 2,
+    CLEAR = 3,
+    CHECKPOINT = 4,
+    REPLACE = 5,
+    EXPIRE = 6,
+    RETIRE = 7
+  };
+
+  struct Record {
+    RecordType type = RecordType::PUT;
+    Bytes key;
+    Bytes value;  // Used by PUT and REPLACE.
+    uint32_t position = 0;  // Used by REMOVE, REPLACE, and RETIRE.
+    uint64_t checkpoint_id = 0;  // Used by CHECKPOINT.
+    uint32_t deadline = 0;  // Used by EXPIRE.
+  };
+
+  Wal(const boost::filesystem::path& file, const Options& options);
+  // Opens the log for appending.  The file is created if it does not exist.
+  // An incomplete record at the end of the file, if any, is truncated.
+
+  ~Wal();
+  // Commits all pending records.
+
+  uint64_t appendPut(const Bytes& key, const Bytes& value);
+
+  uint64_t appendRemove(const Bytes& key, uint32_t position);
+
+  uint64_t appendClear(const Bytes& key);
+
+  uint64_t appendReplace(const Bytes& key, uint32_t position,
+                         const Bytes& value);
+
+  uint64_t appendExpire(const Bytes& key, uint32_t deadline);
+
+  uint64_t appendRetire(const Bytes& key, uint32_t num_entries);
+  // Each append function buffers a record and returns its sequence number
+  // that must be passed to `commit()` to make the record durable.
+
+  uint64_t appendRecord(const Record& record);
+  // Appends a copy of `record`, e.g. one that has been read from another
+  // log.
+
+  void commit(uint64_t sequence_number);
+  // Blocks until all records up to `sequence_number` have been written.
+
+  void reset(uint64_t checkpoint_id);
+  // Discards all records, including pending ones, and starts the log anew
+  // with a single CHECKPOINT record carrying `checkpoint_id`.  This is
+  // called after the state that the records describe has been checkpointed.
+  // Threads waiting in `commit()` for discarded records return.
+
+  uint64_t size() const;
+  // Returns the number of bytes appended so far, including buffered ones
+  // and those discarded by `reset()`.
+
+  const Options& getOptions() const { return options_; }
+
+  template <typename Procedure>
+  static uint64_t forEachRecord(const boost::filesystem::path& file,
+                                Procedure process) {
+    return forEachRecord(file, 0, process);
+  }
+  // Calls `process` for each complete record in the order they have been
+  // appended and returns the size of the valid part of the file.  Reading
+  // stops at the first record that is incomplete or corrupt, which is what
+  // a crash during a write leaves behind.
+
+  template <typename Procedure>
+  static uint64_t forEachRecord(const boost::filesystem::path& file,
+                                uint64_t offset, Procedure process) {
+    const auto file_size = boost::filesystem::file_size(file);
+    mt::Check::isLessEqual(offset, file_size,
+                           "Wal: offset %llu is beyond the end of '%s'",
+                           static_cast<unsigned long long>(offset),
+                           file.c_str());
+    const auto stream = mt::fopen(file, "r");
+    mt::fseek(stream.get(), offset, SEEK_SET);
+    std::vector<char> buffer;
+    Record record;
+    uint64_t num_bytes_valid = offset;
+    while (readRecord(stream.get(), file_size - num_bytes_valid, &buffer,
+                      &record)) {
+      process(record);
+      num_bytes_valid = mt::ftell(stream.get());
+    }
+    return num_bytes_valid;
+  }
+  // Same as above, but starts at `offset`, which must be the end of a
+  // record, such as a value returned before.  Since only complete records
+  // are visited, this can tail a log that another process appends to.
+
+  static bool readFirstRecord(const boost::filesystem::path& file,
+                              std::vector<char>* buffer, Record* record);
+  // Returns `false` if the file does not contain a complete record.
+  // Fields of `record` refer to `buffer`.
+
+ private:
+  static bool readRecord(std::FILE* stream, uint64_t num_bytes_left,
+                         std::vector<char>* buffer, Record* record);
+  // Fields of `record` refer to `buffer`.
+
+  uint64_t append(RecordType type, const Bytes& key, const Bytes& value,
+                  uint64_t number);
+  // `number` is the position of a REMOVE or REPLACE, the id of a
+  // CHECKPOINT, the deadline of an EXPIRE, or the number of entries of a
+  // RETIRE record.
+
+  uint64_t appendUnlocked(RecordType type, const Bytes& key,
+                          const Bytes& value, uint64_t number);
+
+  mutable std::mutex mutex_;
+  std::condition_variable committed_;
+  std::vector<char> buffer_;
+  uint64_t num_bytes_appended_ = 0;
+  uint64_t num_bytes_committed_ = 0;
+  bool is_committing_ = false;
+  mt::AutoCloseFd fd_;
+  Options options_;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_WAL_HPP_INCLUDED
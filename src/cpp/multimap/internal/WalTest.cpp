@@ -0,0 +1,226 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <boost/filesystem/operations.hpp>
+#include "gmock/gmock.h"
+#include "multimap/internal/Wal.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+
+struct WalTestFixture : public testing::Test {
+  void SetUp() override {
+    directory = "/tmp/multimap.WalTestFixture";
+    boost::filesystem::remove_all(directory);
+    MT_ASSERT_TRUE(boost::filesystem::create_directory(directory));
+    file = directory / "wal";
+  }
+
+  void TearDown() override {
+    MT_ASSERT_TRUE(boost::filesystem::remove_all(directory));
+  }
+
+  std::vector<std::string> readRecords(uint64_t offset = 0) const {
+    std::vector<std::string> records;
+    Wal::forEachRecord(file, offset, [&records](const Wal::Record& record) {
+      switch (record.type) {
+        case Wal::RecordType::PUT:
+          records.push_back("put " + record.key.toString() + " " +
+                            record.value.toString());
+          break;
+        case Wal::RecordType::REMOVE:
+          records.push_back("remove " + record.key.toString() + " " +
+                            std::to_string(record.position));
+          break;
+        case Wal::RecordType::CLEAR:
+          records.push_back("clear " + record.key.toString());
+          break;
+        case Wal::RecordType::CHECKPOINT:
+          records.push_back("checkpoint " +
+                            std::to_string(record.checkpoint_id));
+          break;
+        case Wal::RecordType::REPLACE:
+          records.push_back("replace " + record.key.toString() + " " +
+                            std::to_string(record.position) + " " +
+                            record.value.toString());
+          break;
+        case Wal::RecordType::EXPIRE:
+          records.push_back("expire " + record.key.toString() + " " +
+                            std::to_string(record.deadline));
+          break;
+        case Wal::RecordType::RETIRE:
+          records.push_back("retire " + record.key.toString() + " " +
+                            std::to_string(record.position));
+          break;
+      }
+    });
+    return records;
+  }
+
+  boost::filesystem::path directory;
+  boost::filesystem::path file;
+};
+
+TEST(WalTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<Wal>::value);
+  ASSERT_FALSE(std::is_copy_assignable<Wal>::value);
+}
+
+TEST_F(WalTestFixture, CommittedRecordsAreReadInOrder) {
+  Wal wal(file, Wal::Options());
+  wal.appendPut("k1", "v1");
+  wal.appendRemove("k1", 23);
+  wal.appendReplace("k1", 42, "v2");
+  wal.appendExpire("k1", 1234567890);
+  wal.appendRetire("k1", 7);
+  wal.commit(wal.appendClear("k2"));
+  ASSERT_THAT(readRecords(),
+              testing::ElementsAre("put k1 v1", "remove k1 23",
+                                   "replace k1 42 v2", "expire k1 1234567890",
+                                   "retire k1 7", "clear k2"));
+}
+
+TEST_F(WalTestFixture, RecordsAreNotWrittenBeforeCommit) {
+  Wal wal(file, Wal::Options());
+  const auto sequence_number = wal.appendPut("k1", "v1");
+  ASSERT_THAT(readRecords().size(), Eq(0));
+  wal.commit(sequence_number);
+  ASSERT_THAT(readRecords().size(), Eq(1));
+}
+
+TEST_F(WalTestFixture, DestructorCommitsPendingRecords) {
+  {
+    Wal::Options options;
+    options.sync = true;
+    Wal wal(file, options);
+    wal.appendPut("k1", "v1");
+  }
+  ASSERT_THAT(readRecords(), testing::ElementsAre("put k1 v1"));
+}
+
+TEST_F(WalTestFixture, ReopenAppendsAndTruncatesIncompleteRecord) {
+  {
+    Wal wal(file, Wal::Options());
+    wal.appendPut("k1", "v1");
+    wal.appendPut("k2", "v2");
+  }
+  const auto size = boost::filesystem::file_size(file);
+  boost::filesystem::resize_file(file, size - 1);
+  ASSERT_THAT(readRecords(), testing::ElementsAre("put k1 v1"));
+  {
+    Wal wal(file, Wal::Options());
+    ASSERT_THAT(wal.size(), Eq(size / 2));
+    wal.appendPut("k3", "v3");
+  }
+  ASSERT_THAT(readRecords(), testing::ElementsAre("put k1 v1", "put k3 v3"));
+}
+
+TEST_F(WalTestFixture, CorruptRecordEndsTheLog) {
+  {
+    Wal wal(file, Wal::Options());
+    wal.appendPut("k1", "v1");
+    wal.appendPut("k2", "v2");
+    wal.appendPut("k3", "v3");
+  }
+  {
+    const auto size = boost::filesystem::file_size(file);
+    const auto stream = mt::fopen(file, "r+");
+    mt::fseek(stream.get(), size / 2 + 10, SEEK_SET);  // Payload of 2nd one.
+    mt::fwrite(stream.get(), "x", 1);
+  }
+  ASSERT_THAT(readRecords(), testing::ElementsAre("put k1 v1"));
+}
+
+TEST_F(WalTestFixture, ResetDiscardsRecordsAndStartsWithCheckpoint) {
+  {
+    Wal wal(file, Wal::Options());
+    wal.commit(wal.appendPut("k1", "v1"));
+    const auto sequence_number = wal.appendPut("k2", "v2");
+    wal.reset(42);
+    wal.commit(sequence_number);  // Returns immediately.
+    wal.appendPut("k3", "v3");
+  }
+  ASSERT_THAT(readRecords(),
+              testing::ElementsAre("checkpoint 42", "put k3 v3"));
+}
+
+TEST_F(WalTestFixture, RecordsAreReadFromOffsetAndCanBeCopied) {
+  uint64_t offset = 0;
+  {
+    Wal wal(file, Wal::Options());
+    offset = wal.appendPut("k1", "v1");
+    wal.appendRemove("k1", 0);
+    wal.appendReplace("k2", 3, "v3");
+    wal.appendExpire("k3", 7);
+    wal.appendRetire("k4", 5);
+  }
+  const std::vector<std::string> records = {
+      "remove k1 0", "replace k2 3 v3", "expire k3 7", "retire k4 5"};
+  ASSERT_THAT(readRecords(offset), testing::ElementsAreArray(records));
+  const auto file_size = boost::filesystem::file_size(file);
+  ASSERT_THROW(readRecords(file_size + 1), std::runtime_error);
+  ASSERT_TRUE(readRecords(file_size).empty());
+
+  const auto copy = directory / "copy";
+  {
+    Wal wal(copy, Wal::Options());
+    ASSERT_THAT(Wal::forEachRecord(file,
+                                   [&wal](const Wal::Record& record) {
+                                     wal.appendRecord(record);
+                                   }),
+                Eq(file_size));
+  }
+  file = copy;
+  ASSERT_THAT(boost::filesystem::file_size(copy), Eq(file_size));
+  ASSERT_THAT(readRecords(offset), testing::ElementsAreArray(records));
+}
+
+TEST_F(WalTestFixture, ConcurrentCommitsKeepAllRecords) {
+  const size_t num_threads = 4;
+  const size_t num_records = 1000;
+  {
+    Wal wal(file, Wal::Options());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i != num_threads; ++i) {
+      threads.emplace_back([&wal, i] {
+        for (size_t j = 0; j != num_records; ++j) {
+          wal.commit(wal.appendPut(std::to_string(i), std::to_string(j)));
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+  std::vector<size_t> next_value(num_threads);
+  size_t num_records_read = 0;
+  Wal::forEachRecord(file, [&](const Wal::Record& record) {
+    auto& expected = next_value[std::stoul(record.key.toString())];
+    ASSERT_THAT(record.value.toString(), Eq(std::to_string(expected)));
+    ++expected;
+    ++num_records_read;
+  });
+  ASSERT_THAT(num_records_read, Eq(num_threads * num_records));
+}
+
+}  // namespace internal
+}  // namespace multimap
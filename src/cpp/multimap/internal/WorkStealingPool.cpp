@@ -0,0 +1,155 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/internal/WorkStealingPool.hpp"
+
+#include <chrono>
+#include "multimap/internal/ThreadPool.hpp"
+
+namespace multimap {
+namespace internal {
+
+namespace {
+
+struct WorkerState {
+  const WorkStealingPool* pool = nullptr;
+  size_t index = 0;
+};
+
+thread_local WorkerState worker_state;
+
+}  // namespace
+
+const size_t WorkStealingPool::NO_AFFINITY = static_cast<size_t>(-1);
+
+WorkStealingPool::WorkStealingPool(size_t num_threads) {
+  if (num_threads == 0) {
+    num_threads = ThreadPool::getDefaultNumThreads();
+  }
+  for (size_t i = 0; i != num_threads; ++i) {
+    workers_.emplace_back(new Queue());
+  }
+  threads_.reserve(num_threads);
+  for (size_t i = 0; i != num_threads; ++i) {
+    threads_.emplace_back(&WorkStealingPool::run, this, i);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cond_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void WorkStealingPool::wait(std::future<void>* future) {
+  const auto worker = getCurrentWorker();
+  if (worker != NO_AFFINITY) {
+    while (future->wait_for(std::chrono::seconds(0)) !=
+           std::future_status::ready) {
+      if (!tryRunOne(worker)) {
+        future->wait_for(std::chrono::milliseconds(1));
+        // The task is running on another thread or has been taken by one.
+      }
+    }
+  }
+  future->get();
+}
+
+std::shared_ptr<WorkStealingPool> WorkStealingPool::getShared(
+    size_t num_threads) {
+  static std::mutex mutex;
+  static std::weak_ptr<WorkStealingPool> shared;
+  std::lock_guard<std::mutex> lock(mutex);
+  auto pool = shared.lock();
+  if (!pool) {
+    pool = std::make_shared<WorkStealingPool>(num_threads);
+    shared = pool;
+  }
+  return pool;
+}
+
+size_t WorkStealingPool::getCurrentWorkerIndex() {
+  return worker_state.pool ? worker_state.index : NO_AFFINITY;
+}
+
+void WorkStealingPool::push(std::function<void()> task, size_t affinity) {
+  auto queue = affinity == NO_AFFINITY
+                   ? &shared_
+                   : workers_[affinity % workers_.size()].get();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    MT_ASSERT_FALSE(stop_);
+    std::lock_guard<std::mutex> queue_lock(queue->mutex);
+    queue->tasks.push_back(std::move(task));
+    ++num_queued_;
+  }
+  cond_.notify_one();
+}
+
+bool WorkStealingPool::tryRunOne(size_t worker) {
+  std::function<void()> task;
+  bool found = worker != NO_AFFINITY &&
+               tryPop(workers_[worker].get(), true, &task);
+  found = found || tryPop(&shared_, true, &task);
+  const auto first_victim = worker == NO_AFFINITY ? 0 : worker + 1;
+  for (size_t i = 0; !found && i != workers_.size(); ++i) {
+    const auto victim = (first_victim + i) % workers_.size();
+    found = victim != worker && tryPop(workers_[victim].get(), false, &task);
+  }
+  if (!found) return false;
+  task();
+  // Exceptions are caught by std::packaged_task.
+  return true;
+}
+
+bool WorkStealingPool::tryPop(Queue* queue, bool front,
+                              std::function<void()>* task) {
+  std::lock_guard<std::mutex> lock(queue->mutex);
+  if (queue->tasks.empty()) return false;
+  if (front) {
+    *task = std::move(queue->tasks.front());
+    queue->tasks.pop_front();
+  } else {
+    *task = std::move(queue->tasks.back());
+    queue->tasks.pop_back();
+  }
+  --num_queued_;
+  return true;
+}
+
+void WorkStealingPool::run(size_t worker) {
+  worker_state.pool = this;
+  worker_state.index = worker;
+  while (true) {
+    if (tryRunOne(worker)) continue;
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return stop_ || num_queued_ != 0; });
+    if (stop_ && num_queued_ == 0) break;
+  }
+}
+
+size_t WorkStealingPool::getCurrentWorker() const {
+  return worker_state.pool == this ? worker_state.index : NO_AFFINITY;
+}
+
+}  // namespace internal
+}  // namespace multimap
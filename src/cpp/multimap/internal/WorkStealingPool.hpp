@@ -0,0 +1,147 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_WORK_STEALING_POOL_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_WORK_STEALING_POOL_HPP_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "multimap/thirdparty/mt/mt.hpp"
+
+namespace multimap {
+namespace internal {
+
+class WorkStealingPool : public mt::Resource {
+  // A fixed number of worker threads, each of which has a queue of its own.
+  // A task submitted with an affinity goes to the queue of worker
+  // `affinity % size()`, so that the tasks of a partition tend to run on the
+  // same thread, and other tasks go to a shared queue.  A worker takes tasks
+  // from the front of its own queue, then from the shared queue, and steals
+  // from the back of the queues of other workers before it goes to sleep.
+  //
+  // Workers that wait for a task via `wait()` execute other tasks meanwhile,
+  // so tasks can submit and wait for further tasks without a deadlock, even
+  // if all workers do so.  Exceptions thrown by a task are propagated to the
+  // caller via the future returned by `submit()`.  One pool can be shared by
+  // several maps and operations, see `getShared()`, so that their parallel
+  // work does not oversubscribe the cores.  Objects of this class are
+  // thread-safe, but must not be destroyed by one of their own tasks.
+
+ public:
+  static const size_t NO_AFFINITY;
+
+  explicit WorkStealingPool(size_t num_threads);
+  // If `num_threads` is zero, `ThreadPool::getDefaultNumThreads()` threads
+  // are started.
+
+  ~WorkStealingPool();
+  // Executes all pending tasks and joins all worker threads.
+
+  template <typename Task>
+  std::future<void> submit(Task task, size_t affinity = NO_AFFINITY) {
+    const auto packaged_task =
+        std::make_shared<std::packaged_task<void()> >(std::move(task));
+    auto future = packaged_task->get_future();
+    push([packaged_task] { (*packaged_task)(); }, affinity);
+    return future;
+  }
+
+  void wait(std::future<void>* future);
+  // Waits for `future` and calls its `get()`.  Workers of this pool execute
+  // pending tasks meanwhile, while other threads block.
+
+  template <typename Container>
+  void waitAll(Container* futures) {
+    std::exception_ptr error;
+    for (auto& future : *futures) {
+      try {
+        wait(&future);
+      } catch (...) {
+        if (!error) error = std::current_exception();
+      }
+    }
+    futures->clear();
+    if (error) std::rethrow_exception(error);
+  }
+  // Waits for all `futures`, even if some of them fail, so that tasks may
+  // refer to variables of the caller, clears them, and rethrows the first
+  // exception, if any.
+
+  template <typename Procedure>
+  void forEachIndex(size_t n, Procedure process) {
+    std::vector<std::future<void> > futures;
+    futures.reserve(n);
+    for (size_t i = 0; i != n; ++i) {
+      futures.push_back(submit([&process, i] { process(i); }, i));
+    }
+    waitAll(&futures);
+  }
+  // Calls `process(i)` for each `i` in [0, n) concurrently, with affinity
+  // `i`, and returns when all calls have returned.
+
+  size_t size() const { return workers_.size(); }
+
+  static std::shared_ptr<WorkStealingPool> getShared(size_t num_threads);
+  // Returns the process-wide pool, which is started with `num_threads`
+  // threads if it does not exist.  The pool keeps its size until the last
+  // reference is gone, after which it is started anew by the next call.
+
+  static size_t getCurrentWorkerIndex();
+  // Returns the index of the calling thread among the workers of its pool,
+  // or `NO_AFFINITY` if it is not a worker of any pool.
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()> > tasks;
+  };
+
+  void push(std::function<void()> task, size_t affinity);
+
+  bool tryRunOne(size_t worker);
+  // Executes one pending task, preferring those of `worker`, and returns
+  // false if there is none.  `worker` may be `NO_AFFINITY`.
+
+  bool tryPop(Queue* queue, bool front, std::function<void()>* task);
+
+  void run(size_t worker);
+
+  size_t getCurrentWorker() const;
+  // Returns the index of the calling thread if it is a worker of this pool,
+  // and `NO_AFFINITY` otherwise.
+
+  std::vector<std::unique_ptr<Queue> > workers_;
+  Queue shared_;
+  std::atomic<size_t> num_queued_{0};
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  bool stop_ = false;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_WORK_STEALING_POOL_HPP_INCLUDED
@@ -0,0 +1,141 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "gmock/gmock.h"
+#include "multimap/internal/ThreadPool.hpp"
+#include "multimap/internal/WorkStealingPool.hpp"
+
+namespace multimap {
+namespace internal {
+
+using testing::Eq;
+
+TEST(WorkStealingPoolTest, IsNotDefaultConstructible) {
+  ASSERT_FALSE(std::is_default_constructible<WorkStealingPool>::value);
+}
+
+TEST(WorkStealingPoolTest, IsNotCopyConstructibleOrAssignable) {
+  ASSERT_FALSE(std::is_copy_constructible<WorkStealingPool>::value);
+  ASSERT_FALSE(std::is_copy_assignable<WorkStealingPool>::value);
+}
+
+TEST(WorkStealingPoolTest, ConstructedWithZeroThreadsUsesDefaultNumThreads) {
+  WorkStealingPool pool(0);
+  ASSERT_THAT(pool.size(), Eq(ThreadPool::getDefaultNumThreads()));
+}
+
+TEST(WorkStealingPoolTest, SubmittedTasksAreExecuted) {
+  std::atomic<int> counter(0);
+  std::vector<std::future<void> > futures;
+  WorkStealingPool pool(4);
+  for (int i = 0; i != 1000; ++i) {
+    futures.push_back(pool.submit([&counter] { ++counter; }, i % 3));
+    futures.push_back(pool.submit([&counter] { ++counter; }));
+  }
+  pool.waitAll(&futures);
+  ASSERT_TRUE(futures.empty());
+  ASSERT_THAT(counter.load(), Eq(2000));
+}
+
+TEST(WorkStealingPoolTest, DestructorExecutesPendingTasks) {
+  std::atomic<int> counter(0);
+  {
+    WorkStealingPool pool(2);
+    for (int i = 0; i != 100; ++i) {
+      pool.submit([&counter] { ++counter; }, i);
+    }
+  }
+  ASSERT_THAT(counter.load(), Eq(100));
+}
+
+TEST(WorkStealingPoolTest, WaitAllRethrowsFirstExceptionAfterAllTasks) {
+  std::atomic<int> counter(0);
+  std::vector<std::future<void> > futures;
+  WorkStealingPool pool(2);
+  futures.push_back(pool.submit([] { throw std::runtime_error("error"); }));
+  for (int i = 0; i != 100; ++i) {
+    futures.push_back(pool.submit([&counter] { ++counter; }));
+  }
+  ASSERT_THROW(pool.waitAll(&futures), std::runtime_error);
+  ASSERT_THAT(counter.load(), Eq(100));
+}
+
+TEST(WorkStealingPoolTest, IdleWorkersStealTasksOfOtherWorkers) {
+  // All tasks go to the first worker, but can only finish together.
+  const int num_tasks = 4;
+  std::atomic<int> num_started(0);
+  std::atomic<int> num_finished(0);
+  WorkStealingPool pool(num_tasks);
+  std::vector<std::future<void> > futures;
+  for (int i = 0; i != num_tasks; ++i) {
+    futures.push_back(pool.submit(
+        [&] {
+          ++num_started;
+          const auto deadline =
+              std::chrono::steady_clock::now() + std::chrono::seconds(10);
+          while (num_started != num_tasks &&
+                 std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::yield();
+          }
+          num_finished += num_started == num_tasks;
+        },
+        0));
+  }
+  pool.waitAll(&futures);
+  ASSERT_THAT(num_finished.load(), Eq(num_tasks));
+}
+
+TEST(WorkStealingPoolTest, TasksCanWaitForNestedTasks) {
+  // With a single worker, the nested tasks are run by the waiting task.
+  std::atomic<int> counter(0);
+  WorkStealingPool pool(1);
+  pool.forEachIndex(10, [&](size_t) {
+    pool.forEachIndex(10, [&](size_t) { ++counter; });
+  });
+  ASSERT_THAT(counter.load(), Eq(100));
+}
+
+TEST(WorkStealingPoolTest, SharedPoolLivesAsLongAsItIsReferenced) {
+  auto pool = WorkStealingPool::getShared(3);
+  ASSERT_THAT(pool->size(), Eq(3));
+  ASSERT_THAT(WorkStealingPool::getShared(5), Eq(pool));
+  pool.reset();
+  pool = WorkStealingPool::getShared(5);
+  ASSERT_THAT(pool->size(), Eq(5));
+}
+
+TEST(WorkStealingPoolTest, WorkersKnowTheirIndex) {
+  ASSERT_THAT(WorkStealingPool::getCurrentWorkerIndex(),
+              Eq(WorkStealingPool::NO_AFFINITY));
+  WorkStealingPool pool(4);
+  std::vector<size_t> indices(100);
+  pool.forEachIndex(indices.size(), [&indices](size_t i) {
+    indices[i] = WorkStealingPool::getCurrentWorkerIndex();
+  });
+  for (const auto index : indices) {
+    ASSERT_THAT(index, testing::Lt(pool.size()));
+  }
+}
+
+}  // namespace internal
+}  // namespace multimap
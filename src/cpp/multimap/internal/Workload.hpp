@@ -0,0 +1,160 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MULTIMAP_INTERNAL_WORKLOAD_HPP_INCLUDED
+#define MULTIMAP_INTERNAL_WORKLOAD_HPP_INCLUDED
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "multimap/internal/Generator.hpp"
+#include "multimap/internal/Metrics.hpp"
+#include "multimap/Map.hpp"
+
+namespace multimap {
+namespace internal {
+
+class Workload {
+  // Loads a map with lists of values, then runs a mix of reads, which
+  // iterate a list, and writes, which append a value to a list, from
+  // several threads.  This is what multimap-workload and the `bench`
+  // command of the command-line tool run, so that their numbers compare.
+
+ public:
+  struct Options {
+    std::string distribution = "zipfian";
+    // Distribution of the keys that operations are applied to, which is
+    // "sequential", "uniform", or "zipfian".
+
+    uint64_t num_keys = 100000;
+    uint64_t list_length = 10;
+    // Number of values per key to load.
+
+    uint64_t num_ops = 1000000;
+    uint32_t num_threads = 1;
+    uint32_t value_size = 100;
+    uint64_t seed = 1;
+    double read_ratio = 0.95;
+  };
+
+  static double load(Map* map, const Options& options) {
+    const std::string value(options.value_size, 'v');
+    return runInParallel(options.num_threads, [&](uint32_t index) {
+      for (auto k = index; k < options.num_keys; k += options.num_threads) {
+        const auto key = std::to_string(k);
+        for (uint64_t v = 0; v != options.list_length; ++v) {
+          map->put(key, value);
+        }
+      }
+    });
+  }
+  // Puts `options.list_length` values for each key and returns the time
+  // elapsed in seconds.
+
+  static double run(Map* map, const Options& options, Metrics* metrics) {
+    const std::string value(options.value_size, 'v');
+    return runInParallel(options.num_threads, [&](uint32_t index) {
+      const auto generator = newKeyGenerator(options, index);
+      std::default_random_engine random_engine(options.seed + index);
+      std::bernoulli_distribution is_read(options.read_ratio);
+      const auto num_ops = options.num_ops / options.num_threads +
+                           (index < options.num_ops % options.num_threads);
+      for (uint64_t i = 0; i != num_ops; ++i) {
+        const auto key = generator->next();
+        if (is_read(random_engine)) {
+          const Metrics::Timer timer(metrics, Metrics::Operation::GET);
+          const auto iter = map->get(key);
+          while (iter && iter->hasNext()) {
+            iter->next();
+          }
+          // Keys that have not been loaded yield no iterator.
+        } else {
+          const Metrics::Timer timer(metrics, Metrics::Operation::PUT);
+          map->put(key, value);
+        }
+      }
+    });
+  }
+  // Runs `options.num_ops` operations, whose latencies are recorded in
+  // `metrics` as GET and PUT, and returns the time elapsed in seconds.
+
+  static void printThroughput(const char* phase, uint64_t num_ops,
+                              double seconds) {
+    std::printf("%-6s %12" PRIu64 " ops %10.3f s %14.0f ops/s\n", phase,
+                num_ops, seconds, num_ops / seconds);
+  }
+
+  static void printLatencies(const Metrics& metrics) {
+    const auto snapshot = metrics.getSnapshot();
+    std::printf("\n%-6s %16s %10s %10s %10s %10s %10s\n", "op", "", "avg us",
+                "p50 us", "p90 us", "p99 us", "max us");
+    printLatencies("read", snapshot.get(Metrics::Operation::GET));
+    printLatencies("write", snapshot.get(Metrics::Operation::PUT));
+  }
+
+ private:
+  static std::unique_ptr<Generator> newKeyGenerator(const Options& options,
+                                                    uint32_t thread_index) {
+    const auto seed = options.seed + thread_index;
+    if (options.distribution == "sequential") {
+      const auto start = options.num_keys / options.num_threads * thread_index;
+      return std::unique_ptr<Generator>(
+          new SequenceGenerator(start, options.num_keys));
+    }
+    if (options.distribution == "uniform") {
+      return std::unique_ptr<Generator>(
+          new RandomGenerator(options.num_keys, seed));
+    }
+    return std::unique_ptr<Generator>(
+        new ZipfianGenerator(options.num_keys, 0.99, seed));
+  }
+  // Sequential generators of different threads start at evenly spaced keys.
+
+  template <typename Function>
+  static double runInParallel(uint32_t num_threads, Function function) {
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i != num_threads; ++i) {
+      threads.emplace_back(function, i);
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double>(elapsed).count();
+  }
+  // Returns the time elapsed in seconds.
+
+  static void printLatencies(const char* name,
+                             const Metrics::Histogram& histogram) {
+    std::printf("%-6s %12" PRIu64 " ops %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+                name, histogram.count, histogram.mean() / 1e3,
+                histogram.quantile(0.5) / 1e3, histogram.quantile(0.9) / 1e3,
+                histogram.quantile(0.99) / 1e3, histogram.max / 1e3);
+  }
+};
+
+}  // namespace internal
+}  // namespace multimap
+
+#endif  // MULTIMAP_INTERNAL_WORKLOAD_HPP_INCLUDED
@@ -17,11 +17,132 @@
 
 #include "multimap/jni/common.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <stdexcept>
+#include "multimap/callables.hpp"
 
 namespace multimap {
 namespace jni {
 
+namespace {
+
+struct BuiltinPredicateIds {
+  jclass equal = nullptr;
+  jclass contains = nullptr;
+  jclass starts_with = nullptr;
+  jclass ends_with = nullptr;
+  jfieldID equal_bytes = nullptr;
+  jfieldID contains_bytes = nullptr;
+  jfieldID starts_with_bytes = nullptr;
+  jfieldID ends_with_bytes = nullptr;
+};
+
+JavaIds java_ids;
+BuiltinPredicateIds builtin_ids;
+// Both are written once in `JNI_OnLoad()` and only read afterwards.
+
+jclass findClass(JNIEnv* env, const char* class_name) {
+  const auto cls = env->FindClass(class_name);
+  mt::Check::notNull(cls, "FindClass(%s) failed", class_name);
+  const auto global = static_cast<jclass>(env->NewGlobalRef(cls));
+  mt::Check::notNull(global, "NewGlobalRef(%s) failed", class_name);
+  env->DeleteLocalRef(cls);
+  return global;
+}
+// Returns a global reference, so that the class can be used in later calls.
+
+jmethodID getMethodId(JNIEnv* env, const char* class_name, const char* name,
+                      const char* signature) {
+  const auto cls = env->FindClass(class_name);
+  mt::Check::notNull(cls, "FindClass(%s) failed", class_name);
+  const auto mid = env->GetMethodID(cls, name, signature);
+  mt::Check::notNull(mid, "GetMethodID(%s) failed", name);
+  env->DeleteLocalRef(cls);
+  return mid;
+}
+
+jfieldID getBytesFieldId(JNIEnv* env, jclass cls) {
+  const auto fid = env->GetFieldID(cls, "bytes", "[B");
+  mt::Check::notNull(fid, "GetFieldID(bytes) failed");
+  return fid;
+}
+
+void initIds(JNIEnv* env) {
+  java_ids.function_apply =
+      getMethodId(env, "io/multimap/Callables$Function", "apply",
+                  "(Ljava/nio/ByteBuffer;I)[B");
+  java_ids.less_than_apply =
+      getMethodId(env, "io/multimap/Callables$LessThan", "apply",
+                  "(Ljava/nio/ByteBuffer;ILjava/nio/ByteBuffer;I)Z");
+  java_ids.predicate_apply =
+      getMethodId(env, "io/multimap/Callables$Predicate", "apply",
+                  "(Ljava/nio/ByteBuffer;I)Z");
+  java_ids.procedure_apply =
+      getMethodId(env, "io/multimap/Callables$Procedure", "apply",
+                  "(Ljava/nio/ByteBuffer;I)V");
+  java_ids.procedure_apply_batch =
+      getMethodId(env, "io/multimap/Callables$Procedure", "applyBatch",
+                  "(Ljava/nio/ByteBuffer;[II)V");
+
+  builtin_ids.equal = findClass(env, "io/multimap/Callables$Equal");
+  builtin_ids.contains = findClass(env, "io/multimap/Callables$Contains");
+  builtin_ids.starts_with = findClass(env, "io/multimap/Callables$StartsWith");
+  builtin_ids.ends_with = findClass(env, "io/multimap/Callables$EndsWith");
+  builtin_ids.equal_bytes = getBytesFieldId(env, builtin_ids.equal);
+  builtin_ids.contains_bytes = getBytesFieldId(env, builtin_ids.contains);
+  builtin_ids.starts_with_bytes =
+      getBytesFieldId(env, builtin_ids.starts_with);
+  builtin_ids.ends_with_bytes = getBytesFieldId(env, builtin_ids.ends_with);
+}
+
+std::string getBytesField(JNIEnv* env, jobject obj, jfieldID fid) {
+  const auto array = env->GetObjectField(obj, fid);
+  auto bytes = BytesRaiiHelper(env, array).get().toString();
+  env->DeleteLocalRef(array);
+  return bytes;
+}
+
+}  // namespace
+
+const JavaIds& getJavaIds() { return java_ids; }
+
+jobject ByteBufferView::assign(const Bytes& bytes) {
+  if (buffer_ == nullptr || bytes.size() > data_.size()) {
+    if (buffer_ != nullptr) env_->DeleteLocalRef(buffer_);
+    const size_t min_size = std::max<size_t>(256, 2 * data_.size());
+    data_.resize(std::max(bytes.size(), min_size));
+    buffer_ = env_->NewDirectByteBuffer(data_.data(), data_.size());
+    mt::Check::notNull(buffer_, "NewDirectByteBuffer() failed");
+  }
+  std::memcpy(data_.data(), bytes.data(), bytes.size());
+  return buffer_;
+}
+
+std::function<bool(const Bytes&)> makeBuiltinPredicate(JNIEnv* env,
+                                                       jobject obj) {
+  // The predicates refer to a copy of the pattern owned by the closure.
+  if (env->IsInstanceOf(obj, builtin_ids.equal)) {
+    const auto pattern = getBytesField(env, obj, builtin_ids.equal_bytes);
+    return [pattern](const Bytes& value) { return Equal(pattern)(value); };
+  }
+  if (env->IsInstanceOf(obj, builtin_ids.contains)) {
+    const auto pattern = getBytesField(env, obj, builtin_ids.contains_bytes);
+    return [pattern](const Bytes& value) { return Contains(pattern)(value); };
+  }
+  if (env->IsInstanceOf(obj, builtin_ids.starts_with)) {
+    const auto pattern =
+        getBytesField(env, obj, builtin_ids.starts_with_bytes);
+    return
+        [pattern](const Bytes& value) { return StartsWith(pattern)(value); };
+  }
+  if (env->IsInstanceOf(obj, builtin_ids.ends_with)) {
+    const auto pattern = getBytesField(env, obj, builtin_ids.ends_with_bytes);
+    return [pattern](const Bytes& value) { return EndsWith(pattern)(value); };
+  }
+  return std::function<bool(const Bytes&)>();
+}
+
 void propagateOrRethrow(JNIEnv* env, const std::exception& error) {
   if (env->ExceptionOccurred()) {
     // The Java code called before has thrown an exception.
@@ -45,6 +166,12 @@ std::string makeString(JNIEnv* env, jstring string) {
   return result;
 }
 
+char* getDirectBufferAddress(JNIEnv* env, jobject buffer) {
+  const auto address = env->GetDirectBufferAddress(buffer);
+  mt::Check::notNull(address, "ByteBuffer must be direct");
+  return static_cast<char*>(address);
+}
+
 Map::Options makeMapOptions(JNIEnv* env, jobject options) {
   MT_REQUIRE_NOT_NULL(options);
   const auto cls = env->GetObjectClass(options);
@@ -75,12 +202,120 @@ Map::Options makeMapOptions(JNIEnv* env, jobject options) {
   mt::Check::notNull(fid_quiet, "GetFieldID(quiet) failed");
   opts.quiet = env->GetBooleanField(options, fid_quiet);
 
+  const auto fid_lazy = env->GetFieldID(cls, "lazy", "Z");
+  mt::Check::notNull(fid_lazy, "GetFieldID(lazy) failed");
+  opts.lazy = env->GetBooleanField(options, fid_lazy);
+
+  const auto fid_directories =
+      env->GetFieldID(cls, "directories", "[Ljava/lang/String;");
+  mt::Check::notNull(fid_directories, "GetFieldID(directories) failed");
+  const auto directories = static_cast<jobjectArray>(
+      env->GetObjectField(options, fid_directories));
+  mt::Check::notNull(directories, "GetObjectField(directories) failed");
+  for (jsize i = 0; i != env->GetArrayLength(directories); ++i) {
+    const auto directory =
+        static_cast<jstring>(env->GetObjectArrayElement(directories, i));
+    opts.directories.push_back(makeString(env, directory));
+    env->DeleteLocalRef(directory);
+  }
+
+  const auto fid_bloomFilterFalsePositiveRate =
+      env->GetFieldID(cls, "bloomFilterFalsePositiveRate", "D");
+  mt::Check::notNull(fid_bloomFilterFalsePositiveRate,
+                     "GetFieldID(bloomFilterFalsePositiveRate) failed");
+  opts.bloom_filter_false_positive_rate =
+      env->GetDoubleField(options, fid_bloomFilterFalsePositiveRate);
+
+  const auto fid_valueFilterFalsePositiveRate =
+      env->GetFieldID(cls, "valueFilterFalsePositiveRate", "D");
+  mt::Check::notNull(fid_valueFilterFalsePositiveRate,
+                     "GetFieldID(valueFilterFalsePositiveRate) failed");
+  opts.value_filter_false_positive_rate =
+      env->GetDoubleField(options, fid_valueFilterFalsePositiveRate);
+
+  const auto fid_compress = env->GetFieldID(cls, "compress", "Z");
+  mt::Check::notNull(fid_compress, "GetFieldID(compress) failed");
+  opts.compress = env->GetBooleanField(options, fid_compress);
+
+  const auto fid_frontCoding = env->GetFieldID(cls, "frontCoding", "Z");
+  mt::Check::notNull(fid_frontCoding, "GetFieldID(frontCoding) failed");
+  opts.front_coding = env->GetBooleanField(options, fid_frontCoding);
+
+  const auto fid_tailMemoryBudget =
+      env->GetFieldID(cls, "tailMemoryBudget", "J");
+  mt::Check::notNull(fid_tailMemoryBudget,
+                     "GetFieldID(tailMemoryBudget) failed");
+  opts.tail_memory_budget = env->GetLongField(options, fid_tailMemoryBudget);
+
+  const auto fid_writeAheadLog = env->GetFieldID(cls, "writeAheadLog", "Z");
+  mt::Check::notNull(fid_writeAheadLog, "GetFieldID(writeAheadLog) failed");
+  opts.write_ahead_log = env->GetBooleanField(options, fid_writeAheadLog);
+
+  const auto fid_syncWriteAheadLog =
+      env->GetFieldID(cls, "syncWriteAheadLog", "Z");
+  mt::Check::notNull(fid_syncWriteAheadLog,
+                     "GetFieldID(syncWriteAheadLog) failed");
+  opts.sync_write_ahead_log =
+      env->GetBooleanField(options, fid_syncWriteAheadLog);
+
+  const auto fid_checkpointInterval =
+      env->GetFieldID(cls, "checkpointInterval", "I");
+  mt::Check::notNull(fid_checkpointInterval,
+                     "GetFieldID(checkpointInterval) failed");
+  opts.checkpoint_interval = env->GetIntField(options, fid_checkpointInterval);
+
+  const auto fid_compactionThreshold =
+      env->GetFieldID(cls, "compactionThreshold", "D");
+  mt::Check::notNull(fid_compactionThreshold,
+                     "GetFieldID(compactionThreshold) failed");
+  opts.compaction_threshold =
+      env->GetDoubleField(options, fid_compactionThreshold);
+
+  const auto fid_compactionRate = env->GetFieldID(cls, "compactionRate", "J");
+  mt::Check::notNull(fid_compactionRate, "GetFieldID(compactionRate) failed");
+  opts.compaction_rate = env->GetLongField(options, fid_compactionRate);
+
+  const auto fid_populate = env->GetFieldID(cls, "populate", "Z");
+  mt::Check::notNull(fid_populate, "GetFieldID(populate) failed");
+  opts.populate = env->GetBooleanField(options, fid_populate);
+
+  const auto fid_hugePages = env->GetFieldID(cls, "hugePages", "Z");
+  mt::Check::notNull(fid_hugePages, "GetFieldID(hugePages) failed");
+  opts.huge_pages = env->GetBooleanField(options, fid_hugePages);
+
+  const auto fid_lockInMemory = env->GetFieldID(cls, "lockInMemory", "Z");
+  mt::Check::notNull(fid_lockInMemory, "GetFieldID(lockInMemory) failed");
+  opts.lock_in_memory = env->GetBooleanField(options, fid_lockInMemory);
+
+  const auto fid_directIo = env->GetFieldID(cls, "directIo", "Z");
+  mt::Check::notNull(fid_directIo, "GetFieldID(directIo) failed");
+  opts.direct_io = env->GetBooleanField(options, fid_directIo);
+
+  const auto fid_blockCacheSize = env->GetFieldID(cls, "blockCacheSize", "J");
+  mt::Check::notNull(fid_blockCacheSize, "GetFieldID(blockCacheSize) failed");
+  opts.block_cache_size = env->GetLongField(options, fid_blockCacheSize);
+
+  const auto fid_maxReadAhead = env->GetFieldID(cls, "maxReadAhead", "I");
+  mt::Check::notNull(fid_maxReadAhead, "GetFieldID(maxReadAhead) failed");
+  opts.max_read_ahead = env->GetIntField(options, fid_maxReadAhead);
+
+  const auto fid_numThreads = env->GetFieldID(cls, "numThreads", "I");
+  mt::Check::notNull(fid_numThreads, "GetFieldID(numThreads) failed");
+  opts.num_threads = env->GetIntField(options, fid_numThreads);
+
+  const auto fid_metrics = env->GetFieldID(cls, "metrics", "Z");
+  mt::Check::notNull(fid_metrics, "GetFieldID(metrics) failed");
+  opts.metrics = env->GetBooleanField(options, fid_metrics);
+
   const auto fid_lessThan =
       env->GetFieldID(cls, "lessThan", "Lio/multimap/Callables$LessThan;");
   mt::Check::notNull(fid_lessThan, "GetFieldID(lessThan) failed");
   const auto less_than = env->GetObjectField(options, fid_lessThan);
   if (less_than) {
     opts.compare = JavaCompare(env, less_than);
+    opts.num_threads = 1;
+    // A JNIEnv pointer is only valid in the thread that owns it, so
+    // operations calling back into Java must not use worker threads.
   }
 
   return opts;
@@ -88,3 +323,19 @@ Map::Options makeMapOptions(JNIEnv* env, jobject options) {
 
 }  // namespace jni
 }  // namespace multimap
+
+JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void*) {
+  JNIEnv* env = nullptr;
+  if (vm->GetEnv(reinterpret_cast<void**>(&env), JNI_VERSION_1_6) != JNI_OK) {
+    return JNI_ERR;
+  }
+  try {
+    multimap::jni::initIds(env);
+  } catch (std::exception&) {
+    return JNI_ERR;
+    // The pending exception of the failed lookup is thrown by the JVM.
+  }
+  return JNI_VERSION_1_6;
+}
+// Looks up classes, methods, and fields once when the library is loaded,
+// instead of each time a callable is passed from Java.
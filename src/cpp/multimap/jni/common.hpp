@@ -20,6 +20,11 @@
 
 #include <jni.h>
 #include <exception>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
 #include "multimap/Map.hpp"
 
 namespace multimap {
@@ -48,6 +53,27 @@ struct BytesRaiiHelper : private mt::Resource {
   const Bytes bytes_;
 };
 
+struct BytesArrayRaiiHelper : private mt::Resource {
+  BytesArrayRaiiHelper(JNIEnv* env, jobjectArray array) {
+    const auto size = env->GetArrayLength(array);
+    mt::Check::isZero(env->EnsureLocalCapacity(size),
+                      "EnsureLocalCapacity() failed");
+    helpers_.reserve(size);
+    bytes_.reserve(size);
+    for (jsize i = 0; i != size; ++i) {
+      helpers_.emplace_back(
+          new BytesRaiiHelper(env, env->GetObjectArrayElement(array, i)));
+      bytes_.push_back(helpers_.back()->get());
+    }
+  }
+
+  const std::vector<Bytes>& get() const { return bytes_; }
+
+ private:
+  std::vector<std::unique_ptr<BytesRaiiHelper> > helpers_;
+  std::vector<Bytes> bytes_;
+};
+
 inline jobject newByteBufferFromBytes(JNIEnv* env, const Bytes& bytes) {
   return env->NewDirectByteBuffer(const_cast<char*>(bytes.data()),
                                   bytes.size());
@@ -67,16 +93,60 @@ inline Iterator* getIteratorPtrFromByteBuffer(JNIEnv* env, jobject buffer) {
   return getPtrFromByteBuffer<Iterator>(env, buffer);
 }
 
+struct JavaIds {
+  jmethodID function_apply = nullptr;
+  jmethodID less_than_apply = nullptr;
+  jmethodID predicate_apply = nullptr;
+  jmethodID procedure_apply = nullptr;
+  jmethodID procedure_apply_batch = nullptr;
+};
+// Method ids of the abstract classes in `io.multimap.Callables`, which
+// dispatch to the overriding methods of the objects they are called on.
+
+const JavaIds& getJavaIds();
+// Returns the ids that have been looked up once in `JNI_OnLoad()`.
+
+class ByteBufferView {
+  // A direct java.nio.ByteBuffer over native memory that is reused for a
+  // sequence of callbacks.  Each byte sequence is copied into the memory,
+  // which is cheaper than constructing a new buffer via JNI each time and
+  // does not leave one local reference per sequence behind.
+
+ public:
+  explicit ByteBufferView(JNIEnv* env) : env_(env) {}
+
+  jobject assign(const Bytes& bytes);
+  // Copies `bytes` to the beginning of the buffer, which grows if needed,
+  // and returns the buffer.  Java code must only read the first
+  // `bytes.size()` bytes and only until the next call.
+
+ private:
+  JNIEnv* env_;
+  std::vector<char> data_;
+  jobject buffer_ = nullptr;
+};
+
 class JavaCallable {
  public:
-  JavaCallable(JNIEnv* env, jobject obj, const char* signature)
-      : env_(env), obj_(obj) {
-    const auto cls = env->GetObjectClass(obj);
-    mid_ = env->GetMethodID(cls, "call", signature);
-    mt::Check::notNull(mid_, "GetMethodID() failed");
-  }
+  JavaCallable(JNIEnv* env, jobject obj, jmethodID mid)
+      : env_(env), obj_(obj), mid_(mid) {}
 
  protected:
+  void checkForException(const char* kind) const {
+    if (env_->ExceptionOccurred()) {
+      throw std::runtime_error(std::string("Exception in ") + kind +
+                               " passed via JNI");
+      // This exception is to escape from the for-each loop.
+      // Since env->ExceptionClear() is not called the actual exception
+      // is passed to the Java exception-handling process of the Java client.
+    }
+  }
+
+  std::shared_ptr<ByteBufferView> newView() const {
+    return std::make_shared<ByteBufferView>(env_);
+  }
+  // Views are shared, because callables are copied into std::function.
+
   JNIEnv* env_;
   jobject obj_;
   jmethodID mid_;
@@ -87,23 +157,22 @@ class JavaCompare : public JavaCallable {
   typedef JavaCallable Base;
 
   JavaCompare(JNIEnv* env, jobject obj)
-      : Base(env, obj, "(Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;)Z") {}
+      : Base(env, obj, getJavaIds().less_than_apply),
+        lhs_(newView()),
+        rhs_(newView()) {}
 
   bool operator()(const multimap::Bytes& lhs,
                   const multimap::Bytes& rhs) const {
-    // Note: java.nio.ByteBuffer cannot wrap a pointer to const void.
-    // However, on Java side we will call ByteBuffer.asReadOnlyBuffer().
-    const auto result =
-        env_->CallBooleanMethod(obj_, mid_, newByteBufferFromBytes(env_, lhs),
-                                newByteBufferFromBytes(env_, rhs));
-    if (env_->ExceptionOccurred()) {
-      throw std::runtime_error("Exception in comparator passed via JNI");
-      // This exception is to escape from the for-each loop.
-      // Since env->ExceptionClear() is not called the actual exception
-      // is passed to the Java exception-handling process of the Java client.
-    }
+    const auto result = env_->CallBooleanMethod(
+        obj_, mid_, lhs_->assign(lhs), static_cast<jint>(lhs.size()),
+        rhs_->assign(rhs), static_cast<jint>(rhs.size()));
+    checkForException("comparator");
     return result;
   }
+
+ private:
+  std::shared_ptr<ByteBufferView> lhs_;
+  std::shared_ptr<ByteBufferView> rhs_;
 };
 
 class JavaFunction : public JavaCallable {
@@ -111,45 +180,51 @@ class JavaFunction : public JavaCallable {
   typedef JavaCallable Base;
 
   JavaFunction(JNIEnv* env, jobject obj)
-      : Base(env, obj, "(Ljava/nio/ByteBuffer;)[B") {}
+      : Base(env, obj, getJavaIds().function_apply), view_(newView()) {}
 
   std::string operator()(const multimap::Bytes& bytes) const {
-    // Note: java.nio.ByteBuffer cannot wrap a pointer to const void.
-    // However, on Java side we will call ByteBuffer.asReadOnlyBuffer().
-    const auto result =
-        env_->CallObjectMethod(obj_, mid_, newByteBufferFromBytes(env_, bytes));
-    if (env_->ExceptionOccurred()) {
-      throw std::runtime_error("Exception in function passed via JNI");
-      // This exception is to escape from the for-each loop.
-      // Since env->ExceptionClear() is not called the actual exception
-      // is passed to the Java exception-handling process of the Java client.
-    }
+    const auto result = env_->CallObjectMethod(
+        obj_, mid_, view_->assign(bytes), static_cast<jint>(bytes.size()));
+    checkForException("function");
     // result is a jbyteArray that is copied into a std::string.
-    return (result != nullptr) ? BytesRaiiHelper(env_, result).get().toString()
-                               : std::string();
+    if (result == nullptr) return std::string();
+    auto copy = BytesRaiiHelper(env_, result).get().toString();
+    env_->DeleteLocalRef(result);
+    return copy;
   }
+
+ private:
+  std::shared_ptr<ByteBufferView> view_;
 };
 
+std::function<bool(const Bytes&)> makeBuiltinPredicate(JNIEnv* env,
+                                                       jobject obj);
+// Returns the native counterpart of `obj` if it is an instance of one of the
+// built-in predicates of class `io.multimap.Callables`, or an empty function.
+
 class JavaPredicate : public JavaCallable {
  public:
   typedef JavaCallable Base;
 
   JavaPredicate(JNIEnv* env, jobject obj)
-      : Base(env, obj, "(Ljava/nio/ByteBuffer;)Z") {}
+      : Base(env, obj, getJavaIds().predicate_apply),
+        builtin_(makeBuiltinPredicate(env, obj)) {
+    if (!builtin_) view_ = newView();
+  }
 
   bool operator()(const multimap::Bytes& bytes) const {
-    // Note: java.nio.ByteBuffer cannot wrap a pointer to const void.
-    // However, on Java side we will call ByteBuffer.asReadOnlyBuffer().
+    if (builtin_) return builtin_(bytes);
     const auto result = env_->CallBooleanMethod(
-        obj_, mid_, newByteBufferFromBytes(env_, bytes));
-    if (env_->ExceptionOccurred()) {
-      throw std::runtime_error("Exception in predicate passed via JNI");
-      // This exception is to escape from the for-each loop.
-      // Since env->ExceptionClear() is not called the actual exception
-      // is passed to the Java exception-handling process of the Java client.
-    }
+        obj_, mid_, view_->assign(bytes), static_cast<jint>(bytes.size()));
+    checkForException("predicate");
     return result;
   }
+
+ private:
+  std::function<bool(const Bytes&)> builtin_;
+  // Built-in predicates are evaluated without calling back into Java.
+
+  std::shared_ptr<ByteBufferView> view_;
 };
 
 class JavaProcedure : public JavaCallable {
@@ -157,27 +232,102 @@ class JavaProcedure : public JavaCallable {
   typedef JavaCallable Base;
 
   JavaProcedure(JNIEnv* env, jobject obj)
-      : Base(env, obj, "(Ljava/nio/ByteBuffer;)V") {}
+      : Base(env, obj, getJavaIds().procedure_apply), view_(newView()) {}
 
   void operator()(const multimap::Bytes& bytes) const {
-    // Note: java.nio.ByteBuffer cannot wrap a pointer to const void.
-    // However, on Java side we will call ByteBuffer.asReadOnlyBuffer().
-    env_->CallVoidMethod(obj_, mid_, newByteBufferFromBytes(env_, bytes));
-    if (env_->ExceptionOccurred()) {
-      throw std::runtime_error("Exception in procedure passed via JNI");
-      // This exception is to escape from the for-each loop.
-      // Since env->ExceptionClear() is not called the actual exception
-      // is passed to the Java exception-handling process of the Java client.
+    env_->CallVoidMethod(obj_, mid_, view_->assign(bytes),
+                         static_cast<jint>(bytes.size()));
+    checkForException("procedure");
+  }
+
+ private:
+  std::shared_ptr<ByteBufferView> view_;
+};
+
+class JavaBatchProcedure : public JavaCallable {
+  // Collects byte sequences in a native buffer and passes them to Java via
+  // `Callables.Procedure.callBatch()`, which saves one JNI transition and
+  // one direct byte buffer per sequence.  Since objects of this class have
+  // state, they must be passed to for-each functions via `std::ref()`.
+
+ public:
+  typedef JavaCallable Base;
+
+  static const size_t MAX_BATCH_SIZE = mt::KiB(64);
+  static const size_t MAX_NUM_SEQUENCES = 1024;
+
+  JavaBatchProcedure(JNIEnv* env, jobject obj)
+      : Base(env, obj, getJavaIds().procedure_apply_batch),
+        offsets_array_(env->NewIntArray(MAX_NUM_SEQUENCES + 1)) {
+    mt::Check::notNull(offsets_array_, "NewIntArray() failed");
+    data_.reserve(MAX_BATCH_SIZE);
+    offsets_.reserve(MAX_NUM_SEQUENCES + 1);
+    offsets_.push_back(0);
+  }
+
+  void operator()(const multimap::Bytes& bytes) {
+    if (data_.size() + bytes.size() > MAX_BATCH_SIZE) {
+      flush();
+      // A sequence larger than the limit is passed as a batch of its own.
+    }
+    data_.insert(data_.end(), bytes.begin(), bytes.end());
+    offsets_.push_back(data_.size());
+    if (offsets_.size() == MAX_NUM_SEQUENCES + 1) {
+      flush();
     }
   }
+
+  void flush() {
+    const jsize count = offsets_.size() - 1;
+    if (count == 0) return;
+    env_->SetIntArrayRegion(offsets_array_, 0, offsets_.size(),
+                            offsets_.data());
+    if (buffer_ == nullptr || buffer_data_ != data_.data() ||
+        buffer_size_ != data_.capacity()) {
+      // Only a sequence larger than the limit reallocates the memory.
+      if (buffer_ != nullptr) env_->DeleteLocalRef(buffer_);
+      buffer_data_ = data_.data();
+      buffer_size_ = data_.capacity();
+      // Note: java.nio.ByteBuffer cannot wrap a pointer to const void.
+      buffer_ = env_->NewDirectByteBuffer(data_.data(), data_.capacity());
+      mt::Check::notNull(buffer_, "NewDirectByteBuffer() failed");
+    }
+    env_->CallVoidMethod(obj_, mid_, buffer_, offsets_array_, count);
+    data_.clear();
+    offsets_.resize(1);
+    checkForException("procedure");
+  }
+  // Must be called after the last sequence has been passed.
+
+ private:
+  jintArray offsets_array_;
+  std::vector<char> data_;
+  std::vector<jint> offsets_;
+  jobject buffer_ = nullptr;
+  const char* buffer_data_ = nullptr;
+  size_t buffer_size_ = 0;
+  // The direct buffer over `data_` is reused for all batches.
 };
 
+inline void writeSize(uint32_t size, bool big_endian, char* target) {
+  const auto bytes = reinterpret_cast<unsigned char*>(target);
+  for (int i = 0; i != 4; ++i) {
+    const auto shift = big_endian ? 24 - 8 * i : 8 * i;
+    bytes[i] = static_cast<unsigned char>(size >> shift);
+  }
+}
+// Writes `size` as the 4-byte int that precedes each value in buffers
+// filled for `java.nio.ByteBuffer.getInt()`.
+
 void propagateOrRethrow(JNIEnv* env, const std::exception& error);
 
 void throwJavaException(JNIEnv* env, const char* message);
 
 std::string makeString(JNIEnv* env, jstring string);
 
+char* getDirectBufferAddress(JNIEnv* env, jobject buffer);
+// Throws if `buffer` is not a direct java.nio.ByteBuffer.
+
 Map::Options makeMapOptions(JNIEnv* env, jobject options);
 
 }  // namespace jni
@@ -0,0 +1,29 @@
+/* DO NOT EDIT THIS FILE - it is machine generated */
+#include <jni.h>
+/* Header for class io_multimap_EntryScanner_Native */
+
+#ifndef _Included_io_multimap_EntryScanner_Native
+#define _Included_io_multimap_EntryScanner_Native
+#ifdef __cplusplus
+extern "C" {
+#endif
+/*
+ * Class:     io_multimap_EntryScanner_Native
+ * Method:    next
+ * Signature: (Ljava/nio/ByteBuffer;)Ljava/nio/ByteBuffer;
+ */
+JNIEXPORT jobject JNICALL Java_io_multimap_EntryScanner_00024Native_next
+  (JNIEnv *, jclass, jobject);
+
+/*
+ * Class:     io_multimap_EntryScanner_Native
+ * Method:    close
+ * Signature: (Ljava/nio/ByteBuffer;)V
+ */
+JNIEXPORT void JNICALL Java_io_multimap_EntryScanner_00024Native_close
+  (JNIEnv *, jclass, jobject);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -31,6 +31,14 @@ JNIEXPORT jboolean JNICALL Java_io_multimap_Iterator_00024Native_hasNext
 JNIEXPORT jobject JNICALL Java_io_multimap_Iterator_00024Native_next
   (JNIEnv *, jclass, jobject);
 
+/*
+ * Class:     io_multimap_Iterator_Native
+ * Method:    nextBatch
+ * Signature: (Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;IIZ)J
+ */
+JNIEXPORT jlong JNICALL Java_io_multimap_Iterator_00024Native_nextBatch
+  (JNIEnv *, jclass, jobject, jobject, jint, jint, jboolean);
+
 /*
  * Class:     io_multimap_Iterator_Native
  * Method:    peekNext
@@ -39,6 +47,14 @@ JNIEXPORT jobject JNICALL Java_io_multimap_Iterator_00024Native_next
 JNIEXPORT jobject JNICALL Java_io_multimap_Iterator_00024Native_peekNext
   (JNIEnv *, jclass, jobject);
 
+/*
+ * Class:     io_multimap_Iterator_Native
+ * Method:    skip
+ * Signature: (Ljava/nio/ByteBuffer;J)J
+ */
+JNIEXPORT jlong JNICALL Java_io_multimap_Iterator_00024Native_skip
+  (JNIEnv *, jclass, jobject, jlong);
+
 /*
  * Class:     io_multimap_Iterator_Native
  * Method:    close
@@ -23,6 +23,30 @@ JNIEXPORT jobject JNICALL Java_io_multimap_Map_00024Native_newMap
 JNIEXPORT void JNICALL Java_io_multimap_Map_00024Native_put
   (JNIEnv *, jclass, jobject, jbyteArray, jbyteArray);
 
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    putDirect
+ * Signature: (Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;IILjava/nio/ByteBuffer;II)V
+ */
+JNIEXPORT void JNICALL Java_io_multimap_Map_00024Native_putDirect
+  (JNIEnv *, jclass, jobject, jobject, jint, jint, jobject, jint, jint);
+
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    putAll
+ * Signature: (Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;IIZ)I
+ */
+JNIEXPORT jint JNICALL Java_io_multimap_Map_00024Native_putAll
+  (JNIEnv *, jclass, jobject, jobject, jint, jint, jboolean);
+
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    write
+ * Signature: (Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;IZ)V
+ */
+JNIEXPORT void JNICALL Java_io_multimap_Map_00024Native_write
+  (JNIEnv *, jclass, jobject, jobject, jint, jboolean);
+
 /*
  * Class:     io_multimap_Map_Native
  * Method:    get
@@ -39,6 +63,38 @@ JNIEXPORT jobject JNICALL Java_io_multimap_Map_00024Native_get
 JNIEXPORT jboolean JNICALL Java_io_multimap_Map_00024Native_contains
   (JNIEnv *, jclass, jobject, jbyteArray);
 
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    getMany
+ * Signature: (Ljava/nio/ByteBuffer;[[B)[Ljava/nio/ByteBuffer;
+ */
+JNIEXPORT jobjectArray JNICALL Java_io_multimap_Map_00024Native_getMany
+  (JNIEnv *, jclass, jobject, jobjectArray);
+
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    containsMany
+ * Signature: (Ljava/nio/ByteBuffer;[[B)[Z
+ */
+JNIEXPORT jbooleanArray JNICALL Java_io_multimap_Map_00024Native_containsMany
+  (JNIEnv *, jclass, jobject, jobjectArray);
+
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    getManyInto
+ * Signature: (Ljava/nio/ByteBuffer;[[BILjava/nio/ByteBuffer;IIZ)J
+ */
+JNIEXPORT jlong JNICALL Java_io_multimap_Map_00024Native_getManyInto
+  (JNIEnv *, jclass, jobject, jobjectArray, jint, jobject, jint, jint, jboolean);
+
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    newEntryScanner
+ * Signature: (Ljava/nio/ByteBuffer;I)Ljava/nio/ByteBuffer;
+ */
+JNIEXPORT jobject JNICALL Java_io_multimap_Map_00024Native_newEntryScanner
+  (JNIEnv *, jclass, jobject, jint);
+
 /*
  * Class:     io_multimap_Map_Native
  * Method:    remove
@@ -151,6 +207,22 @@ JNIEXPORT void JNICALL Java_io_multimap_Map_00024Native_forEachValue
 JNIEXPORT void JNICALL Java_io_multimap_Map_00024Native_getStats
   (JNIEnv *, jclass, jobject, jobject);
 
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    getMetrics
+ * Signature: (Ljava/nio/ByteBuffer;)[J
+ */
+JNIEXPORT jlongArray JNICALL Java_io_multimap_Map_00024Native_getMetrics
+  (JNIEnv *, jclass, jobject);
+
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    getMetricNames
+ * Signature: ()[Ljava/lang/String;
+ */
+JNIEXPORT jobjectArray JNICALL Java_io_multimap_Map_00024Native_getMetricNames
+  (JNIEnv *, jclass);
+
 /*
  * Class:     io_multimap_Map_Native
  * Method:    isReadOnly
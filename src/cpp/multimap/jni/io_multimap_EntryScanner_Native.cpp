@@ -0,0 +1,54 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "multimap/jni/generated/io_multimap_EntryScanner_Native.h"
+
+#include "multimap/jni/common.hpp"
+#include "multimap/EntryScanner.hpp"
+
+/*
+ * Class:     io_multimap_EntryScanner_Native
+ * Method:    next
+ * Signature: (Ljava/nio/ByteBuffer;)Ljava/nio/ByteBuffer;
+ */
+JNIEXPORT jobject JNICALL
+Java_io_multimap_EntryScanner_00024Native_next(JNIEnv* env, jclass,
+                                               jobject self) {
+  try {
+    const auto scanner =
+        multimap::jni::getPtrFromByteBuffer<multimap::EntryScanner>(env, self);
+    if (const auto batch = scanner->next()) {
+      // Note: java.nio.ByteBuffer cannot wrap a pointer to const void.
+      return env->NewDirectByteBuffer(const_cast<char*>(batch->data()),
+                                      batch->size());
+    }
+  } catch (std::exception& error) {
+    multimap::jni::throwJavaException(env, error.what());
+  }
+  return nullptr;
+}
+
+/*
+ * Class:     io_multimap_EntryScanner_Native
+ * Method:    close
+ * Signature: (Ljava/nio/ByteBuffer;)V
+ */
+JNIEXPORT void JNICALL
+Java_io_multimap_EntryScanner_00024Native_close(JNIEnv* env, jclass,
+                                                jobject self) {
+  delete multimap::jni::getPtrFromByteBuffer<multimap::EntryScanner>(env, self);
+}
@@ -17,6 +17,10 @@
 
 #include "multimap/jni/generated/io_multimap_Iterator_Native.h"
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
 #include "multimap/jni/common.hpp"
 #include "multimap/Map.hpp"
 
@@ -53,6 +57,43 @@ Java_io_multimap_Iterator_00024Native_next(JNIEnv* env, jclass, jobject self) {
       env, multimap::jni::getIteratorPtrFromByteBuffer(env, self)->next());
 }
 
+/*
+ * Class:     io_multimap_Iterator_Native
+ * Method:    nextBatch
+ * Signature: (Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;IIZ)J
+ */
+JNIEXPORT jlong JNICALL Java_io_multimap_Iterator_00024Native_nextBatch(
+    JNIEnv* env, jclass, jobject self, jobject jdst, jint offset, jint size,
+    jboolean big_endian) {
+  // Returns the number of values in the upper and the number of bytes
+  // written in the lower 32 bits, so that one call does the whole transfer.
+  uint64_t num_values = 0;
+  uint64_t num_bytes = 0;
+  try {
+    auto iter = multimap::jni::getIteratorPtrFromByteBuffer(env, self);
+    char* target = multimap::jni::getDirectBufferAddress(env, jdst) + offset;
+    const uint64_t capacity = size;
+    while (iter->hasNext()) {
+      const auto value = iter->peekNext();
+      const auto required = 4 + value.size();
+      if (capacity - num_bytes < required) {
+        mt::Check::notZero(num_values,
+                           "ByteBuffer too small for next value of size %u",
+                           static_cast<unsigned>(value.size()));
+        break;
+      }
+      multimap::jni::writeSize(value.size(), big_endian, target + num_bytes);
+      std::memcpy(target + num_bytes + 4, value.data(), value.size());
+      num_bytes += required;
+      num_values++;
+      iter->next();
+    }
+  } catch (std::exception& error) {
+    multimap::jni::throwJavaException(env, error.what());
+  }
+  return (num_values << 32) | num_bytes;
+}
+
 /*
  * Class:     io_multimap_Iterator_Native
  * Method:    peekNext
@@ -65,6 +106,19 @@ Java_io_multimap_Iterator_00024Native_peekNext(JNIEnv* env, jclass,
       env, multimap::jni::getIteratorPtrFromByteBuffer(env, self)->peekNext());
 }
 
+/*
+ * Class:     io_multimap_Iterator_Native
+ * Method:    skip
+ * Signature: (Ljava/nio/ByteBuffer;J)J
+ */
+JNIEXPORT jlong JNICALL Java_io_multimap_Iterator_00024Native_skip(
+    JNIEnv* env, jclass, jobject self, jlong n) {
+  const auto max = std::numeric_limits<uint32_t>::max();
+  const auto num_values = static_cast<uint32_t>(std::min<jlong>(n, max));
+  return multimap::jni::getIteratorPtrFromByteBuffer(env, self)->skip(
+      num_values);
+}
+
 /*
  * Class:     io_multimap_Iterator_Native
  * Method:    close
@@ -17,8 +17,11 @@
 
 #include "multimap/jni/generated/io_multimap_Map_Native.h"
 
+#include <cstring>
+
 #include "multimap/jni/common.hpp"
 #include "multimap/callables.hpp"
+#include "multimap/EntryScanner.hpp"
 #include "multimap/Map.hpp"
 
 // Bug in javah.
@@ -46,6 +49,28 @@ inline multimap::Map* getMapPtrFromByteBuffer(JNIEnv* env, jobject buffer) {
   return multimap::jni::getPtrFromByteBuffer<multimap::Map>(env, buffer);
 }
 
+uint32_t readSize(const char* data, bool big_endian) {
+  const auto bytes = reinterpret_cast<const unsigned char*>(data);
+  if (big_endian) {
+    return (uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) |
+           (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]);
+  }
+  return (uint32_t(bytes[3]) << 24) | (uint32_t(bytes[2]) << 16) |
+         (uint32_t(bytes[1]) << 8) | uint32_t(bytes[0]);
+}
+
+multimap::Bytes readRecordField(const char** pos, const char* end,
+                                bool big_endian) {
+  mt::Check::isTrue(end - *pos >= 4, "Incomplete record in ByteBuffer");
+  const auto size = readSize(*pos, big_endian);
+  *pos += 4;
+  mt::Check::isTrue(static_cast<size_t>(end - *pos) >= size,
+                    "Incomplete record in ByteBuffer");
+  const multimap::Bytes field(*pos, size);
+  *pos += size;
+  return field;
+}
+
 }  // namespace
 
 /*
@@ -84,6 +109,74 @@ Java_io_multimap_Map_00024Native_put(JNIEnv* env, jclass, jobject self,
   }
 }
 
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    putDirect
+ * Signature: (Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;IILjava/nio/ByteBuffer;II)V
+ */
+JNIEXPORT void JNICALL Java_io_multimap_Map_00024Native_putDirect(
+    JNIEnv* env, jclass, jobject self, jobject jkey, jint key_offset,
+    jint key_size, jobject jvalue, jint value_offset, jint value_size) {
+  try {
+    const auto key_data = multimap::jni::getDirectBufferAddress(env, jkey);
+    const auto value_data = multimap::jni::getDirectBufferAddress(env, jvalue);
+    const multimap::Bytes key(key_data + key_offset, key_size);
+    const multimap::Bytes value(value_data + value_offset, value_size);
+    getMapPtrFromByteBuffer(env, self)->put(key, value);
+  } catch (std::exception& error) {
+    multimap::jni::throwJavaException(env, error.what());
+  }
+}
+
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    putAll
+ * Signature: (Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;IIZ)I
+ */
+JNIEXPORT jint JNICALL Java_io_multimap_Map_00024Native_putAll(
+    JNIEnv* env, jclass, jobject self, jobject jrecords, jint offset,
+    jint size, jboolean big_endian) {
+  jint num_records = 0;
+  try {
+    auto map = getMapPtrFromByteBuffer(env, self);
+    const char* pos =
+        multimap::jni::getDirectBufferAddress(env, jrecords) + offset;
+    const char* end = pos + size;
+    while (pos != end) {
+      const auto key = readRecordField(&pos, end, big_endian);
+      const auto value = readRecordField(&pos, end, big_endian);
+      map->put(key, value);
+      ++num_records;
+    }
+  } catch (std::exception& error) {
+    multimap::jni::throwJavaException(env, error.what());
+  }
+  return num_records;
+}
+
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    write
+ * Signature: (Ljava/nio/ByteBuffer;Ljava/nio/ByteBuffer;IZ)V
+ */
+JNIEXPORT void JNICALL Java_io_multimap_Map_00024Native_write(
+    JNIEnv* env, jclass, jobject self, jobject jrecords, jint size,
+    jboolean big_endian) {
+  try {
+    const char* pos = multimap::jni::getDirectBufferAddress(env, jrecords);
+    const char* end = pos + size;
+    multimap::WriteBatch batch;
+    while (pos != end) {
+      const auto key = readRecordField(&pos, end, big_endian);
+      const auto value = readRecordField(&pos, end, big_endian);
+      batch.put(key, value);
+    }
+    getMapPtrFromByteBuffer(env, self)->write(batch);
+  } catch (std::exception& error) {
+    multimap::jni::throwJavaException(env, error.what());
+  }
+}
+
 /*
  * Class:     io_multimap_Map_Native
  * Method:    get
@@ -112,6 +205,129 @@ Java_io_multimap_Map_00024Native_contains(JNIEnv* env, jclass, jobject self,
   return getMapPtrFromByteBuffer(env, self)->contains(key.get());
 }
 
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    getMany
+ * Signature: (Ljava/nio/ByteBuffer;[[B)[Ljava/nio/ByteBuffer;
+ */
+JNIEXPORT jobjectArray JNICALL
+Java_io_multimap_Map_00024Native_getMany(JNIEnv* env, jclass, jobject self,
+                                         jobjectArray jkeys) {
+  multimap::jni::BytesArrayRaiiHelper keys(env, jkeys);
+  try {
+    auto iters = getMapPtrFromByteBuffer(env, self)->getMany(keys.get());
+    const auto cls = env->FindClass("java/nio/ByteBuffer");
+    mt::Check::notNull(cls, "FindClass() failed");
+    const auto array = env->NewObjectArray(iters.size(), cls, nullptr);
+    mt::Check::notNull(array, "NewObjectArray() failed");
+    for (size_t i = 0; i != iters.size(); ++i) {
+      if (iters[i] && iters[i]->hasNext()) {
+        const auto buffer =
+            multimap::jni::newByteBufferFromPtr(env, iters[i].release());
+        env->SetObjectArrayElement(array, i, buffer);
+        env->DeleteLocalRef(buffer);
+      }
+    }
+    return array;
+  } catch (std::exception& error) {
+    multimap::jni::throwJavaException(env, error.what());
+  }
+  return nullptr;
+}
+
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    containsMany
+ * Signature: (Ljava/nio/ByteBuffer;[[B)[Z
+ */
+JNIEXPORT jbooleanArray JNICALL
+Java_io_multimap_Map_00024Native_containsMany(JNIEnv* env, jclass,
+                                              jobject self,
+                                              jobjectArray jkeys) {
+  multimap::jni::BytesArrayRaiiHelper keys(env, jkeys);
+  try {
+    const auto results =
+        getMapPtrFromByteBuffer(env, self)->containsMany(keys.get());
+    const std::vector<jboolean> jresults(results.begin(), results.end());
+    const auto array = env->NewBooleanArray(jresults.size());
+    mt::Check::notNull(array, "NewBooleanArray() failed");
+    env->SetBooleanArrayRegion(array, 0, jresults.size(), jresults.data());
+    return array;
+  } catch (std::exception& error) {
+    multimap::jni::throwJavaException(env, error.what());
+  }
+  return nullptr;
+}
+
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    getManyInto
+ * Signature: (Ljava/nio/ByteBuffer;[[BILjava/nio/ByteBuffer;IIZ)J
+ */
+JNIEXPORT jlong JNICALL Java_io_multimap_Map_00024Native_getManyInto(
+    JNIEnv* env, jclass, jobject self, jobjectArray jkeys, jint from_index,
+    jobject jdst, jint offset, jint size, jboolean big_endian) {
+  // Returns the number of keys in the upper and the number of bytes
+  // written in the lower 32 bits, so that one call does the whole transfer.
+  uint64_t num_keys = 0;
+  uint64_t num_bytes = 0;
+  multimap::jni::BytesArrayRaiiHelper keys(env, jkeys);
+  try {
+    const std::vector<multimap::Bytes> remaining_keys(
+        keys.get().begin() + from_index, keys.get().end());
+    const auto iters =
+        getMapPtrFromByteBuffer(env, self)->getMany(remaining_keys);
+    char* target = multimap::jni::getDirectBufferAddress(env, jdst) + offset;
+    const uint64_t capacity = size;
+    for (const auto& iter : iters) {
+      uint64_t required = 4;
+      const uint32_t num_values = iter ? iter->available() : 0;
+      if (capacity - num_bytes >= required) {
+        multimap::jni::writeSize(num_values, big_endian, target + num_bytes);
+        while (iter && iter->hasNext()) {
+          const auto value = iter->next();
+          if (capacity - num_bytes - required < 4 + value.size()) {
+            required = capacity + 1;  // Does not fit.
+            break;
+          }
+          multimap::jni::writeSize(value.size(), big_endian,
+                                   target + num_bytes + required);
+          std::memcpy(target + num_bytes + required + 4, value.data(),
+                      value.size());
+          required += 4 + value.size();
+        }
+      }
+      if (capacity - num_bytes < required) {
+        mt::Check::notZero(num_keys,
+                           "ByteBuffer too small for values of next key");
+        break;
+      }
+      num_bytes += required;
+      num_keys++;
+    }
+  } catch (std::exception& error) {
+    multimap::jni::throwJavaException(env, error.what());
+  }
+  return (num_keys << 32) | num_bytes;
+}
+
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    newEntryScanner
+ * Signature: (Ljava/nio/ByteBuffer;I)Ljava/nio/ByteBuffer;
+ */
+JNIEXPORT jobject JNICALL Java_io_multimap_Map_00024Native_newEntryScanner(
+    JNIEnv* env, jclass, jobject self, jint num_threads) {
+  try {
+    const auto scanner = new multimap::EntryScanner(
+        *getMapPtrFromByteBuffer(env, self), num_threads);
+    return multimap::jni::newByteBufferFromPtr(env, scanner);
+  } catch (std::exception& error) {
+    multimap::jni::throwJavaException(env, error.what());
+  }
+  return nullptr;
+}
+
 /*
  * Class:     io_multimap_Map_Native
  * Method:    remove
@@ -308,8 +524,9 @@ JNIEXPORT void JNICALL
 Java_io_multimap_Map_00024Native_forEachKey(JNIEnv* env, jclass, jobject self,
                                             jobject jprocedure) {
   try {
-    getMapPtrFromByteBuffer(env, self)
-        ->forEachKey(multimap::jni::JavaProcedure(env, jprocedure));
+    multimap::jni::JavaBatchProcedure procedure(env, jprocedure);
+    getMapPtrFromByteBuffer(env, self)->forEachKey(std::ref(procedure));
+    procedure.flush();
   } catch (std::exception& error) {
     multimap::jni::propagateOrRethrow(env, error);
   }
@@ -326,8 +543,10 @@ Java_io_multimap_Map_00024Native_forEachValue(JNIEnv* env, jclass, jobject self,
                                               jobject jprocedure) {
   multimap::jni::BytesRaiiHelper key(env, jkey);
   try {
-    getMapPtrFromByteBuffer(env, self)->forEachValue(
-        key.get(), multimap::jni::JavaProcedure(env, jprocedure));
+    multimap::jni::JavaBatchProcedure procedure(env, jprocedure);
+    getMapPtrFromByteBuffer(env, self)
+        ->forEachValue(key.get(), std::ref(procedure));
+    procedure.flush();
   } catch (std::exception& error) {
     multimap::jni::propagateOrRethrow(env, error);
   }
@@ -350,6 +569,42 @@ Java_io_multimap_Map_00024Native_getStats(JNIEnv* env, jclass, jobject self,
                       env->NewDirectByteBuffer(&stats, sizeof stats));
 }
 
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    getMetrics
+ * Signature: (Ljava/nio/ByteBuffer;)[J
+ */
+JNIEXPORT jlongArray JNICALL
+Java_io_multimap_Map_00024Native_getMetrics(JNIEnv* env, jclass, jobject self) {
+  const auto metrics =
+      getMapPtrFromByteBuffer(env, self)->getMetrics().toVector();
+  const std::vector<jlong> jmetrics(metrics.begin(), metrics.end());
+  const auto array = env->NewLongArray(jmetrics.size());
+  mt::Check::notNull(array, "NewLongArray() failed");
+  env->SetLongArrayRegion(array, 0, jmetrics.size(), jmetrics.data());
+  return array;
+}
+
+/*
+ * Class:     io_multimap_Map_Native
+ * Method:    getMetricNames
+ * Signature: ()[Ljava/lang/String;
+ */
+JNIEXPORT jobjectArray JNICALL
+Java_io_multimap_Map_00024Native_getMetricNames(JNIEnv* env, jclass) {
+  const auto& names = multimap::Map::Metrics::names();
+  const auto cls = env->FindClass("java/lang/String");
+  mt::Check::notNull(cls, "FindClass() failed");
+  const auto array = env->NewObjectArray(names.size(), cls, nullptr);
+  mt::Check::notNull(array, "NewObjectArray() failed");
+  for (size_t i = 0; i != names.size(); ++i) {
+    const auto name = env->NewStringUTF(names[i].c_str());
+    env->SetObjectArrayElement(array, i, name);
+    env->DeleteLocalRef(name);
+  }
+  return array;
+}
+
 /*
  * Class:     io_multimap_Map_Native
  * Method:    isReadOnly
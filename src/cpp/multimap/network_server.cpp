@@ -0,0 +1,161 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <pthread.h>
+#include <multimap/thirdparty/mt/mt.hpp>
+#include <multimap/Server.hpp>
+
+// clang-format off
+const auto CREATE   = "--create";
+const auto HELP     = "--help";
+const auto HOST     = "--host";
+const auto PORT     = "--port";
+const auto READONLY = "--readonly";
+const auto THREADS  = "--threads";
+// clang-format on
+
+const uint16_t DEFAULT_PORT = 7426;
+
+struct CommandLine {
+  struct Error : public std::runtime_error {
+    Error(const std::string& what) : std::runtime_error(what) {}
+  };
+
+  std::string map;
+  std::string host;
+  uint16_t port = DEFAULT_PORT;
+  bool create = false;
+  bool readonly = false;
+  uint32_t num_threads = 0;
+};
+
+CommandLine parseCommandLine(int argc, const char** argv) {
+  CommandLine cmd;
+  const auto end = std::next(argv, argc);
+  auto it = std::next(argv);
+
+  using E = CommandLine::Error;
+  mt::check<E>(it != end, "No MAP given");
+  cmd.map = *it++;
+  while (it != end) {
+    const std::string option = *it++;
+    if (option == CREATE) {
+      cmd.create = true;
+      continue;
+    }
+    if (option == READONLY) {
+      cmd.readonly = true;
+      continue;
+    }
+    mt::check<E>(it != end, "No value given for '%s'", option.c_str());
+    const std::string value = *it++;
+    if (option == HOST) {
+      cmd.host = value;
+    } else if (option == PORT) {
+      const auto port = std::stoul(value);
+      mt::check<E>(port <= 65535, "Invalid port '%s'", value.c_str());
+      cmd.port = port;
+    } else if (option == THREADS) {
+      cmd.num_threads = std::stoul(value);
+    } else {
+      mt::fail<E>("Expected option when reading '%s'", option.c_str());
+    }
+  }
+  return cmd;
+}
+
+void runHelpCommand(const char* toolname) {
+  // clang-format off
+  std::printf(
+      "USAGE\n"
+      "\n  %s path/to/map [OPTIONS]"
+      "\n\nServes a map over TCP until interrupted."
+      "\n\nOPTIONS\n"
+      "\n  %-10s       Create a new instance if missing."
+      "\n  %-10s ADDR  Address to listen on. Default is all interfaces."
+      "\n  %-10s NUM   Port to listen on. Default is %u."
+      "\n  %-10s       Open the map read-only."
+      "\n  %-10s NUM   Number of threads for the map's bulk operations."
+      "\n\nEXAMPLES\n"
+      "\n  %s path/to/map"
+      "\n  %s path/to/map %s 127.0.0.1 %s 9000 %s"
+      "\n\n"
+      "\nCopyright (C) 2015-2016 Martin Trenkmann"
+      "\n<http://multimap.io>\n",
+      toolname,
+      CREATE,
+      HOST,
+      PORT, DEFAULT_PORT,
+      READONLY,
+      THREADS,
+      toolname,
+      toolname, HOST, PORT, READONLY);
+  // clang-format on
+}
+
+int main(int argc, const char** argv) {
+  if (argc < 2 || argv[1] == std::string(HELP)) {
+    runHelpCommand(*argv);
+    return argc < 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  try {
+    const auto cmd = parseCommandLine(argc, argv);
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    // Blocked in all threads started hereafter, so that only `sigwait()`
+    // receives them.
+
+    multimap::Map::Options options;
+    options.create_if_missing = cmd.create;
+    options.readonly = cmd.readonly;
+    options.num_threads = cmd.num_threads;
+    multimap::Map map(cmd.map, options);
+    multimap::Server server(&map, cmd.host, cmd.port);
+    mt::log(std::cout) << "Serving " << cmd.map << " on port "
+                       << server.getPort() << std::endl;
+
+    std::thread signal_handler([&server, &signals] {
+      int signal = 0;
+      sigwait(&signals, &signal);
+      server.stop();
+    });
+    server.run();
+    signal_handler.join();
+    mt::log(std::cout) << "Stopped" << std::endl;
+    return EXIT_SUCCESS;
+
+  } catch (CommandLine::Error& error) {
+    std::cerr << "Invalid command line: " << error.what() << '.' << "\nTry '"
+              << *argv << ' ' << HELP << "'." << std::endl;
+
+  } catch (std::exception& error) {
+    std::cerr << error.what() << '.' << std::endl;
+  }
+
+  return EXIT_FAILURE;
+}
@@ -28,6 +28,8 @@
 #include <iostream>
 #include <iomanip>
 #include <memory>
+#include <thread>
+#include <sys/file.h>
 #include <boost/crc.hpp>
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/algorithm/string/predicate.hpp>
@@ -276,26 +278,114 @@ std::vector<std::string> Files::readAllLines(
 
 const char* DirectoryLockGuard::DEFAULT_FILENAME = ".lock";
 
+namespace {
+
+const char* SHARED_LOCK_CONTENT = "shared";
+
+std::string readLockFile(int fd) {
+  char buffer[32];
+  const auto result = ::pread(fd, buffer, sizeof buffer, 0);
+  return std::string(buffer, result > 0 ? result : 0);
+}
+
+bool isSameFile(int fd, const boost::filesystem::path& file) {
+  struct stat fd_stat;
+  struct stat file_stat;
+  return ::fstat(fd, &fd_stat) == 0 && ::stat(file.c_str(), &file_stat) == 0 &&
+         fd_stat.st_dev == file_stat.st_dev &&
+         fd_stat.st_ino == file_stat.st_ino;
+}
+
+AutoCloseFd createLockFile(const boost::filesystem::path& file,
+                           const std::string& content, int operation) {
+  // The file is created under a temporary name and linked to `file` when
+  // complete, so that other processes never see it without its content.
+  const auto temp_file = file.string() + "." + std::to_string(::getpid()) +
+                         "." + std::to_string(std::hash<std::thread::id>()(
+                                   std::this_thread::get_id()));
+  AutoCloseFd fd(::open(temp_file.c_str(), O_CREAT | O_TRUNC | O_RDWR, 0644));
+  Check::notEqual(fd.get(), -1,
+                  "Could not create lock file '%s' because of '%s'",
+                  temp_file.c_str(), errnostr());
+  const auto written = ::write(fd.get(), content.data(), content.size());
+  const auto locked = ::flock(fd.get(), operation | LOCK_NB);
+  const auto linked = ::link(temp_file.c_str(), file.c_str());
+  const auto error = errno;
+  ::unlink(temp_file.c_str());
+  Check::isTrue(written == static_cast<ssize_t>(content.size()) && locked == 0,
+                "Could not create lock file '%s'", file.c_str());
+  if (linked != 0) {
+    Check::isEqual(error, EEXIST,
+                   "Could not create lock file '%s' because of '%s'",
+                   file.c_str(), std::strerror(error));
+    fd.reset();
+  }
+  return fd;
+}
+
+bool removeStaleSharedLockFile(const boost::filesystem::path& file) {
+  // Returns true if `file` has been removed or does not exist anymore.
+  AutoCloseFd fd(::open(file.c_str(), O_RDONLY));
+  if (fd.get() == -1) return errno == ENOENT;
+  if (readLockFile(fd.get()) != SHARED_LOCK_CONTENT) return false;
+  if (::flock(fd.get(), LOCK_EX | LOCK_NB) != 0) return false;
+  if (isSameFile(fd.get(), file)) ::unlink(file.c_str());
+  return true;
+}
+
+} // namespace
+
 DirectoryLockGuard::DirectoryLockGuard(const boost::filesystem::path& directory,
-                                       const std::string& filename)
-    : directory_(directory), filename_(filename) {
+                                       const std::string& filename, Mode mode)
+    : directory_(directory), filename_(filename), mode_(mode) {
   Check::isTrue(boost::filesystem::is_directory(directory),
                 "No such directory '%s'", directory.c_str());
   const auto lock_filename = directory / filename;
-  Check::isFalse(
-      boost::filesystem::exists(lock_filename),
-      "Could not lock directory, because the lock file '%s' already exists",
-      lock_filename.c_str());
-  std::ofstream lock_file(lock_filename.string());
-  Check::isTrue(lock_file.is_open(),
-                "Could not create lock file '%s' for unknown reason",
-                lock_filename.c_str());
-  lock_file << ::getpid();
+  const auto fail_because_exists = [&lock_filename] {
+    fail("Could not lock directory, because the lock file '%s' already exists",
+         lock_filename.c_str());
+  };
+
+  if (mode == Mode::EXCLUSIVE) {
+    while (true) {
+      fd_ = createLockFile(lock_filename, std::to_string(::getpid()), LOCK_EX);
+      if (fd_.get() != AutoCloseFd::NO_FD) break;
+      if (!removeStaleSharedLockFile(lock_filename)) fail_because_exists();
+    }
+    return;
+  }
+
+  while (true) {
+    AutoCloseFd fd(::open(lock_filename.c_str(), O_RDONLY));
+    if (fd.get() == -1) {
+      Check::isEqual(errno, ENOENT,
+                     "Could not open lock file '%s' because of '%s'",
+                     lock_filename.c_str(), errnostr());
+      fd_ = createLockFile(lock_filename, SHARED_LOCK_CONTENT, LOCK_SH);
+      if (fd_.get() != AutoCloseFd::NO_FD) break;
+      continue;
+    }
+    if (readLockFile(fd.get()) != SHARED_LOCK_CONTENT) fail_because_exists();
+    if (::flock(fd.get(), LOCK_SH | LOCK_NB) != 0) {
+      std::this_thread::yield();
+      continue;
+      // The last shared owner is about to remove the file.
+    }
+    if (isSameFile(fd.get(), lock_filename)) {
+      fd_ = std::move(fd);
+      break;
+    }
+    // The file has been removed meanwhile.
+  }
 }
 
 DirectoryLockGuard::~DirectoryLockGuard() {
-  if (!directory_.empty()) {
-    boost::filesystem::remove(directory_ / filename_);
+  if (directory_.empty()) return;
+  const auto lock_filename = directory_ / filename_;
+  if (mode_ == Mode::EXCLUSIVE ||
+      ::flock(fd_.get(), LOCK_EX | LOCK_NB) == 0) {
+    // Upgrading a shared lock succeeds only for its last owner.
+    ::unlink(lock_filename.c_str());
   }
 }
 
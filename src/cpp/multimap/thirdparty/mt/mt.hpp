@@ -25,6 +25,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <cstdarg>
@@ -391,6 +392,13 @@ inline void pwrite(int fd, const void* buf, size_t len, uint64_t offset) {
                  "pwrite() wrote less bytes than expected");
 }
 
+inline void writev(int fd, const struct iovec* iov, int iovcnt, size_t len) {
+  const auto result = ::writev(fd, iov, iovcnt);
+  Check::notEqual(result, -1, "writev() failed because of '%s'", errnostr());
+  Check::isEqual(static_cast<size_t>(result), len,
+                 "writev() wrote less bytes than expected");
+}
+
 inline uint64_t seek(int fd, std::int64_t offset, int whence) {
   const auto result = ::lseek(fd, offset, whence);
   Check::notEqual(result, -1, "seek() failed because of '%s'", errnostr());
@@ -404,6 +412,16 @@ inline void truncate(int fd, uint64_t length) {
   Check::isZero(result, "truncate() failed because of '%s'", errnostr());
 }
 
+inline void fsync(int fd) {
+  const auto result = ::fsync(fd);
+  Check::isZero(result, "fsync() failed because of '%s'", errnostr());
+}
+
+inline void fdatasync(int fd) {
+  const auto result = ::fdatasync(fd);
+  Check::isZero(result, "fdatasync() failed because of '%s'", errnostr());
+}
+
 inline void* mmap(void* addr, uint64_t length, int prot, int flags, int fd,
                   off_t offset) {
   const auto result = ::mmap(addr, length, prot, flags, fd, offset);
@@ -417,6 +435,23 @@ inline void munmap(void* addr, uint64_t length) {
   Check::isZero(result, "munmap() failed because of '%s'", errnostr());
 }
 
+inline void mlock(const void* addr, uint64_t length) {
+  const auto result = ::mlock(addr, length);
+  Check::isZero(result, "mlock() failed because of '%s'", errnostr());
+}
+
+inline void madvise(void* addr, uint64_t length, int advice) {
+  const auto result = ::madvise(addr, length, advice);
+  Check::isZero(result, "madvise() failed because of '%s'", errnostr());
+}
+
+inline void fadvise(int fd, uint64_t offset, uint64_t length, int advice) {
+  const auto result = ::posix_fadvise(fd, offset, length, advice);
+  // posix_fadvise() returns an error number instead of setting errno.
+  Check::isZero(result, "posix_fadvise() failed because of '%s'",
+                std::strerror(result));
+}
+
 #ifdef _GNU_SOURCE
 inline void* mremap(void* old_addr, uint64_t old_size, uint64_t new_size,
                     int flags) {
@@ -425,6 +460,13 @@ inline void* mremap(void* old_addr, uint64_t old_size, uint64_t new_size,
                   errnostr());
   return result;
 }
+
+inline void syncFileRange(int fd, uint64_t offset, uint64_t length,
+                          unsigned flags) {
+  const auto result = ::sync_file_range(fd, offset, length, flags);
+  Check::isZero(result, "sync_file_range() failed because of '%s'",
+                errnostr());
+}
 #endif
 
 class AutoCloseFile {
@@ -512,11 +554,21 @@ inline uint64_t ftell(std::FILE* stream) {
 }
 
 class DirectoryLockGuard : public Resource {
+  // Locks a directory by creating a lock file in it, which is removed when
+  // the guard is destroyed.  An exclusive lock file contains the process id
+  // of its owner.  A shared lock file is created by the first of any number
+  // of shared owners and removed by the last one, which is tracked via
+  // flock(), so that shared owners may be different processes.  A lock file
+  // left behind by a crashed exclusive owner must be removed manually.
+
 public:
+  enum class Mode { EXCLUSIVE, SHARED };
+
   static const char* DEFAULT_FILENAME;
 
   DirectoryLockGuard(const boost::filesystem::path& directory,
-                     const std::string& filename = DEFAULT_FILENAME);
+                     const std::string& filename = DEFAULT_FILENAME,
+                     Mode mode = Mode::EXCLUSIVE);
 
   ~DirectoryLockGuard();
 
@@ -524,9 +576,13 @@ public:
 
   const std::string& filename() const;
 
+  Mode mode() const { return mode_; }
+
 private:
   boost::filesystem::path directory_;
   std::string filename_;
+  Mode mode_;
+  AutoCloseFd fd_;
 };
 
 struct Files {
@@ -0,0 +1,193 @@
+// This file is part of Multimap.  http://multimap.io
+//
+// Copyright (C) 2015-2016  Martin Trenkmann
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as
+// published by the Free Software Foundation, either version 3 of the
+// License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <boost/filesystem/operations.hpp>
+#include <multimap/internal/Workload.hpp>
+#include <multimap/thirdparty/mt/mt.hpp>
+#include <multimap/Map.hpp>
+
+// clang-format off
+const auto CREATE       = "--create";
+const auto DISTRIBUTION = "--distribution";
+const auto HELP         = "--help";
+const auto KEYS         = "--keys";
+const auto LIST_LENGTH  = "--list-length";
+const auto NPARTS       = "--nparts";
+const auto OPS          = "--ops";
+const auto READS        = "--reads";
+const auto SEED         = "--seed";
+const auto THREADS      = "--threads";
+const auto VALUE_SIZE   = "--value-size";
+
+const auto SEQUENTIAL = "sequential";
+const auto UNIFORM    = "uniform";
+const auto ZIPFIAN    = "zipfian";
+// clang-format on
+
+typedef multimap::internal::Metrics Metrics;
+typedef multimap::internal::Workload Workload;
+
+struct CommandLine {
+  struct Error : public std::runtime_error {
+    Error(const std::string& what) : std::runtime_error(what) {}
+  };
+
+  std::string map;
+  bool create = false;
+  uint32_t num_partitions = multimap::Map::Options().num_partitions;
+  Workload::Options workload;
+};
+
+CommandLine parseCommandLine(int argc, const char** argv) {
+  CommandLine cmd;
+  const auto end = std::next(argv, argc);
+  auto it = std::next(argv);
+
+  using E = CommandLine::Error;
+  mt::check<E>(it != end, "No MAP given");
+  cmd.map = *it++;
+  while (it != end) {
+    const std::string option = *it++;
+    if (option == CREATE) {
+      cmd.create = true;
+      continue;
+    }
+    mt::check<E>(it != end, "No value given for '%s'", option.c_str());
+    const std::string value = *it++;
+    if (option == DISTRIBUTION) {
+      mt::check<E>(value == SEQUENTIAL || value == UNIFORM || value == ZIPFIAN,
+                   "Invalid distribution '%s'", value.c_str());
+      cmd.workload.distribution = value;
+    } else if (option == KEYS) {
+      cmd.workload.num_keys = std::stoull(value);
+      mt::check<E>(cmd.workload.num_keys >= 2, "Expected at least 2 keys");
+    } else if (option == LIST_LENGTH) {
+      cmd.workload.list_length = std::stoull(value);
+    } else if (option == NPARTS) {
+      cmd.num_partitions = std::stoul(value);
+    } else if (option == OPS) {
+      cmd.workload.num_ops = std::stoull(value);
+    } else if (option == READS) {
+      cmd.workload.read_ratio = std::stod(value);
+      mt::check<E>(cmd.workload.read_ratio >= 0 &&
+                       cmd.workload.read_ratio <= 1,
+                   "Invalid ratio of reads '%s'", value.c_str());
+    } else if (option == SEED) {
+      cmd.workload.seed = std::stoull(value);
+    } else if (option == THREADS) {
+      cmd.workload.num_threads = std::stoul(value);
+      mt::check<E>(cmd.workload.num_threads != 0,
+                   "Expected at least 1 thread");
+    } else if (option == VALUE_SIZE) {
+      cmd.workload.value_size = std::stoul(value);
+    } else {
+      mt::fail<E>("Expected option when reading '%s'", option.c_str());
+    }
+  }
+  return cmd;
+}
+
+void runHelpCommand(const char* toolname) {
+  // clang-format off
+  const Workload::Options defaults;
+  const multimap::Map::Options map_defaults;
+  std::printf(
+      "USAGE\n"
+      "\n  %s path/to/map [OPTIONS]"
+      "\n\nLoads a map with lists of values, then runs a mix of reads, which"
+      "\niterate a list, and writes, which append a value to a list, from"
+      "\nseveral threads and reports throughput and latency percentiles."
+      "\nThe load phase is skipped if the map already exists."
+      "\n\nOPTIONS\n"
+      "\n  %-14s       Create a new instance if missing."
+      "\n  %-14s NAME  Key distribution: %s, %s, or %s. Default is %s."
+      "\n  %-14s NUM   Number of keys. Default is %" PRIu64 "."
+      "\n  %-14s NUM   Values per key to load. Default is %" PRIu64 "."
+      "\n  %-14s NUM   Number of partitions of a new instance. Default is %u."
+      "\n  %-14s NUM   Number of operations in total. Default is %" PRIu64 "."
+      "\n  %-14s NUM   Fraction of reads in [0, 1]. Default is %.2f."
+      "\n  %-14s NUM   Seed of the key generators. Default is %" PRIu64 "."
+      "\n  %-14s NUM   Number of client threads. Default is %u."
+      "\n  %-14s NUM   Size of values in bytes. Default is %u."
+      "\n\nEXAMPLES\n"
+      "\n  %s path/to/map %s"
+      "\n  %s path/to/map %s %s %s 0.5 %s 8"
+      "\n\n"
+      "\nCopyright (C) 2015-2016 Martin Trenkmann"
+      "\n<http://multimap.io>\n",
+      toolname,
+      CREATE,
+      DISTRIBUTION, SEQUENTIAL, UNIFORM, ZIPFIAN, defaults.distribution.c_str(),
+      KEYS, defaults.num_keys,
+      LIST_LENGTH, defaults.list_length,
+      NPARTS, map_defaults.num_partitions,
+      OPS, defaults.num_ops,
+      READS, defaults.read_ratio,
+      SEED, defaults.seed,
+      THREADS, defaults.num_threads,
+      VALUE_SIZE, defaults.value_size,
+      toolname, CREATE,
+      toolname, DISTRIBUTION, UNIFORM, READS, THREADS);
+  // clang-format on
+}
+
+void runWorkload(const CommandLine& cmd) {
+  const bool exists = boost::filesystem::exists(
+      boost::filesystem::path(cmd.map) / multimap::Map::getNameOfIdFile());
+  multimap::Map::Options options;
+  options.create_if_missing = cmd.create;
+  options.num_partitions = cmd.num_partitions;
+  options.quiet = true;
+  multimap::Map map(cmd.map, options);
+
+  if (!exists) {
+    const auto seconds = Workload::load(&map, cmd.workload);
+    Workload::printThroughput(
+        "load", cmd.workload.num_keys * cmd.workload.list_length, seconds);
+  }
+
+  Metrics metrics;
+  const auto seconds = Workload::run(&map, cmd.workload, &metrics);
+  Workload::printThroughput("run", cmd.workload.num_ops, seconds);
+  Workload::printLatencies(metrics);
+}
+
+int main(int argc, const char** argv) {
+  if (argc < 2 || argv[1] == std::string(HELP)) {
+    runHelpCommand(*argv);
+    return argc < 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  try {
+    runWorkload(parseCommandLine(argc, argv));
+    return EXIT_SUCCESS;
+
+  } catch (CommandLine::Error& error) {
+    std::cerr << "Invalid command line: " << error.what() << '.' << "\nTry '"
+              << *argv << ' ' << HELP << "'." << std::endl;
+
+  } catch (std::exception& error) {
+    std::cerr << error.what() << '.' << std::endl;
+  }
+
+  return EXIT_FAILURE;
+}
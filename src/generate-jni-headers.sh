@@ -15,7 +15,7 @@ mkdir $BUILD_DIR
 javac -sourcepath $SOURCE_DIR -d $BUILD_DIR ${SOURCE_FILES[*]}
 
 PACKAGE=io.multimap
-CLASS_FILES=($PACKAGE.Iterator $PACKAGE.Map)
+CLASS_FILES=($PACKAGE.EntryScanner $PACKAGE.Iterator $PACKAGE.Map)
 OUTPUT_DIR=cpp/multimap/jni/generated
 
 javah -jni -classpath $BUILD_DIR -d $OUTPUT_DIR ${CLASS_FILES[*]}
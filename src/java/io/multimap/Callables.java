@@ -22,7 +22,9 @@ package io.multimap;
 import java.nio.ByteBuffer;
 
 /**
- * This class provides abstract base classes that represent various callable types.
+ * This class provides abstract base classes that represent various callable types. The byte
+ * buffers passed to a callable are only valid until it returns, since the native library reuses
+ * them for the next call instead of allocating a new buffer per value.
  * 
  * @author Martin Trenkmann
  */
@@ -48,6 +50,13 @@ public final class Callables {
      * @return a new {@code byte[]} or {@code null} if explicitly allowed by an implementation.
      */
     public abstract byte[] call(ByteBuffer bytes);
+
+    // Called by the native library, which reuses the same buffer for a sequence of calls.
+    final byte[] apply(ByteBuffer view, int size) {
+      view.clear();
+      view.limit(size);
+      return call(view);
+    }
   }
   
   /**
@@ -67,6 +76,15 @@ public final class Callables {
      * @return {@code true} if {@code a} is less than {@code b}, {@code false} otherwise.
      */
     public abstract boolean call(ByteBuffer a, ByteBuffer b);
+
+    // Called by the native library, which reuses the same buffers for a sequence of calls.
+    final boolean apply(ByteBuffer a, int aSize, ByteBuffer b, int bSize) {
+      a.clear();
+      a.limit(aSize);
+      b.clear();
+      b.limit(bSize);
+      return call(a, b);
+    }
   }
   
   /**
@@ -88,6 +106,101 @@ public final class Callables {
      * @return {@code true} if the predicate matches, {@code false} otherwise.
      */
     public abstract boolean call(ByteBuffer bytes);
+
+    // Called by the native library, which reuses the same buffer for a sequence of calls.
+    final boolean apply(ByteBuffer view, int size) {
+      view.clear();
+      view.limit(size);
+      return call(view);
+    }
+  }
+
+  /**
+   * A predicate that matches values equal to a given sequence of bytes. Unlike other predicates,
+   * built-in predicates are evaluated by the native library without calling back into Java.
+   */
+  public static final class Equal extends Predicate {
+
+    private final byte[] bytes;
+
+    public Equal(byte[] bytes) {
+      this.bytes = bytes.clone();
+    }
+
+    @Override
+    public boolean call(ByteBuffer bytes) {
+      return bytes.remaining() == this.bytes.length && regionEquals(bytes, 0, this.bytes);
+    }
+  }
+
+  /**
+   * A predicate that matches values containing a given sequence of bytes. An empty sequence is
+   * contained in every value. This predicate is evaluated by the native library.
+   */
+  public static final class Contains extends Predicate {
+
+    private final byte[] bytes;
+
+    public Contains(byte[] bytes) {
+      this.bytes = bytes.clone();
+    }
+
+    @Override
+    public boolean call(ByteBuffer bytes) {
+      for (int i = 0; i <= bytes.remaining() - this.bytes.length; ++i) {
+        if (regionEquals(bytes, i, this.bytes)) {
+          return true;
+        }
+      }
+      return false;
+    }
+  }
+
+  /**
+   * A predicate that matches values starting with a given sequence of bytes. This predicate is
+   * evaluated by the native library.
+   */
+  public static final class StartsWith extends Predicate {
+
+    private final byte[] bytes;
+
+    public StartsWith(byte[] bytes) {
+      this.bytes = bytes.clone();
+    }
+
+    @Override
+    public boolean call(ByteBuffer bytes) {
+      return bytes.remaining() >= this.bytes.length && regionEquals(bytes, 0, this.bytes);
+    }
+  }
+
+  /**
+   * A predicate that matches values ending with a given sequence of bytes. This predicate is
+   * evaluated by the native library.
+   */
+  public static final class EndsWith extends Predicate {
+
+    private final byte[] bytes;
+
+    public EndsWith(byte[] bytes) {
+      this.bytes = bytes.clone();
+    }
+
+    @Override
+    public boolean call(ByteBuffer bytes) {
+      final int offset = bytes.remaining() - this.bytes.length;
+      return offset >= 0 && regionEquals(bytes, offset, this.bytes);
+    }
+  }
+
+  private static boolean regionEquals(ByteBuffer bytes, int offset, byte[] other) {
+    final int begin = bytes.position() + offset;
+    for (int i = 0; i != other.length; ++i) {
+      if (bytes.get(begin + i) != other[i]) {
+        return false;
+      }
+    }
+    return true;
   }
 
   /**
@@ -106,6 +219,35 @@ public final class Callables {
      * might let the VM crash.
      */
     public abstract void call(ByteBuffer bytes);
+
+    // Called by the native library, which reuses the same buffer for a sequence of calls.
+    final void apply(ByteBuffer view, int size) {
+      view.clear();
+      view.limit(size);
+      call(view);
+    }
+
+    /**
+     * Applies the procedure to a batch of {@code count} byte sequences stored back to back in
+     * {@code bytes}, where the i-th sequence spans the range from {@code offsets[i]} inclusive to
+     * {@code offsets[i + 1]} exclusive. The native library calls this method once per batch rather
+     * than once per sequence. The default implementation calls {@link #call(ByteBuffer)} for each
+     * sequence. The same restrictions as for {@link #call(ByteBuffer)} apply to the given buffer.
+     */
+    public void callBatch(ByteBuffer bytes, int[] offsets, int count) {
+      for (int i = 0; i != count; ++i) {
+        bytes.limit(offsets[i + 1]);
+        bytes.position(offsets[i]);
+        call(bytes.slice());
+      }
+    }
+
+    // Called by the native library, which reuses the same buffer for all batches.
+    final void applyBatch(ByteBuffer bytes, int[] offsets, int count) {
+      bytes.clear();
+      bytes.limit(offsets[count]);
+      callBatch(bytes, offsets, count);
+    }
   }
 
 }
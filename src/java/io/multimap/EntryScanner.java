@@ -0,0 +1,89 @@
+/*
+ * This file is part of Multimap.  http://multimap.io
+ *
+ * Copyright (C) 2015-2016  Martin Trenkmann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+package io.multimap;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+/**
+ * This class streams all entries of a map to a single Java thread, while the map is scanned by
+ * native threads in parallel. The entries are passed in batches of native memory, so that the
+ * consumer crosses the JNI boundary once per batch rather than once per value, and no Java thread
+ * is occupied by the scan itself. Scanners are created via {@link Map#scanEntries(int)}.
+ * 
+ * <p>A batch is a sequence of records in the format of {@link Map#putAll(ByteBuffer)}, i.e. each
+ * record consists of an {@code int} that gives the size of the key, the key itself, an {@code int}
+ * that gives the size of the value, and the value itself. A list is passed as one record per
+ * value, and lists may be split across batches.</p>
+ * 
+ * <p>While the consumer lags behind, the scanning threads wait, which blocks updates of the
+ * partitions they visit. A scanner must be closed before its map. Objects of this class are not
+ * thread-safe.</p>
+ * 
+ * @since 0.6.0
+ */
+public class EntryScanner implements AutoCloseable {
+
+  private ByteBuffer self;
+
+  EntryScanner(ByteBuffer nativePtr) {
+    Check.notNull(nativePtr);
+    self = nativePtr;
+  }
+
+  /**
+   * Returns the next batch of entries, waiting until it is available, or {@code null} after the
+   * last batch. The returned buffer refers to native memory, which is reused after the next call
+   * of this method or {@link #close()}, so that the buffer must not be accessed afterwards. Its
+   * byte order is set to the native one, in which the sizes are written.
+   * 
+   * @throws Exception if the scan failed. Batches produced before have been returned.
+   */
+  public ByteBuffer nextBatch() throws Exception {
+    Check.notNull(self);
+    ByteBuffer batch = Native.next(self);
+    return (batch != null) ? batch.order(ByteOrder.nativeOrder()) : null;
+  }
+
+  /**
+   * Stops scanning if not finished yet and releases all native resources.
+   */
+  @Override
+  public void close() {
+    if (self != null) {
+      Native.close(self);
+      self = null;
+    }
+  }
+
+  @Override
+  protected void finalize() throws Throwable {
+    if (self != null) {
+      System.err.printf("WARNING %s.finalize() calls close()\n", getClass().getName());
+      close();
+    }
+    super.finalize();
+  }
+
+  private static class Native {
+    static native ByteBuffer next(ByteBuffer self) throws Exception;
+    static native void close(ByteBuffer self);
+  }
+}
@@ -20,6 +20,7 @@
 package io.multimap;
 
 import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 
 /**
  * This abstract class represents an iterator to read a list of values, possibly by streaming them
@@ -105,6 +106,43 @@ public class Iterator implements AutoCloseable {
     return Utils.toString(next());
   }
   
+  /**
+   * Copies as many of the next values as fit into the remaining space of {@code dst} and moves the
+   * iterator forward accordingly. Each value is preceded by an {@code int} that gives its size,
+   * written in the byte order of {@code dst}, so that values can be read back via
+   * {@link ByteBuffer#getInt()} and {@link ByteBuffer#get(byte[])} after flipping the buffer. The
+   * position of {@code dst} is advanced by the number of bytes written. In contrast to
+   * {@link #next()}, which crosses the JNI boundary once per value, this method transfers a whole
+   * batch of values per call.
+   * 
+   * @param dst a direct buffer that receives the values.
+   * @return the number of values copied, which is zero only if the iterator has no more values.
+   * @throws IllegalArgumentException if {@code dst} is not a direct buffer.
+   * @throws Exception if the next value does not fit into the remaining space of {@code dst}.
+   */
+  public int nextBatch(ByteBuffer dst) throws Exception {
+    Check.notNull(dst);
+    if (!dst.isDirect()) {
+      throw new IllegalArgumentException("ByteBuffer must be direct");
+    }
+    long result = Native.nextBatch(self, dst, dst.position(), dst.remaining(),
+        dst.order() == ByteOrder.BIG_ENDIAN);
+    dst.position(dst.position() + (int) result);
+    return (int) (result >>> 32);
+  }
+
+  /**
+   * Moves the iterator forward by {@code n} values, or to the end if less values are available, and
+   * returns the number of values skipped. Long lists are indexed, so that paging through them via
+   * this method and {@link #next()} does not decode every value in between.
+   */
+  public long skip(long n) {
+    if (n < 0) {
+      throw new IllegalArgumentException("n must not be negative");
+    }
+    return Native.skip(self, n);
+  }
+
   /**
    * Same as {@link #next()}, but does not move the iterator once forward.
    */
@@ -153,7 +191,10 @@ public class Iterator implements AutoCloseable {
     static native long available(ByteBuffer self);
     static native boolean hasNext(ByteBuffer self);
     static native ByteBuffer next(ByteBuffer self);
+    static native long nextBatch(ByteBuffer self, ByteBuffer dst, int offset, int size,
+        boolean bigEndian) throws Exception;
     static native ByteBuffer peekNext(ByteBuffer self);
+    static native long skip(ByteBuffer self, long n);
     static native void close(ByteBuffer self);
   }
 
@@ -172,5 +213,15 @@ public class Iterator implements AutoCloseable {
       return false;
     }
 
+    @Override
+    public int nextBatch(ByteBuffer dst) {
+      return 0;
+    }
+
+    @Override
+    public long skip(long n) {
+      return 0;
+    }
+
   };
 }
@@ -190,6 +190,50 @@ public class Map implements AutoCloseable {
       return numPartitions;
     }
 
+    /**
+     * Returns the number of bytes of main memory currently used for keys and in-memory write
+     * buffer blocks. Statistics that were read from disk report 0.
+     */
+    public long getMemoryAllocated() {
+      return memoryAllocated;
+    }
+
+    /**
+     * Returns the number of bytes of main memory obtained from the system, including memory that
+     * is currently unused. Statistics that were read from disk report 0.
+     */
+    public long getMemoryReserved() {
+      return memoryReserved;
+    }
+
+    /**
+     * Returns the number of bytes of main memory that has been released, e.g. by flushing cold
+     * lists, and is kept for reuse. Statistics that were read from disk report 0.
+     */
+    public long getMemoryReusable() {
+      return memoryReusable;
+    }
+
+    /**
+     * Returns the number of blocks that were found in the block cache. Statistics that were read
+     * from disk report 0.
+     * 
+     * @see Options#setBlockCacheSize(long)
+     */
+    public long getBlockCacheHits() {
+      return blockCacheHits;
+    }
+
+    /**
+     * Returns the number of blocks that were not found in the block cache. Statistics that were
+     * read from disk report 0.
+     * 
+     * @see Options#setBlockCacheSize(long)
+     */
+    public long getBlockCacheMisses() {
+      return blockCacheMisses;
+    }
+
     @Override
     public String toString() {
       return String.format(
@@ -205,9 +249,15 @@ public class Map implements AutoCloseable {
           "num_keys_valid    %d\n" +
           "num_values_total  %d\n" +
           "num_values_valid  %d\n" +
-          "num_partitions    %d\n",
+          "num_partitions    %d\n" +
+          "memory_allocated  %d\n" +
+          "memory_reserved   %d\n" +
+          "memory_reusable   %d\n" +
+          "block_cache_hits  %d\n" +
+          "block_cache_misses %d\n",
           blockSize, keySizeAvg, keySizeMax, keySizeMin, listSizeAvg, listSizeMax, listSizeMin,
-          numBlocks, numKeysTotal, numKeysValid, numValuesTotal, numValuesValid, numPartitions);
+          numBlocks, numKeysTotal, numKeysValid, numValuesTotal, numValuesValid, numPartitions,
+          memoryAllocated, memoryReserved, memoryReusable, blockCacheHits, blockCacheMisses);
     }
 
     protected void parseFromBuffer(ByteBuffer buffer) {
@@ -225,6 +275,11 @@ public class Map implements AutoCloseable {
       numValuesTotal = buffer.getLong();
       numValuesValid = buffer.getLong();
       numPartitions = buffer.getLong();
+      memoryAllocated = buffer.getLong();
+      memoryReserved = buffer.getLong();
+      memoryReusable = buffer.getLong();
+      blockCacheHits = buffer.getLong();
+      blockCacheMisses = buffer.getLong();
     }
 
     // Needs to be synchronized with struct Table::Stats in C++.
@@ -241,6 +296,11 @@ public class Map implements AutoCloseable {
     private long numValuesTotal;
     private long numValuesValid;
     private long numPartitions;
+    private long memoryAllocated;
+    private long memoryReserved;
+    private long memoryReusable;
+    private long blockCacheHits;
+    private long blockCacheMisses;
   }
 
   private ByteBuffer self;
@@ -344,6 +404,65 @@ public class Map implements AutoCloseable {
   public void put(String key, byte[] value) throws Exception {
     Native.put(self, Utils.toByteArray(key), value);
   }
+
+  /**
+   * Same as {@link #put(byte[], byte[])}, but taking the remaining bytes of {@code key} and
+   * {@code value}. If both buffers are direct, the bytes are read by the native library in place,
+   * which avoids copying them. The positions of the buffers are not changed.
+   */
+  public void put(ByteBuffer key, ByteBuffer value) throws Exception {
+    Check.notNull(key);
+    Check.notNull(value);
+    if (key.isDirect() && value.isDirect()) {
+      Native.putDirect(self, key, key.position(), key.remaining(), value, value.position(),
+          value.remaining());
+    } else {
+      Native.put(self, getRemaining(key), getRemaining(value));
+    }
+  }
+
+  /**
+   * Appends many values with a single call into the native library. The remaining bytes of
+   * {@code records} must be a sequence of records, each of which consists of an {@code int} that
+   * gives the size of the key, the key itself, an {@code int} that gives the size of the value,
+   * and the value itself. The sizes are read in the byte order of {@code records}, so that records
+   * can be written via {@link ByteBuffer#putInt(int)} and {@link ByteBuffer#put(byte[])}. If the
+   * buffer is direct, it is not copied. The position of the buffer is not changed.
+   * 
+   * @return the number of records put.
+   * @throws Exception if a record is incomplete or if one of the conditions listed for
+   *         {@link #put(byte[], byte[])} is true. Records before the failing one have been put.
+   */
+  public int putAll(ByteBuffer records) throws Exception {
+    Check.notNull(records);
+    ByteBuffer direct = records;
+    if (!records.isDirect()) {
+      direct = ByteBuffer.allocateDirect(records.remaining());
+      direct.put(records.duplicate()).flip();
+    }
+    return Native.putAll(self, direct, direct.position(), direct.remaining(),
+        records.order() == ByteOrder.BIG_ENDIAN);
+  }
+
+  /**
+   * Applies all puts of {@code batch} in the order they were added. Puts that belong to the same
+   * partition are applied together, so that each list is locked only once per call. The batch is
+   * not cleared and can be written again.
+   * 
+   * @throws Exception if one of the conditions listed for {@link #put(byte[], byte[])} is true for
+   *         any put. Puts of other lists may have been applied.
+   */
+  public void write(WriteBatch batch) throws Exception {
+    Check.notNull(batch);
+    ByteBuffer records = batch.getRecords();
+    Native.write(self, records, records.position(), records.order() == ByteOrder.BIG_ENDIAN);
+  }
+
+  private static byte[] getRemaining(ByteBuffer buffer) {
+    byte[] array = new byte[buffer.remaining()];
+    buffer.duplicate().get(array);
+    return array;
+  }
   
   /**
    * Returns a read-only iterator for the list associated with {@code key}. If the key does not
@@ -393,6 +512,88 @@ public class Map implements AutoCloseable {
     return contains(Utils.toByteArray(key));
   }
 
+  /**
+   * Returns read-only iterators for the lists associated with {@code keys} in the same order.
+   * Keys that belong to the same partition are looked up with a single acquisition of the
+   * partition lock, which makes this method faster than calling {@link #get(byte[])} for each
+   * key. As with {@link #get(byte[])}, each non-empty iterator owns a reader lock on the
+   * underlying list and therefore must be closed via {@link Iterator#close()}.
+   * 
+   * <p><b>Acquires:</b></p>
+   * <ul>
+   * <li>a reader lock on each partition that contains one of the keys.</li>
+   * <li>a reader lock on each list associated with one of the keys.</li>
+   * </ul>
+   */
+  @SuppressWarnings("resource")
+  public Iterator[] getMany(byte[][] keys) {
+    Check.notNull(keys);
+    for (byte[] key : keys) {
+      Check.notNull(key);
+    }
+    ByteBuffer[] nativePtrs = Native.getMany(self, keys);
+    Iterator[] iterators = new Iterator[nativePtrs.length];
+    for (int i = 0; i < nativePtrs.length; ++i) {
+      iterators[i] = (nativePtrs[i] != null) ? new Iterator(nativePtrs[i]) : Iterator.EMPTY;
+    }
+    return iterators;
+  }
+
+  /**
+   * Copies the values of {@code keys[fromIndex]}, {@code keys[fromIndex + 1]}, and so on into the
+   * remaining space of {@code dst}, as long as all values of a key fit. For each key, an
+   * {@code int} that gives the number of values is written, followed by the values, each of which
+   * is preceded by an {@code int} that gives its size. The ints are written in the byte order of
+   * {@code dst}, so that the result can be read back via {@link ByteBuffer#getInt()} and
+   * {@link ByteBuffer#get(byte[])} after flipping the buffer. Keys that do not exist have zero
+   * values. The position of {@code dst} is advanced by the number of bytes written.
+   * 
+   * <p>The keys are looked up as in {@link #getMany(byte[][])}, but no iterator is handed over to
+   * Java, so that a single call into the native library transfers the values of many keys, and
+   * {@code dst} can be reused for the next call. Lists that do not fit into {@code dst} should be
+   * read via {@link #get(byte[])} and {@link Iterator#nextBatch(ByteBuffer)}.</p>
+   * 
+   * @return the number of keys whose values have been copied, which is zero only if
+   *         {@code fromIndex} equals {@code keys.length}. The next call should pass
+   *         {@code fromIndex} plus this number.
+   * @throws IllegalArgumentException if {@code dst} is not a direct buffer.
+   * @throws Exception if the values of {@code keys[fromIndex]} do not fit into the remaining space
+   *         of {@code dst}.
+   * @since 0.6.0
+   */
+  public int getMany(byte[][] keys, int fromIndex, ByteBuffer dst) throws Exception {
+    Check.notNull(keys);
+    for (byte[] key : keys) {
+      Check.notNull(key);
+    }
+    Check.notNull(dst);
+    if (fromIndex < 0 || fromIndex > keys.length) {
+      throw new IndexOutOfBoundsException("fromIndex: " + fromIndex);
+    }
+    if (!dst.isDirect()) {
+      throw new IllegalArgumentException("ByteBuffer must be direct");
+    }
+    if (fromIndex == keys.length) {
+      return 0;
+    }
+    long result = Native.getManyInto(self, keys, fromIndex, dst, dst.position(), dst.remaining(),
+        dst.order() == ByteOrder.BIG_ENDIAN);
+    dst.position(dst.position() + (int) result);
+    return (int) (result >>> 32);
+  }
+
+  /**
+   * Returns for each key in {@code keys} whether it is associated with at least one value. The
+   * results are in the same order as the keys. See {@link #getMany(byte[][])} for details.
+   */
+  public boolean[] containsMany(byte[][] keys) {
+    Check.notNull(keys);
+    for (byte[] key : keys) {
+      Check.notNull(key);
+    }
+    return Native.containsMany(self, keys);
+  }
+
   /**
    * Removes all values associated with {@code key}.
    * 
@@ -750,10 +951,20 @@ public class Map implements AutoCloseable {
     forEachValue(Utils.toByteArray(key), process);
   }
 
-  /*
-   * The method `forEachEntry` as provided in the C++ version of this library is currently not
-   * supported. Consider submitting a feature request if you really need it.
+  /**
+   * Starts scanning all entries of the map on {@code numThreads} native threads, or on one thread
+   * per hardware thread if zero, and returns a scanner that yields the entries in batches. This is
+   * the counterpart of {@code forEachEntryInParallel()} in the C++ version of this library, but
+   * without calling back into Java. The scanner must be closed before the map.
+   * 
+   * <p><b>Acquires</b> a reader lock on each partition while it is being scanned.</p>
+   * 
+   * @since 0.6.0
    */
+  public EntryScanner scanEntries(int numThreads) {
+    Check.isPositive(numThreads);
+    return new EntryScanner(Native.newEntryScanner(self, numThreads));
+  }
 
   /**
    * Returns statistical information about the map. Be aware that this operation requires to visit
@@ -773,6 +984,23 @@ public class Map implements AutoCloseable {
     return stats;
   }
 
+  /**
+   * Returns the latency metrics that the map has recorded since it was opened with
+   * {@link Options#setMetrics(boolean)}, keyed by name, such as {@code get_p99}. Latencies are
+   * given in nanoseconds. All values are zero if the map does not record metrics.
+   * 
+   * @since 0.6.0
+   */
+  public java.util.Map<String, Long> getMetrics() {
+    String[] names = Native.getMetricNames();
+    long[] values = Native.getMetrics(self);
+    java.util.Map<String, Long> metrics = new java.util.LinkedHashMap<>();
+    for (int i = 0; i != names.length; ++i) {
+      metrics.put(names[i], values[i]);
+    }
+    return metrics;
+  }
+
   /**
    * Returns {@code true} if the map is read-only, {@code false} otherwise.
    */
@@ -925,8 +1153,19 @@ public class Map implements AutoCloseable {
   private static class Native {
     static native ByteBuffer newMap(String directory, Options options) throws Exception;
     static native void put(ByteBuffer self, byte[] key, byte[] value) throws Exception;
+    static native void putDirect(ByteBuffer self, ByteBuffer key, int keyOffset, int keySize,
+        ByteBuffer value, int valueOffset, int valueSize) throws Exception;
+    static native int putAll(ByteBuffer self, ByteBuffer records, int offset, int size,
+        boolean bigEndian) throws Exception;
+    static native void write(ByteBuffer self, ByteBuffer records, int size, boolean bigEndian)
+        throws Exception;
     static native ByteBuffer get(ByteBuffer self, byte[] key);
     static native boolean contains(ByteBuffer self, byte[] key);
+    static native ByteBuffer[] getMany(ByteBuffer self, byte[][] keys);
+    static native boolean[] containsMany(ByteBuffer self, byte[][] keys);
+    static native long getManyInto(ByteBuffer self, byte[][] keys, int fromIndex, ByteBuffer dst,
+        int offset, int size, boolean bigEndian);
+    static native ByteBuffer newEntryScanner(ByteBuffer self, int numThreads);
     static native int remove(ByteBuffer self, byte[] key);
     static native int removeOne(ByteBuffer self, Predicate predicate);
     static native byte[] removeAll(ByteBuffer self, Predicate predicate);
@@ -941,6 +1180,8 @@ public class Map implements AutoCloseable {
     static native void forEachKey(ByteBuffer self, Procedure process);
     static native void forEachValue(ByteBuffer self, byte[] key, Procedure process);
     static native void getStats(ByteBuffer self, Stats stats);
+    static native long[] getMetrics(ByteBuffer self);
+    static native String[] getMetricNames();
     static native boolean isReadOnly(ByteBuffer self);
     static native void close(ByteBuffer self);
     static native void stats(String directory, Stats stats) throws Exception;
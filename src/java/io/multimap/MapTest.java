@@ -27,6 +27,7 @@ import io.multimap.Map.Stats;
 import java.io.BufferedWriter;
 import java.io.IOException;
 import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
 import java.nio.charset.Charset;
 import java.nio.file.FileVisitResult;
 import java.nio.file.Files;
@@ -209,6 +210,243 @@ public class MapTest {
     map.close();
   }
 
+  @Test
+  public void testGetViaNextBatch() throws Exception {
+    int numValuesPerKeys = 1000;
+    Map map = createAndFillMap(DIRECTORY, 1, numValuesPerKeys);
+    Iterator iter = map.get(makeKey(0));
+    ByteBuffer batch = ByteBuffer.allocateDirect(1000);
+    int numBatches = 0;
+    int nextSuffix = 0;
+    int numValues;
+    while ((numValues = iter.nextBatch(batch)) > 0) {
+      ++numBatches;
+      batch.flip();
+      for (int i = 0; i < numValues; ++i) {
+        byte[] value = new byte[batch.getInt()];
+        batch.get(value);
+        Assert.assertArrayEquals(makeValue(nextSuffix++), value);
+      }
+      Assert.assertFalse(batch.hasRemaining());
+      batch.clear();
+    }
+    Assert.assertEquals(numValuesPerKeys, nextSuffix);
+    Assert.assertTrue(numBatches < numValuesPerKeys / 10);
+    Assert.assertFalse(iter.hasNext());
+    iter.close();
+    Assert.assertEquals(0, map.get(makeKey(1)).nextBatch(batch));
+    map.close();
+  }
+
+  @Test (expected = Exception.class)
+  public void testNextBatchThrowsIfValueDoesNotFit() throws Exception {
+    Map map = createAndFillMap(DIRECTORY, 1, 1);
+    Iterator iter = map.get(makeKey(0));
+    try {
+      iter.nextBatch(ByteBuffer.allocateDirect(4));
+    } finally {
+      iter.close();
+      map.close();
+    }
+  }
+
+  @Test
+  public void testPutViaByteBuffers() throws Exception {
+    Options options = new Options();
+    options.setCreateIfMissing(true);
+    Map map = new Map(DIRECTORY, options);
+    for (int i = 0; i < 100; ++i) {
+      ByteBuffer key = ByteBuffer.allocateDirect(16);
+      key.put((byte) '#').put(makeKey(i)).flip().position(1);
+      ByteBuffer directValue = ByteBuffer.allocateDirect(16);
+      directValue.put(makeValue(i)).flip();
+      ByteBuffer value = ByteBuffer.wrap(makeValue(i));
+      map.put(key, directValue);
+      map.put(key, value);
+      Assert.assertEquals(1, key.position());
+      Assert.assertEquals(0, value.position());
+    }
+    for (int i = 0; i < 100; ++i) {
+      Iterator iter = map.get(makeKey(i));
+      Assert.assertEquals(2, iter.available());
+      Assert.assertArrayEquals(makeValue(i), iter.nextAsByteArray());
+      Assert.assertArrayEquals(makeValue(i), iter.nextAsByteArray());
+      iter.close();
+    }
+    map.close();
+  }
+
+  @Test
+  public void testPutAllReadsRecordsFromByteBuffers() throws Exception {
+    Options options = new Options();
+    options.setCreateIfMissing(true);
+    Map map = new Map(DIRECTORY, options);
+    int numValuesPerKey = 1000;
+    ByteBuffer[] buffers = {
+        ByteBuffer.allocate(numValuesPerKey * 32),
+        ByteBuffer.allocateDirect(numValuesPerKey * 32).order(ByteOrder.LITTLE_ENDIAN) };
+    for (int i = 0; i < buffers.length; ++i) {
+      for (int j = 0; j < numValuesPerKey; ++j) {
+        buffers[i].putInt(makeKey(i).length).put(makeKey(i));
+        buffers[i].putInt(makeValue(j).length).put(makeValue(j));
+      }
+      buffers[i].flip();
+      Assert.assertEquals(numValuesPerKey, map.putAll(buffers[i]));
+      Assert.assertEquals(0, buffers[i].position());
+    }
+    for (int i = 0; i < buffers.length; ++i) {
+      Iterator iter = map.get(makeKey(i));
+      for (int j = 0; j < numValuesPerKey; ++j) {
+        Assert.assertArrayEquals(makeValue(j), iter.nextAsByteArray());
+      }
+      Assert.assertFalse(iter.hasNext());
+      iter.close();
+    }
+    map.close();
+  }
+
+  @Test (expected = Exception.class)
+  public void testPutAllThrowsOnIncompleteRecord() throws Exception {
+    Options options = new Options();
+    options.setCreateIfMissing(true);
+    Map map = new Map(DIRECTORY, options);
+    ByteBuffer records = ByteBuffer.allocateDirect(32);
+    records.putInt(makeKey(0).length).put(makeKey(0)).putInt(100).flip();
+    try {
+      map.putAll(records);
+    } finally {
+      map.close();
+    }
+  }
+
+  @Test
+  public void testWriteBatchKeepsOrderOfValuesPerKey() throws Exception {
+    Options options = new Options();
+    options.setCreateIfMissing(true);
+    Map map = new Map(DIRECTORY, options);
+    int numKeys = 100;
+    int numValuesPerKey = 100;
+    WriteBatch batch = new WriteBatch();
+    for (int j = 0; j < numValuesPerKey; ++j) {
+      for (int i = 0; i < numKeys; ++i) {
+        batch.put(makeKey(i), makeValue(j));
+      }
+    }
+    Assert.assertEquals(numKeys * numValuesPerKey, batch.size());
+    map.write(batch);
+    for (int i = 0; i < numKeys; ++i) {
+      Iterator iter = map.get(makeKey(i));
+      for (int j = 0; j < numValuesPerKey; ++j) {
+        Assert.assertArrayEquals(makeValue(j), iter.nextAsByteArray());
+      }
+      Assert.assertFalse(iter.hasNext());
+      iter.close();
+    }
+    batch.clear();
+    Assert.assertTrue(batch.isEmpty());
+    map.write(batch);
+    map.close();
+  }
+
+  @Test
+  public void testGetManyAndContainsMany() throws Exception {
+    int numKeys = 1000;
+    int numValuesPerKeys = 100;
+    Map map = createAndFillMap(DIRECTORY, numKeys, numValuesPerKeys);
+    byte[][] keys = new byte[2 * numKeys][];
+    for (int i = 0; i < keys.length; ++i) {
+      keys[i] = makeKey(keys.length - 1 - i);
+    }
+    boolean[] contained = map.containsMany(keys);
+    Iterator[] iters = map.getMany(keys);
+    Assert.assertEquals(keys.length, contained.length);
+    Assert.assertEquals(keys.length, iters.length);
+    for (int i = 0; i < keys.length; ++i) {
+      boolean exists = keys.length - 1 - i < numKeys;
+      Assert.assertEquals(exists, contained[i]);
+      Assert.assertEquals(exists ? numValuesPerKeys : 0, iters[i].available());
+      for (int j = 0; iters[i].hasNext(); ++j) {
+        Assert.assertArrayEquals(makeValue(j), iters[i].nextAsByteArray());
+      }
+      iters[i].close();
+    }
+    map.close();
+  }
+
+  @Test
+  public void testGetManyIntoReusedBuffer() throws Exception {
+    int numKeys = 1000;
+    int numValuesPerKeys = 10;
+    Map map = createAndFillMap(DIRECTORY, numKeys, numValuesPerKeys);
+    byte[][] keys = new byte[2 * numKeys][];
+    for (int i = 0; i < keys.length; ++i) {
+      keys[i] = makeKey(keys.length - 1 - i);
+    }
+    ByteBuffer batch = ByteBuffer.allocateDirect(4096);
+    int numCalls = 0;
+    int fromIndex = 0;
+    int numKeysRead;
+    while ((numKeysRead = map.getMany(keys, fromIndex, batch)) > 0) {
+      ++numCalls;
+      batch.flip();
+      for (int i = fromIndex; i < fromIndex + numKeysRead; ++i) {
+        boolean exists = keys.length - 1 - i < numKeys;
+        int numValues = batch.getInt();
+        Assert.assertEquals(exists ? numValuesPerKeys : 0, numValues);
+        for (int j = 0; j < numValues; ++j) {
+          byte[] value = new byte[batch.getInt()];
+          batch.get(value);
+          Assert.assertArrayEquals(makeValue(j), value);
+        }
+      }
+      Assert.assertFalse(batch.hasRemaining());
+      batch.clear();
+      fromIndex += numKeysRead;
+    }
+    Assert.assertEquals(keys.length, fromIndex);
+    Assert.assertTrue(numCalls < numKeys / 10);
+    map.close();
+  }
+
+  @Test (expected = Exception.class)
+  public void testGetManyIntoThrowsIfValuesDoNotFit() throws Exception {
+    Map map = createAndFillMap(DIRECTORY, 1, 10);
+    try {
+      map.getMany(new byte[][] { makeKey(0) }, 0, ByteBuffer.allocateDirect(16));
+    } finally {
+      map.close();
+    }
+  }
+
+  @Test
+  public void testScanEntriesYieldsAllEntries() throws Exception {
+    int numKeys = 1000;
+    int numValuesPerKeys = 10;
+    Map map = createAndFillMap(DIRECTORY, numKeys, numValuesPerKeys);
+    java.util.Map<String, Integer> numValuesByKey = new java.util.HashMap<>();
+    EntryScanner scanner = map.scanEntries(0);
+    ByteBuffer batch;
+    while ((batch = scanner.nextBatch()) != null) {
+      while (batch.hasRemaining()) {
+        byte[] key = new byte[batch.getInt()];
+        batch.get(key);
+        byte[] value = new byte[batch.getInt()];
+        batch.get(value);
+        String keyString = new String(key, "UTF-8");
+        Integer numValues = numValuesByKey.get(keyString);
+        numValues = (numValues == null) ? 0 : numValues;
+        Assert.assertArrayEquals(makeValue(numValues), value);
+        numValuesByKey.put(keyString, numValues + 1);
+      }
+    }
+    scanner.close();
+    Assert.assertEquals(numKeys, numValuesByKey.size());
+    for (int numValues : numValuesByKey.values()) {
+      Assert.assertEquals(numValuesPerKeys, numValues);
+    }
+    map.close();
+  }
+
   @Test
   public void testRemove() throws Exception {
     int numKeys = 1000;
@@ -581,6 +819,53 @@ public class MapTest {
     map.close();
   }
   
+  @Test
+  public void testRemoveAllValuesViaBuiltinPredicates() throws Exception {
+    int numValuesPerKeys = 1000;
+    Map map = createAndFillMap(DIRECTORY, 1, numValuesPerKeys);
+    final byte[] key = makeKey(0);
+    Predicate[] predicates = new Predicate[] {
+        new Callables.EndsWith("7".getBytes()), new Callables.StartsWith("value99".getBytes()),
+        new Callables.Equal(makeValue(5)), new Callables.Contains("12".getBytes())};
+    for (final Predicate predicate : predicates) {
+      final int[] expectedNumRemoved = new int[1];
+      map.forEachValue(key, new Procedure() {
+        @Override
+        public void call(ByteBuffer bytes) {
+          if (predicate.call(bytes)) {
+            ++expectedNumRemoved[0];
+          }
+        }
+      });
+      Assert.assertTrue(expectedNumRemoved[0] > 0);
+      Assert.assertEquals(expectedNumRemoved[0], map.removeAll(key, predicate));
+    }
+    map.close();
+  }
+
+  @Test
+  public void testForEachValuePassesValuesInBatches() throws Exception {
+    int numValuesPerKeys = 10000;
+    Map map = createAndFillMap(DIRECTORY, 1, numValuesPerKeys);
+    final int[] numBatches = new int[1];
+    final int[] nextSuffix = new int[1];
+    map.forEachValue(makeKey(0), new Procedure() {
+      @Override
+      public void call(ByteBuffer bytes) {
+        Assert.assertEquals(nextSuffix[0]++, getSuffix(bytes));
+      }
+
+      @Override
+      public void callBatch(ByteBuffer bytes, int[] offsets, int count) {
+        ++numBatches[0];
+        super.callBatch(bytes, offsets, count);
+      }
+    });
+    Assert.assertEquals(numValuesPerKeys, nextSuffix[0]);
+    Assert.assertTrue(numBatches[0] < numValuesPerKeys / 100);
+    map.close();
+  }
+
   @Test
   public void testGetStats() throws Exception {
     int numKeys = 1000;
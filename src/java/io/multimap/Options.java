@@ -39,6 +39,26 @@ public class Options {
   private boolean errorIfExists = false;
   private boolean readonly = false;
   private boolean quiet = false;
+  private boolean lazy = false;
+  private String[] directories = new String[0];
+  private double bloomFilterFalsePositiveRate = 0;
+  private double valueFilterFalsePositiveRate = 0;
+  private boolean compress = false;
+  private boolean frontCoding = false;
+  private long tailMemoryBudget = 0;
+  private boolean writeAheadLog = false;
+  private boolean syncWriteAheadLog = false;
+  private int checkpointInterval = 0;
+  private double compactionThreshold = 0;
+  private long compactionRate = 8 * 1024 * 1024;
+  private boolean populate = false;
+  private boolean hugePages = false;
+  private boolean lockInMemory = false;
+  private boolean directIo = false;
+  private long blockCacheSize = 0;
+  private int maxReadAhead = 1024;
+  private int numThreads = 0;
+  private boolean metrics = false;
   private Callables.LessThan lessThan;
 
   /**
@@ -181,6 +201,407 @@ public class Options {
     this.quiet = quiet;
   }
 
+  /**
+   * Returns {@code true} if the partitions of a map are opened on first access, {@code false}
+   * otherwise.
+   * 
+   * @see #setLazy(boolean)
+   */
+  public boolean isLazy() {
+    return lazy;
+  }
+
+  /**
+   * If set to {@code true}, the partitions of an existing map are not opened when the map is
+   * opened, but when they are accessed for the first time. This flag is useful for short-lived
+   * processes that only touch a few keys. It has no effect when a new map is created. The default
+   * value is {@code false}.
+   */
+  public void setLazy(boolean lazy) {
+    this.lazy = lazy;
+  }
+
+  /**
+   * Returns the additional directories across which the partitions of a new map are spread.
+   * 
+   * @see #setDirectories(String...)
+   */
+  public String[] getDirectories() {
+    return directories.clone();
+  }
+
+  /**
+   * Sets additional directories, e.g. on other devices, across which the partitions of a new map
+   * are spread round-robin, so that their I/O is striped. The map's own directory holds the first
+   * partition and the list of these directories, so an existing map is opened via its own
+   * directory only. Each directory must not be used by another map. This option has no effect
+   * when an existing map is opened. The default value is an empty array.
+   */
+  public void setDirectories(String... directories) {
+    for (String directory : directories) {
+      if (directory == null) {
+        throw new IllegalArgumentException("directories must not contain null");
+      }
+    }
+    this.directories = directories.clone();
+  }
+
+  /**
+   * Returns the false-positive rate of the Bloom filters written for the keys of each partition.
+   * 
+   * @see #setBloomFilterFalsePositiveRate(double)
+   */
+  public double getBloomFilterFalsePositiveRate() {
+    return bloomFilterFalsePositiveRate;
+  }
+
+  /**
+   * If set to a value in (0, 1), each partition stores a Bloom filter of its keys with this
+   * false-positive rate whenever its keys file is rewritten, e.g. by {@link Map#optimize}. Read-only
+   * maps consult the filter before the key index, so that most lookups of absent keys touch neither
+   * locks nor the disk. A rate of 1% costs about 10 bits per key. The default value is 0, which
+   * disables the filter.
+   */
+  public void setBloomFilterFalsePositiveRate(double bloomFilterFalsePositiveRate) {
+    if (!(bloomFilterFalsePositiveRate > 0 && bloomFilterFalsePositiveRate < 1)) {
+      throw new IllegalArgumentException("bloomFilterFalsePositiveRate must be in (0, 1)");
+    }
+    this.bloomFilterFalsePositiveRate = bloomFilterFalsePositiveRate;
+  }
+
+  /**
+   * Returns the false-positive rate of the Bloom filters written for the values of each partition.
+   * 
+   * @see #setValueFilterFalsePositiveRate(double)
+   */
+  public double getValueFilterFalsePositiveRate() {
+    return valueFilterFalsePositiveRate;
+  }
+
+  /**
+   * If set to a value in (0, 1), {@link Map#optimize} also stores a Bloom filter of all pairs of keys
+   * and values with this false-positive rate, so that lookups of absent values in lists that have
+   * not been appended to since are mostly answered without reading the values file. A rate of 1%
+   * costs about 10 bits per value. The default value is 0, which disables the filter.
+   */
+  public void setValueFilterFalsePositiveRate(double valueFilterFalsePositiveRate) {
+    if (!(valueFilterFalsePositiveRate > 0 && valueFilterFalsePositiveRate < 1)) {
+      throw new IllegalArgumentException("valueFilterFalsePositiveRate must be in (0, 1)");
+    }
+    this.valueFilterFalsePositiveRate = valueFilterFalsePositiveRate;
+  }
+
+  /**
+   * Returns {@code true} if the blocks of a map are compressed when written to disk, {@code false}
+   * otherwise.
+   * 
+   * @see #setCompress(boolean)
+   */
+  public boolean isCompress() {
+    return compress;
+  }
+
+  /**
+   * If set to {@code true}, the blocks of a map are compressed when written to disk. Compressed maps
+   * are read-only, so this flag is only supported by {@link Map#optimize(java.nio.file.Path,
+   * java.nio.file.Path, Options)}. An existing compressed map must be opened in read-only mode. The
+   * default value is {@code false}.
+   */
+  public void setCompress(boolean compress) {
+    this.compress = compress;
+  }
+
+  /**
+   * Returns {@code true} if the values of a new map are front-coded, {@code false} otherwise.
+   * 
+   * @see #setFrontCoding(boolean)
+   */
+  public boolean isFrontCoding() {
+    return frontCoding;
+  }
+
+  /**
+   * If set to {@code true}, each value of a new map is stored as the size of the prefix it shares
+   * with the previous value followed by the remaining suffix. This saves space for lists of values
+   * with long common prefixes, such as URLs. It has no effect when an existing map is opened. The
+   * default value is {@code false}.
+   */
+  public void setFrontCoding(boolean frontCoding) {
+    this.frontCoding = frontCoding;
+  }
+
+  /**
+   * Returns the maximum number of bytes held by partially filled blocks of lists in memory.
+   * 
+   * @see #setTailMemoryBudget(long)
+   */
+  public long getTailMemoryBudget() {
+    return tailMemoryBudget;
+  }
+
+  /**
+   * If set to a positive value, a background thread flushes the partially filled tail blocks of
+   * lists that have not been appended to recently, so that the memory they hold stays roughly
+   * within this number of bytes, regardless of the number of keys. Since flushed blocks are padded,
+   * a small budget trades disk space for memory. The default value is 0, which means no limit.
+   */
+  public void setTailMemoryBudget(long tailMemoryBudget) {
+    Check.isPositive(tailMemoryBudget);
+    this.tailMemoryBudget = tailMemoryBudget;
+  }
+
+  /**
+   * Returns {@code true} if updates are recorded in a write-ahead log, {@code false} otherwise.
+   * 
+   * @see #setWriteAheadLog(boolean)
+   */
+  public boolean isWriteAheadLog() {
+    return writeAheadLog;
+  }
+
+  /**
+   * If set to {@code true}, each partition records updates in a write-ahead log before they return,
+   * so that they are not lost if the process crashes. The log is replayed when the map is opened
+   * the next time, which must be done in writable mode. The default value is {@code false}.
+   */
+  public void setWriteAheadLog(boolean writeAheadLog) {
+    this.writeAheadLog = writeAheadLog;
+  }
+
+  /**
+   * Returns {@code true} if updates wait until their log records are on stable storage,
+   * {@code false} otherwise.
+   * 
+   * @see #setSyncWriteAheadLog(boolean)
+   */
+  public boolean isSyncWriteAheadLog() {
+    return syncWriteAheadLog;
+  }
+
+  /**
+   * If set to {@code true}, updates also wait until their log records have been forced to stable
+   * storage, which protects against a crash of the operating system at the cost of one sync per
+   * group of concurrent updates. Only has an effect together with {@link #setWriteAheadLog(boolean)}.
+   * The default value is {@code false}.
+   */
+  public void setSyncWriteAheadLog(boolean syncWriteAheadLog) {
+    this.syncWriteAheadLog = syncWriteAheadLog;
+  }
+
+  /**
+   * Returns the number of seconds between background checkpoints.
+   * 
+   * @see #setCheckpointInterval(int)
+   */
+  public int getCheckpointInterval() {
+    return checkpointInterval;
+  }
+
+  /**
+   * If set to a positive value, a background thread writes the lists that have been modified since
+   * the last checkpoint to disk every this many seconds, so that they survive a crash of the
+   * process, and truncates write-ahead logs, if any. The default value is 0, which means that
+   * checkpoints are only written when the map is closed.
+   */
+  public void setCheckpointInterval(int checkpointInterval) {
+    Check.isPositive(checkpointInterval);
+    this.checkpointInterval = checkpointInterval;
+  }
+
+  /**
+   * Returns the fraction of removed values above which lists are compacted in the background.
+   * 
+   * @see #setCompactionThreshold(double)
+   */
+  public double getCompactionThreshold() {
+    return compactionThreshold;
+  }
+
+  /**
+   * If set to a value in (0, 1], a background thread rewrites lists in which at least this fraction
+   * of values has been removed, so that the space they occupy can be reused by other lists. Freed
+   * blocks are reused after the next checkpoint, or when the map is opened the next time. The
+   * default value is 0, which disables compaction. Has no effect for compressed maps.
+   */
+  public void setCompactionThreshold(double compactionThreshold) {
+    if (!(compactionThreshold > 0 && compactionThreshold <= 1)) {
+      throw new IllegalArgumentException("compactionThreshold must be in (0, 1]");
+    }
+    this.compactionThreshold = compactionThreshold;
+  }
+
+  /**
+   * Returns the maximum number of bytes per second rewritten by background compaction.
+   * 
+   * @see #setCompactionRate(long)
+   */
+  public long getCompactionRate() {
+    return compactionRate;
+  }
+
+  /**
+   * Sets the maximum number of bytes per second that background compaction rewrites, so that it
+   * does not compete with foreground updates for I/O. The default value is 8 MiB.
+   */
+  public void setCompactionRate(long compactionRate) {
+    Check.isPositive(compactionRate);
+    this.compactionRate = compactionRate;
+  }
+
+  /**
+   * Returns whether the data files of a read-only map are read into memory when it is opened.
+   * 
+   * @see #setPopulate(boolean)
+   */
+  public boolean isPopulate() {
+    return populate;
+  }
+
+  /**
+   * If set to {@code true}, the data files of a read-only map are read into memory when the map is
+   * opened, so that the first lookups do not have to wait for disk I/O. The default value is
+   * {@code false}.
+   */
+  public void setPopulate(boolean populate) {
+    this.populate = populate;
+  }
+
+  /**
+   * Returns whether huge pages are requested for the data files of a read-only map.
+   * 
+   * @see #setHugePages(boolean)
+   */
+  public boolean isHugePages() {
+    return hugePages;
+  }
+
+  /**
+   * If set to {@code true}, transparent huge pages are requested for the data files of a read-only
+   * map, which makes random lookups faster if the map is held in memory. This is only a hint to
+   * the operating system. The default value is {@code false}.
+   */
+  public void setHugePages(boolean hugePages) {
+    this.hugePages = hugePages;
+  }
+
+  /**
+   * Returns whether the data files of a read-only map are locked into memory.
+   * 
+   * @see #setLockInMemory(boolean)
+   */
+  public boolean isLockInMemory() {
+    return lockInMemory;
+  }
+
+  /**
+   * If set to {@code true}, the data files of a read-only map are locked into memory, so that they
+   * cannot be paged out. Opening the map fails if this exceeds the limit for locked memory of the
+   * process. The default value is {@code false}.
+   */
+  public void setLockInMemory(boolean lockInMemory) {
+    this.lockInMemory = lockInMemory;
+  }
+
+  /**
+   * Returns whether the data files of a read-only map are read via direct I/O.
+   * 
+   * @see #setDirectIo(boolean)
+   */
+  public boolean isDirectIo() {
+    return directIo;
+  }
+
+  /**
+   * If set to {@code true}, the data files of a read-only map that is not compressed are read via
+   * direct I/O, bypassing the page cache of the operating system. This gives predictable memory
+   * usage and latency for maps that are much larger than memory, especially in combination with
+   * {@link #setBlockCacheSize(long)}. The default value is {@code false}.
+   */
+  public void setDirectIo(boolean directIo) {
+    this.directIo = directIo;
+  }
+
+  /**
+   * Returns the number of bytes used to cache blocks.
+   * 
+   * @see #setBlockCacheSize(long)
+   */
+  public long getBlockCacheSize() {
+    return blockCacheSize;
+  }
+
+  /**
+   * Sets the number of bytes of a block cache that is shared by all partitions of a read-only map
+   * that is compressed or uses direct I/O, so that hot lists are not decompressed or read from
+   * disk repeatedly. The default value is 0, which means that no blocks are cached.
+   */
+  public void setBlockCacheSize(long blockCacheSize) {
+    Check.isPositive(blockCacheSize);
+    this.blockCacheSize = blockCacheSize;
+  }
+
+  /**
+   * Returns the maximum number of blocks that an iterator reads at once.
+   * 
+   * @see #setMaxReadAhead(int)
+   */
+  public int getMaxReadAhead() {
+    return maxReadAhead;
+  }
+
+  /**
+   * Sets the maximum number of blocks that an iterator reads at once. An iterator starts with a few
+   * blocks and doubles the number with each read until this limit is reached. The default value is
+   * 1024.
+   */
+  public void setMaxReadAhead(int maxReadAhead) {
+    Check.isPositive(maxReadAhead);
+    this.maxReadAhead = maxReadAhead;
+  }
+
+  /**
+   * Returns the number of worker threads used by bulk operations.
+   * 
+   * @see #setNumThreads(int)
+   */
+  public int getNumThreads() {
+    return numThreads;
+  }
+
+  /**
+   * Defines the number of worker threads used by bulk operations such as optimize, and for closing
+   * the partitions of a writable map concurrently. If set to 0, which is also the default, the
+   * number of hardware threads is used. If a callable for comparing
+   * values is set, operations run single-threaded, because the callable must be invoked from the
+   * calling Java thread.
+   * 
+   * @see Map#optimize(java.nio.file.Path, java.nio.file.Path, Options)
+   */
+  public void setNumThreads(int numThreads) {
+    Check.isPositive(numThreads);
+    this.numThreads = numThreads;
+  }
+
+  /**
+   * Returns whether the map records latencies of its operations.
+   * 
+   * @see #setMetrics(boolean)
+   */
+  public boolean isMetrics() {
+    return metrics;
+  }
+
+  /**
+   * Determines whether the map records latency histograms of its operations and the number of
+   * bytes read and written. A writable map saves the metrics when it is closed. The default value
+   * is {@code false}.
+   * 
+   * @see Map#getMetrics()
+   */
+  public void setMetrics(boolean metrics) {
+    this.metrics = metrics;
+  }
+
   /**
    * Returns the callable used for comparing values. May be {@code null} if no sorting is desired.
    * 
@@ -0,0 +1,340 @@
+/*
+ * This file is part of Multimap.  http://multimap.io
+ *
+ * Copyright (C) 2015-2016  Martin Trenkmann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+package io.multimap;
+
+import java.nio.file.Files;
+import java.nio.file.Paths;
+import java.util.Arrays;
+import java.util.Random;
+
+/**
+ * Drives a {@link Map} through the JNI bindings with the same workload as the native
+ * {@code multimap-workload} tool, so that the overhead of the bindings can be measured. Run
+ * {@code java io.multimap.WorkloadDriver --help} for a list of options.
+ */
+public class WorkloadDriver {
+
+  private static final String SEQUENTIAL = "sequential";
+  private static final String UNIFORM = "uniform";
+  private static final String ZIPFIAN = "zipfian";
+
+  private String map;
+  private String distribution = ZIPFIAN;
+  private boolean create = false;
+  private long numKeys = 100000;
+  private long listLength = 10;
+  private long numOps = 1000000;
+  private int numPartitions = 23;
+  private int numThreads = 1;
+  private int valueSize = 100;
+  private long seed = 1;
+  private double readRatio = 0.95;
+
+  private interface KeyGenerator {
+    long next();
+  }
+
+  private static class SequenceGenerator implements KeyGenerator {
+    private final long numUnique;
+    private long state;
+
+    SequenceGenerator(long start, long numUnique) {
+      this.numUnique = numUnique;
+      this.state = start;
+    }
+
+    @Override
+    public long next() {
+      return state++ % numUnique;
+    }
+  }
+
+  private static class UniformGenerator implements KeyGenerator {
+    private final long numUnique;
+    private final Random random;
+
+    UniformGenerator(long numUnique, long seed) {
+      this.numUnique = numUnique;
+      this.random = new Random(seed);
+    }
+
+    @Override
+    public long next() {
+      return (random.nextLong() & Long.MAX_VALUE) % numUnique;
+    }
+  }
+
+  /**
+   * Same algorithm as {@code multimap::internal::ZipfianGenerator}.
+   */
+  private static class ZipfianGenerator implements KeyGenerator {
+    private final long numUnique;
+    private final double theta;
+    private final double zetaN;
+    private final double alpha;
+    private final double eta;
+    private final Random random;
+
+    ZipfianGenerator(long numUnique, double theta, long seed) {
+      this.numUnique = numUnique;
+      this.theta = theta;
+      this.zetaN = zeta(numUnique, theta);
+      this.alpha = 1 / (1 - theta);
+      this.eta = (1 - Math.pow(2.0 / numUnique, 1 - theta)) / (1 - zeta(2, theta) / zetaN);
+      this.random = new Random(seed);
+    }
+
+    @Override
+    public long next() {
+      final double u = random.nextDouble();
+      final double uz = u * zetaN;
+      if (uz < 1) return 0;
+      if (uz < 1 + Math.pow(0.5, theta)) return 1;
+      final long rank = (long) (numUnique * Math.pow(eta * u - eta + 1, alpha));
+      return Math.min(rank, numUnique - 1);
+    }
+
+    private static double zeta(long n, double theta) {
+      double sum = 0;
+      for (long i = 1; i <= n; ++i) {
+        sum += 1 / Math.pow(i, theta);
+      }
+      return sum;
+    }
+  }
+
+  private interface Task {
+    void run(int index) throws Exception;
+  }
+
+  private static void check(boolean expression, String format, Object... args) {
+    if (!expression) {
+      throw new IllegalArgumentException(String.format(format, args));
+    }
+  }
+
+  private static void printHelp() {
+    System.out.println("USAGE\n"
+        + "\n  java io.multimap.WorkloadDriver path/to/map [OPTIONS]\n"
+        + "\nSame as the native multimap-workload tool, see its --help for a list of options.\n");
+  }
+
+  private void parseCommandLine(String[] args) {
+    map = args[0];
+    for (int i = 1; i < args.length; ++i) {
+      final String option = args[i];
+      if (option.equals("--create")) {
+        create = true;
+        continue;
+      }
+      check(i + 1 < args.length, "No value given for '%s'", option);
+      final String value = args[++i];
+      switch (option) {
+        case "--distribution":
+          check(value.equals(SEQUENTIAL) || value.equals(UNIFORM) || value.equals(ZIPFIAN),
+              "Invalid distribution '%s'", value);
+          distribution = value;
+          break;
+        case "--keys":
+          numKeys = Long.parseLong(value);
+          check(numKeys >= 2, "Expected at least 2 keys");
+          break;
+        case "--list-length":
+          listLength = Long.parseLong(value);
+          break;
+        case "--nparts":
+          numPartitions = Integer.parseInt(value);
+          break;
+        case "--ops":
+          numOps = Long.parseLong(value);
+          break;
+        case "--reads":
+          readRatio = Double.parseDouble(value);
+          check(readRatio >= 0 && readRatio <= 1, "Invalid ratio of reads '%s'", value);
+          break;
+        case "--seed":
+          seed = Long.parseLong(value);
+          break;
+        case "--threads":
+          numThreads = Integer.parseInt(value);
+          check(numThreads != 0, "Expected at least 1 thread");
+          break;
+        case "--value-size":
+          valueSize = Integer.parseInt(value);
+          break;
+        default:
+          check(false, "Expected option when reading '%s'", option);
+      }
+    }
+  }
+
+  private KeyGenerator newKeyGenerator(int threadIndex) {
+    if (distribution.equals(SEQUENTIAL)) {
+      return new SequenceGenerator(numKeys / numThreads * threadIndex, numKeys);
+    }
+    if (distribution.equals(UNIFORM)) {
+      return new UniformGenerator(numKeys, seed + threadIndex);
+    }
+    return new ZipfianGenerator(numKeys, 0.99, seed + threadIndex);
+  }
+
+  private double runInParallel(final Task task) throws Exception {
+    final long start = System.nanoTime();
+    final Thread[] threads = new Thread[numThreads];
+    final Exception[] errors = new Exception[numThreads];
+    for (int i = 0; i != numThreads; ++i) {
+      final int index = i;
+      threads[i] = new Thread(new Runnable() {
+        @Override
+        public void run() {
+          try {
+            task.run(index);
+          } catch (Exception e) {
+            errors[index] = e;
+          }
+        }
+      });
+      threads[i].start();
+    }
+    for (Thread thread : threads) {
+      thread.join();
+    }
+    for (Exception error : errors) {
+      if (error != null) throw error;
+    }
+    return (System.nanoTime() - start) / 1e9;
+  }
+
+  private static void printThroughput(String phase, long numOps, double seconds) {
+    System.out.printf("%-6s %12d ops %10.3f s %14.0f ops/s\n", phase, numOps, seconds,
+        numOps / seconds);
+  }
+
+  private static void printLatencies(String name, long[][] latencies) {
+    int count = 0;
+    for (long[] values : latencies) {
+      count += values.length;
+    }
+    final long[] all = new long[count];
+    int offset = 0;
+    double sum = 0;
+    for (long[] values : latencies) {
+      System.arraycopy(values, 0, all, offset, values.length);
+      offset += values.length;
+      for (long value : values) {
+        sum += value;
+      }
+    }
+    Arrays.sort(all);
+    System.out.printf("%-6s %12d ops %10.1f %10.1f %10.1f %10.1f %10.1f\n", name, count,
+        count == 0 ? 0 : sum / count / 1e3, quantile(all, 0.5) / 1e3, quantile(all, 0.9) / 1e3,
+        quantile(all, 0.99) / 1e3, count == 0 ? 0 : all[count - 1] / 1e3);
+  }
+
+  private static double quantile(long[] sorted, double q) {
+    if (sorted.length == 0) return 0;
+    return sorted[(int) Math.min(sorted.length - 1, (long) (q * sorted.length))];
+  }
+
+  private void runWorkload() throws Exception {
+    final boolean exists = Files.exists(Paths.get(map, "multimap.map.id"));
+    final Options options = new Options();
+    options.setCreateIfMissing(create);
+    options.setNumPartitions(numPartitions);
+    options.setQuiet(true);
+    final byte[] value = new byte[valueSize];
+    Arrays.fill(value, (byte) 'v');
+
+    try (final Map map = new Map(this.map, options)) {
+      if (!exists) {
+        final double seconds = runInParallel(new Task() {
+          @Override
+          public void run(int index) throws Exception {
+            for (long k = index; k < numKeys; k += numThreads) {
+              final byte[] key = Utils.toByteArray(Long.toString(k));
+              for (long v = 0; v != listLength; ++v) {
+                map.put(key, value);
+              }
+            }
+          }
+        });
+        printThroughput("load", numKeys * listLength, seconds);
+      }
+
+      final long[][] readLatencies = new long[numThreads][];
+      final long[][] writeLatencies = new long[numThreads][];
+      final double seconds = runInParallel(new Task() {
+        @Override
+        public void run(int index) throws Exception {
+          final KeyGenerator generator = newKeyGenerator(index);
+          final Random random = new Random(seed + index);
+          final int numOpsOfThread =
+              (int) (numOps / numThreads + (index < numOps % numThreads ? 1 : 0));
+          long[] reads = new long[numOpsOfThread];
+          long[] writes = new long[numOpsOfThread];
+          int numReads = 0;
+          int numWrites = 0;
+          for (int i = 0; i != numOpsOfThread; ++i) {
+            final byte[] key = Utils.toByteArray(Long.toString(generator.next()));
+            if (random.nextDouble() < readRatio) {
+              final long start = System.nanoTime();
+              try (Iterator iter = map.get(key)) {
+                while (iter.hasNext()) {
+                  iter.next();
+                }
+              }
+              reads[numReads++] = System.nanoTime() - start;
+            } else {
+              final long start = System.nanoTime();
+              map.put(key, value);
+              writes[numWrites++] = System.nanoTime() - start;
+            }
+          }
+          readLatencies[index] = Arrays.copyOf(reads, numReads);
+          writeLatencies[index] = Arrays.copyOf(writes, numWrites);
+        }
+      });
+      printThroughput("run", numOps, seconds);
+
+      System.out.printf("\n%-6s %16s %10s %10s %10s %10s %10s\n", "op", "", "avg us", "p50 us",
+          "p90 us", "p99 us", "max us");
+      printLatencies("read", readLatencies);
+      printLatencies("write", writeLatencies);
+    }
+  }
+
+  public static void main(String[] args) {
+    if (args.length == 0 || args[0].equals("--help")) {
+      printHelp();
+      System.exit(args.length == 0 ? 1 : 0);
+    }
+    try {
+      final WorkloadDriver driver = new WorkloadDriver();
+      driver.parseCommandLine(args);
+      driver.runWorkload();
+    } catch (IllegalArgumentException e) {
+      System.err.println("Invalid command line: " + e.getMessage() + ".");
+      System.exit(1);
+    } catch (Exception e) {
+      System.err.println(e.getMessage() + ".");
+      System.exit(1);
+    }
+  }
+}
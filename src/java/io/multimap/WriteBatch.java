@@ -0,0 +1,102 @@
+/*
+ * This file is part of Multimap.  http://multimap.io
+ *
+ * Copyright (C) 2015-2016  Martin Trenkmann
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+package io.multimap;
+
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+
+/**
+ * This class collects puts that are applied at once via {@link Map#write(WriteBatch)}, which is
+ * much faster than calling {@link Map#put(byte[], byte[])} for each of them. Keys and values are
+ * copied into a direct buffer, so that the arrays can be reused after {@link #put(byte[], byte[])}
+ * returns. Objects of this class are not thread-safe.
+ * 
+ * @since 0.6.0
+ */
+public class WriteBatch {
+
+  private static final int INITIAL_CAPACITY = 4096;
+
+  private ByteBuffer records = allocate(INITIAL_CAPACITY);
+  private int size = 0;
+
+  /**
+   * Adds a put of {@code value} for {@code key}. The sizes are checked when the batch is written.
+   */
+  public void put(byte[] key, byte[] value) {
+    Check.notNull(key);
+    Check.notNull(value);
+    reserve(8 + key.length + value.length);
+    records.putInt(key.length).put(key).putInt(value.length).put(value);
+    ++size;
+  }
+
+  /**
+   * Same as before, but taking {@code key} as string instead of byte array. Internally the key is
+   * converted into a byte array via {@link Utils#toByteArray(String)}.
+   */
+  public void put(String key, byte[] value) {
+    put(Utils.toByteArray(key), value);
+  }
+
+  /**
+   * Returns the number of puts.
+   */
+  public int size() {
+    return size;
+  }
+
+  /**
+   * Returns {@code true} if the batch contains no puts.
+   */
+  public boolean isEmpty() {
+    return size == 0;
+  }
+
+  /**
+   * Removes all puts, but keeps the allocated memory for reuse.
+   */
+  public void clear() {
+    records.clear();
+    size = 0;
+  }
+
+  // Returns the records in the format of Map.putAll() up to the buffer's position.
+  ByteBuffer getRecords() {
+    return records;
+  }
+
+  private void reserve(int numBytes) {
+    if (records.remaining() < numBytes) {
+      int capacity = records.capacity();
+      while (capacity - records.position() < numBytes) {
+        capacity *= 2;
+      }
+      ByteBuffer larger = allocate(capacity);
+      records.flip();
+      larger.put(records);
+      records = larger;
+    }
+  }
+
+  private static ByteBuffer allocate(int capacity) {
+    return ByteBuffer.allocateDirect(capacity).order(ByteOrder.nativeOrder());
+  }
+}